@@ -0,0 +1,75 @@
+#
+#  Profile guided optimisation.
+#
+#  Usage:
+#
+#	make clean
+#	make pgo
+#
+#  The tree is built twice.  The first build is instrumented with
+#  -fprofile-generate, and the RADIUS encode/decode benchmark is run
+#  against it to collect profiles.  The objects are then removed, and
+#  the tree is rebuilt with -fprofile-use, so that hot paths seen
+#  during the benchmark are laid out and predicted accordingly.
+#
+#  @todo - check for llvm-profdata when building with clang.
+#
+
+PGO_PROFILE_DIR := $(abspath $(BUILD_DIR))/pgo
+
+#
+#  How many times the benchmark re-runs each encode/decode.  Larger
+#  values give more stable profiles, at the cost of training time.
+#
+PGO_ITERATIONS	:= 10000
+
+#
+#  The training workload.  The RADIUS protocol unit test files
+#  exercise the packet encoder and decoder, which is where the
+#  server spends most of its time under load.
+#
+PGO_WORKLOAD	:= $(wildcard src/tests/unit/protocols/radius/*.txt)
+
+#
+#  clang writes raw profiles which have to be merged before they can
+#  be used.  gcc profiles are used directly from the directory, with
+#  -fprofile-correction to tolerate racy counter updates from
+#  threaded code.
+#
+ifneq "$(findstring clang,$(shell $(CC) --version 2>/dev/null))" ""
+PGO_MERGE	= llvm-profdata merge -output=$(PGO_PROFILE_DIR)/default.profdata $(PGO_PROFILE_DIR)
+PGO_USE_FLAGS	= -fprofile-use=$(PGO_PROFILE_DIR)/default.profdata
+else
+PGO_MERGE	= true
+PGO_USE_FLAGS	= -fprofile-use=$(PGO_PROFILE_DIR) -fprofile-correction
+endif
+
+#
+#  Order is important here, and the dependencies in the rest of the
+#  makefiles aren't quite there to allow for these to be targets.
+#  So, as with "make coverage", we just run the steps one after the
+#  other.
+#
+pgo:
+	${Q}echo "PGO - building instrumented binaries"
+	${Q}mkdir -p $(PGO_PROFILE_DIR)
+	${Q}$(MAKE) CFLAGS="$(CFLAGS) -fprofile-generate=$(PGO_PROFILE_DIR)" \
+		LDFLAGS="$(LDFLAGS) -fprofile-generate=$(PGO_PROFILE_DIR)"
+	${Q}echo "PGO - running the training workload"
+	${Q}for x in $(PGO_WORKLOAD); do \
+		$(TESTBIN)/unit_test_attribute -b $(PGO_ITERATIONS) \
+			-D share/dictionary -d src/tests/unit $$x > /dev/null || exit 1; \
+	done
+	${Q}$(PGO_MERGE)
+	${Q}echo "PGO - rebuilding with the collected profiles"
+	${Q}rm -rf $(BUILD_DIR)/objs $(BUILD_DIR)/bin $(BUILD_DIR)/lib
+	${Q}$(MAKE) CFLAGS="$(CFLAGS) $(PGO_USE_FLAGS)" \
+		LDFLAGS="$(LDFLAGS)"
+
+#
+#  Clean the collected profiles, too.
+#
+clean: clean.pgo
+.PHONY: clean.pgo
+clean.pgo:
+	${Q}rm -rf $(PGO_PROFILE_DIR)
@@ -0,0 +1,132 @@
+#!/usr/bin/perl
+
+#  Purpose: build a read-only cache file for the rlm_cache_mmap driver.
+#
+#  Input is a flat text file of cache entries separated by blank lines.
+#  The first line of each entry is the cache key, the remaining lines
+#  are attributes in the format produced by rlm_cache's serializer,
+#  e.g.:
+#
+#      00:11:22:33:44:55
+#      &control:Device-Type := 'printer'
+#      &control:Device-OS := 'lexmark'
+#
+#      00:11:22:33:44:56
+#      &control:Device-Type := 'phone'
+#
+#  The output file layout is described in rlm_cache_mmap.c: a header,
+#  an open addressed hash table of entry offsets (fr_hash of the key,
+#  linear probing), then the 8-byte aligned entries themselves.
+#
+#  Usage: create-cache-mmap.pl <input.txt> <output.cache>
+#
+#  Build the output under a temporary name and rename it over the old
+#  file; the running server keeps serving from the old mapping until
+#  it is re-HUP'd.
+
+use strict;
+use warnings;
+
+my $MAGIC = 0x4d434346;
+my $VERSION = 1;
+my $HEADER_LEN = 40;
+
+#  FNV-1 32-bit, must match fr_hash() in src/lib/util/hash.c
+sub fr_hash {
+	my ($data) = @_;
+	my $hash = 0x811c9dc5;
+
+	foreach my $byte (unpack('C*', $data)) {
+		$hash ^= $byte;
+		$hash = ($hash * 0x01000193) % 4294967296;
+	}
+
+	return $hash;
+}
+
+if (@ARGV != 2) {
+	print "\n\tUsage:  $0  <input.txt> <output.cache>\n\n";
+	exit(1);
+}
+
+my ($input, $output) = @ARGV;
+
+#
+#  Read the entries.
+#
+my @entries;
+my ($key, $data);
+
+open(my $in, '<', $input) || die "Can't open $input: $!";
+while (my $line = <$in>) {
+	chomp $line;
+
+	if ($line eq '') {
+		push @entries, [ $key, $data ] if defined $key;
+		undef $key;
+		undef $data;
+		next;
+	}
+
+	if (!defined $key) {
+		$key = $line;
+		$data = '';
+		next;
+	}
+
+	$data .= $line . "\n";
+}
+push @entries, [ $key, $data ] if defined $key;
+close($in);
+
+die "No entries found in $input\n" if !@entries;
+
+#
+#  Size the hash table for a load factor of at most ~0.7.
+#
+my $buckets = 1;
+$buckets *= 2 while ($buckets < (scalar(@entries) / 0.7));
+
+#
+#  Lay out the entries after the hash table, 8-byte aligned.
+#
+my $table_offset = $HEADER_LEN;
+my $offset = $table_offset + ($buckets * 8);
+my $blob = '';
+my @table = (0) x $buckets;
+
+foreach my $entry (@entries) {
+	my ($k, $d) = @$entry;
+
+	#
+	#  Insert with linear probing.
+	#
+	my $slot = fr_hash($k) % $buckets;
+	my $probed = 0;
+	while ($table[$slot] != 0) {
+		$slot = ($slot + 1) % $buckets;
+		die "Hash table full, duplicate keys?\n" if (++$probed > $buckets);
+	}
+	$table[$slot] = $offset;
+
+	my $record = pack('VV', length($k), length($d)) . $k . $d;
+	$record .= "\0" x ((8 - (length($record) % 8)) % 8);
+
+	$blob .= $record;
+	$offset += length($record);
+}
+
+#
+#  Write the file.
+#
+open(my $out, '>', $output) || die "Can't open $output: $!";
+binmode($out);
+
+print $out pack('VV', $MAGIC, $VERSION);
+print $out pack('Q<Q<Q<Q<', $buckets, scalar(@entries), $table_offset, $offset);
+print $out pack('Q<*', @table);
+print $out $blob;
+
+close($out) || die "Can't write $output: $!";
+
+printf "Wrote %d entries (%d buckets, %d bytes) to %s\n", scalar(@entries), $buckets, $offset, $output;
@@ -2,6 +2,7 @@ SUBMAKEFILES := \
     radclient.mk \
     radict.mk \
     radiusd.mk \
+    radreplay.mk \
     radsniff.mk \
     radwho.mk \
     radsnmp.mk \
@@ -9,6 +10,7 @@ SUBMAKEFILES := \
     radtest.mk \
     radzap.mk \
     unit_test_attribute.mk \
+    unit_test_benchmark.mk \
     unit_test_map.mk \
     unit_test_module.mk \
     checkrad.mk
@@ -33,6 +33,8 @@ RCSID("$Id$")
 #include <freeradius-devel/radius/list.h>
 #include <freeradius-devel/radius/radius.h>
 #include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
 
 #ifdef HAVE_GETOPT_H
 #  include <getopt.h>
@@ -179,6 +181,9 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -s                     Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <threads>           Load-test mode.  Spawn 'threads' senders, each sending the first\n");
+	fprintf(stderr, "                         input packet '-c count' times at the open-loop rate given by '-n',\n");
+	fprintf(stderr, "                         and print latency/loss statistics.\n");
 	fprintf(stderr, "  -v                     Show program version information.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -1166,6 +1171,280 @@ fr_radius_packet_free(&request->reply);
 	return 0;
 }
 
+/*
+ *	Load-test mode.  Each sender thread encodes the first input
+ *	packet once, then re-sends it in an open loop at the target
+ *	rate, mutating the RADIUS ID (and re-signing) per send.
+ *	Latencies are collected in log2 microsecond buckets, which is
+ *	coarse, but enough to read p50/p99 off without any allocation
+ *	in the send path.
+ */
+#define RC_LOADGEN_BUCKETS (40)
+
+static int loadgen_threads = 0;
+static int loadgen_rate = 0;
+
+typedef struct {
+	pthread_t	handle;
+	int		num;			//!< Thread number, 0..N.
+	int		sockfd;			//!< Socket private to this thread.
+
+	bool		failed;			//!< Whether setup or sending failed.
+
+	uint64_t	sent;			//!< Packets sent.
+	uint64_t	received;		//!< Replies seen.
+	uint64_t	lost;			//!< IDs reused or unanswered at exit.
+
+	fr_time_delta_t	latency_min;
+	fr_time_delta_t	latency_max;
+	uint64_t	latency_bucket[RC_LOADGEN_BUCKETS];	//!< log2(latency in usec) counts.
+} rc_loadgen_thread_t;
+
+static inline int rc_loadgen_bucket(uint64_t usec)
+{
+	int b = 0;
+
+	while ((usec > 1) && (b < (RC_LOADGEN_BUCKETS - 1))) {
+		usec >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+/** Record a reply against the timestamp of the request it answers
+ *
+ */
+static void rc_loadgen_reply(rc_loadgen_thread_t *t, fr_time_t *ts, uint8_t id, fr_time_t now)
+{
+	fr_time_delta_t latency;
+
+	if (!ts[id]) return;	/* Not one of ours, or already answered */
+
+	latency = now - ts[id];
+	ts[id] = 0;
+
+	t->received++;
+	t->latency_bucket[rc_loadgen_bucket((uint64_t)latency / 1000)]++;
+
+	if (!t->latency_min || (latency < t->latency_min)) t->latency_min = latency;
+	if (latency > t->latency_max) t->latency_max = latency;
+}
+
+static void *rc_loadgen_worker(void *arg)
+{
+	rc_loadgen_thread_t	*t = arg;
+	RADIUS_PACKET		*packet;
+	fr_time_t		ts[256];
+	fr_time_t		start, deadline;
+	fr_time_delta_t		interval = 0;
+	uint64_t		count, in_flight = 0;
+	uint8_t			buffer[4096];
+
+	memset(ts, 0, sizeof(ts));
+
+	t->sockfd = fr_socket_client_udp(&client_ipaddr, NULL, &server_ipaddr, server_port, false);
+	if (t->sockfd < 0) {
+		ERROR("Failed opening socket: %s", fr_strerror());
+	fail:
+		t->failed = true;
+		return NULL;
+	}
+
+	/*
+	 *	Encode the template once.  Each send only rewrites the
+	 *	ID and re-signs, so the Request Authenticator (and
+	 *	therefore any encrypted attributes) stay valid.
+	 */
+	packet = fr_radius_alloc(NULL, true);
+	if (!packet) goto fail;
+
+	packet->code = request_head->packet->code;
+	packet->id = 0;
+	packet->sockfd = -1;
+	packet->src_ipaddr = client_ipaddr;
+	packet->dst_ipaddr = server_ipaddr;
+	packet->dst_port = server_port;
+
+	if ((fr_pair_list_copy(packet, &packet->vps, request_head->packet->vps) < 0) ||
+	    (fr_radius_packet_encode(packet, NULL, secret) < 0)) {
+		ERROR("Failed encoding packet: %s", fr_strerror());
+		goto fail;
+	}
+
+	/*
+	 *	The rate is split evenly over the sender threads.  Each
+	 *	send is scheduled from the start time, not from the
+	 *	previous send, so a slow server doesn't throttle us
+	 *	(open-loop).
+	 */
+	if (loadgen_rate > 0) interval = ((fr_time_delta_t) NSEC * loadgen_threads) / loadgen_rate;
+
+	start = fr_time();
+
+	for (count = 0; count < (uint64_t) resend_count; count++) {
+		uint8_t		id = count & 0xff;
+		fr_time_t	now;
+		ssize_t		len;
+
+		packet->id = id;
+		packet->data[1] = id;
+		if (fr_radius_packet_sign(packet, NULL, secret) < 0) {
+			ERROR("Failed signing packet: %s", fr_strerror());
+			goto fail;
+		}
+
+		/*
+		 *	The ID space wrapped before the reply arrived.
+		 */
+		if (ts[id]) {
+			t->lost++;
+			in_flight--;
+		}
+
+		if (send(t->sockfd, packet->data, packet->data_len, 0) < 0) {
+			ERROR("Failed sending packet: %s", fr_syserror(errno));
+			goto fail;
+		}
+		ts[id] = fr_time();
+		t->sent++;
+		in_flight++;
+
+		/*
+		 *	Drain any replies which have arrived.
+		 */
+		while ((len = recv(t->sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) >= RADIUS_HEADER_LENGTH) {
+			now = fr_time();
+			if (ts[buffer[1]]) in_flight--;
+			rc_loadgen_reply(t, ts, buffer[1], now);
+		}
+
+		if (interval) {
+			fr_time_t next = start + ((count + 1) * interval);
+
+			now = fr_time();
+			if (next > now) {
+				struct timespec wait = fr_time_delta_to_timespec(next - now);
+
+				nanosleep(&wait, NULL);
+			}
+		}
+	}
+
+	/*
+	 *	Linger for the usual timeout waiting for outstanding
+	 *	replies.
+	 */
+	deadline = fr_time() + timeout;
+	while (in_flight && (fr_time() < deadline)) {
+		struct pollfd	pfd = { .fd = t->sockfd, .events = POLLIN };
+		ssize_t		len;
+
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		while ((len = recv(t->sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) >= RADIUS_HEADER_LENGTH) {
+			if (ts[buffer[1]]) in_flight--;
+			rc_loadgen_reply(t, ts, buffer[1], fr_time());
+		}
+	}
+	t->lost += in_flight;
+
+	talloc_free(packet);
+	close(t->sockfd);
+
+	return NULL;
+}
+
+/** Run the sender threads, then aggregate and print their statistics
+ *
+ * @return 0 if every thread started and nothing was lost, else 1.
+ */
+static int rc_loadgen(void)
+{
+	rc_loadgen_thread_t	*threads;
+	fr_time_t		start;
+	fr_time_delta_t		elapsed;
+	uint64_t		sent = 0, received = 0, lost = 0;
+	uint64_t		bucket[RC_LOADGEN_BUCKETS];
+	fr_time_delta_t		latency_min = 0, latency_max = 0;
+	int			i, failed = 0;
+
+	threads = talloc_zero_array(NULL, rc_loadgen_thread_t, loadgen_threads);
+	if (!threads) {
+		ERROR("Out of memory");
+		return 1;
+	}
+	memset(bucket, 0, sizeof(bucket));
+
+	start = fr_time();
+
+	for (i = 0; i < loadgen_threads; i++) {
+		threads[i].num = i;
+		if (pthread_create(&threads[i].handle, NULL, rc_loadgen_worker, &threads[i]) != 0) {
+			ERROR("Failed creating sender thread %i", i);
+			talloc_free(threads);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < loadgen_threads; i++) {
+		int j;
+
+		pthread_join(threads[i].handle, NULL);
+
+		if (threads[i].failed) failed++;
+
+		sent += threads[i].sent;
+		received += threads[i].received;
+		lost += threads[i].lost;
+
+		for (j = 0; j < RC_LOADGEN_BUCKETS; j++) bucket[j] += threads[i].latency_bucket[j];
+
+		if (threads[i].latency_min &&
+		    (!latency_min || (threads[i].latency_min < latency_min))) latency_min = threads[i].latency_min;
+		if (threads[i].latency_max > latency_max) latency_max = threads[i].latency_max;
+	}
+
+	elapsed = fr_time() - start;
+	if (!elapsed) elapsed = 1;
+
+	printf("Threads   : %i (%i failed)\n", loadgen_threads, failed);
+	printf("Sent      : %" PRIu64 "\n", sent);
+	printf("Received  : %" PRIu64 "\n", received);
+	printf("Lost      : %" PRIu64 " (%.2f%%)\n", lost,
+	       sent ? (100.0 * (double) lost) / (double) sent : 0.0);
+	printf("Rate      : %.0f packets/s\n", ((double) sent * NSEC) / (double) elapsed);
+
+	if (received) {
+		double p[] = { 50.0, 90.0, 99.0, 99.9 };
+		size_t j;
+
+		printf("Latency   : min %.3fms, max %.3fms\n",
+		       (double) latency_min / 1000000.0, (double) latency_max / 1000000.0);
+
+		for (j = 0; j < NUM_ELEMENTS(p); j++) {
+			uint64_t	threshold = (uint64_t) (((double) received * p[j]) / 100.0);
+			uint64_t	seen = 0;
+			int		b;
+
+			for (b = 0; b < RC_LOADGEN_BUCKETS; b++) {
+				seen += bucket[b];
+				if (seen >= threshold) break;
+			}
+
+			/*
+			 *	Buckets are log2 microseconds, so the
+			 *	percentiles are upper bounds.
+			 */
+			printf("  p%-5.4g <= %.3fms\n", p[j], (double) (UINT64_C(1) << b) / 1000.0);
+		}
+	}
+
+	talloc_free(threads);
+
+	return (!failed && (lost == 0)) ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
 	int		c;
@@ -1211,7 +1490,7 @@ int main(int argc, char **argv)
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "46c:d:D:f:Fhn:p:P:qr:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46c:d:D:f:Fhn:p:P:qr:sS:t:T:vx")) != -1) switch (c) {
 		case '4':
 			force_af = AF_INET;
 			break;
@@ -1341,6 +1620,12 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			if (!isdigit((int) *optarg)) usage();
+			loadgen_threads = atoi(optarg);
+			if (loadgen_threads <= 0) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1516,6 +1801,20 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/*
+	 *	Load-test mode takes over from here, using its own
+	 *	sockets and the first input packet as a template.
+	 */
+	if (loadgen_threads > 0) {
+		if (ipproto == IPPROTO_TCP) {
+			ERROR("Load-test mode (-T) only supports UDP");
+			exit(1);
+		}
+
+		loadgen_rate = persec;
+		exit(rc_loadgen());
+	}
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
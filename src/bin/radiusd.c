@@ -36,6 +36,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/state.h>
+#include <freeradius-devel/server/stats_shm.h>
 #include <freeradius-devel/server/virtual_servers.h>
 
 #include <freeradius-devel/tls/base.h>
@@ -502,6 +503,14 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
+	/*
+	 *	Start loading the dictionaries on a second thread.
+	 *	They load in parallel with the config file read in
+	 *	main_config_init(), which joins before anything
+	 *	needs them.
+	 */
+	if (main_config_dict_preload(config) < 0) EXIT_WITH_FAILURE;
+
 #ifdef HAVE_OPENSSL_CRYPTO_H
 	if (tls_dict_init() < 0) {
 		fr_perror("%s", program);
@@ -716,11 +725,34 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
+#ifdef WITH_STATS
+	/*
+	 *	Start mirroring the statistics counters into shared
+	 *	memory, so monitoring agents don't need to query them
+	 *	via Status-Server.
+	 */
+	if (config->stats_shm_path &&
+	    (fr_stats_shm_init(main_loop_event_list(), config->stats_shm_path) < 0)) {
+		EXIT_WITH_FAILURE;
+	}
+#endif
+
 	/*
 	 *  Redirect stderr/stdout as appropriate.
 	 */
 	if (log_global_init(&default_log, config->daemonize) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *  Hand log writes off to a dedicated logger thread, so the
+	 *  network and worker threads don't block on the log
+	 *  destination.  Must be done before the scheduler spawns
+	 *  any threads.
+	 */
+	if (config->log_buffered && (fr_log_defer_start() < 0)) {
+		PERROR("Failed starting logger thread");
+		EXIT_WITH_FAILURE;
+	}
+
 	/*
 	 *	Start the network / worker threads.
 	 */
@@ -740,6 +772,12 @@ int main(int argc, char *argv[])
 			el = main_loop_event_list();
 		}
 
+		fr_schedule_pin_threads(config->pin_workers);
+		if (fr_schedule_cpu_affinity(config->network_cpus, config->worker_cpus) < 0) {
+			PERROR("Invalid thread affinity configuration");
+			EXIT_WITH_FAILURE;
+		}
+
 		sc = fr_schedule_create(NULL, el, &default_log, fr_debug_lvl,
 					networks, workers,
 					thread_instantiate,
@@ -946,6 +984,16 @@ int main(int argc, char *argv[])
 	main_loop_free();		/* Free the requests */
 
 cleanup:
+#ifdef WITH_STATS
+	fr_stats_shm_free();	/* Unlink the statistics segment */
+#endif
+
+	/*
+	 *  Flush any queued log messages, and revert to synchronous
+	 *  logging.  The scheduler threads have already been joined.
+	 */
+	fr_log_defer_stop();
+
 	/*
 	 *  Frees request specific logging resources which is OK
 	 *  because all the requests will have been stopped.
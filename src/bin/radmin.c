@@ -492,6 +492,187 @@ static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_inf
 	return -1;
 }
 
+/** Capture buffer for output of streamed commands
+ */
+typedef struct {
+	TALLOC_CTX	*ctx;		//!< Talloc ctx the buffer is allocated in.
+	char		*buf;		//!< Captured command output.
+	size_t		len;		//!< Length of the captured output.
+} radmin_capture_t;
+
+static ssize_t _capture_write(void *cookie, char const *buffer, size_t buffer_len)
+{
+	radmin_capture_t *capture = cookie;
+
+	capture->buf = talloc_realloc(capture->ctx, capture->buf, char, capture->len + buffer_len + 1);
+	if (!capture->buf) return -1;
+
+	memcpy(capture->buf + capture->len, buffer, buffer_len);
+	capture->len += buffer_len;
+	capture->buf[capture->len] = '\0';
+
+	return buffer_len;
+}
+
+/** Find the value of a "name<TAB>value" line in the previous sample
+ */
+static char const *stats_stream_find(char const *sample, char const *name, size_t name_len)
+{
+	char const *p = sample;
+
+	while (p && *p) {
+		if ((strncmp(p, name, name_len) == 0) && (p[name_len] == '\t')) return p + name_len + 1;
+
+		p = strchr(p, '\n');
+		if (p) p++;
+	}
+
+	return NULL;
+}
+
+/** Push the lines which changed since the previous sample
+ *
+ *  Lines are compared on their "name<TAB>value" form.  Unchanged
+ *  lines are skipped entirely, so the output scales with the change
+ *  rate, not with the size of the stats tree.  Counters additionally
+ *  get the delta since the previous sample.
+ */
+static void stats_stream_delta(FILE *fp, char const *prev, char const *curr)
+{
+	char const *p = curr;
+
+	while (*p) {
+		char const	*eol, *tab, *value, *old;
+		size_t		name_len, value_len;
+
+		eol = strchr(p, '\n');
+		if (!eol) eol = p + strlen(p);
+
+		tab = memchr(p, '\t', eol - p);
+		if (!tab) goto print;		/* Not name / value, always push it */
+
+		name_len = tab - p;
+		value = tab + 1;
+		value_len = eol - value;
+
+		old = prev ? stats_stream_find(prev, p, name_len) : NULL;
+		if (old) {
+			uint64_t	old_num, new_num;
+			char		*end;
+
+			/*
+			 *	Unchanged, skip the line.
+			 */
+			if ((strncmp(old, value, value_len) == 0) &&
+			    ((old[value_len] == '\n') || (old[value_len] == '\0'))) goto next;
+
+			/*
+			 *	Counters also get the delta since the
+			 *	previous sample.
+			 */
+			old_num = strtoull(old, &end, 10);
+			if ((end > old) && ((*end == '\n') || (*end == '\0'))) {
+				new_num = strtoull(value, &end, 10);
+				if (end == (value + value_len)) {
+					fprintf(fp, "%.*s\t%.*s (%+" PRId64 ")\n",
+						(int) name_len, p, (int) value_len, value,
+						(int64_t) (new_num - old_num));
+					goto next;
+				}
+			}
+		}
+
+	print:
+		fprintf(fp, "%.*s\n", (int) (eol - p), p);
+
+	next:
+		p = (*eol == '\n') ? eol + 1 : eol;
+	}
+}
+
+/** Periodically re-run a stats command, pushing only what changed
+ *
+ *  We poll stats over radmin fleet-wide, and re-printing the full
+ *  tree every second costs output proportional to the config size,
+ *  not to what actually changed.  Streaming re-runs the command
+ *  here, diffs each sample against the previous one, and pushes
+ *  compact "name<TAB>value (+delta)" lines for the changes only.
+ */
+static int cmd_stats_stream(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	TALLOC_CTX		*tmp_ctx;
+	fr_cmd_info_t		stream_info;
+	radmin_capture_t	capture;
+	cookie_io_functions_t	io = { .write = _capture_write };
+	FILE			*capture_fp;
+	char			*command;
+	char			*prev = NULL;
+	uint32_t		interval, count, i;
+	int			argc;
+
+	interval = info->box[1]->vb_uint32;
+	if ((interval < 1) || (interval > 3600)) {
+		fprintf(fp_err, "Interval must be between 1 and 3600 seconds.\n");
+		return -1;
+	}
+
+	count = info->box[2]->vb_uint32;
+	if ((count < 1) || (count > 86400)) {
+		fprintf(fp_err, "Count must be between 1 and 86400 samples.\n");
+		return -1;
+	}
+
+	tmp_ctx = talloc_init("radmin stats stream");
+
+	fr_command_info_init(tmp_ctx, &stream_info);
+
+	command = talloc_strdup(tmp_ctx, info->box[0]->vb_strvalue);
+	argc = fr_command_str_to_argv(radmin_cmd, &stream_info, command);
+	if (argc < 0) {
+		fprintf(fp_err, "Failed parsing command: %s\n", fr_strerror());
+	error:
+		talloc_free(tmp_ctx);
+		return -1;
+	}
+
+	if (!stream_info.runnable) {
+		fprintf(fp_err, "Command is not runnable.\n");
+		goto error;
+	}
+
+	capture = (radmin_capture_t){ .ctx = tmp_ctx };
+	capture_fp = fopencookie(&capture, "w", io);
+	if (!capture_fp) {
+		fprintf(fp_err, "Failed creating capture stream.\n");
+		goto error;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i > 0) sleep(interval);
+
+		capture.buf = NULL;
+		capture.len = 0;
+
+		if (fr_command_run(capture_fp, fp_err, &stream_info, true) < 0) {
+			fprintf(fp_err, "Failed running command.\n");
+			fclose(capture_fp);
+			goto error;
+		}
+		fflush(capture_fp);
+
+		stats_stream_delta(fp, prev, capture.buf ? capture.buf : "");
+		fflush(fp);
+
+		talloc_free(prev);
+		prev = capture.buf;
+	}
+
+	fclose(capture_fp);
+	talloc_free(tmp_ctx);
+
+	return 0;
+}
+
 static int cmd_set_debug_level(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
 	int level = atoi(info->argv[0]);
@@ -925,6 +1106,15 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true,
 	},
 
+	{
+		.parent = "stats",
+		.name = "stream",
+		.syntax = "STRING INTEGER INTEGER",
+		.func = cmd_stats_stream,
+		.help = "Re-run a command every <interval> seconds for <count> samples, printing only changed values.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "set",
 		.name = "debug",
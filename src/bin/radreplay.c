@@ -0,0 +1,453 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/bin/radreplay.c
+ * @brief Replay RADIUS requests from a packet capture against a server.
+ *
+ * Reads a pcap file (e.g. one produced by radsniff -w), extracts the
+ * RADIUS requests, re-signs them with the target server's shared
+ * secret, and replays them at the recorded packet timing (optionally
+ * scaled).  Responses are matched back to the requests they answer,
+ * and a latency report is printed at the end.
+ *
+ * Because the requests are replayed verbatim, attributes encrypted
+ * with the original shared secret (User-Password etc.) will not
+ * decrypt to their original values unless the secrets match.  The
+ * tool is intended for load and latency testing, not for reproducing
+ * authentication results.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/pcap.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/timeval.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/radius/defs.h>
+
+#include <poll.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#define ERROR(fmt, ...)		fr_perror("radreplay: " fmt, ## __VA_ARGS__)
+#define DEBUG(fmt, ...)		if (fr_debug_lvl > 0) fprintf(fr_log_fp, fmt "\n", ## __VA_ARGS__)
+
+static char const *radreplay_version = RADIUSD_VERSION_STRING_BUILD("radreplay");
+
+/** An outstanding request, indexed by RADIUS ID
+ *
+ * Replayed packets keep their captured IDs, so at most 256 requests
+ * can be outstanding.  If the capture reuses an ID before the
+ * previous request was answered, the previous one is counted as lost.
+ */
+typedef struct {
+	bool		in_use;
+	uint8_t		data[MAX_RADIUS_LEN];
+	size_t		data_len;
+	fr_time_t	sent;			//!< When we sent the request.
+} rr_slot_t;
+
+typedef struct {
+	uint64_t	sent;			//!< Requests replayed.
+	uint64_t	received;		//!< Responses matched to a request.
+	uint64_t	lost;			//!< Requests which never got a response.
+	uint64_t	bad_verify;		//!< Responses which failed signature validation.
+	uint64_t	unlinked;		//!< Responses with no outstanding request.
+	uint64_t	skipped;		//!< Capture frames which weren't RADIUS requests.
+} rr_stats_t;
+
+static rr_slot_t	slots[UINT8_MAX + 1];
+static rr_stats_t	stats;
+
+static fr_time_delta_t	*latencies = NULL;	//!< One sample per matched response.
+
+static char		*secret = NULL;
+static size_t		secret_len = 0;
+
+static int latency_cmp(void const *one, void const *two)
+{
+	fr_time_delta_t const *a = one, *b = two;
+
+	if (*a < *b) return -1;
+	if (*a > *b) return +1;
+	return 0;
+}
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: radreplay [options] server[:port] <secret> <file>\n");
+	fprintf(output, "  <file>                 Packet capture to replay, e.g. from radsniff -w.\n");
+	fprintf(output, "  -f <filter>            Apply a PCAP filter expression to the capture.\n");
+	fprintf(output, "  -h                     Print usage help information.\n");
+	fprintf(output, "  -s <scale>             Replay at 'scale' times the recorded speed\n");
+	fprintf(output, "                         (default 1.0, 0 replays as fast as possible).\n");
+	fprintf(output, "  -t <timeout>           Wait 'timeout' seconds for outstanding responses\n");
+	fprintf(output, "                         at the end of the capture (default 2.0).\n");
+	fprintf(output, "  -v                     Show program version information.\n");
+	fprintf(output, "  -x                     Debugging mode.\n");
+
+	exit(status);
+}
+
+/** Match a response against the request occupying its ID slot
+ *
+ */
+static void response_process(uint8_t *data, size_t data_len, fr_time_t now)
+{
+	rr_slot_t	*slot;
+	decode_fail_t	reason;
+
+	if (!fr_radius_ok(data, &data_len, 0, false, &reason)) {
+		fr_strerror();	/* Drain the error stack */
+		stats.unlinked++;
+		return;
+	}
+
+	slot = &slots[data[1]];
+	if (!slot->in_use) {
+		stats.unlinked++;
+		return;
+	}
+
+	if (fr_radius_verify(data, slot->data, (uint8_t const *)secret, secret_len) < 0) {
+		fr_strerror();	/* Drain the error stack */
+		stats.bad_verify++;
+		return;
+	}
+
+	slot->in_use = false;
+	latencies[stats.received++] = now - slot->sent;
+}
+
+/** Drain any responses which have arrived on the socket
+ *
+ * @param[in] sockfd	to read responses from.
+ * @param[in] wait	how long to wait for the first response, 0 to
+ *			only read responses which have already arrived.
+ * @return
+ *	- 0 on success.
+ *	- -1 on socket error.
+ */
+static int response_drain(int sockfd, fr_time_delta_t wait)
+{
+	struct pollfd	fds = { .fd = sockfd, .events = POLLIN };
+	uint8_t		buffer[MAX_RADIUS_LEN];
+
+	for (;;) {
+		int	ret;
+		ssize_t	len;
+
+		ret = poll(&fds, 1, (int)(wait / 1000000));
+		if (ret < 0) {
+			ERROR("Failed waiting for responses: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (ret == 0) return 0;
+
+		len = recv(sockfd, buffer, sizeof(buffer), 0);
+		if (len < 0) {
+			ERROR("Failed reading response: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (len >= RADIUS_HEADER_LENGTH) response_process(buffer, (size_t)len, fr_time());
+
+		wait = 0;	/* Only block for the first response */
+	}
+}
+
+/** Extract the RADIUS payload from a capture frame
+ *
+ * @param[in] data	start of the captured frame.
+ * @param[in] caplen	number of bytes captured.
+ * @param[in] link_layer	of the capture.
+ * @param[out] out_len	length of the RADIUS payload.
+ * @return
+ *	- Pointer to the RADIUS payload.
+ *	- NULL if the frame doesn't contain a useable RADIUS request.
+ */
+static uint8_t const *frame_to_radius(uint8_t const *data, uint32_t caplen, int link_layer, size_t *out_len)
+{
+	uint8_t const	*p = data;
+	ssize_t		len;
+	uint8_t		version;
+
+	len = fr_pcap_link_layer_offset(data, caplen, link_layer);
+	if (len < 0) {
+		fr_strerror();	/* Drain the error stack */
+		return NULL;
+	}
+	p += len;
+
+	version = (p[0] & 0xf0) >> 4;
+	switch (version) {
+	case 4:
+	{
+		ip_header_t const *ip = (ip_header_t const *)p;
+
+		p += (0x0f & ip->ip_vhl) * 4;	/* ip_hl specifies length in 32bit words */
+	}
+		break;
+
+	case 6:
+		p += sizeof(ip_header6_t);
+		break;
+
+	default:
+		return NULL;
+	}
+
+	if ((size_t)((p - data) + sizeof(udp_header_t) + RADIUS_HEADER_LENGTH) > caplen) return NULL;
+	p += sizeof(udp_header_t);
+
+	*out_len = caplen - (p - data);
+
+	return p;
+}
+
+int main(int argc, char **argv)
+{
+	fr_pcap_t		*in = NULL;
+	char const		*filter = NULL;
+	double			scale = 1.0;
+	double			timeout = 2.0;
+
+	fr_ipaddr_t		server_ipaddr;
+	uint16_t		server_port = 0;
+	int			sockfd = -1;
+
+	struct pcap_pkthdr	*header;
+	uint8_t const		*data;
+	struct timeval		first_ts = { 0, 0 };
+	fr_time_t		start = 0;
+
+	size_t			num_frames = 0;
+	int			c, ret = EXIT_FAILURE;
+	int			i;
+
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	fr_log_fp = stdout;
+
+	while ((c = getopt(argc, argv, "f:hs:t:vx")) != -1) switch (c) {
+	case 'f':
+		filter = optarg;
+		break;
+
+	case 's':
+		scale = atof(optarg);
+		if (scale < 0) usage(EXIT_FAILURE);
+		break;
+
+	case 't':
+		timeout = atof(optarg);
+		if (timeout < 0) usage(EXIT_FAILURE);
+		break;
+
+	case 'v':
+		printf("%s\n", radreplay_version);
+		exit(EXIT_SUCCESS);
+
+	case 'x':
+		fr_debug_lvl++;
+		break;
+
+	case 'h':
+		usage(EXIT_SUCCESS);
+
+	default:
+		usage(EXIT_FAILURE);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 3) usage(EXIT_FAILURE);
+
+	if (fr_inet_pton_port(&server_ipaddr, &server_port, argv[0], -1, AF_UNSPEC, true, true) < 0) {
+		ERROR("Failed resolving hostname");
+		exit(EXIT_FAILURE);
+	}
+	if (server_port == 0) server_port = FR_AUTH_UDP_PORT;
+
+	secret = argv[1];
+	secret_len = strlen(secret);
+
+	in = fr_pcap_init(autofree, argv[2], PCAP_FILE_IN);
+	if (!in) {
+		ERROR("Failed opening capture");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_pcap_open(in) < 0) {
+		ERROR("Failed opening capture");
+		exit(EXIT_FAILURE);
+	}
+
+	if (filter && (fr_pcap_apply_filter(in, filter) < 0)) {
+		ERROR("Failed applying filter");
+		exit(EXIT_FAILURE);
+	}
+
+	sockfd = fr_socket_client_udp(NULL, NULL, &server_ipaddr, server_port, true);
+	if (sockfd < 0) {
+		ERROR("Failed opening socket");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	One latency sample per request is the worst case.
+	 *	Count the frames with a first pass so we don't have to
+	 *	grow the array while replaying.
+	 */
+	while (pcap_next_ex(in->handle, &header, &data) == 1) num_frames++;
+	MEM(latencies = talloc_array(autofree, fr_time_delta_t, num_frames ? num_frames : 1));
+
+	talloc_free(in);
+	in = fr_pcap_init(autofree, argv[2], PCAP_FILE_IN);
+	if (!in || (fr_pcap_open(in) < 0) ||
+	    (filter && (fr_pcap_apply_filter(in, filter) < 0))) {
+		ERROR("Failed reopening capture");
+		exit(EXIT_FAILURE);
+	}
+
+	start = fr_time();
+
+	while (pcap_next_ex(in->handle, &header, &data) == 1) {
+		uint8_t const	*p;
+		size_t		len;
+		rr_slot_t	*slot;
+		decode_fail_t	reason;
+		fr_time_t	now;
+
+		p = frame_to_radius(data, header->caplen, in->link_layer, &len);
+		if (!p) {
+		skip:
+			stats.skipped++;
+			continue;
+		}
+
+		switch (p[0]) {
+		case FR_CODE_ACCESS_REQUEST:
+		case FR_CODE_ACCOUNTING_REQUEST:
+		case FR_CODE_STATUS_SERVER:
+		case FR_CODE_DISCONNECT_REQUEST:
+		case FR_CODE_COA_REQUEST:
+			break;
+
+		default:
+			goto skip;	/* Don't replay responses */
+		}
+
+		if (!fr_radius_ok(p, &len, 0, false, &reason)) {
+			fr_strerror();	/* Drain the error stack */
+			goto skip;
+		}
+
+		/*
+		 *	Reproduce the capture's packet timing, scaled
+		 *	by the replay speed.
+		 */
+		if (!first_ts.tv_sec) first_ts = header->ts;
+		if (scale > 0) {
+			struct timeval	elapsed_tv;
+			fr_time_delta_t	target;
+
+			fr_timeval_subtract(&elapsed_tv, &header->ts, &first_ts);
+			target = (fr_time_delta_t)(fr_time_delta_from_timeval(&elapsed_tv) / scale);
+
+			now = fr_time();
+			while ((now - start) < target) {
+				if (response_drain(sockfd, target - (now - start)) < 0) goto finish;
+				now = fr_time();
+			}
+		}
+
+		/*
+		 *	Claim the ID slot, re-sign with the target
+		 *	server's secret, and send.
+		 */
+		slot = &slots[p[1]];
+		if (slot->in_use) stats.lost++;
+
+		memcpy(slot->data, p, len);
+		slot->data_len = len;
+
+		if (fr_radius_sign(slot->data, NULL, (uint8_t const *)secret, secret_len) < 0) {
+			ERROR("Failed signing packet");
+			slot->in_use = false;
+			goto skip;
+		}
+
+		if (send(sockfd, slot->data, slot->data_len, 0) < 0) {
+			ERROR("Failed sending packet: %s", fr_syserror(errno));
+			goto finish;
+		}
+		slot->in_use = true;
+		slot->sent = fr_time();
+		stats.sent++;
+
+		if (response_drain(sockfd, 0) < 0) goto finish;
+	}
+
+	/*
+	 *	Wait for responses to the requests still in flight.
+	 */
+	{
+		fr_time_t	stop = fr_time() + (fr_time_delta_t)(timeout * NSEC);
+		fr_time_t	now;
+
+		while (((now = fr_time()) < stop) && (stats.received < stats.sent)) {
+			if (response_drain(sockfd, stop - now) < 0) goto finish;
+		}
+	}
+
+	for (i = 0; i < (UINT8_MAX + 1); i++) if (slots[i].in_use) stats.lost++;
+
+	ret = EXIT_SUCCESS;
+
+finish:
+	printf("Replayed %" PRIu64 " requests, %" PRIu64 " responses, "
+	       "%" PRIu64 " lost, %" PRIu64 " failed verification, "
+	       "%" PRIu64 " unlinked, %" PRIu64 " frames skipped\n",
+	       stats.sent, stats.received, stats.lost, stats.bad_verify,
+	       stats.unlinked, stats.skipped);
+
+	if (stats.received > 0) {
+		size_t median = stats.received / 2;
+		size_t p90 = (stats.received * 9) / 10;
+
+		qsort(latencies, stats.received, sizeof(*latencies), latency_cmp);
+
+		printf("Latency (ms): min %.3f, median %.3f, p90 %.3f, max %.3f\n",
+		       (double)latencies[0] / 1000000,
+		       (double)latencies[median] / 1000000,
+		       (double)latencies[p90 >= stats.received ? stats.received - 1 : p90] / 1000000,
+		       (double)latencies[stats.received - 1] / 1000000);
+	}
+
+	if (sockfd >= 0) close(sockfd);
+
+	return ret;
+}
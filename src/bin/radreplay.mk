@@ -0,0 +1,11 @@
+ifneq ($(PCAP_LIBS),)
+TARGET		:= radreplay
+else
+TARGET		:=
+endif
+
+SOURCES		:= radreplay.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) $(PCAP_LIBS)
+TGT_LDFLAGS     := $(LDFLAGS) $(PCAP_LDFLAGS)
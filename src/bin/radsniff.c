@@ -54,6 +54,9 @@ static rbtree_t *link_tree = NULL;
 static fr_event_list_t *events;
 static bool cleanup;
 
+static fr_dlist_head_t tracked_list;		//!< Outstanding requests in arrival order, oldest first.
+static uint64_t tracked_count = 0;		//!< How many requests are currently outstanding.
+
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
 
 typedef int (*rbcmp)(void const *, void const *);
@@ -1008,6 +1011,11 @@ static int _request_free(rs_request_t *request)
 		RS_ASSERT(ret);
 	}
 
+	if (request->in_tracked_list) {
+		fr_dlist_remove(&tracked_list, request);
+		tracked_count--;
+	}
+
 	if (request->event) {
 		int rcode;
 
@@ -1671,9 +1679,34 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
+			/*
+			 *	The correlation table is a fixed size.  Make
+			 *	room by evicting the oldest outstanding
+			 *	request - its response (if one ever arrives)
+			 *	will be counted as unlinked.  Evictions are
+			 *	silent, as the request wasn't necessarily
+			 *	lost, we just stopped waiting for it.
+			 */
+			if (conf->max_tracked && (tracked_count >= conf->max_tracked)) {
+				rs_request_t *oldest;
+
+				oldest = fr_dlist_head(&tracked_list);
+				RS_ASSERT(oldest);
+
+				RDEBUG2("Tracking limit of %" PRIu64 " reached, evicting request ID %i",
+					conf->max_tracked, oldest->expect->id);
+
+				oldest->silent_cleanup = true;
+				rs_packet_cleanup(oldest);
+			}
+
 			original = talloc_zero(conf, rs_request_t);
 			talloc_set_destructor(original, _request_free);
 
+			fr_dlist_insert_tail(&tracked_list, original);
+			original->in_tracked_list = true;
+			tracked_count++;
+
 			original->id = count;
 			original->in = event->in;
 			original->stats_req = &stats->exchange[current->code];
@@ -1980,6 +2013,115 @@ static int rs_build_dict_list(fr_dict_attr_t const **out, size_t len, char *list
 	return i;
 }
 
+/** Produce a PCAP filter expression which also matches on RADIUS packet code
+ *
+ * The packet code lives at a fixed offset in the UDP payload, so the
+ * predicate compiles down to BPF the kernel runs before the packet is
+ * copied to userspace.  BPF can only inspect the payload of unfragmented
+ * IPv4 packets, so fragments and IPv6 are passed through, and continue
+ * to be filtered in rs_packet_process().
+ *
+ * Filtering out requests would also filter out the responses we want to
+ * pair them with, and vice versa, so each code we're interested in
+ * admits the other half of its exchange too.
+ *
+ * @param[in] ctx		to allocate the new expression in.
+ * @param[in] expression	the existing PCAP filter.
+ * @return
+ *	- A new expression with the code predicates appended.
+ *	- NULL if we can't build predicates for the codes being filtered.
+ */
+static char *rs_pcap_code_filter(TALLOC_CTX *ctx, char const *expression)
+{
+	bool	codes[FR_RADIUS_MAX_PACKET_CODE] = { false };
+	char	*out;
+	size_t	i;
+
+	if (conf->filter_request_code) {
+		if (conf->filter_request_code >= FR_RADIUS_MAX_PACKET_CODE) return NULL;
+
+		codes[conf->filter_request_code] = true;
+		switch (conf->filter_request_code) {
+		case FR_CODE_ACCESS_REQUEST:
+			codes[FR_CODE_ACCESS_ACCEPT] = true;
+			codes[FR_CODE_ACCESS_REJECT] = true;
+			codes[FR_CODE_ACCESS_CHALLENGE] = true;
+			break;
+
+		case FR_CODE_ACCOUNTING_REQUEST:
+			codes[FR_CODE_ACCOUNTING_RESPONSE] = true;
+			break;
+
+		case FR_CODE_STATUS_SERVER:
+			codes[FR_CODE_ACCESS_ACCEPT] = true;
+			codes[FR_CODE_ACCOUNTING_RESPONSE] = true;
+			break;
+
+		case FR_CODE_COA_REQUEST:
+			codes[FR_CODE_COA_ACK] = true;
+			codes[FR_CODE_COA_NAK] = true;
+			break;
+
+		case FR_CODE_DISCONNECT_REQUEST:
+			codes[FR_CODE_DISCONNECT_ACK] = true;
+			codes[FR_CODE_DISCONNECT_NAK] = true;
+			break;
+
+		default:
+			return NULL;
+		}
+	}
+
+	if (conf->filter_response_code) {
+		if (conf->filter_response_code >= FR_RADIUS_MAX_PACKET_CODE) return NULL;
+
+		codes[conf->filter_response_code] = true;
+		switch (conf->filter_response_code) {
+		case FR_CODE_ACCESS_ACCEPT:
+			codes[FR_CODE_ACCESS_REQUEST] = true;
+			codes[FR_CODE_STATUS_SERVER] = true;
+			break;
+
+		case FR_CODE_ACCESS_REJECT:
+		case FR_CODE_ACCESS_CHALLENGE:
+			codes[FR_CODE_ACCESS_REQUEST] = true;
+			break;
+
+		case FR_CODE_ACCOUNTING_RESPONSE:
+			codes[FR_CODE_ACCOUNTING_REQUEST] = true;
+			codes[FR_CODE_STATUS_SERVER] = true;
+			break;
+
+		case FR_CODE_COA_ACK:
+		case FR_CODE_COA_NAK:
+			codes[FR_CODE_COA_REQUEST] = true;
+			break;
+
+		case FR_CODE_DISCONNECT_ACK:
+		case FR_CODE_DISCONNECT_NAK:
+			codes[FR_CODE_DISCONNECT_REQUEST] = true;
+			break;
+
+		default:
+			return NULL;
+		}
+	}
+
+	/*
+	 *	Protocol-Error can answer any request.
+	 */
+	codes[FR_CODE_PROTOCOL_ERROR] = true;
+
+	out = talloc_asprintf(ctx, "(%s) and (ip6 or (ip[6:2] & 0x1fff) != 0", expression);
+	for (i = 0; i < NUM_ELEMENTS(codes); i++) {
+		if (!codes[i]) continue;
+
+		out = talloc_asprintf_append_buffer(out, " or udp[8] = %zu", i);
+	}
+
+	return talloc_asprintf_append_buffer(out, ")");
+}
+
 static int rs_build_filter(VALUE_PAIR **out, char const *filter)
 {
 	fr_cursor_t cursor;
@@ -2174,6 +2316,9 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
+	fprintf(output, "  -M <max>              Track at most <max> outstanding requests, evicting the oldest\n");
+	fprintf(output, "                        when the limit is reached.  Gives a fixed memory footprint\n");
+	fprintf(output, "                        for long running captures (default is unlimited).\n");
 	fprintf(output, "  -p <port>             Filter packets by port (default is %i).\n", FR_AUTH_UDP_PORT);
 	fprintf(output, "  -P <pidfile>          Daemonize and write out <pidfile>.\n");
 	fprintf(output, "  -q                    Print less debugging information.\n");
@@ -2263,7 +2408,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != -1) {
+	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mM:p:P:qr:R:s:Svw:xXW:T:P:N:O:")) != -1) {
 		switch (c) {
 		case 'a':
 		{
@@ -2368,6 +2513,14 @@ int main(int argc, char *argv[])
 			conf->promiscuous = false;
 			break;
 
+		case 'M':
+			conf->max_tracked = atoi(optarg);
+			if (conf->max_tracked == 0) {
+				ERROR("Invalid maximum tracked requests \"%s\"", optarg);
+				usage(1);
+			}
+			break;
+
 		case 'p':
 			port = atoi(optarg);
 			break;
@@ -2638,6 +2791,26 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 *	If we're filtering by packet code, have the kernel
+	 *	filter too.  Dropping uninteresting packets before
+	 *	they're copied to userspace is what keeps the capture
+	 *	buffer from overflowing during packet storms, which is
+	 *	exactly when we're most interested in the packets.
+	 */
+	if (conf->pcap_filter && (conf->filter_request_code || conf->filter_response_code)) {
+		char *expression;
+
+		expression = rs_pcap_code_filter(conf, conf->pcap_filter);
+		if (expression) {
+			conf->pcap_filter = expression;
+			if (conf->pcap_filter_vlan) {
+				conf->pcap_filter_vlan = talloc_asprintf(conf, "(%s) or (vlan and (%s))",
+									 expression, expression);
+			}
+		}
+	}
+
 	/*
 	 *	Default to logging and capturing all events
 	 */
@@ -2666,6 +2839,7 @@ int main(int argc, char *argv[])
 		ERROR("Failed creating request tree");
 		goto finish;
 	}
+	fr_dlist_init(&tracked_list, rs_request_t, tracked);
 
 	/*
 	 *	Get the default capture device
@@ -204,6 +204,11 @@ typedef struct {
 
 	bool			in_request_tree;	//!< Whether the request is currently in the request tree.
 	bool			in_link_tree;		//!< Whether the request is currently in the linked tree.
+
+	bool			in_tracked_list;	//!< Whether the request is counted against the
+							//!< fixed correlation table size.
+	fr_dlist_t		tracked;		//!< Entry in the arrival-ordered list of outstanding
+							//!< requests, used for eviction.
 } rs_request_t;
 
 /** Statistic write/print event
@@ -289,6 +294,10 @@ struct rs {
 
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
+	uint64_t		max_tracked;		//!< Maximum number of outstanding requests to track.
+							//!< When the limit is reached, the oldest outstanding
+							//!< request is evicted, which gives radsniff a fixed
+							//!< memory footprint on long captures.  0 is unlimited.
 
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
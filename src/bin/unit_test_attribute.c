@@ -207,6 +207,25 @@ static dl_t		*dl;
 static dl_loader_t	*dl_loader;
 static char const	*raddb_dir = RADDBDIR;
 static char const	*dict_dir = DICTDIR;
+static uint32_t		bench_iterations = 0;	//!< If non-zero, re-run each encode/decode
+						///< this many times and print timings.
+
+/** Print one machine-readable benchmark result
+ *
+ * One line per vector, as key=value pairs, so results from two builds
+ * can be joined on op/file/line and diffed per vector.
+ *
+ * @param[in] cc	Information about the file being processed.
+ * @param[in] op	Command being benchmarked.
+ * @param[in] len	Input length in bytes (wire data for decode, pair text for encode).
+ * @param[in] elapsed	Total time for all iterations.
+ */
+static void bench_print(command_ctx_t *cc, char const *op, size_t len, fr_time_delta_t elapsed)
+{
+	INFO("bench: op=%s file=%s line=%d len=%zu iterations=%u ns=%" PRIu64 " ns_per_op=%.1f",
+	     op, cc->filename, cc->lineno, len, bench_iterations,
+	     (uint64_t)elapsed, (double)elapsed / bench_iterations);
+}
 
 size_t process_line(command_result_t *result, command_ctx_t *cc, char *data, size_t data_used, char *in, size_t inlen);
 static int process_file(bool *exit_now, TALLOC_CTX *ctx, CONF_SECTION *features,
@@ -1188,6 +1207,34 @@ static size_t command_decode_pair(command_result_t *result, command_ctx_t *cc,
 		to_dec += slen;
 	}
 
+	/*
+	 *	Re-run the decode at high iteration counts, so
+	 *	per-vector codec performance can be compared between
+	 *	builds.
+	 */
+	if (bench_iterations) {
+		fr_time_t	start;
+		uint32_t	i;
+
+		start = fr_time();
+		for (i = 0; i < bench_iterations; i++) {
+			VALUE_PAIR	*bench_head = NULL;
+			fr_cursor_t	bench_cursor;
+			uint8_t		*bench_p = (uint8_t *)data;
+
+			fr_cursor_init(&bench_cursor, &bench_head);
+			while (bench_p < to_dec_end) {
+				slen = tp->func(cc->tmp_ctx, &bench_cursor,
+						cc->active_dict ? cc->active_dict : cc->dict,
+						bench_p, (to_dec_end - bench_p), decoder_ctx);
+				if (slen <= 0) break;
+				bench_p += slen;
+			}
+			fr_pair_list_free(&bench_head);
+		}
+		bench_print(cc, "decode-pair", (uint8_t *)to_dec_end - (uint8_t *)data, fr_time() - start);
+	}
+
 	/*
 	 *	Set p to be the output buffer
 	 */
@@ -1404,6 +1451,30 @@ static size_t command_encode_pair(command_result_t *result, command_ctx_t *cc,
 
 		if (slen == 0) break;
 	}
+
+	/*
+	 *	Re-run the encode at high iteration counts, so
+	 *	per-vector codec performance can be compared between
+	 *	builds.
+	 */
+	if (bench_iterations) {
+		fr_time_t	start;
+		uint32_t	i;
+		size_t		enc_len = enc_p - encoded;
+
+		start = fr_time();
+		for (i = 0; i < bench_iterations; i++) {
+			enc_p = encoded;
+
+			fr_cursor_init(&cursor, &head);
+			while (fr_cursor_current(&cursor)) {
+				slen = tp->func(enc_p, enc_end - enc_p, &cursor, encoder_ctx);
+				if (slen <= 0) break;
+				enc_p += slen;
+			}
+		}
+		bench_print(cc, "encode-pair", enc_len, fr_time() - start);
+	}
 	fr_pair_list_free(&head);
 
 	CLEAR_TEST_POINT(cc);
@@ -2142,6 +2213,7 @@ static void usage(char const *name)
 {
 	INFO("usage: %s [options] (-|<filename>[ <filename>])", name);
 	INFO("options:");
+	INFO("  -b <iterations>    Benchmark mode.  Re-run each encode/decode <iterations> times and print per-vector timings.");
 	INFO("  -d <raddb>         Set user dictionary path (defaults to " RADDBDIR ").");
 	INFO("  -D <dictdir>       Set main dictionary path (defaults to " DICTDIR ").");
 	INFO("  -x                 Debugging mode.");
@@ -2214,7 +2286,11 @@ int main(int argc, char *argv[])
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "cd:D:fxMhr:")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "b:cd:D:fxMhr:")) != -1) switch (c) {
+		case 'b':
+			bench_iterations = atoi(optarg);
+			break;
+
 		case 'c':
 			do_commands = true;
 			break;
@@ -0,0 +1,1016 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+/**
+ * $Id$
+ *
+ * @file unit_test_benchmark.c
+ * @brief Packet path benchmark framework
+ *
+ * Drives decode -> process -> encode over raw packets read from disk
+ * (the same format as a fuzzer corpus), timing each stage separately
+ * and reporting talloc allocation counts, so that per-commit numbers
+ * can catch small regressions before they compound.
+ *
+ * @copyright 2000-2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <freeradius-devel/radius/defs.h>
+#include <freeradius-devel/radius/radius.h>
+
+#include <freeradius-devel/tls/base.h>
+
+#include <freeradius-devel/unlang/base.h>
+
+#include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#include <sys/stat.h>
+
+#define EXIT_WITH_FAILURE \
+do { \
+	ret = EXIT_FAILURE; \
+	goto cleanup; \
+} while (0)
+
+char const *radiusd_version = RADIUSD_VERSION_STRING_BUILD("benchmark");
+
+static fr_dict_t *dict_freeradius;
+static fr_dict_t *dict_radius;
+
+extern fr_dict_autoload_t unit_test_benchmark_dict[];
+fr_dict_autoload_t unit_test_benchmark_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_auth_type;
+
+extern fr_dict_attr_autoload_t unit_test_benchmark_dict_attr[];
+fr_dict_attr_autoload_t unit_test_benchmark_dict_attr[] = {
+	{ .out = &attr_auth_type, .name = "Auth-Type", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ NULL }
+};
+
+/** One raw packet read from the corpus
+ *
+ */
+typedef struct {
+	char const	*filename;	//!< Where the packet came from.
+	uint8_t		*data;		//!< Raw wire data.
+	size_t		data_len;	//!< Length of the wire data.
+	CONF_SECTION	*unlang;	//!< "recv <Packet-Type>" section, resolved once.
+} benchmark_corpus_t;
+
+/** Stages of the packet path we time separately
+ *
+ */
+typedef enum {
+	BENCHMARK_STAGE_SETUP = 0,	//!< Request and packet allocation.
+	BENCHMARK_STAGE_DECODE,		//!< Wire data to VALUE_PAIRs.
+	BENCHMARK_STAGE_PROCESS,	//!< Running the unlang sections.
+	BENCHMARK_STAGE_ENCODE,		//!< Reply VALUE_PAIRs to wire data.
+	BENCHMARK_STAGE_FREE,		//!< Tearing the request down again.
+	BENCHMARK_STAGE_MAX
+} benchmark_stage_t;
+
+static char const *benchmark_stage_names[BENCHMARK_STAGE_MAX] = {
+	"setup",
+	"decode",
+	"process",
+	"encode",
+	"free"
+};
+
+/** Accumulated results for one corpus packet
+ *
+ */
+typedef struct {
+	uint64_t	iterations;	//!< Iterations which ran to completion.
+	uint64_t	failed;		//!< Iterations where a stage errored out.
+
+	fr_time_delta_t	elapsed[BENCHMARK_STAGE_MAX];	//!< Total time spent in each stage.
+
+	size_t		talloc_blocks;	//!< Blocks in the request hierarchy before free.
+	size_t		talloc_bytes;	//!< Bytes in the request hierarchy before free.
+
+	fr_time_delta_t	decode_median;	//!< Median time spent in the decode stage.
+} benchmark_result_t;
+
+/** Budgets for one corpus packet, read from the thresholds file
+ *
+ */
+typedef struct {
+	char		name[128];	//!< Basename of the corpus packet.
+	double		decode_median;	//!< Median decode time budget (microseconds).
+	size_t		talloc_blocks;	//!< Allocation count budget.
+	size_t		talloc_bytes;	//!< Allocation size budget.
+} benchmark_threshold_t;
+
+/*
+ *	Static functions.
+ */
+static void usage(main_config_t const *config, int status);
+
+static RADCLIENT *client_alloc(TALLOC_CTX *ctx, char const *ip, char const *name, char const *secret)
+{
+	CONF_SECTION *cs;
+	CONF_PAIR *cp;
+	RADCLIENT *client;
+
+	cs = cf_section_alloc(ctx, NULL, "client", name);
+	cp = cf_pair_alloc(cs, "ipaddr", ip, T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	cf_pair_add(cs, cp);
+
+	cp = cf_pair_alloc(cs, "secret", secret, T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING);
+	cf_pair_add(cs, cp);
+
+	cp = cf_pair_alloc(cs, "nas_type", "test", T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING);
+	cf_pair_add(cs, cp);
+
+	cp = cf_pair_alloc(cs, "shortname", "test", T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING);
+	cf_pair_add(cs, cp);
+
+	client = client_afrom_cs(ctx, cs, NULL);
+	if (!client) {
+		PERROR("Failed creating test client");
+		rad_assert(0);
+	}
+	talloc_steal(client, cs);
+	rad_assert(client);
+
+	return client;
+}
+
+/** Read one raw packet file into memory
+ *
+ * @param[in] ctx	to allocate the corpus entry in.
+ * @param[in] filename	of the raw packet, in fuzzer corpus format.
+ * @return
+ *	- A new corpus entry on success.
+ *	- NULL if the file could not be read, or is not a sane packet.
+ */
+static benchmark_corpus_t *corpus_afrom_file(TALLOC_CTX *ctx, char const *filename)
+{
+	benchmark_corpus_t	*corpus;
+	FILE			*fp;
+	struct stat		buf;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		ERROR("Failed reading %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (fstat(fileno(fp), &buf) < 0) {
+		ERROR("Failed getting size of %s: %s", filename, fr_syserror(errno));
+	error:
+		fclose(fp);
+		return NULL;
+	}
+
+	if ((buf.st_size < RADIUS_HEADER_LENGTH) || (buf.st_size > MAX_PACKET_LEN)) {
+		ERROR("Invalid packet length %zu in %s", (size_t) buf.st_size, filename);
+		goto error;
+	}
+
+	corpus = talloc_zero(ctx, benchmark_corpus_t);
+	if (!corpus) goto error;
+
+	corpus->filename = filename;
+	corpus->data_len = (size_t) buf.st_size;
+	corpus->data = talloc_array(corpus, uint8_t, corpus->data_len);
+	if (!corpus->data || (fread(corpus->data, 1, corpus->data_len, fp) != corpus->data_len)) {
+		ERROR("Failed reading %s: %s", filename, fr_syserror(errno));
+		talloc_free(corpus);
+		goto error;
+	}
+
+	fclose(fp);
+	return corpus;
+}
+
+/** Create a request containing an un-decoded copy of the corpus packet
+ *
+ * This is the state a request is in after the network side has read a
+ * datagram, and before the worker has decoded it.
+ */
+static REQUEST *request_from_corpus(TALLOC_CTX *ctx, benchmark_corpus_t *corpus,
+				    fr_event_list_t *el, RADCLIENT *client)
+{
+	REQUEST		*request;
+
+	static uint64_t	number = 0;
+
+	request = request_alloc(ctx);
+
+	request->dict = dict_radius;
+	request->packet = fr_radius_alloc(request, false);
+	if (!request->packet) {
+	oom:
+		ERROR("No memory");
+		talloc_free(request);
+		return NULL;
+	}
+	request->packet->timestamp = fr_time();
+
+	request->reply = fr_radius_alloc(request, false);
+	if (!request->reply) goto oom;
+
+	request->client = client;
+
+	request->number = number++;
+	request->name = talloc_typed_asprintf(request, "%" PRIu64, request->number);
+
+	request->master_state = REQUEST_ACTIVE;
+	request->server_cs = virtual_server_find("default");
+	rad_assert(request->server_cs != NULL);
+
+	request->config = main_config;
+	request->el = el;
+
+	request->packet->data = talloc_memdup(request->packet, corpus->data, corpus->data_len);
+	if (!request->packet->data) goto oom;
+	request->packet->data_len = corpus->data_len;
+
+	request->packet->src_ipaddr.af = AF_INET;
+	request->packet->src_ipaddr.prefix = 32;
+	request->packet->src_ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
+	request->packet->src_port = 18120;
+
+	request->packet->dst_ipaddr.af = AF_INET;
+	request->packet->dst_ipaddr.prefix = 32;
+	request->packet->dst_ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
+	request->packet->dst_port = 1812;
+
+	request->log.dst = talloc_zero(request, log_dst_t);
+	request->log.dst->func = vlog_request;
+	request->log.dst->uctx = &default_log;
+	request->log.lvl = fr_debug_lvl;
+
+	fr_request_async_bootstrap(request, el);
+
+	return request;
+}
+
+/** Choose the reply code, as the state machines would
+ *
+ */
+static int reply_code(int code, rlm_rcode_t rcode)
+{
+	bool positive;
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+		positive = true;
+		break;
+
+	default:
+		positive = false;
+		break;
+	}
+
+	switch (code) {
+	case FR_CODE_ACCESS_REQUEST:
+	case FR_CODE_STATUS_SERVER:
+		return positive ? FR_CODE_ACCESS_ACCEPT : FR_CODE_ACCESS_REJECT;
+
+	case FR_CODE_ACCOUNTING_REQUEST:
+		return positive ? FR_CODE_ACCOUNTING_RESPONSE : 0;
+
+	case FR_CODE_COA_REQUEST:
+		return positive ? FR_CODE_COA_ACK : FR_CODE_COA_NAK;
+
+	case FR_CODE_DISCONNECT_REQUEST:
+		return positive ? FR_CODE_DISCONNECT_ACK : FR_CODE_DISCONNECT_NAK;
+
+	default:
+		return 0;
+	}
+}
+
+/** Run one corpus packet through decode -> process -> encode
+ *
+ * @param[in,out] result	accumulated timings for this corpus entry.
+ * @param[in] corpus		the raw packet to run.
+ * @param[in] el		dummy event list for the interpreter.
+ * @param[in] client		fake client the packet "arrived" from.
+ * @param[in] secret		shared secret the corpus was encoded with.
+ * @param[in] sample_allocs	whether to walk the talloc hierarchy recording
+ *				allocation counts (distorts timing, so only
+ *				done on one iteration).
+ * @param[in] decode_only	stop after the decode stage.  Decode failures
+ *				are counted instead of being fatal, so a fuzzer
+ *				corpus (which contains intentionally malformed
+ *				packets) can be replayed unchanged.
+ * @param[out] decode_elapsed	if not NULL, where to write the time spent in
+ *				the decode stage of this iteration.
+ * @return
+ *	- 0 on success.
+ *	- -1 if any stage failed.
+ */
+static int benchmark_one(benchmark_result_t *result, benchmark_corpus_t *corpus,
+			 fr_event_list_t *el, RADCLIENT *client, char const *secret,
+			 bool sample_allocs, bool decode_only, fr_time_delta_t *decode_elapsed)
+{
+	REQUEST		*request;
+	VALUE_PAIR	*vp;
+	rlm_rcode_t	rcode;
+	fr_time_t	checkpoint[BENCHMARK_STAGE_MAX + 1];
+	bool		decoded;
+	int		i;
+
+	checkpoint[0] = fr_time();
+
+	request = request_from_corpus(NULL, corpus, el, client);
+	if (!request) return -1;
+
+	checkpoint[1] = fr_time();
+
+	/*
+	 *	Decode.  fr_radius_packet_ok() is deliberately inside
+	 *	the timed region, as the real packet path always runs
+	 *	both.
+	 */
+	decoded = fr_radius_packet_ok(request->packet, RADIUS_MAX_ATTRIBUTES, false, NULL) &&
+		  (fr_radius_packet_decode(request->packet, NULL,
+					   RADIUS_MAX_ATTRIBUTES, false, secret) >= 0);
+
+	checkpoint[2] = fr_time();
+
+	if (decode_elapsed) *decode_elapsed = checkpoint[2] - checkpoint[1];
+
+	/*
+	 *	In decode-only mode the time taken to reject a
+	 *	malformed packet is as interesting as the time taken
+	 *	to decode a good one, so failures count towards the
+	 *	timings too.
+	 */
+	if (decode_only) {
+		if (!decoded) {
+			fr_strerror();	/* Drain the error stack */
+			result->failed++;
+		}
+
+		if (sample_allocs) {
+			result->talloc_blocks = talloc_total_blocks(request);
+			result->talloc_bytes = talloc_total_size(request);
+		}
+
+		checkpoint[3] = checkpoint[4] = checkpoint[2];
+
+		talloc_free(request);
+
+		checkpoint[5] = fr_time();
+
+		for (i = 0; i < BENCHMARK_STAGE_MAX; i++) {
+			result->elapsed[i] += checkpoint[i + 1] - checkpoint[i];
+		}
+		result->iterations++;
+
+		return 0;
+	}
+
+	if (!decoded) {
+		PERROR("Failed decoding %s", corpus->filename);
+	error:
+		result->failed++;
+		talloc_free(request);
+		return -1;
+	}
+
+	/*
+	 *	Build the reply template from the request.
+	 */
+	request->reply->dst_ipaddr = request->packet->src_ipaddr;
+	request->reply->src_ipaddr = request->packet->dst_ipaddr;
+	request->reply->dst_port = request->packet->src_port;
+	request->reply->src_port = request->packet->dst_port;
+	request->reply->id = request->packet->id;
+	memcpy(request->reply->vector, request->packet->vector, sizeof(request->reply->vector));
+
+	/*
+	 *	Process.  Run the "recv" section, and if it set an
+	 *	Auth-Type, the matching "authenticate" section, as
+	 *	unit_test_module does.
+	 */
+	if (!corpus->unlang) {
+		if (!is_radius_code(request->packet->code)) {
+			ERROR("Invalid packet code %u in %s", request->packet->code, corpus->filename);
+			goto error;
+		}
+
+		corpus->unlang = cf_section_find(request->server_cs, "recv",
+						 fr_packet_codes[request->packet->code]);
+		if (!corpus->unlang) {
+			ERROR("Failed to find 'recv %s' section for %s",
+			      fr_packet_codes[request->packet->code], corpus->filename);
+			goto error;
+		}
+	}
+
+	rcode = unlang_interpret_synchronous(request, corpus->unlang, RLM_MODULE_NOOP);
+
+	vp = fr_pair_find_by_da(request->control, attr_auth_type, TAG_ANY);
+	if (vp && (rcode != RLM_MODULE_REJECT) && (rcode != RLM_MODULE_FAIL) &&
+	    (vp->vp_int32 != FR_AUTH_TYPE_VALUE_ACCEPT) && (vp->vp_int32 != FR_AUTH_TYPE_VALUE_REJECT)) {
+		CONF_SECTION	*unlang;
+		char		*auth_type;
+
+		auth_type = fr_pair_value_asprint(vp, vp, '\0');
+		unlang = cf_section_find(request->server_cs, "authenticate", auth_type);
+		talloc_free(auth_type);
+
+		if (unlang) rcode = unlang_interpret_synchronous(request, unlang, RLM_MODULE_NOOP);
+	}
+
+	request->reply->code = reply_code(request->packet->code, rcode);
+
+	checkpoint[3] = fr_time();
+
+	/*
+	 *	Encode.
+	 */
+	if (request->reply->code &&
+	    (fr_radius_packet_encode(request->reply, request->packet, secret) < 0)) {
+		PERROR("Failed encoding reply for %s", corpus->filename);
+		goto error;
+	}
+
+	checkpoint[4] = fr_time();
+
+	if (sample_allocs) {
+		result->talloc_blocks = talloc_total_blocks(request);
+		result->talloc_bytes = talloc_total_size(request);
+	}
+
+	talloc_free(request);
+
+	checkpoint[5] = fr_time();
+
+	for (i = 0; i < BENCHMARK_STAGE_MAX; i++) {
+		result->elapsed[i] += checkpoint[i + 1] - checkpoint[i];
+	}
+	result->iterations++;
+
+	return 0;
+}
+
+/** Print the accumulated results for one corpus entry
+ *
+ */
+static void benchmark_report(benchmark_result_t *result, benchmark_corpus_t *corpus)
+{
+	fr_time_delta_t	total = 0;
+	int		i;
+
+	printf("%s (%zu bytes)\n", corpus->filename, corpus->data_len);
+	printf("  iterations : %" PRIu64 " (%" PRIu64 " failed)\n", result->iterations, result->failed);
+
+	if (!result->iterations) return;
+
+	for (i = 0; i < BENCHMARK_STAGE_MAX; i++) {
+		total += result->elapsed[i];
+		printf("  %-10s : %8.3f us/packet\n", benchmark_stage_names[i],
+		       ((double) result->elapsed[i]) / ((double) result->iterations * 1000.0));
+	}
+
+	printf("  %-10s : %8.3f us/packet (%.0f packets/s)\n", "total",
+	       ((double) total) / ((double) result->iterations * 1000.0),
+	       ((double) result->iterations * NSEC) / (double) total);
+	if (result->decode_median) {
+		printf("  %-10s : %8.3f us/packet\n", "decode med",
+		       ((double) result->decode_median) / 1000.0);
+	}
+	printf("  allocations: %zu blocks, %zu bytes per request\n",
+	       result->talloc_blocks, result->talloc_bytes);
+}
+
+static int decode_sample_cmp(void const *one, void const *two)
+{
+	fr_time_delta_t const *a = one, *b = two;
+
+	return (*a > *b) - (*a < *b);
+}
+
+/** Read per-packet budgets from the thresholds file
+ *
+ * Each line is `<packet file> <median decode us> <talloc blocks> <talloc bytes>`.
+ * Blank lines and lines starting with '#' are ignored.
+ *
+ * @param[in] ctx	to allocate the threshold array in.
+ * @param[out] out	array of thresholds.
+ * @param[in] filename	to read the thresholds from.
+ * @return
+ *	- The number of thresholds read on success.
+ *	- -1 on failure.
+ */
+static int thresholds_afrom_file(TALLOC_CTX *ctx, benchmark_threshold_t **out, char const *filename)
+{
+	FILE			*fp;
+	benchmark_threshold_t	*thresholds = NULL;
+	char			buffer[256];
+	int			num = 0;
+	int			lineno = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		ERROR("Failed reading %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		benchmark_threshold_t threshold;
+
+		lineno++;
+		if ((buffer[0] == '#') || (buffer[0] == '\n') || (buffer[0] == '\0')) continue;
+
+		if (sscanf(buffer, "%127s %lf %zu %zu", threshold.name, &threshold.decode_median,
+			   &threshold.talloc_blocks, &threshold.talloc_bytes) != 4) {
+			ERROR("Invalid entry at %s[%d]", filename, lineno);
+			fclose(fp);
+			talloc_free(thresholds);
+			return -1;
+		}
+
+		thresholds = talloc_realloc(ctx, thresholds, benchmark_threshold_t, num + 1);
+		if (!thresholds) {
+			fclose(fp);
+			return -1;
+		}
+		thresholds[num++] = threshold;
+	}
+	fclose(fp);
+
+	*out = thresholds;
+	return num;
+}
+
+/** Check one corpus entry's results against its recorded budgets
+ *
+ * @param[in] result		measured for this corpus entry.
+ * @param[in] corpus		the entry which was measured.
+ * @param[in] thresholds	read from the thresholds file.
+ * @param[in] thresholds_num	number of entries in thresholds.
+ * @return
+ *	- 0 if the entry is within budget, or has no recorded budget.
+ *	- -1 on a regression.
+ */
+static int benchmark_gate(benchmark_result_t *result, benchmark_corpus_t *corpus,
+			  benchmark_threshold_t *thresholds, int thresholds_num)
+{
+	benchmark_threshold_t	*threshold = NULL;
+	char const		*name;
+	double			median_us;
+	int			i, ret = 0;
+
+	name = strrchr(corpus->filename, FR_DIR_SEP);
+	name = name ? (name + 1) : corpus->filename;
+
+	for (i = 0; i < thresholds_num; i++) {
+		if (strcmp(thresholds[i].name, name) == 0) {
+			threshold = &thresholds[i];
+			break;
+		}
+	}
+	if (!threshold) {
+		printf("  no budget recorded for %s, skipping\n", name);
+		return 0;
+	}
+
+	median_us = ((double) result->decode_median) / 1000.0;
+	if (median_us > threshold->decode_median) {
+		fprintf(stderr, "%s: median decode time %.3f us exceeds budget %.3f us\n",
+			name, median_us, threshold->decode_median);
+		ret = -1;
+	}
+
+	if (result->talloc_blocks > threshold->talloc_blocks) {
+		fprintf(stderr, "%s: %zu allocations exceeds budget %zu\n",
+			name, result->talloc_blocks, threshold->talloc_blocks);
+		ret = -1;
+	}
+
+	if (result->talloc_bytes > threshold->talloc_bytes) {
+		fprintf(stderr, "%s: %zu bytes allocated exceeds budget %zu\n",
+			name, result->talloc_bytes, threshold->talloc_bytes);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ *	The main guy.
+ */
+int main(int argc, char *argv[])
+{
+	int			ret = EXIT_SUCCESS;
+	int			c, i;
+	uint64_t		count = 10000;
+	char const		*secret = "testing123";
+	bool			decode_only = false;
+	char const		*threshold_file = NULL;
+	fr_event_list_t		*el = NULL;
+	RADCLIENT		*client = NULL;
+	fr_dict_t		*dict = NULL;
+	benchmark_corpus_t	**corpus = NULL;
+	int			corpus_num = 0;
+	benchmark_threshold_t	*thresholds = NULL;
+	int			thresholds_num = 0;
+	fr_time_delta_t		*samples = NULL;
+
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+	TALLOC_CTX		*thread_ctx = talloc_new(autofree);
+
+	char			*p;
+	main_config_t		*config;
+	dl_module_loader_t	*dl_modules = NULL;
+
+	config = main_config_alloc(autofree);
+	if (!config) {
+		fr_perror("unit_test_benchmark");
+		exit(EXIT_FAILURE);
+	}
+
+	p = strrchr(argv[0], FR_DIR_SEP);
+	if (!p) {
+		main_config_name_set_default(config, argv[0], false);
+	} else {
+		main_config_name_set_default(config, p + 1, false);
+	}
+
+	fr_talloc_fault_setup();
+
+	/*
+	 *	If the server was built with debugging enabled always install
+	 *	the basic fatal signal handlers.
+	 */
+#ifndef NDEBUG
+	if (fr_fault_setup(autofree, getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("%s", config->name);
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	fr_debug_lvl = 0;
+	fr_time_start();
+
+	/*
+	 *	The corpus should have only IPs, not host names.
+	 */
+	fr_hostname_lookups = false;
+
+	/*
+	 *	We always log to stdout.
+	 */
+	default_log.dst = L_DST_STDOUT;
+	default_log.fd = STDOUT_FILENO;
+	default_log.print_level = true;
+
+	/*  Process the options.  */
+	while ((c = getopt(argc, argv, "c:d:D:hn:rs:t:xX")) != -1) {
+		switch (c) {
+			case 'c':
+				count = strtoull(optarg, NULL, 10);
+				if (!count) usage(config, EXIT_FAILURE);
+				break;
+
+			case 'd':
+				main_config_raddb_dir_set(config, optarg);
+				break;
+
+			case 'D':
+				main_config_dict_dir_set(config, optarg);
+				break;
+
+			case 'h':
+				usage(config, EXIT_SUCCESS);
+				break;
+
+			case 'n':
+				config->name = optarg;
+				break;
+
+			case 'r':
+				decode_only = true;
+				break;
+
+			case 's':
+				secret = optarg;
+				break;
+
+			case 't':
+				threshold_file = optarg;
+				break;
+
+			case 'X':
+				fr_debug_lvl += 2;
+				default_log.print_level = true;
+				break;
+
+			case 'x':
+				fr_debug_lvl++;
+				if (fr_debug_lvl > 2) default_log.print_level = true;
+				break;
+
+			default:
+				usage(config, EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "No corpus files given\n");
+		usage(config, EXIT_FAILURE);
+	}
+
+#ifdef HAVE_OPENSSL_CRYPTO_H
+	/*
+	 *  Mismatch between build time OpenSSL and linked SSL, better to die
+	 *  here than segfault later.
+	 */
+	if (ssl_check_consistency() < 0) EXIT_WITH_FAILURE;
+
+	/*
+	 *  tls_init() must be called before *ANY* OpenSSL functions are used.
+	 */
+	if (tls_init() < 0) EXIT_WITH_FAILURE;
+#endif
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("%s", config->name);
+		ret = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	dl_modules = dl_module_loader_init(config->lib_dir);
+	if (!dl_modules) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+	if (fr_dict_global_init(autofree, config->dict_dir) < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+	if (fr_dict_internal_afrom_file(&dict, FR_DICTIONARY_INTERNAL_DIR) < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+#ifdef HAVE_OPENSSL_CRYPTO_H
+	if (tls_dict_init() < 0) EXIT_WITH_FAILURE;
+#endif
+
+	/*
+	 *	Load the custom dictionary
+	 */
+	if (fr_dict_read(dict, config->raddb_dir, FR_DICTIONARY_FILE) == -1) {
+		PERROR("Failed to initialize the dictionaries");
+		EXIT_WITH_FAILURE;
+	}
+
+	if (fr_dict_autoload(unit_test_benchmark_dict) < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+	if (fr_dict_attr_autoload(unit_test_benchmark_dict_attr) < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+	if (log_global_init(&default_log, false) < 0) {
+		EXIT_WITH_FAILURE;
+	}
+
+	/*  Read the configuration files, BEFORE doing anything else.  */
+	if (main_config_init(config) < 0) {
+		EXIT_WITH_FAILURE;
+	}
+
+	if (modules_init() < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+	if (virtual_servers_init(config->root_cs) < 0) {
+		fr_perror("%s", config->name);
+		EXIT_WITH_FAILURE;
+	}
+
+	/*
+	 *	Create a dummy client on 127.0.0.1, using the same
+	 *	secret the corpus packets were encoded with.
+	 */
+	{
+		fr_ipaddr_t	ip;
+		char const	*ip_str = "127.0.0.1";
+
+		if (fr_inet_pton(&ip, ip_str, strlen(ip_str), AF_UNSPEC, false, true) < 0) {
+			ret = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		client = client_find(NULL, &ip, IPPROTO_IP);
+		if (!client) {
+			client = client_alloc(NULL, ip_str, "test", secret);
+			client_add(NULL, client);
+		}
+	}
+
+	/*
+	 *	Initialise the interpreter, registering operations.
+	 */
+	if (unlang_init() < 0) EXIT_WITH_FAILURE;
+
+	if (server_init(config->root_cs) < 0) EXIT_WITH_FAILURE;
+
+	/*
+	 *	Create a dummy event list
+	 */
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	rad_assert(el != NULL);
+
+	/*
+	 *	Simulate thread specific instantiation
+	 */
+	if (modules_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
+	if (xlat_thread_instantiate(thread_ctx) < 0) EXIT_WITH_FAILURE;
+
+	/*
+	 *	Load the corpus.
+	 */
+	corpus_num = argc - optind;
+	corpus = talloc_zero_array(autofree, benchmark_corpus_t *, corpus_num);
+	for (i = 0; i < corpus_num; i++) {
+		corpus[i] = corpus_afrom_file(corpus, argv[optind + i]);
+		if (!corpus[i]) EXIT_WITH_FAILURE;
+	}
+
+	/*
+	 *	Load the budgets we gate against.
+	 */
+	if (threshold_file) {
+		thresholds_num = thresholds_afrom_file(autofree, &thresholds, threshold_file);
+		if (thresholds_num < 0) EXIT_WITH_FAILURE;
+	}
+
+	samples = talloc_array(autofree, fr_time_delta_t, count);
+	if (!samples) EXIT_WITH_FAILURE;
+
+	/*
+	 *	Run each corpus packet through the packet path.  The
+	 *	first iteration warms every cache (dictionaries, module
+	 *	state, malloc arenas) and samples allocation counts, so
+	 *	it's excluded from the timings.
+	 */
+	for (i = 0; i < corpus_num; i++) {
+		benchmark_result_t	result;
+		uint64_t		iteration;
+
+		memset(&result, 0, sizeof(result));
+
+		if (benchmark_one(&result, corpus[i], el, client, secret, true, decode_only, NULL) < 0) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		memset(result.elapsed, 0, sizeof(result.elapsed));
+		result.iterations = 0;
+		result.failed = 0;
+
+		for (iteration = 0; iteration < count; iteration++) {
+			if (benchmark_one(&result, corpus[i], el, client, secret, false,
+					  decode_only, &samples[iteration]) < 0) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+		}
+
+		if (iteration == count) {
+			qsort(samples, count, sizeof(*samples), decode_sample_cmp);
+			result.decode_median = samples[count / 2];
+		}
+
+		benchmark_report(&result, corpus[i]);
+
+		if (thresholds && (benchmark_gate(&result, corpus[i], thresholds, thresholds_num) < 0)) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+cleanup:
+	/*
+	 *	Free thread data
+	 */
+	talloc_free(thread_ctx);
+
+	/*
+	 *	Free the event list.
+	 */
+	talloc_free(el);
+
+	/*
+	 *	Free request specific logging infrastructure
+	 */
+	log_global_free();
+
+	server_free();
+
+	/*
+	 *	Free any resources used by the unlang interpreter.
+	 */
+	unlang_free();
+
+	/*
+	 *	And now nothing should be left anywhere except the
+	 *	parsed configuration items.
+	 */
+	main_config_free(&config);
+
+	/*
+	 *	Free any autoload dictionaries
+	 */
+	fr_dict_autofree(unit_test_benchmark_dict);
+
+	/*
+	 *	Free our explicitly loaded internal dictionary
+	 */
+	fr_dict_free(&dict);
+
+	if (dl_modules) talloc_free(dl_modules);
+
+	/*
+	 *  Now we're sure no more triggers can fire, free the
+	 *  trigger tree
+	 */
+	trigger_exec_free();
+
+	/*
+	 *	Explicitly cleanup the buffer used for storing syserror messages
+	 *	This cuts down on address sanitiser output on error.
+	 */
+	fr_syserror_free();
+
+	if (ret != 0) return ret;
+
+	/*
+	 *	Call pthread destructors.  Which aren't normally
+	 *	called for the main thread.
+	 */
+	pthread_exit(NULL);
+}
+
+
+/*
+ *  Display the syntax for starting this program.
+ */
+static void NEVER_RETURNS usage(main_config_t const *config, int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: %s [options] <packet_file> [<packet_file> ...]\n", config->name);
+	fprintf(output, "Options:\n");
+	fprintf(output, "  -c <count>         Run each packet 'count' times (default 10000).\n");
+	fprintf(output, "  -d <raddb_dir>     Configuration files are in \"raddb_dir/*\".\n");
+	fprintf(output, "  -D <dict_dir>      Dictionary files are in \"dict_dir/*\".\n");
+	fprintf(output, "  -h                 Print this help message.\n");
+	fprintf(output, "  -n <name>          Read raddb/name.conf instead of raddb/radiusd.conf.\n");
+	fprintf(output, "  -r                 Decode only.  Decode failures are counted, not fatal, so a\n");
+	fprintf(output, "                     fuzzer corpus can be replayed unchanged.\n");
+	fprintf(output, "  -s <secret>        Shared secret the packets were encoded with (default \"testing123\").\n");
+	fprintf(output, "  -t <file>          Check results against the budgets recorded in 'file', and exit\n");
+	fprintf(output, "                     with an error on any regression.\n");
+	fprintf(output, "  -X                 Turn on full debugging.\n");
+	fprintf(output, "  -x                 Turn on additional debugging. (-xx gives more debugging).\n");
+
+	exit(status);
+}
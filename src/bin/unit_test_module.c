@@ -568,6 +568,125 @@ static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, UNUSED void *proc_inst, U
 	return RLM_MODULE_FAIL;
 }
 
+/** Run the "recv Access-Request" and "authenticate" sections for one request
+ *
+ *  This is the same processing a real worker would do, just run
+ *  synchronously.  The result is left in request->reply->code.
+ */
+static void simulate_sections(REQUEST *request)
+{
+	VALUE_PAIR	*vp;
+	CONF_SECTION	*unlang;
+	char		*auth_type;
+
+	/*
+	 *	Simulate an authorize section
+	 */
+	rad_assert(request->server_cs != NULL);
+	unlang = cf_section_find(request->server_cs, "recv", "Access-Request");
+	if (!unlang) {
+		REDEBUG("Failed to find 'recv Access-Request' section");
+		request->reply->code = FR_CODE_ACCESS_REJECT;
+		return;
+	}
+
+	switch (unlang_interpret_synchronous(request, unlang, RLM_MODULE_NOOP)) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+		request->reply->code = FR_CODE_ACCESS_ACCEPT;
+		break;
+
+	default:
+		request->reply->code = FR_CODE_ACCESS_REJECT;
+		return;
+	}
+
+	/*
+	 *	Simulate an authenticate section
+	 */
+	vp = fr_pair_find_by_da(request->control, attr_auth_type, TAG_ANY);
+	if (!vp) return;
+
+	switch (vp->vp_int32) {
+	case FR_AUTH_TYPE_VALUE_ACCEPT:
+		request->reply->code = FR_CODE_ACCESS_ACCEPT;
+		return;
+
+	case FR_AUTH_TYPE_VALUE_REJECT:
+		request->reply->code = FR_CODE_ACCESS_REJECT;
+		return;
+
+	default:
+		break;
+	}
+
+	auth_type = fr_pair_value_asprint(vp, vp, '\0');
+	unlang = cf_section_find(request->server_cs, "authenticate", auth_type);
+	talloc_free(auth_type);
+	if (!unlang) {
+		REDEBUG("Failed to find 'recv %pV' section", &vp->data);
+		request->reply->code = FR_CODE_ACCESS_REJECT;
+		return;
+	}
+
+	switch (unlang_interpret_synchronous(request, unlang, RLM_MODULE_NOOP)) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+		request->reply->code = FR_CODE_ACCESS_ACCEPT;
+		break;
+
+	default:
+		request->reply->code = FR_CODE_ACCESS_REJECT;
+		break;
+	}
+}
+
+/** Clone a request for benchmarking
+ *
+ *  Policies can (and do) modify the request list, so each benchmark
+ *  iteration gets a pristine copy of the input packet.
+ */
+static REQUEST *request_clone(REQUEST *old)
+{
+	REQUEST *request;
+
+	request = request_alloc(NULL);
+	if (!request) return NULL;
+
+	request->dict = old->dict;
+
+	request->packet = fr_radius_alloc(request, false);
+	if (!request->packet) {
+	error:
+		talloc_free(request);
+		return NULL;
+	}
+	request->packet->timestamp = fr_time();
+
+	request->reply = fr_radius_alloc(request, false);
+	if (!request->reply) goto error;
+
+	request->packet->code = old->packet->code;
+	request->packet->src_ipaddr = old->packet->src_ipaddr;
+	request->packet->src_port = old->packet->src_port;
+	request->packet->dst_ipaddr = old->packet->dst_ipaddr;
+	request->packet->dst_port = old->packet->dst_port;
+
+	if (fr_pair_list_copy(request->packet, &request->packet->vps, old->packet->vps) < 0) goto error;
+
+	request->client = old->client;
+	request->number = old->number;
+	request->name = old->name;
+	request->master_state = REQUEST_ACTIVE;
+	request->server_cs = old->server_cs;
+	request->config = old->config;
+	request->el = old->el;
+
+	return request;
+}
+
 /*
  *	The main guy.
  */
@@ -586,8 +705,7 @@ int main(int argc, char *argv[])
 	fr_state_tree_t		*state = NULL;
 	fr_event_list_t		*el = NULL;
 	RADCLIENT		*client = NULL;
-	CONF_SECTION		*unlang;
-	char			*auth_type;
+	int			count = 1;
 	fr_dict_t		*dict = NULL;
 	char const 		*receipt_file = NULL;
 
@@ -640,8 +758,16 @@ int main(int argc, char *argv[])
 	default_log.print_level = true;
 
 	/*  Process the options.  */
-	while ((c = getopt(argc, argv, "d:D:f:hi:mMn:o:O:r:xX")) != -1) {
+	while ((c = getopt(argc, argv, "c:d:D:f:hi:mMn:o:O:r:xX")) != -1) {
 		switch (c) {
+			case 'c':
+				count = atoi(optarg);
+				if (count < 1) {
+					fprintf(stderr, "Invalid iteration count '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
 			case 'd':
 				main_config_raddb_dir_set(config, optarg);
 				break;
@@ -865,7 +991,7 @@ int main(int argc, char *argv[])
 	if (modules_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
 	if (xlat_thread_instantiate(thread_ctx) < 0) EXIT_WITH_FAILURE;
 
-	state = fr_state_tree_init(autofree, attr_state, false, 256, 10, 0);
+	state = fr_state_tree_init(autofree, attr_state, false, false, 256, 10, 0);
 
 	/*
 	 *  Set the panic action (if required)
@@ -964,69 +1090,39 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 *	Simulate an authorize section
+	 *	When benchmarking, run the sections over fresh clones
+	 *	of the input packet, and report the aggregate rate.
+	 *	The normal pass below still runs afterwards, so the
+	 *	reply and any filter checks are unaffected.
 	 */
-	rad_assert(request->server_cs != NULL);
-	unlang = cf_section_find(request->server_cs, "recv", "Access-Request");
-	if (!unlang) {
-		REDEBUG("Failed to find 'recv Access-Request' section");
-		request->reply->code = FR_CODE_ACCESS_REJECT;
-		goto done;
-	}
-
-	switch (unlang_interpret_synchronous(request, unlang, RLM_MODULE_NOOP)) {
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-	case RLM_MODULE_NOOP:
-		request->reply->code = FR_CODE_ACCESS_ACCEPT;
-		break;
-
-	default:
-		request->reply->code = FR_CODE_ACCESS_REJECT;
-		goto done;
-	}
-
-	/*
-	 *	Simulate an authenticate section
-	 */
-	vp = fr_pair_find_by_da(request->control, attr_auth_type, TAG_ANY);
-	if (!vp) goto done;
-
-	switch (vp->vp_int32) {
-	case FR_AUTH_TYPE_VALUE_ACCEPT:
-		request->reply->code = FR_CODE_ACCESS_ACCEPT;
-		goto done;
-
-	case FR_AUTH_TYPE_VALUE_REJECT:
-		request->reply->code = FR_CODE_ACCESS_REJECT;
-		goto done;
+	if (count > 1) {
+		fr_time_t	start, end;
+		uint64_t	elapsed;
+		int		i;
+
+		start = fr_time();
+		for (i = 0; i < count; i++) {
+			REQUEST *clone;
+
+			clone = request_clone(request);
+			if (!clone) {
+				fprintf(stderr, "Failed cloning request: %s\n", fr_strerror());
+				EXIT_WITH_FAILURE;
+			}
 
-	default:
-		break;
-	}
+			simulate_sections(clone);
+			talloc_free(clone);
+		}
+		end = fr_time();
 
-	auth_type = fr_pair_value_asprint(vp, vp, '\0');
-	unlang = cf_section_find(request->server_cs, "authenticate", auth_type);
-	talloc_free(auth_type);
-	if (!unlang) {
-		REDEBUG("Failed to find 'recv %pV' section", &vp->data);
-		request->reply->code = FR_CODE_ACCESS_REJECT;
-		goto done;
+		elapsed = end - start;
+		INFO("bench: iterations=%d elapsed_ns=%" PRIu64 " ns_per_op=%" PRIu64 " ops_per_sec=%.1f",
+		     count, elapsed, elapsed / (uint64_t) count,
+		     (double) count / ((double) elapsed / NSEC));
 	}
 
-	switch (unlang_interpret_synchronous(request, unlang, RLM_MODULE_NOOP)) {
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-	case RLM_MODULE_NOOP:
-		request->reply->code = FR_CODE_ACCESS_ACCEPT;
-		break;
-
-	default:
-		request->reply->code = FR_CODE_ACCESS_REJECT;
-		goto done;
-	}
+	simulate_sections(request);
 
-done:
 	if (!output_file || (strcmp(output_file, "-") == 0)) {
 		fp = stdout;
 	} else {
@@ -1146,6 +1242,7 @@ static void NEVER_RETURNS usage(main_config_t const *config, int status)
 
 	fprintf(output, "Usage: %s [options]\n", config->name);
 	fprintf(output, "Options:\n");
+	fprintf(output, "  -c <count>         Run the policy sections <count> times, and report the rate.\n");
 	fprintf(output, "  -d <raddb_dir>     Configuration files are in \"raddb_dir/*\".\n");
 	fprintf(output, "  -D <dict_dir>      Dictionary files are in \"dict_dir/*\".\n");
 	fprintf(output, "  -f <file>          Filter reply against attributes in 'file'.\n");
@@ -136,7 +136,14 @@ static int eap_wireformat(eap_packet_t *reply)
 		 */
 		if (reply->type.data && reply->type.length > 0) {
 			memcpy(&header->data[1], reply->type.data, reply->type.length);
-			talloc_free(reply->type.data);
+
+			/*
+			 *	The type data may be a scratch buffer owned by
+			 *	the EAP method's session (so it can be reused
+			 *	between rounds), in which case it's not ours
+			 *	to free.
+			 */
+			if (talloc_parent(reply->type.data) == reply) talloc_free(reply->type.data);
 			reply->type.data = reply->packet + EAP_HEADER_LEN + 1/*EAPtype*/;
 		}
 	}
@@ -23,6 +23,7 @@
  */
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/util/talloc.h>
 
 #include "attrs.h"
 #include "compose.h"
@@ -80,7 +81,21 @@ static eap_session_t *eap_session_alloc(REQUEST *request)
 {
 	eap_session_t	*eap_session;
 
-	eap_session = talloc_zero(NULL, eap_session_t);
+	/*
+	 *	Allocate the eap_session_t as a combined chunk/pool.
+	 *
+	 *	Almost everything hanging off of the session (the
+	 *	rounds, the identity, and the method specific tunnel
+	 *	state) is parented from it, and gets carved out of the
+	 *	pool instead of hitting the allocator.  As the previous
+	 *	round is freed when the next one is recorded, the same
+	 *	pool memory gets recycled for every round trip of the
+	 *	session.
+	 *
+	 *	Anything which doesn't fit falls back to the heap, so
+	 *	the size just needs to cover the common case.
+	 */
+	eap_session = talloc_zero_pooled_object(NULL, eap_session_t, 16, 1024);
 	if (!eap_session) {
 		ERROR("Failed allocating eap_session");
 		return NULL;
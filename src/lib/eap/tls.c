@@ -165,8 +165,20 @@ int eap_tls_compose(REQUEST *request, eap_session_t *eap_session, eap_tls_status
 	 *	Identifier value in the subsequent fragment contained
 	 *	within an EAP-Reponse.
 	 */
-	eap_round->request->type.data = p = talloc_array(eap_round->request, uint8_t, len);
-	if (!p) return -1;
+	/*
+	 *	Compose the fragment in a scratch buffer owned by the
+	 *	session.  eap_wireformat copies the type data into the
+	 *	final packet, so the buffer can be reused for every
+	 *	fragment of a record, and for subsequent rounds.
+	 */
+	if (eap_tls_session->frag_buff_len < len) {
+		p = talloc_realloc(eap_tls_session, eap_tls_session->frag_buff, uint8_t, len);
+		if (!p) return -1;
+
+		eap_tls_session->frag_buff = p;
+		eap_tls_session->frag_buff_len = len;
+	}
+	eap_round->request->type.data = p = eap_tls_session->frag_buff;
 	eap_round->request->type.length = len;
 
 	*p++ = flags;
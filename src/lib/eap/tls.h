@@ -146,6 +146,12 @@ typedef struct {
 	size_t			record_in_total_len;	//!< How long the peer indicated the complete tls record
 							//!< would be.
 	size_t			record_in_recvd_len;	//!< How much of the record we've received so far.
+
+	uint8_t			*frag_buff;		//!< Scratch buffer outgoing fragments are composed in.
+							//!< Owned by the session, and reused between rounds,
+							//!< so fragmenting a large record doesn't allocate
+							//!< a new buffer for every fragment.
+	size_t			frag_buff_len;		//!< Current size of the scratch buffer.
 } eap_tls_session_t;
 
 extern fr_table_num_ordered_t const eap_tls_status_table[];
@@ -42,11 +42,46 @@ RCSID("$Id$")
 #include <freeradius-devel/util/proto.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/thread_local.h>
 #include <openssl/evp.h>
 
 #include "base.h"
 #include "attrs.h"
 
+fr_thread_local_setup(EVP_MD_CTX *, aka_sim_md_ctx)
+
+static void _aka_sim_md_ctx_free_on_exit(void *arg)
+{
+	EVP_MD_CTX_destroy(arg);
+}
+
+/** Grab this thread's reusable digest ctx, allocating it on first use
+ *
+ * Key derivation runs several digests per authentication, so we keep
+ * one EVP_MD_CTX around per thread instead of creating and destroying
+ * one per operation.
+ *
+ * @return
+ *	- The thread's digest ctx.
+ *	- NULL on allocation failure.
+ */
+static EVP_MD_CTX *aka_sim_md_ctx_acquire(void)
+{
+	EVP_MD_CTX *md_ctx;
+
+	md_ctx = aka_sim_md_ctx;
+	if (unlikely(!md_ctx)) {
+		md_ctx = EVP_MD_CTX_create();
+		if (!md_ctx) {
+			tls_strerror_printf("Failed creating digest ctx");
+			return NULL;
+		}
+		fr_thread_local_set_destructor(aka_sim_md_ctx, _aka_sim_md_ctx_free_on_exit, md_ctx);
+	}
+
+	return md_ctx;
+}
+
 /** Free OpenSSL memory associated with our checkcode ctx
  *
  * @param[in] checkcode to free.
@@ -269,15 +304,11 @@ ssize_t fr_aka_sim_crypto_sign_packet(uint8_t out[static AKA_SIM_MAC_DIGEST_SIZE
 		tls_strerror_printf("Failed creating HMAC signing key");
 	error:
 		if (pkey) EVP_PKEY_free(pkey);
-		if (md_ctx) EVP_MD_CTX_destroy(md_ctx);
 		return -1;
 	}
 
-	md_ctx = EVP_MD_CTX_create();
-	if (!md_ctx) {
-		tls_strerror_printf("Failed creating HMAC ctx");
-		goto error;
-	}
+	md_ctx = aka_sim_md_ctx_acquire();
+	if (!md_ctx) goto error;
 
 	if (EVP_DigestSignInit(md_ctx, NULL, md, NULL, pkey) != 1) {
 		tls_strerror_printf("Failed initialising digest");
@@ -387,7 +418,6 @@ ssize_t fr_aka_sim_crypto_sign_packet(uint8_t out[static AKA_SIM_MAC_DIGEST_SIZE
 	memcpy(out, digest, 16);
 
 	EVP_PKEY_free(pkey);
-	EVP_MD_CTX_destroy(md_ctx);
 
 	return 16;	/* AT_MAC (1), LEN (1), RESERVED (2) */
 }
@@ -664,15 +694,11 @@ static int ck_ik_prime_derive(fr_aka_sim_keys_t *keys)
 		tls_strerror_printf("Failed creating HMAC signing key");
 	error:
 		if (pkey) EVP_PKEY_free(pkey);
-		if (md_ctx) EVP_MD_CTX_destroy(md_ctx);
 		return -1;
 	}
 
-	md_ctx = EVP_MD_CTX_create();
-	if (!md_ctx) {
-		tls_strerror_printf("Failed creating HMAC ctx");
-		goto error;
-	}
+	md_ctx = aka_sim_md_ctx_acquire();
+	if (!md_ctx) goto error;
 
 	if (EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, pkey) != 1) {
 		tls_strerror_printf("Failed initialising digest");
@@ -688,7 +714,6 @@ static int ck_ik_prime_derive(fr_aka_sim_keys_t *keys)
 	FR_PROTO_HEX_DUMP(keys->ck_prime, sizeof(keys->ck_prime), "CK'");
 	FR_PROTO_HEX_DUMP(keys->ik_prime, sizeof(keys->ik_prime), "IK'");
 
-	EVP_MD_CTX_destroy(md_ctx);;
 	EVP_PKEY_free(pkey);
 
 	return 0;
@@ -733,15 +758,11 @@ static int aka_prime_prf(uint8_t *out, size_t outlen,
 		tls_strerror_printf("Failed creating HMAC signing key");
 	error:
 		if (pkey) EVP_PKEY_free(pkey);
-		if (md_ctx) EVP_MD_CTX_destroy(md_ctx);
 		return -1;
 	}
 
-	md_ctx = EVP_MD_CTX_create();
-	if (!md_ctx) {
-		tls_strerror_printf("Failed creating HMAC ctx");
-		goto error;
-	}
+	md_ctx = aka_sim_md_ctx_acquire();
+	if (!md_ctx) goto error;
 
 	if (EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, pkey) != 1) {
 		tls_strerror_printf("Failed initialising digest");
@@ -767,7 +788,6 @@ static int aka_prime_prf(uint8_t *out, size_t outlen,
 		p += copy;
 	}
 
-	EVP_MD_CTX_destroy(md_ctx);;
 	EVP_PKEY_free(pkey);
 
 	return 0;
@@ -1014,11 +1034,9 @@ int fr_aka_sim_crypto_kdf_0_reauth(fr_aka_sim_keys_t *keys)
 	/*
 	 *	Digest re-auth key with SHA1
 	 */
-	md_ctx = EVP_MD_CTX_create();
+	md_ctx = aka_sim_md_ctx_acquire();
 	if (!md_ctx) {
-		tls_strerror_printf("Failed creating MD ctx");
 	error:
-		EVP_MD_CTX_destroy(md_ctx);
 		return -1;
 	}
 
@@ -1037,8 +1055,6 @@ int fr_aka_sim_crypto_kdf_0_reauth(fr_aka_sim_keys_t *keys)
 		goto error;
 	}
 
-	EVP_MD_CTX_destroy(md_ctx);
-
 	FR_PROTO_HEX_DUMP(keys->reauth.xkey_prime, sizeof(keys->reauth.xkey_prime), "xkey'");
 
 	/*
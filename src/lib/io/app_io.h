@@ -70,6 +70,7 @@ typedef struct {
 	 *	Either in a buffer, or in a newly-allocated memory.
 	 */
 	fr_io_data_cmp_t		compare;	//!< compare two packets
+	fr_io_data_hash_t		hash;		//!< hash the fields checked by "compare"
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
@@ -41,6 +41,7 @@ RCSIDH(atomic_queue_h, "$Id$")
 #define atomic_uint32_t _Atomic(uint32_t)
 
 #define cas_incr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var + 1, memory_order_release, memory_order_relaxed)
+#define cas_add(_store, _var, _n) atomic_compare_exchange_strong_explicit(&_store, &_var, _var + _n, memory_order_release, memory_order_relaxed)
 #define cas_decr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var - 1, memory_order_release, memory_order_relaxed)
 #define load(_var)           atomic_load_explicit(&_var, memory_order_relaxed)
 #define aquire(_var)         atomic_load_explicit(&_var, memory_order_acquire)
@@ -55,6 +56,7 @@ typedef struct fr_atomic_queue_t fr_atomic_queue_t;
 fr_atomic_queue_t	*fr_atomic_queue_create(TALLOC_CTX *ctx, int size);
 bool			fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
 bool			fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
+size_t			fr_atomic_queue_pop_multi(fr_atomic_queue_t *aq, void **out, size_t max);
 
 #ifndef NDEBUG
 void			fr_atomic_queue_debug(fr_atomic_queue_t *aq, FILE *fp);
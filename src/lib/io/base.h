@@ -285,6 +285,21 @@ typedef void (*fr_io_data_vnode_t)(fr_listen_t *li, uint32_t fflags);
  */
 typedef int (*fr_io_data_cmp_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *packet1, void const *packet2);
 
+/** Hash the fields of a packet which are used for duplicate detection.
+ *
+ * We presume that the packet is well formed.
+ *
+ * The hash MUST cover exactly the fields which the matching
+ * #fr_io_data_cmp_t checks.  Two packets which compare as equal MUST
+ * hash to the same value.  Fields which the comparison function
+ * ignores (e.g. the packet length) MUST NOT be hashed.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] packet		the packet
+ * @return a hash of the fields used for duplicate detection.
+ */
+typedef uint32_t (*fr_io_data_hash_t)(void const *instance, void const *packet);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -781,6 +781,18 @@ bool fr_channel_active(fr_channel_t *ch)
 	return ch->active;
 }
 
+/** Return the number of requests which have been sent to the worker, but not yet replied to
+ *
+ * Only usable from the network side of the channel.
+ *
+ * @param[in] ch the channel
+ * @return the number of outstanding requests
+ */
+int fr_channel_num_outstanding(fr_channel_t *ch)
+{
+	return ch->end[TO_WORKER].num_outstanding;
+}
+
 /** Signal a worker that the channel is closing
  *
  * @param[in] ch	The channel.
@@ -108,12 +108,14 @@ typedef struct {
 			fr_time_t		*recv_time;	//!< time original request was received (network -> worker)
 			fr_dlist_t		entry;		//!< list of unprocessed packets for the worker
 			bool			is_dup;		//!< dup, new, etc.
+			uint64_t		journal_seq;	//!< the listeners journal entry, 0 if none (network -> worker)
 		} request;
 
 		struct {
 			fr_time_t		cpu_time;	//!<  total CPU time, including predicted work, (only worker -> network)
 			fr_time_t		processing_time;  //!< actual processing time for this packet (only worker -> network)
 			fr_time_t		request_time;	//!< timestamp of the request packet
+			uint64_t		journal_seq;	//!< journal entry to acknowledge, 0 if none (worker -> network)
 	        } reply;
 	};
 
@@ -154,6 +156,7 @@ int fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent c
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
 
 bool fr_channel_active(fr_channel_t *ch) CC_HINT(nonnull);
+int fr_channel_num_outstanding(fr_channel_t *ch) CC_HINT(nonnull);
 
 int fr_channel_signal_open(fr_channel_t *ch) CC_HINT(nonnull);
 
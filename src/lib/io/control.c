@@ -80,6 +80,9 @@ struct fr_control_t {
 
 	uintptr_t		ident;			//!< our ident for kqueue.
 
+	atomic_bool		signalled;		//!< we've kicked the KQ, and the
+							//!< receiver hasn't yet serviced it
+
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
@@ -317,10 +320,22 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
+	/*
+	 *	The message is safely in the atomic queue.  If the
+	 *	receiver hasn't yet serviced an earlier signal, it will
+	 *	drain this message along with the ones before it, so
+	 *	there's no need to kick the KQ again.  This coalesces a
+	 *	burst of control messages (e.g. the ACK storm from a busy
+	 *	channel) into a single cross-thread wakeup.
+	 */
+	if (atomic_exchange_explicit(&c->signalled, true, memory_order_acq_rel)) return 0;
+
 	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
 	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
 	if (rcode >= 0) return rcode;
 
+	atomic_store_explicit(&c->signalled, false, memory_order_release);
+
 	fr_strerror_printf("Failed sending user event to kqueue (%i): %s", c->kq, fr_syserror(errno));
 	return rcode;
 }
@@ -438,6 +453,14 @@ void fr_control_service(fr_control_t *c, void *data, size_t data_size, fr_time_t
 	uint32_t id = 0;
 	size_t message_size;
 
+	/*
+	 *	Clear the "signalled" flag BEFORE draining the queue.
+	 *	Any message pushed after this point will trigger a new
+	 *	signal, and any message pushed before it will be picked
+	 *	up by the loop below.
+	 */
+	atomic_store_explicit(&c->signalled, false, memory_order_release);
+
 	while (true) {
 		message_size = fr_control_message_pop(c->aq, &id, data, data_size);
 		if (!message_size) return;
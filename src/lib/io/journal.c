@@ -0,0 +1,373 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Write-ahead journal for accepted packets
+ * @file io/journal.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/journal.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ *	The header occupies the first block of the file, and the size
+ *	of the data area is rounded up to a multiple of the block size,
+ *	so that writes are nicely aligned for the file system.
+ */
+#define JOURNAL_BLOCK_SIZE	(4096)
+
+#define JOURNAL_MAGIC		((uint64_t) 0x46524a4f55524e31)	/* "FRJOURN1" */
+
+#define JOURNAL_REC_LIVE	((uint32_t) 0x4c495645)		/* "LIVE" */
+#define JOURNAL_REC_ACKED	((uint32_t) 0x41434b44)		/* "ACKD" */
+
+/** On-disk journal header, at the start of the file
+ *
+ *  "head" and "tail" are logical offsets into the data area, which
+ *  only ever increase.  Their difference is the number of bytes in
+ *  use, and offset modulo data_size is the physical position.
+ */
+typedef struct {
+	uint64_t		magic;		//!< JOURNAL_MAGIC
+	uint64_t		data_size;	//!< size of the data area following the header
+	uint64_t		head;		//!< logical offset where the next record is appended
+	uint64_t		tail;		//!< logical offset of the oldest record
+	uint64_t		next_seq;	//!< sequence number assigned to the next record
+} fr_journal_header_t;
+
+/** On-disk header for each record
+ *
+ */
+typedef struct {
+	uint32_t		state;		//!< JOURNAL_REC_LIVE or JOURNAL_REC_ACKED
+	uint32_t		data_len;	//!< length of the data following this header
+	uint64_t		seq;		//!< sequence number, used for acknowledgements
+} fr_journal_rec_t;
+
+/*
+ *	Records are padded so that every record header is 8-byte
+ *	aligned in the logical offset space.
+ */
+#define JOURNAL_REC_SIZE(_len) (sizeof(fr_journal_rec_t) + (((uint64_t) (_len) + 7) & ~(uint64_t) 7))
+
+struct fr_journal_s {
+	char const		*path;		//!< where the journal lives
+	int			fd;		//!< of the mapped file
+	uint8_t			*map;		//!< the entire file
+	size_t			map_size;	//!< length of the mapping
+
+	fr_journal_header_t	*hdr;		//!< at the start of the map
+	uint8_t			*data;		//!< data area, after the header block
+};
+
+/** Copy bytes into the data area, wrapping at the end of the ring
+ *
+ */
+static void journal_write(fr_journal_t *j, uint64_t offset, void const *in, size_t len)
+{
+	size_t pos = offset % j->hdr->data_size;
+	size_t room = j->hdr->data_size - pos;
+
+	if (len <= room) {
+		memcpy(j->data + pos, in, len);
+		return;
+	}
+
+	memcpy(j->data + pos, in, room);
+	memcpy(j->data, ((uint8_t const *) in) + room, len - room);
+}
+
+/** Copy bytes out of the data area, wrapping at the end of the ring
+ *
+ */
+static void journal_read(fr_journal_t *j, uint64_t offset, void *out, size_t len)
+{
+	size_t pos = offset % j->hdr->data_size;
+	size_t room = j->hdr->data_size - pos;
+
+	if (len <= room) {
+		memcpy(out, j->data + pos, len);
+		return;
+	}
+
+	memcpy(out, j->data + pos, room);
+	memcpy(((uint8_t *) out) + room, j->data, len - room);
+}
+
+static int _journal_free(fr_journal_t *j)
+{
+	if (j->map != MAP_FAILED) (void) munmap(j->map, j->map_size);
+	if (j->fd >= 0) close(j->fd);
+
+	return 0;
+}
+
+/** Open a journal file, creating or resetting it as necessary
+ *
+ *  If the file already exists, is the correct size, and has a valid
+ *  header, the existing contents are kept, so that records written by
+ *  a previous instance of the process can be replayed.  Otherwise the
+ *  journal is initialized to empty.
+ *
+ * @param[in] ctx	the talloc ctx
+ * @param[in] path	of the journal file.
+ * @param[in] size	of the data area, rounded up to a multiple of the block size.
+ * @return
+ *	- NULL on error
+ *	- fr_journal_t on success
+ */
+fr_journal_t *fr_journal_open(TALLOC_CTX *ctx, char const *path, size_t size)
+{
+	fr_journal_t	*j;
+	struct stat	st;
+	bool		reset = false;
+
+	size = (size + (JOURNAL_BLOCK_SIZE - 1)) & ~((size_t) (JOURNAL_BLOCK_SIZE - 1));
+	if (size < (2 * JOURNAL_BLOCK_SIZE)) size = 2 * JOURNAL_BLOCK_SIZE;
+
+	j = talloc_zero(ctx, fr_journal_t);
+	if (!j) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+	j->fd = -1;
+	j->map = MAP_FAILED;
+	talloc_set_destructor(j, _journal_free);
+
+	j->path = talloc_strdup(j, path);
+	j->map_size = JOURNAL_BLOCK_SIZE + size;
+
+	j->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (j->fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", path, fr_syserror(errno));
+	error:
+		talloc_free(j);
+		return NULL;
+	}
+
+	if (fstat(j->fd, &st) < 0) {
+		fr_strerror_printf("Failed checking %s: %s", path, fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Anything but an exact size match means the file wasn't
+	 *	written by us with the same configuration.  Resize it,
+	 *	and start over.
+	 */
+	if (st.st_size != (off_t) j->map_size) {
+		if (ftruncate(j->fd, (off_t) j->map_size) < 0) {
+			fr_strerror_printf("Failed extending %s: %s", path, fr_syserror(errno));
+			goto error;
+		}
+		reset = true;
+	}
+
+	j->map = mmap(NULL, j->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+	if (j->map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping %s: %s", path, fr_syserror(errno));
+		goto error;
+	}
+
+	j->hdr = (fr_journal_header_t *) j->map;
+	j->data = j->map + JOURNAL_BLOCK_SIZE;
+
+	/*
+	 *	Sanity check the header of an existing file.  If it's
+	 *	damaged, an empty journal is better than replaying
+	 *	garbage.
+	 */
+	if (!reset &&
+	    ((j->hdr->magic != JOURNAL_MAGIC) ||
+	     (j->hdr->data_size != size) ||
+	     (j->hdr->head < j->hdr->tail) ||
+	     ((j->hdr->head - j->hdr->tail) > size) ||
+	     (j->hdr->next_seq == 0))) reset = true;
+
+	if (reset) {
+		memset(j->hdr, 0, sizeof(*j->hdr));
+		j->hdr->magic = JOURNAL_MAGIC;
+		j->hdr->data_size = size;
+		j->hdr->next_seq = 1;
+	}
+
+	return j;
+}
+
+/** Append a record to the journal
+ *
+ *  The record data is written before the head offset is published, so
+ *  that a crash part way through an append leaves the previous records
+ *  intact.
+ *
+ * @param[in] j		the journal
+ * @param[in] data	the raw record bytes.
+ * @param[in] data_len	length of the record.
+ * @return
+ *	- 0 if the record could not be written (e.g. the journal is full)
+ *	- the sequence number assigned to the record on success
+ */
+uint64_t fr_journal_append(fr_journal_t *j, uint8_t const *data, size_t data_len)
+{
+	fr_journal_rec_t	rec;
+	uint64_t		rec_size = JOURNAL_REC_SIZE(data_len);
+
+	if (!data_len || (data_len > UINT32_MAX)) {
+		fr_strerror_printf("Invalid record length %zu", data_len);
+		return 0;
+	}
+
+	if (rec_size > (j->hdr->data_size - (j->hdr->head - j->hdr->tail))) {
+		fr_strerror_printf("Journal %s is full", j->path);
+		return 0;
+	}
+
+	rec.state = JOURNAL_REC_LIVE;
+	rec.data_len = data_len;
+	rec.seq = j->hdr->next_seq;
+
+	journal_write(j, j->hdr->head, &rec, sizeof(rec));
+	journal_write(j, j->hdr->head + sizeof(rec), data, data_len);
+
+	j->hdr->head += rec_size;
+	j->hdr->next_seq++;
+
+	return rec.seq;
+}
+
+/** Acknowledge a record, allowing its space to be reused
+ *
+ *  Acknowledgements can arrive out of order.  The record is marked,
+ *  and the tail then advances over any leading run of acknowledged
+ *  records.
+ *
+ * @param[in] j		the journal
+ * @param[in] seq	sequence number returned by fr_journal_append().
+ * @return
+ *	- <0 if the record wasn't found
+ *	- 0 on success
+ */
+int fr_journal_ack(fr_journal_t *j, uint64_t seq)
+{
+	fr_journal_rec_t	rec;
+	uint64_t		offset;
+	bool			found = false;
+
+	for (offset = j->hdr->tail; offset < j->hdr->head; offset += JOURNAL_REC_SIZE(rec.data_len)) {
+		journal_read(j, offset, &rec, sizeof(rec));
+
+		if ((rec.state != JOURNAL_REC_LIVE) && (rec.state != JOURNAL_REC_ACKED)) {
+			fr_strerror_printf("Journal %s is corrupt at offset %" PRIu64, j->path, offset);
+			return -1;
+		}
+
+		if (rec.seq == seq) {
+			if (rec.state == JOURNAL_REC_LIVE) {
+				rec.state = JOURNAL_REC_ACKED;
+				journal_write(j, offset, &rec, sizeof(rec));
+			}
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		fr_strerror_printf("Journal %s has no record %" PRIu64, j->path, seq);
+		return -1;
+	}
+
+	/*
+	 *	Reclaim space from the start of the ring.
+	 */
+	while (j->hdr->tail < j->hdr->head) {
+		journal_read(j, j->hdr->tail, &rec, sizeof(rec));
+		if (rec.state != JOURNAL_REC_ACKED) break;
+
+		j->hdr->tail += JOURNAL_REC_SIZE(rec.data_len);
+	}
+
+	return 0;
+}
+
+/** Replay the live records, oldest first
+ *
+ * @param[in] j		the journal
+ * @param[in] walk	called for each live record.
+ * @param[in] uctx	passed to the callback.
+ * @return
+ *	- <0 if a record is corrupt, or the callback failed
+ *	- the number of records replayed on success
+ */
+int fr_journal_replay(fr_journal_t *j, fr_journal_walk_t walk, void *uctx)
+{
+	fr_journal_rec_t	rec;
+	uint64_t		offset;
+	uint8_t			*buffer;
+	int			replayed = 0;
+
+	for (offset = j->hdr->tail; offset < j->hdr->head; offset += JOURNAL_REC_SIZE(rec.data_len)) {
+		journal_read(j, offset, &rec, sizeof(rec));
+
+		if ((rec.state != JOURNAL_REC_LIVE) && (rec.state != JOURNAL_REC_ACKED)) {
+			fr_strerror_printf("Journal %s is corrupt at offset %" PRIu64, j->path, offset);
+			return -1;
+		}
+
+		if (rec.state != JOURNAL_REC_LIVE) continue;
+
+		/*
+		 *	Copy the record out, so that the callback gets
+		 *	contiguous data even when the record wraps.
+		 */
+		buffer = talloc_array(j, uint8_t, rec.data_len);
+		if (!buffer) return -1;
+
+		journal_read(j, offset + sizeof(rec), buffer, rec.data_len);
+
+		if (walk(buffer, rec.data_len, rec.seq, uctx) < 0) {
+			talloc_free(buffer);
+			return -1;
+		}
+		talloc_free(buffer);
+		replayed++;
+	}
+
+	return replayed;
+}
+
+/** Return the number of bytes of journal space which are in use
+ *
+ * @param[in] j		the journal
+ * @return the number of bytes between the tail and the head
+ */
+uint64_t fr_journal_outstanding(fr_journal_t const *j)
+{
+	return j->hdr->head - j->hdr->tail;
+}
@@ -0,0 +1,75 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/journal.h
+ * @brief Write-ahead journal for accepted packets.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(journal_h, "$Id$")
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A memory mapped ring file of raw packets which have been accepted, but not yet processed
+ *
+ * Records are appended before the packet is queued, and acknowledged
+ * once a reply has been produced, so the set of live records at any
+ * time is exactly the packets which would be lost if the process died.
+ * On a restart, the live records can be replayed.
+ *
+ * The journal is not locked.  Each journal must only be used from the
+ * single thread which owns the corresponding listener.
+ */
+typedef struct fr_journal_s fr_journal_t;
+
+/** Callback for replaying one live record
+ *
+ * @param[in] data	the raw record bytes.
+ * @param[in] data_len	length of the record.
+ * @param[in] seq	sequence number of the record.
+ * @param[in] uctx	user context passed to fr_journal_replay.
+ * @return
+ *	- 0 on success.
+ *	- <0 to stop the replay.
+ */
+typedef int (*fr_journal_walk_t)(uint8_t const *data, size_t data_len, uint64_t seq, void *uctx);
+
+fr_journal_t	*fr_journal_open(TALLOC_CTX *ctx, char const *path, size_t size) CC_HINT(nonnull(2));
+
+uint64_t	fr_journal_append(fr_journal_t *j, uint8_t const *data, size_t data_len) CC_HINT(nonnull);
+
+int		fr_journal_ack(fr_journal_t *j, uint64_t seq) CC_HINT(nonnull);
+
+int		fr_journal_replay(fr_journal_t *j, fr_journal_walk_t walk, void *uctx) CC_HINT(nonnull(1,2));
+
+uint64_t	fr_journal_outstanding(fr_journal_t const *j) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
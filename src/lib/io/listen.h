@@ -22,6 +22,8 @@
  *
  */
 typedef struct fr_listen fr_listen_t;
+typedef struct fr_worker_trace_s fr_worker_trace_t;
+typedef struct fr_journal_s fr_journal_t;
 struct fr_listen {
 	int			fd;			//!< file descriptor for this socket - set by open
 	char const		*name;			//!< printable name for this socket - set by open
@@ -40,6 +42,8 @@ struct fr_listen {
 	bool			connected;		//!< is this for a connected socket?
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+
+	fr_journal_t		*journal;		//!< optional write-ahead journal for accepted packets
 };
 
 /**
@@ -61,6 +65,10 @@ struct fr_async_t {
 						//!< and how we'll send the reply.
 	uint32_t		priority;
 	bool			fake;		//!< is it a fake request
+
+	uint64_t		journal_seq;	//!< journal entry to acknowledge with the reply, 0 if none
+
+	fr_worker_trace_t	*trace;		//!< hop timestamps, only set for sampled requests
 };
 
 int fr_io_listen_free(fr_listen_t *li);
@@ -30,17 +30,33 @@
 
 #include <freeradius-devel/unlang/base.h>
 
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 
+/** Token bucket for accept-time admission control
+ *
+ */
+typedef struct {
+	uint64_t			tokens;				//!< in units of 1/1000 of a connection
+	fr_time_t			last;				//!< when the bucket was last refilled
+} fr_io_accept_bucket_t;
+
+#define ACCEPT_SOURCE_BUCKETS (256)
+
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
 
 	fr_trie_t			*trie;				//!< trie of clients
+	fr_io_client_t			*last_client;			//!< most recently matched client
 	fr_heap_t			*pending_clients;		//!< heap of pending clients
 	fr_heap_t			*alive_clients;			//!< heap of active clients
 
+	fr_dlist_head_t			expired_clients;		//!< expired clients waiting to be reaped
+	uint32_t			num_expired_clients;		//!< number of entries in expired_clients
+	fr_event_timer_t const		*ev_reap;			//!< incremental reap timer
+
 	fr_listen_t			*listen;			//!< The master IO path
 	fr_listen_t			*child;				//!< The child (app_io) IO path
 	fr_schedule_t			*sc;				//!< the scheduler
@@ -48,6 +64,9 @@ typedef struct {
 	// @todo - count num_nak_clients, and num_nak_connections, too
 	uint32_t			num_connections;		//!< number of dynamic connections
 	uint32_t			num_pending_packets;   		//!< number of pending packets
+
+	fr_io_accept_bucket_t		accept_global;			//!< accept rate limit for the whole listener
+	fr_io_accept_bucket_t		accept_sources[ACCEPT_SOURCE_BUCKETS];	//!< accept rate limits per source network
 } fr_io_thread_t;
 
 /** A saved packet
@@ -94,11 +113,15 @@ struct fr_io_client_s {
 	bool				use_connected;	//!< does this client allow connected sub-sockets?
 	bool				ready_to_delete; //!< are we ready to delete this client?
 	bool				in_trie;	//!< is the client in the trie?
+	bool				expired;	//!< is the client on the expired list?
+
+	fr_dlist_t			expired_entry;	//!< entry in the thread's list of expired clients
 
 	fr_io_instance_t const		*inst;		//!< parent instance for master IO handler
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
-	rbtree_t			*table;		//!< tracking table for packets
+	fr_hash_table_t			*table;		//!< tracking table for packets
+	fr_io_track_t			*last_track;	//!< most recently seen tracking entry
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -225,13 +248,13 @@ static uint32_t connection_hash(void const *ctx)
 	uint32_t hash;
 	fr_io_connection_t const *c = ctx;
 
-	hash = fr_hash(&c->address->src_ipaddr, sizeof(c->address->src_ipaddr));
-	hash = fr_hash_update(&c->address->src_port, sizeof(c->address->src_port), hash);
+	hash = fr_hash_fast(&c->address->src_ipaddr, sizeof(c->address->src_ipaddr));
+	hash = fr_hash_fast_update(&c->address->src_port, sizeof(c->address->src_port), hash);
 
-	hash = fr_hash_update(&c->address->if_index, sizeof(c->address->if_index), hash);
+	hash = fr_hash_fast_update(&c->address->if_index, sizeof(c->address->if_index), hash);
 
-	hash = fr_hash_update(&c->address->dst_ipaddr, sizeof(c->address->dst_ipaddr), hash);
-	return fr_hash_update(&c->address->dst_port, sizeof(c->address->dst_port), hash);
+	hash = fr_hash_fast_update(&c->address->dst_ipaddr, sizeof(c->address->dst_ipaddr), hash);
+	return fr_hash_fast_update(&c->address->dst_port, sizeof(c->address->dst_port), hash);
 }
 
 
@@ -286,6 +309,61 @@ static int track_cmp(void const *one, void const *two)
 						a->packet, b->packet);
 }
 
+/*
+ *	The hash is calculated once, when the tracking entry is
+ *	created, and then cached in the tracking entry.  Lookups and
+ *	deletions then don't need to re-hash the packet.
+ */
+static uint32_t track_hash(void const *ctx)
+{
+	fr_io_track_t const *a = ctx;
+
+	return a->hash;
+}
+
+/** Hash the fields of a tracking entry which track_cmp() checks.
+ *
+ *  The per-protocol hash function covers only the packet fields which
+ *  the per-protocol comparison function checks, so that entries which
+ *  compare as equal hash to the same value.
+ */
+static uint32_t track_hash_packet(fr_io_track_t const *track)
+{
+	uint32_t hash;
+
+	hash = track->client->inst->app_io->hash(track->client->inst->app_io_instance, track->packet);
+
+	/*
+	 *	Connected sockets have all tracking entries use the
+	 *	same src/dst addresses, so there's no point in hashing
+	 *	them.
+	 */
+	if (track->client->connection) return hash;
+
+	hash = fr_hash_fast_update(&track->address->src_ipaddr, sizeof(track->address->src_ipaddr), hash);
+	hash = fr_hash_fast_update(&track->address->src_port, sizeof(track->address->src_port), hash);
+
+	hash = fr_hash_fast_update(&track->address->if_index, sizeof(track->address->if_index), hash);
+
+	hash = fr_hash_fast_update(&track->address->dst_ipaddr, sizeof(track->address->dst_ipaddr), hash);
+	return fr_hash_fast_update(&track->address->dst_port, sizeof(track->address->dst_port), hash);
+}
+
+/** Compare two tracked packet headers
+ *
+ *  i.e. code / id / length, followed by the 16 byte authenticator.
+ *  Fixed-size compares, as this runs for every duplicate check.
+ */
+static inline bool track_packet_eq(uint8_t const *a, uint8_t const *b)
+{
+	uint32_t a0, b0;
+
+	memcpy(&a0, a, sizeof(a0));
+	memcpy(&b0, b, sizeof(b0));
+
+	return (a0 == b0) && fr_memeq16(a + 4, b + 4);
+}
+
 
 static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 {
@@ -495,9 +573,8 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	 *
 	 *	#todo - unify the code with static clients?
 	 */
-	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								     NULL, RBTREE_FLAG_NONE));
+	if (inst->track_duplicates) {
+		MEM(connection->client->table = fr_hash_table_create(client, track_hash, track_cmp, NULL));
 	}
 
 	/*
@@ -820,7 +897,21 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 */
 	memcpy(my_track.packet, packet, sizeof(my_track.packet));
 
-	if (client->inst->app_io->track_duplicates) track = rbtree_finddata(client->table, &my_track);
+	/*
+	 *	Most duplicates arrive back to back, while the original
+	 *	request is still being processed.  Check the most
+	 *	recently seen entry before searching the tracking table.
+	 */
+	if (client->inst->track_duplicates) {
+		my_track.hash = track_hash_packet(&my_track);
+
+		track = client->last_track;
+		if (!track ||
+		    !track_packet_eq(track->packet, my_track.packet) ||
+		    (!client->connection && (address_cmp(track->address, address) != 0))) {
+			track = fr_hash_table_finddata(client->table, &my_track);
+		}
+	}
 	if (!track) {
 		MEM(track = talloc_zero(client, fr_io_track_t));
 		talloc_get_type_abort(track, fr_io_track_t);
@@ -840,17 +931,34 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 		memcpy(track->packet, packet, sizeof(track->packet));
 		track->timestamp = recv_time;
 		track->packets = 1;
+
+		/*
+		 *	Add the new entry to the tracking table.  The
+		 *	hash was computed above, and is cached so that
+		 *	the later deletion doesn't need to re-hash the
+		 *	packet.
+		 */
+		if (client->inst->track_duplicates) {
+			track->hash = my_track.hash;
+			if (!fr_hash_table_insert(client->table, track)) {
+				talloc_free(track);
+				return NULL;
+			}
+		}
+
+		client->last_track = track;
 		return track;
 	}
 
 	talloc_get_type_abort(track, fr_io_track_t);
+	client->last_track = track;
 
 	/*
 	 *	Is it exactly the same packet?
 	 *
 	 *	@todo - compare the tracking structure, not the packet
 	 */
-	if (memcmp(track->packet, my_track.packet, sizeof(my_track.packet)) == 0) {
+	if (track_packet_eq(track->packet, my_track.packet)) {
 		/*
 		 *	Ignore duplicates while the client is
 		 *	still pending.
@@ -920,10 +1028,11 @@ static int pending_free(fr_io_pending_packet_t *pending)
 	 *	delete it.
 	 */
 	if (track->packets == 0) {
-		if (track->client->inst->app_io->track_duplicates) {
+		if (track->client->inst->track_duplicates) {
 			rad_assert(track->client->table != NULL);
-			(void) rbtree_deletebydata(track->client->table, track);
+			(void) fr_hash_table_delete(track->client->table, track);
 		}
+		if (track->client->last_track == track) track->client->last_track = NULL;
 
 		// @todo - put this into a slab allocator
 		talloc_free(track);
@@ -1000,11 +1109,171 @@ static int _client_live_free(fr_io_client_t *client)
 	if (client->pending) TALLOC_FREE(client->pending);
 
 	(void) fr_trie_remove(client->thread->trie, &client->src_ipaddr.addr, client->src_ipaddr.prefix);
+	if (client->thread->last_client == client) client->thread->last_client = NULL;
 	(void) fr_heap_extract(client->thread->alive_clients, client);
 
+	if (client->expired) {
+		fr_dlist_remove(&client->thread->expired_clients, client);
+		client->thread->num_expired_clients--;
+	}
+
 	return 0;
 }
 
+static void client_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/*
+ *	Maximum number of expired dynamic clients freed per reap timer
+ *	tick, and the interval between ticks.  Freeing a client also
+ *	frees its packet tracking table, which with many thousands of
+ *	clients expiring together is enough to stall the network
+ *	thread for several milliseconds if it's all done at once.
+ */
+#define IO_MAX_REAP_CLIENTS	(32)
+#define IO_REAP_INTERVAL	(((fr_time_delta_t) NSEC) / 100)
+
+/** Free a batch of expired clients, and re-arm if there are more
+ *
+ */
+static void client_reap_timer(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_io_thread_t	*thread = uctx;
+	fr_io_client_t	*client;
+	int		reaped = 0;
+
+	/*
+	 *	The client destructor removes the client from the
+	 *	expired list.
+	 */
+	while ((reaped++ < IO_MAX_REAP_CLIENTS) &&
+	       ((client = fr_dlist_head(&thread->expired_clients)) != NULL)) {
+		talloc_free(client);
+	}
+
+	if (!thread->num_expired_clients) return;
+
+	if (fr_event_timer_in(thread, el, &thread->ev_reap,
+			      IO_REAP_INTERVAL, client_reap_timer, thread) < 0) {
+		/*
+		 *	Better a stall than a leak.
+		 */
+		while ((client = fr_dlist_head(&thread->expired_clients)) != NULL) {
+			talloc_free(client);
+		}
+	}
+}
+
+/** Queue an expired dynamic client for incremental reaping
+ *
+ *  The client stays in the trie until it's freed, so it may still be
+ *  matched by packets which arrive before the reaper gets to it; see
+ *  client_unexpire().
+ */
+static void client_expired(fr_io_client_t *client)
+{
+	fr_io_thread_t *thread = client->thread;
+
+	if (client->expired) return;
+
+	client->expired = true;
+	fr_dlist_insert_tail(&thread->expired_clients, client);
+	thread->num_expired_clients++;
+
+	if (thread->ev_reap) return;
+
+	if (fr_event_timer_in(thread, thread->el, &thread->ev_reap,
+			      IO_REAP_INTERVAL, client_reap_timer, thread) < 0) {
+		fr_dlist_remove(&thread->expired_clients, client);
+		thread->num_expired_clients--;
+		client->expired = false;
+		talloc_free(client);
+	}
+}
+
+/** A packet arrived for an expired client before it was reaped
+ *
+ *  The definition is still valid, so instead of freeing and redefining
+ *  the client, take it off the reap list and restart its idle timeout.
+ */
+static void client_unexpire(fr_io_client_t *client)
+{
+	fr_io_thread_t *thread = client->thread;
+
+	fr_dlist_remove(&thread->expired_clients, client);
+	thread->num_expired_clients--;
+	client->expired = false;
+	client->ready_to_delete = false;
+
+	client_expiry_timer(thread->el, 0, client);
+}
+
+/** Take a token from one accept bucket
+ *
+ *  Tokens are tracked in units of 1/1000 of a connection so that low
+ *  rates still refill smoothly.  The bucket depth is one second's
+ *  worth of tokens, which bounds the burst size.
+ *
+ * @param[in] b		the bucket to take from.
+ * @param[in] rate	configured refill rate, in connections per second.
+ * @param[in] now	the current time.
+ * @return whether a token was available.
+ */
+static bool accept_bucket_take(fr_io_accept_bucket_t *b, uint32_t rate, fr_time_t now)
+{
+	uint64_t max_tokens = (uint64_t) rate * 1000;
+
+	/*
+	 *	A new bucket starts out full.
+	 */
+	if (!b->last) {
+		b->tokens = max_tokens;
+	} else {
+		b->tokens += ((uint64_t) (now - b->last) * rate) / 1000000;
+		if (b->tokens > max_tokens) b->tokens = max_tokens;
+	}
+	b->last = now;
+
+	if (b->tokens < 1000) return false;
+
+	b->tokens -= 1000;
+	return true;
+}
+
+/** Check a new connection against the hierarchical accept limits
+ *
+ *  The global bucket is checked first, then the bucket for the source
+ *  network (/32 for IPv4, /64 for IPv6).  Per-source buckets are a
+ *  fixed hash table, so a partner opening connections as fast as we
+ *  can accept() them costs a bounded amount of memory, at the price of
+ *  sources which hash together sharing a limit.
+ *
+ * @param[in] inst	the listener instance, for the configured rates.
+ * @param[in] thread	holding the bucket state.
+ * @param[in] src	source address of the new connection.
+ * @return whether the connection should be accepted.
+ */
+static bool fr_io_accept_allowed(fr_io_instance_t const *inst, fr_io_thread_t *thread, fr_ipaddr_t const *src)
+{
+	fr_time_t now = fr_time();
+
+	if (inst->accept_rate &&
+	    !accept_bucket_take(&thread->accept_global, inst->accept_rate, now)) return false;
+
+	if (inst->accept_rate_per_source) {
+		fr_ipaddr_t	masked;
+		uint32_t	hash;
+
+		masked = *src;
+		fr_ipaddr_mask(&masked, (src->af == AF_INET) ? 32 : 64);
+		hash = fr_hash_fast(&masked, sizeof(masked));
+
+		if (!accept_bucket_take(&thread->accept_sources[hash & (ACCEPT_SOURCE_BUCKETS - 1)],
+					inst->accept_rate_per_source, now)) return false;
+	}
+
+	return true;
+}
+
 /**  Implement 99% of the read routines.
  *
  *  The app_io->read does the transport-specific data read.
@@ -1155,6 +1424,24 @@ redo:
 			 */
 			(void) getsockname(accept_fd, (struct sockaddr *) &saremote, &salen);
 			(void) fr_ipaddr_from_sockaddr(&saremote, salen, &address.dst_ipaddr, &address.dst_port);
+
+			/*
+			 *	Admission control before any connection
+			 *	state is allocated, and before any TLS
+			 *	handshake starts.  Overflow connections
+			 *	are reset (SO_LINGER 0 makes close()
+			 *	send RST) so neither end keeps state
+			 *	for them.
+			 */
+			if (!fr_io_accept_allowed(inst, thread, &address.src_ipaddr)) {
+				struct linger ling = { .l_onoff = 1, .l_linger = 0 };
+
+				DEBUG("proto_%s_%s - dropping connection from client %pV - too many new connections",
+				      inst->app->name, inst->transport, fr_box_ipaddr(address.src_ipaddr));
+				(void) setsockopt(accept_fd, SOL_SOCKET, SO_LINGER, &ling, sizeof(ling));
+				close(accept_fd);
+				return 0;
+			}
 		}
 
 	} else {
@@ -1235,9 +1522,28 @@ do_read:
 	 *	connected socket).
 	 */
 	if (!connection) {
-		client = fr_trie_lookup(thread->trie, &address.src_ipaddr.addr, address.src_ipaddr.prefix);
+		/*
+		 *	Packets from one source tend to arrive in
+		 *	bursts, so check the most recently matched
+		 *	client before descending into the trie.  The
+		 *	trie is owned by this network thread, so the
+		 *	cached pointer can't be invalidated under us.
+		 */
+		client = thread->last_client;
+		if (!client ||
+		    (fr_ipaddr_cmp(&client->src_ipaddr, &address.src_ipaddr) != 0)) {
+			client = fr_trie_lookup(thread->trie, &address.src_ipaddr.addr, address.src_ipaddr.prefix);
+			thread->last_client = client;
+		}
 		rad_assert(!client || !client->connection);
 
+		/*
+		 *	The client expired, but hadn't been reaped
+		 *	yet.  It's in use again, so resurrect it.
+		 */
+		if (client && client->expired &&
+		    (client->state == PR_CLIENT_DYNAMIC)) client_unexpire(client);
+
 	} else {
 		client = connection->client;
 
@@ -1371,10 +1677,10 @@ do_read:
 		/*
 		 *	Create the packet tracking table for this client.
 		 */
-		if (inst->app_io->track_duplicates) {
+		if (inst->track_duplicates) {
 			rad_assert(inst->app_io->compare != NULL);
-			MEM(client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								 NULL, RBTREE_FLAG_NONE));
+			rad_assert(inst->app_io->hash != NULL);
+			MEM(client->table = fr_hash_table_create(client, track_hash, track_cmp, NULL));
 		}
 
 		/*
@@ -1480,6 +1786,21 @@ have_client:
 				return 0;
 			}
 
+			/*
+			 *	Bound the pending queue per candidate
+			 *	client, too.  Otherwise one source
+			 *	flooding us (e.g. an address space
+			 *	scanner) can consume the entire pending
+			 *	budget, and stop other candidate
+			 *	clients from being defined.
+			 */
+			if (!connection && inst->max_pending_packets_per_client &&
+			    (fr_heap_num_elements(client->pending) >= inst->max_pending_packets_per_client)) {
+				DEBUG("Too many pending packets from candidate client %pV - discarding packet",
+				      fr_box_ipaddr(client->src_ipaddr));
+				return 0;
+			}
+
 			/*
 			 *	Allocate the pending packet structure.
 			 */
@@ -1808,6 +2129,16 @@ static void client_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 			return;
 		}
 
+		/*
+		 *	Defer freeing dynamic clients, so that a burst
+		 *	of simultaneous expiries is reaped a batch at a
+		 *	time instead of stalling the network thread.
+		 */
+		if (client->state == PR_CLIENT_DYNAMIC) {
+			client_expired(client);
+			return;
+		}
+
 		talloc_free(client);
 		return;
 	}
@@ -1965,7 +2296,8 @@ static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	track->packets--;
 
 	if (track->packets == 0) {
-		if (inst->app_io->track_duplicates) (void) rbtree_deletebydata(client->table, track);
+		if (inst->track_duplicates) (void) fr_hash_table_delete(client->table, track);
+		if (client->last_track == track) client->last_track = NULL;
 		talloc_free(track);
 
 	} else {
@@ -2406,6 +2738,13 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	inst->app_io_conf = inst->submodule->conf;
 	inst->app_io_instance = inst->submodule->data;
 
+	/*
+	 *	Inherit duplicate tracking from the transport.  The
+	 *	protocol may clear this flag after we return, for
+	 *	listeners which don't need it.
+	 */
+	inst->track_duplicates = inst->app_io->track_duplicates;
+
 	if (inst->app_io->bootstrap && (inst->app_io->bootstrap(inst->app_io_instance,
 								inst->app_io_conf) < 0)) {
 		cf_log_err(inst->app_io_conf, "Bootstrap failed for proto_%s", inst->app_io->name);
@@ -2774,6 +3113,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	MEM(thread->trie = fr_trie_alloc(thread));
 	MEM(thread->alive_clients = fr_heap_create(thread, alive_client_cmp,
 						   fr_io_client_t, alive_id));
+	fr_dlist_init(&thread->expired_clients, fr_io_client_t, expired_entry);
 
 	/*
 	 *	Set the listener to call our master trampoline function.
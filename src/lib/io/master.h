@@ -42,6 +42,7 @@ typedef struct {
 	fr_event_timer_t const		*ev;		//!< when we clean up this tracking entry
 	fr_time_t			timestamp;	//!< when this packet was received
 	int				packets;     	//!< number of packets using this entry
+	uint32_t			hash;		//!< precomputed hash for the tracking table
 	uint8_t				*reply;		//!< reply packet (if any)
 	size_t				reply_len;	//!< length of reply, or 1 for "do not reply"
 
@@ -75,8 +76,13 @@ typedef struct {
 	dl_module_inst_t const   	*dl_inst;			//!< our parent dl_inst
 
 	uint32_t			max_connections;		//!< maximum number of connections to allow
+	uint32_t			accept_rate;			//!< maximum number of connections accepted
+									///< per second.  0 means no limit
+	uint32_t			accept_rate_per_source;		//!< as above, per source network
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
+	uint32_t			max_pending_packets_per_client;	//!< maximum number of pending packets
+									///< for one candidate client
 
 	fr_time_delta_t			cleanup_delay;			//!< for Access-Request packets
 	fr_time_delta_t			idle_timeout;			//!< for dynamic clients
@@ -85,6 +91,12 @@ typedef struct {
 
 	bool				dynamic_clients;		//!< do we have dynamic clients.
 
+	bool				track_duplicates;		//!< do we track duplicate packets.
+									///< Initialized from the app_io.  The
+									///< protocol may clear it for low-rate
+									///< listeners, so that they don't pay
+									///< for a per-client tracking table.
+
 	CONF_SECTION			*server_cs;			//!< server CS for this listener
 
 	dl_module_inst_t		*submodule;			//!< As provided by the transport_parse
@@ -106,6 +106,12 @@ struct fr_message_set_t {
 	int			allocated;
 	int			freed;
 
+	int			outstanding_hwm; //!< high water mark of outstanding messages
+	int			mr_grown;	//!< times the message arrays were doubled
+	int			rb_grown;	//!< times the ring buffers were doubled
+	int			failed;		//!< allocations which failed outright
+	int			grown_snapshot;	//!< grow count at the last pre-grow check
+
 	fr_ring_buffer_t	*mr_array[MSG_ARRAY_SIZE]; //!< array of message arrays
 
 	fr_ring_buffer_t	*rb_array[MSG_ARRAY_SIZE]; //!< array of ring buffers
@@ -678,6 +684,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	fr_ring_buffer_t *mr;
 
 	ms->allocated++;
+	if ((ms->allocated - ms->freed) > ms->outstanding_hwm) ms->outstanding_hwm = ms->allocated - ms->freed;
 	*p_cleaned = false;
 
 	/*
@@ -745,6 +752,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	 */
 	if ((ms->mr_max + 1) >= MSG_ARRAY_SIZE) {
 		fr_strerror_printf("All message arrays are full");
+		ms->failed++;
 		return NULL;
 	}
 
@@ -755,6 +763,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
 	if (!mr) {
 		fr_strerror_printf_push("Failed allocating ring buffer");
+		ms->failed++;
 		return NULL;
 	}
 
@@ -766,6 +775,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	ms->mr_max++;
 	ms->mr_current = ms->mr_max;
 	ms->mr_array[ms->mr_max] = mr;
+	ms->mr_grown++;
 
 	MPRINT("SET MR to doubled %d\n", ms->mr_current);
 
@@ -773,7 +783,10 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	 *	And we should now have an entirely empty message ring.
 	 */
 	m = fr_message_ring_alloc(ms, mr, false);
-	if (!m) return NULL;
+	if (!m) {
+		ms->failed++;
+		return NULL;
+	}
 
 	MPRINT("ALLOC after doubled message ring\n");
 
@@ -891,6 +904,7 @@ alloc_rb:
 	ms->rb_max++;
 	ms->rb_current = ms->rb_max;
 	ms->rb_array[ms->rb_current] = rb;
+	ms->rb_grown++;
 
 	/*
 	 *	And we should now have an entirely empty message ring.
@@ -902,6 +916,7 @@ alloc_rb:
 cleanup:
 	MPRINT("OUT OF MEMORY\n");
 
+	ms->failed++;
 	m->rb = NULL;
 	m->status = FR_MESSAGE_DONE;
 	return NULL;
@@ -1277,6 +1292,82 @@ int fr_message_set_messages_used(fr_message_set_t *ms)
 	return used;
 }
 
+/** Return allocation telemetry for a message set
+ *
+ *  The counters cover the lifetime of the set, and are cheap to
+ *  read, so they can be polled for monitoring.
+ *
+ * @param[in] ms the message set
+ * @param[out] stats where the counters are written
+ */
+void fr_message_set_stats(fr_message_set_t *ms, fr_message_set_stats_t *stats)
+{
+	(void) talloc_get_type_abort(ms, fr_message_set_t);
+
+	stats->allocated = ms->allocated;
+	stats->freed = ms->freed;
+	stats->outstanding = ms->allocated - ms->freed;
+	stats->outstanding_hwm = ms->outstanding_hwm;
+	stats->mr_grown = ms->mr_grown;
+	stats->rb_grown = ms->rb_grown;
+	stats->failed = ms->failed;
+}
+
+/** Pre-grow the message set if it's trending upwards
+ *
+ *  Normally the arrays are doubled when an allocation fails, which
+ *  means the allocation (and copying) stall lands in the receive path,
+ *  mid-burst.  Call this function when the owning thread is idle.  If
+ *  the set has grown since the last check, i.e. load is trending
+ *  upwards, the next doubling is allocated immediately, so that the
+ *  next burst finds room already available.
+ *
+ *  The check is a single comparison when nothing has grown, so the
+ *  function can be called on every pass through the event loop.
+ *
+ * @param[in] ms the message set
+ * @return the number of arrays which were grown (0..2)
+ */
+int fr_message_set_pregrow(fr_message_set_t *ms)
+{
+	int grown = 0;
+	fr_ring_buffer_t *rb;
+
+	(void) talloc_get_type_abort(ms, fr_message_set_t);
+
+	if ((ms->mr_grown + ms->rb_grown) == ms->grown_snapshot) return 0;
+
+	/*
+	 *	Note that pre-growing does NOT update the grow
+	 *	counters.  Growth driven by this function therefore
+	 *	doesn't re-trigger it, and the set stabilises once the
+	 *	bursts fit.
+	 */
+	if ((ms->mr_max + 1) < MSG_ARRAY_SIZE) {
+		rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
+		if (rb) {
+			ms->mr_max++;
+			ms->mr_current = ms->mr_max;
+			ms->mr_array[ms->mr_max] = rb;
+			grown++;
+		}
+	}
+
+	if ((ms->rb_max + 1) < MSG_ARRAY_SIZE) {
+		rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
+		if (rb) {
+			ms->rb_max++;
+			ms->rb_current = ms->rb_max;
+			ms->rb_array[ms->rb_max] = rb;
+			grown++;
+		}
+	}
+
+	ms->grown_snapshot = ms->mr_grown + ms->rb_grown;
+
+	return grown;
+}
+
 /** Garbage collect the message set.
  *
  *  This function should ONLY be called just before freeing the
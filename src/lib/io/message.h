@@ -62,7 +62,22 @@ int fr_message_done(fr_message_t *m) CC_HINT(nonnull);
 
 fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t message_size) CC_HINT(nonnull);
 
+/** Allocation telemetry for a message set
+ *
+ */
+typedef struct {
+	uint64_t		allocated;	//!< messages allocated over the lifetime of the set
+	uint64_t		freed;		//!< messages cleaned up
+	int			outstanding;	//!< messages currently in use
+	int			outstanding_hwm; //!< high water mark of outstanding messages
+	int			mr_grown;	//!< times the message arrays were doubled
+	int			rb_grown;	//!< times the ring buffers were doubled
+	int			failed;		//!< allocations which failed outright
+} fr_message_set_stats_t;
+
 int fr_message_set_messages_used(fr_message_set_t *ms) CC_HINT(nonnull);
+void fr_message_set_stats(fr_message_set_t *ms, fr_message_set_stats_t *stats) CC_HINT(nonnull);
+int fr_message_set_pregrow(fr_message_set_t *ms) CC_HINT(nonnull);
 void fr_message_set_gc(fr_message_set_t *ms) CC_HINT(nonnull);
 
 void fr_message_set_debug(fr_message_set_t *ms, FILE *fp) CC_HINT(nonnull);
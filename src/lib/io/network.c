@@ -36,6 +36,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/journal.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/network.h>
 #include <freeradius-devel/io/queue.h>
@@ -44,6 +45,11 @@ RCSID("$Id$")
 
 #define MAX_WORKERS 64
 
+/*
+ *	Cap for growing default_message_size on stream sockets.
+ */
+#define MAX_MESSAGE_SIZE (65536)
+
 fr_thread_local_setup(fr_ring_buffer_t *, fr_network_rb)	/* macro */
 
 typedef struct {
@@ -125,6 +131,10 @@ struct fr_network_t {
 	int			max_workers;		//!< maximum number of allowed workers
 	int			num_sockets;		//!< actually a counter...
 
+	fr_time_delta_t		max_request_time;	//!< maximum time a request can be processed.
+							//!< Used to discard packets which can't make
+							//!< the deadline before they're queued.
+
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
 };
 
@@ -227,6 +237,14 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 		worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
 	}
 
+	/*
+	 *	The worker is done with the request, so it no longer
+	 *	needs to survive a crash.  Release its journal entry.
+	 */
+	if (cd->listen->journal && cd->reply.journal_seq) {
+		(void) fr_journal_ack(cd->listen->journal, cd->reply.journal_seq);
+	}
+
 	(void) fr_heap_insert(nr->replies, cd);
 }
 
@@ -319,15 +337,54 @@ static bool fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
 
 	/*
-	 *	Send the message to the channel.  If we fail, drop the
-	 *	packet.  The only reason for failure is that the
-	 *	worker isn't servicing it's input queue.  When that
-	 *	happens, we have no idea what to do, and the whole
-	 *	thing falls over.
+	 *	If the worker's queue is already deep enough that this
+	 *	packet can't be serviced before it hits
+	 *	max_request_time, drop it now.  The worker would
+	 *	discard it on dequeue anyway, but only after it had
+	 *	taken up channel space, and overload is exactly when
+	 *	we can't afford to shepherd doomed packets around.
+	 */
+	if (worker->predicted) {
+		fr_time_t backlog;
+
+		backlog = (fr_time_t) fr_channel_num_outstanding(worker->channel) * worker->predicted;
+		if ((cd->m.when - *cd->request.recv_time) + backlog > nr->max_request_time) {
+			DEBUG2("Dropping packet which cannot be serviced before max_request_time "
+			       "(backlog %" PRIu64 " requests)",
+			       (uint64_t) fr_channel_num_outstanding(worker->channel));
+			worker->stats.dropped++;
+			return false;
+		}
+	}
+
+	/*
+	 *	Send the message to the channel.  The only reason for
+	 *	failure is that the worker isn't servicing its input
+	 *	queue.  Rather than dropping the packet, move the work
+	 *	to the least loaded of the other workers.  The
+	 *	channels are strictly single producer / single
+	 *	consumer, so this redistribution at the sending side is
+	 *	the only place work can migrate between workers.
 	 */
 	if (fr_channel_send_request(worker->channel, cd) < 0) {
-		worker->stats.dropped++;
-		return false;
+		int			i;
+		fr_network_worker_t	*other = NULL;
+
+		for (i = 0; i < nr->num_workers; i++) {
+			if (nr->workers[i] == worker) continue;
+
+			if (!other || (nr->workers[i]->cpu_time < other->cpu_time)) {
+				other = nr->workers[i];
+			}
+		}
+
+		if (!other || (fr_channel_send_request(other->channel, cd) < 0)) {
+			ERROR("Failed sending packet to worker");
+			worker->stats.dropped++;
+			return false;
+		}
+
+		worker = other;
 	}
 
 	worker->stats.in++;
@@ -420,6 +477,7 @@ next_message:
 	}
 
 	cd->request.is_dup = false;
+	cd->request.journal_seq = 0;
 	cd->priority = PRIORITY_NORMAL;
 
 	/*
@@ -464,6 +522,20 @@ next_message:
 	nr->stats.in++;
 	s->stats.in++;
 
+	/*
+	 *	A stream socket filled the buffer, so the burst is
+	 *	larger than the buffer.  Reserve more space for the
+	 *	next read, so that a fast stream (e.g. a RadSec
+	 *	connection carrying traffic for many NASes) is drained
+	 *	with a few large reads, instead of one read per packet.
+	 */
+	if (s->leftover && (((size_t) data_size + s->leftover) >= s->listen->default_message_size) &&
+	    (s->listen->default_message_size < MAX_MESSAGE_SIZE)) {
+		s->listen->default_message_size *= 2;
+		DEBUG3("Growing message buffer for %s to %zu bytes",
+		       s->listen->name, s->listen->default_message_size);
+	}
+
 	/*
 	 *	Initialize the rest of the fields of the channel data.
 	 *
@@ -471,7 +543,7 @@ next_message:
 	 *	packet MAY be a duplicate packet magically resurrected
 	 *	from the past.
 	 */
-	cd->m.when = fr_time();
+	cd->m.when = fr_time_coarse();
 	cd->listen = s->listen;
 	cd->request.recv_time = recv_time;
 
@@ -498,8 +570,24 @@ next_message:
 		}
 	}
 
+	/*
+	 *	If the listener wants durability, append the raw packet
+	 *	to its journal before queueing it.  If the journal is
+	 *	full, we carry on without it, trading durability for
+	 *	liveness.
+	 */
+	if (s->listen->journal) {
+		cd->request.journal_seq = fr_journal_append(s->listen->journal, cd->m.data, cd->m.data_size);
+		if (!cd->request.journal_seq) DEBUG2("Failed journaling packet: %s", fr_strerror());
+	}
+
 	if (!fr_network_send_request(nr, cd)) {
-		ERROR("Failed sending packet to worker");
+		/*
+		 *	The NAS will retransmit the dropped packet, so
+		 *	don't let it pin the journal.
+		 */
+		if (cd->request.journal_seq) (void) fr_journal_ack(s->listen->journal, cd->request.journal_seq);
+
 		fr_message_done(&cd->m);
 		nr->stats.dropped++;
 		s->stats.dropped++;
@@ -523,6 +611,27 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Drain the socket before going back to the event loop.
+	 *
+	 *	A busy UDP socket almost always has more datagrams
+	 *	queued behind the one we just read.  Reading them now
+	 *	costs one extra read() which returns no data once the
+	 *	socket is empty, and saves a full event loop iteration
+	 *	per packet.  The num_messages check above still bounds
+	 *	how long any one socket can be serviced.
+	 */
+	cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+	if (!cd) {
+		ERROR("Failed allocating message size %zd! - Closing socket",
+		      s->listen->default_message_size);
+		fr_network_socket_dead(nr, s);
+		return;
+	}
+
+	num_messages++;
+	goto next_message;
 }
 
 
@@ -987,6 +1096,12 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 	nr->max_workers = MAX_WORKERS;
 	nr->num_workers = 0;
 
+	/*
+	 *	@todo make this configurable.  It MUST match the
+	 *	workers' max_request_time.
+	 */
+	nr->max_request_time = fr_time_delta_from_sec(30);
+
 	nr->kq = fr_event_list_kq(nr->el);
 	rad_assert(nr->kq >= 0);
 
@@ -1164,6 +1279,8 @@ static int fr_network_pre_event(void *ctx, UNUSED fr_time_t wake)
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_listen_t *last_li = NULL;
+	fr_network_socket_t *last_s = NULL;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
@@ -1175,10 +1292,18 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		li = cd->listen;
 
 		/*
-		 *	@todo - cache this somewhere so we don't need
-		 *	to do an rbtree lookup for every packet.
+		 *	Replies for the same listener tend to arrive in
+		 *	runs (e.g. everything on one UDP socket), so
+		 *	remember the last lookup instead of hitting the
+		 *	rbtree for every packet.
 		 */
-		s = rbtree_finddata(nr->sockets, &(fr_network_socket_t){ .listen = li });
+		if (li == last_li) {
+			s = last_s;
+		} else {
+			s = rbtree_finddata(nr->sockets, &(fr_network_socket_t){ .listen = li });
+			last_li = li;
+			last_s = s;
+		}
 
 		/*
 		 *	This shouldn't happen, but be safe...
@@ -1203,6 +1328,7 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 			 */
 			if (!s->outstanding) {
 				talloc_free(s);
+				last_li = NULL;
 			}
 
 			continue;
@@ -1314,7 +1440,10 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		 *	As a special case, allow write() to return
 		 *	"0", which means "close the socket".
 		 */
-		if (rcode == 0) fr_network_socket_dead(nr, s);
+		if (rcode == 0) {
+			fr_network_socket_dead(nr, s);
+			last_li = NULL;	/* The socket may have been freed */
+		}
 	}
 }
 
@@ -1556,6 +1685,47 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
 
+	if (s->ms) {
+		fr_message_set_stats_t ms_stats;
+
+		fr_message_set_stats(s->ms, &ms_stats);
+
+		fprintf(fp, "messages.allocated\t%" PRIu64 "\n", ms_stats.allocated);
+		fprintf(fp, "messages.outstanding\t%d\n", ms_stats.outstanding);
+		fprintf(fp, "messages.outstanding_hwm\t%d\n", ms_stats.outstanding_hwm);
+		fprintf(fp, "messages.array_grown\t%d\n", ms_stats.mr_grown);
+		fprintf(fp, "messages.buffer_grown\t%d\n", ms_stats.rb_grown);
+		fprintf(fp, "messages.failed\t%d\n", ms_stats.failed);
+	}
+
+	return 0;
+}
+
+static int event_stats_print(fr_event_cb_stats_t const *stats, void *uctx)
+{
+	FILE *fp = uctx;
+
+	fprintf(fp, "%s\t%" PRIu64 "\t%.1f\t%.1f\n",
+		stats->name, stats->calls,
+		(double) stats->ewma / 1000, (double) stats->max / 1000);
+	return 0;
+}
+
+static int cmd_stats_event(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_network_t const *nr = ctx;
+
+	// @todo - note that this isn't thread-safe!
+
+	/*
+	 *	Timing every callback isn't free, so collection only
+	 *	starts when someone first asks for the report.
+	 */
+	if (fr_event_list_cb_stats_walk(nr->el, event_stats_print, fp) < 0) {
+		(void) fr_event_list_instrument(nr->el, NSEC / 10);
+		fprintf(fp, "Event timing collection is now enabled.  Re-run this command to see results.\n");
+	}
+
 	return 0;
 }
 
@@ -1587,6 +1757,15 @@ fr_cmd_table_t cmd_network_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "stats network",
+		.add_name = true,
+		.name = "event",
+		.func = cmd_stats_event,
+		.help = "Show callback name, call count, EWMA and max runtime (us) for the event loop.",
+		.read_only = true
+	},
+
 	{
 		.parent = "show",
 		.name = "network",
@@ -221,8 +221,9 @@ done:
  */
 int fr_queue_localize_atomic(fr_queue_t *fq, fr_atomic_queue_t *aq)
 {
-	void *data;
-	int i, room;
+	void *batch[32];
+	int moved = 0, room;
+	size_t n, i;
 
 	(void) talloc_get_type_abort(fq, fr_queue_t);
 
@@ -233,20 +234,28 @@ int fr_queue_localize_atomic(fr_queue_t *fq, fr_atomic_queue_t *aq)
 	if (!room) return 0;
 
 	/*
-	 *	Pop as many entries as we have room for.
+	 *	Pop as many entries as we have room for, draining the
+	 *	atomic queue a batch at a time so we don't do one CAS
+	 *	per entry.
 	 */
-	for (i = 0; i < room; i++) {
-		if (!fr_atomic_queue_pop(aq, &data)) {
-			return i;
+	while (room > 0) {
+		n = fr_atomic_queue_pop_multi(aq, batch,
+					      ((size_t) room < (sizeof(batch) / sizeof(batch[0]))) ?
+					      (size_t) room : (sizeof(batch) / sizeof(batch[0])));
+		if (!n) break;
+
+		for (i = 0; i < n; i++) {
+			fq->entry[fq->head++] = batch[i];
+			if (fq->head >= fq->size) fq->head = 0;
+			fq->num++;
+			rad_assert(fq->num <= fq->size);
 		}
 
-		fq->entry[fq->head++] = data;
-		if (fq->head >= fq->size) fq->head = 0;
-		fq->num++;
-		rad_assert(fq->num <= fq->size);
+		room -= n;
+		moved += n;
 	}
 
-	return room;
+	return moved;
 }
 
 #ifndef NDEBUG
@@ -31,10 +31,17 @@ RCSID("$Id$")
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 
+#include <stdlib.h>
+
 #include <pthread.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -136,11 +143,17 @@ struct fr_schedule_t {
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	int		num_networks;		//!< number of network threads which started
+	uint32_t	next_network;		//!< round-robin assignment of listeners to networks
+	fr_schedule_network_t **sn;		//!< array of network threads
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
 
+static bool pin_threads = false;		//!< Pin network / worker threads to CPUs.
+static char const *network_cpu_list = NULL;	//!< CPUs to pin network threads to.
+static char const *worker_cpu_list = NULL;	//!< CPUs to pin worker threads to.
+
 /** Return the worker id for the current thread
  *
  * @return worker ID
@@ -150,6 +163,159 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Enable / disable pinning of scheduler threads to CPUs
+ *
+ * Must be called before #fr_schedule_create.
+ *
+ * @param[in] pin whether to pin threads.
+ */
+void fr_schedule_pin_threads(bool pin)
+{
+	pin_threads = pin;
+}
+
+/** Count, or pick the idx'th entry of, a CPU list like "0,2,8-15"
+ *
+ * @param[in] list	to parse.
+ * @param[in] idx	of the entry to return, or -1 to count the list.
+ * @param[out] cpu	the idx'th CPU, if idx >= 0.
+ * @return
+ *	- The number of CPUs in the list (or in the list up to and
+ *	  including idx, if idx was found).
+ *	- -1 on parse error.
+ */
+static int schedule_cpu_list_walk(char const *list, int idx, int *cpu)
+{
+	char const	*p = list;
+	int		count = 0;
+
+	while (*p) {
+		char	*end;
+		long	start, stop;
+
+		start = strtol(p, &end, 10);
+		if ((end == p) || (start < 0)) return -1;
+
+		stop = start;
+		p = end;
+		if (*p == '-') {
+			p++;
+			stop = strtol(p, &end, 10);
+			if ((end == p) || (stop < start)) return -1;
+			p = end;
+		}
+
+		for (; start <= stop; start++) {
+			if (cpu && (count == idx)) {
+				*cpu = (int) start;
+				return count + 1;
+			}
+			count++;
+		}
+
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+		if (*p) return -1;
+	}
+
+	return count;
+}
+
+/** Pin network and worker threads to explicit CPU lists
+ *
+ * Overrides the sequential assignment done by #fr_schedule_pin_threads,
+ * so that the network threads can be placed on the cores which receive
+ * the NIC interrupts, and the workers kept off of them.
+ *
+ * Must be called before #fr_schedule_create.  Lists wrap if there are
+ * more threads than CPUs in the list.
+ *
+ * @param[in] networks	CPU list for network threads, e.g. "0,2", may be NULL.
+ * @param[in] workers	CPU list for worker threads, e.g. "4-15", may be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a list failed to parse.
+ */
+int fr_schedule_cpu_affinity(char const *networks, char const *workers)
+{
+	if (networks) {
+		if (schedule_cpu_list_walk(networks, -1, NULL) <= 0) {
+			fr_strerror_printf("Invalid CPU list \"%s\"", networks);
+			return -1;
+		}
+		network_cpu_list = networks;
+	}
+
+	if (workers) {
+		if (schedule_cpu_list_walk(workers, -1, NULL) <= 0) {
+			fr_strerror_printf("Invalid CPU list \"%s\"", workers);
+			return -1;
+		}
+		worker_cpu_list = workers;
+	}
+
+	if (networks || workers) pin_threads = true;
+
+	return 0;
+}
+
+/** Pin the calling thread to one CPU
+ *
+ * If explicit CPU lists were given via #fr_schedule_cpu_affinity, the
+ * thread is pinned to the idx'th entry of the relevant list, wrapping
+ * if the list is shorter than the number of threads.
+ *
+ * Otherwise the network threads are pinned to the first CPUs, and the
+ * workers to the CPUs after them.  CPUs are normally numbered with one
+ * NUMA node's CPUs first, so this keeps the network threads and the
+ * first workers on the same node.
+ *
+ * Each thread allocates its own event list, message sets and ring
+ * buffers after this is called, so with first-touch allocation that
+ * memory ends up local to the node the thread runs on.
+ *
+ * @param[in] sc	the scheduler, for logging.
+ * @param[in] idx	of this thread amongst its kind (network or worker).
+ * @param[in] network	true if this is a network thread.
+ */
+static void fr_schedule_thread_pin(UNUSED fr_schedule_t *sc, UNUSED int idx, UNUSED bool network)
+{
+#ifdef __linux__
+	cpu_set_t	cpus;
+	long		num_cpus;
+	int		cpu;
+	char const	*list;
+
+	if (!pin_threads) return;
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cpus <= 0) return;
+
+	list = network ? network_cpu_list : worker_cpu_list;
+	if (list) {
+		int count;
+
+		count = schedule_cpu_list_walk(list, -1, NULL);
+		(void) schedule_cpu_list_walk(list, idx % count, &cpu);
+	} else {
+		cpu = network ? idx : idx + sc->max_networks;
+	}
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu % num_cpus, &cpus);
+
+	/*
+	 *	Not fatal.  The thread just runs wherever the kernel
+	 *	puts it, as before.
+	 */
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+		INFO("Failed pinning thread to CPU %ld: %s", (long)(cpu % num_cpus), fr_syserror(errno));
+	}
+#endif
+}
+
 /** Initialize and run the worker thread.
  *
  * @param[in] arg the fr_schedule_worker_t
@@ -161,10 +327,18 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_worker_t		*sw = talloc_get_type_abort(arg, fr_schedule_worker_t);
 	fr_schedule_t			*sc = sw->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
+	int				i;
 	char buffer[32];
 
 	worker_id = sw->id;		/* Store the current worker ID */
 
+	/*
+	 *	Pin ourselves before allocating anything, so that our
+	 *	memory is faulted in on the node we'll run on.  The
+	 *	first CPUs belong to the network threads.
+	 */
+	fr_schedule_thread_pin(sc, sw->id, false);
+
 	sw->ctx = ctx = talloc_init("worker %d", sw->id);
 	if (!ctx) {
 		ERROR("Worker %d - Failed allocating memory", sw->id);
@@ -200,7 +374,13 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->nr, sw->worker);
+	/*
+	 *	Attach ourselves to every network thread, so that each
+	 *	of them has a channel to us.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		(void) fr_network_worker_add(sc->sn[i]->nr, sw->worker);
+	}
 
 	DEBUG3("Spawned async worker %d", sw->id);
 
@@ -254,6 +434,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("Network %d starting\n", sn->id);
 
+	fr_schedule_thread_pin(sc, sn->id, true);
+
 	sn->ctx = ctx = talloc_init("network %d", sn->id);
 	if (!ctx) {
 		ERROR("Network %d - Failed allocating memory", sn->id);
@@ -280,7 +462,7 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	sem_post(&sc->semaphore);
 
-	DEBUG3("Spawned asycn network 0");
+	DEBUG3("Spawned async network %d", sn->id);
 
 	/*
 	 *	Do all of the work.
@@ -456,25 +638,32 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	}
 
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first, as the workers
+	 *	attach themselves to each network when they start.
+	 *
+	 *	Listeners are assigned round-robin across the network
+	 *	threads, so inbound traffic scales past one core.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
+	sc->sn = talloc_zero_array(sc, fr_schedule_network_t *, sc->max_networks);
 
-	if (fr_schedule_pthread_create(&sc->sn->pthread_id, fr_schedule_network_thread, sc->sn) < 0) {
-		ERROR("Failed creating network thread %s", fr_strerror());
-		goto fail;
-	}
+	for (i = 0; i < sc->max_networks; i++) {
+		sc->sn[i] = talloc_zero(sc, fr_schedule_network_t);
+		sc->sn[i]->sc = sc;
+		sc->sn[i]->id = i;
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		fr_schedule_destroy(sc);
-		if (sc->sn->ctx) TALLOC_FREE(sc->sn->ctx);
-		TALLOC_FREE(sc->sn);
-		return NULL;
+		if (fr_schedule_pthread_create(&sc->sn[i]->pthread_id, fr_schedule_network_thread, sc->sn[i]) < 0) {
+			ERROR("Failed creating network thread %s", fr_strerror());
+			goto fail;
+		}
+
+		SEM_WAIT_INTR(&sc->semaphore);
+		if (sc->sn[i]->status != FR_CHILD_RUNNING) {
+		fail:
+			fr_schedule_destroy(sc);
+			return NULL;
+		}
+
+		sc->num_networks++;
 	}
 
 	/*
@@ -554,9 +743,14 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
-	if (fr_command_register_hook(NULL, "0", sc->sn->nr, cmd_network_table) < 0) {
-		ERROR("Failed adding network commands: %s", fr_strerror());
-		goto st_fail;
+	for (i = 0; i < sc->num_networks; i++) {
+		char buffer[32];
+
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		if (fr_command_register_hook(NULL, buffer, sc->sn[i]->nr, cmd_network_table) < 0) {
+			ERROR("Failed adding network commands: %s", fr_strerror());
+			goto st_fail;
+		}
 	}
 
 	if (sc) INFO("Scheduler created successfully with %d networks and %d workers",
@@ -593,18 +787,19 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	}
 
 	rad_assert(sc->sn);
-	rad_assert(sc->num_workers > 0);
 
 	/*
-	 *	If the network thread is running, tell it to exit, and
-	 *	wait for it to do so.  Once it's exited, we know that
-	 *	this thread can use the network channels to tell the
-	 *	workers that the network side is going away.
+	 *	If the network threads are running, tell them to exit,
+	 *	and wait for them to do so.  Once they've exited, we
+	 *	know that this thread can use the network channels to
+	 *	tell the workers that the network side is going away.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->nr);
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->sn[i]->status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sc->sn[i]->nr);
 		SEM_WAIT_INTR(&sc->semaphore);
-		fr_network_destroy(sc->sn->nr);
+		fr_network_destroy(sc->sn[i]->nr);
 	}
 
 	/*
@@ -650,7 +845,9 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		talloc_free(sw->ctx);
 	}
 
-	TALLOC_FREE(sc->sn->ctx);
+	for (i = 0; i < sc->num_networks; i++) {
+		TALLOC_FREE(sc->sn[i]->ctx);
+	}
 
 	sem_destroy(&sc->semaphore);
 
@@ -681,7 +878,13 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->nr;
+		/*
+		 *	Assign listeners round-robin across the network
+		 *	threads.  With SO_REUSEPORT sockets bound to
+		 *	the same port, the kernel then hashes flows
+		 *	across the threads.
+		 */
+		nr = sc->sn[sc->next_network++ % sc->num_networks]->nr;
 	}
 
 	if (fr_network_listen_add(nr, li) < 0) return NULL;
@@ -706,7 +909,7 @@ fr_network_t *fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->nr;
+		nr = sc->sn[0]->nr;
 	}
 
 	if (fr_network_directory_add(nr, li) < 0) return NULL;
@@ -56,6 +56,9 @@ typedef int (*fr_schedule_thread_instantiate_t)(TALLOC_CTX *ctx, fr_event_list_t
 
 int			fr_schedule_worker_id(void);
 
+void			fr_schedule_pin_threads(bool pin);
+int			fr_schedule_cpu_affinity(char const *networks, char const *workers);
+
 int			fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *arg);
 fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, fr_log_lvl_t lvl,
 					    int max_inputs, int max_workers,
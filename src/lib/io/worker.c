@@ -67,6 +67,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/dlist.h>
 
@@ -78,6 +79,16 @@ typedef struct {
 	fr_heap_t	*heap;			//!< heap, ordered by priority
 } fr_worker_heap_t;
 
+/**
+ *  One runnable queue per priority class, drained by deficit round
+ *  robin so that no class can monopolize the worker.
+ */
+typedef struct {
+	fr_heap4_t	*heap;			//!< runnable requests in this class
+	uint32_t	weight;			//!< requests served per round robin turn
+	uint32_t	deficit;	       	//!< serves left in the current turn
+} fr_worker_class_t;
+
 #ifndef NDEBUG
 static void fr_worker_verify(fr_worker_t *worker);
 #define WORKER_VERIFY fr_worker_verify(worker)
@@ -118,18 +129,35 @@ struct fr_worker_t {
 
 	size_t			talloc_pool_size; //!< for each REQUEST
 
+	size_t			memory_limit;	//!< stop requests which use more memory than this
+	size_t			memory_max;	//!< most memory used by a single request
+	uint64_t		memory_buckets[16]; //!< histogram of per-request memory use, by powers of two
 
 	fr_worker_heap_t	to_decode;	//!< messages from the master, to be decoded or localized
 	fr_worker_heap_t       	localized;	//!< localized messages to be decoded
 
-	fr_heap_t      		*runnable;	//!< current runnable requests which we've spent time processing
-	fr_heap_t		*time_order;	//!< time ordered heap of requests
+	fr_worker_class_t	runnable[4];	//!< runnable requests, one queue per priority class
+	int			drain_class;	//!< which of the weighted classes round robin looks at next
+	fr_heap4_t		*time_order;	//!< time ordered heap of requests
 	rbtree_t		*dedup;		//!< de-dup tree
 
+	fr_dlist_head_t		free_requests;	//!< recycled request skeletons, ready for reuse
+	int			num_free_requests; //!< number of entries in free_requests
+
+	fr_dlist_head_t		dead_requests;	//!< completed requests awaiting deferred teardown
+	int			num_dead_requests; //!< number of entries in dead_requests
+
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
 
+	fr_time_elapsed_t	queue_time[4];	//!< histogram of time spent queued, by priority
+	fr_time_elapsed_t	processing_time[4]; //!< histogram of time spent processing, by priority
+	fr_time_elapsed_t	total_time[4];	//!< histogram of request to reply time, by priority
+
+	fr_worker_trace_t	trace_ring[WORKER_TRACE_RING_SIZE]; //!< hop timestamps of sampled requests
+	uint64_t		trace_next;	//!< number of requests sampled, masked for the ring position
+
 	uint64_t       		num_decoded;	//!< number of messages which have been decoded
 	uint64_t    		num_timeouts;	//!< number of messages which timed out
 	uint64_t    		num_active;	//!< number of active requests
@@ -150,6 +178,114 @@ struct fr_worker_t {
 
 static void fr_worker_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
 
+/*
+ *	The channels map packet types onto a small number of priority
+ *	classes, so the latency histograms are kept per priority class.
+ */
+static char const *worker_latency_names[4] = {
+	"now", "high", "normal", "low"
+};
+
+/*
+ *	The worker servicing this thread, so that code running inside
+ *	of a request (e.g. process modules) can ask about the load of
+ *	the worker it's running in.
+ */
+static _Thread_local fr_worker_t *worker_self;
+
+/*
+ *	Upper bounds for the memory histogram buckets.  Bucket N counts
+ *	requests which used less than 2^(11 + N) bytes, with everything
+ *	larger falling into the last bucket.
+ */
+static char const *worker_memory_names[16] = {
+	"2K", "4K", "8K", "16K", "32K", "64K", "128K", "256K",
+	"512K", "1M", "2M", "4M", "8M", "16M", "32M", "more"
+};
+
+/*
+ *	Hop timestamps are sampled for 1-in-N decoded packets, and kept
+ *	in a per-worker ring which is exported via radmin.  Sampling
+ *	costs one fr_time() call per hop, so it's cheap enough to leave
+ *	enabled.
+ */
+#define WORKER_TRACE_RING_SIZE	(256)	//!< sampled requests remembered per worker, must be a power of two
+#define WORKER_TRACE_INTERVAL	(64)	//!< sample hop timestamps for 1-in-N decoded packets
+
+static int worker_latency_class(uint32_t priority)
+{
+	if (priority >= PRIORITY_NOW) return 0;
+	if (priority >= PRIORITY_HIGH) return 1;
+	if (priority >= PRIORITY_NORMAL) return 2;
+
+	return 3;
+}
+
+/** Return the runnable heap a request belongs to
+ *
+ */
+static fr_heap4_t *worker_runnable_heap(fr_worker_t *worker, REQUEST const *request)
+{
+	return worker->runnable[worker_latency_class(request->async->priority)].heap;
+}
+
+/** Total number of runnable requests, over all classes
+ *
+ */
+static uint32_t worker_num_runnable(fr_worker_t const *worker)
+{
+	uint32_t num = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) num += fr_heap4_num_elements(worker->runnable[i].heap);
+
+	return num;
+}
+
+/** Pop the next runnable request, interleaving the priority classes
+ *
+ *  "now" requests always run first.  The remaining classes share the
+ *  worker in proportion to their configured weights, so a flood of
+ *  packets in one class delays the others by at most a few round
+ *  robin turns, instead of starving them outright.
+ *
+ * @param[in] worker the worker
+ * @return
+ *	- NULL no runnable requests.
+ *	- REQUEST the next request to run.
+ */
+static REQUEST *worker_runnable_pop(fr_worker_t *worker)
+{
+	REQUEST *request;
+	int i;
+
+	request = fr_heap4_pop(worker->runnable[0].heap);
+	if (request) return request;
+
+	for (i = 0; i < 3; i++) {
+		fr_worker_class_t *class = &worker->runnable[1 + worker->drain_class];
+
+		if (fr_heap4_num_elements(class->heap) == 0) {
+			class->deficit = 0;	/* empty classes don't bank credit */
+			worker->drain_class = (worker->drain_class + 1) % 3;
+			continue;
+		}
+
+		if (!class->deficit) class->deficit = class->weight;
+		class->deficit--;
+
+		/*
+		 *	This class has used up its turn, the next pop
+		 *	starts with the next class.
+		 */
+		if (!class->deficit) worker->drain_class = (worker->drain_class + 1) % 3;
+
+		return fr_heap4_pop(class->heap);
+	}
+
+	return NULL;
+}
+
 /*
  *	We need wrapper macros because we have multiple instances of
  *	the same code.
@@ -396,6 +532,7 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	reply->reply.cpu_time = worker->tracking.running;
 	reply->reply.processing_time = 10; /* @todo - set to something better? */
 	reply->reply.request_time = cd->m.when;
+	reply->reply.journal_seq = cd->request.journal_seq;
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
@@ -417,9 +554,107 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 
 static void worker_reset_timer(fr_worker_t *worker);
 
+/*
+ *	Maximum number of recycled request skeletons kept per worker.
+ */
+#define WORKER_MAX_FREE_REQUESTS (256)
+
+/*
+ *	Maximum number of completed requests whose teardown can be
+ *	deferred.  Once the list is this long it's drained in full, so
+ *	the destructor cost is amortized over a batch instead of being
+ *	paid per packet.
+ */
+#define WORKER_MAX_DEAD_REQUESTS (64)
+
+/** Get a request skeleton, from the free list where possible
+ *
+ *  Building the request hierarchy (pool, stack, log ctx) is a
+ *  significant fraction of per-packet work, so completed requests are
+ *  reset and recycled rather than rebuilt from scratch.
+ *
+ * @param[in] worker the worker
+ * @return a request, or NULL on allocation failure
+ */
+static REQUEST *worker_request_alloc(fr_worker_t *worker)
+{
+	REQUEST *request;
+
+	request = fr_dlist_head(&worker->free_requests);
+	if (request) {
+		fr_dlist_remove(&worker->free_requests, request);
+		worker->num_free_requests--;
+		return request;
+	}
+
+	/*
+	 *	Resetting a request awaiting deferred teardown is still
+	 *	cheaper than building a new hierarchy from scratch.
+	 */
+	request = fr_dlist_head(&worker->dead_requests);
+	if (request) {
+		fr_dlist_remove(&worker->dead_requests, request);
+		worker->num_dead_requests--;
+		request_reset(request);
+		return request;
+	}
+
+	return request_alloc_pooled(NULL, worker->talloc_pool_size);
+}
+
+/** Tear down completed requests
+ *
+ *  Walking the request hierarchy firing destructors is a measurable
+ *  fraction of per-packet wall time, and none of it is urgent.  So
+ *  worker_request_free() only parks completed requests on a list, and
+ *  this function does the actual work in batches, or when the worker
+ *  is otherwise idle.
+ *
+ * @param[in] worker the worker
+ */
+static void worker_request_cleanup(fr_worker_t *worker)
+{
+	REQUEST *request;
+
+	while ((request = fr_dlist_head(&worker->dead_requests)) != NULL) {
+		fr_dlist_remove(&worker->dead_requests, request);
+		worker->num_dead_requests--;
+
+		if (worker->num_free_requests >= WORKER_MAX_FREE_REQUESTS) {
+			talloc_free(request);
+			continue;
+		}
+
+		request_reset(request);
+		fr_dlist_insert_head(&worker->free_requests, request);
+		worker->num_free_requests++;
+	}
+}
+
+/** Park a finished request for deferred teardown
+ *
+ *  The request isn't reset or freed here, just queued, which keeps the
+ *  destructor walk off the latency-critical path.
+ *
+ * @param[in] worker the worker
+ * @param[in] request the request, which MUST have been removed from all
+ *	      queues and trees which reference it.
+ */
+static void worker_request_free(fr_worker_t *worker, REQUEST *request)
+{
+	fr_dlist_insert_tail(&worker->dead_requests, request);
+	worker->num_dead_requests++;
+
+	/*
+	 *	Don't let a sustained load spike hoard memory.
+	 */
+	if (worker->num_dead_requests >= WORKER_MAX_DEAD_REQUESTS) worker_request_cleanup(worker);
+}
+
 
 /** Reply to a request
  *
+
  *  And clean it up.
  *
  * @param[in] worker the worker
@@ -442,6 +677,8 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 
 	now = fr_time();
 
+	if (request->async->trace) request->async->trace->done = now;
+
 	/*
 	 *	If it's a fake request, don't send a real reply.
 	 *	Just toss the request.
@@ -492,6 +729,8 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 		(void) fr_message_alloc(ms, &reply->m, slen);
 	}
 
+	if (request->async->trace) request->async->trace->encoded = fr_time();
+
 	/*
 	 *	The request is done.  Track that.
 	 */
@@ -516,6 +755,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	reply->reply.cpu_time = worker->tracking.running;
 	reply->reply.processing_time = request->async->tracking.running;
 	reply->reply.request_time = request->async->recv_time;
+	reply->reply.journal_seq = request->async->journal_seq;
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
@@ -526,6 +766,19 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	fr_time_elapsed_update(&worker->cpu_time, now, now + reply->reply.processing_time);
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
 
+	/*
+	 *	Bucket incrementing is constant time, so we can do it
+	 *	on the hot path.
+	 */
+	{
+		int idx = worker_latency_class(request->async->priority);
+		fr_time_tracking_t const *tracking = &request->async->tracking;
+
+		fr_time_elapsed_update(&worker->queue_time[idx], reply->reply.request_time, tracking->start);
+		fr_time_elapsed_update(&worker->processing_time[idx], now, now + tracking->running);
+		fr_time_elapsed_update(&worker->total_time[idx], reply->reply.request_time, now);
+	}
+
 	RDEBUG("finished request.");
 
 	/*
@@ -535,14 +788,42 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 		DEBUG2("\t%sfails sending reply", worker->name);
 	}
 
+	if (request->async->trace) {
+		request->async->trace->sent = fr_time();
+		request->async->trace = NULL;
+	}
+
 	worker->stats.out++;
 
 	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
+	 *	Update the running average of per-request memory use,
+	 *	so that the pools for new requests are sized to fit
+	 *	without having to fall back to the heap.
 	 */
-	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
-	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
+	{
+		int bucket;
+		size_t used;
+
+		used = talloc_total_size(request);
+		worker->talloc_pool_size = ((worker->talloc_pool_size * 7) + used) / 8;
+		if (worker->talloc_pool_size < 4096) worker->talloc_pool_size = 4096;
+
+		/*
+		 *	Track the high-water mark, and a histogram of
+		 *	per-request memory use.  The histogram tells
+		 *	the administrator how to size the request
+		 *	pools, where the running average above hides
+		 *	the outliers.
+		 */
+		if (used > worker->memory_max) worker->memory_max = used;
+
+		bucket = 0;
+		while (((used >> (11 + bucket)) != 0) && (bucket < 15)) bucket++;
+		worker->memory_buckets[bucket]++;
+	}
+
+	if (request->time_order_id >= 0) (void) fr_heap4_extract(worker->time_order, request);
+	if (request->runnable_id >= 0) (void) fr_heap4_extract(request->backlog, request);
 
 finished:
 	rad_assert(request->time_order_id < 0);
@@ -559,7 +840,7 @@ finished:
 #endif
 
 	DEBUG3("freeing request");
-	talloc_free(request);
+	worker_request_free(worker, request);
 }
 
 
@@ -576,8 +857,8 @@ static void worker_stop_request(fr_worker_t *worker, REQUEST *request, fr_time_t
 	 *	be in the runnable list, but if not, no worries.  It
 	 *	MAY be in the dedup list, but if not, no worries.
 	 */
-	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
-	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
+	if (request->time_order_id >= 0) (void) fr_heap4_extract(worker->time_order, request);
+	if (request->runnable_id >= 0) (void) fr_heap4_extract(request->backlog, request);
 	(void) rbtree_deletebydata(worker->dedup, request);
 
 #ifndef NDEBUG
@@ -607,7 +888,7 @@ static void fr_worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_tim
 	 *	Look at the oldest requests, and see if they need to
 	 *	be deleted.
 	 */
-	while ((request = fr_heap_peek_tail(worker->time_order)) != NULL) {
+	while ((request = fr_heap4_peek_tail(worker->time_order)) != NULL) {
 		REQUEST_VERIFY(request);
 
 		/*
@@ -637,7 +918,7 @@ static void worker_reset_timer(fr_worker_t *worker)
 	fr_time_t	cleanup;
 	REQUEST		*request;
 
-	request = fr_heap_peek_tail(worker->time_order);
+	request = fr_heap4_peek_tail(worker->time_order);
 	if (!request) return;
 	rad_assert(worker->num_active > 0);
 
@@ -756,7 +1037,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	/*
 	 *	Grab a runnable request, and resume it.
 	 */
-	request = fr_heap_pop(worker->runnable);
+	request = worker_runnable_pop(worker);
 	if (request) {
 		DEBUG3("%s found runnable request", worker->name);
 		REQUEST_VERIFY(request);
@@ -783,11 +1064,16 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		worker->num_decoded++;
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
-	if (!request) goto nak;
+	/*
+	 *	Allocate the request at the head of its own talloc
+	 *	pool, sized from a running average of per-request
+	 *	memory use, so that decoded pairs are carved out of
+	 *	the pool and freed in one operation at teardown.
+	 */
+	ctx = request = worker_request_alloc(worker);
+	if (unlikely(!request)) goto nak;
 
 	request->el = worker->el;
-	request->backlog = worker->runnable;
 	request->packet = fr_radius_alloc(request, false);
 	request->packet->timestamp = *cd->request.recv_time; /* Legacy - Remove once everything looks at request->async */
 	rad_assert(request->packet != NULL);
@@ -822,8 +1108,32 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
+	request->async->priority = cd->priority;
+	request->async->journal_seq = cd->request.journal_seq;
 	listen = request->async->listen;
 
+	/*
+	 *	The request is re-inserted into the runnable heap for
+	 *	its priority class when it becomes resumable.
+	 */
+	request->backlog = worker_runnable_heap(worker, request);
+
+	/*
+	 *	Sample hop timestamps for 1-in-N decoded packets.  The
+	 *	remaining hops are filled in as the request progresses.
+	 */
+	if ((worker->num_decoded % WORKER_TRACE_INTERVAL) == 0) {
+		fr_worker_trace_t *trace;
+
+		trace = &worker->trace_ring[worker->trace_next++ & (WORKER_TRACE_RING_SIZE - 1)];
+		memset(trace, 0, sizeof(*trace));
+		trace->number = request->number;
+		trace->priority = cd->priority;
+		trace->recv = request->async->recv_time;
+		trace->dequeue = now;
+		request->async->trace = trace;
+	}
+
 	/*
 	 *	Now that the "request" structure has been initialized, go decode the packet.
 	 *
@@ -842,6 +1152,8 @@ nak:
 		return NULL;
 	}
 
+	if (request->async->trace) request->async->trace->decoded = fr_time();
+
 	/*
 	 *	Call the main protocol handler to set the right async
 	 *	process function.
@@ -945,7 +1257,7 @@ nak:
 	 *	are only removed when the request is done / free'd.
 	 */
 	rad_assert(request->time_order_id < 0);
-	(void) fr_heap_insert(worker->time_order, request);
+	(void) fr_heap4_insert(worker->time_order, request);
 
 	/*
 	 *	Bootstrap the async state machine with the initial
@@ -984,13 +1296,15 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 
 	RDEBUG("running request");
 
+	if (request->async->trace && !request->async->trace->run) request->async->trace->run = fr_time();
+
 	/*
 	 *	If we still have the same packet, and the channel is
 	 *	active, run it.  Otherwise, tell it that it's done.
 	 */
-	if ((*request->async->original_recv_time == request->async->recv_time) &&
-	    (request->async->fake ||
-	     fr_channel_active(request->async->channel))) {
+	if (likely((*request->async->original_recv_time == request->async->recv_time) &&
+		   (request->async->fake ||
+		    fr_channel_active(request->async->channel)))) {
 		final = request->async->process(request->async->process_inst, request);
 
 	} else {
@@ -1016,6 +1330,24 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 		break;
 
 	case RLM_MODULE_YIELD:
+		/*
+		 *	Stop runaway requests before they exhaust the
+		 *	server.  Walking the talloc hierarchy is too
+		 *	expensive to do per instruction, so the check
+		 *	runs only when the request yields.
+		 */
+		if (worker->memory_limit) {
+			size_t used = talloc_total_size(request);
+
+			if (used > worker->memory_limit) {
+				RERROR("request has used %zu bytes of memory (limit %zu) - telling it to stop.",
+				       used, worker->memory_limit);
+				unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+				size = 1;
+				break;
+			}
+		}
+
 		fr_time_tracking_yield(&request->async->tracking, fr_time(), &worker->tracking);
 		return;
 
@@ -1066,7 +1398,7 @@ static int fr_worker_pre_event(void *ctx, fr_time_t wake)
 	 *	more to do, we need to tell the other end of the
 	 *	channels that we're sleeping.
 	 */
-	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
+	sleeping = (worker_num_runnable(worker) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
 
@@ -1080,6 +1412,12 @@ static int fr_worker_pre_event(void *ctx, fr_time_t wake)
 		return 1;
 	}
 
+	/*
+	 *	Nothing is runnable, so this is the cheapest possible
+	 *	time to tear down completed requests.
+	 */
+	worker_request_cleanup(worker);
+
 	/*
 	 *	The application is polling the event loop, but has
 	 *	other work to do.  Don't do anything special here, as
@@ -1090,7 +1428,7 @@ static int fr_worker_pre_event(void *ctx, fr_time_t wake)
 
 	DEBUG3("\t%s sleeping running %u, localized %u, to_decode %u",
 	       worker->name,
-	       fr_heap_num_elements(worker->runnable),
+	       worker_num_runnable(worker),
 	       fr_heap_num_elements(worker->localized.heap),
 	       fr_heap_num_elements(worker->to_decode.heap));
 	DEBUG3("\t%s requests %" PRIu64 ", decoded %" PRIu64 ", replied %" PRIu64 " active %" PRIu64 "",
@@ -1139,26 +1477,26 @@ static int8_t worker_message_cmp(void const *one, void const *two)
 
 /**
  *  Track a REQUEST in the "runnable" heap.
+ *
+ *  Ordered by priority, and within a priority, oldest first.
  */
-static int8_t worker_runnable_cmp(void const *one, void const *two)
+static void worker_runnable_key(uint64_t *key1, uint64_t *key2, void const *data)
 {
-	REQUEST const *a = one, *b = two;
-	int ret;
+	REQUEST const *request = data;
 
-	ret = (a->async->priority > b->async->priority) - (a->async->priority < b->async->priority);
-	if (ret != 0) return ret;
-
-	return (a->async->recv_time > b->async->recv_time) - (a->async->recv_time < b->async->recv_time);
+	*key1 = request->async->priority;
+	*key2 = (uint64_t) request->async->recv_time;
 }
 
 /**
  *  Track a REQUEST in the "time_order" heap.
  */
-static int8_t worker_time_order_cmp(void const *one, void const *two)
+static void worker_time_order_key(uint64_t *key1, uint64_t *key2, void const *data)
 {
-	REQUEST const *a = one, *b = two;
+	REQUEST const *request = data;
 
-	return (a->async->recv_time > b->async->recv_time) - (a->async->recv_time < b->async->recv_time);
+	*key1 = (uint64_t) request->async->recv_time;
+	*key2 = 0;
 }
 
 /**
@@ -1211,12 +1549,27 @@ void fr_worker_destroy(fr_worker_t *worker)
 	 *	which are still waiting for timers or file descriptor
 	 *	events.
 	 */
-	while ((request = fr_heap_peek(worker->time_order)) != NULL) {
+	while ((request = fr_heap4_peek(worker->time_order)) != NULL) {
 		RDEBUG("server is exiting - telling request to stop.");
 		worker_stop_request(worker, request, now);
 		talloc_free(request);
 	}
-	rad_assert(fr_heap_num_elements(worker->runnable) == 0);
+	rad_assert(worker_num_runnable(worker) == 0);
+
+	/*
+	 *	Free any requests awaiting deferred teardown, and the
+	 *	recycled request skeletons.  Both are parented from
+	 *	NULL, not from the worker.
+	 */
+	while ((request = fr_dlist_head(&worker->dead_requests)) != NULL) {
+		fr_dlist_remove(&worker->dead_requests, request);
+		talloc_free(request);
+	}
+
+	while ((request = fr_dlist_head(&worker->free_requests)) != NULL) {
+		fr_dlist_remove(&worker->free_requests, request);
+		talloc_free(request);
+	}
 
 #if 0
 	/*
@@ -1255,6 +1608,7 @@ void fr_worker_destroy(fr_worker_t *worker)
  */
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el, fr_log_t const *logger, fr_log_lvl_t lvl)
 {
+	int i;
 	int max_channels = 64;
 	fr_worker_t *worker;
 
@@ -1278,11 +1632,15 @@ nomem:
 	worker->log = logger;
 	worker->lvl = lvl;
 
+	fr_dlist_init(&worker->free_requests, REQUEST, free_entry);
+	fr_dlist_init(&worker->dead_requests, REQUEST, free_entry);
+
 	/*
 	 *	@todo make these configurable
 	 */
 	worker->max_channels = max_channels;
-	worker->talloc_pool_size = 4096; /* at least enough for a REQUEST */
+	worker->talloc_pool_size = 8192; /* adjusted from a running average as requests complete */
+	if (main_config) worker->memory_limit = main_config->request_memory_limit;
 	worker->message_set_size = 1024;
 	worker->ring_buffer_size = (1 << 16);
 	worker->max_request_time = fr_time_delta_from_sec(30);
@@ -1334,13 +1692,29 @@ nomem:
 	WORKER_HEAP_INIT(to_decode, worker_message_cmp);
 	WORKER_HEAP_INIT(localized, worker_message_cmp);
 
-	worker->runnable = fr_heap_talloc_create(worker, worker_runnable_cmp, REQUEST, runnable_id);
-	if (!worker->runnable) {
-		fr_strerror_printf("Failed creating runnable heap");
-		goto fail;
+	for (i = 0; i < 4; i++) {
+		worker->runnable[i].heap = fr_heap4_talloc_create(worker, worker_runnable_key, REQUEST, runnable_id);
+		if (!worker->runnable[i].heap) {
+			fr_strerror_printf("Failed creating runnable heap");
+			goto fail;
+		}
 	}
 
-	worker->time_order = fr_heap_talloc_create(worker, worker_time_order_cmp, REQUEST, time_order_id);
+	/*
+	 *	How many requests each class gets to run per round
+	 *	robin turn.  The "now" class isn't weighted, it always
+	 *	runs first.
+	 */
+	worker->runnable[1].weight = 8;
+	worker->runnable[2].weight = 4;
+	worker->runnable[3].weight = 1;
+	if (main_config) {
+		if (main_config->weight_high) worker->runnable[1].weight = main_config->weight_high;
+		if (main_config->weight_normal) worker->runnable[2].weight = main_config->weight_normal;
+		if (main_config->weight_low) worker->runnable[3].weight = main_config->weight_low;
+	}
+
+	worker->time_order = fr_heap4_talloc_create(worker, worker_time_order_key, REQUEST, time_order_id);
 	if (!worker->time_order) {
 		fr_strerror_printf("Failed creating time_order heap");
 		goto fail;
@@ -1354,7 +1728,6 @@ nomem:
 
 	if (fr_event_post_insert(worker->el, fr_worker_post_event, worker) < 0) {
 		fr_strerror_printf("Failed inserting post-processing event");
-		talloc_free(worker->runnable);
 		goto fail2;
 	}
 
@@ -1449,21 +1822,41 @@ void fr_worker(fr_worker_t *worker)
 {
 	WORKER_VERIFY;
 
+	worker_self = worker;
+
 	while (true) {
 		bool wait_for_event;
 		int num_events;
 
 		WORKER_VERIFY;
 
-		worker->last_event = fr_time();
+		worker->last_event = fr_time_coarse();
 
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
 		 */
-		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+		wait_for_event = (worker_num_runnable(worker) == 0);
 		if (wait_for_event) {
+			int i;
+
 			DEBUG2("%s ready to process requests", worker->name);
+
+			/*
+			 *	We're about to go idle.  If any
+			 *	channel's message set grew during the
+			 *	last burst, pre-grow it now, so the
+			 *	allocation stall doesn't land in the
+			 *	middle of the next burst.
+			 */
+			for (i = 0; i < worker->max_channels; i++) {
+				fr_message_set_t *ms;
+
+				if (!worker->channel[i]) continue;
+
+				ms = fr_channel_worker_ctx_get(worker->channel[i]);
+				if (ms) (void) fr_message_set_pregrow(ms);
+			}
 		}
 
 		/*
@@ -1589,8 +1982,10 @@ static void fr_worker_verify(fr_worker_t *worker)
 	rad_assert(worker->localized.heap != NULL);
 	(void) talloc_get_type_abort(worker->localized.heap, fr_heap_t);
 
-	rad_assert(worker->runnable != NULL);
-	(void) talloc_get_type_abort(worker->runnable, fr_heap_t);
+	for (i = 0; i < 4; i++) {
+		rad_assert(worker->runnable[i].heap != NULL);
+		(void) talloc_get_type_abort(worker->runnable[i].heap, fr_heap4_t);
+	}
 
 	rad_assert(worker->dedup != NULL);
 	(void) talloc_get_type_abort(worker->dedup, rbtree_t);
@@ -1603,6 +1998,28 @@ static void fr_worker_verify(fr_worker_t *worker)
 }
 #endif
 
+/** Report the load of the worker servicing this thread
+ *
+ * Process modules run inside of the worker thread, so they can call
+ * this to learn how loaded "their" worker is, e.g. to advertise
+ * current capacity in a Status-Server reply.
+ *
+ * @param[out] num_active	how many requests are currently active.
+ * @param[out] predicted	predicted processing time for one request.
+ * @return
+ *	- 0 on success.
+ *	- -1 if this thread isn't being serviced by a worker.
+ */
+int fr_worker_self_load(uint64_t *num_active, fr_time_delta_t *predicted)
+{
+	if (!worker_self) return -1;
+
+	*num_active = worker_self->num_active;
+	*predicted = worker_self->tracking.predicted;
+
+	return 0;
+}
+
 int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 {
 	if (num < 0) return -1;
@@ -1621,6 +2038,26 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 7;
 }
 
+/** Print one hop of a sampled request, as fractional seconds with usec resolution
+ *
+ */
+static void trace_hop_fprint(FILE *fp, fr_time_t start, fr_time_t end)
+{
+	fr_time_t delta;
+
+	/*
+	 *	The request never reached this stage, e.g. it's still
+	 *	in flight, or it was stopped without a reply.
+	 */
+	if (!start || !end) {
+		fprintf(fp, "\t-");
+		return;
+	}
+
+	delta = end - start;
+	fprintf(fp, "\t%u.%06u", (unsigned int) (delta / NSEC), (unsigned int) ((delta % NSEC) / 1000));
+}
+
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
@@ -1634,7 +2071,7 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.decoded\t\t\t%" PRIu64 "\n", worker->num_decoded);
 		fprintf(fp, "count.timeouts\t\t\t%" PRIu64 "\n", worker->num_timeouts);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
-		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.runnable\t\t\t%u\n", worker_num_runnable(worker));
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -1654,6 +2091,63 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 1);
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "latency") == 0)) {
+		int i;
+		char buffer[64];
+
+		for (i = 0; i < 4; i++) {
+			snprintf(buffer, sizeof(buffer), "latency.queue.%s", worker_latency_names[i]);
+			fr_time_elapsed_fprint(fp, &worker->queue_time[i], buffer, 1);
+
+			snprintf(buffer, sizeof(buffer), "latency.processing.%s", worker_latency_names[i]);
+			fr_time_elapsed_fprint(fp, &worker->processing_time[i], buffer, 1);
+
+			snprintf(buffer, sizeof(buffer), "latency.total.%s", worker_latency_names[i]);
+			fr_time_elapsed_fprint(fp, &worker->total_time[i], buffer, 1);
+		}
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "memory") == 0)) {
+		int i;
+
+		fprintf(fp, "memory.max\t\t\t%zu\n", worker->memory_max);
+
+		for (i = 0; i < 16; i++) {
+			if (!worker->memory_buckets[i]) continue;
+
+			fprintf(fp, "memory.requests.%s\t\t%" PRIu64 "\n",
+				worker_memory_names[i], worker->memory_buckets[i]);
+		}
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "trace") == 0)) {
+		int i;
+
+		fprintf(fp, "trace.interval\t\t\t%u\n", WORKER_TRACE_INTERVAL);
+		fprintf(fp, "trace\trequest\tclass\tqueue\tdecode\tdispatch\tpolicy\tencode\tsend\ttotal\n");
+
+		/*
+		 *	Print the ring oldest entry first.
+		 */
+		for (i = 0; i < WORKER_TRACE_RING_SIZE; i++) {
+			fr_worker_trace_t const *t;
+
+			t = &worker->trace_ring[(worker->trace_next + i) & (WORKER_TRACE_RING_SIZE - 1)];
+			if (!t->recv) continue;
+
+			fprintf(fp, "trace\t%" PRIu64 "\t%s", t->number,
+				worker_latency_names[worker_latency_class(t->priority)]);
+			trace_hop_fprint(fp, t->recv, t->dequeue);
+			trace_hop_fprint(fp, t->dequeue, t->decoded);
+			trace_hop_fprint(fp, t->decoded, t->run);
+			trace_hop_fprint(fp, t->run, t->done);
+			trace_hop_fprint(fp, t->done, t->encoded);
+			trace_hop_fprint(fp, t->encoded, t->sent);
+			trace_hop_fprint(fp, t->recv, t->sent);
+			fprintf(fp, "\n");
+		}
+	}
+
 	return 0;
 }
 
@@ -1669,7 +2163,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|latency|memory|trace)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
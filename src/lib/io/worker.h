@@ -53,6 +53,24 @@ typedef struct fr_worker_t fr_worker_t;
 #ifdef __cplusplus
 extern "C" {
 #endif
+/** Hop timestamps for one sampled request
+ *
+ *  Filled in as the request moves network -> channel -> worker ->
+ *  channel -> network, so the gap between any two adjacent stages can
+ *  be attributed after the fact.
+ */
+typedef struct fr_worker_trace_s {
+	uint64_t	number;		//!< worker-local number of the sampled request
+	uint32_t	priority;	//!< priority of this packet
+	fr_time_t	recv;		//!< when the network side received the packet
+	fr_time_t	dequeue;	//!< when the worker popped it from the channel queues
+	fr_time_t	decoded;	//!< when the protocol decoder finished
+	fr_time_t	run;		//!< when the request first entered the interpreter
+	fr_time_t	done;		//!< when the interpreter finished with the request
+	fr_time_t	encoded;	//!< when the reply encoder finished
+	fr_time_t	sent;		//!< when the reply was handed back to the channel
+} fr_worker_trace_t;
+
 extern fr_cmd_table_t cmd_worker_table[];
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el,
@@ -75,6 +93,8 @@ void		fr_worker_name(fr_worker_t *worker, char const *name) CC_HINT(nonnull);
 fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_control_t *master) CC_HINT(nonnull);
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
+
+int		fr_worker_self_load(uint64_t *num_active, fr_time_delta_t *predicted) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
 #endif
@@ -333,11 +333,153 @@ void fr_json_version_print(void)
 #endif
 }
 
+/** Dynamic buffer used to stream out JSON documents
+ *
+ */
+typedef struct {
+	TALLOC_CTX	*ctx;		//!< ctx the buffer is allocated in.
+	char		*buf;		//!< the (partial) JSON document.
+	size_t		len;		//!< length of the document so far, excluding the trailing '\0'.
+} json_buf_t;
+
+static int json_buf_append(json_buf_t *out, char const *in, size_t inlen)
+{
+	size_t size = talloc_array_length(out->buf);
+
+	if ((out->len + inlen + 1) > size) {
+		while (size < (out->len + inlen + 1)) size *= 2;
+
+		out->buf = talloc_realloc(out->ctx, out->buf, char, size);
+		if (!out->buf) return -1;
+	}
+
+	memcpy(out->buf + out->len, in, inlen);
+	out->len += inlen;
+	out->buf[out->len] = '\0';
+
+	return 0;
+}
+
+/** Append a JSON escaped string, including the surrounding quotes
+ *
+ *  Runs of characters which need no escaping are copied in one go,
+ *  so the common case of a clean UTF-8 string is a single memcpy.
+ */
+static int json_buf_append_string(json_buf_t *out, char const *in)
+{
+	char const *p, *start;
+
+	if (json_buf_append(out, "\"", 1) < 0) return -1;
+
+	start = in;
+	for (p = in; *p != '\0'; p++) {
+		char const	*esc;
+		char		ubuf[sizeof("\\u0000")];
+
+		switch (*p) {
+		case '"':	esc = "\\\"";	break;
+		case '\\':	esc = "\\\\";	break;
+		case '\b':	esc = "\\b";	break;
+		case '\f':	esc = "\\f";	break;
+		case '\n':	esc = "\\n";	break;
+		case '\r':	esc = "\\r";	break;
+		case '\t':	esc = "\\t";	break;
+		default:
+			if ((uint8_t)*p >= 0x20) continue;	/* UTF-8 passes straight through */
+			snprintf(ubuf, sizeof(ubuf), "\\u%04x", *p);
+			esc = ubuf;
+			break;
+		}
+
+		if ((p > start) && (json_buf_append(out, start, p - start) < 0)) return -1;
+		if (json_buf_append(out, esc, strlen(esc)) < 0) return -1;
+		start = p + 1;
+	}
+	if ((p > start) && (json_buf_append(out, start, p - start) < 0)) return -1;
+
+	return json_buf_append(out, "\"", 1);
+}
+
+/** Append a boxed value in the same form #json_object_from_value_box produces
+ *
+ */
+static int json_buf_append_value_box(json_buf_t *out, fr_value_box_t const *data)
+{
+	char num[sizeof("-9223372036854775808")];
+
+	/*
+	 *	We're converting to PRESENTATION format
+	 *	so any attributes with enumeration values
+	 *	should be converted to string types.
+	 */
+	if (data->enumv) {
+		fr_dict_enum_t *enumv;
+
+		enumv = fr_dict_enum_by_value(data->enumv, data);
+		if (enumv) return json_buf_append_string(out, enumv->alias);
+	}
+
+	switch (data->type) {
+	case FR_TYPE_BOOL:
+		if (data->vb_uint8) return json_buf_append(out, "true", 4);
+		return json_buf_append(out, "false", 5);
+
+	case FR_TYPE_UINT8:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%u", data->vb_uint8));
+
+	case FR_TYPE_UINT16:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%u", data->vb_uint16));
+
+	case FR_TYPE_UINT32:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%u", data->vb_uint32));
+
+	case FR_TYPE_UINT64:
+		if (data->vb_uint64 > INT64_MAX) break;		/* Doesn't fit in a JSON integer */
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%" PRIu64, data->vb_uint64));
+
+	case FR_TYPE_INT8:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%d", data->vb_int8));
+
+	case FR_TYPE_INT16:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%d", data->vb_int16));
+
+	case FR_TYPE_INT32:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%d", data->vb_int32));
+
+	case FR_TYPE_INT64:
+		return json_buf_append(out, num, snprintf(num, sizeof(num), "%" PRId64, data->vb_int64));
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Everything else is a quoted string in
+	 *	PRESENTATION format.
+	 */
+	{
+		char	*p;
+		int	ret;
+
+		p = fr_value_box_asprint(NULL, data, '\0');
+		if (!p) return -1;
+
+		ret = json_buf_append_string(out, p);
+		talloc_free(p);
+
+		return ret;
+	}
+}
+
 /** Returns a JSON string of a list of value pairs
  *
  *  The result is a talloc-ed string, freeing the string is the responsibility
  *  of the caller.
  *
+ *  The document is streamed directly into the output buffer, rather
+ *  than being assembled as a json-c object tree and then serialized,
+ *  which would cost an allocation per node and a second full pass.
+ *
  * Output format is:
 @verbatim
 {
@@ -366,20 +508,43 @@ void fr_json_version_print(void)
  */
 const char *fr_json_afrom_pair_list(TALLOC_CTX *ctx, VALUE_PAIR **vps, const char *prefix)
 {
-	fr_cursor_t		cursor;
-	VALUE_PAIR 		*vp;
-	struct json_object	*obj;
-	const char		*p;
+	fr_cursor_t		cursor, group_cursor;
+	VALUE_PAIR 		*vp, *group_vp;
+	json_buf_t		out;
+	bool			first_attr = true;
 	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
 
-	MEM(obj = json_object_new_object());
+	out.ctx = ctx;
+	out.len = 0;
+	MEM(out.buf = talloc_array(ctx, char, 256));
+	out.buf[0] = '\0';
+
+	if (json_buf_append(&out, "{", 1) < 0) {
+	error:
+		talloc_free(out.buf);
+		return NULL;
+	}
 
 	for (vp = fr_cursor_init(&cursor, vps);
 	     vp;
 	     vp = fr_cursor_next(&cursor)) {
 		char const		*name_with_prefix;
-		fr_dict_enum_t const	*dv;
-		struct json_object	*vp_object, *values, *value, *type_name;
+		bool			seen = false, first_value = true;
+
+		/*
+		 *	All instances of an attribute are written out
+		 *	when we encounter its first instance, so skip
+		 *	any attribute we've already seen.
+		 */
+		for (group_vp = fr_cursor_init(&group_cursor, vps);
+		     group_vp && (group_vp != vp);
+		     group_vp = fr_cursor_next(&group_cursor)) {
+			if (group_vp->da == vp->da) {
+				seen = true;
+				break;
+			}
+		}
+		if (seen) continue;
 
 		name_with_prefix = vp->da->name;
 		if (prefix) {
@@ -389,66 +554,66 @@ const char *fr_json_afrom_pair_list(TALLOC_CTX *ctx, VALUE_PAIR **vps, const cha
 			}
 		}
 
-		/*
-		 *	See if we already have a key in the table we're working on,
-		 *	if we don't, create a new one...
-		 */
-		if (!json_object_object_get_ex(obj, name_with_prefix, &vp_object)) {
-			MEM(vp_object = json_object_new_object());
-			json_object_object_add(obj, name_with_prefix, vp_object);
+		if (!first_attr && (json_buf_append(&out, ",", 1) < 0)) goto error;
+		first_attr = false;
 
-			MEM(type_name = json_object_new_string(fr_table_str_by_value(fr_value_box_type_table, vp->vp_type, "<INVALID>")));
-			json_object_object_add(vp_object, "type", type_name);
+		if (json_buf_append_string(&out, name_with_prefix) < 0) goto error;
+		if (json_buf_append(&out, ":{\"type\":", 9) < 0) goto error;
+		if (json_buf_append_string(&out,
+					   fr_table_str_by_value(fr_value_box_type_table,
+								 vp->vp_type, "<INVALID>")) < 0) goto error;
 
-			MEM(values = json_object_new_array());
-			json_object_object_add(vp_object, "value", values);
 		/*
-		 *	If we do, get its value array...
+		 *	Write out the values of every instance of
+		 *	this attribute.
 		 */
-		} else if (!fr_cond_assert(json_object_object_get_ex(vp_object, "value", &values))) {
-			fr_strerror_printf("Inconsistent JSON tree");
-			json_object_put(obj);
+		if (json_buf_append(&out, ",\"value\":[", 10) < 0) goto error;
+		fr_cursor_copy(&group_cursor, &cursor);
+		for (group_vp = fr_cursor_current(&group_cursor);
+		     group_vp;
+		     group_vp = fr_cursor_next(&group_cursor)) {
+			if (group_vp->da != vp->da) continue;
 
-			return NULL;
-		}
+			if (!first_value && (json_buf_append(&out, ",", 1) < 0)) goto error;
+			first_value = false;
 
-		MEM(value = json_object_from_value_box(ctx, &vp->data));
-		json_object_array_add(values, value);
+			if (json_buf_append_value_box(&out, &group_vp->data) < 0) goto error;
+		}
+		if (json_buf_append(&out, "]", 1) < 0) goto error;
 
 		/*
 		 *	Add a mapping array
 		 */
 		if (vp->da->flags.has_value) {
-			struct json_object *mapping;
+			if (json_buf_append(&out, ",\"mapping\":[", 12) < 0) goto error;
 
-			if (!json_object_object_get_ex(vp_object, "mapping", &mapping)) {
-				MEM(mapping = json_object_new_array());
-				json_object_object_add(vp_object, "mapping", mapping);
-			}
+			first_value = true;
+			fr_cursor_copy(&group_cursor, &cursor);
+			for (group_vp = fr_cursor_current(&group_cursor);
+			     group_vp;
+			     group_vp = fr_cursor_next(&group_cursor)) {
+				fr_dict_enum_t const *dv;
+
+				if (group_vp->da != vp->da) continue;
+
+				if (!first_value && (json_buf_append(&out, ",", 1) < 0)) goto error;
+				first_value = false;
 
-			dv = fr_dict_enum_by_value(vp->da, &vp->data);
-			if (dv) {
-				struct json_object *mapped_value;
-
-				/* Add to mapping array */
-				MEM(mapped_value = json_object_from_value_box(ctx, dv->value));
-				json_object_array_add(mapping, mapped_value);
-			/*
-			 *	Add NULL value to mapping array
-			 */
-			} else {
-				if (json_object_object_get_ex(vp_object, "mapping", &mapping)) {
-					json_object_array_add(mapping, NULL);
+				dv = fr_dict_enum_by_value(group_vp->da, &group_vp->data);
+				if (dv) {
+					if (json_buf_append_value_box(&out, dv->value) < 0) goto error;
+				} else {
+					if (json_buf_append(&out, "null", 4) < 0) goto error;
 				}
 			}
+			if (json_buf_append(&out, "]", 1) < 0) goto error;
 		}
-	}
 
-	MEM(p = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
-	MEM(p = talloc_strdup(ctx, p));
+		if (json_buf_append(&out, "}", 1) < 0) goto error;
+	}
 
-	json_object_put(obj);	/* Should also free string buff from above */
+	if (json_buf_append(&out, "}", 1) < 0) goto error;
 
-	return p;
+	return out.buf;
 }
 
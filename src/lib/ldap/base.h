@@ -298,9 +298,23 @@ typedef struct {
 
 	fr_ldap_state_t		state;			//!< LDAP connection state machine.
 
+	rbtree_t		*msgids;		//!< Outstanding pipelined operations, keyed by msgid.
+	fr_event_list_t		*demux_el;		//!< Event list the result demuxer is running on.
+	int			demux_fd;		//!< fd the result demuxer is watching.
+
 	void			*uctx;			//!< User data associated with the handle.
 } fr_ldap_connection_t;
 
+/** Invoked by the msgid demuxer when an outstanding operation completes
+ *
+ * @param[in] c		the operation was started on.
+ * @param[in] result	of the operation.  Owned by the callback, which must
+ *			ldap_msgfree it.  NULL if the connection failed before
+ *			a result arrived.
+ * @param[in] uctx	registered with #fr_ldap_msgid_add.
+ */
+typedef void (*fr_ldap_msgid_callback_t)(fr_ldap_connection_t *c, LDAPMessage *result, void *uctx);
+
 /** Contains a collection of values
  *
  */
@@ -415,6 +429,18 @@ fr_ldap_rcode_t	fr_ldap_search_async(int *msgid, REQUEST *request,
 				     char const *dn, int scope, char const *filter, char const * const *attrs,
 				     LDAPControl **serverctrls, LDAPControl **clientctrls);
 
+/*
+ *	msgid.c - Demultiplexing of pipelined operations
+ */
+int		fr_ldap_msgid_demux_init(fr_ldap_connection_t *c, fr_event_list_t *el);
+
+int		fr_ldap_msgid_add(fr_ldap_connection_t *c, int msgid,
+				  fr_ldap_msgid_callback_t callback, void *uctx);
+
+int		fr_ldap_msgid_cancel(fr_ldap_connection_t *c, int msgid);
+
+uint32_t	fr_ldap_msgid_outstanding(fr_ldap_connection_t const *c);
+
 fr_ldap_rcode_t	fr_ldap_modify(REQUEST *request, fr_ldap_connection_t **pconn,
 			       char const *dn, LDAPMod *mods[],
 			       LDAPControl **serverctrls, LDAPControl **clientctrls);
@@ -261,6 +261,15 @@ int fr_ldap_map_expand(fr_ldap_map_exp_t *expanded, REQUEST *request, vp_map_t c
 	char		attr_buff[1024 + 1];	/* X.501 says we need to support at least 1024 chars for attr names */
 
 	for (map = maps; map != NULL; map = map->next) {
+		/*
+		 *	Constant attribute names (the usual case) don't
+		 *	need to be expanded per request.
+		 */
+		if (tmpl_is_unparsed(map->rhs)) {
+			expanded->attrs[total++] = map->rhs->name;
+			continue;
+		}
+
 		if (tmpl_expand(&attr, attr_buff, sizeof(attr_buff), request, map->rhs, NULL, NULL) < 0) {
 			REDEBUG("Expansion of LDAP attribute \"%s\" failed", map->rhs->name);
 			TALLOC_FREE(ctx);
@@ -0,0 +1,248 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/msgid.c
+ * @brief Demultiplexing of pipelined LDAP operations.
+ *
+ * LDAP responses carry the message id of the request they answer, so many
+ * operations can be outstanding on a single connection at once.  This file
+ * tracks outstanding message ids on a connection, and dispatches results to
+ * per-operation callbacks from a single read event on the connection's fd,
+ * which is what allows callers to pipeline operations instead of dedicating
+ * a pooled connection to each one.
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+/** An outstanding operation awaiting a result
+ *
+ */
+typedef struct {
+	int			msgid;		//!< libldap message id of the operation.
+	fr_ldap_msgid_callback_t callback;	//!< Called when the result arrives.
+	void			*uctx;		//!< User data for the callback.
+} fr_ldap_msgid_entry_t;
+
+static int _msgid_entry_cmp(void const *one, void const *two)
+{
+	fr_ldap_msgid_entry_t const *a = one, *b = two;
+
+	if (a->msgid < b->msgid) return -1;
+	if (a->msgid > b->msgid) return +1;
+
+	return 0;
+}
+
+/** Fail a single outstanding operation
+ *
+ * Called with RBTREE_DELETE_ORDER, so returning 0 both dispatches the
+ * callback and removes the entry.
+ */
+static int _msgid_entry_fail(void *data, void *uctx)
+{
+	fr_ldap_msgid_entry_t	*entry = talloc_get_type_abort(data, fr_ldap_msgid_entry_t);
+	fr_ldap_connection_t	*c = talloc_get_type_abort(uctx, fr_ldap_connection_t);
+
+	entry->callback(c, NULL, entry->uctx);
+
+	return 0;
+}
+
+/** Fail all outstanding operations and stop watching the fd
+ *
+ */
+static void msgid_demux_fail(fr_ldap_connection_t *c)
+{
+	if (c->demux_el) {
+		fr_event_fd_delete(c->demux_el, c->demux_fd, FR_EVENT_FILTER_IO);
+		c->demux_el = NULL;
+		c->demux_fd = -1;
+	}
+
+	rbtree_walk(c->msgids, RBTREE_DELETE_ORDER, _msgid_entry_fail, c);
+}
+
+/** Drain all available results, dispatching each to its operation's callback
+ *
+ */
+static void _msgid_demux_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(uctx, fr_ldap_connection_t);
+	struct timeval		tv = { 0, 0 };		/* Don't block */
+	LDAPMessage		*result;
+	int			ret;
+
+	while ((ret = ldap_result(c->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &tv, &result)) > 0) {
+		fr_ldap_msgid_entry_t	find, *entry;
+
+		find.msgid = ldap_msgid(result);
+
+		entry = rbtree_finddata(c->msgids, &find);
+		if (!entry) {
+			/*
+			 *	Results for operations nobody is waiting
+			 *	on (e.g. abandoned ones) are discarded.
+			 */
+			DEBUG3("Ignoring result for unknown msgid %i", find.msgid);
+			ldap_msgfree(result);
+			continue;
+		}
+
+		rbtree_deletebydata(c->msgids, entry);
+
+		/*
+		 *	Callback owns the result, and must
+		 *	ldap_msgfree it.
+		 */
+		entry->callback(c, result, entry->uctx);
+		talloc_free(entry);
+	}
+
+	/*
+	 *	ldap_result failed, so every operation on this
+	 *	connection is dead.
+	 */
+	if (ret < 0) msgid_demux_fail(c);
+}
+
+/** I/O error on the connection's fd
+ *
+ */
+static void _msgid_demux_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			       UNUSED int fd_errno, void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(uctx, fr_ldap_connection_t);
+
+	msgid_demux_fail(c);
+}
+
+/** Start demultiplexing results on a connection
+ *
+ * Installs a read event on the connection's fd.  Must be called once the
+ * connection is bound, before any operations are registered with
+ * #fr_ldap_msgid_add.
+ *
+ * @param[in] c		to demultiplex results on.
+ * @param[in] el	to insert the I/O callback into.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_msgid_demux_init(fr_ldap_connection_t *c, fr_event_list_t *el)
+{
+	int fd = -1;
+
+	if ((ldap_get_option(c->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		fr_strerror_printf("Failed retrieving fd from libldap handle");
+		return -1;
+	}
+
+	if (!c->msgids) {
+		c->msgids = rbtree_talloc_create(c, _msgid_entry_cmp, fr_ldap_msgid_entry_t, NULL,
+						 RBTREE_FLAG_NONE);
+		if (!c->msgids) return -1;
+	}
+
+	if (fr_event_fd_insert(c, el, fd, _msgid_demux_readable, NULL, _msgid_demux_error, c) < 0) return -1;
+
+	c->demux_el = el;
+	c->demux_fd = fd;
+
+	return 0;
+}
+
+/** Register an outstanding operation on a connection
+ *
+ * The callback receives the result (which it owns and must ldap_msgfree),
+ * or NULL if the connection failed before a result arrived.
+ *
+ * @param[in] c		the operation was started on.
+ * @param[in] msgid	returned by the libldap call which started the operation.
+ * @param[in] callback	to invoke when the result arrives.
+ * @param[in] uctx	to pass to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_msgid_add(fr_ldap_connection_t *c, int msgid, fr_ldap_msgid_callback_t callback, void *uctx)
+{
+	fr_ldap_msgid_entry_t *entry;
+
+	rad_assert(c->msgids);
+
+	entry = talloc_zero(c, fr_ldap_msgid_entry_t);
+	if (!entry) return -1;
+
+	entry->msgid = msgid;
+	entry->callback = callback;
+	entry->uctx = uctx;
+
+	if (!rbtree_insert(c->msgids, entry)) {
+		fr_strerror_printf("Duplicate msgid %i", msgid);
+		talloc_free(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Forget an outstanding operation, usually after abandoning it
+ *
+ * The operation's callback will not be called; any result which does
+ * arrive is discarded by the demuxer.
+ *
+ * @param[in] c		the operation was registered with.
+ * @param[in] msgid	of the operation to forget.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the msgid wasn't registered.
+ */
+int fr_ldap_msgid_cancel(fr_ldap_connection_t *c, int msgid)
+{
+	fr_ldap_msgid_entry_t find, *entry;
+
+	find.msgid = msgid;
+
+	entry = rbtree_finddata(c->msgids, &find);
+	if (!entry) return -1;
+
+	rbtree_deletebydata(c->msgids, entry);
+	talloc_free(entry);
+
+	return 0;
+}
+
+/** Return the number of operations outstanding on a connection
+ *
+ * Useful for least-loaded selection when spreading operations over a
+ * small set of pipelined connections.
+ *
+ * @param[in] c to query.
+ */
+uint32_t fr_ldap_msgid_outstanding(fr_ldap_connection_t const *c)
+{
+	if (!c->msgids) return 0;
+
+	return rbtree_num_elements(c->msgids);
+}
@@ -1479,16 +1479,36 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delt
 		return NULL;
 	}
 
+	/*
+	 *	Pipeline the connection setup commands, so establishing
+	 *	a connection costs at most one round trip.
+	 */
 	if (node->cluster->conf->password) {
 		DEBUG3("%s - [%i] Executing: AUTH %s", log_prefix, node->id, node->cluster->conf->password);
-		reply = redisCommand(handle, "AUTH %s", node->cluster->conf->password);
-		if (!reply) {
-			ERROR("%s - [%i] Failed authenticating: %s", log_prefix, node->id, handle->errstr);
+		if (redisAppendCommand(handle, "AUTH %s", node->cluster->conf->password) != REDIS_OK) {
+			ERROR("%s - [%i] Failed appending AUTH command to output buffer: %s",
+			      log_prefix, node->id, handle->errstr);
 		error:
 			if (reply) fr_redis_reply_free(&reply);
 			redisFree(handle);
 			return NULL;
 		}
+	}
+
+	if (node->cluster->conf->database) {
+		DEBUG3("%s - [%i] Executing: SELECT %i", log_prefix, node->id, node->cluster->conf->database);
+		if (redisAppendCommand(handle, "SELECT %i", node->cluster->conf->database) != REDIS_OK) {
+			ERROR("%s - [%i] Failed appending SELECT command to output buffer: %s",
+			      log_prefix, node->id, handle->errstr);
+			goto error;
+		}
+	}
+
+	if (node->cluster->conf->password) {
+		if ((redisGetReply(handle, (void **)&reply) != REDIS_OK) || !reply) {
+			ERROR("%s - [%i] Failed authenticating: %s", log_prefix, node->id, handle->errstr);
+			goto error;
+		}
 
 		switch (reply->type) {
 		case REDIS_REPLY_STATUS:
@@ -1512,9 +1532,7 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delt
 	}
 
 	if (node->cluster->conf->database) {
-		DEBUG3("%s - [%i] Executing: SELECT %i", log_prefix, node->id, node->cluster->conf->database);
-		reply = redisCommand(handle, "SELECT %i", node->cluster->conf->database);
-		if (!reply) {
+		if ((redisGetReply(handle, (void **)&reply) != REDIS_OK) || !reply) {
 			ERROR("%s - [%i] Failed selecting database %i: %s", log_prefix, node->id,
 			      node->cluster->conf->database, handle->errstr);
 			goto error;
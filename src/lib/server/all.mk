@@ -33,6 +33,7 @@ SOURCES	:= \
 	snmp.c \
 	state.c \
 	stats.c \
+	stats_shm.c \
 	tmpl.c \
 	trigger.c \
 	users_file.c \
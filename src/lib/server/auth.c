@@ -160,6 +160,7 @@ runit:
 
 		request->async = talloc_memdup(request, request->parent->async, sizeof(fr_async_t));
 		talloc_set_name_const(request->async, talloc_get_name(request->parent->async));
+		request->async->trace = NULL;	/* the parent's hop timestamps aren't ours */
 	}
 
 	RDEBUG("server %s {", cf_section_name2(request->server_cs));
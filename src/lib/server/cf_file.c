@@ -38,6 +38,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/util.h>
 
 #include <freeradius-devel/util/cursor.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 
@@ -120,6 +121,28 @@ char const *cf_expand_variables(char const *cf, int lineno,
 
 	if (soft_fail) *soft_fail = false;
 
+	/*
+	 *	Fast path.  Almost no lines in a typical raddb tree
+	 *	contain a reference, and the loop below copies byte
+	 *	by byte.
+	 */
+	{
+		size_t len;
+
+		len = (inlen < 0) ? strlen(input) : strnlen(input, (size_t) inlen);
+		if (!memchr(input, '$', len)) {
+			if (len >= outsize) {
+				ERROR("%s[%d]: Reference \"%s\" is too long",
+				      cf, lineno, input);
+				return NULL;
+			}
+
+			memcpy(output, input, len);
+			output[len] = '\0';
+			return output;
+		}
+	}
+
 	/*
 	 *	Find the master parent conf section.
 	 *	We can't use main_config->root_cs, because we're in the
@@ -1110,6 +1133,7 @@ static CONF_SECTION *process_if(CONF_SECTION *parent, char const **ptr_p, char *
 	}
 
 	MEM(cs->name2 = talloc_typed_strdup(cs, buff[2]));
+	cs->item.ident2_hash = fr_hash_string(cs->name2);
 	cs->name2_quote = T_BARE_WORD;
 
 	ptr += slen;
@@ -1212,6 +1236,80 @@ alloc_section:
 }
 
 
+static CONF_SECTION *process_limit(CONF_SECTION *parent, char const **ptr_p, char *buff[static 4], char const *filename, int lineno)
+{
+	char const *key;
+	char const *rate;
+	char const *ptr = *ptr_p;
+	CONF_SECTION *css;
+	FR_TOKEN key_token, rate_token;
+
+	if (invalid_location(parent, "limit", filename, lineno)) {
+		ERROR("%s[%d]: Invalid syntax for 'limit'", filename, lineno);
+		return NULL;
+	}
+
+	/*
+	 *	Get the key to rate limit on.
+	 */
+	if (cf_get_token(parent, &ptr, &key_token, buff[1], talloc_array_length(buff[1]),
+			 filename, lineno) < 0) {
+		return NULL;
+	}
+
+	if ((key_token != T_BARE_WORD) && !fr_str_tok[key_token]) {
+		ERROR("%s[%d]: Expecting attribute reference or string expansion in 'limit' definition",
+		      filename, lineno);
+		return NULL;
+	}
+	key = buff[1];
+
+	/*
+	 *	Now get the rate.
+	 */
+	if (cf_get_token(parent, &ptr, &rate_token, buff[2], talloc_array_length(buff[2]),
+			 filename, lineno) < 0) {
+		return NULL;
+	}
+
+	if (rate_token != T_BARE_WORD) {
+		ERROR("%s[%d]: Expecting bare word rate in 'limit' definition",
+		      filename, lineno);
+		return NULL;
+	}
+
+	if (*ptr != '{') {
+		ERROR("%s[%d]: Expecting section start brace '{' in 'limit' definition",
+		      filename, lineno);
+		return NULL;
+	}
+	ptr++;
+	rate = buff[2];
+
+	/*
+	 *	Allocate the section
+	 */
+	css = cf_section_alloc(parent, parent, "limit", key);
+	if (!css) {
+		ERROR("%s[%d]: Failed allocating memory for section", filename, lineno);
+		return NULL;
+	}
+	css->item.filename = filename;
+	css->item.lineno = lineno;
+	css->name2_quote = key_token;
+
+	css->argc = 1;
+	css->argv = talloc_array(css, char const *, 1);
+	css->argv[0] = talloc_typed_strdup(css->argv, rate);
+	css->argv_quote = talloc_array(css, FR_TOKEN, 1);
+	css->argv_quote[0] = rate_token;
+
+	*ptr_p = ptr;
+
+	return css;
+}
+
+
 static int add_pair(CONF_SECTION *parent, char const *attr, char const *value,
 		    FR_TOKEN name1_token, FR_TOKEN op_token, FR_TOKEN value_token,
 		    char *buff, char const *filename, int lineno)
@@ -1615,6 +1713,18 @@ do_frame:
 			goto add_section;
 		}
 
+		/*
+		 *	"limit" sections have three arguments!
+		 *
+		 *	limit KEY RATE { ... }
+		 */
+		if ((strcmp(buff[1], "limit") == 0) && (*ptr != '{')) {
+			css = process_limit(parent, &ptr, buff, frame->filename, frame->lineno);
+			if (!css) goto error;
+
+			goto add_section;
+		}
+
 		/*
 		 *	A common pattern is: name { ...}
 		 *	Check for it and skip ahead.
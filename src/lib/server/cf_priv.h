@@ -55,6 +55,10 @@ struct cf_item {
 	rbtree_t		*ident1;	//!< Tree to store the first identifier (name1 || type || attr).
 	rbtree_t		*ident2;	//!< Tree to store the second identifier (name2 || name).
 
+	uint32_t		ident1_hash;	//!< Hash of the first identifier.  Compared before the
+						//!< identifier strings, so lookups rarely touch them.
+	uint32_t		ident2_hash;	//!< Hash of the second identifier.  0 if there isn't one.
+
 	int			lineno;		//!< The line number the config item began on.
 	char const		*filename;	//!< The file the config item was parsed from.
 };
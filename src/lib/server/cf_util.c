@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/rad_assert.h>
 
 #include <freeradius-devel/util/cursor.h>
+#include <freeradius-devel/util/hash.h>
 
 static inline int cf_ident2_cmp(void const *a, void const *b);
 static int _cf_ident1_cmp(void const *a, void const *b);
@@ -118,6 +119,13 @@ static CONF_ITEM *cf_find(CONF_ITEM const *parent, CONF_ITEM_TYPE type, char con
 		return NULL;
 	}
 
+	/*
+	 *	Hash the identifiers once, so the tree descent mostly
+	 *	compares integers instead of strings.
+	 */
+	if (!IS_WILDCARD(ident1)) find->ident1_hash = fr_hash_string(ident1);
+	if (ident2 && !IS_WILDCARD(ident2)) find->ident2_hash = fr_hash_string(ident2);
+
 	/*
 	 *	No ident1, iterate over the child list
 	 */
@@ -209,6 +217,9 @@ static CONF_ITEM *cf_find_next(CONF_ITEM const *parent, CONF_ITEM const *prev,
 		return NULL;
 	}
 
+	if (!IS_WILDCARD(ident1)) find->ident1_hash = fr_hash_string(ident1);
+	if (ident2 && !IS_WILDCARD(ident2)) find->ident2_hash = fr_hash_string(ident2);
+
 	if (IS_WILDCARD(ident1)) {
 		for (ci = prev->next;
 		     ci && (cf_ident2_cmp(ci, find) != 0);
@@ -258,6 +269,9 @@ static inline int _cf_ident1_cmp(void const *a, void const *b)
 		if (one->type > two->type) return +1;
 		if (one->type < two->type) return -1;
 
+		if (one->ident1_hash > two->ident1_hash) return +1;
+		if (one->ident1_hash < two->ident1_hash) return -1;
+
 		type = one->type;
 	}
 
@@ -321,6 +335,9 @@ static inline int cf_ident2_cmp(void const *a, void const *b)
 		if (two->name2 && !one->name2) return -1;
 		if (!two->name2 && !one->name2) return 0;
 
+		if (one->item.ident2_hash > two->item.ident2_hash) return +1;
+		if (one->item.ident2_hash < two->item.ident2_hash) return -1;
+
 		return strcmp(one->name2, two->name2);
 	}
 
@@ -333,6 +350,9 @@ static inline int cf_ident2_cmp(void const *a, void const *b)
 		if (two->name && !one->name) return -1;
 		if (!two->name && !one->name) return 0;
 
+		if (one->item.ident2_hash > two->item.ident2_hash) return +1;
+		if (one->item.ident2_hash < two->item.ident2_hash) return -1;
+
 		return strcmp(one->name, two->name);
 	}
 
@@ -750,8 +770,10 @@ CONF_SECTION *_cf_section_alloc(TALLOC_CTX *ctx, CONF_SECTION *parent,
 	if (lineno) cf_lineno_set(cs, lineno);
 
 	MEM(cs->name1 = talloc_typed_strdup(cs, name1));
+	cs->item.ident1_hash = fr_hash_string(cs->name1);
 	if (name2) {
 		MEM(cs->name2 = talloc_typed_strdup(cs, name2));
+		cs->item.ident2_hash = fr_hash_string(cs->name2);
 		cs->name2_quote = T_BARE_WORD;
 	}
 	talloc_set_destructor(cs, _cf_section_free);
@@ -1137,6 +1159,7 @@ CONF_PAIR *cf_pair_alloc(CONF_SECTION *parent, char const *attr, char const *val
 		talloc_free(cp);
 		return NULL;
 	}
+	cp->item.ident1_hash = fr_hash_string(cp->attr);
 
 	if (value) {
 		cp->value = talloc_typed_strdup(cp, value);
@@ -1437,9 +1460,13 @@ static CONF_DATA *cf_data_alloc(CONF_ITEM *parent, void const *data, char const
 	 */
 	if (data) {
 		cd->type = talloc_typed_strdup(cd, type);
+		cd->item.ident1_hash = fr_hash_string(cd->type);
 		cd->data = data;
 	}
-	if (name) cd->name = talloc_typed_strdup(cd, name);
+	if (name) {
+		cd->name = talloc_typed_strdup(cd, name);
+		cd->item.ident2_hash = fr_hash_string(cd->name);
+	}
 
 	if (do_free) {
 		cd->free = true;
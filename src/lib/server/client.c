@@ -39,10 +39,30 @@ RCSID("$Id$")
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 //#define WITH_TRIE (1)
 
+/** How many definitions a client section must contain before we defer
+ *  parsing them until a packet arrives from the client
+ */
+#define CLIENT_DEFER_THRESHOLD (1024)
+
+/** A client definition we haven't parsed yet
+ *
+ * For very large client sections we only pre-scan the IP prefix and
+ * protocol of each definition at boot, and materialise the full
+ * RADCLIENT the first time a packet arrives from that prefix.
+ */
+typedef struct {
+	fr_ipaddr_t	ipaddr;			//!< Prefix from the pre-scan.
+	int		proto;			//!< IPPROTO_UDP, IPPROTO_TCP, or IPPROTO_IP for dual.
+	bool		tls_required;		//!< Whether the listener the section belongs to is TLS.
+	CONF_SECTION	*cs;			//!< Un-parsed client definition.
+	CONF_SECTION	*server_cs;		//!< Virtual server the section belongs to (may be NULL).
+} client_deferred_t;
+
 /** Group of clients
  *
  */
@@ -56,11 +76,22 @@ struct rad_client_list {
 #else
 	rbtree_t	*tree[129];
 #endif
+	rbtree_t	*deferred[129];		//!< Definitions we haven't parsed yet, by prefix.
+	rbtree_t	*lazy[129];		//!< Clients materialised from deferred definitions.
+	uint32_t	num_deferred;		//!< How many un-parsed definitions remain.
+	bool		deferring;		//!< Whether this list ever deferred definitions.
 };
 
 static RADCLIENT_LIST	*root_clients = NULL;	//!< Global client list.
 
-#ifndef WITH_TRIE
+/** Serialises lazy materialisation of deferred clients
+ *
+ * client_afrom_cs() isn't thread safe (static parse globals), and the
+ * lazy/deferred trees are modified after boot, so both are only ever
+ * touched with this held.
+ */
+static pthread_mutex_t	client_deferred_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int client_cmp(void const *one, void const *two)
 {
 	int rcode;
@@ -78,7 +109,19 @@ static int client_cmp(void const *one, void const *two)
 	return a->proto - b->proto;
 }
 
-#endif
+static int client_deferred_cmp(void const *one, void const *two)
+{
+	int rcode;
+	client_deferred_t const *a = one;
+	client_deferred_t const *b = two;
+
+	rcode = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (rcode != 0) return rcode;
+
+	if ((a->proto == IPPROTO_IP) || (b->proto == IPPROTO_IP)) return 0;
+
+	return a->proto - b->proto;
+}
 
 void client_list_free(void)
 {
@@ -372,6 +415,262 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
 	return NULL;
 }
 
+/** Pre-scan a client definition for its prefix and protocol
+ *
+ * Only looks at the "ipaddr" and "proto" pairs, which is all we need
+ * to index the definition for deferred parsing.  Anything we can't
+ * cheaply resolve (hostnames, unknown protocols) makes the caller fall
+ * back to parsing the definition at boot, so errors still surface
+ * there.
+ *
+ * @param[in] cs	client definition to scan.
+ * @param[out] ipaddr	prefix the definition covers.
+ * @param[out] proto	protocol the definition is limited to.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the definition can't be pre-scanned.
+ */
+static int client_cs_prescan(CONF_SECTION *cs, fr_ipaddr_t *ipaddr, int *proto)
+{
+	CONF_PAIR	*cp;
+	char const	*value;
+
+	cp = cf_pair_find(cs, "ipaddr");
+	if (!cp) cp = cf_pair_find(cs, "ipv4addr");
+	if (!cp) cp = cf_pair_find(cs, "ipv6addr");
+	if (!cp) return -1;
+
+	value = cf_pair_value(cp);
+	if (!value) return -1;
+
+	/*
+	 *	Don't resolve hostnames here, those definitions get
+	 *	parsed (and resolved) at boot as before.
+	 */
+	if (fr_inet_pton(ipaddr, value, -1, AF_UNSPEC, false, true) < 0) return -1;
+
+	*proto = IPPROTO_UDP;
+
+	cp = cf_pair_find(cs, "proto");
+	if (cp) {
+		value = cf_pair_value(cp);
+		if (!value) return -1;
+
+		if (strcmp(value, "udp") == 0) {
+			/* do nothing */
+
+		} else if (strcmp(value, "tcp") == 0) {
+			*proto = IPPROTO_TCP;
+#ifdef WITH_TLS
+		} else if (strcmp(value, "tls") == 0) {
+			*proto = IPPROTO_TCP;
+#endif
+		} else if (strcmp(value, "*") == 0) {
+			*proto = IPPROTO_IP; /* fake for dual */
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Index a client definition for deferred parsing
+ *
+ * @param[in] clients	list the client will eventually be added to.
+ * @param[in] cs	un-parsed client definition.
+ * @param[in] server_cs	virtual server the section belongs to.
+ * @param[in] tls_required whether the listener requires TLS.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the definition must be parsed at boot instead.
+ */
+static int client_defer_add(RADCLIENT_LIST *clients, CONF_SECTION *cs, CONF_SECTION *server_cs, bool tls_required)
+{
+	fr_ipaddr_t		ipaddr;
+	int			proto;
+	client_deferred_t	*entry;
+
+	if (client_cs_prescan(cs, &ipaddr, &proto) < 0) return -1;
+
+	/*
+	 *	Same fixup as client_add(), so the prefix we index on
+	 *	matches the one the parsed client will have.
+	 */
+	if (fr_ipaddr_is_inaddr_any(&ipaddr) == 1) switch (ipaddr.af) {
+	case AF_INET:
+		if (ipaddr.prefix == 32) ipaddr.prefix = 0;
+		break;
+
+	case AF_INET6:
+		if (ipaddr.prefix == 128) ipaddr.prefix = 0;
+		break;
+
+	default:
+		rad_assert(0);
+	}
+
+	if (!clients->deferred[ipaddr.prefix]) {
+		clients->deferred[ipaddr.prefix] = rbtree_talloc_create(clients, client_deferred_cmp,
+									client_deferred_t, NULL, RBTREE_FLAG_NONE);
+		if (!clients->deferred[ipaddr.prefix]) return -1;
+	}
+
+	entry = talloc_zero(clients, client_deferred_t);
+	if (!entry) return -1;
+
+	entry->ipaddr = ipaddr;
+	entry->proto = proto;
+	entry->tls_required = tls_required;
+	entry->cs = cs;
+	entry->server_cs = server_cs;
+
+	/*
+	 *	Duplicate definitions fall back to the boot time path,
+	 *	which knows how to compare the parsed clients.
+	 */
+	if (rbtree_finddata(clients->deferred[ipaddr.prefix], entry) ||
+	    !rbtree_insert(clients->deferred[ipaddr.prefix], entry)) {
+		talloc_free(entry);
+		return -1;
+	}
+
+	clients->num_deferred++;
+	clients->deferring = true;
+
+	return 0;
+}
+
+/** Parse a deferred client definition, and cache the result
+ *
+ * Must be called with client_deferred_mutex held.
+ *
+ * @param[in] clients	list the definition was indexed in.
+ * @param[in] entry	to materialise.  Always removed from the
+ *			deferred tree, so a bad definition is only
+ *			parsed (and complained about) once.
+ * @return
+ *	- The parsed client.
+ *	- NULL if parsing failed.
+ */
+static RADCLIENT *client_materialise(RADCLIENT_LIST *clients, client_deferred_t *entry)
+{
+	RADCLIENT	*c;
+	int		prefix = entry->ipaddr.prefix;
+
+	c = client_afrom_cs(entry->cs, entry->cs, entry->server_cs);
+	if (!c) {
+		ERROR("Failed parsing deferred client %s", cf_section_name2(entry->cs));
+	error:
+		(void) rbtree_deletebydata(clients->deferred[prefix], entry);
+		talloc_free(entry);
+		clients->num_deferred--;
+		return NULL;
+	}
+
+#ifdef WITH_TLS
+	if (entry->tls_required != c->tls_required) {
+		cf_log_err(entry->cs, "Client does not have the same TLS configuration as the listener");
+		client_free(c);
+		goto error;
+	}
+#endif
+
+	/*
+	 *	Same fixup as client_add().
+	 */
+	if (fr_ipaddr_is_inaddr_any(&c->ipaddr) == 1) switch (c->ipaddr.af) {
+	case AF_INET:
+		if (c->ipaddr.prefix == 32) c->ipaddr.prefix = 0;
+		break;
+
+	case AF_INET6:
+		if (c->ipaddr.prefix == 128) c->ipaddr.prefix = 0;
+		break;
+
+	default:
+		rad_assert(0);
+	}
+
+	if (!clients->lazy[c->ipaddr.prefix]) {
+		clients->lazy[c->ipaddr.prefix] = rbtree_talloc_create(clients, client_cmp, RADCLIENT,
+								       NULL, RBTREE_FLAG_NONE);
+		if (!clients->lazy[c->ipaddr.prefix]) {
+			client_free(c);
+			goto error;
+		}
+	}
+
+	if (!rbtree_insert(clients->lazy[c->ipaddr.prefix], c)) {
+		client_free(c);
+		goto error;
+	}
+
+	(void) talloc_steal(clients, c); /* reparent it */
+
+	DEBUG3("Materialised deferred client %s", c->longname);
+
+	(void) rbtree_deletebydata(clients->deferred[prefix], entry);
+	talloc_free(entry);
+	clients->num_deferred--;
+
+	return c;
+}
+
+/** Look up a client amongst the deferred and lazily parsed definitions
+ *
+ * @param[in] clients	list to search in.
+ * @param[in] ipaddr	of the client.
+ * @param[in] proto	of the client.
+ * @return
+ *	- The client, parsing its definition if this is the first
+ *	  packet from its prefix.
+ *	- NULL if no deferred definition covers the address.
+ */
+static RADCLIENT *client_find_deferred(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
+{
+	int			i, max;
+	RADCLIENT		my_client, *client = NULL;
+	client_deferred_t	my_entry, *entry;
+	RADCLIENT_LIST		*mutable;
+
+	memcpy(&mutable, &clients, sizeof(mutable));
+
+	if (ipaddr->af == AF_INET) {
+		max = 32;
+	} else {
+		max = 128;
+	}
+	if (max > ipaddr->prefix) max = ipaddr->prefix;
+
+	pthread_mutex_lock(&client_deferred_mutex);
+
+	my_client.proto = proto;
+	my_entry.proto = proto;
+
+	for (i = max; i >= 0; i--) {
+		if (mutable->lazy[i]) {
+			my_client.ipaddr = *ipaddr;
+			fr_ipaddr_mask(&my_client.ipaddr, i);
+			client = rbtree_finddata(mutable->lazy[i], &my_client);
+			if (client) break;
+		}
+
+		if (mutable->deferred[i]) {
+			my_entry.ipaddr = *ipaddr;
+			fr_ipaddr_mask(&my_entry.ipaddr, i);
+			entry = rbtree_finddata(mutable->deferred[i], &my_entry);
+			if (entry) {
+				client = client_materialise(mutable, entry);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&client_deferred_mutex);
+
+	return client;
+}
 
 /*
  *	Find a client in the RADCLIENTS list.
@@ -380,6 +679,7 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 {
 #ifdef WITH_TRIE
 	fr_trie_t *trie;
+	RADCLIENT *client;
 #else
 	int i, max;
 	RADCLIENT my_client, *client;
@@ -392,7 +692,8 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 #ifdef WITH_TRIE
 	trie = clients_trie(clients, ipaddr, proto);
 
-	return fr_trie_lookup(trie, &ipaddr->addr, ipaddr->prefix);
+	client = fr_trie_lookup(trie, &ipaddr->addr, ipaddr->prefix);
+	if (client) return client;
 #else
 
 	if (proto == AF_INET) {
@@ -414,9 +715,15 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 			return client;
 		}
 	}
+#endif
+
+	/*
+	 *	Nothing parsed at boot matched, check the definitions
+	 *	we deferred, parsing on first use.
+	 */
+	if (clients->deferring) return client_find_deferred(clients, ipaddr, proto);
 
 	return NULL;
-#endif
 }
 
 static fr_ipaddr_t cl_ipaddr;
@@ -470,6 +777,8 @@ static const CONF_PARSER client_config[] = {
 RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, int proto, TLS_UNUSED bool tls_required)
 {
 	bool		global = false;
+	bool		defer;
+	uint32_t	num_client_cs = 0;
 	CONF_SECTION	*cs = NULL;
 	RADCLIENT	*c = NULL;
 	RADCLIENT_LIST	*clients = NULL;
@@ -497,6 +806,19 @@ RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, int proto, TLS_
 
 	if (strcmp("server", cf_section_name1(section)) == 0) server_cs = section;
 
+	/*
+	 *	For very large client sections, don't parse every
+	 *	definition at boot.  Index them by prefix, and parse
+	 *	each one the first time a packet arrives from it, so
+	 *	startup time and memory scale with the clients which
+	 *	are actually active.
+	 */
+	while ((cs = cf_section_find_next(section, cs, "client", CF_IDENT_ANY))) num_client_cs++;
+
+	defer = (num_client_cs >= CLIENT_DEFER_THRESHOLD);
+	if (defer) INFO("Deferring parsing of %u clients in section %s until first use",
+			num_client_cs, cf_section_name1(section));
+
 	/*
 	 *	Iterate over all the clients in the section, adding
 	 *	them to the client list.
@@ -546,6 +868,11 @@ RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, int proto, TLS_
 			if ((client_proto != IPPROTO_IP) && (proto != client_proto)) continue;
 		}
 
+		/*
+		 *	Definitions we can't pre-scan (e.g. hostnames)
+		 *	fall through, and are parsed at boot as before.
+		 */
+		if (defer && (client_defer_add(clients, cs, server_cs, tls_required) == 0)) continue;
 
 		c = client_afrom_cs(cs, cs, server_cs);
 		if (!c) {
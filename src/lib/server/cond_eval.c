@@ -158,6 +158,7 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	int		ret;
 
 	regex_t		*preg, *rreg = NULL;
+	bool		cache_owned = false;
 	fr_regmatch_t	*regmatch;
 
 	if (!fr_cond_assert(lhs != NULL)) return -1;
@@ -173,8 +174,8 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	default:
 		if (!fr_cond_assert(rhs && rhs->type == FR_TYPE_STRING)) return -1;
 		if (!fr_cond_assert(rhs && rhs->vb_strvalue)) return -1;
-		slen = regex_compile(request, &rreg, rhs->vb_strvalue, rhs->datum.length,
-				     &map->rhs->tmpl_regex_flags, true, true);
+		slen = regex_compile_cached(request, &rreg, &cache_owned, rhs->vb_strvalue, rhs->datum.length,
+					    &map->rhs->tmpl_regex_flags, true);
 		if (slen <= 0) {
 			REMARKER(rhs->vb_strvalue, -slen, "%s", fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
@@ -182,6 +183,7 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 			return -1;
 		}
 		preg = rreg;
+		if (cache_owned) rreg = NULL;	/* Owned by the compilation cache, not ours to free */
 		break;
 	}
 
@@ -354,12 +356,17 @@ done:
  *
  * If casting is successful, we call cond_cmp_values to do the comparison
  *
+ * If the RHS needs to be expanded, the expansion is written to rhs_expanded,
+ * and reused on subsequent calls (one per LHS attribute instance).  The
+ * caller owns the expansion, and must free it when it's done iterating.
+ *
  * @return
  *	- -1 on failure.
  *	- 0 for "no match".
  *	- 1 for "match".
  */
-static int cond_normalise_and_cmp(REQUEST *request, fr_cond_t const *c, fr_value_box_t const *lhs)
+static int cond_normalise_and_cmp(REQUEST *request, fr_cond_t const *c, fr_value_box_t const *lhs,
+				  fr_value_box_t *rhs_expanded)
 {
 	vp_map_t const		*map = c->data.map;
 
@@ -390,7 +397,7 @@ do {\
 			   fr_table_str_by_value(fr_value_box_type_table, _s->type, "<INVALID>"),\
 			   fr_table_str_by_value(fr_value_box_type_table, cast_type, "<INVALID>"));\
 		if (fr_value_box_cast(request, &_s ## _cast, cast_type, cast, _s) < 0) {\
-			RPEDEBUG("Failed casting " #_s " operand");\
+			if (request) RPEDEBUG("Failed casting " #_s " operand");\
 			rcode = -1;\
 			goto finish;\
 		}\
@@ -508,39 +515,43 @@ do {\
 	case TMPL_TYPE_XLAT_STRUCT:
 	{
 		ssize_t ret;
-		fr_value_box_t data;
-
-		memset(&data, 0, sizeof(data));
 
-		if (!tmpl_is_unparsed(map->rhs)) {
-			char *p;
-
-			ret = tmpl_aexpand(request, &p, request, map->rhs, escape, NULL);
-			if (ret < 0) {
-				EVAL_DEBUG("FAIL [%i]", __LINE__);
-				rcode = -1;
-				goto finish;
+		/*
+		 *	Expand the RHS lazily, i.e. only when the comparison
+		 *	is actually reached, and at most once per condition
+		 *	evaluation.  The expansion is invariant across LHS
+		 *	attribute instances, so it's reused on subsequent
+		 *	calls.
+		 */
+		if (rhs_expanded->type == FR_TYPE_INVALID) {
+			if (!tmpl_is_unparsed(map->rhs)) {
+				char *p;
+
+				ret = tmpl_aexpand(request, &p, request, map->rhs, escape, NULL);
+				if (ret < 0) {
+					EVAL_DEBUG("FAIL [%i]", __LINE__);
+					rcode = -1;
+					goto finish;
+				}
+				rhs_expanded->vb_strvalue = p;
+				rhs_expanded->datum.length = ret;
+
+			} else {
+				rhs_expanded->vb_strvalue = map->rhs->name;
+				rhs_expanded->datum.length = map->rhs->len;
 			}
-			data.vb_strvalue = p;
-			data.datum.length = ret;
-
-		} else {
-			data.vb_strvalue = map->rhs->name;
-			data.datum.length = map->rhs->len;
+			rhs_expanded->type = FR_TYPE_STRING;
 		}
-		data.type = FR_TYPE_STRING;
 
-		rad_assert(data.vb_strvalue);
+		rad_assert(rhs_expanded->vb_strvalue);
 
-		rhs = &data;
+		rhs = rhs_expanded;
 
 		CHECK_INT_CAST(lhs, rhs);
 		CAST(lhs);
 		CAST(rhs);
 
 		rcode = cond_cmp_values(request, c, lhs, rhs);
-		if (!tmpl_is_unparsed(map->rhs)) talloc_free(data.datum.ptr);
-
 		break;
 	}
 
@@ -589,6 +600,8 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 
 	vp_map_t const *map = c->data.map;
 
+	fr_value_box_t rhs_expanded = { .type = FR_TYPE_INVALID };
+
 	EVAL_DEBUG(">>> MAP TYPES LHS: %s, RHS: %s",
 		   fr_table_str_by_value(tmpl_type_table, map->lhs->type, "???"),
 		   fr_table_str_by_value(tmpl_type_table, map->rhs->type, "???"));
@@ -612,7 +625,7 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 #ifndef NDEBUG
 			rad_assert(paircmp_find(map->lhs->tmpl_da)); /* expensive assert */
 #endif
-			rcode = cond_normalise_and_cmp(request, c, NULL);
+			rcode = cond_normalise_and_cmp(request, c, NULL, &rhs_expanded);
 			break;
 		}
 		for (vp = tmpl_cursor_init(&rcode, &cursor, request, map->lhs);
@@ -623,14 +636,14 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 			 *	if we get at least one set of operands that
 			 *	evaluates to true.
 			 */
-	     		rcode = cond_normalise_and_cmp(request, c, &vp->data);
+	     		rcode = cond_normalise_and_cmp(request, c, &vp->data, &rhs_expanded);
 	     		if (rcode != 0) break;
 		}
 	}
 		break;
 
 	case TMPL_TYPE_DATA:
-		rcode = cond_normalise_and_cmp(request, c, &map->lhs->tmpl_value);
+		rcode = cond_normalise_and_cmp(request, c, &map->lhs->tmpl_value, &rhs_expanded);
 		break;
 
 	case TMPL_TYPE_UNPARSED:
@@ -657,7 +670,7 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 		rad_assert(data.vb_strvalue);
 		data.type = FR_TYPE_STRING;
 
-		rcode = cond_normalise_and_cmp(request, c, &data);
+		rcode = cond_normalise_and_cmp(request, c, &data, &rhs_expanded);
 		if (p) talloc_free(p);
 	}
 		break;
@@ -675,6 +688,13 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 		break;
 	}
 
+	/*
+	 *	Free the RHS expansion (if the comparison was reached).
+	 */
+	if ((rhs_expanded.type != FR_TYPE_INVALID) && !tmpl_is_unparsed(map->rhs)) {
+		talloc_free(rhs_expanded.datum.ptr);
+	}
+
 	EVAL_DEBUG("<<<");
 
 	return rcode;
@@ -1354,6 +1354,40 @@ done:
 			break;
 		}
 
+		/*
+		 *	One side is data (usually due to an explicit
+		 *	cast), the other is a literal string.  The
+		 *	result can't change between requests, so
+		 *	evaluate it now.
+		 *
+		 *	If the evaluation fails (e.g. the literal can't
+		 *	be cast to the data type), leave the map alone,
+		 *	so that the error is reported at run time.
+		 */
+		if (((tmpl_is_data(c->data.map->lhs) && tmpl_is_unparsed(c->data.map->rhs)) ||
+		     (tmpl_is_unparsed(c->data.map->lhs) && tmpl_is_data(c->data.map->rhs))) &&
+		    !c->pass2_fixup) {
+			int rcode;
+
+			rcode = cond_eval_map(NULL, 0, 0, c);
+			if (rcode >= 0) {
+				DEBUG3("OPTIMIZING (%s %s %s) --> %s",
+				       c->data.map->lhs->name,
+				       fr_table_str_by_value(fr_tokens_table, c->data.map->op, "??"),
+				       c->data.map->rhs->name,
+				       rcode ? "TRUE" : "FALSE");
+
+				if (rcode) {
+					c->type = COND_TYPE_TRUE;
+				} else {
+					c->type = COND_TYPE_FALSE;
+				}
+				c->cast = NULL;
+				TALLOC_FREE(c->data.map);
+				break;
+			}
+		}
+
 		/*
 		 *	<ipaddr>"foo" CMP &Attribute-Name The cast may
 		 *	not be necessary, and we can re-write it so
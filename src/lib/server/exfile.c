@@ -31,24 +31,43 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
 
 typedef struct {
 	int			fd;			//!< File descriptor associated with an entry.
 	uint32_t		hash;			//!< Hash for cheap comparison.
 	time_t			last_used;		//!< Last time the entry was used.
+	time_t			opened;			//!< When the current incarnation of the file
+							///< was created, for time based rotation.
 	dev_t			st_dev;			//!< device inode
 	ino_t			st_ino;			//!< inode number
 	char			*filename;		//!< Filename.
 } exfile_entry_t;
 
+/** One shard of the handle table
+ *
+ * Files are mapped to shards by filename hash.  The shard mutex is
+ * held from exfile_open() to exfile_close(), which serializes writes
+ * to any one file.  Sharding means that threads appending to
+ * different files (e.g. per-NAS detail files) don't contend on a
+ * single global mutex.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;
+	time_t			last_cleaned;
+	exfile_entry_t		*entries;		//!< Array of exfile_t.shard_entries entries.
+} exfile_shard_t;
+
+#define EXFILE_SHARDS	(8)				//!< Must be a power of two.
 
 struct exfile_t {
-	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
+	uint32_t		shard_entries;		//!< How many file descriptors each shard tracks.
 	uint32_t		max_idle;		//!< Maximum idle time for a descriptor.
-	time_t			last_cleaned;
-	pthread_mutex_t		mutex;
-	exfile_entry_t		*entries;
+	exfile_shard_t		shard[EXFILE_SHARDS];
 	bool			locking;
+	uint64_t		rotate_size;		//!< Rotate a file once it grows past this.  0 disables.
+	uint32_t		rotate_age;		//!< Rotate a file this many seconds after it was
+							///< created.  0 disables.
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	VALUE_PAIR		*trigger_args;		//!< Arguments to pass to trigger.
@@ -61,10 +80,10 @@ struct exfile_t {
  *
  * @param[in] ef to send trigger for.
  * @param[in] request The current request.
- * @param[in] entry for the file that the event occurred on.
+ * @param[in] filename the event occurred on.
  * @param[in] name_suffix trigger name suffix.
  */
-static inline void exfile_trigger_exec(exfile_t *ef, REQUEST *request, exfile_entry_t *entry, char const *name_suffix)
+static inline void exfile_trigger_exec(exfile_t *ef, REQUEST *request, char const *filename, char const *name_suffix)
 {
 	char			name[128];
 	VALUE_PAIR		*vp, *args;
@@ -86,7 +105,7 @@ static inline void exfile_trigger_exec(exfile_t *ef, REQUEST *request, exfile_en
 	fr_cursor_init(&cursor, &args);
 
 	MEM(vp = fr_pair_afrom_da(NULL, da));
-	fr_pair_value_strcpy(vp, entry->filename);
+	fr_pair_value_strcpy(vp, filename);
 
 	fr_cursor_prepend(&cursor, vp);
 
@@ -107,7 +126,7 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 	/*
 	 *	Issue close trigger *after* we've closed the fd
 	 */
-	exfile_trigger_exec(ef, request, entry, "close");
+	exfile_trigger_exec(ef, request, entry->filename, "close");
 
 	/*
 	 *	Trigger still needs access to filename to populate Exfile-Name
@@ -118,18 +137,22 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 
 static int _exfile_free(exfile_t *ef)
 {
-	uint32_t i;
+	uint32_t i, s;
 
-	pthread_mutex_lock(&ef->mutex);
+	for (s = 0; s < EXFILE_SHARDS; s++) {
+		exfile_shard_t *shard = &ef->shard[s];
 
-	for (i = 0; i < ef->max_entries; i++) {
-		if (!ef->entries[i].filename) continue;
+		pthread_mutex_lock(&shard->mutex);
 
-		exfile_cleanup_entry(ef, NULL, &ef->entries[i]);
-	}
+		for (i = 0; i < ef->shard_entries; i++) {
+			if (!shard->entries[i].filename) continue;
+
+			exfile_cleanup_entry(ef, NULL, &shard->entries[i]);
+		}
 
-	pthread_mutex_unlock(&ef->mutex);
-	pthread_mutex_destroy(&ef->mutex);
+		pthread_mutex_unlock(&shard->mutex);
+		pthread_mutex_destroy(&shard->mutex);
+	}
 
 	return 0;
 }
@@ -147,13 +170,20 @@ static int _exfile_free(exfile_t *ef)
 exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle, bool locking)
 {
 	exfile_t *ef;
+	uint32_t s;
 
 	ef = talloc_zero(NULL, exfile_t);
 	if (!ef) return NULL;
 
 	talloc_link_ctx(ctx, ef);
 
-	ef->max_entries = max_entries;
+	/*
+	 *	Spread the entries over the shards.  Each file only
+	 *	ever hashes to one shard, so a shard needs to be able
+	 *	to track at least one file.
+	 */
+	ef->shard_entries = (max_entries + (EXFILE_SHARDS - 1)) / EXFILE_SHARDS;
+	if (!ef->shard_entries) ef->shard_entries = 1;
 	ef->max_idle = max_idle;
 	ef->locking = locking;
 
@@ -164,15 +194,20 @@ exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle,
 	 */
 	if (!ef->locking) return ef;
 
-	ef->entries = talloc_zero_array(ef, exfile_entry_t, max_entries);
-	if (!ef->entries) {
-		talloc_free(ef);
-		return NULL;
-	}
+	for (s = 0; s < EXFILE_SHARDS; s++) {
+		exfile_shard_t *shard = &ef->shard[s];
 
-	if (pthread_mutex_init(&ef->mutex, NULL) != 0) {
-		talloc_free(ef);
-		return NULL;
+		shard->entries = talloc_zero_array(ef, exfile_entry_t, ef->shard_entries);
+		if (!shard->entries) {
+			talloc_free(ef);
+			return NULL;
+		}
+
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			while (s > 0) pthread_mutex_destroy(&ef->shard[--s].mutex);
+			talloc_free(ef);
+			return NULL;
+		}
 	}
 
 	talloc_set_destructor(ef, _exfile_free);
@@ -205,6 +240,70 @@ void exfile_enable_triggers(exfile_t *ef, CONF_SECTION *conf, char const *trigge
 	(void) fr_pair_list_copy(ef, &ef->trigger_args, trigger_args);
 }
 
+/** Enable size/time based rotation for an exfile handle
+ *
+ * Rotation is checked when a writer calls exfile_open().  If the file
+ * is over size, or old enough, it's renamed out of the way and a fresh
+ * file is created, all while holding the shard mutex, so writers never
+ * see a half rotated file.  The rename is two syscalls, so unlike an
+ * external logrotate there's no window where writes stall behind a
+ * copy of the old data.
+ *
+ * Compressing the rotated file is deliberately left to the 'rotate'
+ * trigger, which receives the rotated filename in Exfile-Name, and
+ * runs outside of the request threads, e.g.
+ @verbatim
+   rotate = "/usr/bin/zstd -q --rm %{Exfile-Name}"
+ @endverbatim
+ *
+ * @note Rotation needs the handle to be tracking files, so it does
+ *	nothing when the handle was created with locking disabled.
+ *
+ * @param[in] ef to enable rotation for.
+ * @param[in] max_size a file may grow to before it's rotated at the next
+ *	write.  0 disables size based rotation.
+ * @param[in] max_age of a file, in seconds, before it's rotated at the
+ *	next write.  0 disables time based rotation.
+ */
+void exfile_enable_rotation(exfile_t *ef, uint64_t max_size, uint32_t max_age)
+{
+	ef->rotate_size = max_size;
+	ef->rotate_age = max_age;
+}
+
+/*
+ *	Rename a file out of the way, and tell the admin about it.
+ */
+static int exfile_rotate(exfile_t *ef, REQUEST *request, char const *filename, time_t now)
+{
+	char		rotated[PATH_MAX + 32];
+	struct stat	st;
+	unsigned int	n = 0;
+
+	snprintf(rotated, sizeof(rotated), "%s.%" PRIu64, filename, (uint64_t) now);
+
+	/*
+	 *	If we rotate the same file twice in one second, append
+	 *	a counter until we find a free name.
+	 */
+	while ((stat(rotated, &st) == 0) && (n < 1000)) {
+		snprintf(rotated, sizeof(rotated), "%s.%" PRIu64 ".%u", filename, (uint64_t) now, ++n);
+	}
+
+	if (rename(filename, rotated) < 0) {
+		fr_strerror_printf("Failed rotating file %s to %s: %s", filename, rotated, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The trigger gets the *rotated* name, so it can
+	 *	compress or archive the file we've just finished
+	 *	writing.
+	 */
+	exfile_trigger_exec(ef, request, rotated, "rotate");
+
+	return 0;
+}
 
 /*
  *	Try to open the file. It it doesn't exist, try to
@@ -280,6 +379,7 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	uint32_t hash;
 	time_t now;
 	struct stat st;
+	exfile_shard_t *shard;
 
 	if (!ef || !filename) return -1;
 
@@ -297,14 +397,18 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	/*
 	 *	It's faster to do hash comparisons of a string than
 	 *	full string comparisons.
+	 *
+	 *	The hash also picks the shard, so threads writing to
+	 *	different files usually take different mutexes.
 	 */
 	hash = fr_hash_string(filename);
+	shard = &ef->shard[hash & (EXFILE_SHARDS - 1)];
 	now = time(NULL);
 	unused = -1;
 
-	pthread_mutex_lock(&ef->mutex);
+	pthread_mutex_lock(&shard->mutex);
 
-	if (now > (ef->last_cleaned + 1)) do_cleanup = true;
+	if (now > (shard->last_cleaned + 1)) do_cleanup = true;
 
 	/*
 	 *	Find the matching entry, or an unused one.
@@ -312,14 +416,14 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	 *	Also track which entry is the oldest, in case there
 	 *	are no unused entries.
 	 */
-	for (i = 0; i < (int) ef->max_entries; i++) {
-		if (!ef->entries[i].filename) {
+	for (i = 0; i < (int) ef->shard_entries; i++) {
+		if (!shard->entries[i].filename) {
 			if (unused < 0) unused = i;
 			continue;
 		}
 
 		if ((oldest < 0) ||
-		    (ef->entries[i].last_used < ef->entries[oldest].last_used)) {
+		    (shard->entries[i].last_used < shard->entries[oldest].last_used)) {
 			oldest = i;
 		}
 
@@ -333,8 +437,8 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		 *	ensure that it happens.
 		 */
 		if ((found < 0) &&
-		    (ef->entries[i].hash == hash) &&
-		    (strcmp(ef->entries[i].filename, filename) == 0)) {
+		    (shard->entries[i].hash == hash) &&
+		    (strcmp(shard->entries[i].filename, filename) == 0)) {
 			found = i;
 
 			/*
@@ -348,13 +452,13 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 			 *	do so now.
 			 */
 		} else if (do_cleanup) {
-			if ((ef->entries[i].last_used + ef->max_idle) >= now) continue;
+			if ((shard->entries[i].last_used + ef->max_idle) >= now) continue;
 
-			exfile_cleanup_entry(ef, request, &ef->entries[i]);
+			exfile_cleanup_entry(ef, request, &shard->entries[i]);
 		}
 	}
 
-	if (do_cleanup) ef->last_cleaned = now;
+	if (do_cleanup) shard->last_cleaned = now;
 
 	/*
 	 *	We found an existing entry, return that.
@@ -367,16 +471,30 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		 *	If that's not the file we opened, then go back
 		 *	and re-open the file.
 		 */
-		if (stat(ef->entries[i].filename, &st) < 0) {
+		if (stat(shard->entries[i].filename, &st) < 0) {
 			goto reopen;
 		}
 
-		if ((st.st_dev != ef->entries[i].st_dev) ||
-		    (st.st_ino != ef->entries[i].st_ino)) {
-			close(ef->entries[i].fd);
+		if ((st.st_dev != shard->entries[i].st_dev) ||
+		    (st.st_ino != shard->entries[i].st_ino)) {
+			close(shard->entries[i].fd);
 			goto reopen;
 		}
 
+		/*
+		 *	Built-in rotation.  If the rename fails we
+		 *	keep appending to the old file, which is
+		 *	better than dropping the write.
+		 */
+		if ((ef->rotate_size && ((uint64_t) st.st_size >= ef->rotate_size)) ||
+		    (ef->rotate_age && ((shard->entries[i].opened + (time_t) ef->rotate_age) <= now))) {
+			if (exfile_rotate(ef, request, shard->entries[i].filename, now) == 0) {
+				close(shard->entries[i].fd);
+				goto reopen;
+			}
+			WARN("%s", fr_strerror());
+		}
+
 		goto try_lock;
 	}
 
@@ -384,7 +502,7 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	 *	There are no unused entries, free the oldest one.
 	 */
 	if (unused < 0) {
-		exfile_cleanup_entry(ef, request, &ef->entries[oldest]);
+		exfile_cleanup_entry(ef, request, &shard->entries[oldest]);
 		unused = oldest;
 	}
 
@@ -393,26 +511,36 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	 */
 	i = unused;
 
-	ef->entries[i].hash = hash;
-	ef->entries[i].filename = talloc_typed_strdup(ef->entries, filename);
-	ef->entries[i].fd = -1;
+	shard->entries[i].hash = hash;
+	shard->entries[i].filename = talloc_typed_strdup(shard->entries, filename);
+	shard->entries[i].fd = -1;
+
+	/*
+	 *	A file we weren't tracking (e.g. one left over from
+	 *	before a restart) may already be over the limit.
+	 */
+	if (ef->rotate_size && (stat(filename, &st) == 0) && ((uint64_t) st.st_size >= ef->rotate_size)) {
+		if (exfile_rotate(ef, request, filename, now) < 0) WARN("%s", fr_strerror());
+	}
 
 reopen:
-	ef->entries[i].fd = exfile_open_mkdir(ef, filename, permissions);
-	if (ef->entries[i].fd < 0) goto error;
+	shard->entries[i].fd = exfile_open_mkdir(ef, filename, permissions);
+	if (shard->entries[i].fd < 0) goto error;
+
+	shard->entries[i].opened = now;
 
-	exfile_trigger_exec(ef, request, &ef->entries[i], "open");
+	exfile_trigger_exec(ef, request, shard->entries[i].filename, "open");
 
 try_lock:
 	/*
 	 *	Lock from the start of the file.
 	 */
-	if (lseek(ef->entries[i].fd, 0, SEEK_SET) < 0) {
+	if (lseek(shard->entries[i].fd, 0, SEEK_SET) < 0) {
 		fr_strerror_printf("Failed to seek in file %s: %s", filename, fr_syserror(errno));
 
 	error:
-		exfile_cleanup_entry(ef, request, &ef->entries[i]);
-		pthread_mutex_unlock(&(ef->mutex));
+		exfile_cleanup_entry(ef, request, &shard->entries[i]);
+		pthread_mutex_unlock(&shard->mutex);
 		return -1;
 	}
 
@@ -423,16 +551,16 @@ try_lock:
 	 *	and try again/
 	 */
 	for (tries = 0; tries < MAX_TRY_LOCK; tries++) {
-		if (rad_lockfd_nonblock(ef->entries[i].fd, 0) >= 0) break;
+		if (rad_lockfd_nonblock(shard->entries[i].fd, 0) >= 0) break;
 
 		if (errno != EAGAIN) {
 			fr_strerror_printf("Failed to lock file %s: %s", filename, fr_syserror(errno));
 			goto error;
 		}
 
-		close(ef->entries[i].fd);
-		ef->entries[i].fd = open(filename, O_RDWR | O_CREAT, permissions);
-		if (ef->entries[i].fd < 0) {
+		close(shard->entries[i].fd);
+		shard->entries[i].fd = open(filename, O_RDWR | O_CREAT, permissions);
+		if (shard->entries[i].fd < 0) {
 			fr_strerror_printf("Failed to open file %s: %s", filename, fr_syserror(errno));
 			goto error;
 		}
@@ -447,13 +575,13 @@ try_lock:
 	 *	Maybe someone deleted the file while we were waiting
 	 *	for the lock.  If so, re-open it.
 	 */
-	if (fstat(ef->entries[i].fd, &st) < 0) {
+	if (fstat(shard->entries[i].fd, &st) < 0) {
 		fr_strerror_printf("Failed to stat file %s: %s", filename, fr_syserror(errno));
 		goto reopen;
 	}
 
 	if (st.st_nlink == 0) {
-		close(ef->entries[i].fd);
+		close(shard->entries[i].fd);
 		goto reopen;
 	}
 
@@ -461,8 +589,8 @@ try_lock:
 	 *	Remember which device and inode this file is
 	 *	for.
 	 */
-	ef->entries[i].st_dev = st.st_dev;
-	ef->entries[i].st_ino = st.st_ino;
+	shard->entries[i].st_dev = st.st_dev;
+	shard->entries[i].st_ino = st.st_ino;
 
 	/*
 	 *	Sometimes the file permissions are changed externally.
@@ -482,7 +610,7 @@ try_lock:
 		     oct_have, str_have, oct_need, str_need);
 
 		if (((st.st_mode | permissions) != st.st_mode) &&
-		    (fchmod(ef->entries[i].fd, (st.st_mode & ~S_IFMT) | permissions) < 0)) {
+		    (fchmod(shard->entries[i].fd, (st.st_mode & ~S_IFMT) | permissions) < 0)) {
 			rad_mode_to_oct(oct_need, (st.st_mode & ~S_IFMT) | permissions);
 			rad_mode_to_str(str_need, (st.st_mode & ~S_IFMT) | permissions);
 
@@ -495,17 +623,17 @@ try_lock:
 	 *	Seek to the end of the file before returning the FD to
 	 *	the caller.
 	 */
-	(void) lseek(ef->entries[i].fd, 0, SEEK_END);
+	(void) lseek(shard->entries[i].fd, 0, SEEK_END);
 
 	/*
-	 *	Return holding the mutex for the entry.
+	 *	Return holding the mutex for the shard.
 	 */
-	ef->entries[i].last_used = now;
+	shard->entries[i].last_used = now;
 
-	exfile_trigger_exec(ef, request, &ef->entries[i], "reserve");
+	exfile_trigger_exec(ef, request, shard->entries[i].filename, "reserve");
 
 	/* coverity[missing_unlock] */
-	return ef->entries[i].fd;
+	return shard->entries[i].fd;
 }
 
 /** Close the log file.  Really just return it to the pool.
@@ -523,7 +651,7 @@ try_lock:
  */
 int exfile_close(exfile_t *ef, REQUEST *request, int fd)
 {
-	uint32_t i;
+	uint32_t i, s;
 
 	/*
 	 *	No locking: just close the file.
@@ -535,19 +663,27 @@ int exfile_close(exfile_t *ef, REQUEST *request, int fd)
 
 	/*
 	 *	Unlock the bytes that we had previously locked.
+	 *
+	 *	The caller holds the mutex for the shard the FD lives
+	 *	in, so the matching entry can't change underneath us.
+	 *	Entries in other shards may change, but as the FD is
+	 *	open it can't be in use by any other shard, so a
+	 *	comparison against those entries can never match.
 	 */
-	for (i = 0; i < ef->max_entries; i++) {
-		if (ef->entries[i].fd != fd) continue;
+	for (s = 0; s < EXFILE_SHARDS; s++) {
+		exfile_shard_t *shard = &ef->shard[s];
 
-		(void) lseek(ef->entries[i].fd, 0, SEEK_SET);
-		(void) rad_unlockfd(ef->entries[i].fd, 0);
-		pthread_mutex_unlock(&(ef->mutex));
+		for (i = 0; i < ef->shard_entries; i++) {
+			if (shard->entries[i].fd != fd) continue;
 
-		exfile_trigger_exec(ef, request, &ef->entries[i], "release");
-		return 0;
-	}
+			(void) lseek(shard->entries[i].fd, 0, SEEK_SET);
+			(void) rad_unlockfd(shard->entries[i].fd, 0);
+			pthread_mutex_unlock(&shard->mutex);
 
-	pthread_mutex_unlock(&(ef->mutex));
+			exfile_trigger_exec(ef, request, shard->entries[i].filename, "release");
+			return 0;
+		}
+	}
 
 	fr_strerror_printf("Attempt to unlock file which is not tracked");
 	return -1;
@@ -40,6 +40,8 @@ exfile_t	*exfile_init(TALLOC_CTX *ctx, uint32_t entries, uint32_t idle, bool loc
 void		exfile_enable_triggers(exfile_t *ef, CONF_SECTION *cs, char const *trigger_prefix,
 				       VALUE_PAIR *trigger_args);
 
+void		exfile_enable_rotation(exfile_t *ef, uint64_t max_size, uint32_t max_age);
+
 int		exfile_open(exfile_t *lf, REQUEST *request, char const *filename,
 			    mode_t permissions);
 
@@ -41,6 +41,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/dict.h>
 
 #include <sys/stat.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <grp.h>
 
@@ -81,6 +82,7 @@ static int lib_dir_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci
 
 static int talloc_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
+static int request_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
 static int max_request_time_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
@@ -141,6 +143,7 @@ static const CONF_PARSER log_config[] = {
 	{ FR_CONF_OFFSET("line_number", FR_TYPE_BOOL, main_config_t, log_line_number) },
 	{ FR_CONF_OFFSET("timestamp", FR_TYPE_BOOL, main_config_t, log_timestamp) },
 	{ FR_CONF_OFFSET("use_utc", FR_TYPE_BOOL, main_config_t, log_dates_utc) },
+	{ FR_CONF_OFFSET("buffered", FR_TYPE_BOOL, main_config_t, log_buffered), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -150,6 +153,14 @@ static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, num_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
 
+	{ FR_CONF_OFFSET("pin_workers", FR_TYPE_BOOL, main_config_t, pin_workers), .dflt = "no" },
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+
+	{ FR_CONF_OFFSET("weight_high", FR_TYPE_UINT32, main_config_t, weight_high), .dflt = STRINGIFY(8) },
+	{ FR_CONF_OFFSET("weight_normal", FR_TYPE_UINT32, main_config_t, weight_normal), .dflt = STRINGIFY(4) },
+	{ FR_CONF_OFFSET("weight_low", FR_TYPE_UINT32, main_config_t, weight_low), .dflt = STRINGIFY(1) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -163,6 +174,7 @@ static const CONF_PARSER resources[] = {
 	{ FR_CONF_OFFSET("talloc_pool_size", FR_TYPE_SIZE, main_config_t, talloc_pool_size), .func = talloc_pool_size_parse },			/* DO NOT SET DEFAULT */
 	{ FR_CONF_OFFSET("talloc_memory_limit", FR_TYPE_SIZE, main_config_t, talloc_memory_limit), .func = talloc_memory_limit_parse },		/* DO NOT SET DEFAULT */
 	{ FR_CONF_OFFSET("talloc_memory_report", FR_TYPE_BOOL, main_config_t, talloc_memory_report) },						/* DO NOT SET DEFAULT */
+	{ FR_CONF_OFFSET("request_memory_limit", FR_TYPE_SIZE, main_config_t, request_memory_limit), .func = request_memory_limit_parse },	/* DO NOT SET DEFAULT */
 	CONF_PARSER_TERMINATOR
 };
 
@@ -185,6 +197,7 @@ static const CONF_PARSER server_config[] = {
 	{ FR_CONF_OFFSET("hostname_lookups", FR_TYPE_BOOL, main_config_t, hostname_lookups), .dflt = "yes", .func = hostname_lookups_parse },
 	{ FR_CONF_OFFSET("max_request_time", FR_TYPE_TIME_DELTA, main_config_t, max_request_time), .dflt = STRINGIFY(MAX_REQUEST_TIME), .func = max_request_time_parse },
 	{ FR_CONF_OFFSET("pidfile", FR_TYPE_STRING, main_config_t, pid_file), .dflt = "${run_dir}/radiusd.pid"},
+	{ FR_CONF_OFFSET("stats_shm_path", FR_TYPE_STRING, main_config_t, stats_shm_path) },
 
 	{ FR_CONF_OFFSET("debug_level", FR_TYPE_UINT32, main_config_t, debug_level), .dflt = "0" },
 
@@ -331,6 +344,26 @@ static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+static int request_memory_limit_parse(TALLOC_CTX *ctx, void *out, void *parent,
+				      CONF_ITEM *ci, CONF_PARSER const *rule)
+{
+	int	ret;
+	size_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	if (value) {
+		FR_SIZE_BOUND_CHECK("resources.request_memory_limit", value, >=, (size_t)(64 * 1024));
+		FR_SIZE_BOUND_CHECK("resources.request_memory_limit", value, <=, (size_t)1024 * 1024 * 1024);
+	}
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
 static int max_request_time_parse(TALLOC_CTX *ctx, void *out, void *parent,
 				  CONF_ITEM *ci, CONF_PARSER const *rule)
 {
@@ -359,7 +392,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >, 0);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -889,6 +923,108 @@ static int _dlhandle_free(void **dl_handle)
 	return 0;
 }
 
+/*
+ *	State for the dictionary preload thread.
+ *	See main_config_dict_preload().
+ */
+static pthread_t	dict_preload_thread;
+static bool		dict_preload_running = false;
+static int		dict_preload_result = 0;
+
+/** Load the internal dictionary, and the optional raddb dictionary
+ *
+ * @param[in] config	to write the internal dictionary pointer to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dict_load(main_config_t *config)
+{
+	if (fr_dict_internal_afrom_file(&config->dict, FR_DICTIONARY_INTERNAL_DIR) < 0) {
+		PERROR("Failed reading internal dictionaries");
+		return -1;
+	}
+
+	/*
+	 *	It's OK if this one doesn't exist.
+	 */
+	switch (fr_dict_read(config->dict, config->raddb_dir, FR_DICTIONARY_FILE)) {
+	case -1:
+		PERROR("Error reading dictionary \"%s/%s\"", config->raddb_dir, FR_DICTIONARY_FILE);
+		return -1;
+
+	case 0:
+		DEBUG2("Including dictionary file \"%s/%s\"", config->raddb_dir, FR_DICTIONARY_FILE);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void *_dict_preload(void *uctx)
+{
+	main_config_t *config = talloc_get_type_abort(uctx, main_config_t);
+
+	dict_preload_result = dict_load(config);
+
+	return NULL;
+}
+
+/** Start loading the dictionaries on a second thread
+ *
+ * The dictionary load and the raddb parse don't depend on each other
+ * until the config starts referencing attributes, so the two can be
+ * pipelined.  main_config_dict_join() is called before anything looks
+ * at the dictionaries; namespace_on_read() joins before loading
+ * protocol dictionaries, and main_config_init() joins after reading
+ * the config files.
+ *
+ * Must be called after fr_dict_global_init(), and before
+ * main_config_init().  If the thread can't be started, the
+ * dictionaries are loaded synchronously by main_config_init(), as if
+ * this function had never been called.
+ *
+ * @param[in] config	to load dictionaries for.
+ * @return 0.
+ */
+int main_config_dict_preload(main_config_t *config)
+{
+	int ret;
+
+	rad_assert(!dict_preload_running);
+
+	ret = pthread_create(&dict_preload_thread, NULL, _dict_preload, config);
+	if (ret != 0) {
+		WARN("Failed starting dictionary preload thread: %s", fr_syserror(ret));
+		return 0;
+	}
+	dict_preload_running = true;
+
+	return 0;
+}
+
+/** Wait for the dictionary preload thread to finish
+ *
+ * May be called multiple times, only the first call joins.  Does
+ * nothing if no preload thread was started.
+ *
+ * @return
+ *	- 0 if the dictionaries loaded (or no thread was started).
+ *	- -1 if the preload thread failed loading them.
+ */
+int main_config_dict_join(void)
+{
+	if (!dict_preload_running) return 0;
+
+	(void) pthread_join(dict_preload_thread, NULL);
+	dict_preload_running = false;
+
+	return dict_preload_result;
+}
+
 /*
  *	Read config files.
  *
@@ -930,29 +1066,12 @@ int main_config_init(main_config_t *config)
 	 */
 	config->talloc_pool_size = 8 * 1024; /* default */
 
-	if (fr_dict_internal_afrom_file(&config->dict, FR_DICTIONARY_INTERNAL_DIR) < 0) {
-		PERROR("Failed reading internal dictionaries");
-		goto failure;
-	}
-
-#define DICT_READ_OPTIONAL(_d, _n) \
-do {\
-	switch (fr_dict_read(config->dict, _d, _n)) {\
-	case -1:\
-		PERROR("Error reading dictionary \"%s/%s\"", _d, _n);\
-		goto failure;\
-	case 0:\
-		DEBUG2("Including dictionary file \"%s/%s\"", _d,_n);\
-		break;\
-	default:\
-		break;\
-	}\
-} while (0)
-
 	/*
-	 *	It's OK if this one doesn't exist.
+	 *	If the dictionaries are loading on the preload
+	 *	thread, they load in parallel with the config file
+	 *	read below, and we join afterwards.
 	 */
-	DICT_READ_OPTIONAL(config->raddb_dir, FR_DICTIONARY_FILE);
+	if (!dict_preload_running && (dict_load(config) < 0)) goto failure;
 
 	cs = cf_section_alloc(NULL, NULL, "main", NULL);
 	if (!cs) return -1;
@@ -1024,6 +1143,11 @@ do {\
 		goto failure;
 	}
 
+	/*
+	 *	Everything from here on needs the dictionaries.
+	 */
+	if (main_config_dict_join() < 0) goto failure;
+
 	/*
 	 *	Do any fixups here that might be used in references
 	 */
@@ -1257,6 +1381,42 @@ int main_config_free(main_config_t **config)
 	return 0;
 }
 
+/** Parse the configuration files into a parallel tree to check them
+ *
+ * Building the new tree up front means a broken edit is discovered
+ * while the old configuration is still serving requests, instead of
+ * after a restart has already torn the old one down.
+ *
+ * The parallel tree is only parsed, never instantiated, so it has no
+ * effect on the running server, and is freed before we return.
+ *
+ * @param[in] config	the main config structure.
+ * @return
+ *	- 0 if the new configuration parsed cleanly.
+ *	- -1 on parse error.
+ */
+static int main_config_check(main_config_t *config)
+{
+	CONF_SECTION	*cs;
+	char		buffer[256];
+
+	cs = cf_section_alloc(NULL, NULL, "main", NULL);
+	if (!cs) return -1;
+
+	snprintf(buffer, sizeof(buffer), "%.200s/%.50s.conf", config->raddb_dir, config->name);
+	if (cf_file_read(cs, buffer) < 0) {
+	failure:
+		talloc_free(cs);
+		return -1;
+	}
+
+	if (cf_section_pass2(cs) < 0) goto failure;
+
+	talloc_free(cs);
+
+	return 0;
+}
+
 void hup_logfile(main_config_t *config)
 {
 	int fd, old_fd;
@@ -1304,18 +1464,19 @@ void main_config_hup(main_config_t *config)
 	}
 	last_hup = when;
 
-#if 0
-	rcode = cf_file_changed(cs_cache->cs, hup_callback);
-	if (rcode == CF_FILE_NONE) {
-		INFO("HUP - No files changed.  Ignoring");
-		return;
-	}
-
-	if (rcode == CF_FILE_ERROR) {
-		INFO("HUP - Cannot read configuration files.  Ignoring");
+	/*
+	 *	Re-parse the configuration into a parallel tree, so
+	 *	that a broken edit is discovered now, while the old
+	 *	configuration is still serving requests.
+	 *
+	 *	Swapping the trees over is NYI in version 4: module and
+	 *	virtual server instantiation isn't re-runnable yet, so
+	 *	activating the new tree still requires a restart.
+	 */
+	if (main_config_check(config) < 0) {
+		ERROR("HUP - New configuration is invalid.  Keeping the running configuration");
 		return;
 	}
-#endif
 
-	INFO("HUP - NYI in version 4");	/* Not yet implemented in v4 */
+	INFO("HUP - New configuration parses cleanly.  Restart the server to activate it");
 }
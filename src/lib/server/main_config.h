@@ -64,6 +64,15 @@ struct main_config_s {
 	uint32_t	num_networks;			//!< number of network threads
 	uint32_t	num_workers;			//!< number of network threads
 
+	bool		pin_workers;			//!< Pin network / worker threads to CPUs.
+	char const	*network_cpus;			//!< CPUs to pin network threads to, aligned
+							//!< with the cores receiving the NIC IRQs.
+	char const	*worker_cpus;			//!< CPUs to pin worker threads to.
+
+	uint32_t	weight_high;			//!< Share of the worker given to high priority packets.
+	uint32_t	weight_normal;			//!< Share of the worker given to normal priority packets.
+	uint32_t	weight_low;			//!< Share of the worker given to low priority packets.
+
 	bool		drop_requests;			//!< Administratively disable request processing.
 
 	char const	*log_dir;
@@ -91,12 +100,20 @@ struct main_config_s {
 	bool		*log_timestamp;
 	bool		log_timestamp_is_set;
 
+	bool		log_buffered;			//!< Hand log writes off to a dedicated logger thread.
+
 	int32_t		syslog_facility;
 
 	char const	*dict_dir;			//!< Where to load dictionaries from.
 
+	char const	*stats_shm_path;		//!< Where to export statistics via shared memory.
+							//!< NULL disables the export.
+
 	size_t		talloc_pool_size;		//!< Size of pool to allocate to hold each #REQUEST.
 
+	size_t		request_memory_limit;		//!< Stop a request once it has used this much memory.
+							//!< 0 is unlimited.
+
 	bool		write_pid;			//!< write the PID file
 
 #ifdef HAVE_SETUID
@@ -144,6 +161,8 @@ void			main_config_raddb_dir_set(main_config_t *config, char const *path);
 void			main_config_dict_dir_set(main_config_t *config, char const *path);
 
 main_config_t		*main_config_alloc(TALLOC_CTX *ctx);
+int			main_config_dict_preload(main_config_t *config);
+int			main_config_dict_join(void);
 int			main_config_init(main_config_t *config);
 int			main_config_free(main_config_t **config);
 void			main_config_hup(main_config_t *config);
@@ -46,6 +46,18 @@ static size_t instance_num = 0;
  */
 static _Thread_local module_thread_instance_t **module_thread_inst_array;
 
+/** Whether module calls are timed.  Toggled at runtime via radmin
+ */
+bool module_profile_enabled = false;
+
+/*
+ *	Every thread's module_thread_inst_array, so that the profiling
+ *	counters can be aggregated and reset from the control socket.
+ */
+static pthread_mutex_t module_thread_array_mutex = PTHREAD_MUTEX_INITIALIZER;
+static module_thread_instance_t ***module_thread_arrays = NULL;
+static size_t num_module_thread_arrays = 0;
+
 /** Lookup module instances by name and lineage
  */
 static rbtree_t *module_instance_name_tree;
@@ -181,6 +193,121 @@ static int cmd_set_module_status(UNUSED FILE *fp, UNUSED FILE *fp_err, void *ctx
 }
 
 
+typedef struct {
+	char const	*name;		//!< Instance name.
+	uint64_t	calls;		//!< Aggregated over all threads.
+	int64_t		wall;		//!< Wall clock nanoseconds.
+	int64_t		cpu;		//!< CPU nanoseconds.
+} module_profile_entry_t;
+
+typedef struct {
+	module_profile_entry_t	*entries;
+	size_t			num;
+} module_profile_stats_t;
+
+/*
+ *	The workers update the counters without locks, so the sums are
+ *	only approximate while traffic is flowing.  That's fine for
+ *	"which module got slower".
+ */
+static int _module_profile_sum(void *instance, void *uctx)
+{
+	module_instance_t	*mi = talloc_get_type_abort(instance, module_instance_t);
+	module_profile_stats_t	*stats = uctx;
+	module_profile_entry_t	*entry = &stats->entries[stats->num];
+	size_t			i;
+
+	entry->name = mi->name;
+	entry->calls = 0;
+	entry->wall = 0;
+	entry->cpu = 0;
+
+	for (i = 0; i < num_module_thread_arrays; i++) {
+		module_thread_instance_t *ti = module_thread_arrays[i][mi->number];
+
+		if (!ti) continue;
+
+		entry->calls += ti->profile_calls;
+		entry->wall += ti->profile_wall;
+		entry->cpu += ti->profile_cpu;
+	}
+
+	if (entry->calls > 0) stats->num++;
+
+	return 0;
+}
+
+static int _module_profile_cmp(void const *a, void const *b)
+{
+	module_profile_entry_t const *one = a;
+	module_profile_entry_t const *two = b;
+
+	if (one->wall > two->wall) return -1;
+	if (one->wall < two->wall) return +1;
+
+	return 0;
+}
+
+static int cmd_show_profile(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_profile_stats_t	stats;
+	size_t			i;
+
+	stats.entries = talloc_array(NULL, module_profile_entry_t, instance_num + 1);
+	if (!stats.entries) return -1;
+	stats.num = 0;
+
+	pthread_mutex_lock(&module_thread_array_mutex);
+	(void) rbtree_walk(module_instance_name_tree, RBTREE_IN_ORDER, _module_profile_sum, &stats);
+	pthread_mutex_unlock(&module_thread_array_mutex);
+
+	qsort(stats.entries, stats.num, sizeof(stats.entries[0]), _module_profile_cmp);
+
+	fprintf(fp, "profiling %s\n", module_profile_enabled ? "on" : "off");
+	fprintf(fp, "%-32s %12s %14s %14s\n", "module", "calls", "wall (ms)", "cpu (ms)");
+	for (i = 0; i < stats.num; i++) {
+		fprintf(fp, "%-32s %12" PRIu64 " %14.3f %14.3f\n",
+			stats.entries[i].name, stats.entries[i].calls,
+			(double) stats.entries[i].wall / 1000000.0,
+			(double) stats.entries[i].cpu / 1000000.0);
+	}
+
+	talloc_free(stats.entries);
+
+	return 0;
+}
+
+static int cmd_set_profile(UNUSED FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, fr_cmd_info_t const *info)
+{
+	if (strcmp(info->argv[0], "on") == 0) {
+		module_profile_enabled = true;
+
+	} else if (strcmp(info->argv[0], "off") == 0) {
+		module_profile_enabled = false;
+
+	} else {		/* clear */
+		size_t i, j;
+
+		pthread_mutex_lock(&module_thread_array_mutex);
+		for (i = 0; i < num_module_thread_arrays; i++) {
+			size_t len = talloc_array_length(module_thread_arrays[i]);
+
+			for (j = 0; j < len; j++) {
+				module_thread_instance_t *ti = module_thread_arrays[i][j];
+
+				if (!ti) continue;
+
+				ti->profile_calls = 0;
+				ti->profile_wall = 0;
+				ti->profile_cpu = 0;
+			}
+		}
+		pthread_mutex_unlock(&module_thread_array_mutex);
+	}
+
+	return 0;
+}
+
 static fr_cmd_table_t cmd_module_table[] = {
 	{
 		.parent = "show module",
@@ -241,6 +368,22 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = false,
 	},
 
+	{
+		.parent = "show",
+		.name = "profile",
+		.func = cmd_show_profile,
+		.help = "Show cumulative per-module call counts and times, sorted by wall time.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "set",
+		.name = "profile",
+		.syntax = "(on|off|clear)",
+		.func = cmd_set_profile,
+		.help = "Enable, disable, or reset per-module profiling.",
+		.read_only = false,
+	},
 
 	CMD_TABLE_END
 };
@@ -1174,12 +1317,30 @@ int modules_init(void)
 	return 0;
 }
 
+/** Alignment for per-thread module instance data
+ *
+ * Each module's thread instance data is padded out to a multiple of
+ * this size, so that frequently updated fields (statistics, counters)
+ * at the end of one module's data can't share a cache line with the
+ * start of a neighbouring module's.
+ */
+#define MODULE_THREAD_INST_ALIGN (64)
+
 /** Destructor for module_thread_instance_t array
  */
 static int _module_thread_inst_array_free(module_thread_instance_t **array)
 {
 	size_t i, len;
 
+	pthread_mutex_lock(&module_thread_array_mutex);
+	for (i = 0; i < num_module_thread_arrays; i++) {
+		if (module_thread_arrays[i] == array) {
+			module_thread_arrays[i] = module_thread_arrays[--num_module_thread_arrays];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&module_thread_array_mutex);
+
 	len = talloc_array_length(array);
 	for (i = 0; i < len; i++) {
 		module_thread_instance_t *ti;
@@ -1202,6 +1363,23 @@ typedef struct {
 	fr_event_list_t *el;		//!< Event list for this thread.
 } _thread_intantiate_ctx_t;
 
+/** Accumulate how much memory one module's thread instance data needs
+ *
+ * @param[in] instance	of module to size.
+ * @param[in] uctx	size_t to add the module's requirements to.
+ * @return 0.
+ */
+static int _module_thread_inst_size(void *instance, void *uctx)
+{
+	module_instance_t	*mi = talloc_get_type_abort(instance, module_instance_t);
+	size_t			*total = uctx;
+
+	*total += sizeof(module_thread_instance_t) +
+		  ROUND_UP_POW2(mi->module->thread_inst_size, MODULE_THREAD_INST_ALIGN);
+
+	return 0;
+}
+
 /** Setup thread specific instance data for a module
  *
  * @param[in] uctx	additional arguments to pass to a module's thread_instantiate function.
@@ -1223,7 +1401,9 @@ static int _module_thread_instantiate(void *instance, void *uctx)
 	ti->mod_inst = mi->dl_inst->data;	/* For efficient lookups */
 
 	if (mi->module->thread_inst_size) {
-		MEM(ti->data = talloc_zero_array(ti, uint8_t, mi->module->thread_inst_size));
+		MEM(ti->data = talloc_zero_array(ti, uint8_t,
+						 ROUND_UP_POW2(mi->module->thread_inst_size,
+							       MODULE_THREAD_INST_ALIGN)));
 
 		/*
 		 *	Fixup the type name, incase something calls
@@ -1236,7 +1416,8 @@ static int _module_thread_instantiate(void *instance, void *uctx)
 		}
 	}
 
-	DEBUG4("Worker alloced %s thread instance data (%p/%p)", ti->module->name, ti, ti->data);
+	DEBUG4("Worker alloced %s thread instance data (%p/%p), %zu bytes",
+	       ti->module->name, ti, ti->data, talloc_get_size(ti->data));
 	if (mi->module->thread_instantiate) {
 		ret = mi->module->thread_instantiate(mi->dl_inst->conf, mi->dl_inst->data,
 						     thread_inst_ctx->el, ti->data);
@@ -1269,8 +1450,33 @@ int modules_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
 	 *	Initialise the thread specific tree if this is the first time through
 	 */
 	if (!module_thread_inst_array) {
-		MEM(module_thread_inst_array = talloc_zero_array(ctx, module_thread_instance_t *, instance_num + 1));
+		TALLOC_CTX	*pool;
+		size_t		pool_size = 0;
+
+		/*
+		 *	All of this thread's module instance data is
+		 *	carved out of a single slab, so it's packed
+		 *	into as few pages as possible, and is never
+		 *	interleaved with another thread's data.
+		 *
+		 *	The extra 128 bytes per module covers the
+		 *	talloc chunk headers (two allocations per
+		 *	module).  If the estimate is short talloc
+		 *	falls back to the heap, so it doesn't need
+		 *	to be exact.
+		 */
+		(void) rbtree_walk(module_instance_name_tree, RBTREE_IN_ORDER, _module_thread_inst_size, &pool_size);
+		MEM(pool = talloc_pool(ctx, pool_size + ((instance_num + 1) * 128)));
+
+		MEM(module_thread_inst_array = talloc_zero_array(pool, module_thread_instance_t *, instance_num + 1));
 		talloc_set_destructor(module_thread_inst_array, _module_thread_inst_array_free);
+
+		pthread_mutex_lock(&module_thread_array_mutex);
+		MEM(module_thread_arrays = talloc_realloc(NULL, module_thread_arrays,
+							  module_thread_instance_t **,
+							  num_module_thread_arrays + 1));
+		module_thread_arrays[num_module_thread_arrays++] = module_thread_inst_array;
+		pthread_mutex_unlock(&module_thread_array_mutex);
 	}
 
 	if (rbtree_walk(module_instance_name_tree, RBTREE_IN_ORDER, _module_thread_instantiate,
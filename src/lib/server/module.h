@@ -61,6 +61,8 @@ extern size_t mod_rcode_table_len;
  */
 extern const char *section_type_value[MOD_COUNT];
 
+extern bool module_profile_enabled;
+
 #define RLM_TYPE_THREAD_SAFE	(0 << 0) 	//!< Module is threadsafe.
 #define RLM_TYPE_THREAD_UNSAFE	(1 << 0) 	//!< Module is not threadsafe.
 						//!< Server will protect calls
@@ -227,6 +229,11 @@ struct module_thread_instance_s {
 
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
+
+	uint64_t			profile_calls;	//!< calls recorded while profiling was enabled.
+	int64_t				profile_wall;	//!< cumulative wall clock nanoseconds in the module.
+	int64_t				profile_cpu;	//!< cumulative CPU (user + system) nanoseconds
+							///< in the module, from getrusage deltas.
 };
 
 /** Map string values to module state method
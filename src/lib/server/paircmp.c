@@ -281,6 +281,104 @@ static bool other_attr(fr_dict_attr_t const *da, fr_dict_attr_t const **from)
 	return false;
 }
 
+/*
+ *	Type specialized value comparison functions, resolved through
+ *	a flat table indexed by type.  This way evaluating a check
+ *	item doesn't pay for a type switch on every comparison.
+ */
+typedef int (*paircmp_value_t)(VALUE_PAIR const *vp, VALUE_PAIR const *check);
+
+static int cmp_octets(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	if (vp->vp_length != check->vp_length) return 1; /* NOT equal */
+
+	return memcmp(vp->vp_strvalue, check->vp_strvalue, vp->vp_length);
+}
+
+static int cmp_string(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return strcmp(vp->vp_strvalue, check->vp_strvalue);
+}
+
+static int cmp_uint8(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return vp->vp_uint8 - check->vp_uint8;
+}
+
+static int cmp_uint16(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return vp->vp_uint16 - check->vp_uint16;
+}
+
+static int cmp_uint32(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return (vp->vp_uint32 > check->vp_uint32) - (vp->vp_uint32 < check->vp_uint32);
+}
+
+static int cmp_uint64(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	/*
+	 *	Don't want integer overflow!
+	 */
+	return (vp->vp_uint64 > check->vp_uint64) - (vp->vp_uint64 < check->vp_uint64);
+}
+
+static int cmp_int32(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return (vp->vp_int32 > check->vp_int32) - (vp->vp_int32 < check->vp_int32);
+}
+
+static int cmp_date(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return (vp->vp_date > check->vp_date) - (vp->vp_date < check->vp_date);
+}
+
+static int cmp_ipv4addr(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	uint32_t a = ntohl(vp->vp_ipv4addr), b = ntohl(check->vp_ipv4addr);
+
+	return (a > b) - (a < b);
+}
+
+static int cmp_ipv6addr(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return memcmp(vp->vp_ip.addr.v6.s6_addr, check->vp_ip.addr.v6.s6_addr,
+		      sizeof(vp->vp_ip.addr.v6.s6_addr));
+}
+
+static int cmp_ip_prefix(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return memcmp(&vp->vp_ip, &check->vp_ip, sizeof(vp->vp_ip));
+}
+
+static int cmp_ifid(VALUE_PAIR const *vp, VALUE_PAIR const *check)
+{
+	return memcmp(vp->vp_ifid, check->vp_ifid, sizeof(vp->vp_ifid));
+}
+
+static paircmp_value_t const paircmp_value_func[FR_TYPE_MAX + 1] = {
+#ifdef WITH_ASCEND_BINARY
+	/*
+	 *	Ascend binary attributes can be treated
+	 *	as opaque objects, I guess...
+	 */
+	[FR_TYPE_ABINARY]	= cmp_octets,
+#endif
+	[FR_TYPE_OCTETS]	= cmp_octets,
+	[FR_TYPE_STRING]	= cmp_string,
+	[FR_TYPE_UINT8]		= cmp_uint8,
+	[FR_TYPE_UINT16]	= cmp_uint16,
+	[FR_TYPE_UINT32]	= cmp_uint32,
+	[FR_TYPE_UINT64]	= cmp_uint64,
+	[FR_TYPE_INT32]		= cmp_int32,
+	[FR_TYPE_DATE]		= cmp_date,
+	[FR_TYPE_IPV4_ADDR]	= cmp_ipv4addr,
+	[FR_TYPE_IPV6_ADDR]	= cmp_ipv6addr,
+	[FR_TYPE_IPV4_PREFIX]	= cmp_ip_prefix,
+	[FR_TYPE_IPV6_PREFIX]	= cmp_ip_prefix,
+	[FR_TYPE_IFID]		= cmp_ifid,
+};
+
 /** Compares check and vp by value.
  *
  * Does not call any per-attribute comparison function, but does honour
@@ -318,6 +416,7 @@ int paircmp_pairs(UNUSED REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 	if ((check->op == T_OP_REG_EQ) || (check->op == T_OP_REG_NE)) {
 		ssize_t		slen;
 		regex_t		*preg = NULL;
+		bool		cache_owned = false;
 		uint32_t	subcaptures;
 		fr_regmatch_t	*regmatch;
 
@@ -340,7 +439,7 @@ int paircmp_pairs(UNUSED REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 			REDEBUG("Error stringifying operand for regular expression");
 
 		regex_error:
-			talloc_free(preg);
+			if (!cache_owned) talloc_free(preg);
 			talloc_free(expr);
 			talloc_free(value);
 			return -2;
@@ -349,8 +448,8 @@ int paircmp_pairs(UNUSED REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 		/*
 		 *	Include substring matches.
 		 */
-		slen = regex_compile(request, &preg, expr_p, talloc_array_length(expr_p) - 1,
-				     NULL, true, true);
+		slen = regex_compile_cached(request, &preg, &cache_owned, expr_p,
+					    talloc_array_length(expr_p) - 1, NULL, true);
 		if (slen <= 0) {
 			REMARKER(expr_p, -slen, "%s", fr_strerror());
 
@@ -382,7 +481,7 @@ int paircmp_pairs(UNUSED REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 		}
 
 		talloc_free(regmatch);
-		talloc_free(preg);
+		if (!cache_owned) talloc_free(preg);
 		talloc_free(expr);
 		talloc_free(value);
 
@@ -410,87 +509,13 @@ int paircmp_pairs(UNUSED REQUEST *request, VALUE_PAIR *check, VALUE_PAIR *vp)
 	}
 
 	/*
-	 *	Not a regular expression, compare the types.
+	 *	Not a regular expression, compare the values.
 	 */
-	switch (check->vp_type) {
-#ifdef WITH_ASCEND_BINARY
-		/*
-		 *	Ascend binary attributes can be treated
-		 *	as opaque objects, I guess...
-		 */
-		case FR_TYPE_ABINARY:
-#endif
-		case FR_TYPE_OCTETS:
-			if (vp->vp_length != check->vp_length) {
-				ret = 1; /* NOT equal */
-				break;
-			}
-			ret = memcmp(vp->vp_strvalue, check->vp_strvalue, vp->vp_length);
-			break;
-
-		case FR_TYPE_STRING:
-			ret = strcmp(vp->vp_strvalue, check->vp_strvalue);
-			break;
-
-		case FR_TYPE_UINT8:
-			ret = vp->vp_uint8 - check->vp_uint8;
-			break;
-
-		case FR_TYPE_UINT16:
-			ret = vp->vp_uint16 - check->vp_uint16;
-			break;
-
-		case FR_TYPE_UINT32:
-			ret = vp->vp_uint32 - check->vp_uint32;
-			break;
-
-		case FR_TYPE_UINT64:
-			/*
-			 *	Don't want integer overflow!
-			 */
-			if (vp->vp_uint64 < check->vp_uint64) {
-				ret = -1;
-			} else if (vp->vp_uint64 > check->vp_uint64) {
-				ret = +1;
-			} else {
-				ret = 0;
-			}
-			break;
+	{
+		paircmp_value_t func;
 
-		case FR_TYPE_INT32:
-			if (vp->vp_int32 < check->vp_int32) {
-				ret = -1;
-			} else if (vp->vp_int32 > check->vp_int32) {
-				ret = +1;
-			} else {
-				ret = 0;
-			}
-			break;
-
-		case FR_TYPE_DATE:
-			ret = vp->vp_date - check->vp_date;
-			break;
-
-		case FR_TYPE_IPV4_ADDR:
-			ret = ntohl(vp->vp_ipv4addr) - ntohl(check->vp_ipv4addr);
-			break;
-
-		case FR_TYPE_IPV6_ADDR:
-			ret = memcmp(vp->vp_ip.addr.v6.s6_addr, check->vp_ip.addr.v6.s6_addr,
-				     sizeof(vp->vp_ip.addr.v6.s6_addr));
-			break;
-
-		case FR_TYPE_IPV4_PREFIX:
-		case FR_TYPE_IPV6_PREFIX:
-			ret = memcmp(&vp->vp_ip, &check->vp_ip, sizeof(vp->vp_ip));
-			break;
-
-		case FR_TYPE_IFID:
-			ret = memcmp(vp->vp_ifid, check->vp_ifid, sizeof(vp->vp_ifid));
-			break;
-
-		default:
-			break;
+		func = paircmp_value_func[check->vp_type];
+		if (func) ret = func(vp, check);
 	}
 
 finish:
@@ -566,6 +591,7 @@ int paircmp(REQUEST *request,
 	VALUE_PAIR		*check_item;
 	VALUE_PAIR		*auth_item;
 	fr_dict_attr_t const	*from;
+	fr_pair_index_t		*idx = NULL;
 
 	int			result = 0;
 	int			compare;
@@ -619,6 +645,18 @@ int paircmp(REQUEST *request,
 
 		auth_item = request_list;
 
+		/*
+		 *	We do one request list lookup per check item,
+		 *	so index the list on first use instead of
+		 *	walking it from the head every time.  The
+		 *	comparison functions don't modify the request
+		 *	list, so the snapshot stays valid.
+		 */
+		if (!first_only && from) {
+			if (!idx) idx = fr_pair_index_build(request, request_list);
+			if (idx) auth_item = fr_pair_index_find(idx, from, TAG_ANY);
+		}
+
 	try_again:
 		if (!first_only) {
 			while (auth_item != NULL) {
@@ -639,6 +677,7 @@ int paircmp(REQUEST *request,
 			if (check_item->op == T_OP_CMP_FALSE) {
 				continue;
 			} else {
+				talloc_free(idx);
 				return -1;
 			}
 		}
@@ -647,7 +686,10 @@ int paircmp(REQUEST *request,
 		 *	Else we found it, but we were trying to not
 		 *	find it, so we failed.
 		 */
-		if (check_item->op == T_OP_CMP_FALSE) return -1;
+		if (check_item->op == T_OP_CMP_FALSE) {
+			talloc_free(idx);
+			return -1;
+		}
 
 		/*
 		 *	We've got to xlat the string before doing
@@ -711,6 +753,8 @@ int paircmp(REQUEST *request,
 
 	} /* for every entry in the check item list */
 
+	talloc_free(idx);
+
 	return result;
 }
 
@@ -34,6 +34,53 @@ RCSID("$Id$")
 
 #include <ctype.h>
 
+/** Index entry for the "to" list, ordered by attribute
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< da of the pair at this position.
+	int			idx;		//!< position of the pair in the "to" array.
+} pairmove_idx_t;
+
+static int pairmove_idx_cmp(void const *one, void const *two)
+{
+	pairmove_idx_t const *a = one, *b = two;
+
+	if (a->da < b->da) return -1;
+	if (a->da > b->da) return +1;
+
+	/*
+	 *	Preserve list order between pairs of the same
+	 *	attribute, so "first instance" semantics hold.
+	 */
+	return (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+/** Find the first index entry for an attribute
+ *
+ * @param[in] idx	index array, sorted by da.
+ * @param[in] count	number of entries in the index.
+ * @param[in] da	to search for.
+ * @return the position of the first entry with a da >= the one requested.
+ *	The caller must check whether the da at that position matches.
+ */
+static int pairmove_idx_find(pairmove_idx_t const *idx, int count, fr_dict_attr_t const *da)
+{
+	int lo = 0, hi = count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (idx[mid].da < da) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
 /*
  *	The fr_pair_list_move() function in src/lib/valuepair.c does all sorts of
  *	extra magic that we don't want here.
@@ -44,7 +91,8 @@ RCSID("$Id$")
  */
 void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool do_xlat)
 {
-	int		i, j, count, from_count, to_count, tailto;
+	int		i, j, jj, count, from_count, to_count, tailto;
+	pairmove_idx_t	*to_idx;
 	fr_cursor_t	cursor;
 	VALUE_PAIR	*vp, *next, **last;
 	VALUE_PAIR	**from_list, **to_list;
@@ -106,6 +154,20 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 	tailto = to_count;
 	edited = talloc_zero_array(request, bool, to_count);
 
+	/*
+	 *	Build an index of the "to" list ordered by da, so that
+	 *	each "from" pair only examines the pairs it can match,
+	 *	instead of rescanning the whole "to" list.  Attributes
+	 *	are only ever replaced by pairs of the same da, so the
+	 *	index stays valid while entries are edited or deleted.
+	 */
+	to_idx = talloc_array(request, pairmove_idx_t, to_count);
+	for (j = 0; j < to_count; j++) {
+		to_idx[j].da = to_list[j]->da;
+		to_idx[j].idx = j;
+	}
+	qsort(to_idx, to_count, sizeof(*to_idx), pairmove_idx_cmp);
+
 	RDEBUG4("::: FROM %d TO %d MAX %d", from_count, to_count, count);
 
 	/*
@@ -127,15 +189,17 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 		if (from_list[i]->op == T_OP_ADD) goto do_append;
 
 		found = false;
-		for (j = 0; j < to_count; j++) {
-			if (edited[j] || !to_list[j] || !from_list[i]) continue;
+		for (jj = pairmove_idx_find(to_idx, to_count, from_list[i]->da);
+		     jj < to_count; jj++) {
+			if (!from_list[i]) break;
 
 			/*
-			 *	Attributes aren't the same, skip them.
+			 *	We've run out of attributes which match.
 			 */
-			if (from_list[i]->da != to_list[j]->da) {
-				continue;
-			}
+			if (to_idx[jj].da != from_list[i]->da) break;
+
+			j = to_idx[jj].idx;
+			if (edited[j] || !to_list[j]) continue;
 
 			/*
 			 *	We don't use a "switch" statement here
@@ -322,6 +386,7 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 
 	rad_assert(request->packet != NULL);
 
+	talloc_free(to_idx);
 	talloc_free(to_list);
 	talloc_free(edited);
 }
@@ -32,12 +32,15 @@ RCSID("$Id$")
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/rad_assert.h>
 
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include <time.h>
 
 typedef struct fr_pool_connection_s fr_pool_connection_t;
+typedef struct fr_pool_thread_cache_s fr_pool_thread_cache_t;
 
 static int connection_check(fr_pool_t *pool, REQUEST *request);
 
@@ -110,6 +113,13 @@ struct fr_pool_s {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	bool		cache_per_thread;	//!< If true each thread keeps the connection it last
+						//!< released, and reuses it on its next checkout
+						//!< without taking the mutex.
+
+	fr_dlist_head_t	thread_caches;		//!< All the per-thread caches referencing this pool,
+						//!< so they can be invalidated when the pool is freed.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
 
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
@@ -163,9 +173,99 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIME_DELTA, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_TIME_DELTA, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("cache_per_thread", FR_TYPE_BOOL, fr_pool_t, cache_per_thread), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
+/** Per-thread cache of the connection a thread last released
+ *
+ * While a connection is stashed here it remains linked in the pool's
+ * connection list and marked in_use, so pool wide reconnects still
+ * reach it, and the cleanup code leaves it alone, but the owning
+ * thread can reserve it again without taking the pool mutex.
+ */
+struct fr_pool_thread_cache_s {
+	fr_pool_t		*pool;		//!< Pool this cache belongs to.  NULL if the pool was freed.
+	fr_dlist_t		entry;		//!< Entry in the pool's list of thread caches.
+
+	fr_pool_connection_t	*stashed;	//!< Idle connection reserved for this thread.
+	fr_pool_connection_t	*held;		//!< Connection this thread most recently reserved,
+						//!< so releasing it can skip the list search.
+
+	fr_pool_thread_cache_t	*next;		//!< Next cache (for a different pool) owned by this thread.
+};
+
+fr_thread_local_setup(fr_pool_thread_cache_t *, pool_thread_caches) /* macro */
+
+/** Return any stashed connections to their pools when a thread exits
+ *
+ */
+static void _pool_thread_caches_free(void *arg)
+{
+	fr_pool_thread_cache_t *cache = arg, *next;
+
+	for (; cache; cache = next) {
+		next = cache->next;
+
+		if (cache->pool) {
+			fr_pool_t *pool = cache->pool;
+
+			pthread_mutex_lock(&pool->mutex);
+			if (cache->stashed) {
+				fr_pool_connection_t *this = cache->stashed;
+
+				this->in_use = false;
+				rad_assert(pool->state.active != 0);
+				pool->state.active--;
+				fr_heap_insert(pool->heap, this);
+			}
+			fr_dlist_remove(&pool->thread_caches, cache);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+
+		talloc_free(cache);
+	}
+
+	pool_thread_caches = NULL;
+}
+
+/** Find (or create) this thread's cache for a pool
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to find the cache for.
+ * @param[in] create	whether to create a cache if the thread doesn't have one.
+ * @return
+ *	- This thread's cache for the pool.
+ *	- NULL if it doesn't have one (or creation failed).
+ */
+static fr_pool_thread_cache_t *pool_thread_cache_find(fr_pool_t *pool, bool create)
+{
+	fr_pool_thread_cache_t *cache;
+
+	for (cache = pool_thread_caches; cache; cache = cache->next) {
+		if (cache->pool == pool) return cache;
+	}
+
+	if (!create) return NULL;
+
+	cache = talloc_zero(NULL, fr_pool_thread_cache_t);
+	if (!cache) return NULL;
+
+	cache->pool = pool;
+	fr_dlist_entry_init(&cache->entry);
+
+	pthread_mutex_lock(&pool->mutex);
+	fr_dlist_insert_tail(&pool->thread_caches, cache);
+	pthread_mutex_unlock(&pool->mutex);
+
+	cache->next = pool_thread_caches;
+	pool_thread_caches = cache;
+	fr_thread_local_set_destructor(pool_thread_caches, _pool_thread_caches_free, pool_thread_caches);
+
+	return cache;
+}
+
 /** Order connections by reserved most recently
  */
 static int8_t last_reserved_cmp(void const *one, void const *two)
@@ -804,11 +904,56 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 {
 	fr_time_t now;
 	fr_pool_connection_t *this;
+	fr_pool_thread_cache_t *cache = NULL;
 
 	if (!pool) return NULL;
 
+	/*
+	 *	Fast path.  If this thread stashed a connection when it
+	 *	last released one, reserve it again without touching the
+	 *	mutex, the heap, or any other shared state.
+	 */
+	if (pool->cache_per_thread) {
+		cache = pool_thread_cache_find(pool, false);
+		if (cache && cache->stashed) {
+			this = cache->stashed;
+			now = fr_time();
+
+			if (!this->needs_reconnecting &&
+			    !((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) &&
+			    !((pool->lifetime > 0) && ((this->created + pool->lifetime) < now))) {
+				cache->stashed = NULL;
+				cache->held = this;
+
+				this->num_uses++;
+				this->last_reserved = now;
+#ifdef PTHREAD_DEBUG
+				this->pthread_id = pthread_self();
+#endif
+				ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ") from thread cache",
+					  this->number);
+
+				return this->connection;
+			}
+
+			/*
+			 *	The stashed connection hit one of its
+			 *	limits.  Return it to the pool proper,
+			 *	and let the normal path below close it.
+			 */
+			pthread_mutex_lock(&pool->mutex);
+			cache->stashed = NULL;
+			this->in_use = false;
+			rad_assert(pool->state.active != 0);
+			pool->state.active--;
+			fr_heap_insert(pool->heap, this);
+			goto locked;
+		}
+	}
+
 	pthread_mutex_lock(&pool->mutex);
 
+locked:
 	now = fr_time();
 
 	/*
@@ -878,6 +1023,15 @@ do_return:
 #endif
 	pthread_mutex_unlock(&pool->mutex);
 
+	/*
+	 *	Remember which connection this thread reserved, so
+	 *	releasing it can skip the O(n) search for the handle.
+	 */
+	if (pool->cache_per_thread) {
+		cache = pool_thread_cache_find(pool, true);
+		if (cache) cache->held = this;
+	}
+
 	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
 
 	return this->connection;
@@ -1018,6 +1172,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	pthread_mutex_init(&pool->mutex, NULL);
 	pthread_cond_init(&pool->done_spawn, NULL);
 	pthread_cond_init(&pool->done_reconnecting, NULL);
+	fr_dlist_init(&pool->thread_caches, fr_pool_thread_cache_t, entry);
 
 	DEBUG2("Initialising connection pool");
 
@@ -1082,27 +1237,93 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	return pool;
 }
 
+/** Thread worker for spawning one initial connection
+ *
+ * @param[in] arg	the pool.
+ * @return the new connection, or NULL on failure.
+ */
+static void *_pool_spawn_initial(void *arg)
+{
+	fr_pool_t *pool = arg;
+
+	return connection_spawn(pool, NULL, time(NULL), false, true);
+}
+
+/*
+ *	How many initial connections we open concurrently.  Each one
+ *	can be a network round trip (or a full TLS handshake), and
+ *	they all block start up.
+ */
+#define POOL_START_PARALLEL (8)
+
 int fr_pool_start(fr_pool_t *pool)
 {
 	uint32_t		i;
 	fr_pool_connection_t 	*this;
 
+	/*
+	 *	Don't bother with threads for a single connection.
+	 */
+	if (pool->start == 1) {
+		this = connection_spawn(pool, NULL, time(NULL), false, true);
+		if (!this) {
+			ERROR("Failed spawning initial connections");
+			return -1;
+		}
+
+		goto done;
+	}
+
 	/*
 	 *	Create all of the connections, unless the admin says
 	 *	not to.
+	 *
+	 *	Opening a connection is usually dominated by waiting
+	 *	on the back-end, so we open them a batch at a time.
+	 *	connection_spawn() is safe to call concurrently, it's
+	 *	what the worker threads do at run time.
 	 */
-	for (i = 0; i < pool->start; i++) {
+	for (i = 0; i < pool->start; ) {
+		pthread_t	spawn_thread[POOL_START_PARALLEL];
+		uint32_t	batch, j;
+		bool		failed = false;
+
+		batch = pool->start - i;
+		if (batch > POOL_START_PARALLEL) batch = POOL_START_PARALLEL;
+
+		for (j = 0; j < batch; j++) {
+			if (pthread_create(&spawn_thread[j], NULL, _pool_spawn_initial, pool) != 0) break;
+		}
+
 		/*
-		 *	Call time() once for each spawn attempt as there
-		 *	could be a significant delay.
+		 *	Couldn't create a thread.  Spawn the remainder
+		 *	of this batch from this thread, one at a time.
 		 */
-		this = connection_spawn(pool, NULL, time(NULL), false, true);
-		if (!this) {
+		if (j < batch) {
+			uint32_t serial;
+
+			for (serial = j; serial < batch; serial++) {
+				if (!connection_spawn(pool, NULL, time(NULL), false, true)) failed = true;
+			}
+		}
+
+		while (j > 0) {
+			void *ret;
+
+			j--;
+			pthread_join(spawn_thread[j], &ret);
+			if (!ret) failed = true;
+		}
+
+		if (failed) {
 			ERROR("Failed spawning initial connections");
 			return -1;
 		}
+
+		i += batch;
 	}
 
+done:
 	fr_pool_trigger_exec(pool, NULL, "start");
 
 	return 0;
@@ -1309,6 +1530,32 @@ void fr_pool_free(fr_pool_t *pool)
 
 	pthread_mutex_lock(&pool->mutex);
 
+	/*
+	 *	Invalidate any per-thread caches referencing this pool,
+	 *	and return their stashed connections to the pool proper,
+	 *	so they're closed below with correct accounting.
+	 */
+	{
+		fr_pool_thread_cache_t *cache;
+
+		while ((cache = fr_dlist_head(&pool->thread_caches)) != NULL) {
+			fr_dlist_remove(&pool->thread_caches, cache);
+
+			if (cache->stashed) {
+				fr_pool_connection_t *stashed = cache->stashed;
+
+				stashed->in_use = false;
+				rad_assert(pool->state.active != 0);
+				pool->state.active--;
+				fr_heap_insert(pool->heap, stashed);
+			}
+
+			cache->pool = NULL;
+			cache->stashed = NULL;
+			cache->held = NULL;
+		}
+	}
+
 	/*
 	 *	Don't loop over the list.  Just keep removing the head
 	 *	until they're all gone.
@@ -1372,11 +1619,36 @@ void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 	fr_pool_connection_t	*this;
 	fr_time_delta_t		held;
 	bool			trigger_min = false, trigger_max = false;
+	bool			stash = false;
+	fr_pool_thread_cache_t	*cache = NULL;
 
-	this = connection_find(pool, conn);
-	if (!this) return;
+	/*
+	 *	Fast path.  Stash the connection for this thread's next
+	 *	checkout instead of returning it to the heap.  The mutex
+	 *	is still taken briefly below to keep the fr_pool_state_t
+	 *	accounting consistent, but we skip the O(n) search for
+	 *	the handle, the heap insert, and the idle checks.
+	 */
+	if (pool->cache_per_thread) {
+		cache = pool_thread_cache_find(pool, true);
+		if (cache && !cache->stashed && cache->held &&
+		    (cache->held->connection == conn) && !cache->held->needs_reconnecting) {
+			this = cache->held;
+			cache->held = NULL;
+			stash = true;
+
+			pthread_mutex_lock(&pool->mutex);
+		}
+	}
+
+	if (!stash) {
+		if (cache && cache->held && (cache->held->connection == conn)) cache->held = NULL;
+
+		this = connection_find(pool, conn);	/* Returns with the mutex held */
+		if (!this) return;
 
-	this->in_use = false;
+		this->in_use = false;
+	}
 
 	/*
 	 *	Record when the connection was last released
@@ -1411,6 +1683,19 @@ void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 
 	fr_stats_bins(&pool->state.held_stats, this->last_reserved, this->last_released);
 
+	/*
+	 *	A stashed connection stays marked in_use, and counted
+	 *	as active, so the cleanup code leaves it alone until
+	 *	this thread reserves it again.
+	 */
+	if (stash) {
+		cache->stashed = this;
+		pthread_mutex_unlock(&pool->mutex);
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ") to thread cache", this->number);
+		goto done;
+	}
+
 	/*
 	 *	Insert the connection in the heap.
 	 *
@@ -1433,6 +1718,7 @@ void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 	 */
 	connection_check(pool, request);
 
+done:
 	if (trigger_min) fr_pool_trigger_exec(pool, request, "min");
 	if (trigger_max) fr_pool_trigger_exec(pool, request, "max");
 }
@@ -1468,6 +1754,17 @@ void *fr_pool_connection_reconnect(fr_pool_t *pool, REQUEST *request, void *conn
 
 	if (!pool || !conn) return NULL;
 
+	/*
+	 *	The connection is about to be freed, so forget it was
+	 *	the one this thread most recently reserved.
+	 */
+	if (pool->cache_per_thread) {
+		fr_pool_thread_cache_t *cache;
+
+		cache = pool_thread_cache_find(pool, false);
+		if (cache && cache->held && (cache->held->connection == conn)) cache->held = NULL;
+	}
+
 	/*
 	 *	If connection_find is successful the pool is now locked
 	 */
@@ -1503,6 +1800,17 @@ int fr_pool_connection_close(fr_pool_t *pool, REQUEST *request, void *conn)
 {
 	fr_pool_connection_t *this;
 
+	/*
+	 *	The connection is about to be freed, so forget it was
+	 *	the one this thread most recently reserved.
+	 */
+	if (pool->cache_per_thread) {
+		fr_pool_thread_cache_t *cache;
+
+		cache = pool_thread_cache_find(pool, false);
+		if (cache && cache->held && (cache->held->connection == conn)) cache->held = NULL;
+	}
+
 	this = connection_find(pool, conn);
 	if (!this) return 0;
 
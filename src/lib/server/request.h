@@ -81,28 +81,66 @@ typedef	void (*fr_request_process_t)(REQUEST *, fr_state_signal_t);	//!< Functio
 typedef	rlm_rcode_t (*RAD_REQUEST_FUNP)(REQUEST *);
 
 struct rad_request {
+	/*
+	 *	The fields below are the ones touched on every
+	 *	interpreter step, and are deliberately packed into the
+	 *	first two cache lines of the structure.  Think before
+	 *	adding a field here, and before moving one out.
+	 */
 #ifndef NDEBUG
 	uint32_t		magic; 		//!< Magic number used to detect memory corruption,
 						//!< or request structs that have not been properly initialised.
 #endif
-	uint64_t		number; 	//!< Monotonically increasing request number. Reset on server restart.
-	uint64_t		child_number; 	//!< Monotonically increasing number for children of this request
-	char const		*name;		//!< for debug printing, as (%d) is no longer sufficient
+	fr_request_state_t	request_state;	//!< state for the various protocol handlers.
+
+	void			*stack;		//!< unlang interpreter stack.
+
+	RADIUS_PACKET		*packet;	//!< Incoming request.
+	RADIUS_PACKET		*reply;		//!< Outgoing response.
+
+	rlm_rcode_t		rcode;		//!< Last rcode returned by a module
+	rad_master_state_t	master_state;	//!< Set by the master thread to signal the child that's currently
+						//!< working with the request, to do something.
+
+	fr_async_t		*async;		//!< for new async listeners
 
 	fr_dict_t const		*dict;		//!< Dictionary of the protocol that this request belongs to.
 
 	fr_event_list_t		*el;		//!< thread-specific event list.
-	fr_heap_t		*backlog;	//!< thread-specific backlog
-	fr_request_state_t	request_state;	//!< state for the various protocol handlers.
+	fr_heap4_t		*backlog;	//!< thread-specific backlog
+
+	REQUEST			*parent;
+
+	struct {
+		log_dst_t	*dst;		//!< First in a list of log destinations.
+
+		fr_log_lvl_t	lvl;		//!< Log messages with lvl >= to this should be logged.
+
+		uint8_t		unlang_indent;	//!< By how much to indent log messages. uin8_t so it's obvious
+						//!< when a request has been exdented too much.
+		uint8_t		module_indent;	//!< Indentation after the module prefix name.
+	} log;
+
+	uint64_t		number; 	//!< Monotonically increasing request number. Reset on server restart.
+
+	int32_t			runnable_id;	//!< entry in the queue / heap of runnable packets
+	int32_t			time_order_id;	//!< entry in the queue / heap of time ordered packets
+
+	char const		*component; 	//!< Section the request is in.
+	char const		*module;	//!< Module the request is currently being processed by.
+
+	/*
+	 *	The remaining fields are cold: read a handful of times
+	 *	per request, or only when debugging.
+	 */
+	uint64_t		child_number; 	//!< Monotonically increasing number for children of this request
+	char const		*name;		//!< for debug printing, as (%d) is no longer sufficient
 
 	fr_dlist_head_t		data;		//!< Request metadata.
 
 	rad_listen_t		*listener;	//!< The listener that received the request.
 	RADCLIENT		*client;	//!< The client that originally sent us the request.
 
-	RADIUS_PACKET		*packet;	//!< Incoming request.
-	RADIUS_PACKET		*reply;		//!< Outgoing response.
-
 	VALUE_PAIR		*control;	//!< #VALUE_PAIR (s) used to set per request parameters
 						//!< for modules and the server core at runtime.
 
@@ -113,43 +151,19 @@ struct rad_request {
 						//!< attempt. Useful where the attempt involves a sequence of
 						//!< many request/challenge packets, like OTP, and EAP.
 
-	rad_master_state_t	master_state;	//!< Set by the master thread to signal the child that's currently
-						//!< working with the request, to do something.
-
 	REQUEST			*proxy;		//!< proxied packet
 
 	fr_request_process_t	process;	//!< The function to call to move the request through the state machine.
 
-	rlm_rcode_t		rcode;		//!< Last rcode returned by a module
 	CONF_SECTION		*server_cs;	//!< virtual server which is processing the request.
 
-	char const		*component; 	//!< Section the request is in.
-	char const		*module;	//!< Module the request is currently being processed by.
-
-	void			*stack;		//!< unlang interpreter stack.
-
-	REQUEST			*parent;
-
 	fr_event_timer_t const	*ev;		//!< Event in event loop tied to this request.
 
-	int32_t			runnable_id;	//!< entry in the queue / heap of runnable packets
-	int32_t			time_order_id;	//!< entry in the queue / heap of time ordered packets
+	fr_dlist_t		free_entry;	//!< entry in a worker's list of recycled requests
 
 	main_config_t const	*config;	//!< Pointer to the main config hack to try and deal with hup.
 
-	struct {
-		log_dst_t	*dst;		//!< First in a list of log destinations.
-
-		fr_log_lvl_t	lvl;		//!< Log messages with lvl >= to this should be logged.
-
-		uint8_t		unlang_indent;	//!< By how much to indent log messages. uin8_t so it's obvious
-						//!< when a request has been exdented too much.
-		uint8_t		module_indent;	//!< Indentation after the module prefix name.
-	} log;
-
 	uint32_t		options;	//!< mainly for proxying EAP-MSCHAPv2.
-
-	fr_async_t		*async;		//!< for new async listeners
 };				/* REQUEST typedef */
 
 #ifdef WITH_VERIFY_PTR
@@ -175,6 +189,10 @@ struct rad_request {
 
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
 
+REQUEST		*request_alloc_pooled(TALLOC_CTX *ctx, size_t pool_size);
+
+REQUEST		*request_reset(REQUEST *request);
+
 REQUEST		*request_alloc_fake(REQUEST *parent, fr_dict_t const *namespace);
 
 REQUEST		*request_alloc_detachable(REQUEST *request, fr_dict_t const *namespace);
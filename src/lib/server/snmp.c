@@ -973,7 +973,7 @@ int fr_snmp_process(REQUEST *request)
 			switch (vp->vp_type) {
 			case FR_TYPE_OCTETS:
 			case FR_TYPE_STRING:
-				talloc_free(vp->data.datum.ptr);
+				if (!fr_value_box_is_inline(&vp->data)) talloc_free(vp->data.datum.ptr);
 
 			/* FALL-THROUGH */
 			default:
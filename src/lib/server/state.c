@@ -53,7 +53,9 @@ RCSID("$Id$")
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/sha1.h>
 
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
@@ -112,18 +114,62 @@ typedef struct {
 	REQUEST			*thawed;			//!< The request that thawed this entry.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
-	uint64_t		id;				//!< Next ID to assign.
+/** A single shard of the state tree
+ *
+ * The tree is split into shards by hashing the state value, so that
+ * concurrent EAP conversations contend for one of #STATE_NUM_SHARDS
+ * mutexes, instead of serialising on a single mutex over one tree.
+ */
+typedef struct {
+	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
+	uint64_t		id;				//!< Number of entries created in this shard.
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+} fr_state_shard_t;
+
+/** Number of shards the state tree is split into
+ *
+ * Must be a power of two.
+ */
+#define STATE_NUM_SHARDS	(32)
+
+/** Magic octet identifying a stateless State value
+ *
+ * Cannot collide with tree based state values, as those are always
+ * exactly sizeof(struct state_comp) octets long, and stateless blobs
+ * are always longer than that.
+ */
+#define STATE_BLOB_MAGIC	(0xf4)
+
+/** Length of the stateless blob header (magic octet + expiry time)
+ *
+ */
+#define STATE_BLOB_HEADER_LEN	(1 + 4)
+
+/** Maximum length of a State attribute value on the wire
+ *
+ */
+#define STATE_BLOB_MAX_LEN	(253)
+
+struct fr_state_tree_t {
+	fr_state_shard_t	shard[STATE_NUM_SHARDS];	//!< Shards, indexed by hash of the state value.
+
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
 	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+
+	bool			stateless;			//!< Whether we emit self-authenticating State values
+								//!< instead of tracking sessions in the tree, where
+								//!< the session data allows it.
+
+	uint8_t			key[16];			//!< Random per boot key used to authenticate
+								//!< stateless State values.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
@@ -133,7 +179,7 @@ struct fr_state_tree_t {
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -145,27 +191,40 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard a state value hashes to
+ *
+ */
+static fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shard[fr_hash_fast(entry->state, sizeof(entry->state)) & (STATE_NUM_SHARDS - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	size_t			i;
+	fr_state_entry_t	*entry;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < STATE_NUM_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -175,6 +234,9 @@ static int _state_tree_free(fr_state_tree_t *state)
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
  * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] stateless		Whether to emit self-authenticating State values
+ *				instead of tracking sessions in the tree, where
+ *				the session data allows it.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -182,16 +244,33 @@ static int _state_tree_free(fr_state_tree_t *state)
  *	- A new state tree.
  *	- NULL on failure.
  */
-fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
+fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe, bool stateless,
 				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
 {
 	fr_state_tree_t *state;
+	size_t		i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
+	state->stateless = stateless;
+
+	/*
+	 *	The key is random per boot, so restarting the server
+	 *	invalidates any outstanding stateless State values,
+	 *	the same way it'd lose the contents of the tree.
+	 */
+	if (stateless) {
+		uint32_t x;
+
+		for (i = 0; i < sizeof(state->key) / sizeof(x); i++) {
+			x = fr_rand();
+			memcpy(state->key + (i * 4), &x, sizeof(x));
+		}
+	}
 
 	/*
 	 *	Create a break in the contexts.
@@ -202,29 +281,32 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
+	for (i = 0; i < STATE_NUM_SHARDS; i++) {
+		if (thread_safe && (pthread_mutex_init(&state->shard[i].mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+		fr_dlist_talloc_init(&state->shard[i].to_expire, fr_state_entry_t, list);
+	}
+	talloc_set_destructor(state, _state_tree_free);
 
 	/*
 	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	rbtrees, so that all the state entries
+	 *	are freed before they're destroyed.  Hence
+	 *	them being parented from the NULL ctx.
 	 */
-	state->tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+	for (i = 0; i < STATE_NUM_SHARDS; i++) {
+		state->shard[i].tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
+		if (!state->shard[i].tree) {
+			talloc_free(state);
+			return NULL;
+		}
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
@@ -232,16 +314,16 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 /** Unlink an entry and remove if from the tree
  *
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
 
-	rbtree_deletebydata(state->tree, entry);
+	rbtree_deletebydata(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -286,117 +368,41 @@ static int _state_entry_free(fr_state_entry_t *entry)
 
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * Derives the new state value, then inserts the entry into whichever
+ * shard that value hashes to, cleaning up that shard's expired
+ * entries along the way.
+ *
+ * @note On success, returns with the shard's mutex held, and writes
+ *	the shard to shard_out, so the caller can fill in the entry
+ *	before it becomes visible to other threads.  On failure no
+ *	mutexes are held.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet,
+					    uint8_t const *old_state, int old_tries,
+					    fr_state_shard_t **shard_out)
 {
 	size_t			i;
 	uint32_t		x;
 	time_t			now = time(NULL);
 	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry, *expired, *next;
+	fr_state_shard_t	*shard;
 
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
 	uint64_t		timed_out = 0;
 	bool			too_many = false;
 	fr_dlist_head_t		to_free;
 
 	fr_dlist_init(&to_free, fr_state_entry_t, list);
 
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
-		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
-
-	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
-	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
-	 */
-	if (old) {
-		old_tries = old->tries;
-
-		memcpy(old_state, old->state, sizeof(old_state));
-
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (fr_dlist_empty(&old->data)) {
-			state_entry_unlink(state, old);
-			fr_dlist_insert_tail(&to_free, old);
-		}
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
-
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -445,7 +451,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		 *	16 octets of randomness should be enough to
 		 *	have a globally unique state.
 		 */
-		if (old) {
+		if (old_state) {
 			memcpy(entry->state, old_state, sizeof(entry->state));
 			entry->tries = old_tries + 1;
 		/*
@@ -480,11 +486,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		fr_pair_add(&packet->vps, vp);
 	}
 
-	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
-	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
-
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -493,82 +494,356 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
+	shard = state_shard(state, entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	/*
+	 *	Clean up old entries.
+	 */
+	for (expired = fr_dlist_head(&shard->to_expire);
+	     expired != NULL;
+	     expired = next) {
+		(void)talloc_get_type_abort(expired, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, expired);	/* Advance *before* potential unlinking */
+
+		/*
+		 *	Too old, we can delete it.
+		 */
+		if (expired->cleanup < now) {
+			state_entry_unlink(shard, expired);
+			fr_dlist_insert_tail(&to_free, expired);
+			timed_out++;
+			continue;
+		}
+
+		break;
+	}
+
+	shard->timed_out += timed_out;
+
+	/*
+	 *	The session limit is approximate, as the other shards'
+	 *	counts are read without their mutexes held.
+	 */
+	if (!old_state && (fr_state_entries_tracked(state) >= state->max_sessions)) too_many = true;
+
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	/*
+	 *	Now free the unlinked entries.
+	 *
+	 *	We do it here as freeing may involve significantly more
+	 *	work than just freeing the data.
+	 *
+	 *	If there's request data that was persisted it will now
+	 *	be freed also, and it may have complex destructors associated
+	 *	with it.
+	 */
+	while ((expired = fr_dlist_head(&to_free)) != NULL) {
+		fr_dlist_remove(&to_free, expired);
+		talloc_free(expired);
+	}
+
+	if (too_many) {
+		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+		       state->max_sessions);
+	error:
 		fr_pair_delete_by_da(&packet->vps, state->da);
 		talloc_free(entry);
 		return NULL;
 	}
 
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	entry->id = (shard->id++ * STATE_NUM_SHARDS) | (uint64_t)(shard - state->shard);
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		goto error;
+	}
+
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+
+	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
+	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
+
+	*shard_out = shard;
 
 	return entry;
 }
 
-/** Find the entry, based on the State attribute
+/** Fill in the lookup key for a state entry, based on the State attribute
  *
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb)
+static void state_value_normalise(fr_state_entry_t *my_entry, REQUEST *request, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
-
 	/*
 	 *	Assume our own State first.
 	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
+	if (vb->vb_length == sizeof(my_entry->state)) {
+		memcpy(my_entry->state, vb->vb_octets, sizeof(my_entry->state));
 
 		/*
 		 *	Too big?  Get the MD5 hash, in order
 		 *	to depend on the entire contents of State.
 		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	} else if (vb->vb_length > sizeof(my_entry->state)) {
+		fr_md5_calc(my_entry->state, vb->vb_octets, vb->vb_length);
 
 		/*
 		 *	Too small?  Use the whole thing, and
 		 *	set the rest of my_entry.state to zero.
 		 */
 	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
+		memcpy(my_entry->state, vb->vb_octets, vb->vb_length);
+		memset(&my_entry->state[vb->vb_length], 0, sizeof(my_entry->state) - vb->vb_length);
 	}
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+	my_entry->state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+}
+
+/** Find the entry in a shard, based on the normalised State value
+ *
+ * @note Called with the shard's mutex held.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t const *my_entry)
+{
+	fr_state_entry_t *entry;
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	entry = rbtree_finddata(shard->tree, my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
 	return entry;
 }
 
+/** Compute the HMAC protecting a stateless State value
+ *
+ * The virtual server's hash is appended to the tree's key, so one
+ * virtual server can't act on a State value generated by another.
+ * This mirrors what the server_hash field does for tree based values.
+ */
+static void state_blob_sign(uint8_t digest[static SHA1_DIGEST_LENGTH], fr_state_tree_t *state, REQUEST *request,
+			    uint8_t const *blob, size_t blob_len)
+{
+	uint8_t		key[sizeof(state->key) + sizeof(uint32_t)];
+	uint32_t	server_hash;
+
+	server_hash = fr_hash_string(cf_section_name2(request->server_cs));
+
+	memcpy(key, state->key, sizeof(state->key));
+	memcpy(key + sizeof(state->key), &server_hash, sizeof(server_hash));
+
+	fr_hmac_sha1(digest, blob, blob_len, key, sizeof(key));
+}
+
+/** Verify the header and HMAC of a stateless State value
+ *
+ * @param[in] state	tree the State value was (allegedly) generated by.
+ * @param[in] request	the current request.
+ * @param[in] vb	value of the State attribute.
+ * @param[out] pairs_p	where the serialised pair text starts.
+ * @param[out] pairs_len	length of the serialised pair text.
+ * @return
+ *	- 0 if the value is a valid, unexpired, stateless blob.
+ *	- -1 if it isn't, and the caller should fall back to the tree.
+ */
+static int state_blob_verify(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb,
+			     char const **pairs_p, size_t *pairs_len)
+{
+	uint8_t		digest[SHA1_DIGEST_LENGTH];
+	uint8_t const	*blob = vb->vb_octets;
+	size_t		len = vb->vb_length;
+
+	if (len < (STATE_BLOB_HEADER_LEN + SHA1_DIGEST_LENGTH)) return -1;
+	if (blob[0] != STATE_BLOB_MAGIC) return -1;
+
+	len -= SHA1_DIGEST_LENGTH;
+	state_blob_sign(digest, state, request, blob, len);
+	if (fr_digest_cmp(digest, blob + len, sizeof(digest)) != 0) {
+		RDEBUG2("State value failed verification, ignoring it");
+		return -1;
+	}
+
+	if ((time_t)fr_get_be32(blob + 1) < time(NULL)) {
+		RDEBUG2("Stateless State value expired, ignoring it");
+		return -1;
+	}
+
+	*pairs_p = (char const *)blob + STATE_BLOB_HEADER_LEN;
+	*pairs_len = len - STATE_BLOB_HEADER_LEN;
+
+	return 0;
+}
+
+/** Restore &session-state from a self-authenticating State value
+ *
+ * @return
+ *	- 0 if the State value was a valid stateless blob.
+ *	- -1 if it wasn't, and the caller should try the tree.
+ */
+static int state_blob_to_request(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb)
+{
+	char const	*pairs;
+	char		*buff;
+	size_t		len;
+	VALUE_PAIR	*head = NULL;
+
+	if (state_blob_verify(state, request, vb, &pairs, &len) < 0) return -1;
+
+	/*
+	 *	fr_pair_list_afrom_str needs a terminated string.
+	 */
+	buff = talloc_bstrndup(request, pairs, len);
+	if (!buff) return -1;
+
+	if (fr_pair_list_afrom_str(request->state_ctx, fr_dict_by_da(state->da), buff, &head) == T_INVALID) {
+		RPEDEBUG("Failed parsing stateless State value");
+		talloc_free(buff);
+		return -1;
+	}
+	talloc_free(buff);
+
+	request->state = head;
+
+	if (request->state) {
+		RDEBUG2("Restored &session-state");
+		log_request_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
+	}
+
+	RDEBUG3("RADIUS State - restored (stateless)");
+
+	REQUEST_VERIFY(request);
+
+	return 0;
+}
+
+/** Serialise &session-state into a self-authenticating State value
+ *
+ * The blob is laid out as one magic octet, the expiry time as four
+ * octets in network order, the session-state pairs in their text form,
+ * then an HMAC-SHA1 over everything before it.
+ *
+ * The pairs are authenticated, but *not* encrypted, so anything secret
+ * must stay in the tree.  There's also no way to serialise the opaque
+ * data modules persist between rounds, and no room for more than a few
+ * pairs, so anything we can't represent falls back to the tree.
+ *
+ * @return
+ *	- 0 if the session was serialised into the State value.
+ *	- -1 if it couldn't be, and the caller should use the tree.
+ */
+static int state_request_to_blob(fr_state_tree_t *state, REQUEST *request, fr_dlist_head_t *data)
+{
+	uint8_t		blob[STATE_BLOB_MAX_LEN];
+	char		pairs[STATE_BLOB_MAX_LEN];
+	char		*p = pairs, *end = pairs + sizeof(pairs);
+	size_t		len, used;
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	/*
+	 *	Persisted module data is opaque to us, we can't
+	 *	serialise it.
+	 */
+	if (!fr_dlist_empty(data)) return -1;
+
+	/*
+	 *	A module created its own magic State value.  The tree
+	 *	is the only thing which can honour that.
+	 */
+	if (fr_pair_find_by_da(request->reply->vps, state->da, TAG_ANY)) return -1;
+
+	for (vp = fr_cursor_init(&cursor, &request->state); vp; vp = fr_cursor_next(&cursor)) {
+		if (p != pairs) {
+			if ((end - p) < 2) return -1;
+			*p++ = ',';
+			*p++ = ' ';
+		}
+
+		len = fr_pair_snprint(p, end - p, vp);
+		if (is_truncated(len, end - p)) return -1;
+		p += len;
+	}
+	len = p - pairs;
+
+	/*
+	 *	Too big to fit in a single State attribute.
+	 */
+	if ((STATE_BLOB_HEADER_LEN + len + SHA1_DIGEST_LENGTH) > sizeof(blob)) return -1;
+
+	blob[0] = STATE_BLOB_MAGIC;
+	fr_put_be32(blob + 1, (uint32_t)(time(NULL) + state->timeout));
+	memcpy(blob + STATE_BLOB_HEADER_LEN, pairs, len);
+
+	used = STATE_BLOB_HEADER_LEN + len;
+	state_blob_sign(blob + used, state, request, blob, used);
+	used += SHA1_DIGEST_LENGTH;
+
+	MEM(vp = fr_pair_afrom_da(request->reply, state->da));
+	fr_pair_value_memcpy(vp, blob, used, false);
+	fr_pair_add(&request->reply->vps, vp);
+
+	/*
+	 *	The session-state now lives in the State value, so the
+	 *	request's copy can be freed, the same as if ownership
+	 *	had passed to a state entry.
+	 */
+	TALLOC_FREE(request->state_ctx);
+	request->state = NULL;
+
+	RDEBUG3("RADIUS State - saved (stateless)");
+
+	REQUEST_VERIFY(request);
+
+	return 0;
+}
+
 /** Called when sending an Access-Accept/Access-Reject to discard state information
  *
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 	VALUE_PAIR		*vp;
 
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	/*
+	 *	Stateless State values were never inserted into the
+	 *	tree, there's nothing to unlink.
+	 */
+	if (state->stateless) {
+		char const	*pairs;
+		size_t		len;
+
+		if (state_blob_verify(state, request, &vp->data, &pairs, &len) == 0) goto clear_request;
+	}
+
+	state_value_normalise(&my_entry, request, &vp->data);
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &my_entry);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(shard, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -578,6 +853,7 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 	 */
 	TALLOC_FREE(entry);
 
+clear_request:
 	/*
 	 *	If fr_state_to_request was called, then the request
 	 *	holds the state data, and we need to destroy it
@@ -605,7 +881,8 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	VALUE_PAIR		*vp;
 
@@ -621,13 +898,25 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	/*
+	 *	If the State value is a self-authenticating blob, the
+	 *	session-state is reconstructed from it directly, and no
+	 *	tree access is needed.  If it isn't, fall back to the
+	 *	tree, so sessions the blob couldn't represent keep
+	 *	working.
+	 */
+	if (state->stateless && (state_blob_to_request(state, request, &vp->data) == 0)) return;
+
+	state_value_normalise(&my_entry, request, &vp->data);
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &my_entry);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 			return;
 		}
 		if (request->state_ctx) old_ctx = request->state_ctx;	/* Store for later freeing */
@@ -643,7 +932,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		entry->vps = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -671,10 +960,15 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
  */
 int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry, *old = NULL;
+	fr_state_entry_t	*entry, *old;
+	fr_state_shard_t	*shard;
 	fr_dlist_head_t		data;
 	VALUE_PAIR		*vp;
 
+	uint8_t			old_state[sizeof(entry->state)];
+	uint8_t const		*old_state_p = NULL;
+	int			old_tries = 0;
+
 	request_data_list_init(&data);
 	request_data_by_persistance(&data, request, true);
 
@@ -685,14 +979,54 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 		log_request_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
+	/*
+	 *	If the session can be represented as a
+	 *	self-authenticating State value, no entry is inserted
+	 *	into the tree, and no other worker need ever see it.
+	 */
+	if (state->stateless && (state_request_to_blob(state, request, &data) == 0)) return 0;
+
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+	/*
+	 *	Record the information from the old entry, as the new
+	 *	state may be based on it.  The new entry may hash to a
+	 *	different shard, so this is done under the old shard's
+	 *	mutex, before the new entry is created.
+	 */
+	if (vp) {
+		fr_state_entry_t	my_entry;
+		fr_state_entry_t	*to_free = NULL;
+
+		state_value_normalise(&my_entry, request, &vp->data);
+		shard = state_shard(state, &my_entry);
 
-	entry = state_entry_create(state, request, request->reply, old);
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		old = state_entry_find(shard, &my_entry);
+		if (old) {
+			old_tries = old->tries;
+
+			memcpy(old_state, old->state, sizeof(old_state));
+			old_state_p = old_state;
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (fr_dlist_empty(&old->data)) {
+				state_entry_unlink(shard, old);
+				to_free = old;
+			}
+		}
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+		/*
+		 *	Free it outside of the mutex for less contention.
+		 */
+		if (to_free) talloc_free(to_free);
+	}
+
+	entry = state_entry_create(state, request, request->reply, old_state_p, old_tries, &shard);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
@@ -709,7 +1043,7 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	RDEBUG3("RADIUS State - saved");
 	REQUEST_VERIFY(request);
@@ -849,7 +1183,12 @@ void fr_state_detach(REQUEST *request, bool will_free)
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	size_t		i;
+	uint64_t	created = 0;
+
+	for (i = 0; i < STATE_NUM_SHARDS; i++) created += state->shard[i].id;
+
+	return created;
 }
 
 /** Return number of entries that timed out
@@ -857,7 +1196,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	size_t		i;
+	uint64_t	timed_out = 0;
+
+	for (i = 0; i < STATE_NUM_SHARDS; i++) timed_out += state->shard[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -865,5 +1209,10 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	size_t		i;
+	uint32_t	tracked = 0;
+
+	for (i = 0; i < STATE_NUM_SHARDS; i++) tracked += (uint32_t)rbtree_num_elements(state->shard[i].tree);
+
+	return tracked;
 }
@@ -0,0 +1,265 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file stats_shm.c
+ * @brief Passive statistics export via a shared memory segment.
+ *
+ * Querying statistics through fr_snmp_process() costs a full request
+ * worth of processing.  This file instead mirrors the global
+ * statistics counters into a shared memory segment once a second,
+ * so monitoring agents can scrape them for free.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/stats_shm.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef WITH_STATS
+static fr_stats_shm_t		*stats_shm = NULL;
+static char			*stats_shm_path = NULL;
+static fr_event_timer_t	const	*stats_shm_ev = NULL;
+
+static fr_time_delta_t		stats_shm_interval = NSEC;	/* 1s */
+
+/** Roll the global statistics counters up into the shared segment
+ *
+ * The segment is written seqlock style.  The generation counter is
+ * bumped to an odd value before the copy, and to an even value after
+ * it, so readers can detect a rollup in progress and retry.
+ *
+ * @param[in] now	the current time.
+ */
+static void stats_shm_update(fr_time_t now)
+{
+	stats_shm->generation++;
+	atomic_thread_fence(memory_order_release);
+
+	stats_shm->auth = radius_auth_stats;
+#ifdef WITH_ACCOUNTING
+	stats_shm->acct = radius_acct_stats;
+#endif
+#ifdef WITH_COA
+	stats_shm->coa = radius_coa_stats;
+	stats_shm->dsc = radius_dsc_stats;
+#endif
+#ifdef WITH_PROXY
+	stats_shm->proxy_auth = proxy_auth_stats;
+#ifdef WITH_ACCOUNTING
+	stats_shm->proxy_acct = proxy_acct_stats;
+#endif
+#ifdef WITH_COA
+	stats_shm->proxy_coa = proxy_coa_stats;
+	stats_shm->proxy_dsc = proxy_dsc_stats;
+#endif
+#endif	/* WITH_PROXY */
+
+	stats_shm->updated = now;
+
+	atomic_thread_fence(memory_order_release);
+	stats_shm->generation++;
+}
+
+/** Periodic event which performs the rollup
+ *
+ * @param[in] el	the event list.
+ * @param[in] now	the current time.
+ * @param[in] ctx	unused.
+ */
+static void stats_shm_event(fr_event_list_t *el, fr_time_t now, void *ctx)
+{
+	stats_shm_update(now);
+
+	if (fr_event_timer_in(NULL, el, &stats_shm_ev,
+			      stats_shm_interval, stats_shm_event, ctx) < 0) {
+		ERROR("Failed to insert statistics rollup timer");
+	}
+}
+
+/** Create the shared memory segment, and start the rollup timer
+ *
+ * @param[in] el	event list in which to run the rollup.
+ * @param[in] path	name of the segment, as passed to shm_open().
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_stats_shm_init(fr_event_list_t *el, char const *path)
+{
+	int fd;
+
+	rad_assert(stats_shm == NULL);
+
+	fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		ERROR("Failed creating shared memory segment %s: %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(fr_stats_shm_t)) < 0) {
+		ERROR("Failed sizing shared memory segment %s: %s", path, fr_syserror(errno));
+	error:
+		close(fd);
+		shm_unlink(path);
+		return -1;
+	}
+
+	stats_shm = mmap(NULL, sizeof(fr_stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (stats_shm == MAP_FAILED) {
+		stats_shm = NULL;
+		ERROR("Failed mapping shared memory segment %s: %s", path, fr_syserror(errno));
+		goto error;
+	}
+	close(fd);
+
+	memset(stats_shm, 0, sizeof(fr_stats_shm_t));
+	stats_shm->magic = FR_STATS_SHM_MAGIC;
+	stats_shm->version = FR_STATS_SHM_VERSION;
+	stats_shm->size = sizeof(fr_stats_shm_t);
+
+	stats_shm_path = talloc_typed_strdup(NULL, path);
+
+	if (fr_event_timer_in(NULL, el, &stats_shm_ev,
+			      stats_shm_interval, stats_shm_event, NULL) < 0) {
+		ERROR("Failed to insert statistics rollup timer");
+		fr_stats_shm_free();
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Unmap and unlink the shared memory segment
+ *
+ */
+void fr_stats_shm_free(void)
+{
+	if (!stats_shm) return;
+
+	munmap(stats_shm, sizeof(fr_stats_shm_t));
+	stats_shm = NULL;
+
+	shm_unlink(stats_shm_path);
+	TALLOC_FREE(stats_shm_path);
+}
+
+/** Attach to a statistics segment published by a server
+ *
+ * @param[in] path	name of the segment, as passed to shm_open().
+ * @return
+ *	- the mapped segment on success.
+ *	- NULL on failure.
+ */
+fr_stats_shm_t const *fr_stats_shm_attach(char const *path)
+{
+	int			fd;
+	fr_stats_shm_t const	*shm;
+
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening shared memory segment %s: %s", path, fr_syserror(errno));
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(fr_stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping shared memory segment %s: %s", path, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (shm->magic != FR_STATS_SHM_MAGIC) {
+		fr_strerror_printf("Invalid magic in %s, expected 0x%08x got 0x%08x",
+				   path, FR_STATS_SHM_MAGIC, shm->magic);
+	error:
+		fr_stats_shm_detach(shm);
+		return NULL;
+	}
+
+	if (shm->version != FR_STATS_SHM_VERSION) {
+		fr_strerror_printf("Invalid version in %s, expected %u got %u",
+				   path, FR_STATS_SHM_VERSION, shm->version);
+		goto error;
+	}
+
+	/*
+	 *	fr_stats_t changes size with WITH_STATS_64BIT, so a
+	 *	size mismatch means we were built with different
+	 *	feature flags to the server.
+	 */
+	if (shm->size != sizeof(fr_stats_shm_t)) {
+		fr_strerror_printf("Invalid size in %s, expected %zu got %u",
+				   path, sizeof(fr_stats_shm_t), shm->size);
+		goto error;
+	}
+
+	return shm;
+}
+
+/** Take a consistent snapshot of a statistics segment
+ *
+ * @param[in] shm	segment returned by fr_stats_shm_attach().
+ * @param[out] out	where to write the snapshot.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a consistent snapshot couldn't be taken.
+ */
+int fr_stats_shm_read(fr_stats_shm_t const *shm, fr_stats_shm_t *out)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		uint64_t generation;
+
+		generation = shm->generation;
+		if (generation & 1) continue;	/* rollup in progress */
+		atomic_thread_fence(memory_order_acquire);
+
+		memcpy(out, shm, sizeof(*out));
+
+		atomic_thread_fence(memory_order_acquire);
+		if (shm->generation == generation) return 0;
+	}
+
+	fr_strerror_printf("Failed reading consistent statistics snapshot");
+	return -1;
+}
+
+/** Unmap a segment returned by fr_stats_shm_attach()
+ *
+ */
+void fr_stats_shm_detach(fr_stats_shm_t const *shm)
+{
+	void *mutable;
+
+	if (!shm) return;
+
+	memcpy(&mutable, &shm, sizeof(mutable));	/* const issues */
+	munmap(mutable, sizeof(fr_stats_shm_t));
+}
+#endif	/* WITH_STATS */
@@ -0,0 +1,89 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/stats_shm.h
+ * @brief Passive statistics export via a shared memory segment.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(stats_shm_h, "$Id$")
+
+#include <freeradius-devel/server/stats.h>
+#include <freeradius-devel/util/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_STATS
+/** Layout of the exported statistics segment
+ *
+ * The global statistics counters are rolled up into the segment once
+ * a second, so monitoring agents can scrape them without generating
+ * server requests.
+ *
+ * The generation counter is incremented before and after each rollup
+ * (i.e. it's odd while a rollup is in progress), allowing readers to
+ * detect and retry torn reads.
+ *
+ * All statistics blocks are always present.  Blocks for features
+ * which weren't compiled in stay zero.  As fr_stats_t changes size
+ * with WITH_STATS_64BIT, readers must be built with the same feature
+ * flags as the server, which is what the size field verifies.
+ */
+typedef struct {
+	uint32_t	magic;			//!< Always #FR_STATS_SHM_MAGIC.
+	uint32_t	version;		//!< #FR_STATS_SHM_VERSION, bumped on any layout change.
+	uint32_t	size;			//!< Total size of the segment.
+	uint32_t	_pad;
+
+	uint64_t	generation;		//!< Odd while a rollup is in progress.
+	int64_t		updated;		//!< fr_time_t of the last rollup.
+
+	fr_stats_t	auth;			//!< Mirror of #radius_auth_stats.
+	fr_stats_t	acct;			//!< Mirror of #radius_acct_stats.
+	fr_stats_t	coa;			//!< Mirror of #radius_coa_stats.
+	fr_stats_t	dsc;			//!< Mirror of #radius_dsc_stats.
+	fr_stats_t	proxy_auth;		//!< Mirror of #proxy_auth_stats.
+	fr_stats_t	proxy_acct;		//!< Mirror of #proxy_acct_stats.
+	fr_stats_t	proxy_coa;		//!< Mirror of #proxy_coa_stats.
+	fr_stats_t	proxy_dsc;		//!< Mirror of #proxy_dsc_stats.
+} fr_stats_shm_t;
+
+#define FR_STATS_SHM_MAGIC	0x46525354	/* "FRST" */
+#define FR_STATS_SHM_VERSION	1
+
+/*
+ *	Writer (server) side
+ */
+int	fr_stats_shm_init(fr_event_list_t *el, char const *path);
+void	fr_stats_shm_free(void);
+
+/*
+ *	Reader (monitoring agent) side
+ */
+fr_stats_shm_t const	*fr_stats_shm_attach(char const *path);
+int	fr_stats_shm_read(fr_stats_shm_t const *shm, fr_stats_shm_t *out);
+void	fr_stats_shm_detach(fr_stats_shm_t const *shm);
+#endif	/* WITH_STATS */
+
+#ifdef __cplusplus
+}
+#endif
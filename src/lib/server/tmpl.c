@@ -1328,7 +1328,7 @@ int tmpl_cast_in_place(vp_tmpl_t *vpt, fr_type_t type, fr_dict_attr_t const *enu
 		switch (vpt->tmpl_value_type) {
 		case FR_TYPE_STRING:
 		case FR_TYPE_OCTETS:
-			talloc_free(vpt->tmpl_value.datum.ptr);
+			if (!fr_value_box_is_inline(&vpt->tmpl_value)) talloc_free(vpt->tmpl_value.datum.ptr);
 			break;
 
 		default:
@@ -2050,6 +2050,13 @@ ssize_t _tmpl_to_atype(TALLOC_CTX *ctx, void *out,
 	if ((to_cast->type != dst_type) || needs_dup) {
 		ret = fr_value_box_cast(ctx, &from_cast, dst_type, NULL, to_cast);
 		if (ret < 0) goto error;
+
+		/*
+		 *	The caller gets a talloced buffer it can keep,
+		 *	so values the cast stored in the (stack allocated)
+		 *	box itself have to be moved out.
+		 */
+		if (fr_value_box_inline_spill(ctx, &from_cast) < 0) goto error;
 	} else {
 		switch (to_cast->type) {
 		case FR_TYPE_OCTETS:
@@ -2537,6 +2544,47 @@ int tmpl_find_vp(VALUE_PAIR **out, REQUEST *request, vp_tmpl_t const *vpt)
 
 	int err;
 
+	/*
+	 *	Fast path for bare attribute references, which policy
+	 *	evaluation hits many times per request.  The compiled
+	 *	tmpl already holds the resolved (request, list, da, tag)
+	 *	tuple, so we can walk the list directly instead of
+	 *	setting up a cursor with a talloc checked iterator.
+	 *
+	 *	Equivalent to the NUM_ANY branch of _tmpl_cursor_next.
+	 */
+	if (tmpl_is_attr(vpt) && (vpt->tmpl_num == NUM_ANY)) {
+		VALUE_PAIR **vps;
+
+		if (radius_request(&request, vpt->tmpl_request) < 0) {
+			fr_strerror_printf("Request context \"%s\" not available",
+					   fr_table_str_by_value(request_ref_table, vpt->tmpl_request, "<INVALID>"));
+			if (out) *out = NULL;
+			return -3;
+		}
+
+		vps = radius_list(request, vpt->tmpl_list);
+		if (!vps) {
+			fr_strerror_printf("List \"%s\" not available in this context",
+					   fr_table_str_by_value(pair_list_table, vpt->tmpl_list, "<INVALID>"));
+			if (out) *out = NULL;
+			return -2;
+		}
+
+		for (vp = *vps; vp; vp = vp->next) {
+			VP_VERIFY(vp);
+			if (TMPL_TAG_MATCH(vp, vpt)) break;
+		}
+		if (!vp) {
+			fr_strerror_printf("No matching \"%s\" pairs found", vpt->tmpl_da->name);
+			if (out) *out = NULL;
+			return -1;
+		}
+
+		if (out) *out = vp;
+		return 0;
+	}
+
 	vp = tmpl_cursor_init(&err, &cursor, request, vpt);
 	if (out) *out = vp;
 
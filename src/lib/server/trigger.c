@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_parse.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/dlist.h>
 
 /** Whether triggers are enabled globally
  *
@@ -37,6 +38,20 @@ static CONF_SECTION const	*trigger_exec_main, *trigger_exec_subcs;
 static rbtree_t			*trigger_last_fired_tree;
 static pthread_mutex_t		*trigger_mutex;
 
+static fr_dlist_head_t		trigger_queue;
+static uint32_t			trigger_queue_depth;
+static pthread_cond_t		trigger_queue_cond;
+static pthread_t		trigger_worker_id;
+static bool			trigger_worker_running;
+static bool			trigger_worker_stop;
+
+/** Maximum number of distinct triggers that may be waiting for the worker
+ *
+ * Identical pending triggers are coalesced, so this is only hit when many
+ * different triggers fire faster than they can be executed.
+ */
+#define TRIGGER_MAX_PENDING	(1024)
+
 #define REQUEST_INDEX_TRIGGER_NAME	1
 #define REQUEST_INDEX_TRIGGER_ARGS	2
 
@@ -48,6 +63,22 @@ typedef struct {
 	time_t		last_fired;	//!< When this trigger last fired.
 } trigger_last_fired_t;
 
+/** A trigger command waiting to be executed by the worker thread
+ *
+ */
+typedef struct {
+	fr_dlist_t	entry;		//!< Entry in the pending queue.
+
+	CONF_ITEM	*ci;		//!< Config item the trigger came from.  Used (with the args)
+					//!< as the coalescing identity, and never dereferenced.
+	char const	*name;		//!< Name of the trigger, e.g. module.ldap.pool.start.
+	char const	*value;		//!< The command to execute, expanded by the worker.
+	VALUE_PAIR	*args;		//!< Copy of the caller's trigger arguments.
+	VALUE_PAIR	*env;		//!< Copy of the request pairs, placed in the
+					//!< child's environment.
+	uint32_t	count;		//!< How many times the trigger fired whilst it was queued.
+} trigger_event_t;
+
 /** Retrieve attributes from a special trigger list
  *
  */
@@ -76,7 +107,7 @@ ssize_t trigger_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
 	 */
 	if (!head) return -1;
 
-	da = fr_dict_attr_by_name(request->dict, fmt);
+	da = fr_dict_attr_by_name_cached(request->dict, fmt);
 	if (!da) {
 		ERROR("Unknown attribute \"%s\"", fmt);
 		return -1;
@@ -119,6 +150,154 @@ static int _trigger_last_fired_cmp(void const *a, void const *b)
 	return (lf_a->ci < lf_b->ci) - (lf_a->ci > lf_b->ci);
 }
 
+/** Execute a queued trigger event
+ *
+ * Runs in the worker thread.  Performs the same work the tail of
+ * #trigger_exec used to do inline, against a fake request, as the
+ * request which noticed the event has long since moved on.
+ *
+ * @param[in] ev	to execute.
+ */
+static void trigger_event_exec(trigger_event_t *ev)
+{
+	REQUEST *fake;
+
+	fake = request_alloc(NULL);
+	if (!fake) return;
+
+	if (ev->count > 1) DEBUG2("Trigger \"%s\" fired %u times whilst queued, executing once", ev->name, ev->count);
+
+	/*
+	 *	Add the args to the request data, so they can be picked up by the
+	 *	xlat_trigger function.
+	 */
+	if (ev->args && (request_data_add(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS, ev->args,
+					  false, false, false) < 0)) {
+		ERROR("Failed adding trigger request data");
+		talloc_free(fake);
+		return;
+	}
+
+	{
+		void *name_tmp;
+
+		memcpy(&name_tmp, &ev->name, sizeof(name_tmp));
+
+		if (request_data_add(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_NAME,
+				     name_tmp, false, false, false) < 0) {
+			ERROR("Failed marking request as inside trigger");
+			talloc_free(fake);
+			return;
+		}
+	}
+
+	radius_exec_program(fake, NULL, 0, NULL, fake, ev->value, ev->env, false, true,
+			    fr_time_delta_from_sec(EXEC_TIMEOUT));
+
+	(void) request_data_get(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_NAME);
+	(void) request_data_get(fake, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS);
+
+	talloc_free(fake);
+}
+
+/** Pull pending events off the queue and execute them
+ *
+ * Executing a trigger is expensive relative to noticing the event which
+ * caused it (xlat expansion, building the child's environment, and the
+ * fork itself), so it's done here instead of in the thread which fired
+ * the trigger.  On exit the queue is drained, so triggers fired during
+ * shutdown still run.
+ */
+static void *trigger_worker(UNUSED void *uctx)
+{
+	pthread_mutex_lock(trigger_mutex);
+	for (;;) {
+		trigger_event_t *ev;
+
+		ev = fr_dlist_head(&trigger_queue);
+		if (!ev) {
+			if (trigger_worker_stop) break;
+			pthread_cond_wait(&trigger_queue_cond, trigger_mutex);
+			continue;
+		}
+		fr_dlist_remove(&trigger_queue, ev);
+		trigger_queue_depth--;
+		pthread_mutex_unlock(trigger_mutex);
+
+		trigger_event_exec(ev);
+		talloc_free(ev);
+
+		pthread_mutex_lock(trigger_mutex);
+	}
+	pthread_mutex_unlock(trigger_mutex);
+
+	return NULL;
+}
+
+/** Queue a trigger for the worker thread, coalescing identical pending triggers
+ *
+ * @param[in] ci	the trigger was found in, used as the coalescing identity.
+ * @param[in] name	of the trigger.
+ * @param[in] value	command to execute.
+ * @param[in] args	to make available via the @verbatim %{trigger:<arg>} @endverbatim xlat.
+ * @param[in] env	pairs to place in the child's environment.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the queue is full, or we couldn't queue the event.
+ */
+static int trigger_event_enqueue(CONF_ITEM *ci, char const *name, char const *value,
+				 VALUE_PAIR *args, VALUE_PAIR *env)
+{
+	trigger_event_t *ev;
+
+	pthread_mutex_lock(trigger_mutex);
+
+	/*
+	 *	If an identical trigger is already waiting, don't queue
+	 *	it again.  The worker logs how many executions were
+	 *	folded into one.
+	 */
+	for (ev = fr_dlist_head(&trigger_queue); ev; ev = fr_dlist_next(&trigger_queue, ev)) {
+		if ((ev->ci == ci) && (fr_pair_list_cmp(ev->args, args) == 0)) {
+			ev->count++;
+			pthread_mutex_unlock(trigger_mutex);
+			return 0;
+		}
+	}
+
+	if (trigger_queue_depth >= TRIGGER_MAX_PENDING) {
+		pthread_mutex_unlock(trigger_mutex);
+		WARN("Discarding trigger \"%s\": too many triggers queued", name);
+		return -1;
+	}
+
+	/*
+	 *	The config may be reloaded before the worker gets to the
+	 *	event, so the strings are copied, and ci is only ever
+	 *	compared, never dereferenced.
+	 */
+	ev = talloc_zero(NULL, trigger_event_t);
+	if (!ev) {
+		pthread_mutex_unlock(trigger_mutex);
+		return -1;
+	}
+	fr_dlist_entry_init(&ev->entry);
+	ev->ci = ci;
+	ev->name = talloc_strdup(ev, name);
+	ev->value = talloc_strdup(ev, value);
+	if (args) fr_pair_list_copy(ev, &ev->args, args);
+	if (env) fr_pair_list_copy(ev, &ev->env, env);
+	ev->count = 1;
+
+	fr_dlist_insert_tail(&trigger_queue, ev);
+	trigger_queue_depth++;
+
+	pthread_cond_signal(&trigger_queue_cond);
+	pthread_mutex_unlock(trigger_mutex);
+
+	return 0;
+}
+
 /** Set the global trigger section trigger_exec will search in, and register xlats
  *
  * This function exists because triggers are used by the connection pool, which
@@ -156,6 +335,21 @@ int trigger_exec_init(CONF_SECTION const *cs)
 	pthread_mutex_init(trigger_mutex, 0);
 	talloc_set_destructor(trigger_mutex, _mutex_free);
 
+	/*
+	 *	Triggers are executed by a dedicated worker thread, so
+	 *	they don't steal cycles from whatever noticed the event.
+	 *	If the thread can't be created we fall back to executing
+	 *	them synchronously.
+	 */
+	fr_dlist_talloc_init(&trigger_queue, trigger_event_t, entry);
+	pthread_cond_init(&trigger_queue_cond, NULL);
+	trigger_worker_stop = false;
+	if (pthread_create(&trigger_worker_id, NULL, trigger_worker, NULL) == 0) {
+		trigger_worker_running = true;
+	} else {
+		WARN("Failed creating trigger worker thread, triggers will execute synchronously");
+	}
+
 	triggers_init = true;
 
 	return 0;
@@ -166,6 +360,18 @@ int trigger_exec_init(CONF_SECTION const *cs)
  */
 void trigger_exec_free(void)
 {
+	if (trigger_worker_running) {
+		pthread_mutex_lock(trigger_mutex);
+		trigger_worker_stop = true;
+		pthread_cond_signal(&trigger_queue_cond);
+		pthread_mutex_unlock(trigger_mutex);
+
+		pthread_join(trigger_worker_id, NULL);
+		trigger_worker_running = false;
+
+		pthread_cond_destroy(&trigger_queue_cond);
+	}
+
 	TALLOC_FREE(trigger_last_fired_tree);
 	TALLOC_FREE(trigger_mutex);
 }
@@ -299,6 +505,23 @@ int trigger_exec(REQUEST *request, CONF_SECTION const *cs, char const *name, boo
 		found->last_fired = now;
 	}
 
+	/*
+	 *	Don't fire triggers if we're just testing
+	 */
+	if (check_config) return 0;
+
+	/*
+	 *	Hand the trigger to the worker thread.  Expansion of the
+	 *	command and the fork happen there, and identical triggers
+	 *	already waiting are coalesced, so an event storm results
+	 *	in (at most) one pending execution.
+	 */
+	if (trigger_worker_running) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Trigger \"%s\": %s", name, value);
+
+		return trigger_event_enqueue(ci, name, value, args, vp);
+	}
+
 	/*
 	 *	radius_exec_program always needs a request.
 	 */
@@ -328,12 +551,9 @@ int trigger_exec(REQUEST *request, CONF_SECTION const *cs, char const *name, boo
 		}
 	}
 
-	/*
-	 *	Don't fire triggers if we're just testing
-	 */
-	if (!check_config) ret = radius_exec_program(request, NULL, 0, NULL,
-						     request, value, vp, false, true,
-						     fr_time_delta_from_sec(EXEC_TIMEOUT));
+	ret = radius_exec_program(request, NULL, 0, NULL,
+				  request, value, vp, false, true,
+				  fr_time_delta_from_sec(EXEC_TIMEOUT));
 	(void) request_data_get(request, &trigger_exec_main, REQUEST_INDEX_TRIGGER_NAME);
 	(void) request_data_get(request, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS);
 
@@ -30,6 +30,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/talloc.h>
 
 #include <sys/stat.h>
 
@@ -115,9 +116,13 @@ int pairlist_read(TALLOC_CTX *ctx, fr_dict_t const *dict, char const *file, PAIR
 	}
 
 	/*
-	 *	Allocate the structure for one entry.
+	 *	Allocate the structure for one entry.  Pool the entry's
+	 *	name and pairs with it, so a typical entry costs one
+	 *	malloc instead of one per pair.  With users files in the
+	 *	millions of entries this dominates load time, and the
+	 *	pool spills gracefully for entries with many pairs.
 	 */
-	MEM(t = talloc_zero(ctx, PAIR_LIST));
+	MEM(t = talloc_zero_pooled_object(ctx, PAIR_LIST, 16, 2048));
 
 	/*
 	 *	Read the entire file into memory for speed.
@@ -324,7 +329,7 @@ parse_again:
 		/*
 		 *	Allocate another one, just in case it's needed.
 		 */
-		MEM(t = talloc_zero(ctx, PAIR_LIST));
+		MEM(t = talloc_zero_pooled_object(ctx, PAIR_LIST, 16, 2048));
 
 		/*
 		 *	Look for a name.  If we came here because
@@ -249,6 +249,16 @@ static int namespace_on_read(UNUSED TALLOC_CTX *ctx, UNUSED void *out, UNUSED vo
 
 	if (DEBUG_ENABLED4) cf_log_debug(ci, "Initialising namespace \"%s\"", namespace_str);
 
+	/*
+	 *	Loading a protocol dictionary requires the internal
+	 *	dictionary, which may still be loading on the
+	 *	preload thread.
+	 */
+	if (main_config_dict_join() < 0) {
+		cf_log_err(ci, "Failed loading dictionaries");
+		return -1;
+	}
+
 	/*
 	 *	Doesn't currently work, because namespace
 	 *	*REALLY REALLY* shouldn't be processed on_read,
@@ -424,6 +434,44 @@ static int cmd_show_server_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx,
 	return 0;
 }
 
+static int cmd_show_server_profile(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	size_t i, server_cnt = virtual_servers ? talloc_array_length(virtual_servers) : 0;
+
+	for (i = 0; i < server_cnt; i++) {
+		CONF_SECTION	*server_cs = virtual_servers[i]->server_cs;
+		CONF_ITEM	*ci;
+
+		fprintf(fp, "server %s {\n", cf_section_name2(server_cs));
+
+		/*
+		 *	Print the counters for each processing
+		 *	section which was compiled to unlang.
+		 */
+		for (ci = cf_item_next(server_cs, NULL);
+		     ci != NULL;
+		     ci = cf_item_next(server_cs, ci)) {
+			CONF_SECTION *subcs;
+
+			if (!cf_item_is_section(ci)) continue;
+
+			subcs = cf_item_to_section(ci);
+			unlang_profile_fprint(fp, subcs);
+		}
+
+		fprintf(fp, "}\n");
+	}
+
+	return 0;
+}
+
+static int cmd_set_profile_status(UNUSED FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	unlang_profile_enable(strcmp(info->argv[0], "on") == 0);
+
+	return 0;
+}
+
 static fr_cmd_table_t cmd_table[] = {
 	{
 		.parent = "show",
@@ -440,6 +488,23 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true,
 	},
 
+	{
+		.parent = "show server",
+		.name = "profile",
+		.func = cmd_show_server_profile,
+		.help = "Show per-instruction unlang profiling counters for each virtual server.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "set",
+		.name = "profile",
+		.syntax = "(on|off)",
+		.func = cmd_set_profile_status,
+		.help = "Enable or disable unlang profiling.",
+		.read_only = false,
+	},
+
 	CMD_TABLE_END
 
 };
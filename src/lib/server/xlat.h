@@ -291,6 +291,8 @@ xlat_t const	*xlat_async_register(TALLOC_CTX *ctx, char const *name, xlat_func_a
 
 int		xlat_internal(char const *name);
 
+int		xlat_pure(char const *name);
+
 #define	xlat_async_instantiate_set(_xlat, _instantiate, _inst_struct, _detach, _uctx) \
 	_xlat_async_instantiate_set(_xlat, _instantiate, #_inst_struct, sizeof(_inst_struct), _detach, _uctx)
 void _xlat_async_instantiate_set(xlat_t const *xlat,
@@ -2243,6 +2243,30 @@ int xlat_internal(char const *name)
 	return 0;
 }
 
+/** Mark an xlat function as pure
+ *
+ * A pure function produces the same output for the same input, and
+ * doesn't look at the request.  Results of pure functions may be
+ * memoized within a request, so repeated expansions with the same
+ * input don't recompute them.
+ *
+ * @param[in] name of function to find.
+ * @return
+ *	- -1 on failure (function doesn't exist).
+ *	- 0 on success.
+ */
+int xlat_pure(char const *name)
+{
+	xlat_t *c;
+
+	c = xlat_func_find(name);
+	if (!c) return -1;
+
+	c->pure = true;
+
+	return 0;
+}
+
 /** Set global instantiation/detach callbacks
  *
  * All functions registered must be async_safe.
@@ -3003,6 +3027,45 @@ int xlat_init(void)
 	xlat_async_register(NULL, "urlquote", xlat_func_urlquote);
 	xlat_async_register(NULL, "urlunquote", xlat_func_urlunquote);
 
+	/*
+	 *	These functions give the same output for the same
+	 *	input, and don't look at the request, so repeated
+	 *	expansions with the same input within one request can
+	 *	be answered from the memo cache.
+	 */
+	xlat_pure("base64");
+	xlat_pure("base64decode");
+	xlat_pure("bin");
+	xlat_pure("hex");
+	xlat_pure("hmacmd5");
+	xlat_pure("hmacsha1");
+	xlat_pure("md4");
+	xlat_pure("md5");
+	xlat_pure("sha1");
+#ifdef HAVE_OPENSSL_EVP_H
+	xlat_pure("sha2_224");
+	xlat_pure("sha2_256");
+	xlat_pure("sha2_384");
+	xlat_pure("sha2_512");
+
+#  if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	xlat_pure("blake2s_256");
+	xlat_pure("blake2b_512");
+#  endif
+
+#  if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	xlat_pure("sha3_224");
+	xlat_pure("sha3_256");
+	xlat_pure("sha3_384");
+	xlat_pure("sha3_512");
+#  endif
+#endif
+	xlat_pure("strlen");
+	xlat_pure("tolower");
+	xlat_pure("toupper");
+	xlat_pure("urlquote");
+	xlat_pure("urlunquote");
+
 	return 0;
 }
 
@@ -39,6 +39,18 @@ RCSID("$Id$")
 
 #include <ctype.h>
 
+/*
+ *	Pool for intermediate expansion buffers, when we have no
+ *	high-water mark from a previous evaluation.
+ */
+#define XLAT_DEFAULT_POOL_SIZE	(1024)
+
+/*
+ *	Don't let one pathological expansion pin a huge pool size
+ *	for every subsequent evaluation.
+ */
+#define XLAT_MAX_POOL_SIZE	(65536)
+
 static bool done_init = false;
 
 static fr_dict_t *dict_freeradius;
@@ -96,6 +108,110 @@ size_t xlat_action_table_len = NUM_ELEMENTS(xlat_action_table);
 static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_exp_t const * const head,
 			   xlat_escape_t escape, void  const *escape_ctx);
 
+/*
+ *	Maximum number of memoized pure function results we track
+ *	per request.  Once the cache is full we stop adding entries,
+ *	which bounds both the memory used and the cost of a miss.
+ */
+#define XLAT_MEMO_MAX		(16)
+
+/** One memoized result of a pure xlat function
+ *
+ */
+typedef struct xlat_memo_entry_s xlat_memo_entry_t;
+struct xlat_memo_entry_s {
+	xlat_memo_entry_t	*next;		//!< Next entry for this request.
+	xlat_t const		*func;		//!< Function the result belongs to.
+	uint32_t		hash;		//!< Hash of in, to cheapen misses.
+	char			*in;		//!< Input the function was expanded with.
+	fr_value_box_t		*out;		//!< Result of the expansion.
+};
+
+/** Per-request cache of pure xlat function results
+ *
+ * Policies frequently expand the same pure function with the same
+ * input several times in one request, e.g. hashing User-Name once
+ * to log it and again to compare it.  We only compute the result
+ * once, and answer subsequent expansions from here.
+ */
+typedef struct {
+	xlat_memo_entry_t	*head;		//!< Singly linked list of entries.
+	unsigned int		num;		//!< Number of entries.
+} xlat_memo_t;
+
+static int xlat_memo_key;			//!< Unique pointer for request data.
+
+/** Find a memoized result of a pure xlat function
+ *
+ * @param[in] request	the current request.
+ * @param[in] func	the function being expanded.
+ * @param[in] in	the fully expanded input string.
+ * @return
+ *	- The cached result.  Still owned by the cache, the caller must copy it.
+ *	- NULL if we haven't seen this (function, input) pair before.
+ */
+static fr_value_box_t const *xlat_memo_get(REQUEST *request, xlat_t const *func, char const *in)
+{
+	xlat_memo_t		*memo;
+	xlat_memo_entry_t	*entry;
+	uint32_t		hash;
+
+	if (!request) return NULL;
+
+	memo = request_data_reference(request, &xlat_memo_key, 0);
+	if (!memo) return NULL;
+
+	hash = fr_hash_string(in);
+	for (entry = memo->head; entry; entry = entry->next) {
+		if ((entry->func == func) && (entry->hash == hash) && (strcmp(entry->in, in) == 0)) {
+			return entry->out;
+		}
+	}
+
+	return NULL;
+}
+
+/** Memoize the result of a pure xlat function
+ *
+ * Failures here just mean we'll recompute the result next time,
+ * so they're ignored.
+ *
+ * @param[in] request	the current request.
+ * @param[in] func	the function which was expanded.
+ * @param[in] in	the fully expanded input string.
+ * @param[in] out	the result.  Copied into the cache.
+ */
+static void xlat_memo_add(REQUEST *request, xlat_t const *func, char const *in, fr_value_box_t const *out)
+{
+	xlat_memo_t		*memo;
+	xlat_memo_entry_t	*entry;
+
+	if (!request) return;
+
+	memo = request_data_reference(request, &xlat_memo_key, 0);
+	if (!memo) {
+		MEM(memo = talloc_zero(request, xlat_memo_t));
+		if (request_data_add(request, &xlat_memo_key, 0, memo, true, true, false) < 0) {
+			talloc_free(memo);
+			return;
+		}
+	}
+	if (memo->num >= XLAT_MEMO_MAX) return;
+
+	MEM(entry = talloc_zero(memo, xlat_memo_entry_t));
+	entry->func = func;
+	entry->hash = fr_hash_string(in);
+	MEM(entry->in = talloc_typed_strdup(entry, in));
+	if (fr_value_box_list_acopy(entry, &entry->out, out) < 0) {
+		talloc_free(entry);
+		return;
+	}
+
+	entry->next = memo->head;
+	memo->head = entry;
+	memo->num++;
+}
+
 /** Check to see if the expansion consists entirely of literal elements
  *
  * @param[in] exp	to check.
@@ -778,6 +894,31 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 				result_str = talloc_typed_strdup(NULL, "");
 			}
 
+			/*
+			 *	Pure functions may have already been
+			 *	expanded with this input in this
+			 *	request.
+			 */
+			if (node->xlat->pure) {
+				fr_value_box_t const *cached;
+
+				cached = xlat_memo_get(request, node->xlat, result_str);
+				if (cached) {
+					fr_cursor_t from;
+
+					xlat_debug_log_expansion(request, *in, *result);
+					if (fr_value_box_list_acopy(ctx, &value, cached) < 0) {
+						talloc_free(result_str);
+						return XLAT_ACTION_FAIL;
+					}
+					fr_cursor_init(&from, &value);
+					fr_cursor_merge(out, &from);
+					talloc_free(result_str);
+					xlat_debug_log_result(request, fr_cursor_current(out));
+					break;
+				}
+			}
+
 			if (node->xlat->buf_len > 0) {
 				str = talloc_array(ctx, char, node->xlat->buf_len);
 				str[0] = '\0';	/* Be sure the string is \0 terminated */
@@ -815,6 +956,7 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 			MEM(value = fr_value_box_alloc_null(ctx));
 			fr_value_box_bstrsteal(value, value, NULL, str, false);
 			fr_cursor_append(out, value);			/* Append the result of the expansion */
+			if (node->xlat->pure) xlat_memo_add(request, node->xlat, result_str, value);
 			talloc_free(result_str);
 			xlat_debug_log_result(request, value);
 		}
@@ -825,12 +967,46 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 			xlat_action_t		xa;
 			xlat_thread_inst_t	*thread_inst;
 			fr_value_box_t		*result_copy = NULL;
+			fr_value_box_t		*prev_tail = NULL;
+			char			*in_str = NULL;
 
 			thread_inst = xlat_thread_instance_find(node);
 
 			XLAT_DEBUG("** [%i] %s(func-async) - %%{%s:%pM}", unlang_interpret_stack_depth(request), __FUNCTION__,
 				   node->fmt, result);
 
+			/*
+			 *	Pure functions may have already been
+			 *	expanded with this input in this
+			 *	request.
+			 */
+			if (node->xlat->pure) {
+				in_str = *result ? fr_value_box_list_asprint(NULL, *result, NULL, '\0') :
+						   talloc_typed_strdup(NULL, "");
+				if (in_str) {
+					fr_value_box_t const *cached;
+
+					cached = xlat_memo_get(request, node->xlat, in_str);
+					if (cached) {
+						fr_value_box_t	*copy = NULL;
+						fr_cursor_t	from;
+
+						xlat_debug_log_expansion(request, *in, *result);
+						if (fr_value_box_list_acopy(ctx, &copy, cached) < 0) {
+							talloc_free(in_str);
+							return XLAT_ACTION_FAIL;
+						}
+						fr_cursor_init(&from, &copy);
+						fr_cursor_merge(out, &from);
+						talloc_free(in_str);
+						xlat_debug_log_result(request, fr_cursor_current(out));
+						break;
+					}
+
+					prev_tail = fr_cursor_tail(out);
+				}
+			}
+
 			/*
 			 *	Need to copy the input list in case
 			 *	the async function mucks with it.
@@ -847,19 +1023,37 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_cursor_t *out,
 			}
 			switch (xa) {
 			case XLAT_ACTION_FAIL:
+				talloc_free(in_str);
 				return xa;
 
 			case XLAT_ACTION_PUSH_CHILD:
 				RDEBUG2("   -- CHILD");
+				talloc_free(in_str);
 				return xa;
 
 			case XLAT_ACTION_YIELD:
 				RDEBUG2("   -- YIELD");
+				talloc_free(in_str);
 				return xa;
 
 			case XLAT_ACTION_DONE:				/* Process the result */
 				fr_cursor_next(out);
 				xlat_debug_log_result(request, fr_cursor_current(out));
+
+				/*
+				 *	Remember the boxes the function
+				 *	produced, so the next expansion
+				 *	with the same input doesn't need
+				 *	to recompute them.
+				 */
+				if (in_str) {
+					fr_value_box_t *produced;
+
+					produced = prev_tail ? prev_tail->next : fr_cursor_head(out);
+					if (produced) xlat_memo_add(request, node->xlat, in_str, produced);
+					fr_cursor_tail(out);
+					talloc_free(in_str);
+				}
 				break;
 			}
 			break;
@@ -1131,6 +1325,16 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			fr_cursor_free_list(&cursor);
 			return NULL;
 		}
+
+		/*
+		 *	The caller frees the returned buffer, so a
+		 *	value the cast stored inline in the (stack
+		 *	allocated) box has to be moved out first.
+		 */
+		if (fr_value_box_inline_spill(ctx, &string) < 0) {
+			fr_cursor_free_list(&cursor);
+			return NULL;
+		}
 		memcpy(&str, &string.vb_strvalue, sizeof(str));
 		fr_cursor_free_list(&cursor);
 		break;
@@ -1297,16 +1501,39 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			*q = '\0';
 		}
 
+		/*
+		 *	Pure functions may have already been expanded
+		 *	with this input in this request.
+		 */
+		if (node->xlat->pure) {
+			fr_value_box_t const *cached;
+
+			cached = xlat_memo_get(request, node->xlat, child);
+			if (cached) {
+				str = fr_value_box_list_asprint(ctx, cached, NULL, '\0');
+				talloc_free(child);
+				break;
+			}
+		}
+
 		if (node->xlat->buf_len > 0) {
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
 		slen = node->xlat->func.sync(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, child);
-		talloc_free(child);
 		if (slen < 0) {
+			talloc_free(child);
 			talloc_free(str);
 			return NULL;
 		}
+
+		if (node->xlat->pure && str) {
+			fr_value_box_t vb;
+
+			fr_value_box_strdup_shallow(&vb, NULL, str, false);
+			xlat_memo_add(request, node->xlat, child, &vb);
+		}
+		talloc_free(child);
 		break;
 
 #ifdef HAVE_REGEX
@@ -1476,34 +1703,66 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 static ssize_t _xlat_eval_compiled(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *request,
 				   xlat_exp_t const *node, xlat_escape_t escape, void const *escape_ctx)
 {
-	char *buff;
-	ssize_t len;
+	char		*buff;
+	ssize_t		len;
+	TALLOC_CTX	*pool;
+	size_t		pool_size, used;
+	xlat_exp_t	*mutable;
 
 	rad_assert(node != NULL);
 
-	len = xlat_process(ctx, &buff, request, node, escape, escape_ctx);
+	/*
+	 *	Intermediate expansion buffers are bump allocated out
+	 *	of a pool, and released in one operation, instead of
+	 *	churning the heap with one allocation per segment.
+	 *
+	 *	The pool is pre-sized from the high-water mark of
+	 *	previous evaluations of this node, so the common case
+	 *	never grows it.
+	 */
+	pool_size = node->pool_size;
+	if (!pool_size) pool_size = XLAT_DEFAULT_POOL_SIZE;
+	pool = talloc_pool(NULL, pool_size);
+	if (!pool) return -1;
+
+	len = xlat_process(pool, &buff, request, node, escape, escape_ctx);
 	if ((len < 0) || !buff) {
 		rad_assert(buff == NULL);
+		talloc_free(pool);
 		if (*out) **out = '\0';
 		return len;
 	}
 
 	len = strlen(buff);
 
+	/*
+	 *	Record the high-water mark, so the next evaluation of
+	 *	this node pre-sizes its pool.  The write is unlocked,
+	 *	but it's only a sizing hint, so the occasional lost
+	 *	update doesn't matter.
+	 */
+	used = talloc_total_size(pool);
+	if ((used > node->pool_size) && (used <= XLAT_MAX_POOL_SIZE)) {
+		memcpy(&mutable, &node, sizeof(mutable));
+		mutable->pool_size = used;
+	}
+
 	/*
 	 *	If out doesn't point to an existing buffer
-	 *	copy the pointer to our buffer over.
+	 *	copy the result out of the pool into one.
 	 */
 	if (!*out) {
-		*out = buff;
+		*out = talloc_bstrndup(ctx, buff, len);
+		talloc_free(pool);
+		if (!*out) return -1;
 		return len;
 	}
 
 	/*
-	 *	Otherwise copy the talloced buffer to the fixed one.
+	 *	Otherwise copy the pool buffer to the fixed one.
 	 */
 	strlcpy(*out, buff, outlen);
-	talloc_free(buff);
+	talloc_free(pool);
 	return len;
 }
 
@@ -61,6 +61,9 @@ typedef struct xlat_s {
 								///< is freed.
 
 	bool			internal;			//!< If true, cannot be redefined.
+	bool			pure;				//!< If true, the output depends only on the
+								///< input, and results may be memoized
+								///< within a request.
 
 	char const		*inst_type;			//!< C name of instance structure.
 	size_t			inst_size;			//!< Size of instance data to pre-allocate.
@@ -98,6 +101,9 @@ struct xlat_exp {
 	char const	*fmt;		//!< The original format string.
 	size_t		len;		//!< Length of the format string.
 
+	size_t		pool_size;	//!< High-water mark of expansion buffer memory used by
+					///< previous evaluations, used to pre-size the next one.
+
 	bool		async_safe;	//!< carried from all of the children
 
 	xlat_type_t	type;		//!< type of this expansion.
@@ -871,6 +871,72 @@ size_t xlat_snprint(char *out, size_t outlen, xlat_exp_t const *node)
 	return p - out;
 }
 
+/** Fold constants in a parsed xlat tree
+ *
+ *  Merges runs of adjacent literal nodes into single nodes, and
+ *  replaces alternations whose first branch is a non-empty literal
+ *  with the literal itself.  This shrinks the tree the evaluator has
+ *  to walk, and reduces the number of intermediate results produced
+ *  at runtime.  Run once at tokenization time, so the cost is paid at
+ *  compile, not per request.
+ */
+static void xlat_fold(xlat_exp_t **head)
+{
+	xlat_exp_t *node, **prev;
+
+	for (prev = head; (node = *prev) != NULL;) {
+		/*
+		 *	Fold nested expansions first, so that branches
+		 *	which reduce to literals can be folded here.
+		 */
+		if (node->child) xlat_fold(&node->child);
+
+		if (node->type == XLAT_ALTERNATE) {
+			if (node->alternate) xlat_fold(&node->alternate);
+
+			/*
+			 *	The first branch is a single non-empty
+			 *	literal, so the alternative can never
+			 *	be taken.  Replace the alternation
+			 *	with the literal.
+			 */
+			if (node->child && (node->child->type == XLAT_LITERAL) &&
+			    !node->child->next && (node->child->len > 0)) {
+				xlat_exp_t *child = node->child;
+
+				child->next = node->next;
+				node->next = NULL;
+				node->child = NULL;
+
+				*prev = talloc_steal(talloc_parent(node), child);
+				talloc_free(node);
+				node = *prev;
+			}
+		}
+
+		/*
+		 *	Merge runs of adjacent literals.
+		 */
+		while ((node->type == XLAT_LITERAL) &&
+		       node->next && (node->next->type == XLAT_LITERAL)) {
+			xlat_exp_t	*next = node->next;
+			char		*fmt;
+
+			fmt = talloc_typed_asprintf(node, "%s%s", node->fmt, next->fmt);
+			if (!fmt) break;
+
+			node->fmt = fmt;
+			node->len += next->len;
+
+			node->next = next->next;
+			next->next = NULL;
+			talloc_free(next);
+		}
+
+		prev = &node->next;
+	}
+}
+
 /** Tokenize an xlat expansion at runtime
  *
  * This is used for runtime parsing of xlat expansions, such as those we receive from datastores
@@ -924,6 +990,8 @@ ssize_t xlat_tokenize_ephemeral(TALLOC_CTX *ctx, xlat_exp_t **head, REQUEST *req
 		return slen;
 	}
 
+	if (*head) xlat_fold(head);
+
 	if (*head && RDEBUG_ENABLED3) {
 		RDEBUG3("%s", fmt);
 		RDEBUG3("Parsed xlat tree:");
@@ -970,6 +1038,8 @@ ssize_t xlat_tokenize(TALLOC_CTX *ctx, xlat_exp_t **head, char *fmt, vp_tmpl_rul
 	ret = xlat_tokenize_literal(ctx, head, fmt, false, rules);
 	if (ret < 0) return ret;
 
+	if (*head) xlat_fold(head);
+
 	/*
 	 *	Add nodes that need to be bootstrapped to
 	 *	the registry.
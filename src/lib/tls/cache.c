@@ -33,6 +33,9 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/unlang/base.h>
 
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
 #include "base.h"
 #include "missing.h"
 #include "attrs.h"
@@ -75,6 +78,122 @@ static int tls_cache_session_id_to_vp(REQUEST *request, uint8_t const *key, size
 	return 0;
 }
 
+/** An entry in the in-process first level session cache
+ *
+ */
+typedef struct {
+	uint8_t		key[SSL_MAX_SSL_SESSION_ID_LENGTH];	//!< Session ID.
+	size_t		key_len;				//!< Length of the session ID.
+	uint8_t		*blob;					//!< Serialised session.
+	size_t		blob_len;				//!< Length of the serialised session.
+	time_t		expires;				//!< When the entry becomes invalid.
+} tls_cache_local_entry_t;
+
+/** In-process first level session cache
+ *
+ * Avoids a full request cycle through the cache virtual server for
+ * sessions this process wrote itself.  The virtual server remains the
+ * authoritative store; this only short-circuits the common case of a
+ * client resuming against the same server that authenticated it.
+ */
+static rbtree_t		*tls_cache_local;
+static uint32_t		tls_cache_local_lifetime;
+static pthread_mutex_t	tls_cache_local_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int tls_cache_local_cmp(void const *one, void const *two)
+{
+	tls_cache_local_entry_t const *a = one, *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Store a serialised session in the local cache
+ *
+ */
+static void tls_cache_local_store(uint8_t const *key, size_t key_len, uint8_t const *blob, size_t blob_len)
+{
+	tls_cache_local_entry_t *entry;
+
+	if (!tls_cache_local || (key_len > SSL_MAX_SSL_SESSION_ID_LENGTH)) return;
+
+	entry = talloc_zero(NULL, tls_cache_local_entry_t);
+	if (!entry) return;
+
+	memcpy(entry->key, key, key_len);
+	entry->key_len = key_len;
+	entry->blob = talloc_memdup(entry, blob, blob_len);
+	if (!entry->blob) {
+		talloc_free(entry);
+		return;
+	}
+	entry->blob_len = blob_len;
+	entry->expires = time(NULL) + tls_cache_local_lifetime;
+
+	pthread_mutex_lock(&tls_cache_local_mutex);
+	if (!rbtree_insert(tls_cache_local, entry)) talloc_free(entry);	/* Replaced by racing thread */
+	pthread_mutex_unlock(&tls_cache_local_mutex);
+}
+
+/** Copy a serialised session out of the local cache
+ *
+ * @param[in] ctx	to allocate the returned blob in.
+ * @param[out] blob_len	length of the returned blob.
+ * @param[in] key	session ID to look up.
+ * @param[in] key_len	length of the session ID.
+ * @return
+ *	- The serialised session on success.
+ *	- NULL if not found, or the entry had expired.
+ */
+static uint8_t *tls_cache_local_load(TALLOC_CTX *ctx, size_t *blob_len, uint8_t const *key, size_t key_len)
+{
+	tls_cache_local_entry_t	find, *entry;
+	uint8_t			*blob = NULL;
+
+	if (!tls_cache_local || (key_len > SSL_MAX_SSL_SESSION_ID_LENGTH)) return NULL;
+
+	memcpy(find.key, key, key_len);
+	find.key_len = key_len;
+
+	pthread_mutex_lock(&tls_cache_local_mutex);
+	entry = rbtree_finddata(tls_cache_local, &find);
+	if (entry) {
+		if (entry->expires <= time(NULL)) {
+			rbtree_deletebydata(tls_cache_local, entry);
+			talloc_free(entry);
+		} else {
+			blob = talloc_memdup(ctx, entry->blob, entry->blob_len);
+			if (blob) *blob_len = entry->blob_len;
+		}
+	}
+	pthread_mutex_unlock(&tls_cache_local_mutex);
+
+	return blob;
+}
+
+/** Remove a session from the local cache
+ *
+ */
+static void tls_cache_local_remove(uint8_t const *key, size_t key_len)
+{
+	tls_cache_local_entry_t find, *entry;
+
+	if (!tls_cache_local || (key_len > SSL_MAX_SSL_SESSION_ID_LENGTH)) return;
+
+	memcpy(find.key, key, key_len);
+	find.key_len = key_len;
+
+	pthread_mutex_lock(&tls_cache_local_mutex);
+	entry = rbtree_finddata(tls_cache_local, &find);
+	if (entry) {
+		rbtree_deletebydata(tls_cache_local, entry);
+		talloc_free(entry);
+	}
+	pthread_mutex_unlock(&tls_cache_local_mutex);
+}
+
 /** Execute the virtual server configured to perform cache actions
  *
  * @param[in] request		The current request.
@@ -303,6 +422,15 @@ int tls_cache_write(REQUEST *request, tls_session_t *tls_session)
 		break;
 	}
 
+	/*
+	 *	Write through to the local cache, so resumption against
+	 *	this process doesn't need to consult the virtual server.
+	 */
+	if (ret == 0) tls_cache_local_store(tls_session->session_id,
+					    talloc_array_length(tls_session->session_id),
+					    tls_session->session_blob,
+					    talloc_array_length(tls_session->session_blob));
+
 	/*
 	 *	Ensure that the session data can't be used by anyone else.
 	 */
@@ -335,19 +463,32 @@ static SSL_SESSION *tls_cache_read(SSL *ssl,
 	REQUEST			*request;
 	unsigned char const	**p;
 	uint8_t const		*q;
-	VALUE_PAIR		*vp;
+	uint8_t const		*data;
+	size_t			data_len;
+	VALUE_PAIR		*vp = NULL;
 	SSL_SESSION		*sess;
 
 	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
 	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
 
+	*copy = 0;
+
+	/*
+	 *	Check the in-process cache first.  If this process wrote
+	 *	the session, we can skip the round trip through the
+	 *	virtual server entirely.
+	 */
+	data = tls_cache_local_load(request, &data_len, key, (size_t)key_len);
+	if (data) {
+		RDEBUG3("Found session data in local cache");
+		goto deserialize;
+	}
+
 	if (tls_cache_session_id_to_vp(request, key, key_len) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		return NULL;
 	}
 
-	*copy = 0;
-
 	/*
 	 *	Call the virtual server to read the session
 	 */
@@ -367,15 +508,19 @@ static SSL_SESSION *tls_cache_read(SSL *ssl,
 		return NULL;
 	}
 
-	q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+	data = vp->vp_octets;
+	data_len = vp->vp_length;
+
+deserialize:
+	q = data;	/* openssl will mutate q, so we can't use the stored data directly */
 	p = (unsigned char const **)&q;
 
-	sess = d2i_SSL_SESSION(NULL, p, vp->vp_length);
+	sess = d2i_SSL_SESSION(NULL, p, data_len);
 	if (!sess) {
 		RWDEBUG("Failed loading persisted session: %s", ERR_error_string(ERR_get_error(), NULL));
 		return NULL;
 	}
-	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", vp->vp_length);
+	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", data_len);
 
 	/*
 	 *	OpenSSL's API is very inconsistent.
@@ -407,7 +552,7 @@ static SSL_SESSION *tls_cache_read(SSL *ssl,
 	/*
 	 *	Ensure that the session data can't be used by anyone else.
 	 */
-	fr_pair_delete_by_da(&request->state, attr_tls_session_data);
+	if (vp) fr_pair_delete_by_da(&request->state, attr_tls_session_data);
 
 	return sess;
 }
@@ -443,6 +588,8 @@ static void tls_cache_delete(SSL_CTX *ctx, SSL_SESSION *sess)
 		return;
 	}
 
+	tls_cache_local_remove(key, (size_t)key_len);
+
 	if (tls_cache_session_id_to_vp(request, key, (size_t)key_len) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		goto error;
@@ -549,6 +696,128 @@ int tls_cache_disable_cb(SSL *ssl,
 	return 0;
 }
 
+/** A key used to encrypt and authenticate RFC 5077 session tickets
+ *
+ */
+typedef struct {
+	uint8_t		name[16];		//!< Random name identifying the key in the ticket.
+	uint8_t		aes_key[32];		//!< Key used to encrypt the session ticket.
+	uint8_t		hmac_key[32];		//!< Key used to authenticate the session ticket.
+	time_t		expires;		//!< When we stop encrypting new tickets with this key.
+} tls_ticket_key_t;
+
+/** Keys for encrypting RFC 5077 session tickets
+ *
+ * Tickets mean we keep no session state server side, so the keys are
+ * the only long lived secret.  New tickets are encrypted with the
+ * current key, and tickets encrypted with the previous key continue
+ * to be accepted for one rotation period, so a key change doesn't
+ * force every client through a full handshake simultaneously.
+ */
+static tls_ticket_key_t	tls_ticket_key_current;
+static tls_ticket_key_t	tls_ticket_key_previous;
+static bool		tls_ticket_key_have_previous;
+static uint32_t		tls_ticket_key_lifetime;
+static pthread_mutex_t	tls_ticket_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Fill a ticket key with fresh random material
+ *
+ * @note Must be called with #tls_ticket_mutex held.
+ *
+ * @param[out] key to (re-)generate.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the PRNG failed.
+ */
+static int tls_ticket_key_generate(tls_ticket_key_t *key)
+{
+	if ((RAND_bytes(key->name, sizeof(key->name)) != 1) ||
+	    (RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1) ||
+	    (RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1)) {
+		tls_log_error(NULL, "Failed generating session ticket key");
+		return -1;
+	}
+	key->expires = time(NULL) + tls_ticket_key_lifetime;
+
+	return 0;
+}
+
+/** Encrypt or decrypt a RFC 5077 session ticket
+ *
+ * Called by OpenSSL when a new session ticket is issued (enc is one),
+ * and when a client presents a ticket for resumption (enc is zero).
+ *
+ * @param[in] ssl		session state.  Unused.
+ * @param[in,out] name		of the key the ticket was encrypted with.
+ * @param[in,out] iv		for the ticket cipher.
+ * @param[in] evp_ctx		to initialise with the ticket cipher.
+ * @param[in] hmac_ctx		to initialise with the ticket digest.
+ * @param[in] enc		non-zero if we're encrypting a new ticket.
+ * @return
+ *	- 2 ticket was decrypted with the previous key, and should be reissued.
+ *	- 1 on success.
+ *	- 0 if the key the ticket was encrypted with is no longer available.
+ *	- -1 on error.
+ */
+static int tls_ticket_key_cb(UNUSED SSL *ssl, uint8_t *name, uint8_t *iv,
+			     EVP_CIPHER_CTX *evp_ctx, HMAC_CTX *hmac_ctx, int enc)
+{
+	tls_ticket_key_t	key;
+	int			ret = 1;
+
+	pthread_mutex_lock(&tls_ticket_mutex);
+	if (enc) {
+		/*
+		 *	Rotate to a fresh key once the current one's
+		 *	encryption lifetime is up.  Tickets issued under
+		 *	the previous key remain valid for one more
+		 *	rotation period.
+		 */
+		if (tls_ticket_key_current.expires <= time(NULL)) {
+			tls_ticket_key_previous = tls_ticket_key_current;
+			tls_ticket_key_have_previous = true;
+
+			if (tls_ticket_key_generate(&tls_ticket_key_current) < 0) {
+				pthread_mutex_unlock(&tls_ticket_mutex);
+				return -1;
+			}
+		}
+		key = tls_ticket_key_current;
+	} else {
+		if (memcmp(name, tls_ticket_key_current.name, sizeof(tls_ticket_key_current.name)) == 0) {
+			key = tls_ticket_key_current;
+		} else if (tls_ticket_key_have_previous &&
+			   (memcmp(name, tls_ticket_key_previous.name,
+				   sizeof(tls_ticket_key_previous.name)) == 0)) {
+			key = tls_ticket_key_previous;
+			ret = 2;	/* Valid, but have OpenSSL reissue under the current key */
+		} else {
+			/*
+			 *	Not one of our keys.  Fall back to a
+			 *	full handshake.
+			 */
+			pthread_mutex_unlock(&tls_ticket_mutex);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&tls_ticket_mutex);
+
+	if (enc) {
+		memcpy(name, key.name, sizeof(key.name));
+
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+			tls_log_error(NULL, "Failed generating session ticket IV");
+			return -1;
+		}
+		if (EVP_EncryptInit_ex(evp_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) return -1;
+	} else {
+		if (EVP_DecryptInit_ex(evp_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) return -1;
+	}
+	if (HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL) != 1) return -1;
+
+	return ret;
+}
+
 /** Sets callbacks on a SSL_CTX to enable/disable session resumption
  *
  * @param ctx			to modify.
@@ -580,11 +849,71 @@ void tls_cache_init(SSL_CTX *ctx, bool enabled, uint32_t lifetime)
 	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
 	SSL_CTX_set_timeout(ctx, lifetime);
 
+	/*
+	 *	First level in-process cache, checked before calling out
+	 *	to the virtual server.  The virtual server remains the
+	 *	authoritative store.
+	 */
+	if (!tls_cache_local) tls_cache_local = rbtree_talloc_create(NULL, tls_cache_local_cmp,
+								     tls_cache_local_entry_t, NULL,
+								     RBTREE_FLAG_NONE);
+	tls_cache_local_lifetime = lifetime;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	SSL_CTX_set_num_tickets(ctx, 1);
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_CTX_set_not_resumable_session_callback(ctx, tls_cache_disable_cb);
+#endif
+}
+
+/** Sets callbacks on a SSL_CTX to issue stateless RFC 5077 session tickets
+ *
+ * No session data is kept server side.  The session is serialised into
+ * the ticket, encrypted under keys only we hold, and presented back to
+ * us by the client on resumption.
+ *
+ * The ticket keys are shared by all SSL_CTXs configured for tickets, so
+ * a session may be resumed by any thread, regardless of which context
+ * issued it.
+ *
+ * @param ctx		to modify.
+ * @param key_lifetime	How often the key used to encrypt new tickets
+ *			is rotated.
+ * @param lifetime	The maximum period a session can be resumed after.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_tickets_init(SSL_CTX *ctx, uint32_t key_lifetime, uint32_t lifetime)
+{
+	pthread_mutex_lock(&tls_ticket_mutex);
+	tls_ticket_key_lifetime = key_lifetime;
+	if (!tls_ticket_key_current.expires && (tls_ticket_key_generate(&tls_ticket_key_current) < 0)) {
+		pthread_mutex_unlock(&tls_ticket_mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&tls_ticket_mutex);
+
+	if (SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_ticket_key_cb) != 1) {
+		tls_log_error(NULL, "Failed setting session ticket callback");
+		return -1;
+	}
+
+	/*
+	 *	Tickets are the only resumption mechanism, the session
+	 *	cache (internal and external) stays disabled.
+	 */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_timeout(ctx, lifetime);
+
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L
 	SSL_CTX_set_num_tickets(ctx, 1);
 #endif
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	SSL_CTX_set_not_resumable_session_callback(ctx, tls_cache_disable_cb);
 #endif
+
+	return 0;
 }
 #endif /* WITH_TLS */
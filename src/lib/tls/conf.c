@@ -72,6 +72,9 @@ static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("lifetime", FR_TYPE_UINT32, fr_tls_conf_t, session_cache_lifetime), .dflt = "86400" },
 	{ FR_CONF_OFFSET("verify", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_verify), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("use_tickets", FR_TYPE_BOOL, fr_tls_conf_t, session_tickets), .dflt = "no" },
+	{ FR_CONF_OFFSET("ticket_key_lifetime", FR_TYPE_UINT32, fr_tls_conf_t, session_ticket_key_lifetime), .dflt = "86400" },
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	{ FR_CONF_OFFSET("require_extended_master_secret", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_require_extms), .dflt = "yes" },
 	{ FR_CONF_OFFSET("require_perfect_forward_secrecy", FR_TYPE_BOOL, fr_tls_conf_t, session_cache_require_pfs), .dflt = "no" },
@@ -102,6 +105,9 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, cache_responses), .dflt = "yes" },
+	{ FR_CONF_OFFSET("cache_max_entries", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "1024" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -479,6 +485,15 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 		goto error;
 	}
 
+	/*
+	 *	Session tickets leave no state server side, so there's
+	 *	nothing for a cache virtual server to act on.
+	 */
+	if (conf->session_tickets && conf->session_cache_server) {
+		ERROR("\"use_tickets\" and the session cache \"virtual_server\" are mutually exclusive");
+		goto error;
+	}
+
 	if (conf->session_cache_server) {
 		CONF_SECTION *server_cs;
 
@@ -668,8 +668,12 @@ post_ca:
 	}
 #endif
 
+	/*
+	 *	Stateless tickets must be explicitly enabled, otherwise
+	 *	we refuse to issue them at all.
+	 */
 #ifdef SSL_OP_NO_TICKET
-	ctx_options |= SSL_OP_NO_TICKET;
+	if (!conf->session_tickets) ctx_options |= SSL_OP_NO_TICKET;
 #endif
 
 	if (!conf->disable_single_dh_use) {
@@ -832,9 +836,15 @@ post_ca:
 #endif
 
 	/*
-	 *	Setup session caching
+	 *	Setup session caching, or stateless session tickets.
 	 */
-	tls_cache_init(ctx, conf->session_cache_server ? true : false, conf->session_cache_lifetime);
+	if (conf->session_tickets) {
+		if (tls_tickets_init(ctx, conf->session_ticket_key_lifetime, conf->session_cache_lifetime) < 0) {
+			goto error;
+		}
+	} else {
+		tls_cache_init(ctx, conf->session_cache_server ? true : false, conf->session_cache_lifetime);
+	}
 
 	return ctx;
 }
@@ -29,6 +29,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #ifdef HAVE_OPENSSL_OCSP_H
 #define LOG_PREFIX "tls - ocsp - "
 
+#include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/server/rad_assert.h>
@@ -57,6 +58,266 @@ typedef enum {
  */
 #define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
 
+/** Maximum serial number length we'll cache responses for
+ *
+ * RFC 5280 limits serial numbers to 20 octets, but not all CAs comply.
+ */
+#define OCSP_CACHE_SERIAL_MAX (32)
+
+/** An entry in the in-process OCSP response cache
+ *
+ */
+typedef struct {
+	unsigned long	issuer_hash;			//!< X509_issuer_name_hash() of the certificate.
+	uint8_t		serial[OCSP_CACHE_SERIAL_MAX];	//!< Serial number of the certificate.
+	size_t		serial_len;			//!< Length of the serial number.
+	int		cert_status;			//!< V_OCSP_CERTSTATUS_*
+	uint8_t		*resp_der;			//!< DER encoded response, for stapling.
+	size_t		resp_der_len;			//!< Length of the DER encoded response.
+	time_t		expires;			//!< nextUpdate time of the response.
+	time_t		refresh_at;			//!< When we start re-querying the responder.
+	bool		refreshing;			//!< A thread is re-querying the responder.
+} tls_ocsp_cache_entry_t;
+
+/** In-process OCSP response cache
+ *
+ * Definitive responses (good/revoked) are cached until their nextUpdate
+ * time.  Once a response is past its refresh point the next handshake
+ * which hits it re-queries the responder, whilst other handshakes
+ * continue to be served from the cache.  Handshakes therefore only wait
+ * on the responder for certificates we've never seen before.
+ */
+static rbtree_t		*ocsp_cache;
+static pthread_mutex_t	ocsp_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int ocsp_cache_cmp(void const *one, void const *two)
+{
+	tls_ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->issuer_hash < b->issuer_hash) return -1;
+	if (a->issuer_hash > b->issuer_hash) return +1;
+
+	if (a->serial_len < b->serial_len) return -1;
+	if (a->serial_len > b->serial_len) return +1;
+
+	return memcmp(a->serial, b->serial, a->serial_len);
+}
+
+/** Fill in the cache key for a certificate
+ *
+ * @param[out] key	to populate.
+ * @param[in] cert	to extract the issuer hash and serial number from.
+ * @return
+ *	- true if the key was populated.
+ *	- false if the serial number was too long to cache.
+ */
+static bool ocsp_cache_key(tls_ocsp_cache_entry_t *key, X509 *cert)
+{
+	ASN1_INTEGER	*serial;
+
+	serial = X509_get_serialNumber(cert);
+	if (!serial || (serial->length <= 0) || ((size_t)serial->length > sizeof(key->serial))) return false;
+
+	memset(key, 0, sizeof(*key));
+	key->issuer_hash = X509_issuer_name_hash(cert);
+	memcpy(key->serial, serial->data, serial->length);
+	key->serial_len = serial->length;
+
+	return true;
+}
+
+static int _ocsp_cache_entry_expire(void *data, void *uctx)
+{
+	tls_ocsp_cache_entry_t	*entry = talloc_get_type_abort(data, tls_ocsp_cache_entry_t);
+	time_t			now = *((time_t *)uctx);
+
+	if (entry->expires > now) return 0;
+
+	talloc_free(entry);
+	return 2;
+}
+
+/** Record the result of an OCSP check in the response cache
+ *
+ * Only definitive results (good/revoked) with a nextUpdate time are
+ * cached.  If the check failed, any existing entry is left in place and
+ * its refresh point pushed back, so we don't hammer a broken responder.
+ *
+ * @param[in] conf	OCSP configuration.
+ * @param[in] key	identifying the certificate checked.
+ * @param[in] cert_status V_OCSP_CERTSTATUS_* from the response, or -1 if
+ *			the check failed.
+ * @param[in] resp	the response (may be NULL on failure).
+ * @param[in] next_update nextUpdate time of the response (0 if none).
+ */
+static void ocsp_cache_store(fr_tls_ocsp_conf_t *conf, tls_ocsp_cache_entry_t const *key,
+			     int cert_status, OCSP_RESPONSE *resp, time_t next_update)
+{
+	tls_ocsp_cache_entry_t	*entry;
+	time_t			now = time(NULL);
+
+	pthread_mutex_lock(&ocsp_cache_mutex);
+	if (!ocsp_cache) ocsp_cache = rbtree_talloc_create(NULL, ocsp_cache_cmp,
+							   tls_ocsp_cache_entry_t, NULL,
+							   RBTREE_FLAG_NONE);
+	if (!ocsp_cache) goto done;
+
+	entry = rbtree_finddata(ocsp_cache, key);
+
+	/*
+	 *	The check didn't produce a definitive answer.  Clear the
+	 *	refresh marker so another handshake will retry, but not
+	 *	immediately.
+	 */
+	if ((cert_status != V_OCSP_CERTSTATUS_GOOD) && (cert_status != V_OCSP_CERTSTATUS_REVOKED)) {
+		if (entry) {
+			entry->refreshing = false;
+			if (entry->refresh_at <= now) entry->refresh_at = now + 60;
+		}
+		goto done;
+	}
+
+	/*
+	 *	Without a nextUpdate time we don't know how long the
+	 *	response is good for, so we can't cache it.
+	 */
+	if (next_update <= now) {
+		if (entry) {
+			rbtree_deletebydata(ocsp_cache, entry);
+			talloc_free(entry);
+		}
+		goto done;
+	}
+
+	if (entry) {
+		rbtree_deletebydata(ocsp_cache, entry);
+		talloc_free(entry);
+	}
+
+	/*
+	 *	If we're at capacity, evict anything which has expired.
+	 *	If everything is still valid, don't cache this response.
+	 */
+	if (conf->cache_max_entries && (rbtree_num_elements(ocsp_cache) >= conf->cache_max_entries)) {
+		rbtree_walk(ocsp_cache, RBTREE_DELETE_ORDER, _ocsp_cache_entry_expire, &now);
+		if (rbtree_num_elements(ocsp_cache) >= conf->cache_max_entries) goto done;
+	}
+
+	entry = talloc_zero(NULL, tls_ocsp_cache_entry_t);
+	if (!entry) goto done;
+
+	memcpy(entry, key, sizeof(*entry));
+	entry->cert_status = cert_status;
+	entry->expires = next_update;
+	entry->refresh_at = now + ((next_update - now) / 2);	/* Refresh halfway through the validity period */
+	entry->refreshing = false;
+
+	if (resp) {
+		size_t	len;
+		uint8_t	*p;
+
+		len = i2d_OCSP_RESPONSE(resp, NULL);
+		if (len > 0) {
+			entry->resp_der = p = talloc_array(entry, uint8_t, len);
+			if (entry->resp_der && ((size_t)i2d_OCSP_RESPONSE(resp, &p) == len)) {
+				entry->resp_der_len = len;
+			} else {
+				TALLOC_FREE(entry->resp_der);
+			}
+		}
+	}
+
+	if (!rbtree_insert(ocsp_cache, entry)) talloc_free(entry);	/* Replaced by racing thread */
+
+done:
+	pthread_mutex_unlock(&ocsp_cache_mutex);
+}
+
+/** Attempt to answer an OCSP check from the response cache
+ *
+ * @param[in] request	The current request.
+ * @param[in] ssl	The current SSL session, for stapling.
+ * @param[in] key	identifying the certificate being checked.
+ * @param[in] staple_response whether the response needs to be stapled.
+ * @return
+ *	- -1 on cache miss, or if the entry needs refreshing (caller
+ *	  should perform a full check).
+ *	- OCSP_STATUS_OK if the cached response says the cert is good.
+ *	- OCSP_STATUS_FAILED if the cached response says it's revoked.
+ */
+static int ocsp_cache_load(REQUEST *request, SSL *ssl, tls_ocsp_cache_entry_t const *key, bool staple_response)
+{
+	tls_ocsp_cache_entry_t	*entry;
+	VALUE_PAIR		*vp;
+	int			cert_status;
+	uint8_t			*resp_der = NULL;
+	size_t			resp_der_len = 0;
+	time_t			now = time(NULL);
+
+	if (!ocsp_cache) return -1;
+
+	pthread_mutex_lock(&ocsp_cache_mutex);
+	entry = rbtree_finddata(ocsp_cache, key);
+	if (!entry || (entry->expires <= now)) {
+	miss:
+		if (entry) {
+			rbtree_deletebydata(ocsp_cache, entry);
+			talloc_free(entry);
+		}
+		pthread_mutex_unlock(&ocsp_cache_mutex);
+		return -1;
+	}
+
+	/*
+	 *	Still valid, but due for a refresh.  The first handshake
+	 *	past the refresh point does the work, everyone else keeps
+	 *	being served from the cache.
+	 */
+	if ((entry->refresh_at <= now) && !entry->refreshing) {
+		entry->refreshing = true;
+		pthread_mutex_unlock(&ocsp_cache_mutex);
+		RDEBUG2("Cached OCSP response approaching nextUpdate, refreshing");
+		return -1;
+	}
+
+	/*
+	 *	If we need to staple and didn't keep the response,
+	 *	we have to do the full check.
+	 */
+	if (staple_response && !entry->resp_der) goto miss;
+
+	cert_status = entry->cert_status;
+	if (staple_response) {
+		resp_der = talloc_memdup(request, entry->resp_der, entry->resp_der_len);
+		if (!resp_der) goto miss;
+		resp_der_len = entry->resp_der_len;
+	}
+	pthread_mutex_unlock(&ocsp_cache_mutex);
+
+	if (cert_status != V_OCSP_CERTSTATUS_GOOD) {
+		REDEBUG("Cached OCSP response: cert status: %s", OCSP_cert_status_str(cert_status));
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 0;	/* no */
+		return OCSP_STATUS_FAILED;
+	}
+
+	RDEBUG2("Cached OCSP response: cert status: good");
+
+	if (staple_response) {
+		MEM(pair_update_request(&vp, attr_tls_ocsp_response) >= 0);
+		fr_pair_value_memsteal(vp, resp_der, true);
+		if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+			RWDEBUG("Failed setting OCSP staple response in SSL session");
+			return -1;
+		}
+	}
+
+	MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+	vp->vp_uint32 = 1;	/* yes */
+
+	return OCSP_STATUS_OK;
+}
+
 /** Extract components of OCSP responser URL from a certificate
  *
  * @param[in] cert to extract URL from.
@@ -354,6 +615,11 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	fr_time_t	start;
 	VALUE_PAIR	*vp;
 
+	tls_ocsp_cache_entry_t	cache_key;
+	bool		cache_key_valid = false;
+	int		cert_status = -1;
+	time_t		next_update_time = 0;
+
 	if (conf->cache_server) switch (tls_cache_process(request, conf->cache.load)) {
 	case RLM_MODULE_REJECT:
 		REDEBUG("Told to force OCSP validation failure from cached response");
@@ -413,6 +679,20 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		break;
 	}
 
+	/*
+	 *	Check the in-process response cache before doing
+	 *	anything expensive.
+	 */
+	if (conf->cache_responses && client_cert) {
+		cache_key_valid = ocsp_cache_key(&cache_key, client_cert);
+		if (cache_key_valid) {
+			int cached;
+
+			cached = ocsp_cache_load(request, ssl, &cache_key, staple_response);
+			if (cached >= 0) return cached;
+		}
+	}
+
 	if (issuer_cert == NULL) {
 		RWDEBUG("Could not get issuer certificate");
 		goto skipped;
@@ -621,6 +901,7 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 			ocsp_status = OCSP_STATUS_SKIPPED;
 			goto finish;
 		}
+		next_update_time = next;
 		if (fr_time_to_sec(now) < next){
 			RDEBUG2("Adding OCSP TTL attribute");
 
@@ -636,6 +917,8 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		RDEBUG2("Update time not provided.  Not adding &TLS-OCSP-Next-Update");
 	}
 
+	cert_status = status;
+
 	switch (status) {
 	case V_OCSP_CERTSTATUS_GOOD:
 		RDEBUG2("Cert status: good");
@@ -726,6 +1009,14 @@ finish:
 		break;
 	}
 
+	/*
+	 *	Update the in-process response cache with what we learnt,
+	 *	so subsequent handshakes don't wait on the responder.
+	 */
+	if (conf->cache_responses && cache_key_valid) {
+		ocsp_cache_store(conf, &cache_key, cert_status, resp, next_update_time);
+	}
+
 	/* Free OCSP Stuff */
 	OCSP_REQUEST_free(req);
 	OCSP_BASICRESP_free(bresp);
@@ -1077,7 +1077,7 @@ int tls_session_pairs_from_x509_cert(fr_cursor_t *cursor, TALLOC_CTX *ctx,
 
 				value[len] = '\0';
 
-				da = fr_dict_attr_by_name(dict_freeradius, attribute);
+				da = fr_dict_attr_by_name_cached(dict_freeradius, attribute);
 				if (!da) {
 					RWDEBUG3("Skipping attribute %s: "
 						 "Add dictionary definition if you want to access it", attribute);
@@ -1838,7 +1838,7 @@ tls_session_t *tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *conf, REQ
 		session->mtu = vp->vp_uint32;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_tickets) session->allow_session_resumption = true; /* otherwise it's false */
 
 	tls_session_request_unbind(session->ssl);
 
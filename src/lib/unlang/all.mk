@@ -9,6 +9,7 @@ SOURCES	:=	base.c \
 		group.c \
 		interpret.c \
 		io.c \
+		limit.c \
 		load_balance.c \
 		map.c \
 		module.c \
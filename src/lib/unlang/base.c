@@ -77,6 +77,7 @@ int unlang_init(void)
 	unlang_foreach_init();
 	unlang_function_init();
 	unlang_group_init();
+	unlang_limit_init();
 	unlang_load_balance_init();
 	unlang_map_init();
 	unlang_module_init();
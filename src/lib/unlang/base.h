@@ -23,6 +23,8 @@
  *
  * @copyright 2016-2019 The FreeRADIUS server project
  */
+#include <stdio.h>
+
 #include <freeradius-devel/unlang/compile.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/module.h>
@@ -36,6 +38,10 @@ bool		unlang_section(CONF_SECTION *cs);
 
 void		unlang_register(int type, unlang_op_t *op);
 
+void		unlang_profile_enable(bool enable);
+
+void		unlang_profile_fprint(FILE *fp, CONF_SECTION *cs);
+
 int		unlang_init(void);
 
 void		unlang_free(void);
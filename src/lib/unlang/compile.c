@@ -2103,6 +2103,68 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 	return compile_section(parent, unlang_ctx, cs, UNLANG_TYPE_GROUP);
 }
 
+/** Compare the values of two 'case' statements
+ *
+ * May be called with a stack-based probe, so we can't talloc_get_type_abort
+ * the arguments.
+ */
+static int case_cmp(void const *one, void const *two)
+{
+	unlang_group_t const *a = one, *b = two;
+
+	return fr_value_box_cmp(&a->vpt->tmpl_value, &b->vpt->tmpl_value);
+}
+
+/** Build a dispatch table for a 'switch' section where all case values are literals
+ *
+ * The interpreter normally evaluates each 'case' statement in turn, which
+ * is O(n) in the number of cases.  When we're switching over an attribute
+ * and every case value was parsed (and cast) to data at compile time, we
+ * can match by value instead, turning dispatch into a tree lookup.
+ *
+ * Best effort.  If any case value needs runtime evaluation we leave
+ * g->case_tree NULL, and the interpreter falls back to the linear scan.
+ */
+static void compile_switch_dispatch(unlang_group_t *g)
+{
+	unlang_t	*this;
+	rbtree_t	*tree;
+
+	if (!tmpl_is_attr(g->vpt)) return;
+
+	for (this = g->children; this; this = this->next) {
+		unlang_group_t *h;
+
+		rad_assert(this->type == UNLANG_TYPE_CASE);
+
+		h = unlang_generic_to_group(this);
+		if (!h->vpt) continue;		/* default case */
+
+		if (!tmpl_is_data(h->vpt)) return;
+		if (h->vpt->tmpl_value_type != g->vpt->tmpl_da->type) return;
+	}
+
+	tree = rbtree_create(g, case_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!tree) return;
+
+	for (this = g->children; this; this = this->next) {
+		unlang_group_t *h = unlang_generic_to_group(this);
+
+		if (!h->vpt) {
+			if (!g->case_default) g->case_default = this;
+			continue;
+		}
+
+		/*
+		 *	Duplicate case values.  The first one wins,
+		 *	matching the behaviour of the linear scan.
+		 */
+		if (!rbtree_insert(tree, h)) continue;
+	}
+
+	g->case_tree = tree;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	CONF_ITEM *ci;
@@ -2212,7 +2274,12 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx);
+	c = compile_children(g, parent, unlang_ctx);
+	if (!c) return NULL;
+
+	compile_switch_dispatch(g);
+
+	return c;
 }
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
@@ -2335,6 +2402,162 @@ static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 	return c;
 }
 
+static unlang_t *compile_limit(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
+{
+	char const	*name2, *rate_str;
+	char		*end;
+	FR_TOKEN	type;
+	unlang_group_t	*g;
+	unlang_t	*c;
+	ssize_t		slen;
+	unsigned long	rate, burst;
+
+	vp_tmpl_rules_t	parse_rules;
+
+	/*
+	 *	We allow unknown attributes here.
+	 */
+	parse_rules = *(unlang_ctx->rules);
+	parse_rules.allow_unknown = true;
+
+	name2 = cf_section_name2(cs);
+	if (!name2) {
+		cf_log_err(cs, "You must specify a key to rate limit on, e.g. 'limit &NAS-IP-Address 100 { ... }'");
+		return NULL;
+	}
+
+	rate_str = cf_section_argv(cs, 0);
+	if (!rate_str) {
+		cf_log_err(cs, "You must specify a rate, e.g. 'limit &NAS-IP-Address 100 { ... }'");
+		return NULL;
+	}
+
+	rate = strtoul(rate_str, &end, 10);
+	if ((rate == 0) || (rate > UINT32_MAX) || (*end && (*end != '/'))) {
+	invalid_rate:
+		cf_log_err(cs, "Invalid rate \"%s\", must be 'packets-per-second[/burst]'", rate_str);
+		return NULL;
+	}
+
+	/*
+	 *	The default burst is one second's worth of packets.
+	 */
+	burst = rate;
+	if (*end == '/') {
+		burst = strtoul(end + 1, &end, 10);
+		if ((burst == 0) || (burst > UINT32_MAX) || (*end != '\0')) goto invalid_rate;
+	}
+
+	g = group_allocate(parent, cs, UNLANG_TYPE_LIMIT);
+	if (!g) return NULL;
+
+	type = cf_section_name2_quote(cs);
+	slen = tmpl_afrom_str(g, &g->vpt, name2, strlen(name2), type, &parse_rules, true);
+	if (slen < 0) {
+		char *spaces, *text;
+
+		fr_canonicalize_error(cs, &spaces, &text, slen, fr_strerror());
+
+		cf_log_err(cs, "Syntax error");
+		cf_log_err(cs, "%s", name2);
+		cf_log_err(cs, "%s^ %s", spaces, text);
+
+		talloc_free(g);
+		talloc_free(spaces);
+		talloc_free(text);
+
+		return NULL;
+	}
+
+	g->rate = rate;
+	g->burst = burst;
+
+	if (unlang_limit_instance_init(g) < 0) {
+		cf_log_err(cs, "Failed initialising token buckets");
+		talloc_free(g);
+		return NULL;
+	}
+
+	c = unlang_group_to_generic(g);
+	c->name = "limit";
+	c->debug_name = talloc_typed_asprintf(c, "limit %s %s", name2, rate_str);
+
+	if (!pass2_fixup_tmpl(cf_section_to_item(g->cs), &g->vpt, unlang_ctx->rules, true)) {
+		talloc_free(g);
+		return NULL;
+	}
+
+	return compile_children(g, parent, unlang_ctx);
+}
+
+/** Check whether a foreach body can safely iterate over the live pair list
+ *
+ * The body must consist only of flow control keywords, and update
+ * sections which don't write to the list being iterated over.  Module
+ * calls, subrequests, map sections, etc. can all modify arbitrary pair
+ * lists, so any of them forces the interpreter to take a snapshot copy
+ * of the matched pairs before looping.
+ *
+ * @param[in] c		first statement of the body.
+ * @param[in] vpt	list or attribute the loop iterates over.
+ * @return true if the body provably can't modify the iterated list.
+ */
+static bool foreach_is_inplace_safe(unlang_t *c, vp_tmpl_t const *vpt)
+{
+	for (; c != NULL; c = c->next) {
+		unlang_group_t *g;
+
+		switch (c->type) {
+		case UNLANG_TYPE_BREAK:
+		case UNLANG_TYPE_RETURN:
+			continue;
+
+		case UNLANG_TYPE_GROUP:
+		case UNLANG_TYPE_IF:
+		case UNLANG_TYPE_ELSE:
+		case UNLANG_TYPE_ELSIF:
+		case UNLANG_TYPE_SWITCH:
+		case UNLANG_TYPE_CASE:
+		case UNLANG_TYPE_FOREACH:
+		case UNLANG_TYPE_POLICY:
+			g = unlang_generic_to_group(c);
+			if (!foreach_is_inplace_safe(g->children, vpt)) return false;
+			continue;
+
+		case UNLANG_TYPE_UPDATE:
+		{
+			vp_map_t *map;
+
+			g = unlang_generic_to_group(c);
+			for (map = g->map; map != NULL; map = map->next) {
+				vp_tmpl_t const *lhs = map->lhs;
+
+				/*
+				 *	Unresolved attributes are fixed
+				 *	up in pass2, after us.  Play it
+				 *	safe and take the copy.
+				 */
+				if (!lhs || (!tmpl_is_attr(lhs) && !tmpl_is_list(lhs))) return false;
+
+				/*
+				 *	Writing to the list we're
+				 *	iterating over would invalidate
+				 *	the iterator.
+				 */
+				if ((lhs->tmpl_request == vpt->tmpl_request) &&
+				    (lhs->tmpl_list == vpt->tmpl_list)) return false;
+			}
+			continue;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static unlang_t *compile_foreach(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	FR_TOKEN		type;
@@ -2422,6 +2645,13 @@ static unlang_t *compile_foreach(unlang_t *parent, unlang_compile_t *unlang_ctx,
 	g = unlang_generic_to_group(c);
 	g->vpt = vpt;
 
+	/*
+	 *	If the body provably can't modify the list, the
+	 *	interpreter iterates over the live pairs instead of
+	 *	snapshotting them.
+	 */
+	g->inplace = foreach_is_inplace_safe(g->children, vpt);
+
 	return c;
 }
 
@@ -2812,6 +3042,24 @@ static unlang_t *compile_load_balance_subsection(unlang_t *parent, unlang_compil
 		case TMPL_TYPE_EXEC:
 			break;
 		}
+
+		/*
+		 *	Keys which hash are mapped through a
+		 *	consistent-hash ring.  Integer attributes
+		 *	index the children directly, and the admin is
+		 *	responsible for their stability.
+		 */
+		if (!(tmpl_is_attr(g->vpt) &&
+		      ((g->vpt->tmpl_da->type == FR_TYPE_UINT8) ||
+		       (g->vpt->tmpl_da->type == FR_TYPE_UINT16) ||
+		       (g->vpt->tmpl_da->type == FR_TYPE_UINT32) ||
+		       (g->vpt->tmpl_da->type == FR_TYPE_UINT64)))) {
+			if (unlang_load_balance_ring_build(g) < 0) {
+				cf_log_err(cs, "Failed building load-balance ring");
+				talloc_free(g);
+				return NULL;
+			}
+		}
 	}
 
 	return c;
@@ -3214,6 +3462,7 @@ static unlang_t *compile_module(unlang_t *parent, unlang_compile_t *unlang_ctx,
 
 	single = talloc_zero(parent, unlang_module_t);
 	single->module_instance = inst;
+	single->mod_inst = inst->dl_inst->data;
 	single->method = method;
 
 	c = unlang_module_to_generic(single);
@@ -3255,6 +3504,7 @@ static unlang_compile_table_t compile_table[] = {
 	{ "update",		compile_update },
 	{ "map",		compile_map },
 	{ "switch",		compile_switch },
+	{ "limit",		compile_limit },
 	{ "parallel",		compile_parallel },
 	{ "subrequest",		compile_subrequest },
 	{ "call",		compile_call },
@@ -3274,6 +3524,82 @@ static unlang_compile_table_t compile_table[] = {
 	unlang_ctx2.section_name2 = unlang_ctx->section_name2; \
 	unlang_ctx2.rules = unlang_ctx->rules
 
+/** Compile a policy section once, and share the result between references
+ *
+ *	Policies are usually referenced from many places in a virtual
+ *	server, and each reference used to compile its own copy of the
+ *	policy.  For large configurations, that recompilation dominates
+ *	server startup time.
+ *
+ *	The children of a compiled policy depend only on the things we
+ *	put into the cache key below, so we compile the policy once per
+ *	key, and hang the result off of the policy section.  Each
+ *	subsequent reference gets a thin #UNLANG_TYPE_POLICY node which
+ *	points at the shared children.  The per-reference node is still
+ *	needed, as its "parent", "next", and default actions all depend
+ *	on the place the policy is referenced from.
+ *
+ * @param[in] parent		unlang node of the enclosing section.
+ * @param[in] unlang_ctx	as passed to #compile_item.
+ * @param[in] subcs		section in the policy { ... } block to compile.
+ * @return
+ *	- The compiled policy on success.
+ *	- NULL on error.
+ */
+static unlang_t *compile_policy(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *subcs)
+{
+	unlang_group_t	*cached, *g;
+	unlang_t	*c;
+	char		name[512];
+
+	/*
+	 *	The method name determines which method a module call
+	 *	inside of the policy resolves to, and the component
+	 *	picks the default actions.  Compiling the same policy
+	 *	with a different key can give a different result.
+	 */
+	snprintf(name, sizeof(name), "policy %d %p %p %s.%s",
+		 unlang_ctx->component, unlang_ctx->actions, unlang_ctx->rules->dict_def,
+		 unlang_ctx->section_name1 ? unlang_ctx->section_name1 : "",
+		 unlang_ctx->section_name2 ? unlang_ctx->section_name2 : "");
+
+	cached = cf_data_value(cf_data_find(subcs, unlang_group_t, name));
+	if (!cached) {
+		c = compile_section(parent, unlang_ctx, subcs, UNLANG_TYPE_POLICY);
+		if (!c) return NULL;
+
+		/*
+		 *	The compiled policy has to outlive the section
+		 *	which happened to reference it first, so it's
+		 *	parented from its own configuration.
+		 */
+		(void) talloc_steal(subcs, c);
+		(void) cf_data_add(subcs, unlang_generic_to_group(c), name, false);
+
+		return c;
+	}
+
+	g = group_allocate(parent, subcs, UNLANG_TYPE_POLICY);
+	if (!g) return NULL;
+
+	/*
+	 *	The interpreter only ever pushes g->children, so the
+	 *	subtree can be shared.  Note that the instructions
+	 *	there are linked via their "next" pointers, and NOT via
+	 *	the "parent" pointers, which are only used at compile
+	 *	time.
+	 */
+	g->children = cached->children;
+	g->tail = cached->tail;
+	g->num_children = cached->num_children;
+
+	c = unlang_group_to_generic(g);
+	c->name = cached->self.name;
+	c->debug_name = cached->self.debug_name;
+
+	return compile_action_defaults(c, unlang_ctx);
+}
+
 /*
  *	Compile one entry of a module call.
  */
@@ -3513,8 +3839,11 @@ static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 			 *
 			 *	group foo { ...
 			 */
-			c = compile_section(parent, &unlang_ctx2, subcs,
-					  policy ? UNLANG_TYPE_POLICY : UNLANG_TYPE_GROUP);
+			if (policy) {
+				c = compile_policy(parent, &unlang_ctx2, subcs);
+			} else {
+				c = compile_section(parent, &unlang_ctx2, subcs, UNLANG_TYPE_GROUP);
+			}
 			if (!c) return NULL;
 		}
 
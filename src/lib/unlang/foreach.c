@@ -161,21 +161,31 @@ static unlang_action_t unlang_foreach(REQUEST *request, rlm_rcode_t *presult)
 	MEM(frame->state = foreach = talloc_zero(stack, unlang_frame_state_foreach_t));
 
 	/*
-	 *	Copy the VPs from the original request, this ensures deterministic
-	 *	behaviour if someone decides to add or remove VPs in the set we're
-	 *	iterating over.
+	 *	When the compiler proved the body can't modify the
+	 *	list, iterate over the live pairs.  Otherwise copy the
+	 *	VPs from the original request, which ensures
+	 *	deterministic behaviour if someone decides to add or
+	 *	remove VPs in the set we're iterating over.
 	 */
-	if (tmpl_copy_vps(frame->state, &vps, request, g->vpt) < 0) {	/* nothing to loop over */
-		*presult = RLM_MODULE_NOOP;
-		return UNLANG_ACTION_CALCULATE_RESULT;
-	}
+	if (g->inplace) {
+		if (!tmpl_cursor_init(NULL, &foreach->cursor, request, g->vpt)) {	/* nothing to loop over */
+			*presult = RLM_MODULE_NOOP;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+	} else {
+		if (tmpl_copy_vps(frame->state, &vps, request, g->vpt) < 0) {	/* nothing to loop over */
+			*presult = RLM_MODULE_NOOP;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		rad_assert(vps != NULL);
 
-	rad_assert(vps != NULL);
+		foreach->vps = vps;
+		fr_cursor_talloc_init(&foreach->cursor, &foreach->vps, VALUE_PAIR);
+	}
 
 	foreach->request = request;
 	foreach->depth = foreach_depth;
-	foreach->vps = vps;
-	fr_cursor_talloc_init(&foreach->cursor, &foreach->vps, VALUE_PAIR);
 #ifndef NDEBUG
 	foreach->indent = request->log.unlang_indent;
 #endif
@@ -43,6 +43,13 @@ static fr_table_num_sorted_t const unlang_action_table[] = {
 };
 static size_t unlang_action_table_len = NUM_ELEMENTS(unlang_action_table);
 
+/** Whether the interpreter records per-instruction profiling counters
+ *
+ * Kept as a simple global so the hot path is a single branch when
+ * profiling is disabled.
+ */
+static bool unlang_profile_enabled = false;
+
 #ifndef NDEBUG
 static void instruction_dump(REQUEST *request, unlang_t *instruction)
 {
@@ -161,7 +168,7 @@ void unlang_interpret_push(REQUEST *request, unlang_t *instruction,
 				    top_frame ? "UNLANG_TOP_FRAME" : "UNLANG_SUB_FRAME");
 #endif
 
-	if (stack->depth >= (UNLANG_STACK_MAX - 1)) {
+	if (unlikely(stack->depth >= (UNLANG_STACK_MAX - 1))) {
 		RERROR("Internal sanity check failed: module stack is too deep");
 		fr_exit(EXIT_FAILURE);
 	}
@@ -424,7 +431,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 		 *	marking the requests as STOP on a CANCEL
 		 *	signal.
 		 */
-		if (request->master_state == REQUEST_STOP_PROCESSING) {
+		if (unlikely(request->master_state == REQUEST_STOP_PROCESSING)) {
 		do_stop:
 			frame->result = RLM_MODULE_FAIL;
 			frame->priority = 9999;
@@ -450,7 +457,16 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 			unlang_ops[instruction->type].name);
 
 		rad_assert(frame->interpret != NULL);
-		action = frame->interpret(request, result);
+		if (unlang_profile_enabled) {
+			fr_time_t start;
+
+			start = fr_time();
+			action = frame->interpret(request, result);
+			instruction->profile_time += fr_time() - start;
+			instruction->profile_calls++;
+		} else {
+			action = frame->interpret(request, result);
+		}
 
 		RDEBUG4("** [%i] %s << %s (%d)", stack->depth, __FUNCTION__,
 			fr_table_str_by_value(unlang_action_table, action, "<INVALID>"), *priority);
@@ -832,10 +848,20 @@ rlm_rcode_t unlang_interpret_section(REQUEST *request, CONF_SECTION *subcs, rlm_
  * @param[in] action	The default return code to use.
  * @return One of the RLM_MODULE_* macros.
  */
+/** Key requests in the synchronous backlog by pointer
+ *
+ * The ordering is arbitrary but stable, which is all we need here.
+ */
+static void _request_pointer_key(uint64_t *key1, uint64_t *key2, void const *data)
+{
+	*key1 = (uint64_t) (uintptr_t) data;
+	*key2 = 0;
+}
+
 rlm_rcode_t unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action)
 {
 	fr_event_list_t *el, *old_el;
-	fr_heap_t	*backlog, *old_backlog;
+	fr_heap4_t	*backlog, *old_backlog;
 	rlm_rcode_t	rcode;
 	char const	*caller;
 	REQUEST		*sub_request = NULL;
@@ -852,7 +878,7 @@ rlm_rcode_t unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm
 		return RLM_MODULE_FAIL;
 	}
 
-	MEM(backlog = fr_heap_talloc_create(el, fr_pointer_cmp, REQUEST, runnable_id));
+	MEM(backlog = fr_heap4_talloc_create(el, _request_pointer_key, REQUEST, runnable_id));
 	old_el = request->el;
 	old_backlog = request->backlog;
 	caller = request->module;
@@ -885,7 +911,7 @@ rlm_rcode_t unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm
 		 *	to run.  We can exit the loop.
 		 */
 		if (!wait_for_events && (num_events == 0) &&
-		    (fr_heap_num_elements(backlog) == 0)) {
+		    (fr_heap4_num_elements(backlog) == 0)) {
 			break;
 		}
 
@@ -907,7 +933,7 @@ rlm_rcode_t unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm
 		 *	request, THEN we're guaranteed that there is
 		 *	still a timer event left.
 		 */
-		sub_request = fr_heap_pop(backlog);
+		sub_request = fr_heap4_pop(backlog);
 		if (!sub_request) {
 			wait_for_events = (num_events > 0);
 			continue;
@@ -976,6 +1002,27 @@ void *unlang_interpret_stack_alloc(TALLOC_CTX *ctx)
 	return stack;
 }
 
+/** Reset an interpreter stack for reuse
+ *
+ * Frees any lingering frame state (which is parented from the stack,
+ * so returns to the stack's pool), and re-initialises the bookkeeping,
+ * leaving the stack as unlang_interpret_stack_alloc() would.
+ *
+ * The stack chunk and its state pool are retained, so a recycled
+ * request keeps its (warm) stack instead of allocating a new one.
+ *
+ * @param[in] stack_p	to reset.
+ */
+void unlang_interpret_stack_reset(void *stack_p)
+{
+	unlang_stack_t *stack = talloc_get_type_abort(stack_p, unlang_stack_t);
+
+	talloc_free_children(stack);
+
+	memset(stack, 0, sizeof(*stack));
+	stack->result = RLM_MODULE_UNKNOWN;
+}
+
 /** Send a signal (usually stop) to a request
  *
  * This is typically called via an "async" action, i.e. an action
@@ -1134,7 +1181,7 @@ void unlang_interpret_resumable(REQUEST *request)
 
 	rad_assert(request->backlog != NULL);
 
-	fr_heap_insert(request->backlog, request);
+	fr_heap4_insert(request->backlog, request);
 }
 
 
@@ -1235,6 +1282,60 @@ static ssize_t unlang_interpret_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t
 	return 0;
 }
 
+/** Enable or disable per-instruction profiling
+ *
+ * @param[in] enable	true to start recording counters, false to stop.
+ */
+void unlang_profile_enable(bool enable)
+{
+	unlang_profile_enabled = enable;
+}
+
+/** Print profiling counters for an instruction list, recursing into children
+ *
+ */
+static void profile_dump(FILE *fp, unlang_t *instruction, int depth)
+{
+	unlang_t *inst;
+
+	for (inst = instruction; inst != NULL; inst = inst->next) {
+		fprintf(fp, "%.*s%s calls=%" PRIu64 " time=%" PRIu64 "\n",
+			depth, "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t",
+			inst->debug_name, inst->profile_calls, (uint64_t) inst->profile_time);
+
+		/*
+		 *	All of the ops which print braces are
+		 *	groupings, and have children.
+		 */
+		if (unlang_ops[inst->type].debug_braces) {
+			unlang_group_t *g;
+
+			g = unlang_generic_to_group(inst);
+			profile_dump(fp, g->children, depth + 1);
+		}
+	}
+}
+
+/** Write out profiling counters for a compiled section
+ *
+ * One line per instruction, indented by stack depth, with the number of
+ * times the instruction was interpreted and the cumulative nanoseconds
+ * spent interpreting it.  Time spent yielded (i.e. waiting on I/O) is
+ * not included, so the numbers reflect interpreter work, not wallclock.
+ *
+ * @param[in] fp	to print the report to.
+ * @param[in] cs	a section which has been compiled with #unlang_compile.
+ */
+void unlang_profile_fprint(FILE *fp, CONF_SECTION *cs)
+{
+	unlang_t *instruction;
+
+	instruction = (unlang_t *)cf_data_value(cf_data_find(cs, unlang_group_t, NULL));
+	if (!instruction) return;
+
+	profile_dump(fp, instruction, 0);
+}
+
 void unlang_interpret_init(void)
 {
 	(void) xlat_register(NULL, "interpreter", unlang_interpret_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
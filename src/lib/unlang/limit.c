@@ -0,0 +1,225 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/limit.c
+ * @brief Unlang "limit" keyword evaluation.
+ *
+ * Each "limit" section owns a table of token buckets, one per key
+ * value.  A bucket accumulates g->rate tokens per second up to a
+ * maximum of g->burst, and each packet consumes one token.  While
+ * tokens are available the section is a no-op.  When a bucket is
+ * empty, the statements inside the section are executed, so the
+ * section body is the "over limit" branch:
+ *
+ *     limit &NAS-IP-Address 100/200 {
+ *         reject
+ *     }
+ *
+ * The buckets are shared between all worker threads, so the limit is
+ * enforced across the whole server.  The critical section is a table
+ * lookup and a handful of arithmetic ops, which is far cheaper than
+ * the multiple cache/database round trips needed to maintain the same
+ * counters in a module.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "unlang_priv.h"
+#include "group_priv.h"
+
+/** Cap on the number of buckets a single "limit" section can track
+ *
+ * When the cap is hit, buckets which have refilled completely are
+ * evicted.  A full bucket behaves identically to a brand new one, so
+ * the eviction doesn't change any rate limiting decisions.
+ */
+#define LIMIT_MAX_BUCKETS (65536)
+
+/** One token bucket, tracking a single key value
+ *
+ */
+typedef struct {
+	char		*key;		//!< Expanded key this bucket tracks.
+	size_t		key_len;	//!< Length of the key.
+	double		tokens;		//!< Tokens currently available.
+	fr_time_t	last;		//!< When the bucket was last refilled.
+} unlang_limit_bucket_t;
+
+static int unlang_limit_bucket_cmp(void const *one, void const *two)
+{
+	unlang_limit_bucket_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+typedef struct {
+	unlang_group_t	*g;		//!< The "limit" instruction owning the buckets.
+	fr_time_t	now;		//!< When the walk started.
+} unlang_limit_expire_t;
+
+/** Evict buckets which have refilled completely
+ *
+ */
+static int _unlang_limit_bucket_expire(void *data, void *uctx)
+{
+	unlang_limit_bucket_t	*bucket = data;
+	unlang_limit_expire_t	*expire = uctx;
+	unlang_group_t		*g = expire->g;
+
+	if ((bucket->tokens + (((double)(expire->now - bucket->last) * g->rate) / NSEC)) >= g->burst) return 2;
+
+	return 0;
+}
+
+static unlang_action_t unlang_limit(REQUEST *request, rlm_rcode_t *presult)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
+	unlang_t		*instruction = frame->instruction;
+	unlang_group_t		*g;
+	unlang_limit_bucket_t	*bucket;
+	char			*key;
+	ssize_t			key_len;
+	fr_time_t		now;
+	bool			under_limit = false;
+
+	g = unlang_generic_to_group(instruction);
+
+	key_len = tmpl_aexpand(request, &key, request, g->vpt, NULL, NULL);
+	if (key_len < 0) {
+		RPEDEBUG("Failed expanding key for \"limit\", skipping");
+		*presult = RLM_MODULE_NOOP;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	now = fr_time();
+
+	pthread_mutex_lock(&g->bucket_mutex);
+
+	bucket = rbtree_finddata(g->buckets, &(unlang_limit_bucket_t){ .key = key, .key_len = (size_t)key_len });
+	if (!bucket) {
+		/*
+		 *	Too many keys.  Evict the buckets which have
+		 *	refilled completely, they behave identically
+		 *	to new ones.
+		 */
+		if (rbtree_num_elements(g->buckets) >= LIMIT_MAX_BUCKETS) {
+			rbtree_walk(g->buckets, RBTREE_DELETE_ORDER, _unlang_limit_bucket_expire,
+				    &(unlang_limit_expire_t){ .g = g, .now = now });
+		}
+
+		bucket = talloc_zero(g->buckets, unlang_limit_bucket_t);
+		if (bucket) {
+			bucket->key = talloc_memdup(bucket, key, key_len + 1);
+			bucket->key_len = key_len;
+			bucket->tokens = g->burst;
+			bucket->last = now;
+
+			if (!bucket->key || !rbtree_insert(g->buckets, bucket)) TALLOC_FREE(bucket);
+		}
+
+		/*
+		 *	Can't track the key.  Fail open rather than
+		 *	rejecting packets on memory pressure.
+		 */
+		if (!bucket) {
+			pthread_mutex_unlock(&g->bucket_mutex);
+			goto done_expand;
+		}
+	}
+
+	/*
+	 *	Refill the bucket for the time elapsed since we last
+	 *	saw this key, then try to take a token.
+	 */
+	bucket->tokens += ((double)(now - bucket->last) * g->rate) / NSEC;
+	if (bucket->tokens > g->burst) bucket->tokens = g->burst;
+	bucket->last = now;
+
+	if (bucket->tokens >= 1.0) {
+		bucket->tokens -= 1.0;
+		under_limit = true;
+	}
+
+	pthread_mutex_unlock(&g->bucket_mutex);
+
+	if (!under_limit) {
+		RDEBUG2("Rate limit exceeded for \"%pV\"", fr_box_strvalue_len(key, key_len));
+		talloc_free(key);
+
+		if (!g->children) {
+			*presult = RLM_MODULE_NOOP;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		unlang_interpret_push(request, g->children, frame->result, UNLANG_NEXT_SIBLING, UNLANG_SUB_FRAME);
+		return UNLANG_ACTION_PUSHED_CHILD;
+	}
+
+done_expand:
+	talloc_free(key);
+
+	*presult = RLM_MODULE_NOOP;
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Destructor for a "limit" instruction
+ *
+ */
+static int _unlang_limit_instance_free(unlang_group_t *g)
+{
+	pthread_mutex_destroy(&g->bucket_mutex);
+
+	return 0;
+}
+
+/** Initialise the bucket table for a "limit" instruction
+ *
+ * Called by the compiler once the rate and burst have been parsed.
+ *
+ * @param[in] g		compiled "limit" instruction.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int unlang_limit_instance_init(unlang_group_t *g)
+{
+	g->buckets = rbtree_talloc_create(g, unlang_limit_bucket_cmp, unlang_limit_bucket_t, NULL, 0);
+	if (!g->buckets) return -1;
+
+	if (pthread_mutex_init(&g->bucket_mutex, NULL) != 0) return -1;
+	talloc_set_destructor(g, _unlang_limit_instance_free);
+
+	return 0;
+}
+
+void unlang_limit_init(void)
+{
+	unlang_register(UNLANG_TYPE_LIMIT,
+			   &(unlang_op_t){
+				.name = "limit",
+				.interpret = unlang_limit,
+				.debug_braces = true
+			   });
+}
@@ -29,6 +29,214 @@
 
 #define unlang_redundant_load_balance unlang_load_balance
 
+#define LOAD_BALANCE_VNODES (64)	//!< Ring positions per child.
+
+/** One position on a consistent-hash ring
+ *
+ */
+typedef struct {
+	uint32_t		point;		//!< Where this virtual node sits on the ring.
+	int			idx;		//!< Which child owns this position.
+} unlang_load_balance_node_t;
+
+/** Consistent-hash ring for a keyed load-balance section
+ *
+ * Each child owns #LOAD_BALANCE_VNODES positions on the ring, derived
+ * from its name.  A key maps to the first position at or after its
+ * hash, so adding or removing one child from the section only remaps
+ * the keys that child owned, instead of reshuffling everything as
+ * "hash % num_children" does.
+ */
+struct unlang_load_balance_ring_s {
+	int				num_children;	//!< Number of children in the section.
+	unlang_t			**children;	//!< Flat array of children, for lookup by index.
+	uint32_t			*ewma;		//!< Smoothed child run time in usec, by index.
+							///< Updated without locks, so the values are
+							///< approximate when multiple threads run the
+							///< same section.  They're advisory only.
+	unlang_load_balance_node_t	*nodes;		//!< Ring positions, sorted by point.
+	int				num_nodes;
+};
+
+static int load_balance_node_cmp(void const *one, void const *two)
+{
+	unlang_load_balance_node_t const *a = one, *b = two;
+
+	return (a->point > b->point) - (a->point < b->point);
+}
+
+/** Build the consistent-hash ring for a keyed section
+ *
+ * Called at compile time.  Ring positions depend only on the child
+ * names, so the same children always own the same positions, no matter
+ * what else is in the section.
+ *
+ * @param[in] g		load-balance group to build the ring for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int unlang_load_balance_ring_build(unlang_group_t *g)
+{
+	unlang_load_balance_ring_t	*ring;
+	unlang_t			*child;
+	int				i, j;
+
+	ring = talloc_zero(g, unlang_load_balance_ring_t);
+	if (!ring) return -1;
+
+	ring->num_children = g->num_children;
+	ring->children = talloc_array(ring, unlang_t *, g->num_children);
+	ring->ewma = talloc_zero_array(ring, uint32_t, g->num_children);
+	ring->num_nodes = g->num_children * LOAD_BALANCE_VNODES;
+	ring->nodes = talloc_array(ring, unlang_load_balance_node_t, ring->num_nodes);
+	if (!ring->children || !ring->ewma || !ring->nodes) {
+		talloc_free(ring);
+		return -1;
+	}
+
+	for (i = 0, child = g->children; child != NULL; i++, child = child->next) {
+		uint32_t hash = fr_hash(child->name, strlen(child->name));
+
+		ring->children[i] = child;
+
+		for (j = 0; j < LOAD_BALANCE_VNODES; j++) {
+			unlang_load_balance_node_t *node = &ring->nodes[(i * LOAD_BALANCE_VNODES) + j];
+			uint32_t replica = j;
+
+			node->point = fr_hash_update(&replica, sizeof(replica), hash);
+			node->idx = i;
+		}
+	}
+
+	qsort(ring->nodes, ring->num_nodes, sizeof(ring->nodes[0]), load_balance_node_cmp);
+
+	g->ring = ring;
+	return 0;
+}
+
+/** Find the first ring position at or after a hash
+ *
+ */
+static int load_balance_ring_search(unlang_load_balance_ring_t const *ring, uint32_t hash)
+{
+	int lo = 0, hi = ring->num_nodes;
+
+	while (lo < hi) {
+		int mid = lo + ((hi - lo) / 2);
+
+		if (ring->nodes[mid].point < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (lo == ring->num_nodes) ? 0 : lo;	/* Wrap around */
+}
+
+/** Map a key hash to a child, routing around slow children
+ *
+ * A child whose smoothed run time is more than twice the average of
+ * its peers is skipped, and the key moves to the next child along the
+ * ring.  Keys mapping to healthy children are unaffected, so a single
+ * slow backend only disturbs its own keys.
+ *
+ * @param[in] ring	to search.
+ * @param[in] hash	of the load-balance key.
+ * @return index of the chosen child.
+ */
+static int load_balance_ring_pick(unlang_load_balance_ring_t const *ring, uint32_t hash)
+{
+	int		i, n, idx, skipped;
+	uint64_t	sum = 0;
+	uint32_t	avg;
+	int		active = 0;
+	uint64_t	tried;
+
+	n = load_balance_ring_search(ring, hash);
+	idx = ring->nodes[n].idx;
+
+	/*
+	 *	Health weighting needs at least two children with
+	 *	samples to compare; the bitmap of skipped children
+	 *	also limits it to sections of 64 or fewer.
+	 */
+	if (ring->num_children > 64) return idx;
+
+	for (i = 0; i < ring->num_children; i++) {
+		if (ring->ewma[i]) {
+			sum += ring->ewma[i];
+			active++;
+		}
+	}
+	if (active < 2) return idx;
+	avg = (uint32_t) (sum / active);
+
+	tried = 0;
+	for (skipped = 0; skipped < (ring->num_children - 1); skipped++) {
+		if (!ring->ewma[idx] || (ring->ewma[idx] <= (2 * avg))) break;
+
+		/*
+		 *	Walk clockwise to the next position owned by a
+		 *	child we haven't considered yet.
+		 */
+		tried |= ((uint64_t) 1) << idx;
+		do {
+			n++;
+			if (n == ring->num_nodes) n = 0;
+		} while (tried & (((uint64_t) 1) << ring->nodes[n].idx));
+
+		idx = ring->nodes[n].idx;
+	}
+
+	return idx;
+}
+
+/** Fold a child's run time into its moving average
+ *
+ * Same smoothing as TCP's SRTT: ewma += (sample - ewma) / 8.  The
+ * update is racy by design, see the note on #unlang_load_balance_ring_s.
+ */
+static void load_balance_ring_sample(unlang_load_balance_ring_t *ring, int idx, fr_time_delta_t elapsed)
+{
+	uint32_t sample, ewma;
+
+	sample = (uint32_t) (elapsed / 1000);	/* usec */
+	if (!sample) sample = 1;
+
+	ewma = ring->ewma[idx];
+	if (!ewma) {
+		ewma = sample;
+	} else {
+		ewma += ((int32_t) (sample - ewma)) / 8;
+		if (!ewma) ewma = 1;
+	}
+	ring->ewma[idx] = ewma;
+}
+
+/** Record the run time of the child a keyed load-balance section chose
+ *
+ * Set as the resume function when the selection went through the ring,
+ * purely so we regain control after the child finishes.  The result is
+ * the child's, and is passed through untouched.
+ */
+static unlang_action_t unlang_load_balance_resume(REQUEST *request, UNUSED rlm_rcode_t *presult)
+{
+	unlang_stack_t			*stack = request->stack;
+	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_frame_state_redundant_t	*redundant = talloc_get_type_abort(frame->state,
+									   unlang_frame_state_redundant_t);
+	unlang_group_t			*g = unlang_generic_to_group(frame->instruction);
+
+	if (g->ring && (redundant->ring_idx >= 0)) {
+		load_balance_ring_sample(g->ring, redundant->ring_idx, fr_time() - redundant->start);
+	}
+
+	/* DON'T change presult, as it is taken from the child */
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
 static unlang_action_t unlang_load_balance_next(REQUEST *request, rlm_rcode_t *presult)
 {
 	unlang_stack_t			*stack = request->stack;
@@ -54,6 +262,14 @@ static unlang_action_t unlang_load_balance_next(REQUEST *request, rlm_rcode_t *p
 		redundant->child = redundant->found;
 
 	} else {
+		/*
+		 *	A child has just finished.  Feed its run time
+		 *	back into the ring weighting, if there is one.
+		 */
+		if (g->ring && (redundant->ring_idx >= 0)) {
+			load_balance_ring_sample(g->ring, redundant->ring_idx, fr_time() - redundant->start);
+		}
+
 		/*
 		 *	child is NULL on the first pass.  But if it's
 		 *	back to the found one, then we're done.
@@ -83,6 +299,24 @@ static unlang_action_t unlang_load_balance_next(REQUEST *request, rlm_rcode_t *p
 		}
 	}
 
+	/*
+	 *	Remember which ring child is about to run (after a
+	 *	failover it may not be the one the ring chose), so its
+	 *	run time can be recorded when we resume.
+	 */
+	if (g->ring) {
+		int i;
+
+		redundant->ring_idx = -1;
+		for (i = 0; i < g->ring->num_children; i++) {
+			if (g->ring->children[i] == redundant->child) {
+				redundant->ring_idx = i;
+				break;
+			}
+		}
+		redundant->start = fr_time();
+	}
+
 	/*
 	 *	Push the child, and yield for a later return.
 	 */
@@ -125,6 +359,7 @@ static unlang_action_t unlang_load_balance(REQUEST *request, rlm_rcode_t *presul
 	RDEBUG4("%s setting up", frame->instruction->debug_name);
 
 	redundant = talloc_get_type_abort(frame->state, unlang_frame_state_redundant_t);
+	redundant->ring_idx = -1;
 
 	if (g->vpt) {
 		uint32_t hash, start;
@@ -179,6 +414,20 @@ static unlang_action_t unlang_load_balance(REQUEST *request, rlm_rcode_t *presul
 
 			hash = fr_hash(p, slen);
 
+			/*
+			 *	Keys are mapped through the consistent-hash
+			 *	ring, so editing the section's children only
+			 *	remaps the keys belonging to the children
+			 *	which changed.
+			 */
+			if (g->ring) {
+				redundant->ring_idx = load_balance_ring_pick(g->ring, hash);
+				redundant->child = redundant->found = g->ring->children[redundant->ring_idx];
+
+				RDEBUG3("load-balance ring chose child %d", redundant->ring_idx);
+				goto push;
+			}
+
 			start = hash % g->num_children;;
 		}
 
@@ -227,9 +476,21 @@ static unlang_action_t unlang_load_balance(REQUEST *request, rlm_rcode_t *presul
 	/*
 	 *	Plain "load-balance".  Just do one child.
 	 */
+push:
 	if (instruction->type == UNLANG_TYPE_LOAD_BALANCE) {
 		unlang_interpret_push(request, redundant->found,
 				      frame->result, UNLANG_NEXT_STOP, UNLANG_SUB_FRAME);
+
+		/*
+		 *	If the ring chose the child, resume afterwards
+		 *	to feed its run time back into the weighting.
+		 */
+		if (redundant->ring_idx >= 0) {
+			redundant->start = fr_time();
+			frame->interpret = unlang_load_balance_resume;
+			repeatable_set(frame);
+		}
+
 		return UNLANG_ACTION_PUSHED_CHILD;
 	}
 
@@ -35,6 +35,27 @@ RCSID("$Id$")
 #include "module_priv.h"
 #include "subrequest_priv.h"
 
+#include <sys/resource.h>
+
+/*
+ *	Thread granularity CPU time where the OS provides it, else the
+ *	whole process.
+ */
+#ifdef RUSAGE_THREAD
+#define PROFILE_RUSAGE_WHO RUSAGE_THREAD
+#else
+#define PROFILE_RUSAGE_WHO RUSAGE_SELF
+#endif
+
+/** Convert the user + system time of a getrusage() sample to nanoseconds
+ *
+ */
+static inline int64_t profile_rusage_cpu(struct rusage const *ru)
+{
+	return (((int64_t) ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * NSEC) +
+	       (((int64_t) ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000);
+}
+
 /** Wrap an #fr_event_timer_t providing data needed for unlang events
  *
  */
@@ -147,7 +168,7 @@ int unlang_module_timeout_add(REQUEST *request, fr_unlang_module_timeout_t callb
 	ev->request = request;
 	ev->fd = -1;
 	ev->timeout = callback;
-	ev->inst = sp->module_instance->dl_inst->data;
+	ev->inst = sp->mod_inst;
 	ev->thread = state->thread;
 	ev->ctx = ctx;
 
@@ -279,7 +300,7 @@ int unlang_module_fd_add(REQUEST *request,
 	ev->fd_read = read;
 	ev->fd_write = write;
 	ev->fd_error = error;
-	ev->inst = sp->module_instance->dl_inst->data;
+	ev->inst = sp->mod_inst;
 	ev->thread = state->thread;
 	ev->ctx = ctx;
 
@@ -372,6 +393,7 @@ void unlang_module_push(rlm_rcode_t *out, REQUEST *request,
 	sp->self.name = module_instance->name;
 	sp->self.debug_name = sp->self.name;
 	sp->module_instance = module_instance;
+	sp->mod_inst = module_instance->dl_inst->data;
 	sp->method = method;
 
 	/*
@@ -493,7 +515,7 @@ rlm_rcode_t unlang_module_yield_to_section(REQUEST *request, CONF_SECTION *subcs
 		 */
 		request->rcode = frame->result = default_rcode;
 
-		return resume(sp->module_instance->dl_inst->data,
+		return resume(sp->mod_inst,
 			      module_thread(sp->module_instance)->data, request, rctx);
 	}
 
@@ -546,7 +568,7 @@ static void unlang_module_signal(REQUEST *request, fr_state_signal_t action)
 
 	caller = request->module;
 	request->module = sp->module_instance->name;
-	state->signal(sp->module_instance->dl_inst->data, state->thread->data, request,
+	state->signal(sp->mod_inst, state->thread->data, request,
 		   state->rctx, action);
 	request->module = caller;
 
@@ -583,8 +605,23 @@ static unlang_action_t unlang_module_resume(REQUEST *request, rlm_rcode_t *presu
 	request->module = sp->module_instance->name;
 
 	safe_lock(sp->module_instance);
-	rcode = request->rcode = state->resume(sp->module_instance->dl_inst->data,
-					       state->thread->data, request, state->rctx);
+	if (!module_profile_enabled) {
+		rcode = request->rcode = state->resume(sp->mod_inst,
+						       state->thread->data, request, state->rctx);
+	} else {
+		fr_time_t	start;
+		struct rusage	ru_start, ru_end;
+
+		start = fr_time();
+		(void) getrusage(PROFILE_RUSAGE_WHO, &ru_start);
+
+		rcode = request->rcode = state->resume(sp->mod_inst,
+						       state->thread->data, request, state->rctx);
+
+		(void) getrusage(PROFILE_RUSAGE_WHO, &ru_end);
+		state->thread->profile_wall += fr_time() - start;
+		state->thread->profile_cpu += profile_rusage_cpu(&ru_end) - profile_rusage_cpu(&ru_start);
+	}
 	safe_unlock(sp->module_instance);
 	request->module = caller;
 
@@ -622,6 +659,43 @@ static unlang_action_t unlang_module_resume(REQUEST *request, rlm_rcode_t *presu
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Allocate a resume context inside the module's stack frame
+ *
+ * Modules which yield usually talloc a small closure off the request
+ * for the state their resume function will need.  For modules which
+ * yield on most requests, those allocations add up.
+ *
+ * Contexts which fit into the fixed slot embedded in the module's
+ * stack frame are handed out with no allocation at all.  Larger
+ * contexts fall back to talloc.  Either way the memory is zeroed,
+ * remains valid until the module call returns a final rcode, and
+ * MUST NOT be freed by the module.
+ *
+ * @param[in] request		The current request.
+ * @param[in] size		How much memory the resume context needs.
+ * @return
+ *	- A zeroed resume context of at least size bytes.
+ *	- NULL if the current frame is not a module call, or on
+ *	  allocation failure.
+ */
+void *unlang_module_rctx_alloc(REQUEST *request, size_t size)
+{
+	unlang_stack_t			*stack = request->stack;
+	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_frame_state_module_t	*state;
+
+	if (!fr_cond_assert(frame->instruction->type == UNLANG_TYPE_MODULE)) return NULL;
+
+	state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
+
+	if (size <= sizeof(state->rctx_fixed)) {
+		memset(state->rctx_fixed, 0, size);
+		return state->rctx_fixed;
+	}
+
+	return talloc_zero_size(state, size);
+}
+
 /** Yield a request back to the interpreter from within a module
  *
  * This passes control of the request back to the unlang interpreter, setting
@@ -717,7 +791,22 @@ static unlang_action_t unlang_module(REQUEST *request, rlm_rcode_t *presult)
 	caller = request->module;
 	request->module = sp->module_instance->name;
 	safe_lock(sp->module_instance);	/* Noop unless instance->mutex set */
-	rcode = sp->method(sp->module_instance->dl_inst->data, state->thread->data, request);
+	if (!module_profile_enabled) {
+		rcode = sp->method(sp->mod_inst, state->thread->data, request);
+	} else {
+		fr_time_t	start;
+		struct rusage	ru_start, ru_end;
+
+		start = fr_time();
+		(void) getrusage(PROFILE_RUSAGE_WHO, &ru_start);
+
+		rcode = sp->method(sp->mod_inst, state->thread->data, request);
+
+		(void) getrusage(PROFILE_RUSAGE_WHO, &ru_end);
+		state->thread->profile_calls++;
+		state->thread->profile_wall += fr_time() - start;
+		state->thread->profile_cpu += profile_rusage_cpu(&ru_end) - profile_rusage_cpu(&ru_start);
+	}
 	safe_unlock(sp->module_instance);
 	request->module = caller;
 
@@ -35,6 +35,10 @@ extern "C" {
 typedef struct {
 	unlang_t			self;
 	module_instance_t		*module_instance;	//!< Instance of the module we're calling.
+	void				*mod_inst;		//!< module_instance->dl_inst->data, resolved
+								///< when the call is compiled.  Dispatch is
+								///< the hot path, so we don't want to chase
+								///< that pointer chain on every call.
 	module_method_t			method;
 } unlang_module_t;
 
@@ -48,6 +52,9 @@ typedef struct {
 	void				*rctx;			//!< for resume / signal
 	fr_unlang_module_resume_t	resume;			//!< resumption handler
 	fr_unlang_module_signal_t	signal;			//!< for signal handlers
+	uint64_t			rctx_fixed[4];		//!< Fixed slot for small resume contexts,
+								//!< handed out by #unlang_module_rctx_alloc
+								//!< without allocating.
 } unlang_frame_state_module_t;
 
 static inline unlang_module_t *unlang_generic_to_module(unlang_t *p)
@@ -62,6 +62,30 @@ static unlang_action_t unlang_parallel_child_done(REQUEST *request, UNUSED rlm_r
 }
 
 
+/** Merge a completed child's reply list back into the parent
+ *
+ * The pairs are moved, not copied.  Each child allocated its reply
+ * pairs itself, and it's about to be freed, so we steal them into the
+ * parent's reply and apply the usual list-merge operator rules.  Pairs
+ * the merge leaves behind (e.g. attributes a previous child already
+ * set) are freed here rather than with the child, as they've already
+ * been re-parented.
+ *
+ * @param[in] request	the parent request.
+ * @param[in] child	which has finished executing.
+ */
+static void unlang_parallel_child_join(REQUEST *request, REQUEST *child)
+{
+	VALUE_PAIR *vp;
+
+	if (!child->reply->vps) return;
+
+	for (vp = child->reply->vps; vp; vp = vp->next) fr_pair_steal(request->reply, vp);
+
+	fr_pair_list_move(&request->reply->vps, &child->reply->vps);
+	fr_pair_list_free(&child->reply->vps);
+}
+
 /** Run one or more sub-sections from the parallel section.
  *
  */
@@ -111,15 +135,15 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 				 *	contains state information for
 				 *	the parent.
 				 */
-				if ((fr_pair_list_copy(child->packet,
-						       &child->packet->vps,
-						       request->packet->vps) < 0) ||
-				    (fr_pair_list_copy(child->reply,
-						       &child->reply->vps,
-						       request->reply->vps) < 0) ||
-				    (fr_pair_list_copy(child,
-						       &child->control,
-						       request->control) < 0)) {
+				if ((fr_pair_list_copy_pooled(child->packet,
+							      &child->packet->vps,
+							      request->packet->vps) < 0) ||
+				    (fr_pair_list_copy_pooled(child->reply,
+							      &child->reply->vps,
+							      request->reply->vps) < 0) ||
+				    (fr_pair_list_copy_pooled(child,
+							      &child->control,
+							      request->control) < 0)) {
 					REDEBUG("failed copying lists to clone");
 					for (i = 0; i < state->num_children; i++) TALLOC_FREE(state->children[i].child);
 
@@ -209,6 +233,14 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 			 */
 			priority = state->children[i].instruction->actions[result];
 
+			/*
+			 *	Cloned children ran with a copy of the
+			 *	parent's lists, so anything they added to
+			 *	their reply would otherwise be lost when
+			 *	the child is freed.
+			 */
+			if (state->clone) unlang_parallel_child_join(request, state->children[i].child);
+
 			/*
 			 *	Clean up the state entry.
 			 */
@@ -269,7 +301,7 @@ static unlang_action_t unlang_parallel_process(REQUEST *request, rlm_rcode_t *pr
 			 */
 		case CHILD_YIELDED:
 			if (state->children[i].child->runnable_id == -2) { /* see unlang_interpret_resumable() */
-				(void) fr_heap_extract(state->children[i].child->backlog,
+				(void) fr_heap4_extract(state->children[i].child->backlog,
 						       state->children[i].child);
 				goto runnable;
 			}
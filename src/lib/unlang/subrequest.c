@@ -73,7 +73,7 @@ static void unlang_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t
 	 */
 	if (is_scheduled(request)) {
 		rad_assert(request->backlog != NULL);
-		(void) fr_heap_extract(request->backlog, request);
+		(void) fr_heap4_extract(request->backlog, request);
 	}
 
 	talloc_free(request);
@@ -307,7 +307,7 @@ int unlang_detached_child_init(REQUEST *request)
 	 *	Mark the child as runnable.
 	 */
 	rad_assert(request->parent == NULL);
-	if (fr_heap_insert(request->backlog, request) < 0) {
+	if (fr_heap4_insert(request->backlog, request) < 0) {
 		RPERROR("Failed inserting ourself into the backlog.");
 		return -1;
 	}
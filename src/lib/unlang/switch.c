@@ -42,6 +42,44 @@ static unlang_action_t unlang_switch(REQUEST *request, UNUSED rlm_rcode_t *presu
 
 	g = unlang_generic_to_group(instruction);
 
+	rad_assert(g->vpt != NULL);
+
+	/*
+	 *	All of the case values were known at compile time, so
+	 *	dispatch via the pre-built table instead of evaluating
+	 *	each 'case' statement in turn.
+	 */
+	if (g->case_tree) {
+		VALUE_PAIR *vp = NULL;
+
+		found = NULL;
+
+		if (tmpl_find_vp(&vp, request, g->vpt) == 0) {
+			unlang_group_t	probe, *match;
+			vp_tmpl_t	probe_vpt;
+
+			memset(&probe, 0, sizeof(probe));
+			memset(&probe_vpt, 0, sizeof(probe_vpt));
+
+			probe_vpt.type = TMPL_TYPE_DATA;
+			probe_vpt.tmpl_value = vp->data;
+			probe.vpt = &probe_vpt;
+
+			match = rbtree_finddata(g->case_tree, &probe);
+			if (match) found = unlang_group_to_generic(match);
+		}
+		if (!found) found = g->case_default;
+
+		/*
+		 *	Nothing found.  Just continue, and ignore the
+		 *	"switch" statement.
+		 */
+		if (!found) return UNLANG_ACTION_EXECUTE_NEXT;
+
+		unlang_interpret_push(request, found, frame->result, UNLANG_NEXT_STOP, UNLANG_SUB_FRAME);
+		return UNLANG_ACTION_PUSHED_CHILD;
+	}
+
 	memset(&cond, 0, sizeof(cond));
 	memset(&map, 0, sizeof(map));
 
@@ -51,8 +89,6 @@ static unlang_action_t unlang_switch(REQUEST *request, UNUSED rlm_rcode_t *presu
 	map.op = T_OP_CMP_EQ;
 	map.ci = cf_section_to_item(g->cs);
 
-	rad_assert(g->vpt != NULL);
-
 	null_case = found = NULL;
 	data.datum.ptr = NULL;
 
@@ -33,6 +33,8 @@
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/io/listen.h>
 
+#include <pthread.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -78,6 +80,7 @@ typedef enum {
 	UNLANG_TYPE_SUBREQUEST,			//!< create a child subrequest
 	UNLANG_TYPE_DETACH,			//!< detach a child
 	UNLANG_TYPE_CALL,			//!< call another virtual server
+	UNLANG_TYPE_LIMIT,			//!< Token bucket rate limit section.
 #endif
 	UNLANG_TYPE_POLICY,			//!< Policy section.
 	UNLANG_TYPE_XLAT_INLINE,		//!< xlat statement, inline in "unlang"
@@ -123,8 +126,19 @@ struct unlang_s {
 	unlang_type_t		type;		//!< The specialisation of this node.
 	CONF_ITEM const		*closed;       	//!< whether or not we can add any children, and where it was closed
 	int			actions[RLM_MODULE_NUMCODES];	//!< Priorities for the various return codes.
+
+	/*
+	 *	Profiling counters, updated by the interpreter when
+	 *	profiling is enabled.  Increments aren't atomic, so
+	 *	the numbers are approximate when multiple threads
+	 *	execute the same instruction concurrently.
+	 */
+	uint64_t		profile_calls;	//!< Number of times the node has been interpreted.
+	fr_time_delta_t		profile_time;	//!< Cumulative nanoseconds spent interpreting the node.
 };
 
+typedef struct unlang_load_balance_ring_s unlang_load_balance_ring_t;
+
 /** Generic representation of a grouping
  *
  * Can represent IF statements, maps, update sections etc...
@@ -158,6 +172,31 @@ typedef struct {
 					fr_dict_attr_t const	*attr_packet_type;
 					fr_dict_enum_t const	*type_enum;
 				};
+				struct {
+					rbtree_t		*case_tree;	//!< #UNLANG_TYPE_SWITCH - Dispatch table
+										//!< built at compile time when all case
+										//!< values are known literals.
+					unlang_t		*case_default;	//!< The default 'case' statement.
+				};
+				struct {
+					unlang_load_balance_ring_t *ring;	//!< #UNLANG_TYPE_LOAD_BALANCE,
+										//!< #UNLANG_TYPE_REDUNDANT_LOAD_BALANCE
+										//!< consistent-hash ring, built at
+										//!< compile time for keyed sections.
+				};
+				struct {
+					bool			inplace;	//!< #UNLANG_TYPE_FOREACH - the body can't
+										//!< modify the list, so iterate it without
+										//!< a snapshot copy.
+				};
+				struct {
+					uint32_t		rate;		//!< #UNLANG_TYPE_LIMIT - Tokens added
+										//!< to each bucket per second.
+					uint32_t		burst;		//!< Maximum tokens a bucket can hold.
+					rbtree_t		*buckets;	//!< Token bucket for each key.
+					pthread_mutex_t		bucket_mutex;	//!< Protects the buckets, which are
+										//!< shared between worker threads.
+				};
 			};
 		};
 		fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
@@ -186,6 +225,9 @@ typedef struct {
 typedef struct {
 	unlang_t 		*child;
 	unlang_t		*found;
+	fr_time_t		start;		//!< When the chosen child started executing.
+	int			ring_idx;	//!< Which ring child was chosen, -1 if the
+						//!< selection didn't go through the ring.
 } unlang_frame_state_redundant_t;
 
 /** Our interpreter stack, as distinct from the C stack
@@ -227,6 +269,16 @@ typedef struct {
 	uint8_t			uflags;				//!< Unwind markers
 } unlang_stack_frame_t;
 
+/*
+ *	Pushing and popping frames is the inner loop of the
+ *	interpreter, so the frame must stay within a single cache
+ *	line.  Anything cold (names, debug state) belongs on the
+ *	#REQUEST, not here.
+ */
+#ifdef __LP64__
+static_assert(sizeof(unlang_stack_frame_t) <= 64, "unlang_stack_frame_t must fit in one cache line");
+#endif
+
 /** An unlang stack associated with a request
  *
  */
@@ -367,6 +419,12 @@ void		unlang_function_init(void);
 
 void		unlang_group_init(void);
 
+int		unlang_limit_instance_init(unlang_group_t *g);
+
+void		unlang_limit_init(void);
+
+int		unlang_load_balance_ring_build(unlang_group_t *g);
+
 void		unlang_load_balance_init(void);
 
 void		unlang_map_init(void);
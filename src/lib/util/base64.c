@@ -203,14 +203,37 @@ size_t fr_base64_encode(char *out, size_t outlen, uint8_t const *in, size_t inle
 		return -1;
 	}
 
-	while (inlen) {
-		*p++ = fr_base64_str[(in[0] >> 2) & 0x3f];
-		*p++ = fr_base64_str[((in[0] << 4) + (--inlen ? in[1] >> 4 : 0)) & 0x3f];
-		*p++ = (inlen ? fr_base64_str[((in[1] << 2) + (--inlen ? in[2] >> 6 : 0)) & 0x3f] : '=');
-		*p++ = inlen ? fr_base64_str[in[2] & 0x3f] : '=';
+	/*
+	 *	Process complete 24bit quanta.  The loop body is
+	 *	branch free, so the compiler can unroll/vectorize it.
+	 */
+	while (inlen >= 3) {
+		*p++ = fr_base64_str[in[0] >> 2];
+		*p++ = fr_base64_str[((in[0] << 4) | (in[1] >> 4)) & 0x3f];
+		*p++ = fr_base64_str[((in[1] << 2) | (in[2] >> 6)) & 0x3f];
+		*p++ = fr_base64_str[in[2] & 0x3f];
+
+		in += 3;
+		inlen -= 3;
+	}
+
+	switch (inlen) {
+	case 2:		/* Final quantum is 16 bits */
+		*p++ = fr_base64_str[in[0] >> 2];
+		*p++ = fr_base64_str[((in[0] << 4) | (in[1] >> 4)) & 0x3f];
+		*p++ = fr_base64_str[(in[1] << 2) & 0x3f];
+		*p++ = '=';
+		break;
 
-		if (inlen) inlen--;
-		if (inlen) in += 3;
+	case 1:		/* Final quantum is 8 bits */
+		*p++ = fr_base64_str[in[0] >> 2];
+		*p++ = fr_base64_str[(in[0] << 4) & 0x3f];
+		*p++ = '=';
+		*p++ = '=';
+		break;
+
+	case 0:
+		break;
 	}
 
 	p[0] = '\0';
@@ -263,10 +286,19 @@ ssize_t fr_base64_decode(uint8_t *out, size_t outlen, char const *in, size_t inl
 	char const	*end = p + inlen;
 
 	/*
-	 *	Process complete 24bit quanta
+	 *	Process complete 24bit quanta.  Each input char is
+	 *	looked up once, and validity is checked with a single
+	 *	branch per quantum, by folding the -1 invalid markers
+	 *	together.
 	 */
 	while ((end - p) >= 4) {
-		if (!fr_is_base64(p[0]) || !fr_is_base64(p[1]) || !fr_is_base64(p[2]) || !fr_is_base64(p[3])) break;
+		int8_t a, b, c, d;
+
+		a = fr_base64_sextet[us(p[0])];
+		b = fr_base64_sextet[us(p[1])];
+		c = fr_base64_sextet[us(p[2])];
+		d = fr_base64_sextet[us(p[3])];
+		if ((a | b | c | d) < 0) break;
 
 		/*
 		 *	Check we have enough bytes to write out
@@ -278,9 +310,9 @@ ssize_t fr_base64_decode(uint8_t *out, size_t outlen, char const *in, size_t inl
 			return p - end;
 		}
 
-		*out_p++ = ((fr_base64_sextet[us(p[0])] << 2) | (fr_base64_sextet[us(p[1])] >> 4));
-		*out_p++ = ((fr_base64_sextet[us(p[1])] << 4) & 0xf0) | (fr_base64_sextet[us(p[2])] >> 2);
-		*out_p++ = ((fr_base64_sextet[us(p[2])] << 6) & 0xc0) | fr_base64_sextet[us(p[3])];
+		*out_p++ = (a << 2) | (b >> 4);
+		*out_p++ = ((b << 4) & 0xf0) | (c >> 2);
+		*out_p++ = ((c << 6) & 0xc0) | d;
 
 		p += 4;	/* 32bit input -> 24bit output */
 	}
@@ -780,6 +780,154 @@ static int fr_fault_check_permissions(void)
 	return 0;
 }
 
+#define FAULT_LOG_MAX	(4096)			//!< Longest single fault log line.
+#define FAULT_RING_SIZE	(16384)			//!< Fault output retained in the process image.
+
+static char	fault_ring[FAULT_RING_SIZE];	//!< Copy of everything written via fr_fault_log,
+						//!< so it's recoverable from a core dump.
+static size_t	fault_ring_used = 0;		//!< Bytes of fault_ring filled.
+
+/** Copy a string, without writing the terminating \0
+ *
+ */
+static char *fault_strcpy(char *out, char const *end, char const *in)
+{
+	while (*in && (out < end)) *out++ = *in++;
+
+	return out;
+}
+
+/** Print an unsigned integer, without any of printf's machinery
+ *
+ */
+static char *fault_utoa(char *out, char const *end, uint64_t num, unsigned int base)
+{
+	char	digits[sizeof(num) * CHAR_BIT];
+	size_t	i = 0;
+
+	do {
+		digits[i++] = "0123456789abcdef"[num % base];
+		num /= base;
+	} while (num);
+
+	while (i && (out < end)) *out++ = digits[--i];
+
+	return out;
+}
+
+/** Async-signal-safe replacement for vsnprintf, for the fault path
+ *
+ * Understands the conversions used by FR_FAULT_LOG call sites (%s, %c,
+ * %d, %i, %u, %x, %p, the 'z' size modifier and %%), without touching
+ * locale data, stdio, or the heap.  Unknown conversions are printed
+ * literally.
+ *
+ * @param[out] out	buffer to print into, always \0 terminated.
+ * @param[in] outlen	size of the output buffer.
+ * @param[in] fmt	printf style format string.
+ * @param[in] ap	arguments for the format string.
+ * @return the number of bytes written, excluding the terminator.
+ */
+static size_t fault_vsnprintf(char *out, size_t outlen, char const *fmt, va_list ap)
+{
+	char		*p = out;
+	char const	*end = out + outlen - 1;
+
+	while (*fmt && (p < end)) {
+		bool	size_mod = false;
+		int64_t	num;
+
+		if (*fmt != '%') {
+			*p++ = *fmt++;
+			continue;
+		}
+		fmt++;
+
+		if (*fmt == 'z') {
+			size_mod = true;
+			fmt++;
+		}
+
+		switch (*fmt++) {
+		case '%':
+			*p++ = '%';
+			break;
+
+		case 'c':
+			*p++ = (char) va_arg(ap, int);
+			break;
+
+		case 's':
+		{
+			char const *str = va_arg(ap, char const *);
+
+			p = fault_strcpy(p, end, str ? str : "(null)");
+		}
+			break;
+
+		case 'd':
+		case 'i':
+			num = size_mod ? (int64_t) va_arg(ap, ssize_t) : va_arg(ap, int);
+			if (num < 0) {
+				*p++ = '-';
+				num = -num;
+			}
+			p = fault_utoa(p, end, (uint64_t) num, 10);
+			break;
+
+		case 'u':
+			p = fault_utoa(p, end, size_mod ? (uint64_t) va_arg(ap, size_t) : va_arg(ap, unsigned int), 10);
+			break;
+
+		case 'x':
+			p = fault_utoa(p, end, size_mod ? (uint64_t) va_arg(ap, size_t) : va_arg(ap, unsigned int), 16);
+			break;
+
+		case 'p':
+			p = fault_strcpy(p, end, "0x");
+			p = fault_utoa(p, end, (uintptr_t) va_arg(ap, void *), 16);
+			break;
+
+		default:
+			if (p < end) *p++ = '%';
+			if (p < end) *p++ = fmt[-1];
+			break;
+		}
+	}
+	*p = '\0';
+
+	return p - out;
+}
+
+/** Async-signal-safe subset of strsignal
+ *
+ */
+static char const *fault_signame(int sig)
+{
+	switch (sig) {
+	case SIGABRT:
+		return "Aborted";
+
+	case SIGBUS:
+		return "Bus error";
+
+	case SIGFPE:
+		return "Floating point exception";
+
+	case SIGILL:
+		return "Illegal instruction";
+
+	case SIGSEGV:
+		return "Segmentation fault";
+
+	case SIGTRAP:
+		return "Trace/breakpoint trap";
+
+	default:
+		return "Unknown signal";
+	}
+}
+
 /** Prints a simple backtrace (if execinfo is available) and calls panic_action if set.
  *
  * @param sig caught
@@ -802,7 +950,7 @@ NEVER_RETURNS void fr_fault(int sig)
 	 *	the debugger handle it how it wants.
 	 */
 	if (fr_debug_state == DEBUGGER_STATE_ATTACHED) {
-		FR_FAULT_LOG("RAISING SIGNAL: %s", strsignal(sig));
+		FR_FAULT_LOG("RAISING SIGNAL: %s (%i)", fault_signame(sig), sig);
 		raise(sig);
 	}
 
@@ -811,7 +959,7 @@ NEVER_RETURNS void fr_fault(int sig)
 	 */
 	memset(cmd, 0, sizeof(cmd));
 
-	FR_FAULT_LOG("CAUGHT SIGNAL: %s", strsignal(sig));
+	FR_FAULT_LOG("CAUGHT SIGNAL: %s (%i)", fault_signame(sig), sig);
 
 	/*
 	 *	Run the callback if one was registered
@@ -1211,17 +1359,53 @@ void fr_fault_set_cb(fr_fault_cb_t func)
  * which would result in a deadlock if fr_fault was triggered from within
  * a allocation call.
  *
- * Now we just write directly to the FD.
+ * Now we format into a pre-allocated buffer with our own async-signal-safe
+ * formatter, and write directly to the FD, so the fault path touches
+ * neither stdio nor the heap.
  */
 void fr_fault_log(char const *msg, ...)
 {
-	va_list ap;
-
-	if (fr_fault_log_fd < 0) return;
+	static char	buffer[FAULT_LOG_MAX];	/* Pre-allocated, only ever written by the faulting thread */
+	va_list		ap;
+	size_t		len;
 
 	va_start(ap, msg);
-	vdprintf(fr_fault_log_fd, msg, ap);
+	len = fault_vsnprintf(buffer, sizeof(buffer), msg, ap);
 	va_end(ap);
+
+	/*
+	 *	Keep a copy in the process image, so the crash output
+	 *	is recoverable from a core dump (gdb "print fault_ring",
+	 *	or strings piped through grep for the magic) even when
+	 *	the log fd pointed at a pipe or pty which is now gone.
+	 *
+	 *	Once the ring is full we stop appending, as the start
+	 *	of the output is the part which explains the crash.
+	 */
+	if (fault_ring_used == 0) fault_ring_used = strlcpy(fault_ring, "FR-FAULT-LOG: ", sizeof(fault_ring));
+	if (len && (fault_ring_used < (sizeof(fault_ring) - 1))) {
+		size_t room = (sizeof(fault_ring) - 1) - fault_ring_used;
+
+		if (room > len) room = len;
+		memcpy(fault_ring + fault_ring_used, buffer, room);
+		fault_ring_used += room;
+	}
+
+	if (fr_fault_log_fd >= 0) {
+		char const *q = buffer;
+
+		while (len) {
+			ssize_t slen;
+
+			slen = write(fr_fault_log_fd, q, len);
+			if (slen <= 0) {
+				if ((slen < 0) && (errno == EINTR)) continue;
+				break;
+			}
+			q += slen;
+			len -= slen;
+		}
+	}
 }
 
 /** Set a file descriptor to log memory reports to.
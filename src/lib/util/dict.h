@@ -272,6 +272,9 @@ int			fr_dict_unknown_vendor_afrom_num(TALLOC_CTX *ctx, fr_dict_attr_t **out,
 fr_dict_attr_t const   	*fr_dict_unknown_afrom_fields(TALLOC_CTX *ctx, fr_dict_attr_t const *parent,
 						      unsigned int vendor, unsigned int attr) CC_HINT(nonnull(2));
 
+fr_dict_attr_t const	*fr_dict_unknown_afrom_fields_cached(TALLOC_CTX *ctx, fr_dict_attr_t const *parent,
+							     unsigned int vendor, unsigned int attr) CC_HINT(nonnull(2));
+
 ssize_t			fr_dict_unknown_afrom_oid_str(TALLOC_CTX *ctx, fr_dict_attr_t **out,
 			      	      		      fr_dict_attr_t const *parent, char const *oid_str);
 
@@ -366,6 +369,8 @@ ssize_t			fr_dict_attr_by_name_substr(fr_dict_attr_err_t *err, fr_dict_attr_t co
 
 fr_dict_attr_t const	*fr_dict_attr_by_name(fr_dict_t const *dict, char const *attr);
 
+fr_dict_attr_t const	*fr_dict_attr_by_name_cached(fr_dict_t const *dict, char const *attr);
+
 ssize_t			fr_dict_attr_by_qualified_name_substr(fr_dict_attr_err_t *err, fr_dict_attr_t const **out,
 							      fr_dict_t const *dict_def,
 							      char const *attr, bool fallback);
@@ -379,6 +384,9 @@ fr_dict_attr_t const	*fr_dict_attr_child_by_da(fr_dict_attr_t const *parent, fr_
 
 fr_dict_attr_t const	*fr_dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned int attr);
 
+fr_dict_attr_t const	*fr_dict_attr_by_child_num(fr_dict_t const *dict,
+						   fr_dict_attr_t const *parent, unsigned int attr);
+
 fr_dict_enum_t		*fr_dict_enum_by_value(fr_dict_attr_t const *da, fr_value_box_t const *value);
 
 char const		*fr_dict_enum_alias_by_value(fr_dict_attr_t const *da, fr_value_box_t const *value);
@@ -70,6 +70,8 @@ struct fr_dict {
 
 	fr_hash_table_t		*attributes_by_name;	//!< Allow attribute lookup by unique name.
 
+	fr_hash_table_t		*attributes_by_num;	//!< Flat lookup of attributes by (parent, number).
+
 	fr_hash_table_t		*attributes_combo;	//!< Lookup variants of polymorphic attributes.
 
 	fr_hash_table_t		*values_by_da;		//!< Lookup an attribute enum by its value.
@@ -96,6 +98,7 @@ struct fr_dict {
 extern bool dict_initialised;
 extern char *dict_dir_default;
 extern TALLOC_CTX *dict_ctx;
+extern uint64_t dict_cache_generation;
 
 extern fr_table_num_ordered_t const date_precision_table[];
 extern size_t date_precision_table_len;
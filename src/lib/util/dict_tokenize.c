@@ -1543,6 +1543,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 	struct stat		statbuf;
 	char			*argv[MAX_ARGV];
 	int			argc;
+	int			first;
 	fr_dict_attr_t const	*da;
 
 	/*
@@ -1675,10 +1676,18 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			return -1;
 		}
 
+		/*
+		 *	Dictionary files are dominated by VALUE and
+		 *	ATTRIBUTE lines, so gate each keyword comparison
+		 *	on the first character instead of strcasecmp()ing
+		 *	every line against every keyword.
+		 */
+		first = toupper((uint8_t)argv[0][0]);
+
 		/*
 		 *	Perhaps this is an attribute.
 		 */
-		if (strcasecmp(argv[0], "ATTRIBUTE") == 0) {
+		if ((first == 'A') && (strcasecmp(argv[0], "ATTRIBUTE") == 0)) {
 			if (dict_read_process_attribute(ctx,
 							argv + 1, argc - 1,
 							&base_flags) == -1) goto error;
@@ -1688,7 +1697,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Process VALUE lines.
 		 */
-		if (strcasecmp(argv[0], "VALUE") == 0) {
+		if ((first == 'V') && (strcasecmp(argv[0], "VALUE") == 0)) {
 			if (dict_read_process_value(ctx, argv + 1, argc - 1) == -1) goto error;
 			continue;
 		}
@@ -1696,7 +1705,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Process FLAGS lines.
 		 */
-		if (strcasecmp(argv[0], "FLAGS") == 0) {
+		if ((first == 'F') && (strcasecmp(argv[0], "FLAGS") == 0)) {
 			if (dict_read_process_flags(ctx->dict, argv + 1, argc - 1, &base_flags) == -1) goto error;
 			continue;
 		}
@@ -1707,7 +1716,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		 *	@todo - create child ctx, so that we can have
 		 *	nested structs.
 		 */
-		if (strcasecmp(argv[0], "MEMBER") == 0) {
+		if ((first == 'M') && (strcasecmp(argv[0], "MEMBER") == 0)) {
 			if (dict_read_process_member(ctx,
 						     argv + 1, argc - 1,
 						     &base_flags) == -1) goto error;
@@ -1717,7 +1726,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Process STRUCT lines.
 		 */
-		if (strcasecmp(argv[0], "STRUCT") == 0) {
+		if ((first == 'S') && (strcasecmp(argv[0], "STRUCT") == 0)) {
 			if (dict_read_process_struct(ctx, argv + 1, argc - 1) == -1) goto error;
 			continue;
 		}
@@ -1725,7 +1734,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	See if we need to import another dictionary.
 		 */
-		if (strncasecmp(argv[0], "$INCLUDE", 8) == 0) {
+		if ((first == '$') && (strncasecmp(argv[0], "$INCLUDE", 8) == 0)) {
 			int rcode;
 			int stack_depth = ctx->stack_depth;
 
@@ -1792,7 +1801,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Process VENDOR lines.
 		 */
-		if (strcasecmp(argv[0], "VENDOR") == 0) {
+		if ((first == 'V') && (strcasecmp(argv[0], "VENDOR") == 0)) {
 			if (dict_read_process_vendor(ctx->dict, argv + 1, argc - 1) == -1) goto error;
 			continue;
 		}
@@ -1800,7 +1809,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Process PROTOCOL line.  Defines a new protocol.
 		 */
-		if (strcasecmp(argv[0], "PROTOCOL") == 0) {
+		if ((first == 'P') && (strcasecmp(argv[0], "PROTOCOL") == 0)) {
 			if (argc < 2) {
 				fr_strerror_printf_push("Invalid PROTOCOL entry");
 				goto error;
@@ -1812,7 +1821,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Switches the current protocol context
 		 */
-		if (strcasecmp(argv[0], "BEGIN-PROTOCOL") == 0) {
+		if ((first == 'B') && (strcasecmp(argv[0], "BEGIN-PROTOCOL") == 0)) {
 			fr_dict_t *found;
 
 			if (argc != 2) {
@@ -1860,7 +1869,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Switches back to the previous protocol context
 		 */
-		if (strcasecmp(argv[0], "END-PROTOCOL") == 0) {
+		if ((first == 'E') && (strcasecmp(argv[0], "END-PROTOCOL") == 0)) {
 			fr_dict_t const *found;
 
 			if (argc != 2) {
@@ -1925,7 +1934,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Switches TLV parent context
 		 */
-		if (strcasecmp(argv[0], "BEGIN-TLV") == 0) {
+		if ((first == 'B') && (strcasecmp(argv[0], "BEGIN-TLV") == 0)) {
 			fr_dict_attr_t const *common;
 
 			if (argc != 2) {
@@ -1962,7 +1971,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		/*
 		 *	Switches back to previous TLV parent
 		 */
-		if (strcasecmp(argv[0], "END-TLV") == 0) {
+		if ((first == 'E') && (strcasecmp(argv[0], "END-TLV") == 0)) {
 			if (argc != 2) {
 				fr_strerror_printf_push("Invalid END-TLV entry");
 				goto error;
@@ -2002,7 +2011,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			continue;
 		} /* END-VENDOR */
 
-		if (strcasecmp(argv[0], "BEGIN-VENDOR") == 0) {
+		if ((first == 'B') && (strcasecmp(argv[0], "BEGIN-VENDOR") == 0)) {
 			fr_dict_vendor_t const	*vendor;
 			fr_dict_attr_flags_t	flags;
 
@@ -2119,7 +2128,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			continue;
 		} /* BEGIN-VENDOR */
 
-		if (strcasecmp(argv[0], "END-VENDOR") == 0) {
+		if ((first == 'E') && (strcasecmp(argv[0], "END-VENDOR") == 0)) {
 			fr_dict_vendor_t const *vendor;
 
 			if (argc != 2) {
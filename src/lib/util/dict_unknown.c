@@ -23,6 +23,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/thread_local.h>
 
 /** Copy a known or unknown attribute to produce an unknown attribute
  *
@@ -334,6 +335,114 @@ fr_dict_attr_t const *fr_dict_unknown_afrom_fields(TALLOC_CTX *ctx, fr_dict_attr
 	return n;
 }
 
+/** A single entry in the per-thread unknown attribute cache
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*parent;	//!< Parent the unknown attribute was created under.
+	unsigned int		vendor;		//!< Vendor number.
+	unsigned int		attr;		//!< Attribute number.
+	fr_dict_attr_t const	*da;		//!< The interned unknown attribute.
+} dict_unknown_cache_entry_t;
+
+#define DICT_UNKNOWN_CACHE_SIZE	(64)		//!< Must be a power of two.
+
+typedef struct {
+	uint64_t			generation;	//!< #dict_cache_generation the entries were filled at.
+	dict_unknown_cache_entry_t	entry[DICT_UNKNOWN_CACHE_SIZE];
+} dict_unknown_cache_t;
+
+fr_thread_local_setup(TALLOC_CTX *, dict_unknown_cache_ctx)	/* macro */
+static _Thread_local dict_unknown_cache_t dict_unknown_cache;
+
+static void _dict_unknown_cache_ctx_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Allocate an unknown attribute, interning repeatedly seen ones per-thread
+ *
+ * Drop in replacement for #fr_dict_unknown_afrom_fields for decoder hot
+ * paths.  The first time a (parent, vendor, attr) triplet is seen on a
+ * thread, the unknown attribute is allocated in a thread local context
+ * and remembered, so subsequent packets carrying the same unknown
+ * attribute reuse it instead of allocating a fresh hierarchy per packet.
+ *
+ * Cached entries are never evicted, so a cached attribute remains valid
+ * for as long as the dictionaries do.  If the slot for a triplet is
+ * already occupied, or the parent is itself unknown (and so allocated
+ * per-packet), we fall back to allocating in the caller's ctx.
+ *
+ * @note The caller must not free or steal the result.  Pairs created
+ *	from it copy it, as they do for any unknown attribute.
+ *
+ * @param[in] ctx		to allocate in, if the attribute can't be cached.
+ * @param[in] parent		of the unknown attribute (may also be unknown).
+ * @param[in] vendor		number.
+ * @param[in] attr		number.
+ * @return
+ *	- An interned or freshly allocated unknown attribute.
+ *	- NULL on error.
+ */
+fr_dict_attr_t const *fr_dict_unknown_afrom_fields_cached(TALLOC_CTX *ctx, fr_dict_attr_t const *parent,
+							  unsigned int vendor, unsigned int attr)
+{
+	uint32_t			hash;
+	dict_unknown_cache_entry_t	*entry;
+	fr_dict_attr_t const		*da;
+	TALLOC_CTX			*cache_ctx;
+
+	/*
+	 *	Unknown parents are allocated per-packet, so their
+	 *	addresses can't be used as cache keys.
+	 */
+	if (!parent || parent->flags.is_unknown) return fr_dict_unknown_afrom_fields(ctx, parent, vendor, attr);
+
+	/*
+	 *	Dictionaries can be freed and reloaded, at which
+	 *	point any cached attributes parented by them go stale.
+	 */
+	if (dict_unknown_cache.generation != dict_cache_generation) {
+		memset(&dict_unknown_cache.entry, 0, sizeof(dict_unknown_cache.entry));
+		if (dict_unknown_cache_ctx) talloc_free_children(dict_unknown_cache_ctx);
+		dict_unknown_cache.generation = dict_cache_generation;
+	}
+
+	hash = fr_hash(&parent, sizeof(parent));
+	hash = fr_hash_update(&vendor, sizeof(vendor), hash);
+	hash = fr_hash_update(&attr, sizeof(attr), hash);
+	entry = &dict_unknown_cache.entry[hash & (DICT_UNKNOWN_CACHE_SIZE - 1)];
+
+	if (entry->da) {
+		if ((entry->parent == parent) && (entry->vendor == vendor) && (entry->attr == attr)) return entry->da;
+
+		/*
+		 *	Slot taken by a different attribute.  We can't
+		 *	evict, as the previous occupant may still be in
+		 *	use further up the stack, so this one stays
+		 *	uncached.
+		 */
+		return fr_dict_unknown_afrom_fields(ctx, parent, vendor, attr);
+	}
+
+	cache_ctx = dict_unknown_cache_ctx;
+	if (!cache_ctx) {
+		cache_ctx = talloc_init("dict_unknown_cache");
+		if (!cache_ctx) return fr_dict_unknown_afrom_fields(ctx, parent, vendor, attr);
+		fr_thread_local_set_destructor(dict_unknown_cache_ctx, _dict_unknown_cache_ctx_free, cache_ctx);
+	}
+
+	da = fr_dict_unknown_afrom_fields(cache_ctx, parent, vendor, attr);
+	if (!da) return NULL;
+
+	entry->parent = parent;
+	entry->vendor = vendor;
+	entry->attr = attr;
+	entry->da = da;
+
+	return da;
+}
+
 /** Initialise a fr_dict_attr_t from an ASCII attribute and value
  *
  * Where the attribute name is in the form:
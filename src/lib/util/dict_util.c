@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include <ctype.h>
 #ifdef HAVE_SYS_STAT_H
@@ -289,6 +290,32 @@ static int dict_attr_combo_cmp(void const *one, void const *two)
 	return (a->attr > b->attr) - (a->attr < b->attr);
 }
 
+/** Hash an attribute by its parent and attribute number
+ *
+ */
+static uint32_t dict_attr_num_hash(void const *data)
+{
+	uint32_t hash;
+	fr_dict_attr_t const *attr = data;
+
+	hash = fr_hash(&attr->parent, sizeof(attr->parent));			//-V568
+	return fr_hash_update(&attr->attr, sizeof(attr->attr), hash);
+}
+
+/** Compare two attributes by parent and attribute number
+ *
+ */
+static int dict_attr_num_cmp(void const *one, void const *two)
+{
+	fr_dict_attr_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->parent < b->parent) - (a->parent > b->parent);
+	if (ret != 0) return ret;
+
+	return (a->attr > b->attr) - (a->attr < b->attr);
+}
+
 /** Wrap name hash function for fr_dict_vendor_t
  *
  * @param data fr_dict_vendor_t to hash.
@@ -931,6 +958,17 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 	 */
 	if (dict_attr_child_add(mutable, n) < 0) goto error;
 
+	/*
+	 *	Add to the flat (parent, attr) index.  A few vendors
+	 *	overload the RFC space with duplicate numbers, where
+	 *	bin ordering decides which definition wins.  Drop those
+	 *	keys from the index so lookups for them fall back to
+	 *	the bin walk, which preserves the ordering rules.
+	 */
+	if (!fr_hash_table_insert(dict->attributes_by_num, n)) {
+		fr_hash_table_delete(dict->attributes_by_num, n);
+	}
+
 	return 0;
 }
 
@@ -1759,6 +1797,76 @@ fr_dict_attr_t const *fr_dict_attr_by_name(fr_dict_t const *dict, char const *na
 	return fr_hash_table_finddata(dict->attributes_by_name, &(fr_dict_attr_t) { .name = name });
 }
 
+/** A single entry in the per-thread attribute name cache
+ *
+ */
+typedef struct {
+	fr_dict_t const		*dict;		//!< Dictionary the entry was resolved in.
+	fr_dict_attr_t const	*da;		//!< The resolved attribute.
+} dict_attr_cache_entry_t;
+
+#define DICT_ATTR_CACHE_SIZE	(64)		//!< Must be a power of two.
+
+typedef struct {
+	uint64_t		generation;	//!< #dict_cache_generation the entries were filled at.
+	dict_attr_cache_entry_t	entry[DICT_ATTR_CACHE_SIZE];
+} dict_attr_cache_t;
+
+static _Thread_local dict_attr_cache_t dict_attr_cache;
+
+/** Incremented when a dictionary is freed, invalidating the per-thread caches
+ *
+ */
+uint64_t dict_cache_generation = 1;
+
+/** Locate a #fr_dict_attr_t by its name, caching the result per-thread
+ *
+ * Drop in replacement for #fr_dict_attr_by_name for call sites which
+ * resolve names at runtime, usually once per request.  Successful
+ * lookups are remembered in a small flat per-thread table, so that
+ * repeated lookups of the same names don't touch the dictionary hash
+ * tables, and need no locking.
+ *
+ * @param[in] dict		of protocol context we're operating in.
+ *				If NULL the internal dictionary will be used.
+ * @param[in] name		of the attribute to locate.
+ * @return
+ * 	- Attribute matching name.
+ * 	- NULL if no matching attribute could be found.
+ */
+fr_dict_attr_t const *fr_dict_attr_by_name_cached(fr_dict_t const *dict, char const *name)
+{
+	uint32_t		hash;
+	dict_attr_cache_entry_t	*entry;
+	fr_dict_attr_t const	*da;
+
+	INTERNAL_IF_NULL(dict, NULL);
+
+	if (!name) return NULL;
+
+	/*
+	 *	Dictionaries can be freed and reloaded, at which
+	 *	point any cached pointers into them go stale.
+	 */
+	if (dict_attr_cache.generation != dict_cache_generation) {
+		memset(&dict_attr_cache.entry, 0, sizeof(dict_attr_cache.entry));
+		dict_attr_cache.generation = dict_cache_generation;
+	}
+
+	hash = dict_hash_name(name, strlen(name));
+	entry = &dict_attr_cache.entry[hash & (DICT_ATTR_CACHE_SIZE - 1)];
+
+	if ((entry->dict == dict) && (strcasecmp(entry->da->name, name) == 0)) return entry->da;
+
+	da = fr_hash_table_finddata(dict->attributes_by_name, &(fr_dict_attr_t) { .name = name });
+	if (!da) return NULL;	/* Only successful lookups are cached */
+
+	entry->dict = dict;
+	entry->da = da;
+
+	return da;
+}
+
 /** Locate a qualified #fr_dict_attr_t by its name and a dictionary qualifier
  *
  * @note If calling this function from the server any list or request qualifiers
@@ -2022,6 +2130,41 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 	return NULL;
 }
 
+/** Check if a child attribute exists in a parent using an attribute number
+ *
+ * Identical to #fr_dict_attr_child_by_num, except the dictionary's flat
+ * (parent, attr) index is checked first, so hot paths which already hold
+ * the dictionary avoid walking the per-parent bins entirely.
+ *
+ * @param[in] dict		the attribute was defined in.
+ * @param[in] parent		to check for child in.
+ * @param[in] attr		number to look for.
+ * @return
+ *	- The child attribute on success.
+ *	- NULL if the child attribute does not exist.
+ */
+fr_dict_attr_t const *fr_dict_attr_by_child_num(fr_dict_t const *dict,
+						fr_dict_attr_t const *parent, unsigned int attr)
+{
+	fr_dict_attr_t const *da;
+
+	if (!dict || !dict->attributes_by_num) return fr_dict_attr_child_by_num(parent, attr);
+
+	DA_VERIFY(parent);
+
+	if (parent->type == FR_TYPE_GROUP) parent = parent->ref;
+
+	da = fr_hash_table_finddata(dict->attributes_by_num,
+				    &(fr_dict_attr_t){ .parent = parent, .attr = attr });
+	if (da) return da;
+
+	/*
+	 *	Unknown attributes, and the few duplicate numbers
+	 *	dropped from the index, are only found in the bins.
+	 */
+	return fr_dict_attr_child_by_num(parent, attr);
+}
+
 /** Lookup the structure representing an enum value in a #fr_dict_attr_t
  *
  * @param[in] da		to search in.
@@ -2163,6 +2306,11 @@ static int _dict_free(fr_dict_t *dict)
 {
 	if (dict == fr_dict_internal) fr_dict_internal = NULL;
 
+	/*
+	 *	Invalidate the per-thread attribute name caches.
+	 */
+	dict_cache_generation++;
+
 	if (!fr_cond_assert(!dict->in_protocol_by_name || fr_hash_table_delete(protocol_by_name, dict))) {
 		fr_strerror_printf("Failed removing dictionary from protocol hash \"%s\"", dict->root->name);
 		return -1;
@@ -2235,6 +2383,13 @@ fr_dict_t *dict_alloc(TALLOC_CTX *ctx)
 	 */
 	dict->autoref = fr_hash_table_create(dict, dict_protocol_name_hash, dict_protocol_name_cmp, NULL);
 
+	/*
+	 *	Flat index of attributes by (parent, number), so hot
+	 *	lookups don't have to walk the per-parent bins.
+	 */
+	dict->attributes_by_num = fr_hash_table_create(dict, dict_attr_num_hash, dict_attr_num_cmp, NULL);
+	if (!dict->attributes_by_num) goto error;
+
 	/*
 	 *	Horrible hacks for combo-IP.
 	 */
@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rbtree.h>
 #include <freeradius-devel/util/strerror.h>
@@ -40,6 +41,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/token.h>
+#include <dlfcn.h>
 #include <sys/stat.h>
 
 #define FR_EV_BATCH_FDS (256)
@@ -85,6 +87,10 @@ struct fr_event_timer {
 
 	fr_event_timer_t const	**parent;		//!< Previous timer.
 	int32_t			heap_id;	       	//!< Where to store opaque heap data.
+
+	fr_dlist_t		entry;			//!< Entry in a timer wheel slot.
+	uint64_t		slot;			//!< Absolute index of the wheel slot the event expires in.
+	bool			in_wheel;		//!< Event is in the timer wheel, not the heap.
 };
 
 typedef enum {
@@ -295,9 +301,20 @@ struct fr_event_list {
 	fr_heap_t		*times;			//!< of timer events to be executed.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
+	fr_dlist_head_t		*wheel_slots;		//!< Timer wheel slots, NULL if the wheel is disabled.
+	fr_time_delta_t		wheel_granularity;	//!< Width of each wheel slot.
+	uint32_t		wheel_num_slots;	//!< Number of slots in the wheel.
+	uint64_t		wheel_next;		//!< Absolute index of the next slot to expire.
+	int			wheel_num_entries;	//!< Number of events currently in the wheel.
+
 	int			exit;			//!< If non-zero, the event loop will exit after its current
 							///< iteration, returning this value.
 
+	rbtree_t		*cb_stats;		//!< Per-callback timing statistics.  NULL unless
+							///< instrumentation has been enabled.
+	fr_time_delta_t		cb_slow_threshold;	//!< Warn whenever a single callback runs for longer
+							///< than this.  0 disables the warning.
+
 	fr_time_t 		now;			//!< The last time the event list was serviced.
 	bool			dispatch;		//!< Whether the event list is currently dispatching events.
 
@@ -354,6 +371,100 @@ static int fr_event_fd_cmp(void const *a, void const *b)
 	return (ev_a->filter > ev_b->filter) - (ev_a->filter < ev_b->filter);
 }
 
+/** Compare two callback statistics entries by callback address
+ *
+ * @param[in] a the first statistics entry.
+ * @param[in] b the second statistics entry.
+ * @return
+ *	- +1 if a's callback address is higher than b's.
+ *	- -1 if a's callback address is lower than b's.
+ *	- 0 if both entries refer to the same callback.
+ */
+static int fr_event_cb_stats_cmp(void const *a, void const *b)
+{
+	fr_event_cb_stats_t const	*stats_a = a, *stats_b = b;
+
+	return (stats_a->callback > stats_b->callback) - (stats_a->callback < stats_b->callback);
+}
+
+/** Record the runtime of a single callback invocation
+ *
+ * Updates the aggregate statistics for the callback, allocating an entry
+ * on first sight, and warns if the invocation exceeded the configured
+ * stall threshold.
+ *
+ * @param[in] el	the callback was dispatched from.
+ * @param[in] callback	address of the function which was run.
+ * @param[in] elapsed	how long the invocation took.
+ */
+static void event_callback_account(fr_event_list_t *el, void const *callback, fr_time_delta_t elapsed)
+{
+	fr_event_cb_stats_t	*stats;
+
+	stats = rbtree_finddata(el->cb_stats, &(fr_event_cb_stats_t){ .callback = callback });
+	if (!stats) {
+		Dl_info	info = { .dli_sname = NULL };
+		void	*addr;
+
+		stats = talloc_zero(NULL, fr_event_cb_stats_t);
+		if (unlikely(!stats)) return;
+
+		stats->callback = callback;
+
+		/*
+		 *	Resolve the symbol once, so both the stall
+		 *	warning and the statistics report can name
+		 *	the callback without debug tooling.
+		 */
+		memcpy(&addr, &callback, sizeof(addr));
+		(void) dladdr(addr, &info);
+		stats->name = info.dli_sname ? talloc_typed_strdup(stats, info.dli_sname) : "<unknown>";
+
+		stats->ewma = elapsed;
+
+		if (unlikely(!rbtree_insert(el->cb_stats, stats))) {
+			talloc_free(stats);
+			return;
+		}
+	} else {
+		stats->ewma += (elapsed - stats->ewma) / 8;
+	}
+
+	stats->calls++;
+	if (elapsed > stats->max) stats->max = elapsed;
+
+	if (el->cb_slow_threshold && (elapsed >= el->cb_slow_threshold)) {
+		fr_log(&default_log, L_WARN, __FILE__, __LINE__,
+		       "Event loop stalled for %.3fms in callback %s (%p)",
+		       (double) elapsed / 1000000, stats->name, callback);
+	}
+}
+
+/** Dispatch a file descriptor callback, timing it if instrumentation is enabled
+ *
+ * @param[in] el	the callback is being dispatched from.
+ * @param[in] callback	to run.
+ * @param[in] fd	the callback was registered for.
+ * @param[in] flags	from kevent.
+ * @param[in] uctx	the callback was registered with.
+ */
+static inline void event_fd_dispatch(fr_event_list_t *el, fr_event_fd_cb_t callback, int fd, int flags, void *uctx)
+{
+	fr_time_t	start;
+	void const	*addr;
+
+	if (!el->cb_stats) {
+		callback(el, fd, flags, uctx);
+		return;
+	}
+
+	memcpy(&addr, &callback, sizeof(addr));
+
+	start = fr_time();
+	callback(el, fd, flags, uctx);	/* may free the event being serviced */
+	event_callback_account(el, addr, fr_time() - start);
+}
+
 /** Return the number of file descriptors is_registered with this event loop
  *
  */
@@ -373,7 +484,7 @@ int fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_heap_num_elements(el->times) + el->wheel_num_entries;
 }
 
 /** Return the kq associated with an event list.
@@ -408,6 +519,80 @@ fr_time_t fr_event_list_time(fr_event_list_t *el)
 	}
 }
 
+/** Enable per-callback timing statistics for an event list
+ *
+ * Every timer and IO callback dispatched by the event list is timed, with
+ * the results aggregated per callback function.  Statistics may be
+ * retrieved with #fr_event_list_cb_stats_walk.
+ *
+ * Instrumentation adds two clock reads and a tree lookup to every callback
+ * dispatched, so it should be left disabled unless the visibility is needed.
+ *
+ * @param[in] el		to instrument.
+ * @param[in] slow_threshold	log a warning naming the callback whenever a single
+ *				invocation runs for longer than this.  0 disables
+ *				the warning, leaving just the statistics.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_list_instrument(fr_event_list_t *el, fr_time_delta_t slow_threshold)
+{
+	if (unlikely(!el)) return -1;
+
+	el->cb_slow_threshold = slow_threshold;
+
+	if (!el->cb_stats) {
+		el->cb_stats = rbtree_talloc_create(el, fr_event_cb_stats_cmp, fr_event_cb_stats_t,
+						    rbtree_node_talloc_free, 0);
+		if (unlikely(!el->cb_stats)) {
+			fr_strerror_printf("Failed allocating callback statistics tree");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Stores the user walker during an #fr_event_list_cb_stats_walk
+ *
+ */
+typedef struct {
+	fr_event_cb_stats_walk_t	walker;		//!< User walker to call for each entry.
+	void				*uctx;		//!< User ctx to pass to the walker.
+} event_cb_stats_walk_ctx_t;
+
+/** Adapt an #rb_walker_t call to the statistics walker
+ *
+ */
+static int event_cb_stats_walk_adapter(void *data, void *uctx)
+{
+	event_cb_stats_walk_ctx_t	*wctx = uctx;
+
+	return wctx->walker(talloc_get_type_abort(data, fr_event_cb_stats_t), wctx->uctx);
+}
+
+/** Iterate over the per-callback statistics gathered by an event list
+ *
+ * @param[in] el	to report statistics for.
+ * @param[in] walker	called once for each callback dispatched since
+ *			instrumentation was enabled.
+ * @param[in] uctx	passed to the walker.
+ * @return
+ *	- 0 on success.
+ *	- -1 if instrumentation has not been enabled with #fr_event_list_instrument.
+ */
+int fr_event_list_cb_stats_walk(fr_event_list_t *el, fr_event_cb_stats_walk_t walker, void *uctx)
+{
+	event_cb_stats_walk_ctx_t	wctx = { .walker = walker, .uctx = uctx };
+
+	if (unlikely(!el) || !el->cb_stats) return -1;
+
+	rbtree_walk(el->cb_stats, RBTREE_IN_ORDER, event_cb_stats_walk_adapter, &wctx);
+
+	return 0;
+}
+
 /** Build a new evset based on function pointers present
  *
  * @note The contents of active functions may be inconsistent if this function errors.  But the
@@ -950,6 +1135,158 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 }
 
 
+/** Enable a timer wheel for coarse-granularity timers
+ *
+ * Timer events are normally tracked in a heap, where insert and extract
+ * are O(log n) in the number of pending events.  With hundreds of
+ * thousands of pending timers (e.g. cleanup_delay and max_request_time
+ * during retransmit storms) the comparisons dominate.
+ *
+ * The wheel is a hashed timing wheel.  Insert and delete are O(1), and
+ * events are swept into the heap for dispatch as their slot expires.
+ * Events placed in the wheel fire up to one slot width late (never
+ * early), so the granularity should reflect the accuracy the event
+ * list's timers actually need.  Events expiring within the current
+ * slot stay in the heap, and retain exact ordering.
+ *
+ * @param[in] el		to enable the wheel for.
+ * @param[in] granularity	width of each slot in nanoseconds.
+ * @param[in] num_slots		number of slots in the wheel.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_timer_wheel_enable(fr_event_list_t *el, fr_time_delta_t granularity, uint32_t num_slots)
+{
+	fr_dlist_head_t *slots;
+	uint32_t	i;
+
+	if (unlikely(!el)) {
+		fr_strerror_printf("Invalid arguments: NULL event list");
+		return -1;
+	}
+
+	if (unlikely((granularity <= 0) || (num_slots == 0))) {
+		fr_strerror_printf("Invalid arguments: granularity and num_slots must be positive");
+		return -1;
+	}
+
+	if (unlikely(el->wheel_slots != NULL)) {
+		fr_strerror_printf("Timer wheel already enabled");
+		return -1;
+	}
+
+	slots = talloc_array(el, fr_dlist_head_t, num_slots);
+	if (unlikely(!slots)) return -1;
+
+	for (i = 0; i < num_slots; i++) fr_dlist_init(&slots[i], fr_event_timer_t, entry);
+
+	el->wheel_granularity = granularity;
+	el->wheel_num_slots = num_slots;
+	el->wheel_next = (uint64_t) fr_time() / (uint64_t) granularity;
+	el->wheel_slots = slots;
+
+	return 0;
+}
+
+/** Place a timer event in the wheel, if it's eligible
+ *
+ * @param[in] el	the event belongs to.
+ * @param[in] ev	to insert.
+ * @return
+ *	- true if the event was placed in the wheel.
+ *	- false if the event must go into the heap.
+ */
+static bool event_wheel_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	uint64_t slot;
+
+	if (!el->wheel_slots) return false;
+
+	/*
+	 *	Round the expiry up to a slot boundary, so the event
+	 *	never fires early.  Events due before the next slot
+	 *	expires need the heap for accuracy.
+	 */
+	slot = ((uint64_t) ev->when + (uint64_t) el->wheel_granularity - 1) / (uint64_t) el->wheel_granularity;
+	if (slot <= el->wheel_next) return false;
+
+	ev->slot = slot;
+	ev->in_wheel = true;
+	fr_dlist_insert_tail(&el->wheel_slots[slot % el->wheel_num_slots], ev);
+	el->wheel_num_entries++;
+
+	return true;
+}
+
+/** Remove a timer event from the wheel
+ *
+ */
+static void event_wheel_remove(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_dlist_remove(&el->wheel_slots[ev->slot % el->wheel_num_slots], ev);
+	ev->in_wheel = false;
+	el->wheel_num_entries--;
+}
+
+/** Sweep due wheel events into the heap
+ *
+ * @param[in] el	to advance the wheel for.
+ * @param[in] when	the current time.
+ */
+static void event_wheel_advance(fr_event_list_t *el, fr_time_t when)
+{
+	uint64_t target, stop, slot;
+
+	if (!el->wheel_slots) return;
+
+	target = (uint64_t) when / (uint64_t) el->wheel_granularity;
+	if (target < el->wheel_next) return;
+
+	if (!el->wheel_num_entries) {
+		el->wheel_next = target + 1;
+		return;
+	}
+
+	/*
+	 *	One full lap visits every slot, and we dispatch every
+	 *	due event in the slots we visit, so never do more.
+	 */
+	stop = target;
+	if ((stop - el->wheel_next) >= el->wheel_num_slots) {
+		stop = el->wheel_next + el->wheel_num_slots - 1;
+	}
+
+	for (slot = el->wheel_next; slot <= stop; slot++) {
+		fr_dlist_head_t		*head = &el->wheel_slots[slot % el->wheel_num_slots];
+		fr_event_timer_t	*ev, *next;
+
+		for (ev = fr_dlist_head(head); ev; ev = next) {
+			next = fr_dlist_next(head, ev);
+
+			/*
+			 *	Not due for another lap of the wheel.
+			 */
+			if (ev->slot > target) continue;
+
+			event_wheel_remove(el, ev);
+
+			/*
+			 *	Dispatch through the heap, so firing
+			 *	order matches heap-only operation.
+			 */
+			if (!fr_cond_assert(fr_heap_insert(el->times, ev) == 0)) {
+				fr_dlist_insert_tail(head, ev);
+				ev->in_wheel = true;
+				el->wheel_num_entries++;
+				return;
+			}
+		}
+	}
+
+	el->wheel_next = target + 1;
+}
+
 /** Delete a timer event from the event list
  *
  * @param[in] el	to delete event from.
@@ -982,14 +1319,19 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	fr_event_timer_t const **ev_p;
 	int		ret;
 
-	ret = fr_heap_extract(el->times, ev);
+	if (ev->in_wheel) {
+		event_wheel_remove(el, ev);
+		ret = 0;
+	} else {
+		ret = fr_heap_extract(el->times, ev);
+	}
 
 	ev_p = ev->parent;
 	rad_assert(*(ev->parent) == ev);
 	*ev_p = NULL;
 
 	/*
-	 *	Events MUST be in the heap
+	 *	Events MUST be in the wheel or the heap
 	 */
 	if (!fr_cond_assert(ret == 0)) {
 		fr_strerror_printf("Event not found in heap");
@@ -1082,7 +1424,11 @@ int fr_event_timer_at(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t con
 		 *	Event may have fired, in which case the
 		 *	event will no longer be in the event loop.
 		 */
-		(void) fr_heap_extract(el->times, ev);
+		if (ev->in_wheel) {
+			event_wheel_remove(el, ev);
+		} else {
+			(void) fr_heap_extract(el->times, ev);
+		}
 	}
 
 	ev->el = el;
@@ -1092,7 +1438,8 @@ int fr_event_timer_at(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t con
 	ev->linked_ctx = ctx;
 	ev->parent = ev_p;
 
-	if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+	if (!event_wheel_insert(el, ev) &&
+	    unlikely(fr_heap_insert(el->times, ev) < 0)) {
 		talloc_free(ev);
 		return -1;
 	}
@@ -1366,6 +1713,11 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
+	/*
+	 *	Move any due wheel events into the heap.
+	 */
+	event_wheel_advance(el, *when);
+
 	if (fr_heap_num_elements(el->times) == 0) {
 		*when = 0;
 		return 0;
@@ -1395,7 +1747,18 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	 */
 	fr_event_timer_delete(el, ev->parent);
 
-	callback(el, *when, uctx);
+	if (el->cb_stats) {
+		fr_time_t	start;
+		void const	*addr;
+
+		memcpy(&addr, &callback, sizeof(addr));
+
+		start = fr_time();
+		callback(el, *when, uctx);
+		event_callback_account(el, addr, fr_time() - start);
+	} else {
+		callback(el, *when, uctx);
+	}
 
 	return 1;
 }
@@ -1431,6 +1794,9 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
+		fr_time_t	next = 0;
+		bool		next_set = false;
+
 		if (fr_heap_num_elements(el->times) > 0) {
 			fr_event_timer_t *ev;
 
@@ -1440,13 +1806,32 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 				return -1;
 			}
 
+			next = ev->when;
+			next_set = true;
+		}
+
+		/*
+		 *	The wheel doesn't track its earliest event, so
+		 *	wake when the next slot expires.
+		 */
+		if (el->wheel_num_entries) {
+			fr_time_t tick = (fr_time_t) (el->wheel_next * (uint64_t) el->wheel_granularity);
+
+			if (!next_set || (tick < next)) {
+				next = tick;
+				next_set = true;
+			}
+		}
+
+		if (next_set) {
 			el->now = fr_time();
+			fr_time_coarse_update(el->now);
 
 			/*
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (ev->when > el->now) when = ev->when - el->now;
+			if (next > el->now) when = next - el->now;
 
 			wake = &when;
 			num_timer_events = 1;
@@ -1631,10 +2016,10 @@ service:
 			 *	we *DON'T* want to call the write event.
 			 */
 			if (el->events[i].filter == EVFILT_READ) {
-				ef->active.io.read(el, ef->fd, flags, ef->uctx);
+				event_fd_dispatch(el, ef->active.io.read, ef->fd, flags, ef->uctx);
 			}
 			else if (el->events[i].filter == EVFILT_WRITE) {
-				ef->active.io.write(el, ef->fd, flags, ef->uctx);
+				event_fd_dispatch(el, ef->active.io.write, ef->fd, flags, ef->uctx);
 			}
 			break;
 
@@ -1709,11 +2094,12 @@ service:
 	talloc_list_free(&el->fd_to_free);
 
 	el->now = fr_time();
+	fr_time_coarse_update(el->now);
 
 	/*
 	 *	Run all of the timer events.
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if ((fr_heap_num_elements(el->times) > 0) || el->wheel_num_entries) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -1794,6 +2180,18 @@ static int _event_list_free(fr_event_list_t *el)
 
 	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(el, &ev);
 
+	if (el->wheel_slots) {
+		uint32_t i;
+
+		for (i = 0; i < el->wheel_num_slots; i++) {
+			fr_event_timer_t *wev;
+
+			while ((wev = fr_dlist_head(&el->wheel_slots[i])) != NULL) {
+				fr_event_timer_delete(el, wev->parent);
+			}
+		}
+	}
+
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
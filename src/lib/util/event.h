@@ -189,11 +189,38 @@ typedef union {
 	fr_event_vnode_func_t	vnode;			//!< vnode callback functions.
 } fr_event_funcs_t;
 
+/** Accumulated timing statistics for a single event callback
+ *
+ * Only gathered after #fr_event_list_instrument has been called on the
+ * event list dispatching the callback.
+ */
+typedef struct {
+	void const		*callback;		//!< The function registered for the event.
+	char const		*name;			//!< Symbol name of the callback, if resolvable.
+	uint64_t		calls;			//!< Number of times the callback has been run.
+	fr_time_delta_t		ewma;			//!< Exponentially weighted moving average of
+							///< the callback's runtime.
+	fr_time_delta_t		max;			//!< Longest single runtime observed.
+} fr_event_cb_stats_t;
+
+/** Function called for each callback seen by #fr_event_list_cb_stats_walk
+ *
+ * @param[in] stats	for a single callback.
+ * @param[in] uctx	passed to #fr_event_list_cb_stats_walk.
+ * @return
+ *	- 0 to continue walking.
+ *	- <0 to stop.
+ */
+typedef int (*fr_event_cb_stats_walk_t)(fr_event_cb_stats_t const *stats, void *uctx);
+
 int		fr_event_list_num_fds(fr_event_list_t *el);
 int		fr_event_list_num_timers(fr_event_list_t *el);
 int		fr_event_list_kq(fr_event_list_t *el);
 fr_time_t	fr_event_list_time(fr_event_list_t *el);
 
+int		fr_event_list_instrument(fr_event_list_t *el, fr_time_delta_t slow_threshold);
+int		fr_event_list_cb_stats_walk(fr_event_list_t *el, fr_event_cb_stats_walk_t walker, void *uctx);
+
 int		fr_event_fd_delete(fr_event_list_t *el, int fd, fr_event_filter_t filter);
 
 int		fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
@@ -220,6 +247,7 @@ int		fr_event_timer_in(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t co
 				  fr_time_delta_t delta, fr_event_cb_t callback, void const *uctx);
 int		fr_event_timer_delete(fr_event_list_t *el, fr_event_timer_t const **ev);
 int		fr_event_timer_run(fr_event_list_t *el, fr_time_t *when);
+int		fr_event_timer_wheel_enable(fr_event_list_t *el, fr_time_delta_t granularity, uint32_t num_slots);
 
 uintptr_t      	fr_event_user_insert(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
 int		fr_event_user_delete(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
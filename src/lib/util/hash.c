@@ -39,7 +39,15 @@ RCSID("$Id$")
  *	A reasonable number of buckets to start off with.
  *	Should be a power of two.
  */
-#define FR_HASH_NUM_BUCKETS (64)
+#define FR_HASH_NUM_BUCKETS_BITS (6)
+#define FR_HASH_NUM_BUCKETS (1 << FR_HASH_NUM_BUCKETS_BITS)
+
+/*
+ *	Buckets are stored in power-of-two sized segments, which are
+ *	never reallocated.  24 segments is 2^29 buckets, which is more
+ *	elements than "int num_elements" can count.
+ */
+#define FR_HASH_MAX_SEGMENTS (24)
 
 struct fr_hash_entry_s {
 	fr_hash_entry_t *next;
@@ -51,6 +59,7 @@ struct fr_hash_entry_s {
 struct fr_hash_table_t {
 	int			num_elements;
 	int			num_buckets; /* power of 2 */
+	int			num_segments;
 	int			next_grow;
 	int			mask;
 
@@ -60,7 +69,7 @@ struct fr_hash_table_t {
 
 	fr_hash_entry_t		null;
 
-	fr_hash_entry_t		**buckets;
+	fr_hash_entry_t		**segments[FR_HASH_MAX_SEGMENTS];
 };
 
 #ifdef TESTING
@@ -174,6 +183,30 @@ static uint32_t parent_of(uint32_t key)
 }
 
 
+/*
+ *	Return the address of a bucket slot.
+ *
+ *	Segment 0 holds the first FR_HASH_NUM_BUCKETS buckets, and
+ *	each later segment doubles the table.  Growing the table
+ *	therefore allocates one new segment, and never moves, copies,
+ *	or re-hashes the existing buckets.  Entries migrate to the new
+ *	buckets lazily, when fr_hash_table_fixup() first touches them.
+ */
+static fr_hash_entry_t **hash_bucket(fr_hash_table_t const *ht, uint32_t entry)
+{
+	unsigned int h;
+
+	if (entry < FR_HASH_NUM_BUCKETS) return &ht->segments[0][entry];
+
+	/*
+	 *	The segment is named by the highest set bit, and the
+	 *	offset within it by the remaining bits.
+	 */
+	h = (8 * sizeof(unsigned int)) - 1 - __builtin_clz(entry);
+
+	return &ht->segments[h - (FR_HASH_NUM_BUCKETS_BITS - 1)][entry - (1U << h)];
+}
+
 static fr_hash_entry_t *list_find(fr_hash_table_t *ht,
 				    fr_hash_entry_t *head,
 				    uint32_t reversed,
@@ -251,22 +284,23 @@ static int list_delete(fr_hash_table_t *ht,
 static int _fr_hash_table_free(fr_hash_table_t *ht)
 {
 	int i;
-	fr_hash_entry_t *node, *next;
+	fr_hash_entry_t *bucket, *node, *next;
 
 	/*
 	 *	Walk over the buckets, freeing them all.
 	 */
 	for (i = 0; i < ht->num_buckets; i++) {
-		if (ht->buckets[i]) for (node = ht->buckets[i];
-					 node != &ht->null;
-					 node = next) {
+		bucket = *hash_bucket(ht, i);
+		if (bucket) for (node = bucket;
+				 node != &ht->null;
+				 node = next) {
 			next = node->next;
 			if (!node->data) continue; /* dummy entry */
 
 			talloc_free(node);
 		}
 	}
-	talloc_free(ht->buckets);
+	for (i = 0; i < ht->num_segments; i++) talloc_free(ht->segments[i]);
 
 	return 0;
 }
@@ -303,16 +337,17 @@ fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 	 */
 	ht->next_grow = (ht->num_buckets << 1) + (ht->num_buckets >> 1);
 
-	ht->buckets = talloc_zero_array(NULL, fr_hash_entry_t *, ht->num_buckets);
-	if (!ht->buckets) {
+	ht->segments[0] = talloc_zero_array(NULL, fr_hash_entry_t *, ht->num_buckets);
+	if (!ht->segments[0]) {
 		talloc_free(ht);
 		return NULL;
 	}
+	ht->num_segments = 1;
 
 	ht->null.reversed = ~0;
 	ht->null.key = ~0;
 	ht->null.next = &ht->null;
-	ht->buckets[0] = &ht->null;
+	ht->segments[0][0] = &ht->null;
 
 	return ht;
 }
@@ -331,14 +366,14 @@ fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
 {
 	uint32_t parent_entry;
-	fr_hash_entry_t **last, *cur;
+	fr_hash_entry_t **last, **bucket, *cur;
 	uint32_t this;
 
 	parent_entry = parent_of(entry);
 
 	/* parent_entry == entry if and only if entry == 0 */
 
-	if (!ht->buckets[parent_entry]) {
+	if (!*hash_bucket(ht, parent_entry)) {
 		fr_hash_table_fixup(ht, parent_entry);
 	}
 
@@ -347,16 +382,16 @@ static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
 	 *	don't belong here any more.  There may be multiple
 	 *	ones, so we can't have a naive algorithm...
 	 */
-	last = &ht->buckets[parent_entry];
+	last = hash_bucket(ht, parent_entry);
 	this = parent_entry;
 
 	for (cur = *last; cur != &ht->null; cur = cur->next) {
 		uint32_t real_entry;
 
 		real_entry = cur->key & ht->mask;
-		if (real_entry != this) { /* ht->buckets[real_entry] == NULL */
+		if (real_entry != this) { /* *hash_bucket(ht, real_entry) == NULL */
 			*last = &ht->null;
-			ht->buckets[real_entry] = cur;
+			*hash_bucket(ht, real_entry) = cur;
 			this = real_entry;
 		}
 
@@ -366,12 +401,13 @@ static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
 	/*
 	 *	We may NOT have initialized this bucket, so do it now.
 	 */
-	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
+	bucket = hash_bucket(ht, entry);
+	if (!*bucket) *bucket = &ht->null;
 }
 
 /*
- *	This should be a power of two.  Changing it to 4 doesn't seem
- *	to make any difference.
+ *	This MUST be 2.  Each new bucket segment doubles the size of
+ *	the table.
  */
 #define GROW_FACTOR (2)
 
@@ -380,15 +416,21 @@ static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
  */
 static void fr_hash_table_grow(fr_hash_table_t *ht)
 {
-	fr_hash_entry_t **buckets;
+	fr_hash_entry_t **segment;
 
-	buckets = talloc_zero_array(NULL, fr_hash_entry_t *, GROW_FACTOR * ht->num_buckets);
-	if (!buckets) return;
+	if (ht->num_segments == FR_HASH_MAX_SEGMENTS) return;
 
-	memcpy(buckets, ht->buckets, sizeof(*buckets) * ht->num_buckets);
-	talloc_free(ht->buckets); /* Free the old buckets */
+	/*
+	 *	The new segment holds buckets [num_buckets, 2 *
+	 *	num_buckets).  The existing buckets don't move, so
+	 *	there's no stop-the-world copy or re-hash; entries
+	 *	split into the new buckets lazily, as the new buckets
+	 *	are first touched.
+	 */
+	segment = talloc_zero_array(NULL, fr_hash_entry_t *, ht->num_buckets);
+	if (!segment) return;
 
-	ht->buckets = buckets;
+	ht->segments[ht->num_segments++] = segment;
 	ht->num_buckets *= GROW_FACTOR;
 	ht->next_grow *= GROW_FACTOR;
 	ht->mask = ht->num_buckets - 1;
@@ -407,7 +449,7 @@ int fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 	uint32_t key;
 	uint32_t entry;
 	uint32_t reversed;
-	fr_hash_entry_t *node;
+	fr_hash_entry_t **bucket, *node;
 
 	if (!ht || !data) return 0;
 
@@ -415,7 +457,8 @@ int fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 	entry = key & ht->mask;
 	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	bucket = hash_bucket(ht, entry);
+	if (!*bucket) fr_hash_table_fixup(ht, entry);
 
 	/*
 	 *	If we try to do our own memory allocation here, the
@@ -430,7 +473,7 @@ int fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 	memcpy(&node->data, &data, sizeof(node->data));
 
 	/* already in the table, can't insert it */
-	if (!list_insert(ht, &ht->buckets[entry], node)) {
+	if (!list_insert(ht, bucket, node)) {
 		talloc_free(node);
 		return 0;
 	}
@@ -454,6 +497,7 @@ static fr_hash_entry_t *fr_hash_table_find(fr_hash_table_t *ht, void const *data
 	uint32_t key;
 	uint32_t entry;
 	uint32_t reversed;
+	fr_hash_entry_t **bucket;
 
 	if (!ht) return NULL;
 
@@ -461,9 +505,10 @@ static fr_hash_entry_t *fr_hash_table_find(fr_hash_table_t *ht, void const *data
 	entry = key & ht->mask;
 	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	bucket = hash_bucket(ht, entry);
+	if (!*bucket) fr_hash_table_fixup(ht, entry);
 
-	return list_find(ht, ht->buckets[entry], reversed, data);
+	return list_find(ht, *bucket, reversed, data);
 }
 
 
@@ -514,7 +559,7 @@ void *fr_hash_table_yank(fr_hash_table_t *ht, void const *data)
 	uint32_t entry;
 	uint32_t reversed;
 	void *old;
-	fr_hash_entry_t *node;
+	fr_hash_entry_t **bucket, *node;
 
 	if (!ht) return NULL;
 
@@ -522,12 +567,13 @@ void *fr_hash_table_yank(fr_hash_table_t *ht, void const *data)
 	entry = key & ht->mask;
 	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	bucket = hash_bucket(ht, entry);
+	if (!*bucket) fr_hash_table_fixup(ht, entry);
 
-	node = list_find(ht, ht->buckets[entry], reversed, data);
+	node = list_find(ht, *bucket, reversed, data);
 	if (!node) return NULL;
 
-	list_delete(ht, &ht->buckets[entry], node);
+	list_delete(ht, bucket, node);
 	ht->num_elements--;
 
 	old = node->data;
@@ -558,7 +604,7 @@ int fr_hash_table_delete(fr_hash_table_t *ht, void const *data)
 void fr_hash_table_free(fr_hash_table_t *ht)
 {
 	int i;
-	fr_hash_entry_t *node, *next;
+	fr_hash_entry_t *bucket, *node, *next;
 
 	if (!ht) return;
 
@@ -567,9 +613,10 @@ void fr_hash_table_free(fr_hash_table_t *ht)
 	 */
 	if (ht->free) {
 		for (i = 0; i < ht->num_buckets; i++) {
-			if (ht->buckets[i]) for (node = ht->buckets[i];
-						 node != &ht->null;
-						 node = next) {
+			bucket = *hash_bucket(ht, i);
+			if (bucket) for (node = bucket;
+					 node != &ht->null;
+					 node = next) {
 				next = node->next;
 				if (!node->data) continue; /* dummy entry */
 
@@ -608,14 +655,15 @@ int fr_hash_table_walk(fr_hash_table_t *ht,
 	if (!ht || !callback) return 0;
 
 	for (i = ht->num_buckets - 1; i >= 0; i--) {
-		fr_hash_entry_t *node, *next;
+		fr_hash_entry_t **bucket, *node, *next;
 
 		/*
 		 *	Ensure that the current bucket is filled.
 		 */
-		if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
+		bucket = hash_bucket(ht, i);
+		if (!*bucket) fr_hash_table_fixup(ht, i);
 
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
+		for (node = *bucket; node != &ht->null; node = next) {
 			next = node->next;
 
 			rcode = callback(context, node->data);
@@ -660,9 +708,12 @@ void *fr_hash_table_iter_next(fr_hash_table_t *ht, fr_hash_iter_t *iter)
 	 *	we should return
 	 */
 	while ((--iter->bucket) >= 0) {
-		if (!ht->buckets[iter->bucket]) fr_hash_table_fixup(ht, iter->bucket);
+		fr_hash_entry_t **bucket;
 
-		node = ht->buckets[iter->bucket];
+		bucket = hash_bucket(ht, iter->bucket);
+		if (!*bucket) fr_hash_table_fixup(ht, iter->bucket);
+
+		node = *bucket;
 		if (node == &ht->null) continue;	/* This bucket was empty too... */
 
 		iter->node = node->next;		/* Store the next one to examine */
@@ -709,20 +760,21 @@ int fr_hash_table_info(fr_hash_table_t *ht)
 	for (i = 0; i < ht->num_buckets; i++) {
 		uint32_t key;
 		int load;
-		fr_hash_entry_t *node, *next;
+		fr_hash_entry_t *bucket, *node, *next;
 
 		/*
 		 *	If we haven't inserted or looked up an entry
 		 *	in a bucket, it's uninitialized.
 		 */
-		if (!ht->buckets[i]) {
+		bucket = *hash_bucket(ht, i);
+		if (!bucket) {
 			uninitialized++;
 			continue;
 		}
 
 		load = 0;
 		key = ~0;
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
+		for (node = bucket; node != &ht->null; node = next) {
 			if (node->reversed == key) {
 				collisions++;
 			} else {
@@ -778,39 +830,177 @@ int fr_hash_table_info(fr_hash_table_t *ht)
  *	Which also includes public domain source.  We've re-written
  *	it here for our purposes.
  */
-uint32_t fr_hash(void const *data, size_t size)
+static uint32_t hash_fnv_update(void const *data, size_t size, uint32_t hash)
 {
 	uint8_t const *p = data;
 	uint8_t const *q = p + size;
-	uint32_t      hash = FNV_MAGIC_INIT;
 
-	/*
-	 *	FNV-1 hash each octet in the buffer
-	 */
 	while (p != q) {
 		/*
-		 *	XOR the 8-bit quantity into the bottom of
+		 *	Multiply by the 32-bit magic FNV prime, mod 2^32,
+		 *	then XOR the 8-bit quantity into the bottom of
 		 *	the hash.
 		 */
+		hash *= FNV_MAGIC_PRIME;
 		hash ^= (uint32_t) (*p++);
+	}
+
+	return hash;
+}
+
+/*
+ *	Hardware CRC32C processes 8 bytes per instruction, which is
+ *	5-10x the per-byte throughput of FNV.  CRC on its own is a
+ *	poor bucket hash (the low bits of short, similar keys are too
+ *	regular), so the result is run through a final avalanche mix.
+ *
+ *	The mixed output is just as stable as the FNV output within
+ *	one process, which is all the callers need.  Nothing persists
+ *	these hashes.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#  include <cpuid.h>
+#  include <string.h>
+#  define HASH_HAVE_HW_CRC32
+
+static bool hash_crc32_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+
+	return (ecx & bit_SSE4_2) != 0;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t hash_crc32_raw(void const *data, size_t size, uint32_t hash)
+{
+	uint8_t const *p = data;
+	uint8_t const *q = p + size;
+
+	while ((size_t) (q - p) >= sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));	/* p may not be aligned */
+		hash = (uint32_t) __builtin_ia32_crc32di(hash, word);
+		p += sizeof(word);
+	}
+
+	while (p != q) hash = __builtin_ia32_crc32qi(hash, *p++);
 
+	return hash;
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#  include <arm_acle.h>
+#  include <string.h>
+#  include <sys/auxv.h>
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1 << 7)
+#  endif
+#  define HASH_HAVE_HW_CRC32
+
+static bool hash_crc32_available(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+__attribute__((target("+crc")))
+static uint32_t hash_crc32_raw(void const *data, size_t size, uint32_t hash)
+{
+	uint8_t const *p = data;
+	uint8_t const *q = p + size;
+
+	while ((size_t) (q - p) >= sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));	/* p may not be aligned */
+		hash = __crc32cd(hash, word);
+		p += sizeof(word);
+	}
+
+	while (p != q) hash = __crc32cb(hash, *p++);
+
+	return hash;
+}
+#endif
+
+#ifdef HASH_HAVE_HW_CRC32
+static uint32_t hash_crc32_update(void const *data, size_t size, uint32_t hash)
+{
+	hash = hash_crc32_raw(data, size, hash);
+
+	/*
+	 *	Finalise with an avalanche mix (the one from Murmur3)
+	 *	so that every input bit affects every output bit.
+	 */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+#endif
+
+static uint32_t hash_select_update(void const *data, size_t size, uint32_t hash);
+
+/*
+ *	Points at the best implementation the CPU supports.  Starts
+ *	out pointing at the selector, which replaces it on the first
+ *	call, i.e. during single threaded startup when the dictionaries
+ *	are loaded.  If two threads do race here they write the same
+ *	value, so the race is benign.
+ */
+static uint32_t (*hash_update)(void const *data, size_t size, uint32_t hash) = hash_select_update;
+
+/** Pick a hash implementation, then perform the requested hash
+ *
+ */
+static uint32_t hash_select_update(void const *data, size_t size, uint32_t hash)
+{
+#ifdef HASH_HAVE_HW_CRC32
+	if (hash_crc32_available()) {
+		hash_update = hash_crc32_update;
+	} else
+#endif
+	hash_update = hash_fnv_update;
+
+	return hash_update(data, size, hash);
+}
+
+/*
+ *	A fast hash function, for short binary keys.
+ *
+ *	This is the stable, portable FNV-1a definition.  Hash values
+ *	from this function are persisted to disk (e.g. by the mmap
+ *	cache driver, whose files are built by an external generator),
+ *	so the output MUST NOT change.  Use fr_hash_fast() for purely
+ *	in-memory hashes.
+ */
+uint32_t fr_hash(void const *data, size_t size)
+{
+	uint8_t const *p = data;
+	uint8_t const *q = p + size;
+	uint32_t      hash = FNV_MAGIC_INIT;
+
+	while (p != q) {
 		/*
-		 *	Multiple by 32-bit magic FNV prime, mod 2^32
+		 *	XOR the 8-bit quantity into the bottom of
+		 *	the hash, then multiply by the 32-bit magic
+		 *	FNV prime, mod 2^32.
 		 */
+		hash ^= (uint32_t) (*p++);
 		hash *= FNV_MAGIC_PRIME;
-#if 0
-		/*
-		 *	Potential optimization.
-		 */
-		hash += (hash<<1) + (hash<<4) + (hash<<7) + (hash<<8) + (hash<<24);
-#endif
-    }
+	}
 
-    return hash;
+	return hash;
 }
 
 /*
- *	Continue hashing data.
+ *	Continue hashing data.  As with fr_hash(), the output is
+ *	stable, and MUST NOT change.
  */
 uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
 {
@@ -820,10 +1010,28 @@ uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
 	while (p != q) {
 		hash *= FNV_MAGIC_PRIME;
 		hash ^= (uint32_t) (*p++);
-    }
+	}
+
+	return hash;
+}
 
-    return hash;
+/** Hash short binary keys, trading stability for speed
+ *
+ * 5-10x the throughput of fr_hash() where the CPU has a CRC32C
+ * instruction.  The output depends on the CPU, so it MUST NOT be
+ * persisted, or compared across processes.
+ */
+uint32_t fr_hash_fast(void const *data, size_t size)
+{
+	return hash_update(data, size, FNV_MAGIC_INIT);
+}
 
+/** Continue hashing data, with the same caveats as fr_hash_fast()
+ *
+ */
+uint32_t fr_hash_fast_update(void const *data, size_t size, uint32_t hash)
+{
+	return hash_update(data, size, hash);
 }
 
 /*
@@ -50,6 +50,8 @@ typedef struct {
  */
 uint32_t fr_hash(void const *, size_t);
 uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash);
+uint32_t fr_hash_fast(void const *, size_t);
+uint32_t fr_hash_fast_update(void const *data, size_t size, uint32_t hash);
 uint32_t fr_hash_string(char const *p);
 uint32_t fr_hash_case_string(char const *p);
 
@@ -177,6 +177,106 @@ static void fr_heap_bubble(fr_heap_t *hp, int32_t child)
 }
 
 
+/** Restore the heap property downwards from parent, within the first max elements
+ *
+ */
+static void fr_heap_sift_down(fr_heap_t *hp, int32_t parent, int32_t max)
+{
+	for (;;) {
+		int32_t child = HEAP_LEFT(parent);
+
+		if (child >= max) break;
+
+		/*
+		 *	Maybe take the right child.
+		 */
+		if ((child + 1 < max) &&
+		    (hp->cmp(hp->p[child + 1], hp->p[child]) < 0)) {
+			child = child + 1;
+		}
+
+		if (hp->cmp(hp->p[parent], hp->p[child]) < 0) break;
+
+		HEAP_SWAP(hp->p[parent], hp->p[child]);
+		SET_OFFSET(hp, parent);
+
+		parent = child;
+	}
+	SET_OFFSET(hp, parent);
+}
+
+/** Insert many elements into the heap at once
+ *
+ * The elements are appended to the heap's array, and the whole heap is
+ * then re-ordered with Floyd's heapify, which is O(n), instead of the
+ * O(n log n) of repeated #fr_heap_insert calls.  Useful when thousands
+ * of timers/requests are re-registered at once, e.g. detail file
+ * replay at startup.
+ *
+ * @param[in] hp	The heap to insert elements into.
+ * @param[in] data	Array of elements to insert.
+ * @param[in] num	Number of elements in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (heap full or malloc error).
+ */
+int fr_heap_from_array(fr_heap_t *hp, void * const data[], uint32_t num)
+{
+	int32_t i, total;
+
+	if (num == 0) return 0;
+
+	if ((hp->num_elements + (uint64_t)num) > INT32_MAX) {
+		fr_strerror_printf("Heap is full");
+		return -1;
+	}
+	total = hp->num_elements + num;
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (hp->type) for (i = 0; i < (int32_t)num; i++) {
+		(void)_talloc_get_type_abort(data[i], hp->type, __location__);
+	}
+#endif
+
+	/*
+	 *	Grow the heap to fit all of the new elements, keeping
+	 *	the doubling behaviour of fr_heap_insert.
+	 */
+	if ((size_t)total > hp->size) {
+		void	**n;
+		size_t	n_size = hp->size;
+
+		while (n_size < (size_t)total) n_size *= 2;
+
+		n = talloc_realloc(hp, hp->p, void *, n_size);
+		if (!n) {
+			fr_strerror_printf("Failed expanding heap");
+			return -1;
+		}
+		hp->size = n_size;
+		hp->p = n;
+	}
+
+	memcpy(hp->p + hp->num_elements, data, num * sizeof(*data));
+	hp->num_elements = total;
+
+	/*
+	 *	Floyd's heapify.  Leaves are trivially heaps, so start
+	 *	at the last internal node and sift down.
+	 */
+	for (i = (total / 2) - 1; i >= 0; i--) {
+		fr_heap_sift_down(hp, i, total);
+	}
+
+	/*
+	 *	The sifts only set the offsets of the nodes they
+	 *	touch, fix up the rest.
+	 */
+	for (i = 0; i < total; i++) SET_OFFSET(hp, i);
+
+	return 0;
+}
+
 /** Remove the top element, or object
  *
  * @param[in] hp	The heap to insert an element into.
@@ -267,6 +367,55 @@ void *fr_heap_pop(fr_heap_t *hp)
 }
 
 
+/** Remove multiple elements from the top of the heap, in sorted order
+ *
+ * When the heap is drained completely, the elements are sorted with an
+ * in-place heapsort instead of repeated #fr_heap_extract calls, which
+ * saves the hole-filling and bubble-up work extract does per element.
+ *
+ * @param[in] hp	The heap to extract elements from.
+ * @param[out] out	Array of at least max entries to write to.
+ * @param[in] max	Maximum number of elements to extract.
+ * @return the number of elements extracted.
+ */
+uint32_t fr_heap_drain(fr_heap_t *hp, void *out[], uint32_t max)
+{
+	int32_t i, num;
+
+	if (!hp || (hp->num_elements == 0) || (max == 0)) return 0;
+
+	/*
+	 *	The caller doesn't want everything, fall back to
+	 *	popping elements one at a time.
+	 */
+	if ((int32_t)max < hp->num_elements) {
+		for (i = 0; i < (int32_t)max; i++) out[i] = fr_heap_pop(hp);
+
+		return max;
+	}
+
+	num = hp->num_elements;
+
+	/*
+	 *	Heapsort.  Swapping the smallest element to the end
+	 *	and shrinking the heap sorts the array in descending
+	 *	order, so copy it out backwards.
+	 */
+	for (i = num - 1; i > 0; i--) {
+		HEAP_SWAP(hp->p[0], hp->p[i]);
+		fr_heap_sift_down(hp, 0, i);
+	}
+
+	for (i = 0; i < num; i++) {
+		out[i] = hp->p[num - 1 - i];
+		*((int32_t *)(((uint8_t *)out[i]) + hp->offset)) = -1;
+	}
+
+	hp->num_elements = 0;
+
+	return (uint32_t)num;
+}
+
 void *fr_heap_peek_tail(fr_heap_t *hp)
 {
 	if (!hp || (hp->num_elements == 0)) return NULL;
@@ -284,6 +433,253 @@ uint32_t fr_heap_num_elements(fr_heap_t *hp)
 	return (uint32_t)hp->num_elements;
 }
 
+/*
+ *	A 4-ary heap with the sort keys stored inline next to the
+ *	element pointer.  Sift operations compare keys without
+ *	dereferencing the elements, so with many entries the heap
+ *	touches only its own (mostly contiguous) array, instead of
+ *	chasing a pointer per comparison.  The four children of a node
+ *	are adjacent, which also halves the depth of the heap.
+ *
+ *	Ordering is lexicographic over (key1, key2), smallest first.
+ *	Like fr_heap_t, the element's position is stored in the
+ *	element at the given offset, so elements can be extracted from
+ *	the middle of the heap.
+ */
+typedef struct {
+	uint64_t	key1;			//!< Major sort key.
+	uint64_t	key2;			//!< Minor sort key.
+	void		*data;			//!< Element pointer.
+} fr_heap4_entry_t;
+
+struct fr_heap4_t {
+	size_t			size;		//!< Number of nodes allocated.
+	size_t			offset;		//!< Offset of heap index in element structure.
+
+	int32_t			num_elements;	//!< Number of nodes used.
+
+	fr_heap4_key_t		key;		//!< Derives sort keys on insertion.
+	char const		*type;		//!< Type of elements.
+
+	fr_heap4_entry_t	*p;		//!< Array of nodes.
+};
+
+#define HEAP4_PARENT(_x)	(((_x) - 1) / 4)
+#define HEAP4_FIRST_CHILD(_x)	(4 * (_x) + 1)
+
+#define HEAP4_LT(_a, _b)	(((_a).key1 < (_b).key1) || \
+				 (((_a).key1 == (_b).key1) && ((_a).key2 < (_b).key2)))
+
+#define HEAP4_SET_OFFSET(_heap, _node) \
+	*((int32_t *)(((uint8_t *)_heap->p[_node].data) + _heap->offset)) = _node
+
+#define HEAP4_RESET_OFFSET(_heap, _node) \
+	*((int32_t *)(((uint8_t *)_heap->p[_node].data) + _heap->offset)) = -1
+
+fr_heap4_t *_fr_heap4_create(TALLOC_CTX *ctx, fr_heap4_key_t key, char const *type, size_t offset)
+{
+	fr_heap4_t *fh;
+
+	if (!key) return NULL;
+
+	fh = talloc_zero(ctx, fr_heap4_t);
+	if (!fh) return NULL;
+
+	fh->size = 2048;
+	fh->p = talloc_array(fh, fr_heap4_entry_t, fh->size);
+	if (!fh->p) {
+		talloc_free(fh);
+		return NULL;
+	}
+
+	fh->key = key;
+	fh->type = type;
+	fh->offset = offset;
+
+	return fh;
+}
+
+static void fr_heap4_bubble(fr_heap4_t *hp, int32_t child)
+{
+	while (child > 0) {
+		int32_t parent = HEAP4_PARENT(child);
+		fr_heap4_entry_t tmp;
+
+		if (!HEAP4_LT(hp->p[child], hp->p[parent])) break;
+
+		tmp = hp->p[child];
+		hp->p[child] = hp->p[parent];
+		hp->p[parent] = tmp;
+		HEAP4_SET_OFFSET(hp, child);
+
+		child = parent;
+	}
+	HEAP4_SET_OFFSET(hp, child);
+}
+
+static void fr_heap4_sift_down(fr_heap4_t *hp, int32_t parent)
+{
+	int32_t max = hp->num_elements;
+
+	for (;;) {
+		int32_t	child = HEAP4_FIRST_CHILD(parent);
+		int32_t	least, i, end;
+		fr_heap4_entry_t tmp;
+
+		if (child >= max) break;
+
+		/*
+		 *	Find the smallest of (up to) four children.
+		 */
+		least = child;
+		end = child + 4;
+		if (end > max) end = max;
+		for (i = child + 1; i < end; i++) {
+			if (HEAP4_LT(hp->p[i], hp->p[least])) least = i;
+		}
+
+		if (!HEAP4_LT(hp->p[least], hp->p[parent])) break;
+
+		tmp = hp->p[parent];
+		hp->p[parent] = hp->p[least];
+		hp->p[least] = tmp;
+		HEAP4_SET_OFFSET(hp, parent);
+
+		parent = least;
+	}
+	HEAP4_SET_OFFSET(hp, parent);
+}
+
+/** Insert a new element into the heap
+ *
+ * The element's sort keys are derived by the key callback passed to
+ * #fr_heap4_create, and are fixed for as long as the element remains
+ * in the heap.
+ *
+ * @param[in] hp	The heap to insert an element into.
+ * @param[in] data	Data to insert into the heap.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (heap full or malloc error).
+ */
+int fr_heap4_insert(fr_heap4_t *hp, void *data)
+{
+	int32_t child = hp->num_elements;
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (hp->type) (void)_talloc_get_type_abort(data, hp->type, __location__);
+#endif
+
+	/*
+	 *	Heap is full.  Double it's size.
+	 */
+	if ((size_t)child == hp->size) {
+		fr_heap4_entry_t *n;
+		size_t		 n_size = hp->size * 2;
+
+		if (n_size > INT32_MAX) {
+			fr_strerror_printf("Heap is full");
+			return -1;
+		}
+
+		n = talloc_realloc(hp, hp->p, fr_heap4_entry_t, n_size);
+		if (!n) {
+			fr_strerror_printf("Failed expanding heap");
+			return -1;
+		}
+		hp->size = n_size;
+		hp->p = n;
+	}
+
+	hp->key(&hp->p[child].key1, &hp->p[child].key2, data);
+	hp->p[child].data = data;
+	hp->num_elements++;
+
+	fr_heap4_bubble(hp, child);
+
+	return 0;
+}
+
+/** Remove an element from the heap
+ *
+ * @param[in] hp	The heap to extract an element from.
+ * @param[in] data	Data to extract, or NULL for the top element.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (no elements or data not found).
+ */
+int fr_heap4_extract(fr_heap4_t *hp, void *data)
+{
+	int32_t node, max;
+
+	if (!hp || (hp->num_elements == 0)) return -1;
+
+	max = hp->num_elements - 1;
+
+	if (!data) {
+		node = 0;
+	} else {
+		node = *((int32_t *)(((uint8_t *)data) + hp->offset));
+
+		/*
+		 *	Out of bounds.
+		 */
+		if ((node < 0) || (node > max)) return -1;
+	}
+
+	HEAP4_RESET_OFFSET(hp, node);
+	hp->num_elements--;
+
+	/*
+	 *	Fill the hole with the last entry, and restore the
+	 *	heap property in whichever direction it was violated.
+	 */
+	if (node != max) {
+		hp->p[node] = hp->p[max];
+
+		if ((node > 0) && HEAP4_LT(hp->p[node], hp->p[HEAP4_PARENT(node)])) {
+			fr_heap4_bubble(hp, node);
+		} else {
+			fr_heap4_sift_down(hp, node);
+		}
+	}
+
+	return 0;
+}
+
+void *fr_heap4_peek(fr_heap4_t *hp)
+{
+	if (!hp || (hp->num_elements == 0)) return NULL;
+
+	return hp->p[0].data;
+}
+
+void *fr_heap4_pop(fr_heap4_t *hp)
+{
+	void *data;
+
+	if (hp->num_elements == 0) return NULL;
+
+	data = hp->p[0].data;
+	(void) fr_heap4_extract(hp, NULL);
+
+	return data;
+}
+
+void *fr_heap4_peek_tail(fr_heap4_t *hp)
+{
+	if (!hp || (hp->num_elements == 0)) return NULL;
+
+	return hp->p[hp->num_elements - 1].data;
+}
+
+uint32_t fr_heap4_num_elements(fr_heap4_t *hp)
+{
+	if (!hp) return 0;
+
+	return (uint32_t)hp->num_elements;
+}
+
 
 #ifdef TESTING
 static bool fr_heap_check(fr_heap_t *hp, void *data)
@@ -326,6 +722,7 @@ int main(int argc, char **argv)
 	fr_heap_t *hp;
 	int i;
 	heap_thing array[ARRAY_SIZE];
+	void *bulk[ARRAY_SIZE];
 	int skip = 0;
 	int left;
 
@@ -333,7 +730,7 @@ int main(int argc, char **argv)
 		skip = atoi(argv[1]);
 	}
 
-	hp = fr_heap_create(NULL, heap_cmp, offsetof(heap_thing, heap_id));
+	hp = fr_heap_create(NULL, heap_cmp, offsetof(heap_thing, heap));
 	if (!hp) {
 		fprintf(stderr, "Failed creating heap!\n");
 		fr_exit(1);
@@ -407,6 +804,90 @@ int main(int argc, char **argv)
 		fr_exit(1);
 	}
 
+	/*
+	 *	Now bulk insert and drain, reusing the (empty) heap.
+	 */
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		array[i].data = rand() % 65537;
+		bulk[i] = &array[i];
+	}
+
+	/*
+	 *	Insert a few one at a time first, so the heapify in
+	 *	fr_heap_from_array has to merge with existing elements.
+	 */
+	for (i = 0; i < 16; i++) {
+		if (fr_heap_insert(hp, &array[i]) < 0) {
+			fprintf(stderr, "Failed inserting %d before bulk insert\n", i);
+			fr_exit(1);
+		}
+	}
+
+	if (fr_heap_from_array(hp, bulk + 16, ARRAY_SIZE - 16) < 0) {
+		fprintf(stderr, "Failed bulk inserting\n");
+		fr_exit(1);
+	}
+
+	if (fr_heap_num_elements(hp) != ARRAY_SIZE) {
+		fprintf(stderr, "Wrong number of elements after bulk insert %d\n",
+			fr_heap_num_elements(hp));
+		fr_exit(1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		if (!fr_heap_check(hp, &array[i])) {
+			fprintf(stderr, "Bulk inserted but not in heap %d\n", i);
+			fr_exit(1);
+		}
+	}
+
+	/*
+	 *	The offsets the heapify set have to be good enough for
+	 *	targeted extraction.
+	 */
+	if (fr_heap_extract(hp, &array[ARRAY_SIZE / 2]) < 0) {
+		fprintf(stderr, "Failed extracting after bulk insert\n");
+		fr_exit(1);
+	}
+
+	if (fr_heap_insert(hp, &array[ARRAY_SIZE / 2]) < 0) {
+		fprintf(stderr, "Failed re-inserting after bulk insert\n");
+		fr_exit(1);
+	}
+
+	/*
+	 *	A partial drain pops, a full drain heapsorts.  Check
+	 *	both, and that the result is one sorted array.
+	 */
+	if (fr_heap_drain(hp, bulk, ARRAY_SIZE / 2) != ARRAY_SIZE / 2) {
+		fprintf(stderr, "Partial drain returned wrong count\n");
+		fr_exit(1);
+	}
+
+	if (fr_heap_drain(hp, bulk + (ARRAY_SIZE / 2), ARRAY_SIZE) != ARRAY_SIZE - (ARRAY_SIZE / 2)) {
+		fprintf(stderr, "Full drain returned wrong count\n");
+		fr_exit(1);
+	}
+
+	if (fr_heap_num_elements(hp) > 0) {
+		fprintf(stderr, "%d elements left after draining", fr_heap_num_elements(hp));
+		fr_exit(1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		heap_thing *t = bulk[i];
+
+		if ((i > 0) && (heap_cmp(bulk[i - 1], t) > 0)) {
+			fprintf(stderr, "Drained elements out of order at %d\n", i);
+			fr_exit(1);
+		}
+
+		if (t->heap != -1) {
+			fprintf(stderr, "Drained element %d still has a heap offset\n", i);
+			fr_exit(1);
+		}
+	}
+
 	talloc_free(hp);
 
 	return 0;
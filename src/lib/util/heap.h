@@ -68,13 +68,61 @@ typedef struct fr_heap_t fr_heap_t;
 fr_heap_t	*_fr_heap_create(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *talloc_type, size_t offset);
 
 int		fr_heap_insert(fr_heap_t *hp, void *data);
+int		fr_heap_from_array(fr_heap_t *hp, void * const data[], uint32_t num);
 int		fr_heap_extract(fr_heap_t *hp, void *data);
+uint32_t	fr_heap_drain(fr_heap_t *hp, void *out[], uint32_t max);
 void		*fr_heap_pop(fr_heap_t *hp) CC_HINT(nonnull);
 void		*fr_heap_peek(fr_heap_t *hp);
 void		*fr_heap_peek_tail(fr_heap_t *hp);
 
 uint32_t	fr_heap_num_elements(fr_heap_t *hp);
 
+typedef struct fr_heap4_t fr_heap4_t;
+
+/** Derive the sort keys for an element on insertion into a 4-ary heap
+ *
+ * Elements are ordered by key1, with key2 breaking ties.  Smaller keys
+ * sort towards the top of the heap.
+ *
+ * @param[out] key1		Major sort key.
+ * @param[out] key2		Minor sort key.
+ * @param[in] data		Element being inserted.
+ */
+typedef void (*fr_heap4_key_t)(uint64_t *key1, uint64_t *key2, void const *data);
+
+/** Creates a 4-ary heap with inline keys, for non-talloced elements
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _key		Callback used to derive element keys.
+ * @param[in] _type		Of elements.
+ * @param[in] _field		to store heap indexes in.
+ */
+#define fr_heap4_create(_ctx, _key, _type, _field) \
+	_fr_heap4_create(_ctx, _key, NULL, (size_t)offsetof(_type, _field))
+
+/** Creates a 4-ary heap with inline keys, verifying elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _key		Callback used to derive element keys.
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _field		to store heap indexes in.
+ * @return
+ *	- A new heap.
+ *	- NULL on error.
+ */
+#define fr_heap4_talloc_create(_ctx, _key, _talloc_type, _field) \
+	_fr_heap4_create(_ctx, _key, #_talloc_type, (size_t)offsetof(_talloc_type, _field))
+
+fr_heap4_t	*_fr_heap4_create(TALLOC_CTX *ctx, fr_heap4_key_t key, char const *talloc_type, size_t offset);
+
+int		fr_heap4_insert(fr_heap4_t *hp, void *data);
+int		fr_heap4_extract(fr_heap4_t *hp, void *data);
+void		*fr_heap4_pop(fr_heap4_t *hp) CC_HINT(nonnull);
+void		*fr_heap4_peek(fr_heap4_t *hp);
+void		*fr_heap4_peek_tail(fr_heap4_t *hp);
+
+uint32_t	fr_heap4_num_elements(fr_heap4_t *hp);
+
 #ifdef __cplusplus
 }
 #endif
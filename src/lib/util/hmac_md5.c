@@ -39,6 +39,17 @@ RCSID("$Id$")
 
 fr_thread_local_setup(HMAC_CTX *, md5_hmac_ctx)
 
+/*
+ *	Cache the last key the ctx was initialised with, so that back
+ *	to back HMACs with the same key (the common case when signing
+ *	packets with the same shared secret) skip re-keying the ctx,
+ *	which costs two MD5 block transforms.  Keys longer than one
+ *	MD5 block are pre-hashed by HMAC, and aren't worth caching.
+ */
+static _Thread_local uint8_t	md5_hmac_key[64];	/* MD5 block size */
+static _Thread_local size_t	md5_hmac_key_len;
+static _Thread_local bool	md5_hmac_keyed;
+
 static void _hmac_md5_ctx_free_on_exit(void *arg)
 {
 	HMAC_CTX_free(arg);
@@ -71,10 +82,20 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t in
 	HMAC_CTX_set_flags(ctx, EVP_MD_CTX_FLAG_NON_FIPS_ALLOW);
 #endif /* EVP_MD_CTX_FLAG_NON_FIPS_ALLOW */
 
-	HMAC_Init_ex(ctx, key, key_len, EVP_md5(), NULL);
+	if (md5_hmac_keyed && (key_len == md5_hmac_key_len) && (memcmp(md5_hmac_key, key, key_len) == 0)) {
+		HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);		/* Reuse the existing key */
+	} else {
+		HMAC_Init_ex(ctx, key, key_len, EVP_md5(), NULL);
+		if (key_len <= sizeof(md5_hmac_key)) {
+			memcpy(md5_hmac_key, key, key_len);
+			md5_hmac_key_len = key_len;
+			md5_hmac_keyed = true;
+		} else {
+			md5_hmac_keyed = false;
+		}
+	}
 	HMAC_Update(ctx, in, inlen);
 	HMAC_Final(ctx, digest, NULL);
-	HMAC_CTX_reset(ctx);
 }
 #else
 /** Calculate HMAC using internal MD5 implementation
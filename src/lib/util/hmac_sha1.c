@@ -44,6 +44,16 @@ unsigned int sha1_data_problems = 0;
 
 fr_thread_local_setup(HMAC_CTX *, sha1_hmac_ctx)
 
+/*
+ *	Cache the last key the ctx was initialised with, so that back
+ *	to back HMACs with the same key skip re-keying the ctx, which
+ *	costs two SHA1 block transforms.  Keys longer than one SHA1
+ *	block are pre-hashed by HMAC, and aren't worth caching.
+ */
+static _Thread_local uint8_t	sha1_hmac_key[64];	/* SHA1 block size */
+static _Thread_local size_t	sha1_hmac_key_len;
+static _Thread_local bool	sha1_hmac_keyed;
+
 static void _hmac_sha1_ctx_free_on_exit(void *arg)
 {
 	HMAC_CTX_free(arg);
@@ -71,10 +81,20 @@ void fr_hmac_sha1(uint8_t digest[SHA1_DIGEST_LENGTH], uint8_t const *in, size_t
 		ctx = sha1_hmac_ctx;
 	}
 
-	HMAC_Init_ex(ctx, key, key_len, EVP_sha1(), NULL);
+	if (sha1_hmac_keyed && (key_len == sha1_hmac_key_len) && (memcmp(sha1_hmac_key, key, key_len) == 0)) {
+		HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);		/* Reuse the existing key */
+	} else {
+		HMAC_Init_ex(ctx, key, key_len, EVP_sha1(), NULL);
+		if (key_len <= sizeof(sha1_hmac_key)) {
+			memcpy(sha1_hmac_key, key, key_len);
+			sha1_hmac_key_len = key_len;
+			sha1_hmac_keyed = true;
+		} else {
+			sha1_hmac_keyed = false;
+		}
+	}
 	HMAC_Update(ctx, in, inlen);
 	HMAC_Final(ctx, digest, NULL);
-	HMAC_CTX_reset(ctx);
 }
 #else
 /** Calculate HMAC using internal SHA1 implementation
@@ -20,10 +20,12 @@
  * @author Arran Cudbard-Bell (a.cudbardb@freeradius.org)
  * @copyright 2015 Arran Cudbard-Bell (a.cudbardb@freeradius.org)
  */
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/thread_local.h>
 #include <freeradius-devel/util/value.h>
 
 #include <ctype.h>
@@ -36,6 +38,49 @@
 bool fr_reverse_lookups = false;		//!< IP -> hostname lookups?
 bool fr_hostname_lookups = true;		//!< hostname -> IP lookups?
 
+/** A cached hostname lookup
+ *
+ */
+typedef struct {
+	char		name[256];	//!< Hostname.  Maximum DNS name length plus '\0'.
+	int		af;		//!< Address family which was requested.
+	bool		fallback;	//!< Whether other address families were allowed.
+	bool		negative;	//!< The name failed to resolve.
+	fr_ipaddr_t	ipaddr;		//!< The resolved address.
+	time_t		expires;	//!< When the entry must be re-resolved.
+} fr_hostname_entry_t;
+
+#define HOSTNAME_CACHE_ENTRIES	(16)	//!< Must be a power of two.
+#define HOSTNAME_CACHE_TTL	(30)	//!< seconds
+
+static _Thread_local fr_hostname_entry_t hostname_cache[HOSTNAME_CACHE_ENTRIES];
+
+/** Remember the result of a hostname lookup, including failures
+ *
+ * @param[in] hostname	which was resolved.
+ * @param[in] af	address family which was requested.
+ * @param[in] fallback	whether other address families were allowed.
+ * @param[in] ipaddr	the resolved address, or NULL if resolution failed.
+ * @param[in] now	the current time.
+ */
+static void hostname_cache_set(char const *hostname, int af, bool fallback,
+			       fr_ipaddr_t const *ipaddr, time_t now)
+{
+	fr_hostname_entry_t	*entry;
+	size_t			len;
+
+	len = strlen(hostname);
+	if (len >= sizeof(entry->name)) return;		/* Don't cache invalid names */
+
+	entry = &hostname_cache[fr_hash_string(hostname) & (HOSTNAME_CACHE_ENTRIES - 1)];
+	memcpy(entry->name, hostname, len + 1);
+	entry->af = af;
+	entry->fallback = fallback;
+	entry->negative = (ipaddr == NULL);
+	if (ipaddr) entry->ipaddr = *ipaddr;
+	entry->expires = now + HOSTNAME_CACHE_TTL;
+}
+
 /** Determine if an address is the INADDR_ANY address for its address family
  *
  * @param ipaddr to check.
@@ -189,6 +234,8 @@ void fr_ipaddr_mask(fr_ipaddr_t *addr, uint8_t prefix)
 int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 {
 	int rcode;
+	time_t now;
+	fr_hostname_entry_t *entry;
 	struct addrinfo hints, *ai = NULL, *alt = NULL, *res = NULL;
 
 	/*
@@ -225,6 +272,27 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 		return 0;
 	}
 
+	/*
+	 *	Runtime lookups of the same names repeat from request
+	 *	to request, and every one blocks the calling thread in
+	 *	getaddrinfo().  Remember results (including failures)
+	 *	for a short time, so steady state traffic doesn't wait
+	 *	on the resolver.  The cache is per-thread, and so
+	 *	needs no locking.
+	 */
+	now = time(NULL);
+	entry = &hostname_cache[fr_hash_string(hostname) & (HOSTNAME_CACHE_ENTRIES - 1)];
+	if ((entry->expires > now) && (entry->af == af) && (entry->fallback == fallback) &&
+	    (strcmp(entry->name, hostname) == 0)) {
+		if (entry->negative) {
+			fr_strerror_printf("Failed resolving \"%s\" to IP address: cached failure", hostname);
+			return -1;
+		}
+
+		*out = entry->ipaddr;
+		return 0;
+	}
+
 	memset(&hints, 0, sizeof(hints));
 
 	/*
@@ -237,6 +305,8 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 	}
 
 	if ((rcode = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
+		hostname_cache_set(hostname, af, fallback, NULL, now);
+
 		switch (af) {
 		default:
 		case AF_UNSPEC:
@@ -266,6 +336,7 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 		fr_strerror_printf("Failed resolving \"%s\": No records matching requested address family returned",
 				   hostname);
 		freeaddrinfo(res);
+		hostname_cache_set(hostname, af, fallback, NULL, now);
 		return -1;
 	}
 
@@ -276,6 +347,8 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 		return -1;
 	}
 
+	hostname_cache_set(hostname, af, fallback, out, now);
+
 	return 0;
 }
 
@@ -395,6 +468,48 @@ static int ip_prefix_addr_from_str(struct in_addr *out, char const *str)
 	return p - str;
 }
 
+/** Parse a plain dotted quad
+ *
+ * Handles only the overwhelmingly common case: four decimal octets
+ * separated by dots, nothing else.  Anything fancier (prefixes,
+ * integers, wildcards, hostnames) is rejected, and the caller falls
+ * back to the full parser.
+ *
+ * @param[out] out	Where to write the parsed address.
+ * @param[in] value	to parse.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the string isn't a plain dotted quad.
+ */
+static int inet_pton4_fast(struct in_addr *out, char const *value)
+{
+	uint32_t	addr = 0;
+	int		octets = 0;
+	char const	*p = value;
+
+	for (;;) {
+		uint32_t	octet = 0;
+		unsigned int	digits = 0;
+
+		while ((*p >= '0') && (*p <= '9')) {
+			octet = (octet * 10) + ((uint32_t) (*p++ - '0'));
+			if (++digits > 3) return -1;
+		}
+		if (!digits || (octet > 255)) return -1;
+		if ((digits > 1) && (p[-(ssize_t) digits] == '0')) return -1;	/* Reject leading zeros, as inet_pton does */
+
+		addr = (addr << 8) | octet;
+		if (++octets == 4) break;
+
+		if (*p++ != '.') return -1;
+	}
+	if (*p != '\0') return -1;
+
+	out->s_addr = htonl(addr);
+
+	return 0;
+}
+
 /** Parse an IPv4 address or IPv4 prefix in presentation format (and others)
  *
  * @param[out] out	Where to write the ip address value.
@@ -438,6 +553,18 @@ int fr_inet_pton4(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resol
 		value = buffer;
 	}
 
+	/*
+	 *	Almost everything we're asked to parse is a plain
+	 *	dotted quad, so try that before any of the string
+	 *	fiddling below.
+	 */
+	if (inet_pton4_fast(&out->addr.v4, value) == 0) {
+		out->prefix = 32;
+		out->af = AF_INET;
+
+		return 0;
+	}
+
 	p = strchr(value, '/');
 
 	/*
@@ -862,6 +989,26 @@ do_port:
 	return 0;
 }
 
+/** Print one decimal octet without calling sprintf
+ *
+ */
+static inline char *inet_ntop4_octet(char *p, uint8_t octet)
+{
+	if (octet >= 100) {
+		*p++ = (char) ('0' + (octet / 100));
+		octet %= 100;
+		*p++ = (char) ('0' + (octet / 10));
+		*p++ = (char) ('0' + (octet % 10));
+	} else if (octet >= 10) {
+		*p++ = (char) ('0' + (octet / 10));
+		*p++ = (char) ('0' + (octet % 10));
+	} else {
+		*p++ = (char) ('0' + octet);
+	}
+
+	return p;
+}
+
 /** Print the address portion of a #fr_ipaddr_t
  *
  * @note Includes the textual scope_id name (eth0, en0 etc...) if supported.
@@ -881,6 +1028,27 @@ char *fr_inet_ntop(char out[FR_IPADDR_STRLEN], size_t outlen, fr_ipaddr_t const
 
 	out[0] = '\0';
 
+	/*
+	 *	Most addresses we print are IPv4, and inet_ntop()
+	 *	formats those through sprintf() on common libcs, which
+	 *	shows up in profiles of accounting heavy workloads.
+	 */
+	if ((addr->af == AF_INET) && (outlen >= INET_ADDRSTRLEN)) {
+		uint8_t const *b = (uint8_t const *) &addr->addr.v4.s_addr;
+
+		p = out;
+		p = inet_ntop4_octet(p, b[0]);
+		*p++ = '.';
+		p = inet_ntop4_octet(p, b[1]);
+		*p++ = '.';
+		p = inet_ntop4_octet(p, b[2]);
+		*p++ = '.';
+		p = inet_ntop4_octet(p, b[3]);
+		*p = '\0';
+
+		return out;
+	}
+
 	if (inet_ntop(addr->af, &addr->addr, out, outlen) == NULL) {
 		fr_strerror_printf("%s", fr_syserror(errno));
 		return NULL;
@@ -23,6 +23,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/fring.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/print.h>
 #include <freeradius-devel/util/strerror.h>
@@ -34,6 +35,7 @@ RCSID("$Id$")
 #ifdef HAVE_FEATURES_H
 #  include <features.h>
 #endif
+#include <pthread.h>
 #include <stdio.h>
 #ifdef HAVE_SYSLOG_H
 #  include <syslog.h>
@@ -213,52 +215,61 @@ static void _fr_vlog_pool_free(void *arg)
 	fr_vlog_pool = NULL;
 }
 
-/** Send a server log message to its destination
+/** A log message pre-formatted on the thread which generated it
+ *
+ * Everything needed to render the final log line on the logger
+ * thread.  The format string has already been expanded, as its
+ * arguments may point at storage which is freed as soon as the
+ * caller returns.
+ */
+typedef struct {
+	fr_log_t	log;		//!< Destination.  Copied, as the original may be freed
+					//!< before the message is written.
+	fr_log_type_t	type;		//!< Type of log message.
+	char const	*file;		//!< Src file the log message was generated in.
+	int		line;		//!< Number the log message was generated on.
+	time_t		timestamp;	//!< When the log message was generated.
+	char		*msg;		//!< The expanded log message.
+} fr_log_defer_entry_t;
+
+static fr_fring_t	*log_defer_fring;	//!< Messages waiting to be written by the logger thread.
+static pthread_t	log_defer_thread;
+static bool		log_defer_running;	//!< Whether new messages should be queued.
+static bool		log_defer_exit;		//!< Tells the logger thread to drain the ring and exit.
+static uint64_t		log_defer_discarded;	//!< Messages overwritten before they could be written.
+static pthread_mutex_t	log_defer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	log_defer_signal = PTHREAD_COND_INITIALIZER;
+
+/** Write out a pre-expanded log message to its destination
+ *
+ * Adds the timestamp, location and facility prefixes, sanitises the
+ * message, and performs the actual write.  May run on the thread that
+ * generated the message, or on the logger thread if one is running.
  *
  * @param[in] log	destination.
  * @param[in] type	of log message.
  * @param[in] file	src file the log message was generated in.
  * @param[in] line	number the log message was generated on.
- * @param[in] fmt	with printf style substitution tokens.
- * @param[in] ap	Substitution arguments.
+ * @param[in] timestamp	when the message was generated, 0 for now.
+ * @param[in] fmt_msg	the expanded log message.  Sanitised in place.
+ * @param[in] pool	for temporary allocations.
  */
-int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line, char const *fmt, va_list ap)
+static int fr_vlog_write(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
+			 time_t timestamp, char *fmt_msg, TALLOC_CTX *pool)
 {
 	int		colourise = log->colourise;
 	char		*buffer;
-	TALLOC_CTX	*pool;
 	int		ret = 0;
 	char const	*fmt_colour = "";
 	char const	*fmt_location = "";
 	char		fmt_time[50];
 	char const	*fmt_facility = "";
 	char const	*fmt_type = "";
-	char		*fmt_msg;
 
 	static char const *spaces = "                                    ";	/* 40 */
 
 	fmt_time[0] = '\0';
 
-	/*
-	 *	If we don't want any messages, then
-	 *	throw them away.
-	 */
-	if (log->dst == L_DST_NULL) return 0;
-
-	/*
-	 *	Allocate a thread local, 4k pool so we don't
-	 *      need to keep allocating memory on the heap.
-	 */
-	pool = fr_vlog_pool;
-	if (!pool) {
-		pool = talloc_pool(NULL, 4096);
-		if (!pool) {
-			fr_perror("Failed allocating memory for vlog_request_pool");
-			return -1;
-		}
-		fr_thread_local_set_destructor(fr_vlog_pool, _fr_vlog_pool_free, pool);
-	}
-
 	/*
 	 *	Set colourisation
 	 */
@@ -307,19 +318,18 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 
 	case L_TIMESTAMP_ON:
 	{
-		time_t timeval;
 		size_t len;
 
-		timeval = time(NULL);
+		if (!timestamp) timestamp = time(NULL);
 #ifdef HAVE_GMTIME_R
 		if (log->dates_utc) {
 			struct tm utc;
-			gmtime_r(&timeval, &utc);
+			gmtime_r(&timestamp, &utc);
 			ASCTIME_R(&utc, fmt_time, sizeof(fmt_time));
 		} else
 #endif
 		{
-			CTIME_R(&timeval, fmt_time, sizeof(fmt_time));
+			CTIME_R(&timestamp, fmt_time, sizeof(fmt_time));
 		}
 
 		/*
@@ -366,8 +376,8 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 	{
 		char	*p, *end;
 
-		p = fmt_msg = fr_vasprintf(pool, fmt, ap);
-		end = p + talloc_array_length(fmt_msg) - 1;
+		p = fmt_msg;
+		end = p + strlen(fmt_msg);
 
 		/*
 		 *	Filter out control chars and non UTF8 chars
@@ -472,11 +482,236 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 		break;
 	}
 
+	return ret;
+}
+
+/** Queue a pre-expanded log message for the logger thread
+ *
+ * @param[in] log	destination.  Copied into the queue entry.
+ * @param[in] type	of log message.
+ * @param[in] file	src file the log message was generated in.
+ * @param[in] line	number the log message was generated on.
+ * @param[in] msg	the expanded log message.  Copied into the queue entry.
+ * @return
+ *	- 0 if the message was queued.
+ *	- -1 on failure, the caller should write the message synchronously.
+ */
+static int fr_vlog_defer(fr_log_t const *log, fr_log_type_t type, char const *file, int line, char const *msg)
+{
+	fr_log_defer_entry_t *entry;
+
+	entry = talloc_zero(NULL, fr_log_defer_entry_t);
+	if (!entry) return -1;
+
+	entry->log = *log;
+	entry->type = type;
+	entry->file = file;
+	entry->line = line;
+	entry->timestamp = time(NULL);
+	entry->msg = talloc_typed_strdup(entry, msg);
+	if (!entry->msg) {
+		talloc_free(entry);
+		return -1;
+	}
+
+	/*
+	 *	If the logger thread can't keep up we overwrite the
+	 *	oldest unwritten message and count the loss, rather
+	 *	than stalling the thread doing useful work.
+	 */
+	pthread_mutex_lock(&log_defer_mutex);
+	if (fr_fring_overwrite(log_defer_fring, entry) == 1) log_defer_discarded++;
+	pthread_cond_signal(&log_defer_signal);
+	pthread_mutex_unlock(&log_defer_mutex);
+
+	return 0;
+}
+
+/** Send a server log message to its destination
+ *
+ * Expands the format string, then either queues the message for the
+ * logger thread, or writes it out synchronously if no logger thread
+ * is running.
+ *
+ * @param[in] log	destination.
+ * @param[in] type	of log message.
+ * @param[in] file	src file the log message was generated in.
+ * @param[in] line	number the log message was generated on.
+ * @param[in] fmt	with printf style substitution tokens.
+ * @param[in] ap	Substitution arguments.
+ */
+int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line, char const *fmt, va_list ap)
+{
+	TALLOC_CTX	*pool;
+	char		*fmt_msg;
+	int		ret = 0;
+
+	/*
+	 *	If we don't want any messages, then
+	 *	throw them away.
+	 */
+	if (log->dst == L_DST_NULL) return 0;
+
+	/*
+	 *	Allocate a thread local, 4k pool so we don't
+	 *      need to keep allocating memory on the heap.
+	 */
+	pool = fr_vlog_pool;
+	if (!pool) {
+		pool = talloc_pool(NULL, 4096);
+		if (!pool) {
+			fr_perror("Failed allocating memory for vlog_request_pool");
+			return -1;
+		}
+		fr_thread_local_set_destructor(fr_vlog_pool, _fr_vlog_pool_free, pool);
+	}
+
+	/*
+	 *	Expand the format string before anything else.  This is
+	 *	the one step which can't be deferred, as the arguments
+	 *	may point at storage which is freed when we return.
+	 */
+	fmt_msg = fr_vasprintf(pool, fmt, ap);
+
+	switch (log->dst) {
+	case L_DST_FILES:
+	case L_DST_STDOUT:
+	case L_DST_STDERR:
+#ifdef HAVE_SYSLOG_H
+	case L_DST_SYSLOG:
+#endif
+		/*
+		 *	If a logger thread is running hand the message
+		 *	off, and let it do the formatting and writing
+		 *	off-path.
+		 */
+		if (log_defer_running && (fr_vlog_defer(log, type, file, line, fmt_msg) == 0)) goto finish;
+		break;
+
+	default:
+		break;
+	}
+
+	ret = fr_vlog_write(log, type, file, line, 0, fmt_msg, pool);
+
+finish:
 	talloc_free_children(pool);	/* clears all temporary allocations */
 
 	return ret;
 }
 
+/** Drain the ring buffer, formatting and writing queued log messages
+ *
+ * Run by the logger thread.  Exits once #log_defer_exit has been set
+ * and the ring buffer is empty.
+ */
+static void *log_defer_loop(UNUSED void *uctx)
+{
+	TALLOC_CTX *pool;
+
+	pool = talloc_pool(NULL, 4096);
+	if (!pool) return NULL;
+
+	for (;;) {
+		fr_log_defer_entry_t	*entry;
+		uint64_t		discarded;
+		bool			exiting;
+
+		pthread_mutex_lock(&log_defer_mutex);
+		for (;;) {
+			entry = fr_fring_next(log_defer_fring);
+			if (entry || log_defer_exit) break;
+			pthread_cond_wait(&log_defer_signal, &log_defer_mutex);
+		}
+		discarded = log_defer_discarded;
+		log_defer_discarded = 0;
+		exiting = log_defer_exit;
+		pthread_mutex_unlock(&log_defer_mutex);
+
+		if (discarded > 0) {
+			char msg[64];
+
+			snprintf(msg, sizeof(msg), "Discarded %" PRIu64 " log messages (logger thread overloaded)",
+				 discarded);
+			fr_vlog_write(&default_log, L_WARN, __FILE__, __LINE__, 0, msg, pool);
+			talloc_free_children(pool);
+		}
+
+		if (entry) {
+			fr_vlog_write(&entry->log, entry->type, entry->file, entry->line,
+				      entry->timestamp, entry->msg, pool);
+			talloc_free_children(pool);
+			talloc_free(entry);
+			continue;
+		}
+
+		if (exiting) break;
+	}
+
+	talloc_free(pool);
+
+	return NULL;
+}
+
+/** Spawn a logger thread, and defer all log writes to it
+ *
+ * Threads which log after this function returns pay only for expanding
+ * the format string.  Timestamping, prefixing, sanitisation, and the
+ * write itself all happen on the logger thread.
+ *
+ * Must be called before any threads which will log are spawned.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_log_defer_start(void)
+{
+	if (log_defer_running) return 0;
+
+	log_defer_fring = fr_fring_alloc(NULL, 65536, false);	/* We do our own locking */
+	if (!log_defer_fring) {
+		fr_strerror_printf("Failed allocating log message ring buffer");
+		return -1;
+	}
+
+	log_defer_exit = false;
+	if (pthread_create(&log_defer_thread, NULL, log_defer_loop, NULL) != 0) {
+		fr_strerror_printf("Failed spawning logger thread: %s", fr_syserror(errno));
+		TALLOC_FREE(log_defer_fring);
+		return -1;
+	}
+	log_defer_running = true;
+
+	return 0;
+}
+
+/** Stop the logger thread, flushing any queued messages
+ *
+ * Subsequent log writes revert to being performed synchronously on the
+ * thread which generated them.
+ *
+ * Must be called after all threads which log have been joined.
+ *
+ * @return 0.
+ */
+int fr_log_defer_stop(void)
+{
+	if (!log_defer_running) return 0;
+
+	log_defer_running = false;	/* New messages revert to synchronous writes */
+
+	pthread_mutex_lock(&log_defer_mutex);
+	log_defer_exit = true;
+	pthread_cond_signal(&log_defer_signal);
+	pthread_mutex_unlock(&log_defer_mutex);
+
+	pthread_join(log_defer_thread, NULL);
+	TALLOC_FREE(log_defer_fring);
+
+	return 0;
+}
+
 /** Send a server log message to its destination
  *
  * @param log	destination.
@@ -132,6 +132,10 @@ void	fr_log_hex(fr_log_t const *log, fr_log_type_t type,
 		   uint8_t const *data, size_t data_len, char const *fmt, ...)
 		   CC_HINT(format (printf, 7, 8)) CC_HINT(nonnull (1,3,5));
 
+int	fr_log_defer_start(void);
+
+int	fr_log_defer_stop(void);
+
 bool	fr_rate_limit_enabled(void);
 
 #ifdef __cplusplus
@@ -181,6 +181,30 @@ int rad_unlockfd(int fd, int lock_len)
 
 static char const hextab[] = "0123456789abcdef";
 
+/*
+ *	Value of a hex digit, or -1 for chars which aren't hex digits.
+ */
+#define HEX(_)						\
+  ((((_) >= '0') && ((_) <= '9')) ? (_) - '0'		\
+   : (((_) >= 'a') && ((_) <= 'f')) ? (_) - 'a' + 10	\
+   : (((_) >= 'A') && ((_) <= 'F')) ? (_) - 'A' + 10	\
+   : -1)
+
+#define HEX8(_)						\
+  HEX(_), HEX((_) + 1), HEX((_) + 2), HEX((_) + 3),	\
+  HEX((_) + 4), HEX((_) + 5), HEX((_) + 6), HEX((_) + 7)
+
+static int8_t const hex_nibble[0x100] = {
+	HEX8(0x00), HEX8(0x08), HEX8(0x10), HEX8(0x18),
+	HEX8(0x20), HEX8(0x28), HEX8(0x30), HEX8(0x38),
+	HEX8(0x40), HEX8(0x48), HEX8(0x50), HEX8(0x58),
+	HEX8(0x60), HEX8(0x68), HEX8(0x70), HEX8(0x78),
+	HEX8(0x80), HEX8(0x88), HEX8(0x90), HEX8(0x98),
+	HEX8(0xa0), HEX8(0xa8), HEX8(0xb0), HEX8(0xb8),
+	HEX8(0xc0), HEX8(0xc8), HEX8(0xd0), HEX8(0xd8),
+	HEX8(0xe0), HEX8(0xe8), HEX8(0xf0), HEX8(0xf8)
+};
+
 /** Convert hex strings to binary data
  *
  * @param bin Buffer to write output to.
@@ -193,7 +217,6 @@ size_t fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
 {
 	size_t i;
 	size_t len;
-	char *c1, *c2;
 
 	/*
 	 *	Smartly truncate output, caller should check number of bytes
@@ -203,10 +226,13 @@ size_t fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
 	if (len > outlen) len = outlen;
 
 	for (i = 0; i < len; i++) {
-		if(!(c1 = memchr(hextab, tolower((int) hex[i << 1]), sizeof(hextab))) ||
-		   !(c2 = memchr(hextab, tolower((int) hex[(i << 1) + 1]), sizeof(hextab))))
-			break;
-		bin[i] = ((c1-hextab)<<4) + (c2-hextab);
+		int8_t c1, c2;
+
+		c1 = hex_nibble[(uint8_t) hex[i << 1]];
+		c2 = hex_nibble[(uint8_t) hex[(i << 1) + 1]];
+		if ((c1 | c2) < 0) break;
+
+		bin[i] = (c1 << 4) | c2;
 	}
 
 	return i;
@@ -251,7 +277,7 @@ char *fr_abin2hex(TALLOC_CTX *ctx, uint8_t const *bin, size_t inlen)
 {
 	char *buff;
 
-	buff = talloc_array(ctx, char, (inlen << 2));
+	buff = talloc_array(ctx, char, (inlen << 1) + 1);
 	if (!buff) return NULL;
 
 	fr_bin2hex(buff, bin, inlen);
@@ -35,6 +35,7 @@ extern "C" {
 #include <ctype.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <string.h>
 #include <talloc.h>
 
 typedef		int8_t (*fr_cmp_t)(void const *a, void const *b);
@@ -181,6 +182,46 @@ int8_t		fr_pointer_cmp(void const *a, void const *b);
 void		fr_quick_sort(void const *to_sort[], int min_idx, int max_idx, fr_cmp_t cmp);
 int		fr_digest_cmp(uint8_t const *a, uint8_t const *b, size_t length) CC_HINT(nonnull);
 
+/** Compare two 16 byte blocks for equality
+ *
+ *  The fixed size lets the compiler emit two word compares (or one
+ *  vector compare) instead of calling a length-generic memcmp.  There
+ *  is no early exit, so the comparison is also constant-time, and safe
+ *  for authenticators and other secrets, like fr_digest_cmp().
+ */
+static inline bool fr_memeq16(uint8_t const *a, uint8_t const *b)
+{
+	uint64_t a0, a1, b0, b1;
+
+	memcpy(&a0, a, sizeof(a0));
+	memcpy(&a1, a + 8, sizeof(a1));
+	memcpy(&b0, b, sizeof(b0));
+	memcpy(&b1, b + 8, sizeof(b1));
+
+	return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+}
+
+/** Compare two 32 byte blocks for equality
+ *
+ *  As with fr_memeq16(), there is no early exit, so the comparison is
+ *  constant-time.
+ */
+static inline bool fr_memeq32(uint8_t const *a, uint8_t const *b)
+{
+	uint64_t a0, a1, a2, a3, b0, b1, b2, b3;
+
+	memcpy(&a0, a, sizeof(a0));
+	memcpy(&a1, a + 8, sizeof(a1));
+	memcpy(&a2, a + 16, sizeof(a2));
+	memcpy(&a3, a + 24, sizeof(a3));
+	memcpy(&b0, b, sizeof(b0));
+	memcpy(&b1, b + 8, sizeof(b1));
+	memcpy(&b2, b + 16, sizeof(b2));
+	memcpy(&b3, b + 24, sizeof(b3));
+
+	return (((a0 ^ b0) | (a1 ^ b1)) | ((a2 ^ b2) | (a3 ^ b3))) == 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair_cursor.h>
 #include <freeradius-devel/util/pair.h>
@@ -779,7 +780,6 @@ void *fr_pair_iter_next_by_ancestor(void **prev, void *to_eval, void *uctx)
  */
 VALUE_PAIR *fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_t tag)
 {
-	fr_cursor_t 	cursor;
 	VALUE_PAIR	*vp;
 
 	/* List head may be NULL if it contains no VPs */
@@ -789,16 +789,119 @@ VALUE_PAIR *fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_
 
 	if (!da) return NULL;
 
+	for (vp = head; vp; vp = vp->next) {
+		if ((da == vp->da) && TAG_EQ(tag, vp->tag)) return vp;
+	}
+
+	return NULL;
+}
+
+
+/** Snapshot index over a pair list
+ *
+ * Maps each #fr_dict_attr_t present in the list to the first pair
+ * carrying it.
+ */
+struct fr_pair_index_s {
+	fr_hash_table_t	*ht;		//!< First pair in the list for each da.
+};
+
+static uint32_t pair_index_hash(void const *data)
+{
+	VALUE_PAIR const *vp = data;
+
+	return fr_hash(&vp->da, sizeof(vp->da));
+}
+
+static int pair_index_cmp(void const *one, void const *two)
+{
+	VALUE_PAIR const *a = one, *b = two;
+
+	if (a->da < b->da) return -1;
+	if (a->da > b->da) return +1;
+
+	return 0;
+}
+
+/** Build a snapshot index over a pair list
+ *
+ * Records the first pair for each da, so that repeated #fr_pair_index_find
+ * calls against a stable list cost O(1) instead of a full list walk.
+ *
+ * The index is a snapshot.  It does not track later modifications to the
+ * list, so the caller must free and rebuild it if pairs are added to, or
+ * removed from, the list.
+ *
+ * @param[in] ctx	to allocate the index in.
+ * @param[in] head	of the pair list to index.  May be NULL.
+ * @return
+ *	- A new index.
+ *	- NULL on failure.
+ */
+fr_pair_index_t *fr_pair_index_build(TALLOC_CTX *ctx, VALUE_PAIR *head)
+{
+	fr_pair_index_t	*idx;
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	idx = talloc_zero(ctx, fr_pair_index_t);
+	if (!idx) return NULL;
+
+	idx->ht = fr_hash_table_create(idx, pair_index_hash, pair_index_cmp, NULL);
+	if (!idx->ht) {
+		talloc_free(idx);
+		return NULL;
+	}
+
 	for (vp = fr_cursor_init(&cursor, &head);
 	     vp;
 	     vp = fr_cursor_next(&cursor)) {
+		VP_VERIFY(vp);
+
+		/*
+		 *	Inserting a duplicate da fails, which keeps
+		 *	the first pair in list order.
+		 */
+		(void) fr_hash_table_insert(idx->ht, vp);
+	}
+
+	return idx;
+}
+
+/** Find the first pair with a matching da via a snapshot index
+ *
+ * Has the same semantics as #fr_pair_find_by_da, evaluated against the
+ * list as it was when the index was built.
+ *
+ * @param[in] idx	built by #fr_pair_index_build.
+ * @param[in] da	to search for.
+ * @param[in] tag	to match. TAG_ANY matches any tag, TAG_NONE matches tagless VPs.
+ * @return
+ *	- First matching #VALUE_PAIR.
+ *	- NULL if no pairs match.
+ */
+VALUE_PAIR *fr_pair_index_find(fr_pair_index_t *idx, fr_dict_attr_t const *da, int8_t tag)
+{
+	VALUE_PAIR	probe, *vp;
+
+	if (!idx || !da) return NULL;
+
+	memset(&probe, 0, sizeof(probe));
+	probe.da = da;
+
+	/*
+	 *	The index only records the first pair for each da, so
+	 *	walk forward from there for a matching tag.
+	 */
+	for (vp = fr_hash_table_finddata(idx->ht, &probe);
+	     vp;
+	     vp = vp->next) {
 		if ((da == vp->da) && TAG_EQ(tag, vp->tag)) return vp;
 	}
 
 	return NULL;
 }
 
-
 /** Find the pair with the matching attribute
  *
  * @todo should take DAs and do a pointer comparison.
@@ -864,6 +967,10 @@ VALUE_PAIR *fr_pair_find_by_child_num(VALUE_PAIR *head, fr_dict_attr_t const *pa
  *
  * Locates the end of 'head', and links an additional VP 'add' at the end.
  *
+ * @note This walks the entire list to find the end.  Loops which build
+ *	long lists one pair at a time should use a #fr_cursor_t and
+ *	#fr_cursor_append instead, which track the tail of the list.
+ *
  * @param[in] head VP in linked list. Will add new VP to the end of this list.
  * @param[in] add VP to add to list.
  */
@@ -1386,6 +1493,43 @@ void fr_pair_list_sort(VALUE_PAIR **vps, fr_cmp_t cmp)
 	*vps = _pair_list_sort_merge(a, b, cmp);
 }
 
+/** Sort a list into canonical order and strip exact duplicates
+ *
+ * The list is sorted by da and tag with #fr_pair_list_sort, which is
+ * stable, so attributes which legitimately repeat, like EAP-Message
+ * fragments and Proxy-State, keep their original relative order.
+ * Adjacent pairs with the same da, tag, and value are then collapsed
+ * into one.
+ *
+ * Useful for cleaning up packets from broken NASes which repeat
+ * attributes, so that later scans of the list don't pay for the
+ * duplicates on every pass.
+ *
+ * @param[in,out] vps	List of VALUE_PAIRs to normalize.
+ * @return the number of duplicate pairs which were removed.
+ */
+int fr_pair_list_normalize(VALUE_PAIR **vps)
+{
+	VALUE_PAIR	*vp, *next;
+	int		removed = 0;
+
+	fr_pair_list_sort(vps, fr_pair_cmp_by_da_tag);
+
+	for (vp = *vps; vp != NULL; vp = vp->next) {
+		while ((next = vp->next) != NULL) {
+			if ((next->da != vp->da) || (next->tag != vp->tag) ||
+			    (fr_value_box_cmp(&vp->data, &next->data) != 0)) break;
+
+			vp->next = next->next;
+			next->next = NULL;
+			talloc_free(next);
+			removed++;
+		}
+	}
+
+	return removed;
+}
+
 /** Write an error to the library errorbuff detailing the mismatch
  *
  * Retrieve output with fr_strerror();
@@ -1795,6 +1939,90 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR *from)
 	return cnt;
 }
 
+/*
+ *	We can't know libtalloc's exact per-chunk overhead, so assume a
+ *	generous fixed cost for each allocation when sizing a pool.
+ *	Over-estimating merely leaves slack in the pool, under-estimating
+ *	causes an extra malloc.
+ */
+#define PAIR_POOL_CHUNK_OVERHEAD	(128)
+
+/** Size a talloc pool big enough to hold a copy of a list of pairs
+ *
+ */
+static size_t pair_list_pool_size(VALUE_PAIR *from)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	size_t		size = 0;
+
+	for (vp = fr_cursor_init(&cursor, &from);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		size += sizeof(VALUE_PAIR) + PAIR_POOL_CHUNK_OVERHEAD;
+
+		/*
+		 *	The unknown hierarchy is copied with the pair.
+		 */
+		if (vp->da->flags.is_unknown) size += 2 * PAIR_POOL_CHUNK_OVERHEAD;
+
+		if (vp->type == VT_XLAT) {
+			size += strlen(vp->xlat) + 1 + PAIR_POOL_CHUNK_OVERHEAD;
+			continue;
+		}
+
+		switch (vp->vp_type) {
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+			size += vp->vp_length + 1 + PAIR_POOL_CHUNK_OVERHEAD;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return size;
+}
+
+/** Duplicate a list of pairs into a single pre-sized talloc pool
+ *
+ * Sizes the whole list (pairs, value buffers, and unknown attributes)
+ * in one pass, allocates a pool big enough to hold all of it under ctx,
+ * then copies into the pool.  The copies are normal talloc chunks, and
+ * may be freed or stolen individually, but the underlying memory comes
+ * from a single allocation which is released when ctx is freed.
+ *
+ * Useful when seeding child requests, where the copy is made once and
+ * freed as a unit with the child.
+ *
+ * @param[in] ctx	to allocate the pool (and therefore the copies) in.
+ * @param[in] to	where to copy attributes to.
+ * @param[in] from	whence to copy #VALUE_PAIR (s).
+ * @return
+ *	- >0 the number of attributes copied.
+ *	- 0 if no attributes copied.
+ *	- -1 on error.
+ */
+int fr_pair_list_copy_pooled(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR *from)
+{
+	TALLOC_CTX	*pool;
+	int		cnt;
+
+	if (!from) return 0;
+
+	pool = talloc_pool(ctx, pair_list_pool_size(from));
+	if (!pool) return -1;
+
+	cnt = fr_pair_list_copy(pool, to, from);
+	if (cnt < 0) {
+		talloc_free(pool);
+		return -1;
+	}
+
+	return cnt;
+}
+
 /** Duplicate pairs in a list matching the specified da
  *
  * Copy all pairs from 'from' matching the specified da.
@@ -1811,7 +2039,8 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR *from)
 int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, VALUE_PAIR **to,
 			    VALUE_PAIR *from, fr_dict_attr_t const *da)
 {
-	fr_cursor_t	src, dst, tmp;
+	fr_cursor_t	dst, tmp;
+	fr_pair_iter_t	src;
 
 	VALUE_PAIR	*head = NULL;
 	VALUE_PAIR	*vp;
@@ -1823,10 +2052,9 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, VALUE_PAIR **to,
 	}
 
 	fr_cursor_talloc_init(&tmp, &head, VALUE_PAIR);
-	for (vp = fr_cursor_iter_by_da_init(&src, &from, da);
+	for (vp = fr_pair_iter_by_da_init(&src, from, da);
 	     vp;
-	     vp = fr_cursor_next(&src), cnt++) {
-		VP_VERIFY(vp);
+	     vp = fr_pair_iter_by_da_next(&src), cnt++) {
 		vp = fr_pair_copy(ctx, vp);
 		if (!vp) {
 			fr_pair_list_free(&head);
@@ -1864,7 +2092,8 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, VALUE_PAIR **to,
 int fr_pair_list_copy_by_ancestor(TALLOC_CTX *ctx, VALUE_PAIR **to,
 				  VALUE_PAIR *from, fr_dict_attr_t const *parent_da)
 {
-	fr_cursor_t	src, dst, tmp;
+	fr_cursor_t	dst, tmp;
+	fr_pair_iter_t	src;
 
 	VALUE_PAIR	*head = NULL;
 	VALUE_PAIR	*vp;
@@ -1876,10 +2105,9 @@ int fr_pair_list_copy_by_ancestor(TALLOC_CTX *ctx, VALUE_PAIR **to,
 	}
 
 	fr_cursor_talloc_init(&tmp, &head, VALUE_PAIR);
-	for (vp = fr_cursor_iter_by_ancestor_init(&src, &from, parent_da);
+	for (vp = fr_pair_iter_by_ancestor_init(&src, from, parent_da);
 	     vp;
-	     vp = fr_cursor_next(&src), cnt++) {
-		VP_VERIFY(vp);
+	     vp = fr_pair_iter_by_ancestor_next(&src), cnt++) {
 		vp = fr_pair_copy(ctx, vp);
 		if (!vp) {
 			fr_pair_list_free(&head);
@@ -1992,13 +2220,25 @@ void fr_pair_list_move(VALUE_PAIR **to, VALUE_PAIR **from)
 				break;
 
 			case FR_TYPE_OCTETS:
+				/*
+				 *	In situ values have no buffer to steal.
+				 */
+				if (fr_value_box_is_inline(&i->data)) {
+					fr_pair_value_memcpy(found, i->vp_octets, i->vp_length, i->data.tainted);
+					break;
+				}
+
 				fr_pair_value_memsteal(found, i->vp_octets, i->data.tainted);
 				i->vp_octets = NULL;
 				break;
 
 			case FR_TYPE_STRING:
-				fr_pair_value_strsteal(found, i->vp_strvalue);
-				i->vp_strvalue = NULL;
+				if (fr_value_box_is_inline(&i->data)) {
+					fr_pair_value_bstrncpy(found, i->vp_strvalue, i->vp_length);
+				} else {
+					fr_pair_value_strsteal(found, i->vp_strvalue);
+					i->vp_strvalue = NULL;
+				}
 				found->tag = i->tag;
 				break;
 			}
@@ -2778,6 +3018,19 @@ inline void fr_pair_verify(char const *file, int line, VALUE_PAIR const *vp)
 		size_t len;
 		TALLOC_CTX *parent;
 
+		/*
+		 *	In situ values have no talloc buffer to check.
+		 */
+		if (fr_value_box_is_inline(&vp->data)) {
+			if (vp->vp_length > FR_VALUE_BOX_INLINE_LEN) {
+				FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" length %zu is greater "
+					     "than the in situ buffer length %u\n", file, line, vp->da->name,
+					     vp->vp_length, FR_VALUE_BOX_INLINE_LEN);
+				if (!fr_cond_assert(0)) fr_exit_now(1);
+			}
+			break;
+		}
+
 		if (!talloc_get_type(vp->vp_ptr, uint8_t)) {
 			FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" data buffer type should be "
 				     "uint8_t but is %s\n", file, line, vp->da->name, talloc_get_name(vp->vp_ptr));
@@ -2807,6 +3060,20 @@ inline void fr_pair_verify(char const *file, int line, VALUE_PAIR const *vp)
 		size_t len;
 		TALLOC_CTX *parent;
 
+		if (fr_value_box_is_inline(&vp->data)) {
+			if (vp->vp_length >= FR_VALUE_BOX_INLINE_LEN) {
+				FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" length %zu is too "
+					     "long for the in situ buffer\n", file, line, vp->da->name, vp->vp_length);
+				if (!fr_cond_assert(0)) fr_exit_now(1);
+			}
+			if (vp->vp_strvalue[vp->vp_length] != '\0') {
+				FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" char buffer not \\0 "
+					     "terminated\n", file, line, vp->da->name);
+				if (!fr_cond_assert(0)) fr_exit_now(1);
+			}
+			break;
+		}
+
 		if (!talloc_get_type(vp->vp_ptr, char)) {
 			FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" data buffer type should be "
 				     "char but is %s\n", file, line, vp->da->name, talloc_get_name(vp->vp_ptr));
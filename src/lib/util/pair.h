@@ -245,8 +245,101 @@ static inline VALUE_PAIR *fr_cursor_iter_by_ancestor_init(fr_cursor_t *cursor,
 	return fr_cursor_talloc_iter_init(cursor, list, fr_pair_iter_next_by_ancestor, da, VALUE_PAIR);
 }
 
+/** Stack only state for filtered iteration over a pair list
+ *
+ * Unlike the cursor based iterators there's no function pointer
+ * indirection and no runtime talloc type checks in the iteration
+ * path.  The list must not be modified during iteration.
+ */
+typedef struct {
+	VALUE_PAIR		*next;		//!< Next pair to evaluate.
+	fr_dict_attr_t const	*da;		//!< Filter.
+} fr_pair_iter_t;
+
+/** Return the next attribute matching the iterator's #fr_dict_attr_t
+ *
+ * @param[in] iter	initialised with #fr_pair_iter_by_da_init.
+ * @return
+ *	- The next matching pair.
+ *	- NULL if no more pairs match.
+ */
+static inline VALUE_PAIR *fr_pair_iter_by_da_next(fr_pair_iter_t *iter)
+{
+	VALUE_PAIR *vp;
+
+	for (vp = iter->next; vp; vp = vp->next) {
+		VP_VERIFY(vp);
+		if (vp->da == iter->da) break;
+	}
+	iter->next = vp ? vp->next : NULL;
+
+	return vp;
+}
+
+/** Initialise iteration over attributes matching the specified #fr_dict_attr_t
+ *
+ * @param[in] iter	to initialise.  May be stack allocated.
+ * @param[in] head	of the list to iterate over.
+ * @param[in] da	to search for.
+ * @return
+ *	- The first matching pair.
+ *	- NULL if no pairs match.
+ */
+static inline VALUE_PAIR *fr_pair_iter_by_da_init(fr_pair_iter_t *iter,
+						  VALUE_PAIR *head, fr_dict_attr_t const *da)
+{
+	iter->next = head;
+	iter->da = da;
+
+	return fr_pair_iter_by_da_next(iter);
+}
+
+/** Return the next attribute descended from the iterator's #fr_dict_attr_t
+ *
+ * @param[in] iter	initialised with #fr_pair_iter_by_ancestor_init.
+ * @return
+ *	- The next matching pair.
+ *	- NULL if no more pairs match.
+ */
+static inline VALUE_PAIR *fr_pair_iter_by_ancestor_next(fr_pair_iter_t *iter)
+{
+	VALUE_PAIR *vp;
+
+	for (vp = iter->next; vp; vp = vp->next) {
+		VP_VERIFY(vp);
+		if (fr_dict_parent_common(iter->da, vp->da, true)) break;
+	}
+	iter->next = vp ? vp->next : NULL;
+
+	return vp;
+}
+
+/** Initialise iteration over attributes descended from the specified #fr_dict_attr_t
+ *
+ * @param[in] iter	to initialise.  May be stack allocated.
+ * @param[in] head	of the list to iterate over.
+ * @param[in] da	whose descendants to search for.
+ * @return
+ *	- The first matching pair.
+ *	- NULL if no pairs match.
+ */
+static inline VALUE_PAIR *fr_pair_iter_by_ancestor_init(fr_pair_iter_t *iter,
+							VALUE_PAIR *head, fr_dict_attr_t const *da)
+{
+	iter->next = head;
+	iter->da = da;
+
+	return fr_pair_iter_by_ancestor_next(iter);
+}
+
 VALUE_PAIR	*fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_t tag);
 
+typedef struct fr_pair_index_s fr_pair_index_t;
+
+fr_pair_index_t	*fr_pair_index_build(TALLOC_CTX *ctx, VALUE_PAIR *head);
+
+VALUE_PAIR	*fr_pair_index_find(fr_pair_index_t *idx, fr_dict_attr_t const *da, int8_t tag);
+
 VALUE_PAIR	*fr_pair_find_by_num(VALUE_PAIR *head, unsigned int vendor, unsigned int attr, int8_t tag);
 
 VALUE_PAIR	*fr_pair_find_by_child_num(VALUE_PAIR *head, fr_dict_attr_t const *parent,
@@ -281,6 +374,7 @@ int8_t		fr_pair_cmp_by_parent_num_tag(void const *a, void const *b);
 int		fr_pair_cmp(VALUE_PAIR *a, VALUE_PAIR *b);
 int		fr_pair_list_cmp(VALUE_PAIR *a, VALUE_PAIR *b);
 void		fr_pair_list_sort(VALUE_PAIR **vps, fr_cmp_t cmp);
+int		fr_pair_list_normalize(VALUE_PAIR **vps);
 
 /* Filtering */
 void		fr_pair_validate_debug(TALLOC_CTX *ctx, VALUE_PAIR const *failed[2]);
@@ -294,6 +388,7 @@ int		fr_pair_list_afrom_file(TALLOC_CTX *ctx, fr_dict_t const *dict,
 					VALUE_PAIR **out, FILE *fp, bool *pfiledone);
 
 int		fr_pair_list_copy(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR *from);
+int		fr_pair_list_copy_pooled(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR *from);
 int		fr_pair_list_copy_by_da(TALLOC_CTX *ctx, VALUE_PAIR **to,
 					VALUE_PAIR *from, fr_dict_attr_t const *da);
 int		fr_pair_list_copy_by_ancestor(TALLOC_CTX *ctx, VALUE_PAIR **to,
@@ -140,6 +140,10 @@ inline size_t fr_utf8_char(uint8_t const *str, ssize_t inlen)
 }
 
 /** Validate a complete UTF8 string
+ *
+ * Printable ASCII is validated a word at a time, with only multibyte
+ * sequences (and bytes near the ASCII boundaries) falling through to
+ * the per-character check.
  *
  * @param[in] str	input string.
  * @param[in] inlen	length of input string.  May be -1 if str
@@ -154,17 +158,37 @@ ssize_t fr_utf8_str(uint8_t const *str, ssize_t inlen)
 	size_t len;
 
 	len = inlen < 0 ? strlen((char const *)str) : (size_t) inlen;
+	if (len == 0) return 0;
 
 	p = str;
 	end = p + len;
 
-	do {
+	while (p < end) {
 		size_t clen;
 
+		/*
+		 *	ASCII fast path.  A word contains only bytes
+		 *	in [0x20-0x7e] iff no byte has the high bit
+		 *	set, no byte borrows when 0x20 is subtracted,
+		 *	and no byte carries into 0x80 when 1 is added.
+		 *	Carries between bytes can only cause false
+		 *	positives, which the slow path resolves.
+		 */
+		while ((size_t)(end - p) >= sizeof(uint64_t)) {
+			uint64_t word;
+
+			memcpy(&word, p, sizeof(word));
+			if ((word |
+			     (word - UINT64_C(0x2020202020202020)) |
+			     (word + UINT64_C(0x0101010101010101))) & UINT64_C(0x8080808080808080)) break;
+			p += sizeof(word);
+		}
+		if (p == end) break;
+
 		clen = fr_utf8_char(p, end - p);
 		if (clen == 0) return end - p;
 		p += clen;
-	} while (p < end);
+	}
 
 	return inlen;
 }
@@ -262,7 +286,43 @@ size_t fr_snprint(char *out, size_t outlen, char const *in, ssize_t inlen, char
 	used = 0;
 
 	while (inlen > 0) {
-		int sp = 0;
+		int	sp = 0;
+		size_t	clean;
+
+		/*
+		 *	Almost all input is printable ASCII which needs
+		 *	no escaping.  Scan forward for the end of the
+		 *	clean run, and copy it in bulk, instead of
+		 *	dropping into the switch below for every byte.
+		 *
+		 *	Anything outside 0x20-0x7e (controls, and bytes
+		 *	needing UTF-8 validation), the backslash, and
+		 *	the quotation character all end the run.
+		 */
+		for (clean = 0; clean < (size_t)inlen; clean++) {
+			uint8_t const c = p[clean];
+
+			if ((c < 0x20) || (c > 0x7e) || (c == '\\') || (c == quote)) break;
+		}
+		if (clean > 0) {
+			if ((freespace > 0) && (freespace <= clean)) {
+				if (out) {
+					memcpy(out + used, p, freespace - 1);
+					out[used + freespace - 1] = '\0';
+				}
+				out = NULL;
+				freespace = 0;
+
+			} else if (freespace > clean) { /* room for run AND trailing zero */
+				if (out) memcpy(out + used, p, clean);
+				freespace -= clean;
+			}
+
+			used += clean;
+			p += clean;
+			inlen -= clean;
+			continue;
+		}
 
 		/*
 		 *	Always escape the quotation character.
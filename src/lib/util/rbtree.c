@@ -53,6 +53,8 @@ struct rbtree_t {
 #endif
 	rbnode_t		*root;
 	int			num_elements;
+	uint32_t		generation;	//!< Incremented on every structural change,
+						///< so suspended walks can detect them.
 	rb_comparator_t		compare;
 	rb_free_t		free;
 	bool			replace;
@@ -63,6 +65,9 @@ struct rbtree_t {
 
 	TALLOC_CTX		*node_ctx;	//!< Freed last by the destructor, to ensure
 						//!< the tree is still functional.
+
+	rbnode_t		*free_list;	//!< Deleted nodes, held for reuse by
+						//!< subsequent inserts.
 };
 
 #ifndef NDEBUG
@@ -77,6 +82,36 @@ static inline void rbtree_free_data(rbtree_t *tree, rbnode_t *node)
 	node->being_freed = false;
 }
 
+/** Allocate a node, reusing one from the tree's free list where possible
+ *
+ * High churn trees (e.g. the worker's dedup trees) delete and insert
+ * nodes at the same rate, so instead of returning each deleted node to
+ * talloc, we hold it on a free list for the next insert.  The list is
+ * bounded by the tree's peak occupancy.
+ */
+static inline rbnode_t *node_alloc(rbtree_t *tree)
+{
+	rbnode_t *node;
+
+	node = tree->free_list;
+	if (node) {
+		tree->free_list = node->left;
+		memset(node, 0, sizeof(*node));
+		return node;
+	}
+
+	return talloc_zero(tree->node_ctx, rbnode_t);
+}
+
+/** Return a deleted node to the tree's free list
+ *
+ */
+static inline void node_free(rbtree_t *tree, rbnode_t *node)
+{
+	node->left = tree->free_list;
+	tree->free_list = node;
+}
+
 /** Walks the tree to delete all nodes Does NOT re-balance it!
  *
  */
@@ -131,6 +166,7 @@ static int _tree_free(rbtree_t *tree)
 	tree->magic = 0;
 #endif
 	tree->root = NIL;
+	tree->free_list = NULL;
 	tree->num_elements = 0;
 
 	/*
@@ -344,7 +380,7 @@ rbnode_t *rbtree_insert_node(rbtree_t *tree, void *data)
 	}
 
 	/* setup new node */
-	x = talloc_zero(tree->node_ctx, rbnode_t);
+	x = node_alloc(tree);
 	if (!x) {
 		fr_strerror_printf("No memory for new rbtree node");
 		if (tree->lock) pthread_mutex_unlock(&tree->mutex);
@@ -371,6 +407,7 @@ rbnode_t *rbtree_insert_node(rbtree_t *tree, void *data)
 	insert_fixup(tree, x);
 
 	tree->num_elements++;
+	tree->generation++;
 
 	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
 	return x;
@@ -525,7 +562,7 @@ static void rbtree_delete_internal(rbtree_t *tree, rbnode_t *z, bool skiplock)
 		if (y->left->parent == z) y->left->parent = y;
 		if (y->right->parent == z) y->right->parent = y;
 
-		talloc_free(z);
+		node_free(tree, z);
 
 	} else {
 		rbtree_free_data(tree, y);
@@ -533,10 +570,11 @@ static void rbtree_delete_internal(rbtree_t *tree, rbnode_t *z, bool skiplock)
 		if (y->colour == BLACK)
 			delete_fixup(tree, x, parent);
 
-		talloc_free(y);
+		node_free(tree, y);
 	}
 
 	tree->num_elements--;
+	tree->generation++;
 	if (!skiplock) {
 		if (tree->lock) pthread_mutex_unlock(&tree->mutex);
 	}
@@ -791,6 +829,128 @@ int rbtree_walk(rbtree_t *tree, rb_order_t order, rb_walker_t compare, void *uct
 	return rcode;
 }
 
+/** In-order successor of a node
+ *
+ */
+static rbnode_t *node_successor(rbnode_t *x)
+{
+	if (x->right != NIL) {
+		x = x->right;
+		while (x->left != NIL) x = x->left;
+		return x;
+	}
+
+	while (x->parent && (x->parent->right == x)) x = x->parent;
+
+	return x->parent;
+}
+
+/** Prepare an incremental in-order walk
+ *
+ * @param[out] cursor	to initialise.
+ * @param[in] tree	to walk.
+ */
+void rbtree_walk_init(rbtree_walk_t *cursor, rbtree_t *tree)
+{
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->tree = tree;
+}
+
+/** Visit the next batch of nodes of an incremental in-order walk
+ *
+ * Unlike #rbtree_walk, the tree's mutex is held only while one batch
+ * is visited, and released before returning, so writers stall for at
+ * most one batch instead of the whole traversal.
+ *
+ * If the tree was modified while the walk was suspended, the walk
+ * resumes at the first element greater than the last one visited.
+ * Elements inserted or deleted behind the walk are not revisited.
+ *
+ * @note The last element visited must not be freed while the walk is
+ *	suspended, as its key is used to re-find our position when the
+ *	tree was modified.
+ *
+ * @param[in,out] cursor	initialised with #rbtree_walk_init.
+ * @param[in] batch		maximum number of nodes to visit before
+ *				releasing the mutex.
+ * @param[in] compare		callback, as for #rbtree_walk.  Returning
+ *				non-zero stops the walk.
+ * @param[in] uctx		passed to the callback.
+ * @return
+ *	- 1 if more nodes remain, call again to continue.
+ *	- 0 when the walk has visited every node.
+ *	- anything else is the callback's return value, the walk stops.
+ */
+int rbtree_walk_batch(rbtree_walk_t *cursor, uint32_t batch, rb_walker_t compare, void *uctx)
+{
+	rbtree_t	*tree = cursor->tree;
+	rbnode_t	*x;
+	uint32_t	visited = 0;
+	int		rcode = 0;
+
+	if (tree->lock) pthread_mutex_lock(&tree->mutex);
+
+	if (!cursor->started) {
+		x = tree->root;
+		if (x == NIL) goto done;
+		while (x->left != NIL) x = x->left;
+
+	} else if (cursor->node && (cursor->generation == tree->generation)) {
+		/*
+		 *	Nothing changed while we were suspended, so the
+		 *	saved node is still where we left it.
+		 */
+		x = cursor->node;
+
+	} else {
+		rbnode_t *found = NULL;
+
+		/*
+		 *	The tree was modified while we were suspended.
+		 *	Re-find the first element greater than the last
+		 *	one we visited.
+		 */
+		x = tree->root;
+		while (x != NIL) {
+			if (tree->compare(x->data, cursor->last) > 0) {
+				found = x;
+				x = x->left;
+			} else {
+				x = x->right;
+			}
+		}
+		x = found;
+		if (!x) goto done;
+	}
+
+	while (x) {
+		rcode = compare(x->data, uctx);
+		if (rcode != 0) goto finish;
+
+		cursor->last = x->data;
+		cursor->started = true;
+
+		x = node_successor(x);
+		if (++visited >= batch) break;
+	}
+
+	if (!x) {
+	done:
+		cursor->node = NULL;
+		rcode = 0;
+		goto finish;
+	}
+
+	cursor->node = x;
+	cursor->generation = tree->generation;
+	rcode = 1;
+
+finish:
+	if (tree->lock) pthread_mutex_unlock(&tree->mutex);
+
+	return rcode;
+}
+
 uint32_t rbtree_num_elements(rbtree_t *tree)
 {
 	if (!tree) return 0;
@@ -128,6 +128,25 @@ void		*rbtree_node2data(rbtree_t *tree, rbnode_t *node);
  */
 int		rbtree_walk(rbtree_t *tree, rb_order_t order, rb_walker_t compare, void *uctx);
 
+/** State of an incremental in-order tree walk
+ *
+ * Unlike #rbtree_walk, the tree's mutex is held only while one batch
+ * of nodes is visited, so writers can make progress between batches.
+ *
+ * Stack allocate, and initialise with #rbtree_walk_init.
+ */
+typedef struct {
+	rbtree_t	*tree;		//!< Tree being walked.
+	rbnode_t	*node;		//!< Next node to visit, if the tree is unchanged.
+	void		*last;		//!< Data of the last node visited.
+	uint32_t	generation;	//!< Tree generation node was captured at.
+	bool		started;	//!< At least one node has been visited.
+} rbtree_walk_t;
+
+void		rbtree_walk_init(rbtree_walk_t *cursor, rbtree_t *tree);
+
+int		rbtree_walk_batch(rbtree_walk_t *cursor, uint32_t batch, rb_walker_t compare, void *uctx);
+
 #ifdef __cplusplus
 }
 #endif
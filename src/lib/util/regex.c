@@ -25,6 +25,7 @@ RCSID("$Id$")
 
 #ifdef HAVE_REGEX
 
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/regex.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/talloc.h>
@@ -1196,6 +1197,174 @@ fr_regmatch_t *regex_match_data_alloc(TALLOC_CTX *ctx, uint32_t count)
  *########################################
  */
 
+/** Maximum number of runtime compiled expressions to cache per thread
+ *
+ */
+#define REGEX_CACHE_MAX_ENTRIES	(64)
+
+/** An entry in the thread local cache of runtime compiled expressions
+ *
+ */
+typedef struct {
+	char const		*pattern;	//!< Pattern the expression was compiled from.
+	size_t			pattern_len;	//!< Length of the pattern.
+	fr_regex_flags_t	flags;		//!< Flags the expression was compiled with.
+	bool			subcaptures;	//!< Whether the expression records subcapture data.
+	regex_t			*preg;		//!< The compiled expression.
+} regex_cache_entry_t;
+
+fr_thread_local_setup(fr_hash_table_t *, regex_cache)	/* macro */
+
+static uint32_t _regex_cache_entry_hash(void const *data)
+{
+	regex_cache_entry_t const *a = data;
+	uint32_t hash;
+
+	hash = fr_hash(a->pattern, a->pattern_len);
+	hash = fr_hash_update(&a->flags, sizeof(a->flags), hash);
+
+	return fr_hash_update(&a->subcaptures, sizeof(a->subcaptures), hash);
+}
+
+static int _regex_cache_entry_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	if (a->pattern_len != b->pattern_len) return (a->pattern_len > b->pattern_len) - (a->pattern_len < b->pattern_len);
+
+	ret = memcmp(a->pattern, b->pattern, a->pattern_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(&a->flags, &b->flags, sizeof(a->flags));
+	if (ret != 0) return ret;
+
+	return (a->subcaptures > b->subcaptures) - (a->subcaptures < b->subcaptures);
+}
+
+static void _regex_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Explicitly cleanup the memory allocated to the regex cache
+ *
+ */
+static void _regex_cache_free(void *arg)
+{
+	talloc_free(arg);
+	regex_cache = NULL;
+}
+
+/** Compile a runtime expression, caching the result per thread
+ *
+ * Expressions produced by expansions at runtime tend to repeat, so
+ * instead of compiling them for one off evaluation, we keep them in a
+ * thread local cache, and compile them as if they were known at startup,
+ * which also runs them through the JIT where that's available.
+ *
+ * Capture data handed to the request keeps a pointer to the compiled
+ * expression, so entries are never evicted.  Once the cache is full,
+ * expressions are compiled for one off evaluation, exactly as if
+ * #regex_compile had been called with runtime set.
+ *
+ * @param[in] ctx		to bind the expression to, if it could not be cached.
+ * @param[out] out		Where to write out a pointer to the structure containing
+ *				the compiled expression.
+ * @param[out] cache_owned	Set to true if the expression is owned by the cache,
+ *				in which case the caller must not free it.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] flags		controlling matching. May be NULL.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture
+ *				data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, bool *cache_owned,
+			     char const *pattern, size_t len,
+			     fr_regex_flags_t const *flags, bool subcaptures)
+{
+	fr_hash_table_t		*ht;
+	regex_cache_entry_t	find, *found;
+	ssize_t			slen;
+
+	*out = NULL;
+	*cache_owned = false;
+
+	ht = regex_cache;
+	if (!ht) {
+		ht = fr_hash_table_create(NULL, _regex_cache_entry_hash, _regex_cache_entry_cmp,
+					  _regex_cache_entry_free);
+		if (ht) {
+			fr_thread_local_set_destructor(regex_cache, _regex_cache_free, ht);
+		}
+	}
+
+	if (ht) {
+		memset(&find, 0, sizeof(find));
+		find.pattern = pattern;
+		find.pattern_len = len;
+		if (flags) find.flags = *flags;
+		find.subcaptures = subcaptures;
+
+		found = fr_hash_table_finddata(ht, &find);
+		if (found) {
+			*out = found->preg;
+			*cache_owned = true;
+
+			return (ssize_t)len;
+		}
+	}
+
+	/*
+	 *	Cache unavailable or full.
+	 */
+	if (!ht || (fr_hash_table_num_elements(ht) >= REGEX_CACHE_MAX_ENTRIES)) {
+	uncached:
+		return regex_compile(ctx, out, pattern, len, flags, subcaptures, true);
+	}
+
+	found = talloc_zero(NULL, regex_cache_entry_t);
+	if (!found) goto uncached;
+
+	found->pattern = talloc_bstrndup(found, pattern, len);
+	if (!found->pattern) {
+		talloc_free(found);
+		goto uncached;
+	}
+	found->pattern_len = len;
+	if (flags) found->flags = *flags;
+	found->subcaptures = subcaptures;
+
+	/*
+	 *	Compiled as if it were a startup expression, so it's
+	 *	JIT'd where possible, and capture processing doesn't
+	 *	attempt to steal it out of the cache.
+	 */
+	slen = regex_compile(found, &found->preg, found->pattern, len, flags, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(found);
+
+		/*
+		 *	JIT'ing the pattern may fail where a one off
+		 *	compilation would succeed.
+		 */
+		goto uncached;
+	}
+
+	if (fr_hash_table_insert(ht, found) == 0) {
+		talloc_free(found);
+		goto uncached;
+	}
+
+	*out = found->preg;
+	*cache_owned = true;
+
+	return slen;
+}
+
 /** Parse a string containing one or more regex flags
  *
  * @param[out] err		May be NULL. If not NULL will be set to:
@@ -169,6 +169,9 @@ ssize_t		regex_flags_parse(int *err, fr_regex_flags_t *out, char const *in, size
 size_t		regex_flags_snprint(char *out, size_t outlen, fr_regex_flags_t const *flags);
 ssize_t		regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
 			      fr_regex_flags_t const *flags, bool subcaptures, bool runtime);
+ssize_t		regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, bool *cache_owned,
+				     char const *pattern, size_t len,
+				     fr_regex_flags_t const *flags, bool subcaptures);
 int		regex_exec(regex_t *preg, char const *subject, size_t len, fr_regmatch_t *regmatch);
 #ifdef HAVE_REGEX_PCRE2
 int		regex_substitute(TALLOC_CTX *ctx, char **out, size_t max_out, regex_t *preg, fr_regex_flags_t *flags,
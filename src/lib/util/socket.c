@@ -34,6 +34,7 @@
 
 #include <fcntl.h>
 #include <netdb.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -1023,3 +1024,104 @@ skip_cap:
 #endif
 	return 0;
 }
+
+/*
+ *	The first inherited file descriptor, as per the systemd
+ *	sd_listen_fds() protocol.  0/1/2 are stdin/stdout/stderr.
+ */
+#define SOCKET_INHERIT_FDS_START (3)
+
+/** Claim a matching socket passed to us by a supervisor process
+ *
+ * Implements the receiving half of the systemd "socket activation"
+ * protocol.  The supervisor binds the sockets, and passes them to us
+ * as file descriptors 3..(3 + LISTEN_FDS - 1), with LISTEN_PID set to
+ * our PID.  Any wrapper script can do the same, so this also allows an
+ * old radiusd to hand its sockets to a new one across a restart,
+ * without a window where the port is closed and packets are dropped.
+ *
+ * Each descriptor is claimed at most once, so that two listeners with
+ * the same address configuration don't share a socket.
+ *
+ * The claimed socket is fixed up (close on exec, non-blocking,
+ * udpfromto) the same way as one opened by fr_socket_server_udp() or
+ * fr_socket_server_tcp(), so it can be used as a drop-in replacement.
+ *
+ * @param[in] type	SOCK_DGRAM or SOCK_STREAM.
+ * @param[in] ipaddr	the socket must be bound to this address.
+ * @param[in] port	and this port.
+ * @param[in] async	whether we block or not on reads and writes.
+ * @return
+ *	- Socket FD on success.
+ *	- -1 if no inherited socket matches.  The caller should open
+ *	  its own socket as usual.
+ */
+int fr_socket_inherit(int type, fr_ipaddr_t const *ipaddr, uint16_t port, bool async)
+{
+	static int	num_fds = -1;
+	static uint64_t	claimed = 0;
+	int		i;
+
+	/*
+	 *	Parse the environment once.  If LISTEN_PID isn't our
+	 *	PID, the descriptors are meant for another process,
+	 *	and we must leave them alone.
+	 */
+	if (num_fds < 0) {
+		char const *env;
+
+		num_fds = 0;
+
+		env = getenv("LISTEN_PID");
+		if (!env || ((pid_t) strtoul(env, NULL, 10) != getpid())) return -1;
+
+		env = getenv("LISTEN_FDS");
+		if (!env) return -1;
+
+		num_fds = atoi(env);
+		if (num_fds < 0) num_fds = 0;
+		if (num_fds > 64) num_fds = 64;	/* size of the "claimed" bitmap */
+	}
+
+	for (i = 0; i < num_fds; i++) {
+		int			fd = SOCKET_INHERIT_FDS_START + i;
+		int			sock_type;
+		socklen_t		opt_len = sizeof(sock_type);
+		struct sockaddr_storage	salocal;
+		socklen_t		salen = sizeof(salocal);
+		fr_ipaddr_t		my_ipaddr;
+		uint16_t		my_port;
+
+		if (claimed & (((uint64_t) 1) << i)) continue;
+
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &sock_type, &opt_len) < 0) continue;
+		if (sock_type != type) continue;
+
+		memset(&salocal, 0, sizeof(salocal));
+		if (getsockname(fd, (struct sockaddr *) &salocal, &salen) < 0) continue;
+		if (fr_ipaddr_from_sockaddr(&salocal, salen, &my_ipaddr, &my_port) < 0) continue;
+
+		if (my_port != port) continue;
+		if (fr_ipaddr_cmp(&my_ipaddr, ipaddr) != 0) continue;
+
+		/*
+		 *	Match.  Fix the socket up the same way as
+		 *	fr_socket_server_*() would have.
+		 */
+		if (async && (fr_nonblock(fd) < 0)) continue;
+
+		if (socket_dont_inherit(fd) < 0) continue;
+
+#ifdef WITH_UDPFROMTO
+		if ((type == SOCK_DGRAM) && (udpfromto_init(fd) != 0)) {
+			fr_strerror_printf("Failed initializing udpfromto: %s", fr_syserror(errno));
+			continue;
+		}
+#endif
+
+		claimed |= (((uint64_t) 1) << i);
+		return fd;
+	}
+
+	return -1;
+}
@@ -257,6 +257,81 @@ done:
 }
 
 
+/** Encode a fixed-size struct member with straight-line code
+ *
+ *  Fixed-layout structs are almost always built from small integers
+ *  and addresses.  Encoding each member through
+ *  fr_value_box_to_network() costs a table lookup and a switch on the
+ *  data type, which shows up in traces for hot structs.  Copy the
+ *  common fixed-size types here with a memcpy or a byte swap, and
+ *  leave the generic encoder to deal with everything else.
+ */
+static ssize_t struct_member_to_network(uint8_t *out, size_t outlen, VALUE_PAIR const *vp)
+{
+	switch (vp->da->type) {
+	case FR_TYPE_BOOL:
+		if (outlen < 1) break;
+		out[0] = vp->vp_bool ? 0x01 : 0x00;
+		return 1;
+
+	case FR_TYPE_UINT8:
+	case FR_TYPE_INT8:
+		if (outlen < 1) break;
+		out[0] = vp->vp_uint8;
+		return 1;
+
+	case FR_TYPE_UINT16:
+	case FR_TYPE_INT16:
+	{
+		uint16_t num;
+
+		if (outlen < sizeof(num)) break;
+		num = htons(vp->vp_uint16);	/* Not a typo, uses the union to avoid memcpy */
+		memcpy(out, &num, sizeof(num));
+		return sizeof(num);
+	}
+
+	case FR_TYPE_UINT32:
+	case FR_TYPE_INT32:
+	{
+		uint32_t num;
+
+		if (outlen < sizeof(num)) break;
+		num = htonl(vp->vp_uint32);
+		memcpy(out, &num, sizeof(num));
+		return sizeof(num);
+	}
+
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT64:
+	{
+		uint64_t num;
+
+		if (outlen < sizeof(num)) break;
+		num = htonll(vp->vp_uint64);
+		memcpy(out, &num, sizeof(num));
+		return sizeof(num);
+	}
+
+	/*
+	 *	Already in network byte order.
+	 */
+	case FR_TYPE_IPV4_ADDR:
+		if (outlen < sizeof(vp->vp_ipv4addr)) break;
+		memcpy(out, &vp->vp_ipv4addr, sizeof(vp->vp_ipv4addr));
+		return sizeof(vp->vp_ipv4addr);
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Truncated buffers and the less common types go through
+	 *	the generic encoder.
+	 */
+	return fr_value_box_to_network(NULL, out, outlen, &vp->data);
+}
+
 ssize_t fr_struct_to_network(uint8_t *out, size_t outlen,
 			     fr_dict_attr_t const *parent, fr_cursor_t *cursor)
 {
@@ -344,7 +419,7 @@ ssize_t fr_struct_to_network(uint8_t *out, size_t outlen,
 			/*
 			 *	Determine the nested type and call the appropriate encoder
 			 */
-			len = fr_value_box_to_network(NULL, p, outlen, &vp->data);
+			len = struct_member_to_network(p, outlen, vp);
 			if (len <= 0) return -1;
 		}
 
@@ -112,6 +112,8 @@ typedef struct {
 int fr_time_start(void);
 int fr_time_sync(void);
 fr_time_t fr_time(void);
+fr_time_t fr_time_coarse(void);
+void fr_time_coarse_update(fr_time_t now);
 
 #define fr_unix_time_from_nsec(_x) _x
 #define fr_unix_time_from_usec fr_time_delta_from_usec
@@ -245,6 +245,32 @@ const bool fr_str_tok[] = {
 	( (tptr)[0] == (bptr)[0] && \
 	 ((tptr)[1] == (bptr)[1] || (tptr)[1] == 0))
 
+/*
+ *	A token can only begin with one of these characters.  Must be
+ *	kept in sync with the first character of every entry in
+ *	fr_tokens_table.
+ *
+ *	Almost every byte of a config or users file is an ordinary word
+ *	character, so this lets us skip the token list scan entirely
+ *	instead of running it for every byte.
+ */
+static bool const token_start_char[UINT8_MAX + 1] = {
+	['='] = true,
+	['!'] = true,
+	['{'] = true,
+	['}'] = true,
+	['('] = true,
+	[')'] = true,
+	[','] = true,
+	['+'] = true,
+	['-'] = true,
+	[':'] = true,
+	['>'] = true,
+	['<'] = true,
+	['#'] = true,
+	[';'] = true
+};
+
 /*
  *	Read a word from a buffer and advance pointer.
  *	This function knows about escapes and quotes.
@@ -277,7 +303,7 @@ static FR_TOKEN getthing(char const **ptr, char *buf, int buflen, bool tok,
 	/*
 	 *	Might be a 1 or 2 character token.
 	 */
-	if (tok) {
+	if (tok && token_start_char[(uint8_t) *p]) {
 		for (i = 0; i < tokenlist_len; i++) {
 			if (TOKEN_MATCH(p, tokenlist[i].name)) {
 				strcpy(buf, tokenlist[i].name);
@@ -315,15 +341,33 @@ static FR_TOKEN getthing(char const **ptr, char *buf, int buflen, bool tok,
 	}
 	s = buf;
 
-	while (*p && buflen-- > 1) {
-		/*
-		 *	We're looking for strings.  Stop on spaces, or
-		 *	(if given a token list), on a token, or on a
-		 *	comma.
-		 */
-		if (!quote) {
-			if (isspace((int) *p)) break;
+	/*
+	 *	Bare words stop on spaces, a comma, or (if given a
+	 *	token list), on a token.  Scan for the end of each
+	 *	span and copy it in one go, instead of re-checking the
+	 *	token list for every byte.
+	 */
+	if (!quote) {
+		while (*p && (buflen > 1)) {
+			char const	*start = p;
+			size_t		outlen;
+
+			while (*p && !isspace((int) *p) && (*p != ',') &&
+			       (!tok || !token_start_char[(uint8_t) *p])) p++;
+
+			outlen = (size_t) (p - start);
+			if (outlen >= (size_t) buflen) {
+				outlen = buflen - 1;
+				memcpy(s, start, outlen);
+				s += outlen;
+				p = start + outlen;	/* Stop where the copy stopped */
+				break;
+			}
+			memcpy(s, start, outlen);
+			s += outlen;
+			buflen -= outlen;
 
+			if (!*p || isspace((int) *p) || (*p == ',')) break;
 
 			if (tok) {
 				for (i = 0; i < tokenlist_len; i++) {
@@ -333,15 +377,22 @@ static FR_TOKEN getthing(char const **ptr, char *buf, int buflen, bool tok,
 					}
 				}
 			}
-			if (*p == ',') break;
 
 			/*
-			 *	Copy the character over.
+			 *	Looked like it could start a token, but
+			 *	didn't (e.g. a lone '+'), so it's part
+			 *	of the word.
 			 */
+			if (buflen <= 1) break;
 			*s++ = *p++;
-			continue;
-		} /* else there was a quotation character */
+			buflen--;
+		}
+
+		*s++ = 0;
+		goto done;
+	}
 
+	while (*p && buflen-- > 1) {
 		/*
 		 *	Un-escaped quote character.  We're done.
 		 */
@@ -256,3 +256,128 @@ done:
 
 	return received;
 }
+
+#ifdef HAVE_RECVMMSG
+/** Read as many UDP packets as possible from a socket in one system call
+ *
+ *  Uses recvmmsg() to drain the socket in batches, so a busy listener
+ *  pays one syscall for a burst of packets instead of one per packet.
+ *
+ *  The destination address is NOT reported, so this function is only
+ *  usable on connected sockets, or on sockets bound to a single address
+ *  where the destination is already known.  Callers needing per-packet
+ *  destinations (wildcard binds) must use udp_recv().
+ *
+ * @param[in] sockfd		we're reading from.
+ * @param[in,out] packets	caller-supplied buffers to receive into,
+ *				with received lengths and source addresses
+ *				filled in on return.
+ * @param[in] max_packets	number of entries in packets.
+ * @return
+ *	- >0 the number of packets received.
+ *	- 0 on no data available.
+ *	- <0 on error.
+ */
+int udp_recv_multi(int sockfd, udp_packet_t *packets, int max_packets)
+{
+	struct mmsghdr		msgvec[32];
+	struct iovec		iov[32];
+	struct sockaddr_storage	src[32];
+	int			i, num;
+	fr_time_t		when;
+
+	if (max_packets > (int) (sizeof(msgvec) / sizeof(msgvec[0]))) {
+		max_packets = (int) (sizeof(msgvec) / sizeof(msgvec[0]));
+	}
+	if (max_packets <= 0) return 0;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * max_packets);
+
+	for (i = 0; i < max_packets; i++) {
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = packets[i].data_len;
+
+		msgvec[i].msg_hdr.msg_name = &src[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof(src[i]);
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	num = recvmmsg(sockfd, msgvec, max_packets, MSG_DONTWAIT, NULL);
+	if (num < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	One timestamp for the whole batch.  The packets were
+	 *	all sitting in the kernel queue at the same time.
+	 */
+	when = fr_time();
+
+	for (i = 0; i < num; i++) {
+		packets[i].data_len = msgvec[i].msg_len;
+		packets[i].when = when;
+
+		if (fr_ipaddr_from_sockaddr(&src[i], msgvec[i].msg_hdr.msg_namelen,
+					    &packets[i].src_ipaddr, &packets[i].src_port) < 0) {
+			fr_strerror_printf_push("Failed converting sockaddr to ipaddr");
+			return -1;
+		}
+	}
+
+	return num;
+}
+#endif	/* HAVE_RECVMMSG */
+
+#ifdef HAVE_SENDMMSG
+/** Write a batch of UDP packets to a socket in one system call
+ *
+ *  Uses sendmmsg() so a sender flushing a queue pays one syscall for
+ *  a burst of packets instead of one per packet.
+ *
+ *  The destination address is taken from the socket, so this function
+ *  is only usable on connected sockets.
+ *
+ * @param[in] sockfd		we're writing to.
+ * @param[in] packets		to write, using the data and data_len fields.
+ * @param[in] num_packets	number of entries in packets.
+ * @return
+ *	- >=0 the number of packets written.  May be less than
+ *	  num_packets if the socket blocked part way through.
+ *	- <0 on error.
+ */
+int udp_send_multi(int sockfd, udp_packet_t *packets, int num_packets)
+{
+	struct mmsghdr		msgvec[32];
+	struct iovec		iov[32];
+	int			i, num;
+
+	if (num_packets > (int) (sizeof(msgvec) / sizeof(msgvec[0]))) {
+		num_packets = (int) (sizeof(msgvec) / sizeof(msgvec[0]));
+	}
+	if (num_packets <= 0) return 0;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num_packets);
+
+	for (i = 0; i < num_packets; i++) {
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = packets[i].data_len;
+
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	num = sendmmsg(sockfd, msgvec, num_packets, 0);
+	if (num < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed writing socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return num;
+}
+#endif	/* HAVE_SENDMMSG */
@@ -43,6 +43,26 @@ ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
 
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+/** One packet in a udp_recv_multi() or udp_send_multi() batch
+ */
+typedef struct {
+	uint8_t		*data;		//!< Caller-supplied buffer to receive into.
+	size_t		data_len;	//!< In: size of the buffer.  Out: bytes received.
+	fr_ipaddr_t	src_ipaddr;	//!< Source address of the packet.
+	uint16_t	src_port;	//!< Source port of the packet.
+	fr_time_t	when;		//!< When the packet was received.
+} udp_packet_t;
+#endif
+
+#ifdef HAVE_RECVMMSG
+int udp_recv_multi(int sockfd, udp_packet_t *packets, int max_packets);
+#endif
+
+#ifdef HAVE_SENDMMSG
+int udp_send_multi(int sockfd, udp_packet_t *packets, int num_packets);
+#endif
+
 int udp_recv_discard(int sockfd);
 
 ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipaddr_t *src_ipaddr, uint16_t *src_port);
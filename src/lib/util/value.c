@@ -294,7 +294,11 @@ inline void fr_value_box_clear(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
-		TALLOC_FREE(data->datum.ptr);
+		if (fr_value_box_is_inline(data)) {
+			data->datum.ptr = NULL;
+		} else {
+			TALLOC_FREE(data->datum.ptr);
+		}
 		data->datum.length = 0;
 		break;
 
@@ -336,6 +340,24 @@ static inline void fr_value_box_copy_meta(fr_value_box_t *dst, fr_value_box_t co
 	dst->next = NULL;	/* copy one */
 }
 
+/** Copy a short value into the in situ buffer of a destination box
+ *
+ * The caller must have checked the data fits, i.e. len < #FR_VALUE_BOX_INLINE_LEN
+ * for strings (which get a trailing '\0'), len <= #FR_VALUE_BOX_INLINE_LEN for
+ * octet strings.
+ *
+ * @param[in] dst	box to copy the value into.
+ * @param[in] src	data to copy.
+ * @param[in] len	of data.
+ * @param[in] nul_term	Add a trailing '\0' (strings).
+ */
+static inline void fr_value_box_inline_copy(fr_value_box_t *dst, void const *src, size_t len, bool nul_term)
+{
+	memcpy(dst->datum.inline_buf, src, len);
+	if (nul_term) dst->datum.inline_buf[len] = '\0';
+	dst->datum.ptr = dst->datum.inline_buf;
+}
+
 /** Compare two values
  *
  * @param[in] a Value to compare.
@@ -367,6 +389,15 @@ int fr_value_box_cmp(fr_value_box_t const *a, fr_value_box_t const *b)
 	{
 		size_t length;
 
+		/*
+		 *	16 octet blobs (authentication vectors, hashes,
+		 *	State) are common, and are almost always being
+		 *	checked for equality.  One fixed-size compare,
+		 *	instead of a length-generic memcmp.
+		 */
+		if ((a->datum.length == 16) && (b->datum.length == 16) &&
+		    fr_memeq16(a->vb_octets, b->vb_octets)) break;
+
 		if (a->datum.length < b->datum.length) {
 			length = a->datum.length;
 		} else {
@@ -983,6 +1014,99 @@ size_t fr_value_box_network_length(fr_value_box_t *value)
 	}
 }
 
+/** Direct network encoders for fixed-width types
+ *
+ * Each function writes one value in network format, with a single
+ * byte-swapping store.  They're called through
+ * #fr_value_box_to_network_table, so that the hot path in the protocol
+ * encoders is one indexed call, instead of the full type switch in
+ * #fr_value_box_to_network.
+ *
+ * @param[out] dst	Where to write the serialized data.  The caller
+ *			MUST have checked that there's space for the
+ *			(fixed) network width of the type.
+ * @param[in] value	to encode.
+ * @return the number of bytes written to dst.
+ */
+static size_t to_network_bool(uint8_t *dst, fr_value_box_t const *value)
+{
+	dst[0] = value->datum.boolean ? 0x01 : 0x00;
+	return 1;
+}
+
+static size_t to_network_8(uint8_t *dst, fr_value_box_t const *value)
+{
+	dst[0] = value->vb_uint8;			/* Not a typo, uses the union for int8 too */
+	return 1;
+}
+
+static size_t to_network_16(uint8_t *dst, fr_value_box_t const *value)
+{
+	uint16_t v = htons(value->vb_uint16);		/* Not a typo, uses the union for int16 too */
+
+	memcpy(dst, &v, sizeof(v));
+	return sizeof(v);
+}
+
+static size_t to_network_32(uint8_t *dst, fr_value_box_t const *value)
+{
+	uint32_t v = htonl(value->vb_uint32);		/* Not a typo, uses the union for int32/float32 too */
+
+	memcpy(dst, &v, sizeof(v));
+	return sizeof(v);
+}
+
+static size_t to_network_64(uint8_t *dst, fr_value_box_t const *value)
+{
+	uint64_t v = htonll(value->vb_uint64);		/* Not a typo, uses the union for int64/float64 too */
+
+	memcpy(dst, &v, sizeof(v));
+	return sizeof(v);
+}
+
+static size_t to_network_ipv4_addr(uint8_t *dst, fr_value_box_t const *value)
+{
+	memcpy(dst, (uint8_t const *)&value->vb_ip.addr.v4.s_addr, sizeof(value->vb_ip.addr.v4.s_addr));
+	return sizeof(value->vb_ip.addr.v4.s_addr);
+}
+
+/** Lookup table of direct encoders, indexed by type
+ *
+ * Only types whose network width is fixed, and whose encoding doesn't
+ * depend on the dictionary (as dates and deltas do) have entries.
+ */
+static fr_value_box_to_network_t const fr_value_box_to_network_table[FR_TYPE_MAX + 1] = {
+	[FR_TYPE_BOOL]		= to_network_bool,
+	[FR_TYPE_UINT8]		= to_network_8,
+	[FR_TYPE_UINT16]	= to_network_16,
+	[FR_TYPE_UINT32]	= to_network_32,
+	[FR_TYPE_UINT64]	= to_network_64,
+	[FR_TYPE_INT8]		= to_network_8,
+	[FR_TYPE_INT16]		= to_network_16,
+	[FR_TYPE_INT32]		= to_network_32,
+	[FR_TYPE_INT64]		= to_network_64,
+	[FR_TYPE_FLOAT32]	= to_network_32,
+	[FR_TYPE_FLOAT64]	= to_network_64,
+	[FR_TYPE_IPV4_ADDR]	= to_network_ipv4_addr,
+};
+
+/** Return the direct network encoder for a type, if one exists
+ *
+ * The protocol encoders cache this per dictionary attribute, so that
+ * encoding a numeric attribute in their pair loops is one indexed call.
+ *
+ * @param[in] type	to return an encoder for.
+ * @return
+ *	- The encoder.
+ *	- NULL if the type needs the full #fr_value_box_to_network.
+ */
+fr_value_box_to_network_t fr_value_box_to_network_func(fr_type_t type)
+{
+	if (type >= FR_TYPE_MAX) return NULL;
+
+	return fr_value_box_to_network_table[type];
+}
+
 /** Encode a single value box, serializing its contents in generic network format
  *
  * The serialized form of #fr_value_box_t may not match the requirements of your protocol
@@ -1036,6 +1160,20 @@ ssize_t fr_value_box_to_network(size_t *need, uint8_t *dst, size_t dst_len, fr_v
 
 	RETURN_IF_NO_SPACE_INIT(need, 1, p, dst, end);
 
+	/*
+	 *	Fixed-width types with direct encoders.  One bounds
+	 *	check, then a single byte-swapping store.
+	 */
+	if (fr_value_box_to_network_table[value->type]) {
+		min = fr_value_box_network_sizes[value->type][0];
+		if (min > dst_len) {
+			if (need) *need = min;
+			return 0;
+		}
+
+		return fr_value_box_to_network_table[value->type](dst, value);
+	}
+
 	/*
 	 *	Variable length types
 	 */
@@ -1630,6 +1768,8 @@ static inline int fr_value_box_cast_to_strvalue(TALLOC_CTX *ctx, fr_value_box_t
 						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	if (!fr_cond_assert(dst_type == FR_TYPE_STRING)) return -1;
 
 	switch (src->type) {
@@ -1674,6 +1814,8 @@ static inline int fr_value_box_cast_to_octets(TALLOC_CTX *ctx, fr_value_box_t *d
 {
 	uint8_t *bin;
 
+	memset(dst, 0, sizeof(*dst));
+
 	if (!fr_cond_assert(dst_type == FR_TYPE_OCTETS)) return -1;
 
 	switch (src->type) {
@@ -1759,6 +1901,8 @@ static inline int fr_value_box_cast_to_ipv4addr(TALLOC_CTX *ctx, fr_value_box_t
 						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	if (!fr_cond_assert(dst_type == FR_TYPE_IPV4_ADDR)) return -1;
 
 	switch (src->type) {
@@ -1862,6 +2006,8 @@ static inline int fr_value_box_cast_to_ipv4prefix(TALLOC_CTX *ctx, fr_value_box_
 						  fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						  fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	if (!fr_cond_assert(dst_type == FR_TYPE_IPV4_PREFIX)) return -1;
 
 	switch (src->type) {
@@ -1966,6 +2112,8 @@ static inline int fr_value_box_cast_to_ipv6addr(TALLOC_CTX *ctx, fr_value_box_t
 						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	if (!fr_cond_assert(dst_type == FR_TYPE_IPV6_ADDR)) return -1;
 
 	static_assert((sizeof(v4_v6_map) + sizeof(src->vb_ip.addr.v4)) <=
@@ -2069,6 +2217,8 @@ static inline int fr_value_box_cast_to_ipv6prefix(TALLOC_CTX *ctx, fr_value_box_
 						  fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						  fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_IPV4_ADDR:
 	{
@@ -2153,6 +2303,8 @@ static inline int fr_value_box_cast_to_ethernet(TALLOC_CTX *ctx, fr_value_box_t
 						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 						fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_STRING:
 		if (fr_value_box_from_str(ctx, dst, &dst_type, dst_enumv,
@@ -2205,6 +2357,8 @@ static inline int fr_value_box_cast_to_bool(TALLOC_CTX *ctx, fr_value_box_t *dst
 					    fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 					    fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_STRING:
 		if (fr_value_box_from_str(ctx, dst, &dst_type, dst_enumv,
@@ -2242,6 +2396,8 @@ static inline int fr_value_box_cast_to_uint8(TALLOC_CTX *ctx, fr_value_box_t *ds
 					     fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 					     fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_BOOL:
 		dst->vb_uint8 = (src->vb_bool == true) ? 1 : 0;
@@ -2287,6 +2443,8 @@ static inline int fr_value_box_cast_to_uint16(TALLOC_CTX *ctx, fr_value_box_t *d
 					      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 					      fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_BOOL:
 		dst->vb_uint16 = (src->vb_bool == true) ? 1 : 0;
@@ -2346,6 +2504,8 @@ static inline int fr_value_box_cast_to_uint32(TALLOC_CTX *ctx, fr_value_box_t *d
 					      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 					      fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_BOOL:
 		dst->vb_uint32 = (src->vb_bool == true) ? 1 : 0;
@@ -2514,6 +2674,8 @@ static inline int fr_value_box_cast_to_uint64(TALLOC_CTX *ctx, fr_value_box_t *d
 					      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 					      fr_value_box_t const *src)
 {
+	memset(dst, 0, sizeof(*dst));
+
 	switch (src->type) {
 	case FR_TYPE_BOOL:
 		dst->vb_uint64 = (src->vb_bool == true) ? 1 : 0;
@@ -2638,43 +2800,28 @@ static inline int fr_value_box_cast_to_uint64(TALLOC_CTX *ctx, fr_value_box_t *d
 	return 0;
 }
 
-/** Convert one type of fr_value_box_t to another
- *
- * This should be the canonical function used to convert between INTERNAL data formats.
+/** Copy a value box, assigning the enumeration values of the destination
  *
- * If you want to convert from PRESENTATION format, use #fr_value_box_from_str.
- *
- * @note src and dst must not be the same box.  We do not support casting in place.
+ * Handles casts where the source and destination types are identical.
  *
  * @param ctx		to allocate buffers in (usually the same as dst)
  * @param dst		Where to write result of casting.
  * @param dst_type	to cast to.
  * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
- *			If #fr_value_box_t is passed to #fr_value_box_asprint
- *			aliases will be printed instead of actual value.
  * @param src		Input data.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
-		      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
-		      fr_value_box_t const *src)
+static int fr_value_box_cast_copy(TALLOC_CTX *ctx, fr_value_box_t *dst,
+				  UNUSED fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+				  fr_value_box_t const *src)
 {
-	if (!fr_cond_assert(dst_type != FR_TYPE_INVALID)) return -1;
-	if (!fr_cond_assert(src->type != FR_TYPE_INVALID)) return -1;
-	if (!fr_cond_assert(src != dst)) return -1;
-
-	if (fr_dict_non_data_types[dst_type]) {
-		fr_strerror_printf("Invalid cast from %s to %s.  Can only cast simple data types.",
-				   fr_table_str_by_value(fr_value_box_type_table, src->type, "<INVALID>"),
-				   fr_table_str_by_value(fr_value_box_type_table, dst_type, "<INVALID>"));
-		return -1;
-	}
+	int ret;
 
 	/*
-	 *	If it's the same type, copy, but set the enumv
-	 *	in the destination box to be the one provided.
+	 *	Copy, but set the enumv in the destination box to be
+	 *	the one provided.
 	 *
 	 *	The theory here is that the attribute value isn't
 	 *	being converted into its presentation format and
@@ -2687,94 +2834,31 @@ int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 	 *	all the casting functions to treat any value
 	 *	with an enumv as a string, which seems weird.
 	 */
-	if (dst_type == src->type) {
-		int ret;
-
-		ret = fr_value_box_copy(ctx, dst, src);
-		if (ret < 0) return ret;
+	ret = fr_value_box_copy(ctx, dst, src);
+	if (ret < 0) return ret;
 
-		dst->enumv = dst_enumv;
+	dst->enumv = dst_enumv;
 
-		return ret;
-	}
+	return ret;
+}
 
-	/*
-	 *	Initialise dst
-	 */
+/** Convert the types for which we don't have a specialised cast function
+ *
+ * @param ctx		to allocate buffers in (usually the same as dst)
+ * @param dst		Where to write result of casting.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
+ * @param src		Input data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_value_box_cast_generic(TALLOC_CTX *ctx, fr_value_box_t *dst,
+				     fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+				     fr_value_box_t const *src)
+{
 	memset(dst, 0, sizeof(*dst));
 
-	/*
-	 *	Dispatch to specialised cast functions
-	 */
-	switch (dst_type) {
-	case FR_TYPE_STRING:
-		return fr_value_box_cast_to_strvalue(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_OCTETS:
-		return fr_value_box_cast_to_octets(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_IPV4_ADDR:
-		return fr_value_box_cast_to_ipv4addr(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_IPV4_PREFIX:
-		return fr_value_box_cast_to_ipv4prefix(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_IPV6_ADDR:
-		return fr_value_box_cast_to_ipv6addr(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_IPV6_PREFIX:
-		return fr_value_box_cast_to_ipv6prefix(ctx, dst, dst_type, dst_enumv, src);
-
-	/*
-	 *	Need func
-	 */
-	case FR_TYPE_IFID:
-	case FR_TYPE_COMBO_IP_ADDR:
-	case FR_TYPE_COMBO_IP_PREFIX:
-		break;
-
-	case FR_TYPE_ETHERNET:
-		return fr_value_box_cast_to_ethernet(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_BOOL:
-		return fr_value_box_cast_to_bool(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_UINT8:
-		return fr_value_box_cast_to_uint8(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_UINT16:
-		return fr_value_box_cast_to_uint16(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_UINT32:
-		return fr_value_box_cast_to_uint32(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_UINT64:
-		return fr_value_box_cast_to_uint64(ctx, dst, dst_type, dst_enumv, src);
-
-	case FR_TYPE_INT8:
-	case FR_TYPE_INT16:
-	case FR_TYPE_INT32:
-	case FR_TYPE_INT64:
-	case FR_TYPE_FLOAT32:
-	case FR_TYPE_FLOAT64:
-	case FR_TYPE_DATE:
-	case FR_TYPE_SIZE:
-	case FR_TYPE_TIME_DELTA:
-	case FR_TYPE_ABINARY:
-		break;
-
-	/*
-	 *	Invalid types for casting (should have been caught earlier)
-	 */
-	case FR_TYPE_VALUE_BOX:
-	case FR_TYPE_STRUCTURAL:
-	case FR_TYPE_GROUP:
-	case FR_TYPE_INVALID:
-	case FR_TYPE_MAX:
-		fr_assert_fail(NULL);
-		return -1;
-	}
-
 	/*
 	 *	Deserialise a fr_value_box_t
 	 */
@@ -2936,6 +3020,107 @@ int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 	return 0;
 }
 
+/** Specialised cast functions, indexed by destination type
+ *
+ */
+static fr_value_box_cast_fn_t const fr_value_box_cast_table[FR_TYPE_MAX] = {
+	[FR_TYPE_STRING]	= fr_value_box_cast_to_strvalue,
+	[FR_TYPE_OCTETS]	= fr_value_box_cast_to_octets,
+	[FR_TYPE_IPV4_ADDR]	= fr_value_box_cast_to_ipv4addr,
+	[FR_TYPE_IPV4_PREFIX]	= fr_value_box_cast_to_ipv4prefix,
+	[FR_TYPE_IPV6_ADDR]	= fr_value_box_cast_to_ipv6addr,
+	[FR_TYPE_IPV6_PREFIX]	= fr_value_box_cast_to_ipv6prefix,
+	[FR_TYPE_ETHERNET]	= fr_value_box_cast_to_ethernet,
+	[FR_TYPE_BOOL]		= fr_value_box_cast_to_bool,
+	[FR_TYPE_UINT8]		= fr_value_box_cast_to_uint8,
+	[FR_TYPE_UINT16]	= fr_value_box_cast_to_uint16,
+	[FR_TYPE_UINT32]	= fr_value_box_cast_to_uint32,
+	[FR_TYPE_UINT64]	= fr_value_box_cast_to_uint64
+};
+
+/** Resolve a (src, dst) type pair to a cast function
+ *
+ * Looking the function up once, when the types are known ahead of time,
+ * allows a cast to be applied repeatedly with a single indirect call,
+ * and no per-cast dispatch.
+ *
+ * The returned function has the same calling convention and behaviour
+ * as #fr_value_box_cast, for the (src, dst) type pair it was resolved
+ * for.
+ *
+ * @param[in] src_type	to cast from.
+ * @param[in] dst_type	to cast to.
+ * @return
+ *	- NULL if dst_type cannot be cast to.
+ *	- the cast function on success.
+ */
+fr_value_box_cast_fn_t fr_value_box_cast_fn(fr_type_t src_type, fr_type_t dst_type)
+{
+	if (fr_dict_non_data_types[dst_type]) {
+		fr_strerror_printf("Invalid cast from %s to %s.  Can only cast simple data types.",
+				   fr_table_str_by_value(fr_value_box_type_table, src_type, "<INVALID>"),
+				   fr_table_str_by_value(fr_value_box_type_table, dst_type, "<INVALID>"));
+		return NULL;
+	}
+
+	switch (dst_type) {
+	/*
+	 *	Invalid types for casting (should have been caught earlier)
+	 */
+	case FR_TYPE_VALUE_BOX:
+	case FR_TYPE_STRUCTURAL:
+	case FR_TYPE_GROUP:
+	case FR_TYPE_INVALID:
+	case FR_TYPE_MAX:
+		fr_assert_fail(NULL);
+		return NULL;
+
+	default:
+		break;
+	}
+
+	if (dst_type == src_type) return fr_value_box_cast_copy;
+
+	if (fr_value_box_cast_table[dst_type]) return fr_value_box_cast_table[dst_type];
+
+	return fr_value_box_cast_generic;
+}
+
+/** Convert one type of fr_value_box_t to another
+ *
+ * This should be the canonical function used to convert between INTERNAL data formats.
+ *
+ * If you want to convert from PRESENTATION format, use #fr_value_box_from_str.
+ *
+ * @note src and dst must not be the same box.  We do not support casting in place.
+ *
+ * @param ctx		to allocate buffers in (usually the same as dst)
+ * @param dst		Where to write result of casting.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
+ *			If #fr_value_box_t is passed to #fr_value_box_asprint
+ *			aliases will be printed instead of actual value.
+ * @param src		Input data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
+		      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+		      fr_value_box_t const *src)
+{
+	fr_value_box_cast_fn_t func;
+
+	if (!fr_cond_assert(dst_type != FR_TYPE_INVALID)) return -1;
+	if (!fr_cond_assert(src->type != FR_TYPE_INVALID)) return -1;
+	if (!fr_cond_assert(src != dst)) return -1;
+
+	func = fr_value_box_cast_fn(src->type, dst_type);
+	if (!func) return -1;
+
+	return func(ctx, dst, dst_type, dst_enumv, src);
+}
+
 /** Convert one type of fr_value_box_t to another in place
  *
  * This should be the canonical function used to convert between INTERNAL data formats.
@@ -3069,6 +3254,15 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
 	{
 		char *str = NULL;
 
+		/*
+		 *	Values short enough to fit are duplicated
+		 *	into the box itself, avoiding the allocator.
+		 */
+		if (src->datum.length < FR_VALUE_BOX_INLINE_LEN) {
+			fr_value_box_inline_copy(dst, src->vb_strvalue, src->datum.length, true);
+			break;
+		}
+
 		/*
 		 *	Zero length strings still have a one uint8 buffer
 		 */
@@ -3086,6 +3280,11 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
 		uint8_t *bin = NULL;
 
 		if (src->datum.length) {
+			if (src->datum.length <= FR_VALUE_BOX_INLINE_LEN) {
+				fr_value_box_inline_copy(dst, src->vb_octets, src->datum.length, false);
+				break;
+			}
+
 			bin = talloc_memdup(ctx, src->vb_octets, src->datum.length);
 			if (!bin) {
 				fr_strerror_printf("Failed allocating octets buffer");
@@ -3126,6 +3325,17 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	In situ values have no buffer to alias or
+		 *	reference, so the bytes are copied instead.
+		 */
+		if (fr_value_box_is_inline(src)) {
+			fr_value_box_inline_copy(dst, src->datum.ptr, src->datum.length,
+						 src->type == FR_TYPE_STRING);
+			fr_value_box_copy_meta(dst, src);
+			break;
+		}
+
 		dst->datum.ptr = ctx && incr_ref ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
 		break;
@@ -3153,6 +3363,16 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t cons
 	{
 		char const *str;
 
+		/*
+		 *	There's no buffer to steal for in situ
+		 *	values, so copy the bytes across.
+		 */
+		if (fr_value_box_is_inline(src)) {
+			fr_value_box_inline_copy(dst, src->vb_strvalue, src->datum.length, true);
+			fr_value_box_copy_meta(dst, src);
+			return 0;
+		}
+
 		str = talloc_steal(ctx, src->vb_strvalue);
 		if (!str) {
 			fr_strerror_printf("Failed stealing string buffer");
@@ -3167,6 +3387,12 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t cons
 	{
 		uint8_t const *bin;
 
+		if (fr_value_box_is_inline(src)) {
+			fr_value_box_inline_copy(dst, src->vb_octets, src->datum.length, false);
+			fr_value_box_copy_meta(dst, src);
+			return 0;
+		}
+
  		bin = talloc_steal(ctx, src->vb_octets);
 		if (!bin) {
 			fr_strerror_printf("Failed stealing octets buffer");
@@ -3249,18 +3475,30 @@ int fr_value_box_asprintf(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t c
 int fr_value_box_strdup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 			char const *src, bool tainted)
 {
-	char const	*str;
+	size_t		len;
 
-	str = talloc_typed_strdup(ctx, src);
-	if (!str) {
-		fr_strerror_printf("Failed allocating string buffer");
-		return -1;
+	len = strlen(src);
+
+	/*
+	 *	Short strings are stored in the box itself
+	 *	to avoid hitting the allocator.
+	 */
+	if (len < FR_VALUE_BOX_INLINE_LEN) {
+		fr_value_box_inline_copy(dst, src, len, true);
+	} else {
+		char const *str;
+
+		str = talloc_typed_strdup(ctx, src);
+		if (!str) {
+			fr_strerror_printf("Failed allocating string buffer");
+			return -1;
+		}
+		dst->vb_strvalue = str;
 	}
 
 	dst->type = FR_TYPE_STRING;
 	dst->tainted = tainted;
-	dst->vb_strvalue = str;
-	dst->datum.length = talloc_array_length(str) - 1;
+	dst->datum.length = len;
 	dst->enumv = enumv;
 	dst->next = NULL;
 
@@ -3279,17 +3517,24 @@ int fr_value_box_strdup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t con
 int fr_value_box_bstrndup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 			  char const *src, size_t len, bool tainted)
 {
-	char const	*str;
+	/*
+	 *	Store short strings in situ.
+	 */
+	if (len < FR_VALUE_BOX_INLINE_LEN) {
+		fr_value_box_inline_copy(dst, src, len, true);
+	} else {
+		char const *str;
 
-	str = talloc_bstrndup(ctx, src, len);
-	if (!str) {
-		fr_strerror_printf("Failed allocating string buffer");
-		return -1;
+		str = talloc_bstrndup(ctx, src, len);
+		if (!str) {
+			fr_strerror_printf("Failed allocating string buffer");
+			return -1;
+		}
+		dst->vb_strvalue = str;
 	}
 
 	dst->type = FR_TYPE_STRING;
 	dst->tainted = tainted;
-	dst->vb_strvalue = str;
 	dst->datum.length = len;
 	dst->enumv = enumv;
 	dst->next = NULL;
@@ -3574,18 +3819,25 @@ int fr_value_box_strdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_
 int fr_value_box_memcpy(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 			uint8_t const *src, size_t len, bool tainted)
 {
-	uint8_t *bin;
+	/*
+	 *	Short octet strings are stored in the box itself.
+	 */
+	if (len <= FR_VALUE_BOX_INLINE_LEN) {
+		fr_value_box_inline_copy(dst, src, len, false);
+	} else {
+		uint8_t *bin;
 
-	bin = talloc_memdup(ctx, src, len);
-	if (!bin) {
-		fr_strerror_printf("Failed allocating octets buffer");
-		return -1;
+		bin = talloc_memdup(ctx, src, len);
+		if (!bin) {
+			fr_strerror_printf("Failed allocating octets buffer");
+			return -1;
+		}
+		talloc_set_type(bin, uint8_t);
+		dst->vb_octets = bin;
 	}
-	talloc_set_type(bin, uint8_t);
 
 	dst->type = FR_TYPE_OCTETS;
 	dst->tainted = tainted;
-	dst->vb_octets = bin;
 	dst->datum.length = len;
 	dst->enumv = enumv;
 	dst->next = NULL;
@@ -4616,6 +4868,55 @@ char *fr_value_box_asprint(TALLOC_CTX *ctx, fr_value_box_t const *data, char quo
 	return p;
 }
 
+/** Move an in situ value out to a talloced buffer
+ *
+ * Used when the value buffer needs to be reallocable, e.g. for appending.
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[in] vb	to move the value out of.
+ * @return
+ *	- 0 on success.
+ *	- -1 on allocation failure.
+ */
+int fr_value_box_inline_spill(TALLOC_CTX *ctx, fr_value_box_t *vb)
+{
+	if (!fr_value_box_is_inline(vb)) return 0;
+
+	switch (vb->type) {
+	case FR_TYPE_STRING:
+	{
+		char *str;
+
+		str = talloc_bstrndup(ctx, vb->vb_strvalue, vb->datum.length);
+		if (!str) {
+			fr_strerror_printf("Failed allocating string buffer");
+			return -1;
+		}
+		vb->vb_strvalue = str;
+	}
+		break;
+
+	case FR_TYPE_OCTETS:
+	{
+		uint8_t *bin;
+
+		bin = talloc_memdup(ctx, vb->vb_octets, vb->datum.length);
+		if (!bin) {
+			fr_strerror_printf("Failed allocating octets buffer");
+			return -1;
+		}
+		talloc_set_type(bin, uint8_t);
+		vb->vb_octets = bin;
+	}
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
 /** Concatenate a list of value boxes
  *
  * @note Will automatically cast all #fr_value_box_t to type specified.
@@ -4687,6 +4988,12 @@ int fr_value_box_list_concat(TALLOC_CTX *ctx,
 	 */
 	if (!fr_cursor_current(&cursor)) return 0;
 
+	/*
+	 *	The append functions realloc out's buffer, which
+	 *	doesn't work for values held in the box itself.
+	 */
+	if (fr_value_box_inline_spill(ctx, out) < 0) return -1;
+
 	pool = talloc_pool(NULL, 255);	/* To absorb the temporary strings */
 
 	/*
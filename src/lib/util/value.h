@@ -58,6 +58,14 @@ extern size_t const fr_value_box_field_sizes[];
 
 extern size_t const fr_value_box_offsets[];
 
+#define FR_VALUE_BOX_INLINE_LEN		32		//!< Variable length values of this size or less
+							//!< (strings need one byte for the trailing '\0')
+							//!< are stored in the box itself, instead of a
+							//!< separate talloced buffer.  This also covers
+							//!< typical User-Name / NAS-Identifier values,
+							//!< without sharing buffers (and so lifetimes)
+							//!< between requests.
+
 /** Union containing all data types supported by the server
  *
  * This union contains all data types that can be represented by VALUE_PAIRs. It may also be used in other parts
@@ -79,6 +87,8 @@ struct value_box {
 
 			};
 			size_t		length;
+			uint8_t		inline_buf[FR_VALUE_BOX_INLINE_LEN];	//!< In situ storage for short
+										//!< strings and octet strings.
 		};
 
 		/*
@@ -123,6 +133,22 @@ struct value_box {
 	fr_value_box_t			*next;			//!< Next in a series of value_box.
 };
 
+/** Check whether a value is stored in the box itself, rather than in a talloced buffer
+ *
+ * In situ values are identified by the data pointer pointing at the box's own
+ * inline buffer.  These values must never be passed to talloc_free, talloc_steal,
+ * talloc_array_length etc.
+ *
+ * @param[in] vb	to check.
+ * @return
+ *	- true if the value is held in the box itself.
+ *	- false if the value is in a separate buffer.
+ */
+static inline bool fr_value_box_is_inline(fr_value_box_t const *vb)
+{
+	return vb->datum.ptr == (void const *)vb->datum.inline_buf;
+}
+
 /*
  *	Versions of ntho* which expect a binary buffer
  */
@@ -506,10 +532,31 @@ size_t		fr_value_box_network_length(fr_value_box_t *value);
 
 ssize_t		fr_value_box_to_network(size_t *need, uint8_t *out, size_t outlen, fr_value_box_t const *value);
 
+/** A direct network encoder for a fixed-width type, resolved ahead of time with #fr_value_box_to_network_func
+ *
+ * Writes the value in network format with a single byte-swapping store,
+ * and returns the number of bytes written.  The caller MUST provide a
+ * buffer at least as large as the network width of the type.
+ */
+typedef size_t (*fr_value_box_to_network_t)(uint8_t *dst, fr_value_box_t const *value);
+
+fr_value_box_to_network_t fr_value_box_to_network_func(fr_type_t type);
+
 ssize_t		fr_value_box_from_network(TALLOC_CTX *ctx,
 					  fr_value_box_t *dst, fr_type_t type, fr_dict_attr_t const *enumv,
 				  	  uint8_t const *src, size_t len, bool tainted);
 
+/** A cast function resolved ahead of time with #fr_value_box_cast_fn
+ *
+ * Has the same calling convention and behaviour as #fr_value_box_cast,
+ * for the (src, dst) type pair it was resolved for.
+ */
+typedef int (*fr_value_box_cast_fn_t)(TALLOC_CTX *ctx, fr_value_box_t *dst,
+				      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+				      fr_value_box_t const *src);
+
+fr_value_box_cast_fn_t fr_value_box_cast_fn(fr_type_t src_type, fr_type_t dst_type);
+
 int		fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 				  fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 				  fr_value_box_t const *src);
@@ -532,6 +579,8 @@ void		fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst,
 
 int		fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t const *src);
 
+int		fr_value_box_inline_spill(TALLOC_CTX *ctx, fr_value_box_t *vb);
+
 int		fr_value_box_vasprintf(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv, bool tainted,
 				       char const *fmt, va_list ap)
 		CC_HINT(format (printf, 5, 0));
@@ -119,6 +119,7 @@ struct proto_detail_work_thread_s {
 
 	char const			*filename_work;		//!< work file name
 	fr_dlist_head_t			list;			//!< for retransmissions
+	fr_dlist_head_t			free_entries;		//!< tracking entries, recycled between records
 
 	uint32_t       			outstanding;		//!< number of currently outstanding records;
 	fr_time_delta_t			lock_interval;		//!< interval between trying the locks.
@@ -488,9 +488,17 @@ redo:
 	}
 
 	/*
-	 *	Allocate the tracking entry.
+	 *	Allocate the tracking entry, reusing one from a
+	 *	previous record where possible.  With a large
+	 *	outstanding window, one entry is churned per record.
 	 */
-	track = talloc_zero(thread, fr_detail_entry_t);
+	track = fr_dlist_head(&thread->free_entries);
+	if (track) {
+		fr_dlist_remove(&thread->free_entries, track);
+		memset(track, 0, sizeof(*track));
+	} else {
+		track = talloc_zero(thread, fr_detail_entry_t);
+	}
 	track->parent = thread;
 	track->timestamp = fr_time();
 	track->id = thread->count++;
@@ -651,14 +659,14 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
 		/*
-		 *	Seek to the entry, mark it as done, and then seek to
-		 *	the point in the file where we were reading from.
+		 *	Mark the entry as done.  pwrite() doesn't move
+		 *	the file offset, so the reader's position is
+		 *	undisturbed, and it's one syscall instead of a
+		 *	seek / write / seek-back for every record.
 		 */
-		(void) lseek(thread->fd, track->done_offset, SEEK_SET);
-		if (write(thread->fd, "Done", 4) < 0) {
+		if (pwrite(thread->fd, "Done", 4, track->done_offset) < 0) {
 			ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
 		}
-		(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
 	}
 
 free_track:
@@ -680,9 +688,13 @@ free_track:
 	}
 
 	/*
-	 *	@todo - add a used / free pool for these
+	 *	Recycle the tracking entry.  The window caps how many
+	 *	can be outstanding, so the free list is bounded by
+	 *	max_outstanding.
 	 */
-	talloc_free(track);
+	if (track->ev) (void) fr_event_timer_delete(thread->el, &track->ev);
+	talloc_free_children(track);	/* frees the retransmission copy */
+	fr_dlist_insert_head(&thread->free_entries, track);
 
 	/*
 	 *	Close the socket if we're at EOF, and there are no
@@ -706,6 +718,7 @@ static int mod_open(fr_listen_t *li)
 	proto_detail_work_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_detail_work_thread_t);
 
 	fr_dlist_init(&thread->list, fr_detail_entry_t, entry);
+	fr_dlist_init(&thread->free_entries, fr_detail_entry_t, entry);
 
 	/*
 	 *	Open the file if we haven't already been given one.
@@ -58,6 +58,7 @@ static CONF_PARSER const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, proto_dhcpv4_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", FR_TYPE_UINT32, proto_dhcpv4_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", FR_TYPE_UINT32, proto_dhcpv4_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_pending_packets_per_client", FR_TYPE_UINT32, proto_dhcpv4_t, io.max_pending_packets_per_client), .dflt = "16" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -76,6 +76,11 @@ typedef struct {
 	fr_trie_t			*trie;			//!< for parsed networks
 	fr_ipaddr_t			*allow;			//!< allowed networks for dynamic clients
 	fr_ipaddr_t			*deny;			//!< denied networks for dynamic clients
+
+	char const			*lease_table_file;	//!< File backing the lease table.
+	uint32_t			lease_table_size;	//!< Maximum number of leases in the table.
+	fr_dhcpv4_lease_table_t		*lease_table;		//!< mmap'd lease table, which answers lease
+								///< queries without running the policies.
 } proto_dhcpv4_udp_t;
 
 
@@ -108,6 +113,9 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("lease_table_file", FR_TYPE_FILE_OUTPUT, proto_dhcpv4_udp_t, lease_table_file) },
+	{ FR_CONF_OFFSET("lease_table_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, lease_table_size), .dflt = "65536" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -121,16 +129,97 @@ fr_dict_autoload_t proto_dhcpv4_udp_dict[] = {
 
 static fr_dict_attr_t const *attr_message_type;
 static fr_dict_attr_t const *attr_dhcp_server_identifier;
+static fr_dict_attr_t const *attr_ip_address_lease_time;
 
 extern fr_dict_attr_autoload_t proto_dhcpv4_udp_dict_attr[];
 fr_dict_attr_autoload_t proto_dhcpv4_udp_dict_attr[] = {
 	{ .out = &attr_message_type, .name = "DHCP-Message-Type", .type = FR_TYPE_UINT8, .dict = &dict_dhcpv4},
 	{ .out = &attr_dhcp_server_identifier, .name = "DHCP-DHCP-Server-Identifier", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
+	{ .out = &attr_ip_address_lease_time, .name = "DHCP-IP-Address-Lease-Time", .type = FR_TYPE_UINT32, .dict = &dict_dhcpv4},
 	{ NULL }
 };
 
+/** Answer a lease query from the lease table, without running the policies
+ *
+ * RFC 4388 allows queries by IP address (ciaddr), by hardware address
+ * (chaddr), or by client identifier.  The first two are answered
+ * directly from the lease table.  Client identifier queries, and
+ * queries for addresses the table has never seen, go through the
+ * normal policy path.
+ *
+ * @param[in] inst	of the listener, holding the lease table.
+ * @param[in] thread	of the listener, holding the socket.
+ * @param[in] address	the query was received from.
+ * @param[in] packet	the lease query.
+ * @return
+ *	- 1 if a reply was sent, and the packet is consumed.
+ *	- 0 if the query must go through the normal policy path.
+ */
+static int lease_query_answer(proto_dhcpv4_udp_t const *inst, proto_dhcpv4_udp_thread_t *thread,
+			      fr_io_address_t const *address, dhcp_packet_t const *packet)
+{
+	fr_dhcpv4_lease_t	lease;
+	uint8_t			reply[DEFAULT_PACKET_SIZE] = { 0 };
+	dhcp_packet_t		*rp = (dhcp_packet_t *) reply;
+	uint8_t			*p;
+	int			found;
+	uint64_t		now = (uint64_t) time(NULL);
+
+	if (packet->ciaddr != INADDR_ANY) {
+		found = fr_dhcpv4_lease_find_by_ip(inst->lease_table, &lease, packet->ciaddr);
+
+	} else if (packet->hlen > 0) {
+		found = fr_dhcpv4_lease_find_by_chaddr(inst->lease_table, &lease,
+						       packet->chaddr, packet->hlen);
+
+	} else {
+		return 0;	/* Query by client identifier */
+	}
+
+	/*
+	 *	Unknown client or address, let the policies decide.
+	 */
+	if (found < 0) return 0;
+
+	rp->opcode = 2;		/* server message */
+	rp->htype = packet->htype;
+	rp->hlen = lease.hlen;
+	rp->xid = packet->xid;
+	rp->ciaddr = lease.ipaddr;
+	rp->giaddr = packet->giaddr;
+	memcpy(rp->chaddr, lease.chaddr, lease.hlen);
+	rp->option_format = htonl(DHCP_OPTION_MAGIC_NUMBER);
+
+	p = rp->options;
+	*p++ = 53;		/* DHCP-Message-Type */
+	*p++ = 1;
+	*p++ = (found == 1) ? FR_DHCP_LEASE_ACTIVE : FR_DHCP_LEASE_UNASSIGNED;
+
+	if (found == 1) {
+		uint32_t remaining = htonl((uint32_t) (lease.expires - now));
+
+		*p++ = 51;	/* DHCP-IP-Address-Lease-Time */
+		*p++ = 4;
+		memcpy(p, &remaining, 4);
+		p += 4;
+	}
+
+	*p = 255;		/* End-of-Options */
+
+	if (udp_send(thread->sockfd, reply, sizeof(reply), 0,
+		     &address->dst_ipaddr, address->dst_port, address->if_index,
+		     &address->src_ipaddr, address->src_port) < 0) {
+		DEBUG2("proto_dhcpv4_udp failed sending lease query reply: %s", fr_strerror());
+	}
+
+	thread->stats.total_responses++;
+
+	return 1;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
+	proto_dhcpv4_udp_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dhcpv4_udp_t);
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
 	fr_io_address_t			*address, **address_p;
 
@@ -197,6 +286,24 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 		return 0;
 	}
 
+	/*
+	 *	Lease queries are answered from the lease table when
+	 *	one is configured, without waking the worker threads.
+	 *	RELEASEs passing through keep the table current.
+	 */
+	if (inst->lease_table) {
+		if (message_type == FR_DHCP_LEASE_QUERY) {
+			if (lease_query_answer(inst, thread, address, packet)) {
+				DEBUG2("proto_dhcpv4_udp - Received %s XID %08x - answered from the lease table %s",
+				       dhcp_message_types[message_type], xid, thread->name);
+				return 0;
+			}
+
+		} else if ((message_type == FR_DHCP_RELEASE) && (packet->ciaddr != INADDR_ANY)) {
+			(void) fr_dhcpv4_lease_release(inst->lease_table, packet->ciaddr);
+		}
+	}
+
 	*recv_time_p = fr_time();
 
 	/*
@@ -267,6 +374,28 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			return 0;
 		}
 
+		/*
+		 *	Record ACK'd leases, so that lease queries can
+		 *	be answered from the lease table.
+		 */
+		if (inst->lease_table && (code[2] == FR_DHCP_ACK) &&
+		    (packet->yiaddr != INADDR_ANY) && (packet->hlen > 0)) {
+			uint8_t const	*lease_time;
+			uint32_t	seconds = 0;
+
+			lease_time = fr_dhcpv4_packet_get_option(packet, buffer_len, attr_ip_address_lease_time);
+			if (lease_time && (lease_time[1] == 4)) {
+				memcpy(&seconds, lease_time + 2, 4);
+				seconds = ntohl(seconds);
+			}
+
+			/*
+			 *	ACKs to INFORM have no lease time.
+			 */
+			if (seconds > 0) (void) fr_dhcpv4_lease_update(inst->lease_table, packet->yiaddr,
+								       packet->chaddr, packet->hlen, seconds);
+		}
+
 		/*
 		 *	Set the source IP of the packet.
 		 *
@@ -678,6 +807,21 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 		}
 	}
 
+	/*
+	 *	Open the lease table, if one was configured.
+	 */
+	if (inst->lease_table_file) {
+		FR_INTEGER_BOUND_CHECK("lease_table_size", inst->lease_table_size, >=, 256);
+		FR_INTEGER_BOUND_CHECK("lease_table_size", inst->lease_table_size, <=, ((uint32_t) 1 << 24));
+
+		inst->lease_table = fr_dhcpv4_lease_table_open(inst, inst->lease_table_file,
+							       inst->lease_table_size);
+		if (!inst->lease_table) {
+			cf_log_perr(cs, "Failed opening lease table");
+			return -1;
+		}
+	}
+
 	/*
 	 *	Create a fake client.
 	 */
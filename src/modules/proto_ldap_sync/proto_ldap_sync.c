@@ -469,7 +469,7 @@ static void request_queued(REQUEST *request, fr_state_signal_t action)
 		break;
 
 	case FR_SIGNAL_CANCEL:
-		(void) fr_heap_extract(request->backlog, request);
+		(void) fr_heap4_extract(request->backlog, request);
 		//request_delete(request);
 		break;
 
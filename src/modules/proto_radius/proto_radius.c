@@ -41,8 +41,28 @@ static CONF_PARSER const limit_config[] = {
 	{ FR_CONF_OFFSET("nak_lifetime", FR_TYPE_TIME_DELTA, proto_radius_t, io.nak_lifetime), .dflt = "30.0" } ,
 
 	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, proto_radius_t, io.max_connections), .dflt = "1024" } ,
+
+	/*
+	 *	How many new connections we will accept() per second,
+	 *	in total, and per source network.  Connections past the
+	 *	limit are reset before any TLS handshake, or any
+	 *	connection state, gets a chance to eat CPU.  0 means no
+	 *	limit.
+	 */
+	{ FR_CONF_OFFSET("accept_rate", FR_TYPE_UINT32, proto_radius_t, io.accept_rate) } ,
+	{ FR_CONF_OFFSET("accept_rate_per_source", FR_TYPE_UINT32, proto_radius_t, io.accept_rate_per_source) } ,
+
 	{ FR_CONF_OFFSET("max_clients", FR_TYPE_UINT32, proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", FR_TYPE_UINT32, proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_pending_packets_per_client", FR_TYPE_UINT32, proto_radius_t, io.max_pending_packets_per_client), .dflt = "16" } ,
+
+	/*
+	 *	Low-rate listeners (e.g. ones which see only CoA or
+	 *	Disconnect packets) can turn this off, so that they
+	 *	don't allocate an auth-scale tracking table for every
+	 *	client.
+	 */
+	{ FR_CONF_OFFSET("track_duplicates", FR_TYPE_BOOL, proto_radius_t, track_duplicates), .dflt = "yes" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -83,6 +103,21 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("tunnel_password_zeros", FR_TYPE_BOOL, proto_radius_t, tunnel_password_zeros) } ,
 
+	/*
+	 *	Sort decoded attributes into canonical order, and strip
+	 *	exact duplicates sent by broken NASes.
+	 */
+	{ FR_CONF_OFFSET("normalize", FR_TYPE_BOOL, proto_radius_t, normalize) } ,
+
+	/*
+	 *	Verify Message-Authenticator (and for non-Access
+	 *	packets, the Request Authenticator) before decoding.
+	 *	The HMAC runs in the worker threads, so verification
+	 *	scales across cores instead of capping the network
+	 *	thread.
+	 */
+	{ FR_CONF_OFFSET("verify_message_authenticator", FR_TYPE_BOOL, proto_radius_t, verify_message_authenticator) } ,
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) priority_config },
 
@@ -302,17 +337,61 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 	request->packet->data = talloc_memdup(request->packet, data, data_len);
 	request->packet->data_len = data_len;
 
+	/*
+	 *	Check the packet signature.  mod_decode runs in a
+	 *	worker thread, so the HMAC-MD5 work is spread across
+	 *	all of the workers, instead of being done inline in the
+	 *	network thread's receive path.
+	 *
+	 *	Skip fake packets used to define dynamic clients, as
+	 *	there's no secret to check against.
+	 */
+	if (inst->verify_message_authenticator && client->active &&
+	    (fr_radius_verify(request->packet->data, NULL,
+			      (uint8_t const *) client->secret,
+			      talloc_array_length(client->secret) - 1) < 0)) {
+		RPEDEBUG("Failed verifying packet signature");
+		return -1;
+	}
+
 	/*
 	 *	Note that we don't set a limit on max_attributes here.
 	 *	That MUST be set and checked in the underlying
 	 *	transport, via a call to fr_radius_ok().
-	 */
-	if (fr_radius_packet_decode(request->packet, NULL, 0,
-				    inst->tunnel_password_zeros, client->secret) < 0) {
+	 *
+	 *	If the process module for this packet code has declared
+	 *	an attribute interest set, only those attributes are
+	 *	materialised as pairs.  The raw bytes stay in
+	 *	packet->data, so nothing is lost.
+	 */
+	if (inst->dispatch[request->packet->code].interest) {
+		if (fr_radius_decode_filtered(request->packet, request->packet->data, data_len,
+					      request->packet->data, client->secret,
+					      talloc_array_length(client->secret) - 1,
+					      inst->dispatch[request->packet->code].interest, NULL,
+					      &request->packet->vps) < 0) {
+			RPEDEBUG("Failed decoding packet");
+			return -1;
+		}
+
+	} else if (fr_radius_packet_decode(request->packet, NULL, 0,
+					   inst->tunnel_password_zeros, client->secret) < 0) {
 		RPEDEBUG("Failed decoding packet");
 		return -1;
 	}
 
+	/*
+	 *	Put the attributes into canonical order, and strip
+	 *	exact duplicates sent by broken NASes, so that every
+	 *	later scan of the list is shorter.
+	 */
+	if (inst->normalize) {
+		int removed;
+
+		removed = fr_pair_list_normalize(&request->packet->vps);
+		if (removed > 0) RDEBUG2("Removed %d duplicate attributes", removed);
+	}
+
 	/*
 	 *	Set the rest of the fields.
 	 */
@@ -515,9 +594,9 @@ static ssize_t mod_encode(void const *instance, REQUEST *request, uint8_t *buffe
 
 static void mod_entry_point_set(void const *instance, REQUEST *request)
 {
-	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
-	dl_module_inst_t	*type_submodule;
-	fr_io_track_t		*track = request->async->packet_ctx;
+	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	proto_radius_dispatch_t const	*dispatch;
+	fr_io_track_t			*track = request->async->packet_ctx;
 
 	rad_assert(request->packet->code != 0);
 	rad_assert(request->packet->code <= FR_RADIUS_MAX_PACKET_CODE);
@@ -538,14 +617,18 @@ static void mod_entry_point_set(void const *instance, REQUEST *request)
 		return;
 	}
 
-	type_submodule = inst->type_submodule_by_code[request->packet->code];
-	if (!type_submodule) {
+	/*
+	 *	One indexed load from the dispatch table, instead of
+	 *	chasing submodule pointers for every packet.
+	 */
+	dispatch = &inst->dispatch[request->packet->code];
+	if (!dispatch->process) {
 		REDEBUG("The server is not configured to accept 'type = %s'", fr_packet_codes[request->packet->code]);
 		return;
 	}
 
-	request->async->process = ((fr_app_worker_t const *)type_submodule->module->common)->entry_point;
-	request->async->process_inst = type_submodule->data;
+	request->async->process = dispatch->process;
+	request->async->process_inst = dispatch->process_inst;
 }
 
 
@@ -622,6 +705,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	Flatten the process modules into the per-code dispatch
+	 *	table, which is read for every packet.  The interest
+	 *	set stays NULL (decode everything) until a process
+	 *	module declares which attributes its sections read.
+	 */
+	{
+		size_t i;
+
+		for (i = 0; i < NUM_ELEMENTS(inst->type_submodule_by_code); i++) {
+			dl_module_inst_t *type_submodule = inst->type_submodule_by_code[i];
+
+			if (!type_submodule) continue;
+
+			inst->dispatch[i].process = ((fr_app_worker_t const *) type_submodule->module->common)->entry_point;
+			inst->dispatch[i].process_inst = type_submodule->data;
+		}
+	}
+
 	/*
 	 *	No IO module, it's an empty listener.
 	 */
@@ -710,7 +812,17 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	/*
 	 *	Bootstrap the master IO handler.
 	 */
-	return fr_master_app_io.bootstrap(&inst->io, conf);
+	if (fr_master_app_io.bootstrap(&inst->io, conf) < 0) return -1;
+
+	/*
+	 *	The master IO handler inherits duplicate tracking from
+	 *	the transport.  Apply our override, which can only turn
+	 *	tracking off, as the tri-state is "transport can't
+	 *	track", "we don't want to", and "track".
+	 */
+	if (!inst->track_duplicates) inst->io.track_duplicates = false;
+
+	return 0;
 }
 
 static int mod_load(void)
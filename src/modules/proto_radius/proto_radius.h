@@ -24,7 +24,21 @@
  * @copyright 2018 Alan DeKok (aland@freeradius.org)
  */
 #include <freeradius-devel/io/master.h>
+#include <freeradius-devel/radius/radius.h>
 
+/** Per-packet-code dispatch table entry
+ *
+ *  Filled in once at instantiation time, so that finding the entry
+ *  point for a packet is a single indexed load, instead of chasing
+ *  submodule pointers for every packet.
+ */
+typedef struct {
+	fr_io_process_t			process;	//!< entry point into the state machine, or NULL
+							//!< if this packet code isn't accepted.
+	void				*process_inst;	//!< instance data for the process module.
+	fr_radius_interest_t const	*interest;	//!< attributes to decode for this packet code.
+							//!< NULL means decode everything.
+} proto_radius_dispatch_t;
 
 /** An instance of a proto_radius listen section
  *
@@ -40,8 +54,19 @@ typedef struct {
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
 
+	bool				track_duplicates;		//!< track duplicate packets.  Can be
+									//!< turned off for low-rate listeners.
+
+	bool				normalize;			//!< sort decoded attributes and strip
+									//!< exact duplicates.
+
+	bool				verify_message_authenticator;	//!< check packet signatures before
+									//!< decoding.
+
 	bool				code_allowed[FR_CODE_RADIUS_MAX + 1];	//!< Allowed packet codes.
 
+	proto_radius_dispatch_t		dispatch[FR_RADIUS_MAX_PACKET_CODE];	//!< per-code dispatch table.
+
 	uint32_t			priorities[FR_RADIUS_MAX_PACKET_CODE];	//!< priorities for individual packets
 } proto_radius_t;
 
@@ -55,6 +55,10 @@ typedef struct {
 	uint32_t	session_timeout;		//!< Maximum time between the last response and next request.
 	uint32_t	max_session;			//!< Maximum ongoing session allowed.
 
+	bool		stateless;			//!< Whether sessions without opaque module data should be
+							//!< stored in a self-authenticating State value, instead
+							//!< of the state tree.
+
 	uint8_t       	state_server_id;		//!< Sets a specific byte in the state to allow the
 							//!< authenticating server to be identified in packet
 							//!< captures.
@@ -72,6 +76,7 @@ typedef struct {
 static const CONF_PARSER session_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, proto_radius_auth_t, session_timeout), .dflt = "15" },
 	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, proto_radius_auth_t, max_session), .dflt = "4096" },
+	{ FR_CONF_OFFSET("stateless", FR_TYPE_BOOL, proto_radius_auth_t, stateless), .dflt = "no" },
 	{ FR_CONF_OFFSET("state_server_id", FR_TYPE_UINT8, proto_radius_auth_t, state_server_id) },
 
 	CONF_PARSER_TERMINATOR
@@ -684,8 +689,8 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 {
 	proto_radius_auth_t	*inst = instance;
 
-	inst->state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->max_session,
-					      inst->session_timeout, inst->state_server_id);
+	inst->state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->stateless,
+					      inst->max_session, inst->session_timeout, inst->state_server_id);
 
 	return 0;
 }
@@ -23,6 +23,7 @@
  * @copyright 2016 Alan DeKok (aland@deployingradius.com)
  */
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/protocol.h>
@@ -39,10 +40,14 @@ fr_dict_autoload_t proto_radius_status_dict[] = {
 };
 
 static fr_dict_attr_t const *attr_packet_type;
+static fr_dict_attr_t const *attr_queue_length;
+static fr_dict_attr_t const *attr_predicted_process_time;
 
 extern fr_dict_attr_autoload_t proto_radius_status_dict_attr[];
 fr_dict_attr_autoload_t proto_radius_status_dict_attr[] = {
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_queue_length, .name = "FreeRADIUS-Stats4-Queue-Length", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_predicted_process_time, .name = "FreeRADIUS-Stats4-Predicted-Process-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
 };
 
@@ -173,6 +178,27 @@ static rlm_rcode_t mod_process(UNUSED void const *instance, REQUEST *request)
 			break;
 		}
 
+		/*
+		 *	Advertise our current load, so that smart
+		 *	clients can pre-shed traffic before we're
+		 *	saturated, instead of waiting for us to start
+		 *	dropping their packets.
+		 */
+		if (request->reply->code == FR_CODE_ACCESS_ACCEPT) {
+			uint64_t	num_active;
+			fr_time_delta_t	predicted;
+
+			if (fr_worker_self_load(&num_active, &predicted) == 0) {
+				MEM(vp = fr_pair_afrom_da(request->reply, attr_queue_length));
+				vp->vp_uint32 = (uint32_t) num_active;
+				fr_pair_add(&request->reply->vps, vp);
+
+				MEM(vp = fr_pair_afrom_da(request->reply, attr_predicted_process_time));
+				vp->vp_uint32 = (uint32_t) (predicted / 1000);	/* nanoseconds to microseconds */
+				fr_pair_add(&request->reply->vps, vp);
+			}
+		}
+
 		if (request->parent && RDEBUG_ENABLED) {
 			RDEBUG("Sending %s ID %i", fr_packet_codes[request->reply->code], request->reply->id);
 			log_request_pair_list(L_DBG_LVL_1, request, request->reply->vps, "");
@@ -110,30 +110,57 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	decode_fail_t			reason;
 
 	fr_time_t			*recv_time_p;
+	size_t				in_buffer = *leftover;
+	bool				have_packet = false;
 
 	recv_time_p = *recv_time;
 
 	/*
-	 *      Read data into the buffer.
+	 *	If the previous read left a complete packet in the
+	 *	buffer, return it without touching the socket.  One
+	 *	wakeup then drains a burst of pipelined packets with
+	 *	one large read, instead of one read per packet.
 	 */
-	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
-	if (data_size < 0) {
-		DEBUG2("proto_radius_tcp got read error %zd: %s", data_size, fr_strerror());
-		return data_size;
+	if (in_buffer >= 20) {
+		packet_len = (buffer[2] << 8) | buffer[3];
+		have_packet = (in_buffer >= packet_len);
 	}
 
 	/*
-	 *	Note that we return ERROR for all bad packets, as
-	 *	there's no point in reading RADIUS packets from a TCP
-	 *	connection which isn't sending us RADIUS packets.
+	 *      Read data into the buffer, after any pending bytes.
 	 */
+	if (!have_packet) {
+		data_size = read(thread->sockfd, buffer + in_buffer, buffer_len - in_buffer);
+		if (data_size < 0) {
+			/*
+			 *	We may be called speculatively when
+			 *	there's leftover data, so no data isn't
+			 *	an error.
+			 */
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+				*leftover = in_buffer;
+				return 0;
+			}
 
-	/*
-	 *	TCP read of zero means the socket is dead.
-	 */
-	if (!data_size) {
-		DEBUG2("proto_radius_tcp - other side closed the socket.");
-		return -1;
+			DEBUG2("proto_radius_tcp got read error %zd: %s", data_size, fr_strerror());
+			return data_size;
+		}
+
+		/*
+		 *	Note that we return ERROR for all bad packets, as
+		 *	there's no point in reading RADIUS packets from a TCP
+		 *	connection which isn't sending us RADIUS packets.
+		 */
+
+		/*
+		 *	TCP read of zero means the socket is dead.
+		 */
+		if (!data_size) {
+			DEBUG2("proto_radius_tcp - other side closed the socket.");
+			return -1;
+		}
+
+		in_buffer += data_size;
 	}
 
 	/*
@@ -148,8 +175,8 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	/*
 	 *	Not enough for one packet.  Tell the caller that we need to read more.
 	 */
-	if (data_size < 20) {
-		*leftover = data_size;
+	if (in_buffer < 20) {
+		*leftover = in_buffer;
 		return 0;
 	}
 
@@ -162,8 +189,8 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	 *	We don't have a complete RADIUS packet.  Tell the
 	 *	caller that we need to read more.
 	 */
-	if ((size_t) data_size < packet_len) {
-		*leftover = data_size;
+	if (in_buffer < packet_len) {
+		*leftover = in_buffer;
 		return 0;
 	}
 
@@ -171,9 +198,7 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t **r
 	 *	We've read more than one packet.  Tell the caller that
 	 *	there's more data available, and return only one packet.
 	 */
-	if ((size_t) data_size > packet_len) {
-		*leftover = data_size - packet_len;
-	}
+	*leftover = in_buffer - packet_len;
 
 	/*
 	 *      If it's not a RADIUS packet, ignore it.
@@ -295,28 +320,40 @@ static int mod_open(fr_listen_t *li)
 
 	int				sockfd;
 	uint16_t			port = inst->port;
+	bool				inherited = false;
 	CONF_SECTION			*server_cs;
 	CONF_ITEM			*ci;
 
 	rad_assert(!thread->connection);
 
-	li->fd = sockfd = fr_socket_server_tcp(&inst->ipaddr, &port, inst->port_name, true);
-	if (sockfd < 0) {
-		PERROR("Failed opening TCP socket");
-	error:
-		return -1;
-	}
+	/*
+	 *	Prefer a socket passed to us by a supervisor (e.g.
+	 *	systemd socket activation).  The supervisor has already
+	 *	bound it, and called listen().
+	 */
+	li->fd = sockfd = fr_socket_inherit(SOCK_STREAM, &inst->ipaddr, port, true);
+	if (sockfd >= 0) {
+		inherited = true;
 
-	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
-		close(sockfd);
-		PERROR("Failed binding socket");
-		goto error;
-	}
+	} else {
+		li->fd = sockfd = fr_socket_server_tcp(&inst->ipaddr, &port, inst->port_name, true);
+		if (sockfd < 0) {
+			PERROR("Failed opening TCP socket");
+		error:
+			return -1;
+		}
+
+		if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
+			close(sockfd);
+			PERROR("Failed binding socket");
+			goto error;
+		}
 
-	if (listen(sockfd, 8) < 0) {
-		close(sockfd);
-		PERROR("Failed listening on socket");
-		goto error;
+		if (listen(sockfd, 8) < 0) {
+			close(sockfd);
+			PERROR("Failed listening on socket");
+			goto error;
+		}
 	}
 
 	thread->sockfd = sockfd;
@@ -334,8 +371,9 @@ static int mod_open(fr_listen_t *li)
 					     inst->interface);
 
 	// @todo - also print out auth / acct / coa, etc.
-	DEBUG("Listening on radius address %s bound to virtual server %s",
-	      thread->name, cf_section_name2(server_cs));
+	DEBUG("Listening on radius address %s bound to virtual server %s%s",
+	      thread->name, cf_section_name2(server_cs),
+	      inherited ? " (inherited socket)" : "");
 
 	return 0;
 }
@@ -388,6 +426,24 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(void const *instance, void const *packet)
+{
+	uint32_t hash;
+	proto_radius_tcp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_tcp_t);
+
+	uint8_t const *a = packet;
+
+	/*
+	 *	Hash only the fields which mod_compare() checks, so
+	 *	that packets which compare as equal hash to the same
+	 *	value: code, ID, and (optionally) the authenticator.
+	 */
+	hash = fr_hash_fast(a, 2);
+	if (inst->dedup_authenticator) hash = fr_hash_fast_update(a + 4, RADIUS_AUTH_VECTOR_LENGTH, hash);
+
+	return hash;
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -609,6 +665,7 @@ fr_app_io_t proto_radius_tcp = {
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -38,6 +38,10 @@
 
 extern fr_app_io_t proto_radius_udp;
 
+#ifdef HAVE_RECVMMSG
+#define UDP_READ_BATCH_SIZE	(8)
+#endif
+
 typedef struct {
 	char const			*name;			//!< socket name
 	int				sockfd;
@@ -45,6 +49,14 @@ typedef struct {
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
 	fr_stats_t			stats;			//!< statistics for this socket
+
+#ifdef HAVE_RECVMMSG
+	uint8_t				*batch_buffer;		//!< contiguous buffers for batched reads,
+								//!< NULL if batching isn't usable here.
+	udp_packet_t			batch[UDP_READ_BATCH_SIZE];	//!< packets drained in one recvmmsg()
+	int				batch_num;		//!< packets in the current batch
+	int				batch_idx;		//!< next packet to hand to the caller
+#endif
 } proto_radius_udp_thread_t;
 
 typedef struct {
@@ -137,18 +149,78 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
-			     &address->src_ipaddr, &address->src_port,
-			     &address->dst_ipaddr, &address->dst_port,
-			     &address->if_index, &timestamp);
-	if (data_size < 0) {
-		DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
-		return data_size;
-	}
+#ifdef HAVE_RECVMMSG
+	/*
+	 *	Batched reads.  Drain a burst of packets from the
+	 *	kernel in one recvmmsg(), stash them, and hand them
+	 *	out one at a time.  The network side keeps calling us
+	 *	until we return 0, so the stash is always emptied
+	 *	before we say "no data".
+	 */
+	if (thread->batch_buffer) {
+		udp_packet_t *pkt;
+
+redo:
+		if (thread->batch_idx >= thread->batch_num) {
+			int i, num;
+
+			for (i = 0; i < UDP_READ_BATCH_SIZE; i++) {
+				thread->batch[i].data = thread->batch_buffer + ((size_t) i * inst->max_packet_size);
+				thread->batch[i].data_len = inst->max_packet_size;
+			}
+
+			num = udp_recv_multi(thread->sockfd, thread->batch, UDP_READ_BATCH_SIZE);
+			if (num < 0) {
+				DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
+				return num;
+			}
+			if (!num) {
+				DEBUG2("proto_radius_udp got no data: ignoring");
+				return 0;
+			}
+
+			thread->batch_num = num;
+			thread->batch_idx = 0;
+		}
+
+		pkt = &thread->batch[thread->batch_idx++];
+
+		if (pkt->data_len > buffer_len) {
+			DEBUG2("proto_radius_udp got 'too long' packet size %zu > %zu", pkt->data_len, buffer_len);
+			thread->stats.total_malformed_requests++;
+			goto discard;
+		}
 
-	if (!data_size) {
-		DEBUG2("proto_radius_udp got no data: ignoring");
-		return 0;
+		memcpy(buffer, pkt->data, pkt->data_len);
+		data_size = pkt->data_len;
+		timestamp = pkt->when;
+
+		address->src_ipaddr = pkt->src_ipaddr;
+		address->src_port = pkt->src_port;
+		if (thread->connection) {
+			address->dst_ipaddr = thread->connection->dst_ipaddr;
+			address->dst_port = thread->connection->dst_port;
+		} else {
+			address->dst_ipaddr = inst->ipaddr;
+			address->dst_port = inst->port;
+		}
+		address->if_index = 0;
+	} else
+#endif
+	{
+		data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
+				     &address->src_ipaddr, &address->src_port,
+				     &address->dst_ipaddr, &address->dst_port,
+				     &address->if_index, &timestamp);
+		if (data_size < 0) {
+			DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
+			return data_size;
+		}
+
+		if (!data_size) {
+			DEBUG2("proto_radius_udp got no data: ignoring");
+			return 0;
+		}
 	}
 
 	packet_len = data_size;
@@ -156,19 +228,19 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	if (data_size < 20) {
 		DEBUG2("proto_radius_udp got 'too short' packet size %zd", data_size);
 		thread->stats.total_malformed_requests++;
-		return 0;
+		goto discard;
 	}
 
 	if (packet_len > inst->max_packet_size) {
 		DEBUG2("proto_radius_udp got 'too long' packet size %zd > %u", data_size, inst->max_packet_size);
 		thread->stats.total_malformed_requests++;
-		return 0;
+		goto discard;
 	}
 
 	if ((buffer[0] == 0) || (buffer[0] > FR_RADIUS_MAX_PACKET_CODE)) {
 		DEBUG("proto_radius_udp got invalid packet code %d", buffer[0]);
 		thread->stats.total_unknown_types++;
-		return 0;
+		goto discard;
 	}
 
 	/*
@@ -180,7 +252,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 		 */
 		DEBUG2("proto_radius_udp got a packet which isn't RADIUS");
 		thread->stats.total_malformed_requests++;
-		return 0;
+		goto discard;
 	}
 
 	*recv_time_p = timestamp;
@@ -197,6 +269,15 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t **recv_tim
 	       (int) packet_len, thread->name);
 
 	return packet_len;
+
+discard:
+#ifdef HAVE_RECVMMSG
+	/*
+	 *	There may be more packets in the stash.
+	 */
+	if (thread->batch_buffer) goto redo;
+#endif
+	return 0;
 }
 
 
@@ -305,14 +386,27 @@ static int mod_open(fr_listen_t *li)
 
 	int				sockfd;
 	uint16_t			port = inst->port;
+	bool				inherited = false;
 	CONF_SECTION			*server_cs;
 	CONF_ITEM			*ci;
 
-	li->fd = sockfd = fr_socket_server_udp(&inst->ipaddr, &port, inst->port_name, true);
-	if (sockfd < 0) {
-		PERROR("Failed opening UDP socket");
-	error:
-		return -1;
+	/*
+	 *	Prefer a socket passed to us by a supervisor (e.g.
+	 *	systemd socket activation).  Re-using the bound socket
+	 *	across restarts means there is no window where the port
+	 *	is closed, and packets are dropped.
+	 */
+	li->fd = sockfd = fr_socket_inherit(SOCK_DGRAM, &inst->ipaddr, port, true);
+	if (sockfd >= 0) {
+		inherited = true;
+
+	} else {
+		li->fd = sockfd = fr_socket_server_udp(&inst->ipaddr, &port, inst->port_name, true);
+		if (sockfd < 0) {
+			PERROR("Failed opening UDP socket");
+		error:
+			return -1;
+		}
 	}
 
 	li->app_io_addr = fr_app_io_socket_addr(li, IPPROTO_UDP, &inst->ipaddr, port);
@@ -321,7 +415,7 @@ static int mod_open(fr_listen_t *li)
 	 *	Set SO_REUSEPORT before bind, so that all packets can
 	 *	listen on the same destination IP address.
 	 */
-	if (1) {
+	if (!inherited) {
 		int on = 1;
 
 		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
@@ -352,7 +446,7 @@ static int mod_open(fr_listen_t *li)
 	}
 #endif
 
-	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
+	if (!inherited && (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0)) {
 		close(sockfd);
 		PERROR("Failed binding socket");
 		goto error;
@@ -360,6 +454,23 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+#ifdef HAVE_RECVMMSG
+	/*
+	 *	Sockets bound to a single address can use batched
+	 *	reads, as every packet has the same destination.
+	 *	Wildcard binds can't, as recvmmsg() doesn't report
+	 *	per-packet destination addresses.
+	 */
+	if (!fr_ipaddr_is_inaddr_any(&inst->ipaddr)) {
+		thread->batch_buffer = talloc_array(thread, uint8_t,
+						    (size_t) UDP_READ_BATCH_SIZE * inst->max_packet_size);
+		/*
+		 *	Not fatal, we just fall back to one packet per
+		 *	system call.
+		 */
+	}
+#endif
+
 	ci = cf_parent(inst->cs); /* listen { ... } */
 	rad_assert(ci != NULL);
 	ci = cf_parent(ci);
@@ -373,8 +484,9 @@ static int mod_open(fr_listen_t *li)
 					     inst->interface);
 
 	// @todo - also print out auth / acct / coa, etc.
-	DEBUG("Listening on radius address %s bound to virtual server %s",
-	      thread->name, cf_section_name2(server_cs));
+	DEBUG("Listening on radius address %s bound to virtual server %s%s",
+	      thread->name, cf_section_name2(server_cs),
+	      inherited ? " (inherited socket)" : "");
 
 	return 0;
 }
@@ -427,6 +539,24 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(void const *instance, void const *packet)
+{
+	uint32_t hash;
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	uint8_t const *a = packet;
+
+	/*
+	 *	Hash only the fields which mod_compare() checks, so
+	 *	that packets which compare as equal hash to the same
+	 *	value: code, ID, and (optionally) the authenticator.
+	 */
+	hash = fr_hash_fast(a, 2);
+	if (inst->dedup_authenticator) hash = fr_hash_fast_update(a + 4, RADIUS_AUTH_VECTOR_LENGTH, hash);
+
+	return hash;
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -557,6 +687,7 @@ fr_app_io_t proto_radius_udp = {
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -89,6 +89,166 @@ static REQUEST *request_setup(UNUSED TALLOC_CTX *ctx, UNUSED rad_listen_t *liste
 	return NULL;
 }
 
+/** A request waiting for its session to become free
+ *
+ */
+typedef struct {
+	REQUEST		*request;
+	fr_dlist_t	entry;
+} proto_tacacs_waiting_t;
+
+/** One TACACS+ session multiplexed over a TCP connection
+ *
+ * Network gear multiplexes many sessions over a single connection,
+ * each identified by a session_id.  Packets of one session have
+ * strictly increasing sequence numbers, so they must be processed in
+ * order, but packets of different sessions are independent.  We track
+ * each (connection, session_id) pair, run one request per session at
+ * a time, and queue follow-on packets until the active one has been
+ * answered.  Replies are written as complete frames (see
+ * fr_tacacs_packet_send), so concurrent sessions can't corrupt each
+ * other's place in the stream.
+ */
+typedef struct {
+	rad_listen_t const	*listener;	//!< Connection the session arrived on.
+	uint32_t		session_id;
+
+	REQUEST			*active;	//!< Request currently being processed.
+	fr_dlist_head_t		waiting;	//!< Packets queued behind 'active'.
+	uint32_t		num_waiting;
+} proto_tacacs_session_t;
+
+/*
+ *	A client shouldn't have more than one packet of a session in
+ *	flight, so a small backlog is plenty.  Hitting the limit means
+ *	the client is broken, or isn't reading our replies.
+ */
+#define TACACS_MAX_SESSION_BACKLOG (16)
+
+static rbtree_t *tacacs_sessions = NULL;
+
+static int tacacs_session_cmp(void const *one, void const *two)
+{
+	proto_tacacs_session_t const *a = one, *b = two;
+
+	if (a->listener < b->listener) return -1;
+	if (a->listener > b->listener) return +1;
+
+	if (a->session_id < b->session_id) return -1;
+	if (a->session_id > b->session_id) return +1;
+
+	return 0;
+}
+
+/** Reserve the session for a newly received request
+ *
+ * @param[in] listener	connection the packet was received on.
+ * @param[in] request	containing the packet.
+ * @return
+ *	- 0 if the session was free, and the request may run now.
+ *	- 1 if the request was queued behind the session's active request.
+ *	- -1 if the session's backlog is full, and the packet should be dropped.
+ */
+static int tacacs_session_reserve(rad_listen_t *listener, REQUEST *request)
+{
+	proto_tacacs_session_t	*session;
+	proto_tacacs_session_t	find = {
+					.listener = listener,
+					.session_id = tacacs_session_id(request->packet)
+				};
+	proto_tacacs_waiting_t	*waiting;
+
+	session = rbtree_finddata(tacacs_sessions, &find);
+	if (!session) {
+		session = talloc_zero(listener, proto_tacacs_session_t);
+		if (!session) return -1;
+
+		session->listener = listener;
+		session->session_id = find.session_id;
+		fr_dlist_init(&session->waiting, proto_tacacs_waiting_t, entry);
+
+		if (!rbtree_insert(tacacs_sessions, session)) {
+			talloc_free(session);
+			return -1;
+		}
+	}
+
+	if (!session->active) {
+		session->active = request;
+		return 0;
+	}
+
+	if (session->num_waiting >= TACACS_MAX_SESSION_BACKLOG) {
+		fr_strerror_printf("Too many outstanding packets for session %u", session->session_id);
+		return -1;
+	}
+
+	waiting = talloc_zero(session, proto_tacacs_waiting_t);
+	if (!waiting) return -1;
+
+	waiting->request = request;
+	fr_dlist_insert_tail(&session->waiting, waiting);
+	session->num_waiting++;
+
+	return 1;
+}
+
+/** Release a request's claim on its session
+ *
+ * If another packet for the session is queued, it becomes the active
+ * request and is kicked off immediately.  Otherwise the session entry
+ * is removed.
+ */
+static void tacacs_session_release(REQUEST *request)
+{
+	proto_tacacs_session_t	*session;
+	proto_tacacs_session_t	find = {
+					.listener = request->listener,
+					.session_id = tacacs_session_id(request->packet)
+				};
+	proto_tacacs_waiting_t	*waiting;
+	REQUEST			*next;
+
+	if (!tacacs_sessions) return;
+
+	session = rbtree_finddata(tacacs_sessions, &find);
+	if (!session) return;
+
+	/*
+	 *	A queued request was cancelled before it ever became
+	 *	active.  Just drop it from the backlog.
+	 */
+	if (session->active != request) {
+		for (waiting = fr_dlist_head(&session->waiting);
+		     waiting;
+		     waiting = fr_dlist_next(&session->waiting, waiting)) {
+			if (waiting->request != request) continue;
+
+			fr_dlist_remove(&session->waiting, waiting);
+			session->num_waiting--;
+			talloc_free(waiting);
+			break;
+		}
+		return;
+	}
+
+	waiting = fr_dlist_head(&session->waiting);
+	if (!waiting) {
+		rbtree_deletebydata(tacacs_sessions, session);
+		talloc_free(session);
+		return;
+	}
+
+	fr_dlist_remove(&session->waiting, waiting);
+	session->num_waiting--;
+
+	next = waiting->request;
+	talloc_free(waiting);
+
+	session->active = next;
+	next->process(next, FR_SIGNAL_RUN);
+}
+
 /*
  *	Debug the packet if requested - cribbed from common_packet_debug
  */
@@ -496,7 +656,8 @@ send_reply:
 
 done:
 	default:
-		(void) fr_heap_extract(request->backlog, request);
+		tacacs_session_release(request);
+		(void) fr_heap4_extract(request->backlog, request);
 		//request_delete(request);
 		break;
 	}
@@ -513,7 +674,8 @@ static void tacacs_queued(REQUEST *request, fr_state_signal_t action)
 		break;
 
 	case FR_SIGNAL_CANCEL:
-		(void) fr_heap_extract(request->backlog, request);
+		tacacs_session_release(request);
+		(void) fr_heap4_extract(request->backlog, request);
 		//request_delete(request);
 		break;
 
@@ -588,8 +750,21 @@ static int tacacs_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	/*
+	 *	Serialize packets of the same session, and let other
+	 *	sessions on this connection proceed independently.
+	 */
+	rcode = tacacs_session_reserve(listener, request);
+	if (rcode < 0) {
+		PERROR("Dropping packet from %s", client->shortname);
+		talloc_free(ctx);
+		return 0;
+	}
+
 	request->process = tacacs_queued;
-//	request_enqueue(request);
+	if (rcode == 0) {
+//		request_enqueue(request);
+	}
 
 	sock->packet = NULL;	/* we have no need for more partial reads */
 	return 1;
@@ -667,11 +842,20 @@ static int mod_load(void)
 		return -1;
 	}
 
+	tacacs_sessions = rbtree_talloc_create(NULL, tacacs_session_cmp, proto_tacacs_session_t,
+					       NULL, RBTREE_FLAG_NONE);
+	if (!tacacs_sessions) {
+		fr_tacacs_free();
+		return -1;
+	}
+
 	return 0;
 }
 
 static void mod_unload(void)
 {
+	TALLOC_FREE(tacacs_sessions);
+
 	fr_tacacs_free();
 }
 
@@ -394,6 +394,20 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	return (a[1] < b[1]) - (a[1] > b[1]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint32_t hash;
+	uint8_t const *a = packet;
+
+	/*
+	 *	Hash only the fields which mod_compare() checks, so
+	 *	that packets which compare as equal hash to the same
+	 *	value: the transaction ID and the opcode.
+	 */
+	hash = fr_hash_fast(a + 4, 4);
+	return fr_hash_fast_update(a + 1, 1, hash);
+}
+
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
 	proto_vmps_udp_t	*inst = talloc_get_type_abort(instance, proto_vmps_udp_t);
@@ -517,6 +531,7 @@ fr_app_io_t proto_vmps_udp = {
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
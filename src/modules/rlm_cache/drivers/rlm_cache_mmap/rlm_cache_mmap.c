@@ -0,0 +1,346 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_mmap.c
+ * @brief Read-only cache backed by a pre-built memory mapped file.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+
+#define LOG_PREFIX "rlm_cache_mmap - "
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+/** On-disk file format
+ *
+ * The cache file is built offline with scripts/create-cache-mmap.pl and
+ * mapped read-only and shared, so the kernel shares the pages between
+ * every server process using the same file, and "warm up" is just a
+ * page fault.
+ *
+ * All integers are little-endian.  All offsets are from the start of
+ * the file.  The layout is:
+ *
+ * - A #rlm_cache_mmap_header_t.
+ * - An open addressed hash table of `buckets` uint64_t entry offsets
+ *   (0 for an empty slot), indexed by fr_hash() of the key modulo
+ *   `buckets` with linear probing.  `buckets` must be a power of two.
+ * - The entries.  Each entry is 8-byte aligned, and consists of a
+ *   #rlm_cache_mmap_entry_t followed by the key, followed by the entry
+ *   data in the format produced by #cache_serialize.
+ *
+ * Entries are deserialized lazily when a lookup hits them.
+ */
+#define RLM_CACHE_MMAP_MAGIC	(0x4d434346)		/* "FCCM" */
+#define RLM_CACHE_MMAP_VERSION	(1)
+
+typedef struct {
+	uint32_t		magic;			//!< RLM_CACHE_MMAP_MAGIC.
+	uint32_t		version;		//!< RLM_CACHE_MMAP_VERSION.
+	uint64_t		buckets;		//!< Number of hash buckets.  Must be a power of two.
+	uint64_t		count;			//!< Number of entries in the file.
+	uint64_t		table_offset;		//!< Offset of the hash table.
+	uint64_t		file_size;		//!< Total size of the file, for sanity checking.
+} rlm_cache_mmap_header_t;
+
+typedef struct {
+	uint32_t		key_len;		//!< Length of the key.
+	uint32_t		data_len;		//!< Length of the serialized entry data.
+} rlm_cache_mmap_entry_t;
+
+typedef struct {
+	char const		*filename;		//!< File to map.
+
+	uint8_t const		*map;			//!< The mapped file.
+	size_t			map_size;		//!< Size of the mapping.
+
+	uint64_t		buckets;		//!< Number of hash buckets, from the header.
+	uint64_t const		*table;			//!< The hash table within the mapping.
+} rlm_cache_mmap_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED, rlm_cache_mmap_t, filename) },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Unmap the cache file
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_mmap_t *driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+
+	if (driver->map) {
+		void *mutable;
+
+		memcpy(&mutable, &driver->map, sizeof(mutable));	/* const issues */
+		munmap(mutable, driver->map_size);
+	}
+
+	return 0;
+}
+
+/** Map the cache file, and verify its header
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_cache_mmap_t		*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_header_t	const	*header;
+	struct stat			buf;
+	void				*map;
+	int				fd;
+
+	fd = open(driver->filename, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Failed opening \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &buf) < 0) {
+		ERROR("Failed getting size of \"%s\": %s", driver->filename, fr_syserror(errno));
+	error:
+		close(fd);
+		return -1;
+	}
+
+	if ((size_t)buf.st_size < sizeof(*header)) {
+		ERROR("Cache file \"%s\" is too small to contain a header", driver->filename);
+		goto error;
+	}
+
+	/*
+	 *	MAP_SHARED means the page cache is shared with any
+	 *	other process which maps the same file.
+	 */
+	map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		ERROR("Failed mapping \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	driver->map = map;
+	driver->map_size = buf.st_size;
+
+	header = (rlm_cache_mmap_header_t const *)driver->map;
+	if (header->magic != RLM_CACHE_MMAP_MAGIC) {
+		ERROR("Cache file \"%s\" has invalid magic.  Is it a cache file?", driver->filename);
+		return -1;
+	}
+	if (header->version != RLM_CACHE_MMAP_VERSION) {
+		ERROR("Cache file \"%s\" is version %u, we need version %u.  Rebuild it",
+		      driver->filename, header->version, RLM_CACHE_MMAP_VERSION);
+		return -1;
+	}
+	if (header->file_size != (uint64_t)driver->map_size) {
+		ERROR("Cache file \"%s\" is truncated.  Header says %" PRIu64 " bytes, file is %zu bytes",
+		      driver->filename, header->file_size, driver->map_size);
+		return -1;
+	}
+	if (!header->buckets || (header->buckets & (header->buckets - 1))) {
+		ERROR("Cache file \"%s\" bucket count %" PRIu64 " is not a power of two",
+		      driver->filename, header->buckets);
+		return -1;
+	}
+	if ((header->table_offset + (header->buckets * sizeof(uint64_t))) > driver->map_size) {
+		ERROR("Cache file \"%s\" hash table extends past the end of the file", driver->filename);
+		return -1;
+	}
+
+	driver->buckets = header->buckets;
+	driver->table = (uint64_t const *)(driver->map + header->table_offset);
+
+	DEBUG2("Mapped \"%s\": %" PRIu64 " entries, %zu bytes", driver->filename, header->count, driver->map_size);
+
+	return 0;
+}
+
+/** Free a deserialized entry
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Look a key up in the mapped hash table, deserializing the entry on a hit
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_mmap_t		*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_entry_t const	*f = NULL;
+	rlm_cache_entry_t		*c;
+	uint8_t const			*data;
+	char				*buff;
+	uint32_t			hash;
+	uint64_t			i;
+	int				ret;
+
+	hash = fr_hash(key, key_len);
+
+	for (i = 0; i < driver->buckets; i++) {
+		uint64_t offset;
+
+		offset = driver->table[(hash + i) & (driver->buckets - 1)];
+		if (!offset) return CACHE_MISS;
+
+		/*
+		 *	Don't chase corrupted offsets outside the mapping.
+		 */
+		if ((offset + sizeof(*f)) > driver->map_size) {
+			RERROR("Corrupt cache file \"%s\": entry offset %" PRIu64 " out of bounds",
+			       driver->filename, offset);
+			return CACHE_ERROR;
+		}
+
+		f = (rlm_cache_mmap_entry_t const *)(driver->map + offset);
+		if ((offset + sizeof(*f) + f->key_len + f->data_len) > driver->map_size) {
+			RERROR("Corrupt cache file \"%s\": entry at %" PRIu64 " extends past the end of the file",
+			       driver->filename, offset);
+			return CACHE_ERROR;
+		}
+
+		if ((f->key_len == key_len) &&
+		    (memcmp((uint8_t const *)(f + 1), key, key_len) == 0)) break;
+
+		f = NULL;	/* Hash collision, keep probing */
+	}
+	if (!f) return CACHE_MISS;
+
+	data = (uint8_t const *)(f + 1) + f->key_len;
+
+	/*
+	 *	The mapping is read-only and cache_deserialize modifies
+	 *	its input, so deserialize from a mutable copy.
+	 */
+	c = talloc_zero(NULL, rlm_cache_entry_t);
+	if (!c) return CACHE_ERROR;
+
+	buff = talloc_array(c, char, f->data_len + 1);
+	if (!buff) {
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+	memcpy(buff, data, f->data_len);
+	buff[f->data_len] = '\0';
+
+	ret = cache_deserialize(c, request->dict, buff, f->data_len);
+	talloc_free(buff);
+	if (ret < 0) {
+		RPERROR("Invalid entry");
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+
+	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
+
+	/*
+	 *	Static datasets usually don't serialize expiry times.
+	 *	Keep the entry alive for the configured ttl, so the
+	 *	module doesn't immediately expire it.
+	 */
+	if (!c->expires) c->expires = fr_time_to_sec(request->packet->timestamp) + config->ttl;
+	if (!c->created) c->created = fr_time_to_sec(request->packet->timestamp);
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Insertions are not supported, the mapping is read-only
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 UNUSED rlm_cache_entry_t const *c)
+{
+	rlm_cache_mmap_t *driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+
+	RWDEBUG("Cache file \"%s\" is read-only, not inserting entry.  "
+		"Rebuild the file to change its contents", driver->filename);
+
+	return CACHE_ERROR;
+}
+
+/** Expiry is a noop, the mapping is read-only
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 UNUSED uint8_t const *key, UNUSED size_t key_len)
+{
+	rlm_cache_mmap_t *driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+
+	RDEBUG3("Cache file \"%s\" is read-only, leaving entry in place", driver->filename);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the mapped file
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  UNUSED REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_mmap_t		*driver = talloc_get_type_abort(instance, rlm_cache_mmap_t);
+	rlm_cache_mmap_header_t const	*header = (rlm_cache_mmap_header_t const *)driver->map;
+
+	return header->count;
+}
+
+extern cache_driver_t rlm_cache_mmap;
+cache_driver_t rlm_cache_mmap = {
+	.name		= "rlm_cache_mmap",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_mmap_t),
+	.config		= driver_config,
+
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.count		= cache_entry_count,
+};
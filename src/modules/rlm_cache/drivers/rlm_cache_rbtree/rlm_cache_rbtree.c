@@ -19,6 +19,10 @@
  * @file rlm_cache_rbtree.c
  * @brief Simple rbtree based cache.
  *
+ * The key space is split over a number of shards, each with its own
+ * tree, expiry heap, and mutex.  Workers operating on different keys
+ * then no longer serialize on a single mutex.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 #include <freeradius-devel/server/base.h>
@@ -26,18 +30,53 @@
 #include <freeradius-devel/server/rad_assert.h>
 #include "../../rlm_cache.h"
 
+/** A single shard of the cache
+ *
+ */
 typedef struct {
 	rbtree_t		*cache;		//!< Tree for looking up cache keys.
+	rbtree_t		*counters;	//!< Tree of atomic counters, in their own namespace.
 	fr_heap_t		*heap;		//!< For managing entry expiry.
 
 	pthread_mutex_t		mutex;		//!< Protect the tree from multiple readers/writers.
+} rlm_cache_rbtree_shard_t;
+
+typedef struct {
+	rlm_cache_rbtree_shard_t *shards;	//!< Array of shards, indexed by key hash.
+	uint32_t		num_shards;	//!< Number of shards allocated.
 } rlm_cache_rbtree_t;
 
+/** Tracks which shard is locked for the current operation
+ *
+ * All calls between one acquire/release pair operate on the same key,
+ * so at most one shard is ever locked at a time.
+ */
+typedef struct {
+	rlm_cache_rbtree_shard_t *shard;	//!< Shard we hold the mutex for, NULL if none yet.
+} rlm_cache_rbtree_handle_t;
+
 typedef struct {
 	rlm_cache_entry_t	fields;		//!< Entry data.
 	int32_t			heap_id;	//!< Offset used for heap.
 } rlm_cache_rbtree_entry_t;
 
+/** An atomic counter
+ *
+ * Counters are expired lazily, when an increment finds the window has
+ * passed, rather than via the expiry heap.
+ */
+typedef struct {
+	uint8_t const		*key;		//!< Key used to identify the counter.
+	size_t			key_len;	//!< Length of key data.
+	int64_t			value;		//!< Current value of the counter.
+	time_t			expires;	//!< When the current window ends.
+} rlm_cache_rbtree_counter_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_rbtree_t, num_shards), .dflt = "32" },
+	CONF_PARSER_TERMINATOR
+};
+
 /** Compare two entries by key
  *
  * There may only be one entry with the same key.
@@ -53,6 +92,21 @@ static int cache_entry_cmp(void const *one, void const *two)
 	return memcmp(a->key, b->key, a->key_len);
 }
 
+/** Compare two counters by key
+ *
+ * There may only be one counter with the same key.
+ */
+static int cache_counter_cmp(void const *one, void const *two)
+{
+	rlm_cache_rbtree_counter_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
 /** Compare two entries by expiry time
  *
  * There may be multiple entries with the same expiry time.
@@ -64,6 +118,35 @@ static int8_t cache_heap_cmp(void const *one, void const *two)
 	return (a->expires > b->expires) - (a->expires < b->expires);
 }
 
+/** Return the shard for a key, locking it if we don't hold it already
+ *
+ * @param[in] driver	this instance of the rbtree driver.
+ * @param[in] handle	tracking which shard is currently locked.
+ * @param[in] key	the cache key.
+ * @param[in] key_len	length of the cache key.
+ * @return the locked shard for this key.
+ */
+static rlm_cache_rbtree_shard_t *cache_shard_lock(rlm_cache_rbtree_t *driver, rlm_cache_rbtree_handle_t *handle,
+						  uint8_t const *key, size_t key_len)
+{
+	rlm_cache_rbtree_shard_t *shard;
+
+	shard = &driver->shards[fr_hash_fast(key, key_len) % driver->num_shards];
+	if (handle->shard == shard) return shard;
+
+	/*
+	 *	The cache module only uses one key between acquire and
+	 *	release, so we should never be asked for a second shard.
+	 *	If that ever changes, swap the locks instead of deadlocking.
+	 */
+	if (!fr_cond_assert(!handle->shard)) pthread_mutex_unlock(&handle->shard->mutex);
+
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	return shard;
+}
+
 /** Walk over the cache rbtree
  *
  * Used to free any entries left in the tree on detach.
@@ -85,13 +168,25 @@ static int _cache_entry_free(void *data, UNUSED void *uctx)
 static int mod_detach(void *instance)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	uint32_t i;
 
-	if (driver->cache) {
-		rbtree_walk(driver->cache, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
-		talloc_free(driver->cache);
-	}
+	if (!driver->shards) return 0;
 
-	pthread_mutex_destroy(&driver->mutex);
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_rbtree_shard_t *shard = &driver->shards[i];
+
+		if (shard->cache) {
+			rbtree_walk(shard->cache, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
+			talloc_free(shard->cache);
+		}
+
+		if (shard->counters) {
+			rbtree_walk(shard->counters, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
+			talloc_free(shard->counters);
+		}
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
 
 	return 0;
 }
@@ -109,29 +204,55 @@ static int mod_detach(void *instance)
 static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	uint32_t i;
 
-	/*
-	 *	The cache.
-	 */
-	driver->cache = rbtree_talloc_create(NULL, cache_entry_cmp, rlm_cache_rbtree_entry_t, NULL, 0);
-	if (!driver->cache) {
-		ERROR("Failed to create cache");
+	if (!driver->num_shards) {
+		ERROR("Invalid value \"0\" for shards");
 		return -1;
 	}
-	talloc_link_ctx(driver, driver->cache);
 
-	/*
-	 *	The heap of entries to expire.
-	 */
-	driver->heap = fr_heap_talloc_create(driver, cache_heap_cmp, rlm_cache_rbtree_entry_t, heap_id);
-	if (!driver->heap) {
-		ERROR("Failed to create heap for the cache");
+	driver->shards = talloc_zero_array(driver, rlm_cache_rbtree_shard_t, driver->num_shards);
+	if (!driver->shards) {
+		ERROR("Failed to allocate shards");
 		return -1;
 	}
 
-	if (pthread_mutex_init(&driver->mutex, NULL) < 0) {
-		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
-		return -1;
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_rbtree_shard_t *shard = &driver->shards[i];
+
+		/*
+		 *	The cache.
+		 */
+		shard->cache = rbtree_talloc_create(NULL, cache_entry_cmp, rlm_cache_rbtree_entry_t, NULL, 0);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+		talloc_link_ctx(driver, shard->cache);
+
+		/*
+		 *	The counters.
+		 */
+		shard->counters = rbtree_talloc_create(NULL, cache_counter_cmp, rlm_cache_rbtree_counter_t, NULL, 0);
+		if (!shard->counters) {
+			ERROR("Failed to create counter tree");
+			return -1;
+		}
+		talloc_link_ctx(driver, shard->counters);
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_create(driver, cache_heap_cmp, rlm_cache_rbtree_entry_t, heap_id);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
 	}
 
 	return 0;
@@ -158,35 +279,35 @@ static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *con
 }
 
 /** Locate a cache entry
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 				       UNUSED rlm_cache_config_t const *config, void *instance,
-				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t *shard;
 
 	rlm_cache_entry_t *c;
 
-	rad_assert(driver->cache);
+	shard = cache_shard_lock(driver, handle, key, key_len);
+	rad_assert(shard->cache);
 
 	/*
 	 *	Clear out old entries
 	 */
-	c = fr_heap_peek(driver->heap);
+	c = fr_heap_peek(shard->heap);
 	if (c && (c->expires < fr_time_to_sec(request->packet->timestamp))) {
-		fr_heap_extract(driver->heap, c);
-		rbtree_deletebydata(driver->cache, c);
+		fr_heap_extract(shard->heap, c);
+		rbtree_deletebydata(shard->cache, c);
 		talloc_free(c);
 	}
 
 	/*
 	 *	Is there an entry for this key?
 	 */
-	c = rbtree_finddata(driver->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	c = rbtree_finddata(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
 	if (!c) {
 		*out = NULL;
 		return CACHE_MISS;
@@ -197,33 +318,32 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 }
 
 /** Free an entry and remove it from the data store
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_expire_t
  */
 static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
-					 REQUEST *request, UNUSED void *handle,
+					 REQUEST *request, void *handle,
 					 uint8_t const *key, size_t key_len)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t *shard;
 	rlm_cache_entry_t *c;
 
 	if (!request) return CACHE_ERROR;
 
-	c = rbtree_finddata(driver->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	shard = cache_shard_lock(driver, handle, key, key_len);
+
+	c = rbtree_finddata(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
 	if (!c) return CACHE_MISS;
 
-	fr_heap_extract(driver->heap, c);
-	rbtree_deletebydata(driver->cache, c);
+	fr_heap_extract(shard->heap, c);
+	rbtree_deletebydata(shard->cache, c);
 	talloc_free(c);
 
 	return CACHE_OK;
 }
 
 /** Insert a new entry into the data store
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_insert_t
  */
@@ -234,30 +354,31 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 	cache_status_t status;
 
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t *shard;
 	rlm_cache_entry_t *my_c;
 
-	rad_assert(handle == request);
-
 	if (!request) return CACHE_ERROR;
 
 	memcpy(&my_c, &c, sizeof(my_c));
 
+	shard = cache_shard_lock(driver, handle, c->key, c->key_len);
+
 	/*
 	 *	Allow overwriting
 	 */
-	if (!rbtree_insert(driver->cache, my_c)) {
+	if (!rbtree_insert(shard->cache, my_c)) {
 		status = cache_entry_expire(config, instance, request, handle, c->key, c->key_len);
 		if ((status != CACHE_OK) && !fr_cond_assert(0)) return CACHE_ERROR;
 
-		if (!rbtree_insert(driver->cache, my_c)) {
+		if (!rbtree_insert(shard->cache, my_c)) {
 			RERROR("Failed adding entry");
 
 			return CACHE_ERROR;
 		}
 	}
 
-	if (fr_heap_insert(driver->heap, my_c) < 0) {
-		rbtree_deletebydata(driver->cache, my_c);
+	if (fr_heap_insert(shard->heap, my_c) < 0) {
+		rbtree_deletebydata(shard->cache, my_c);
 		RERROR("Failed adding entry to expiry heap");
 
 		return CACHE_ERROR;
@@ -267,37 +388,89 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 }
 
 /** Update the TTL of an entry
- *
- * @note handle not used except for sanity checks.
  *
  * @copydetails cache_entry_set_ttl_t
  */
 static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
-					  REQUEST *request, UNUSED void *handle,
+					  REQUEST *request, void *handle,
 					  rlm_cache_entry_t *c)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t *shard;
 
 #ifdef NDEBUG
 	if (!request) return CACHE_ERROR;
 #endif
 
-	if (!fr_cond_assert(fr_heap_extract(driver->heap, c) == 0)) {
+	shard = cache_shard_lock(driver, handle, c->key, c->key_len);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, c) == 0)) {
 		RERROR("Entry not in heap");
 		return CACHE_ERROR;
 	}
 
-	if (fr_heap_insert(driver->heap, c) < 0) {
-		rbtree_deletebydata(driver->cache, c);	/* make sure we don't leak entries... */
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		rbtree_deletebydata(shard->cache, c);	/* make sure we don't leak entries... */
 		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
 		return CACHE_ERROR;
 	}
 	return CACHE_OK;
 }
 
+/** Atomically add a delta to a counter
+ *
+ * The shard mutex makes the whole operation atomic with respect to
+ * other workers.
+ *
+ * @copydetails cache_entry_incr_t
+ */
+static cache_status_t cache_entry_incr(int64_t *out, UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, void *handle,
+				       uint8_t const *key, size_t key_len, int64_t delta, time_t expires)
+{
+	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_shard_t *shard;
+	rlm_cache_rbtree_counter_t *counter;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(driver, handle, key, key_len);
+
+	counter = rbtree_finddata(shard->counters,
+				  &(rlm_cache_rbtree_counter_t){ .key = key, .key_len = key_len });
+	if (!counter) {
+		counter = talloc_zero(NULL, rlm_cache_rbtree_counter_t);
+		if (!counter) {
+			RERROR("Failed allocating counter");
+			return CACHE_ERROR;
+		}
+		counter->key = talloc_memdup(counter, key, key_len);
+		counter->key_len = key_len;
+
+		if (!rbtree_insert(shard->counters, counter)) {
+			talloc_free(counter);
+			RERROR("Failed adding counter");
+			return CACHE_ERROR;
+		}
+	} else if (counter->expires < fr_time_to_sec(request->packet->timestamp)) {
+		/*
+		 *	The window has passed, start a new one.
+		 */
+		counter->value = 0;
+	}
+
+	counter->value += delta;
+	counter->expires = expires;
+	*out = counter->value;
+
+	return CACHE_OK;
+}
+
 /** Return the number of entries in the cache
  *
- * @note handle not used except for sanity checks.
+ * The count is only approximate when other workers are modifying the
+ * cache concurrently, as we don't stall them to get a consistent sum
+ * over all of the shards.
  *
  * @copydetails cache_entry_count_t
  */
@@ -305,46 +478,51 @@ static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void
 				  REQUEST *request, UNUSED void *handle)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	uint32_t count = 0;
+	uint32_t i;
 
 	if (!request) return CACHE_ERROR;
 
-	return rbtree_num_elements(driver->cache);
+	for (i = 0; i < driver->num_shards; i++) count += rbtree_num_elements(driver->shards[i].cache);
+
+	return count;
 }
 
-/** Lock the rbtree
+/** Allocate a handle to track the locked shard
  *
- * @note handle not used except for sanity checks.
+ * The shard itself isn't locked until the first operation with a key,
+ * as we don't know which shard that key will hash to yet.
  *
  * @copydetails cache_acquire_t
  */
-static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
 			 REQUEST *request)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-
-	pthread_mutex_lock(&driver->mutex);
+	rlm_cache_rbtree_handle_t *h;
 
-	*handle = request;		/* handle is unused, this is just for sanity checking */
+	h = talloc_zero(request, rlm_cache_rbtree_handle_t);
+	if (!h) return -1;
 
-	RDEBUG3("Mutex acquired");
+	*handle = h;
 
 	return 0;
 }
 
-/** Release an entry unlocking any mutexes
- *
- * @note handle not used except for sanity checks.
+/** Release the handle, unlocking any shard mutex we hold
  *
  * @copydetails cache_release_t
  */
-static void cache_release(UNUSED rlm_cache_config_t const *config, void *instance, REQUEST *request,
-			  UNUSED rlm_cache_handle_t *handle)
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
 {
-	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_handle_t *h = talloc_get_type_abort(handle, rlm_cache_rbtree_handle_t);
 
-	pthread_mutex_unlock(&driver->mutex);
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
 
-	RDEBUG3("Mutex released");
+	talloc_free(h);
 }
 
 extern cache_driver_t rlm_cache_rbtree;
@@ -353,6 +531,7 @@ cache_driver_t rlm_cache_rbtree = {
 	.magic		= RLM_MODULE_INIT,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.config		= driver_config,
 	.inst_size	= sizeof(rlm_cache_rbtree_t),
 	.alloc		= cache_entry_alloc,
 
@@ -360,6 +539,7 @@ cache_driver_t rlm_cache_rbtree = {
 	.insert		= cache_entry_insert,
 	.expire		= cache_entry_expire,
 	.set_ttl	= cache_entry_set_ttl,
+	.incr		= cache_entry_incr,
 	.count		= cache_entry_count,
 
 	.acquire	= cache_acquire,
@@ -418,6 +418,188 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	return CACHE_OK;
 }
 
+/** Update the expiry time of an entry in redis
+ *
+ * #cache_entry_insert always serializes Cache-Created as list elements 0-2
+ * and Cache-Expires as list elements 3-5, so the stored expiry value is
+ * always element 5.  That lets us update it in place with LSET instead of
+ * re-serializing and re-inserting the whole entry.
+ *
+ * We must update the stored value as well as calling EXPIREAT, as
+ * #cache_entry_find returns it to the cache module, which compares it
+ * against the request time when deciding whether the entry is still live.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  REQUEST *request, UNUSED void *handle, rlm_cache_entry_t *c)
+{
+	rlm_cache_redis_t	*driver = instance;
+	TALLOC_CTX		*pool;
+
+	fr_redis_conn_t		*conn;
+	fr_redis_cluster_state_t	state;
+	fr_redis_rcode_t	status;
+	redisReply		*reply = NULL;
+	int			s_ret;
+
+	char const		*argv[3];
+	size_t			argv_len[3];
+
+	unsigned int		pipelined = 0;	/* How many commands pending in the pipeline */
+	redisReply		*replies[4];	/* Should have the same number of elements as pipelined commands */
+	size_t			reply_cnt = 0, i;
+
+	vp_tmpl_t		expires_value;
+	vp_map_t		expires = {
+					.op	= T_OP_SET,
+					.lhs	= driver->expires_attr,
+					.rhs	= &expires_value,
+				};
+
+	/*
+	 *	Encode the new entry expiry time, in the same format
+	 *	cache_entry_insert uses.
+	 */
+	tmpl_init(&expires_value, TMPL_TYPE_DATA, "<TEMP>", 6, T_BARE_WORD);
+	expires_value.tmpl_value_type = FR_TYPE_DATE;
+	expires_value.tmpl_value.vb_date = fr_time_from_timeval(&(struct timeval) {.tv_sec = c->expires});
+
+	pool = talloc_pool(request, 256);
+	if (!pool) return CACHE_ERROR;
+
+	if (fr_redis_tuple_from_map(pool, argv, argv_len, &expires) < 0) {
+		REDEBUG("Failed encoding map as Redis K/V pair");
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, c->key, c->key_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		/*
+		 *	Start the transaction, as we need to update the
+		 *	stored value and the expiry time atomically.
+		 */
+		RDEBUG3("MULTI");
+		if (redisAppendCommand(conn->handle, "MULTI") != REDIS_OK) {
+		append_error:
+			RERROR("Failed appending Redis command to output buffer: %s", conn->handle->errstr);
+			talloc_free(pool);
+			return CACHE_ERROR;
+		}
+		pipelined++;
+
+		RDEBUG3("LSET \"%pV\" 5 %pV", fr_box_strvalue_len((char const *)c->key, c->key_len),
+			fr_box_strvalue_len(argv[2], argv_len[2]));
+		if (redisAppendCommand(conn->handle, "LSET %b 5 %b", c->key, c->key_len,
+				       argv[2], argv_len[2]) != REDIS_OK) goto append_error;
+		pipelined++;
+
+		RDEBUG3("EXPIREAT \"%pV\" %li",
+			fr_box_strvalue_len((char const *)c->key, c->key_len), (long)c->expires);
+		if (redisAppendCommand(conn->handle, "EXPIREAT %b %i", c->key,
+				       c->key_len, c->expires) != REDIS_OK) goto append_error;
+		pipelined++;
+
+		RDEBUG3("EXEC");
+		if (redisAppendCommand(conn->handle, "EXEC") != REDIS_OK) goto append_error;
+		pipelined++;
+
+		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
+						     replies, NUM_ELEMENTS(replies),
+						     conn);
+		reply = replies[0];
+	}
+	talloc_free(pool);
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RPERROR("Failed updating entry TTL");
+		return CACHE_ERROR;
+	}
+
+	RDEBUG3("Command results");
+	RINDENT();
+	if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+	fr_redis_pipeline_free(replies, reply_cnt);
+	REXDENT();
+
+	return CACHE_OK;
+}
+
+/** Atomically add a delta to a counter
+ *
+ * INCRBY is atomic on the Redis side, so no MULTI/EXEC is needed; the
+ * EXPIREAT is pipelined after it, and only affects when the counter is
+ * reaped.  As Redis has a flat key space, counters share it with the
+ * serialized entries, and the same key must not be used for both.
+ *
+ * @copydetails cache_entry_incr_t
+ */
+static cache_status_t cache_entry_incr(int64_t *out, UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, UNUSED void *handle,
+				       uint8_t const *key, size_t key_len, int64_t delta, time_t expires)
+{
+	rlm_cache_redis_t		*driver = instance;
+	fr_redis_cluster_state_t	state;
+	fr_redis_conn_t			*conn;
+	fr_redis_rcode_t		status;
+	redisReply			*reply = NULL;
+	int				s_ret;
+
+	unsigned int			pipelined = 0;	/* How many commands pending in the pipeline */
+	redisReply			*replies[2];	/* Should have the same number of elements as pipelined commands */
+	size_t				reply_cnt = 0, i;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, key, key_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		RDEBUG3("INCRBY \"%pV\" %lli", fr_box_strvalue_len((char const *)key, key_len), (long long)delta);
+		if (redisAppendCommand(conn->handle, "INCRBY %b %lld", key, key_len,
+				       (long long)delta) != REDIS_OK) {
+		append_error:
+			RERROR("Failed appending Redis command to output buffer: %s", conn->handle->errstr);
+			return CACHE_ERROR;
+		}
+		pipelined++;
+
+		if (expires > 0) {
+			RDEBUG3("EXPIREAT \"%pV\" %li",
+				fr_box_strvalue_len((char const *)key, key_len), (long)expires);
+			if (redisAppendCommand(conn->handle, "EXPIREAT %b %i", key,
+					       key_len, expires) != REDIS_OK) goto append_error;
+			pipelined++;
+		}
+
+		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
+						     replies, NUM_ELEMENTS(replies),
+						     conn);
+		reply = replies[0];
+	}
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RPERROR("Failed incrementing counter");
+		return CACHE_ERROR;
+	}
+
+	RDEBUG3("Command results");
+	RINDENT();
+	if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+	REXDENT();
+
+	if (!fr_cond_assert(reply) || (reply->type != REDIS_REPLY_INTEGER)) {
+		REDEBUG("Bad result type, expected integer, got %s",
+			reply ? fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>") : "<NULL>");
+		fr_redis_pipeline_free(replies, reply_cnt);
+		return CACHE_ERROR;
+	}
+
+	*out = (int64_t)reply->integer;
+	fr_redis_pipeline_free(replies, reply_cnt);
+
+	return CACHE_OK;
+}
+
 /** Call delete the cache entry from redis
  *
  * @copydetails cache_entry_expire_t
@@ -475,4 +657,6 @@ cache_driver_t rlm_cache_redis = {
 	.find		= cache_entry_find,
 	.insert		= cache_entry_insert,
 	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.incr		= cache_entry_incr,
 };
@@ -34,6 +34,8 @@ RCSID("$Id$")
 
 #include "rlm_cache.h"
 
+#include <ctype.h>
+
 extern module_t rlm_cache;
 
 static const CONF_PARSER module_config[] = {
@@ -523,6 +525,37 @@ static rlm_rcode_t cache_set_ttl(rlm_cache_t const *inst, REQUEST *request,
 	}
 }
 
+/** Atomically add a delta to a counter
+ *
+ * @return
+ *	- #RLM_MODULE_UPDATED on success.
+ *	- #RLM_MODULE_FAIL on failure.
+ */
+static rlm_rcode_t cache_incr(int64_t *out, rlm_cache_t const *inst, REQUEST *request,
+			      rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len,
+			      int64_t delta, time_t expires)
+{
+	rad_assert(inst->driver->incr);
+
+	for (;;) {
+		cache_status_t ret;
+
+		ret = inst->driver->incr(out, &inst->config, inst->driver_inst->dl_inst->data, request,
+					 *handle, key, key_len, delta, expires);
+		switch (ret) {
+		case CACHE_RECONNECT:
+			if (cache_reconnect(handle, inst, request) == 0) continue;
+			return RLM_MODULE_FAIL;
+
+		case CACHE_OK:
+			return RLM_MODULE_UPDATED;
+
+		default:
+			return RLM_MODULE_FAIL;
+		}
+	}
+}
+
 /** Verify that a map in the cache section makes sense
  *
  */
@@ -874,6 +907,61 @@ static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 	return ret;
 }
 
+/** Atomically increment a counter, expanding to the new value
+ *
+ * The expansion argument is the delta to add, defaulting to 1 when
+ * empty.  The counter is identified by the module's key, and expires
+ * config.ttl seconds after the last increment.
+ *
+ * This replaces the find/modify/insert cycle (and its races) that
+ * policies maintaining counters otherwise have to do with three
+ * serialized cache calls.
+ */
+static ssize_t cache_incr_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
+			       void const *mod_inst, UNUSED void const *xlat_inst,
+			       REQUEST *request, char const *fmt) CC_HINT(nonnull);
+static ssize_t cache_incr_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
+			       void const *mod_inst, UNUSED void const *xlat_inst,
+			       REQUEST *request, char const *fmt)
+{
+	rlm_cache_t const	*inst = mod_inst;
+	rlm_cache_handle_t	*handle = NULL;
+
+	uint8_t			buffer[1024];
+	uint8_t const		*key;
+	ssize_t			key_len;
+
+	int64_t			delta = 1, value;
+	rlm_rcode_t		rcode;
+
+	while (isspace((int) *fmt)) fmt++;
+
+	if (*fmt) {
+		char *end;
+
+		delta = strtoll(fmt, &end, 10);
+		if ((end == fmt) || (*end != '\0')) {
+			REDEBUG("Invalid delta \"%s\"", fmt);
+			return -1;
+		}
+	}
+
+	key_len = tmpl_expand((char const **)&key, (char *)buffer, sizeof(buffer),
+			      request, inst->config.key, NULL, NULL);
+	if (key_len < 0) return -1;
+
+	if (cache_acquire(&handle, inst, request) < 0) return -1;
+
+	rcode = cache_incr(&value, inst, request, &handle, key, (size_t)key_len, delta,
+			   fr_time_to_sec(request->packet->timestamp) + inst->config.ttl);
+	cache_release(inst, request, &handle);
+	if (rcode == RLM_MODULE_FAIL) return -1;
+
+	*out = talloc_typed_asprintf(ctx, "%" PRIi64, value);
+
+	return talloc_array_length(*out) - 1;
+}
+
 /** Free any memory allocated under the instance
  *
  */
@@ -952,6 +1040,19 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	 */
 	xlat_register(inst, inst->config.name, cache_xlat, NULL, NULL, 0, 0, true);
 
+	/*
+	 *	And the counter xlat, for drivers which support atomic
+	 *	increments.
+	 */
+	if (inst->driver->incr) {
+		char *incr_name;
+
+		incr_name = talloc_asprintf(inst, "%s_incr", inst->config.name);
+		if (!incr_name) return -1;
+
+		xlat_register(inst, incr_name, cache_incr_xlat, NULL, NULL, 0, 0, true);
+	}
+
 	return 0;
 }
 
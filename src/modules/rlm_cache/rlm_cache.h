@@ -205,6 +205,44 @@ typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config
 						 REQUEST *request, void *handle,
 						 rlm_cache_entry_t *c);
 
+/** Atomically add a delta to an integer counter
+ *
+ * Counters live in their own namespace, separate from the map entries
+ * accessed via #cache_entry_find_t, though drivers with a flat key space
+ * (like Redis) may share it, in which case the same key should not be
+ * used for both.
+ *
+ * If no counter exists for the key, the driver must create one with an
+ * initial value of zero before applying the delta.  The counter's expiry
+ * time is set to expires on every call, so the window slides with use.
+ *
+ * The load, modification, and store must be atomic with respect to other
+ * workers (and for network datastores, other servers), as removing the
+ * read-modify-write cycle is the entire point of this callback.
+ *
+ * @note This callback is optional.  If it's not provided, the increment
+ *	 xlat registered by rlm_cache will error out.
+ *
+ * @param[out] out Where to write the post-increment value of the counter.
+ * @param[in] config for this instance of the rlm_cache module.
+ * @param[in] instance Driver specific instance data.
+ * @param[in] request The current request.
+ * @param[in] handle the driver gave us when we called #cache_acquire_t, or NULL if no
+ *	#cache_acquire_t callback was provided.
+ * @param[in] key identifying the counter.
+ * @param[in] key_len the length of the key string.
+ * @param[in] delta to add to the counter, may be negative.
+ * @param[in] expires when the counter should expire.
+ * @return
+ *	- #CACHE_RECONNECT - If handle needs to be reinitialised/reconnected.
+ *	- #CACHE_ERROR - If the counter couldn't be updated.
+ *	- #CACHE_OK - If the counter was updated.
+ */
+typedef cache_status_t	(*cache_entry_incr_t)(int64_t *out, rlm_cache_config_t const *config, void *instance,
+					      REQUEST *request, void *handle,
+					      uint8_t const *key, size_t key_len,
+					      int64_t delta, time_t expires);
+
 /** Get the number of entries in the cache
  *
  * @note This callback is optional. Though max_entries will not be enforced if it is not provided.
@@ -275,6 +313,7 @@ struct cache_driver {
 	cache_entry_insert_t		insert;			//!< Add a new entry.
 	cache_entry_expire_t		expire;			//!< Remove an old entry.
 	cache_entry_set_ttl_t		set_ttl;		//!< (Optional) Update the TTL of an entry.
+	cache_entry_incr_t		incr;			//!< (Optional) Atomically increment a counter.
 	cache_entry_count_t		count;			//!< (Optional) Number of entries currently in
 								//!< the cache.
 
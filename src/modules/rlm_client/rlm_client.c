@@ -67,7 +67,7 @@ static int _map_proc_client_get_vp(TALLOC_CTX *ctx, VALUE_PAIR **out, REQUEST *r
 			return -1;
 		}
 
-		da = fr_dict_attr_by_name(request->dict, attr);
+		da = fr_dict_attr_by_name_cached(request->dict, attr);
 		if (!da) {
 			RWDEBUG("No such attribute '%s'", attr);
 			talloc_free(attr);
@@ -60,7 +60,7 @@ static const CONF_PARSER module_config[] = {
  */
 static void _delay_done(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx, fr_time_t fired)
 {
-	fr_time_t *yielded = talloc_get_type_abort(rctx, fr_time_t);
+	fr_time_t *yielded = rctx;
 
 	RDEBUG2("Delay done");
 
@@ -125,13 +125,12 @@ static int delay_add(REQUEST *request, fr_time_t *resume_at, fr_time_t now,
  */
 static rlm_rcode_t mod_delay_return(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
 {
-	fr_time_t *yielded = talloc_get_type_abort(rctx, fr_time_t);
+	fr_time_t *yielded = rctx;
 
 	/*
 	 *	Print how long the delay *really* was.
 	 */
 	RDEBUG3("Request delayed by %pV", fr_box_time_delta(fr_time() - *yielded));
-	talloc_free(yielded);
 
 	return RLM_MODULE_OK;
 }
@@ -160,9 +159,11 @@ static rlm_rcode_t CC_HINT(nonnull) mod_delay(void *instance, UNUSED void *threa
 	}
 
 	/*
-	 *	Record the time that we yielded the request
+	 *	Record the time that we yielded the request.  The
+	 *	resume context lives in the module's stack frame, so
+	 *	no allocation is needed.
 	 */
-	MEM(yielded_at = talloc(request, fr_time_t));
+	MEM(yielded_at = unlang_module_rctx_alloc(request, sizeof(fr_time_t)));
 	*yielded_at = fr_time();
 
 	/*
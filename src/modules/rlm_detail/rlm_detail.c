@@ -33,6 +33,7 @@ RCSID("$Id$")
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #ifdef HAVE_UNISTD_H
@@ -62,11 +63,23 @@ typedef struct {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	bool		batch;		//!< Keep the file open, and flush entries in batches.
+	size_t		batch_size;	//!< Accumulate this much output between writes.
+	fr_time_delta_t	batch_timeout;	//!< Flush at least this often, however little is buffered.
+
+	size_t		rotate_size;	//!< Rotate the file when it grows past this.  0 disables.
+	uint32_t	rotate_age;	//!< Rotate the file after this many seconds.  0 disables.
+
 	xlat_escape_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
 
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
+
+	pthread_mutex_t	batch_mutex;	//!< Serialises access to the persistent file handle.
+	FILE		*batch_fp;	//!< Persistent output handle, in batch mode.
+	char		*batch_filename; //!< Filename batch_fp was opened with.
+	fr_time_t	batch_last_flush; //!< When we last flushed batched entries.
 } rlm_detail_t;
 
 static const CONF_PARSER module_config[] = {
@@ -77,6 +90,11 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("batch", FR_TYPE_BOOL, rlm_detail_t, batch), .dflt = "no" },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_SIZE, rlm_detail_t, batch_size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("batch_timeout", FR_TYPE_TIME_DELTA, rlm_detail_t, batch_timeout), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("rotate_size", FR_TYPE_SIZE, rlm_detail_t, rotate_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("rotate_age", FR_TYPE_UINT32, rlm_detail_t, rotate_age), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -124,6 +142,11 @@ static int mod_detach(void *instance)
 {
 	rlm_detail_t *inst = instance;
 
+	if (inst->batch) {
+		if (inst->batch_fp) fclose(inst->batch_fp);	/* flushes any buffered entries */
+		pthread_mutex_destroy(&inst->batch_mutex);
+	}
+
 	if (inst->ht) fr_hash_table_free(inst->ht);
 	return 0;
 }
@@ -166,6 +189,31 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->rotate_size || inst->rotate_age) {
+		if (!inst->locking) {
+			cf_log_err(conf, "'rotate_size' and 'rotate_age' require 'locking = yes'");
+			return -1;
+		}
+		exfile_enable_rotation(inst->ef, inst->rotate_size, inst->rotate_age);
+	}
+
+	/*
+	 *	In batch mode we're the only writer, and hold the file
+	 *	open across packets.  That can't be combined with
+	 *	advisory locking, which assumes open / lock / write /
+	 *	close around every entry.
+	 */
+	if (inst->batch) {
+		if (inst->locking) {
+			cf_log_err(conf, "'locking' cannot be used with 'batch'");
+			return -1;
+		}
+
+		if (inst->batch_size < 1024) inst->batch_size = 1024;
+
+		pthread_mutex_init(&inst->batch_mutex, NULL);
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -377,10 +425,112 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	return 0;
 }
 
+/** Append a detail entry to a persistent file handle
+ *
+ *  The handle is opened once and kept open, with a stdio buffer of
+ *  batch_size bytes, so entries reach the kernel in large batched
+ *  writes instead of one set of open/write/close syscalls per record.
+ *  A timeout bounds how long a buffered entry can sit in memory when
+ *  traffic is light.
+ *
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request.
+ * @param[in] compat Write out entry in compatibility mode.
+ * @param[in] filename the expanded detail file name.
+ */
+static rlm_rcode_t detail_do_batch(rlm_detail_t *inst, REQUEST *request, RADIUS_PACKET *packet,
+				   bool compat, char const *filename)
+{
+	fr_time_t now = fr_time();
+
+	pthread_mutex_lock(&inst->batch_mutex);
+
+	/*
+	 *	The expanded filename changed (e.g. it contains a date
+	 *	which rolled over).  Flush what we have, and re-open.
+	 */
+	if (inst->batch_fp && (strcmp(inst->batch_filename, filename) != 0)) {
+		fclose(inst->batch_fp);
+		inst->batch_fp = NULL;
+		TALLOC_FREE(inst->batch_filename);
+	}
+
+	if (!inst->batch_fp) {
+		int fd;
+
+		fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, inst->perm);
+		if (fd < 0) {
+			RERROR("Couldn't open file %s: %s", filename, fr_syserror(errno));
+		fail:
+			pthread_mutex_unlock(&inst->batch_mutex);
+			return RLM_MODULE_FAIL;
+		}
+
+		inst->batch_fp = fdopen(fd, "a");
+		if (!inst->batch_fp) {
+			RERROR("Couldn't open file %s: %s", filename, fr_syserror(errno));
+			close(fd);
+			goto fail;
+		}
+
+		/*
+		 *	Entries accumulate in the stdio buffer, and are
+		 *	written out in batch_size chunks as it fills.
+		 */
+		(void) setvbuf(inst->batch_fp, NULL, _IOFBF, inst->batch_size);
+
+#ifdef HAVE_GRP_H
+		if (inst->group) {
+			gid_t	gid;
+			char	*endptr;
+
+			gid = strtol(inst->group, &endptr, 10);
+			if ((*endptr != '\0') && (rad_getgid(request, &gid, inst->group) < 0)) {
+				RDEBUG2("Unable to find system group '%s'", inst->group);
+			} else if (chown(filename, -1, gid) == -1) {
+				RDEBUG2("Unable to change system group of '%s'", filename);
+			}
+		}
+#endif
+
+		inst->batch_filename = talloc_typed_strdup(inst, filename);
+		inst->batch_last_flush = now;
+	}
+
+	if (detail_write(inst->batch_fp, inst, request, packet, compat) < 0) {
+	error:
+		/*
+		 *	The handle is in an unknown state.  Close it,
+		 *	and re-open on the next entry.
+		 */
+		fclose(inst->batch_fp);
+		inst->batch_fp = NULL;
+		TALLOC_FREE(inst->batch_filename);
+		goto fail;
+	}
+
+	/*
+	 *	The timeout bounds how stale the tail of the file can
+	 *	be when there isn't enough traffic to fill the buffer.
+	 */
+	if ((now - inst->batch_last_flush) >= inst->batch_timeout) {
+		if (fflush(inst->batch_fp) != 0) {
+			RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+			goto error;
+		}
+		inst->batch_last_flush = now;
+	}
+
+	pthread_mutex_unlock(&inst->batch_mutex);
+
+	return RLM_MODULE_OK;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
-static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *request,
+static rlm_rcode_t CC_HINT(nonnull) detail_do(void *instance, REQUEST *request,
 					      RADIUS_PACKET *packet, bool compat)
 {
 	int		outfd, dupfd;
@@ -393,7 +543,7 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 	char		*endptr;
 #endif
 
-	rlm_detail_t const *inst = instance;
+	rlm_detail_t *inst = instance;
 
 	/*
 	 *	Generate the path for the detail file.  Use the same
@@ -406,6 +556,8 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 
 	RDEBUG2("%s expands to %s", inst->filename, buffer);
 
+	if (inst->batch) return detail_do_batch(inst, request, packet, compat, buffer);
+
 	outfd = exfile_open(inst->ef, request, buffer, inst->perm);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %s", buffer);
@@ -35,6 +35,7 @@ RCSID("$Id$")
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/module.h>
+#include <ctype.h>
 #include "rlm_eap.h"
 
 extern module_t rlm_eap;
@@ -477,6 +478,94 @@ static rlm_rcode_t mod_authenticate_result_async(void *instance, void *thread, R
 	return mod_authenticate_result(request, instance, thread, eap_session, eap_session->submodule_rcode);
 }
 
+/** Check if an EAP-Identity hints at a method we have enabled
+ *
+ * EAP-SIM/EAP-AKA/EAP-AKA' identities (RFC 4186/4187/5448) carry a leading
+ * tag byte identifying both the method, and whether this is a permanent
+ * identity, a pseudonym, or a fast re-auth identity.
+ *
+ * Starting the default method for these identities costs a wasted
+ * session_init, a NAK from the supplicant, and a full extra round trip
+ * before the right method starts.  Fast re-auth is particularly latency
+ * sensitive, as the whole point of it is to skip the full authentication.
+ *
+ * @param[in] inst		Configuration data for this instance of rlm_eap.
+ * @param[in] eap_session	containing the identity to inspect.
+ * @return
+ *	- The hinted EAP method, if it's enabled.
+ *	- FR_EAP_METHOD_INVALID if the identity doesn't hint at one.
+ */
+static eap_type_t eap_identity_method_hint(rlm_eap_t *inst, eap_session_t *eap_session)
+{
+	char const	*identity = eap_session->identity;
+	size_t		len = talloc_array_length(identity) - 1;
+	char const	*p, *end;
+	eap_type_t	method;
+	bool		permanent = false;
+
+	if (len < 2) return FR_EAP_METHOD_INVALID;
+
+	switch (identity[0]) {
+	case '1':	/* Permanent (IMSI) */
+		permanent = true;
+		/* FALL-THROUGH */
+	case '3':	/* Pseudonym */
+	case '5':	/* Fast re-auth */
+		method = FR_EAP_METHOD_SIM;
+		break;
+
+	case '0':	/* Permanent (IMSI) */
+		permanent = true;
+		/* FALL-THROUGH */
+	case '2':	/* Pseudonym */
+	case '4':	/* Fast re-auth */
+		method = FR_EAP_METHOD_AKA;
+		break;
+
+	case '6':	/* Permanent (IMSI) */
+		permanent = true;
+		/* FALL-THROUGH */
+	case '7':	/* Pseudonym */
+	case '8':	/* Fast re-auth */
+		method = FR_EAP_METHOD_AKA_PRIME;
+		break;
+
+	default:
+		return FR_EAP_METHOD_INVALID;
+	}
+
+	if (!inst->methods[method].submodule) return FR_EAP_METHOD_INVALID;
+
+	/*
+	 *	Verify the user portion looks like what the tag promises,
+	 *	so ordinary user names which happen to start with a digit
+	 *	don't get pushed into the wrong method.  Permanent
+	 *	identities are an IMSI, pseudonyms and fast re-auth
+	 *	identities are opaque machine generated tokens.  Final
+	 *	validation is left to the method, which falls back to a
+	 *	full authentication on any mismatch.
+	 */
+	p = identity + 1;
+	end = memchr(p, '@', len - 1);
+	if (!end) end = identity + len;
+
+	if (permanent) {
+		/*
+		 *	An IMSI is 14-15 decimal digits.
+		 */
+		if (((end - p) < 14) || ((end - p) > 15)) return FR_EAP_METHOD_INVALID;
+		while (p < end) if (!isdigit((int) *(uint8_t const *)p++)) return FR_EAP_METHOD_INVALID;
+	} else {
+		while (p < end) {
+			if (!isalnum((int) *(uint8_t const *)p) &&
+			    (*p != '+') && (*p != '/') && (*p != '=')) return FR_EAP_METHOD_INVALID;
+			p++;
+		}
+	}
+
+	return method;
+}
+
 /** Select the correct callback based on a response
  *
  * Based on the EAP response from the supplicant, and setup a call on the
@@ -547,6 +636,23 @@ static rlm_rcode_t eap_method_select(rlm_eap_t *inst, UNUSED void *thread, eap_s
 		if (vp) {
 			RDEBUG2("Using method from &control:EAP-Type");
 			next = vp->vp_uint32;
+		/*
+		 *	No admin override.  If the identity is tagged as
+		 *	EAP-SIM/AKA/AKA', start that method directly instead
+		 *	of starting the default method and waiting for the
+		 *	supplicant to NAK it.  For fast re-auth identities
+		 *	this saves a full round trip on what's meant to be
+		 *	the fast path.
+		 */
+		} else {
+			eap_type_t hinted;
+
+			hinted = eap_identity_method_hint(inst, eap_session);
+			if (hinted != FR_EAP_METHOD_INVALID) {
+				RDEBUG2("Identity hints at EAP type %s, starting it directly",
+					eap_type2name(hinted));
+				next = hinted;
+			}
 		}
 
 		/*
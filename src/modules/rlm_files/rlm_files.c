@@ -36,34 +36,34 @@ typedef struct rlm_files_t {
 	vp_tmpl_t *key;
 
 	char const *filename;
-	rbtree_t *common;
+	fr_hash_table_t *common;
 
 	/* autz */
 	char const *usersfile;
-	rbtree_t *users;
+	fr_hash_table_t *users;
 
 
 	/* authenticate */
 	char const *auth_usersfile;
-	rbtree_t *auth_users;
+	fr_hash_table_t *auth_users;
 
 	/* preacct */
 	char const *acct_usersfile;
-	rbtree_t *acct_users;
+	fr_hash_table_t *acct_users;
 
 #ifdef WITH_PROXY
 	/* pre-proxy */
 	char const *preproxy_usersfile;
-	rbtree_t *preproxy_users;
+	fr_hash_table_t *preproxy_users;
 
 	/* post-proxy */
 	char const *postproxy_usersfile;
-	rbtree_t *postproxy_users;
+	fr_hash_table_t *postproxy_users;
 #endif
 
 	/* post-authenticate */
 	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
+	fr_hash_table_t *postauth_users;
 } rlm_files_t;
 
 static fr_dict_t *dict_freeradius;
@@ -111,19 +111,24 @@ static const CONF_PARSER module_config[] = {
 };
 
 
+static uint32_t pairlist_hash(void const *data)
+{
+	return fr_hash_string(((PAIR_LIST const *)data)->name);
+}
+
 static int pairlist_cmp(void const *a, void const *b)
 {
 	return strcmp(((PAIR_LIST const *)a)->name, ((PAIR_LIST const *)b)->name);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_hash_table_t **ptree)
 {
 	int rcode;
 	VALUE_PAIR *vp;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
 	PAIR_LIST *user_list, *default_list, **default_tail;
-	rbtree_t *tree;
+	fr_hash_table_t *tree;
 
 	if (!filename) {
 		*ptree = NULL;
@@ -205,7 +210,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		entry = entry->next;
 	}
 
-	tree = rbtree_create(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
+	tree = fr_hash_table_create(ctx, pairlist_hash, pairlist_cmp, NULL);
 	if (!tree) {
 		pairlist_free(&users);
 		return -1;
@@ -236,7 +241,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 				/*
 				 *	Insert the first DEFAULT into the tree.
 				 */
-				if (!rbtree_insert(tree, entry)) {
+				if (!fr_hash_table_insert(tree, entry)) {
 				error:
 					pairlist_free(&entry);
 					pairlist_free(&next);
@@ -259,12 +264,12 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		/*
 		 *	Not DEFAULT, must be a normal user.
 		 */
-		user_list = rbtree_finddata(tree, entry);
+		user_list = fr_hash_table_finddata(tree, entry);
 		if (!user_list) {
 			/*
 			 *	Insert the first one.
 			 */
-			if (!rbtree_insert(tree, entry)) goto error;
+			if (!fr_hash_table_insert(tree, entry)) goto error;
 		} else {
 			/*
 			 *	Find the tail of this list, and add it
@@ -311,7 +316,7 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 /*
  *	Common code called by everything below.
  */
-static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char const *filename, rbtree_t *tree,
+static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char const *filename, fr_hash_table_t *tree,
 			       RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet)
 {
 	char const	*name;
@@ -330,9 +335,9 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 	if (!tree) return RLM_MODULE_NOOP;
 
 	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
+	user_pl = fr_hash_table_finddata(tree, &my_pl);
 	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	default_pl = fr_hash_table_finddata(tree, &my_pl);
 
 	/*
 	 *	Find the entry for the user.
@@ -0,0 +1,2 @@
+TARGET		:= rlm_interim_dedup.a
+SOURCES		:= rlm_interim_dedup.c
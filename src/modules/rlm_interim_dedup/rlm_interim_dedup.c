@@ -0,0 +1,350 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_interim_dedup.c
+ * @brief Detect Interim-Update packets which carry no new information.
+ *
+ * Most NAS send Interim-Update packets on a fixed timer, whether or not
+ * the session counters have moved.  This module keeps a digest of the
+ * last update seen for each session, and returns "ok" when a new update
+ * is identical to the previous one.  The policy can then acknowledge
+ * the packet immediately, instead of writing an unchanged row to the
+ * database.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <pthread.h>
+
+typedef struct {
+	char const		*name;		//!< Instance name.
+
+	vp_tmpl_t		*key;		//!< What to expand to get the session key.
+	uint32_t		timeout;	//!< How long before an entry expires (seconds).
+	uint32_t		max_entries;	//!< Maximum number of sessions we track.
+
+	rbtree_t		*tree;		//!< Session key -> digest of the last update.
+	pthread_mutex_t		mutex;		//!< Protect the tree from multiple readers/writers.
+} rlm_interim_dedup_t;
+
+/** Digest of the last Interim-Update seen for one session
+ *
+ */
+typedef struct {
+	uint8_t const		*key;		//!< Expanded session key.
+	size_t			key_len;	//!< Length of the session key.
+	uint32_t		digest;		//!< Hash of the non-volatile accounting attributes.
+	time_t			expires;	//!< When this entry may be reclaimed.
+} interim_dedup_entry_t;
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_interim_dedup_t, key) },
+	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, rlm_interim_dedup_t, timeout), .dflt = "600" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_interim_dedup_t, max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t *dict_radius;
+
+extern fr_dict_autoload_t rlm_interim_dedup_dict[];
+fr_dict_autoload_t rlm_interim_dedup_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_acct_status_type;
+static fr_dict_attr_t const *attr_acct_delay_time;
+static fr_dict_attr_t const *attr_acct_session_time;
+static fr_dict_attr_t const *attr_event_timestamp;
+
+extern fr_dict_attr_autoload_t rlm_interim_dedup_dict_attr[];
+fr_dict_attr_autoload_t rlm_interim_dedup_dict_attr[] = {
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_delay_time, .name = "Acct-Delay-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_session_time, .name = "Acct-Session-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius },
+	{ NULL }
+};
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int interim_dedup_entry_cmp(void const *one, void const *two)
+{
+	interim_dedup_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Hash the accounting attributes which carry session state
+ *
+ * Attributes which change with every packet (timestamps and the session
+ * duration) are excluded, so two updates which only differ by "time has
+ * passed" produce the same digest.
+ *
+ * @param[in] request	the current request.
+ * @return a digest of the request's accounting attributes.
+ */
+static uint32_t interim_dedup_digest(REQUEST *request)
+{
+	uint32_t	hash;
+	VALUE_PAIR	*vp;
+	fr_cursor_t	cursor;
+	char		buffer[1024];
+	size_t		len;
+
+	hash = fr_hash(&request->packet->code, sizeof(request->packet->code));
+
+	for (vp = fr_cursor_init(&cursor, &request->packet->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if ((vp->da == attr_acct_delay_time) ||
+		    (vp->da == attr_acct_session_time) ||
+		    (vp->da == attr_event_timestamp)) continue;
+
+		/*
+		 *	Dictionary attributes are interned, so hashing
+		 *	the pointer is sufficient to distinguish them
+		 *	within one lifetime of the server.
+		 */
+		hash = fr_hash_update(&vp->da, sizeof(vp->da), hash);
+
+		len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, '\0');
+		hash = fr_hash_update(buffer, len, hash);
+	}
+
+	return hash;
+}
+
+/** Reclaim an entry if it has expired
+ *
+ * @param[in] data	entry to check.
+ * @param[in] uctx	the current time (time_t *).
+ * @return
+ *	- 2 if the entry was reclaimed.
+ *	- 0 if the entry is still live.
+ */
+static int _interim_dedup_entry_expire(void *data, void *uctx)
+{
+	interim_dedup_entry_t *entry = data;
+	time_t now = *((time_t *) uctx);
+
+	if (entry->expires > now) return 0;
+
+	talloc_free(entry);
+
+	return 2;
+}
+
+/** Walk over the tree, freeing all entries
+ *
+ * Used on detach.
+ *
+ * @param[in] data	entry to free.
+ * @param[in] uctx	unused.
+ * @return 2
+ */
+static int _interim_dedup_entry_free(void *data, UNUSED void *uctx)
+{
+	talloc_free(data);
+
+	return 2;
+}
+
+/** Check whether this Interim-Update matches the previous one
+ *
+ * @return
+ *	- #RLM_MODULE_OK if the update is identical to the last one we saw.
+ *	- #RLM_MODULE_NOOP if the update carries new information, or is not
+ *	  an Interim-Update.
+ *	- #RLM_MODULE_FAIL if the key could not be expanded.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_interim_dedup_t	*inst = talloc_get_type_abort(instance, rlm_interim_dedup_t);
+	interim_dedup_entry_t	*entry;
+	VALUE_PAIR		*vp;
+	uint32_t		digest;
+	time_t			now;
+
+	uint8_t			buffer[1024];
+	uint8_t const		*key;
+	ssize_t			key_len;
+
+	vp = fr_pair_find_by_da(request->packet->vps, attr_acct_status_type, TAG_ANY);
+	if (!vp) return RLM_MODULE_NOOP;
+
+	key_len = tmpl_expand((char const **)&key, (char *)buffer, sizeof(buffer),
+			      request, inst->key, NULL, NULL);
+	if (key_len < 0) return RLM_MODULE_FAIL;
+
+	if (key_len == 0) {
+		REDEBUG("Zero length key string is invalid");
+		return RLM_MODULE_INVALID;
+	}
+
+	now = fr_time_to_sec(request->packet->timestamp);
+
+	switch (vp->vp_uint32) {
+	case FR_STATUS_ALIVE:
+		break;
+
+	/*
+	 *	The session is over, stop tracking it.  Stop packets
+	 *	always carry final counters, so they're never duplicates
+	 *	of an update.
+	 */
+	case FR_STATUS_STOP:
+	case FR_STATUS_ACCOUNTING_ON:
+	case FR_STATUS_ACCOUNTING_OFF:
+		pthread_mutex_lock(&inst->mutex);
+		entry = rbtree_finddata(inst->tree, &(interim_dedup_entry_t){ .key = key, .key_len = key_len });
+		if (entry) {
+			rbtree_deletebydata(inst->tree, entry);
+			talloc_free(entry);
+		}
+		pthread_mutex_unlock(&inst->mutex);
+		return RLM_MODULE_NOOP;
+
+	default:
+		return RLM_MODULE_NOOP;
+	}
+
+	digest = interim_dedup_digest(request);
+
+	pthread_mutex_lock(&inst->mutex);
+
+	entry = rbtree_finddata(inst->tree, &(interim_dedup_entry_t){ .key = key, .key_len = key_len });
+	if (entry) {
+		if ((entry->expires > now) && (entry->digest == digest)) {
+			entry->expires = now + inst->timeout;
+			pthread_mutex_unlock(&inst->mutex);
+
+			RDEBUG2("Interim-Update carries no new information");
+			return RLM_MODULE_OK;
+		}
+
+		entry->digest = digest;
+		entry->expires = now + inst->timeout;
+		pthread_mutex_unlock(&inst->mutex);
+
+		return RLM_MODULE_NOOP;
+	}
+
+	/*
+	 *	Reclaim expired sessions lazily, and only when we'd
+	 *	otherwise refuse to track a new one.
+	 */
+	if (rbtree_num_elements(inst->tree) >= inst->max_entries) {
+		rbtree_walk(inst->tree, RBTREE_DELETE_ORDER, _interim_dedup_entry_expire, &now);
+
+		if (rbtree_num_elements(inst->tree) >= inst->max_entries) {
+			pthread_mutex_unlock(&inst->mutex);
+
+			RWDEBUG("Not tracking session, already tracking %u sessions", inst->max_entries);
+			return RLM_MODULE_NOOP;
+		}
+	}
+
+	entry = talloc_zero(NULL, interim_dedup_entry_t);
+	if (!entry) {
+		pthread_mutex_unlock(&inst->mutex);
+		return RLM_MODULE_FAIL;
+	}
+	entry->key = talloc_memdup(entry, key, key_len);
+	if (!entry->key) {
+		talloc_free(entry);
+		pthread_mutex_unlock(&inst->mutex);
+		return RLM_MODULE_FAIL;
+	}
+	entry->key_len = key_len;
+	entry->digest = digest;
+	entry->expires = now + inst->timeout;
+
+	if (!rbtree_insert(inst->tree, entry)) {
+		talloc_free(entry);
+		pthread_mutex_unlock(&inst->mutex);
+		return RLM_MODULE_FAIL;
+	}
+
+	pthread_mutex_unlock(&inst->mutex);
+
+	return RLM_MODULE_NOOP;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_interim_dedup_t *inst = talloc_get_type_abort(instance, rlm_interim_dedup_t);
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	inst->tree = rbtree_talloc_create(NULL, interim_dedup_entry_cmp, interim_dedup_entry_t, NULL, 0);
+	if (!inst->tree) {
+		ERROR("Failed to create session tree");
+		return -1;
+	}
+	talloc_link_ctx(inst, inst->tree);
+
+	if (pthread_mutex_init(&inst->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_interim_dedup_t *inst = talloc_get_type_abort(instance, rlm_interim_dedup_t);
+
+	if (inst->tree) rbtree_walk(inst->tree, RBTREE_DELETE_ORDER, _interim_dedup_entry_free, NULL);
+
+	pthread_mutex_destroy(&inst->mutex);
+
+	return 0;
+}
+
+/*
+ *	The module name should be the only globally exported symbol.
+ *	That is, everything else should be 'static'.
+ */
+extern module_t rlm_interim_dedup;
+module_t rlm_interim_dedup = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "interim_dedup",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_interim_dedup_t),
+	.config		= module_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.methods = {
+		[MOD_PREACCT]		= mod_accounting,
+		[MOD_ACCOUNTING]	= mod_accounting
+	},
+};
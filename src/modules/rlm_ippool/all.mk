@@ -0,0 +1,3 @@
+TARGETNAME	:= rlm_ippool
+TARGET		:= $(TARGETNAME).a
+SOURCES		:= $(TARGETNAME).c
@@ -0,0 +1,773 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_ippool.c
+ * @brief Allocates an IPv4 address from an in-memory pool.
+ *
+ * Unlike rlm_sqlippool, the entire pool lives in process memory, so an
+ * allocation is a mutex, a hash lookup and a stack pop rather than a
+ * series of SQL round trips.  Leases can optionally be journalled to a
+ * flat file so they survive a restart.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "rlm_ippool (%s) - "
+#define LOG_PREFIX_ARGS inst->pool_name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <pthread.h>
+
+/** One allocated lease
+ *
+ *  Leases are owned by exactly one shard, keyed by the expanded owner
+ *  key, and sit on that shard's expiry list.  Because every lease gets
+ *  the same lease_duration, appending renewals to the tail of the
+ *  expiry list keeps it sorted, and reclaiming expired leases is just
+ *  popping the head.
+ */
+typedef struct {
+	uint32_t	index;		//!< Offset of the address within the pool range.
+	char const	*owner;		//!< Expanded owner key the lease was issued to.
+	time_t		expires;	//!< When the lease may be reclaimed.
+	fr_dlist_t	entry;		//!< Entry in the shard's expiry list.
+} rlm_ippool_lease_t;
+
+/** One slice of the pool, with its own lock
+ *
+ *  The shard is chosen by hashing the owner key, and each shard owns a
+ *  contiguous slice of the address range.  The same owner therefore
+ *  always lands on the same shard, so renewals are sticky and an
+ *  allocation only ever takes one lock.  The cost is that the slices
+ *  fill unevenly, so the range should be a little larger than the
+ *  expected number of concurrent leases.
+ */
+typedef struct {
+	pthread_mutex_t	mutex;
+	TALLOC_CTX	*ctx;		//!< Leases are parented here, so each shard's
+					///< talloc hierarchy is only ever touched under
+					///< its own mutex.
+	fr_hash_table_t	*owners;	//!< Owner key -> lease.
+	fr_dlist_head_t	expiry;		//!< Leases in expiry order, oldest first.
+	uint32_t	*free_stack;	//!< LIFO of never-or-no-longer leased indexes.
+	uint32_t	num_free;
+	uint32_t	base;		//!< First index of this shard's slice.
+	uint32_t	size;		//!< Number of addresses in the slice.
+} rlm_ippool_shard_t;
+
+/*
+ *	Define a structure for our module configuration.
+ */
+typedef struct {
+	char const	*pool_name;
+
+	fr_ipaddr_t	range_start;		//!< First address in the pool.
+	fr_ipaddr_t	range_end;		//!< Last address in the pool (inclusive).
+	uint32_t	lease_duration;
+	uint32_t	num_shards;
+
+	char const	*attribute_name;	//!< name of the IP address attribute
+	fr_dict_attr_t const *framed_ip_address; //!< the attribute for IP address allocation
+
+	char const	*key;			//!< xlat expanded to the owner key.
+
+	char const	*journal_name;		//!< Optional lease journal.
+
+						/* Logging Section */
+	char const	*log_exists;		//!< There was an ip address already assigned.
+	char const	*log_success;		//!< We successfully allocated ip address from pool.
+	char const	*log_clear;		//!< We successfully deallocated ip address from pool.
+	char const	*log_failed;		//!< Failed to allocate ip from the pool.
+	char const	*log_nopool;		//!< There was no Framed-IP-Address but also no Pool-Name.
+
+	uint32_t	range_base;		//!< range_start in host byte order.
+	uint32_t	range_size;		//!< Number of addresses in the pool.
+	rlm_ippool_shard_t *shards;
+	FILE		*journal;		//!< Open journal, appends are buffered.
+} rlm_ippool_t;
+
+static CONF_PARSER message_config[] = {
+	{ FR_CONF_OFFSET("exists", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_ippool_t, log_exists) },
+	{ FR_CONF_OFFSET("success", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_ippool_t, log_success) },
+	{ FR_CONF_OFFSET("clear", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_ippool_t, log_clear) },
+	{ FR_CONF_OFFSET("failed", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_ippool_t, log_failed) },
+	{ FR_CONF_OFFSET("nopool", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_ippool_t, log_nopool) },
+	CONF_PARSER_TERMINATOR
+};
+
+static CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("range_start", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_ippool_t, range_start) },
+	{ FR_CONF_OFFSET("range_end", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_ippool_t, range_end) },
+
+	{ FR_CONF_OFFSET("lease_duration", FR_TYPE_UINT32, rlm_ippool_t, lease_duration), .dflt = "86400" },
+
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_ippool_t, num_shards), .dflt = "16" },
+
+	{ FR_CONF_OFFSET("attribute_name", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_ippool_t, attribute_name), .dflt = "Framed-IP-Address" },
+
+	{ FR_CONF_OFFSET("key", FR_TYPE_STRING | FR_TYPE_XLAT | FR_TYPE_REQUIRED, rlm_ippool_t, key), .dflt = "%{Calling-Station-Id}" },
+
+	{ FR_CONF_OFFSET("journal", FR_TYPE_FILE_OUTPUT, rlm_ippool_t, journal_name) },
+
+	{ FR_CONF_POINTER("messages", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) message_config },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t *dict_freeradius;
+static fr_dict_t *dict_radius;
+
+extern fr_dict_autoload_t rlm_ippool_dict[];
+fr_dict_autoload_t rlm_ippool_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_pool_name;
+static fr_dict_attr_t const *attr_module_success_message;
+static fr_dict_attr_t const *attr_acct_status_type;
+
+extern fr_dict_attr_autoload_t rlm_ippool_dict_attr[];
+fr_dict_attr_autoload_t rlm_ippool_dict_attr[] = {
+	{ .out = &attr_module_success_message, .name = "Module-Success-Message", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
+	{ .out = &attr_pool_name, .name = "Pool-Name", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+
+	{ NULL }
+};
+
+static uint32_t lease_hash(void const *data)
+{
+	rlm_ippool_lease_t const *lease = data;
+
+	return fr_hash_string(lease->owner);
+}
+
+static int lease_cmp(void const *one, void const *two)
+{
+	rlm_ippool_lease_t const *a = one;
+	rlm_ippool_lease_t const *b = two;
+
+	return strcmp(a->owner, b->owner);
+}
+
+/** Pick the shard responsible for an owner key
+ */
+static rlm_ippool_shard_t *shard_by_owner(rlm_ippool_t *inst, char const *owner)
+{
+	return &inst->shards[fr_hash_string(owner) % inst->num_shards];
+}
+
+/** Print the address at the given pool offset
+ */
+static char *ippool_index_ntop(rlm_ippool_t *inst, uint32_t index, char out[FR_IPADDR_STRLEN])
+{
+	fr_ipaddr_t ipaddr;
+
+	ipaddr = inst->range_start;
+	ipaddr.addr.v4.s_addr = htonl(inst->range_base + index);
+
+	return fr_inet_ntop(out, FR_IPADDR_STRLEN, &ipaddr);
+}
+
+/** Append a lease operation to the journal
+ *
+ * Appends are write-behind.  stdio buffers them, and the buffer is
+ * only forced out when it fills, or when the module is unloaded.  A
+ * crash can therefore lose the tail of the journal, which costs us
+ * nothing worse than handing those owners a different address.
+ */
+static void ippool_journal_log(rlm_ippool_t *inst, rlm_ippool_lease_t const *lease, bool alloc)
+{
+	char buffer[FR_IPADDR_STRLEN];
+
+	if (!inst->journal) return;
+
+	if (alloc) {
+		fprintf(inst->journal, "alloc %s %" PRIu64 " %s\n",
+			ippool_index_ntop(inst, lease->index, buffer),
+			(uint64_t) lease->expires, lease->owner);
+	} else {
+		fprintf(inst->journal, "free %s\n", lease->owner);
+	}
+}
+
+/** Create a lease and index it
+ *
+ * Must be called with the shard mutex held.  The index must have
+ * already been removed from the free stack (or reclaimed).
+ */
+static rlm_ippool_lease_t *lease_create(rlm_ippool_shard_t *shard, uint32_t index,
+					char const *owner, time_t expires)
+{
+	rlm_ippool_lease_t *lease;
+
+	lease = talloc_zero(shard->ctx, rlm_ippool_lease_t);
+	if (!lease) return NULL;
+
+	lease->index = index;
+	lease->owner = talloc_typed_strdup(lease, owner);
+	if (!lease->owner) {
+		talloc_free(lease);
+		return NULL;
+	}
+	lease->expires = expires;
+
+	if (!fr_hash_table_insert(shard->owners, lease)) {
+		talloc_free(lease);
+		return NULL;
+	}
+	fr_dlist_insert_tail(&shard->expiry, lease);
+
+	return lease;
+}
+
+/** Remove a lease from the shard's indexes and free it
+ *
+ * Must be called with the shard mutex held.  The address index is
+ * returned to the caller, who decides whether it goes back on the free
+ * stack or is immediately re-issued.
+ */
+static uint32_t lease_destroy(rlm_ippool_shard_t *shard, rlm_ippool_lease_t *lease)
+{
+	uint32_t index = lease->index;
+
+	fr_hash_table_delete(shard->owners, lease);
+	fr_dlist_remove(&shard->expiry, lease);
+	talloc_free(lease);
+
+	return index;
+}
+
+/** Allocate (or renew) an address for an owner
+ *
+ * @param[in] inst	of rlm_ippool.
+ * @param[in] owner	expanded owner key.
+ * @param[out] index_p	offset of the allocated address within the range.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the shard's slice is exhausted.
+ */
+static int ippool_allocate(rlm_ippool_t *inst, char const *owner, uint32_t *index_p)
+{
+	rlm_ippool_shard_t	*shard = shard_by_owner(inst, owner);
+	rlm_ippool_lease_t	*lease, find = { .owner = owner };
+	uint32_t		index;
+	time_t			now = time(NULL);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	/*
+	 *	Renewal.  The owner keeps the address it already has,
+	 *	which keeps DHCP clients happy, and just moves to the
+	 *	tail of the expiry list.
+	 */
+	lease = fr_hash_table_finddata(shard->owners, &find);
+	if (lease) {
+		lease->expires = now + inst->lease_duration;
+		fr_dlist_remove(&shard->expiry, lease);
+		fr_dlist_insert_tail(&shard->expiry, lease);
+		goto done;
+	}
+
+	/*
+	 *	Prefer a never-used (or explicitly freed) address...
+	 */
+	if (shard->num_free > 0) {
+		index = shard->free_stack[--shard->num_free];
+
+	/*
+	 *	...otherwise reclaim the longest-expired lease.  The
+	 *	expiry list is sorted, so if the head hasn't expired,
+	 *	nothing has.
+	 */
+	} else {
+		lease = fr_dlist_head(&shard->expiry);
+		if (!lease || (lease->expires > now)) {
+			pthread_mutex_unlock(&shard->mutex);
+			return -1;
+		}
+		index = lease_destroy(shard, lease);
+	}
+
+	lease = lease_create(shard, index, owner, now + inst->lease_duration);
+	if (!lease) {
+		shard->free_stack[shard->num_free++] = index;
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
+	}
+
+done:
+	*index_p = lease->index;
+	ippool_journal_log(inst, lease, true);
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return 0;
+}
+
+/** Renew an existing lease without allocating
+ *
+ * @return
+ *	- 0 if the owner held a lease.
+ *	- -1 if it didn't.
+ */
+static int ippool_renew(rlm_ippool_t *inst, char const *owner)
+{
+	rlm_ippool_shard_t	*shard = shard_by_owner(inst, owner);
+	rlm_ippool_lease_t	*lease, find = { .owner = owner };
+	int			ret = -1;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	lease = fr_hash_table_finddata(shard->owners, &find);
+	if (lease) {
+		lease->expires = time(NULL) + inst->lease_duration;
+		fr_dlist_remove(&shard->expiry, lease);
+		fr_dlist_insert_tail(&shard->expiry, lease);
+		ippool_journal_log(inst, lease, true);
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Release the lease held by an owner
+ *
+ * @return
+ *	- 0 if a lease was released.
+ *	- -1 if the owner held no lease.
+ */
+static int ippool_release(rlm_ippool_t *inst, char const *owner)
+{
+	rlm_ippool_shard_t	*shard = shard_by_owner(inst, owner);
+	rlm_ippool_lease_t	*lease, find = { .owner = owner };
+	int			ret = -1;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	lease = fr_hash_table_finddata(shard->owners, &find);
+	if (lease) {
+		ippool_journal_log(inst, lease, false);
+		shard->free_stack[shard->num_free++] = lease_destroy(shard, lease);
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Replay one journal line
+ *
+ * Runs single threaded at instantiation, so no locking.  Lines which
+ * no longer match the configured range or shard layout are skipped,
+ * the owner simply loses its sticky address.
+ */
+static void ippool_journal_replay_line(rlm_ippool_t *inst, char *line)
+{
+	char			*p;
+	rlm_ippool_shard_t	*shard;
+	rlm_ippool_lease_t	*lease, find;
+
+	p = strchr(line, '\n');
+	if (p) *p = '\0';
+
+	if (strncmp(line, "alloc ", 6) == 0) {
+		char		*ip_str = line + 6, *expires_str, *owner;
+		fr_ipaddr_t	ipaddr;
+		uint32_t	addr, index, i;
+
+		expires_str = strchr(ip_str, ' ');
+		if (!expires_str) return;
+		*expires_str++ = '\0';
+
+		owner = strchr(expires_str, ' ');
+		if (!owner) return;
+		*owner++ = '\0';
+
+		if (fr_inet_pton4(&ipaddr, ip_str, -1, false, false, false) < 0) return;
+
+		addr = ntohl(ipaddr.addr.v4.s_addr);
+		if ((addr < inst->range_base) || ((addr - inst->range_base) >= inst->range_size)) return;
+		index = addr - inst->range_base;
+
+		shard = shard_by_owner(inst, owner);
+		if ((index < shard->base) || (index >= (shard->base + shard->size))) return;
+
+		/*
+		 *	A renewal of a lease we've already replayed.
+		 *	The journal is written in time order, so just
+		 *	bumping the expiry and moving the lease to the
+		 *	tail keeps the expiry list sorted.
+		 */
+		find.owner = owner;
+		lease = fr_hash_table_finddata(shard->owners, &find);
+		if (lease) {
+			if (lease->index != index) return;
+
+			lease->expires = (time_t) strtoull(expires_str, NULL, 10);
+			fr_dlist_remove(&shard->expiry, lease);
+			fr_dlist_insert_tail(&shard->expiry, lease);
+			return;
+		}
+
+		/*
+		 *	Pull the index off the free stack.  O(n), but
+		 *	only at startup.
+		 */
+		for (i = 0; i < shard->num_free; i++) {
+			if (shard->free_stack[i] == index) break;
+		}
+		if (i == shard->num_free) return;	/* already leased to someone else */
+		shard->free_stack[i] = shard->free_stack[--shard->num_free];
+
+		lease = lease_create(shard, index, owner, (time_t) strtoull(expires_str, NULL, 10));
+		if (!lease) shard->free_stack[shard->num_free++] = index;
+
+	} else if (strncmp(line, "free ", 5) == 0) {
+		find.owner = line + 5;
+
+		shard = shard_by_owner(inst, find.owner);
+		lease = fr_hash_table_finddata(shard->owners, &find);
+		if (lease) shard->free_stack[shard->num_free++] = lease_destroy(shard, lease);
+	}
+}
+
+/** Replay the journal, then compact it
+ *
+ * The journal is append only, so it accumulates a line per renewal.
+ * After replaying we rewrite it to contain only the live leases, and
+ * keep the handle open for subsequent appends.
+ */
+static int ippool_journal_open(rlm_ippool_t *inst, CONF_SECTION *conf)
+{
+	FILE		*fp;
+	char		line[1024];
+	uint32_t	i;
+
+	fp = fopen(inst->journal_name, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp) != NULL) ippool_journal_replay_line(inst, line);
+		fclose(fp);
+	} else if (errno != ENOENT) {
+		cf_log_err(conf, "Failed opening journal file \"%s\": %s", inst->journal_name,
+			   fr_syserror(errno));
+		return -1;
+	}
+
+	inst->journal = fopen(inst->journal_name, "w");
+	if (!inst->journal) {
+		cf_log_err(conf, "Failed creating journal file \"%s\": %s", inst->journal_name,
+			   fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < inst->num_shards; i++) {
+		rlm_ippool_lease_t *lease;
+
+		for (lease = fr_dlist_head(&inst->shards[i].expiry);
+		     lease;
+		     lease = fr_dlist_next(&inst->shards[i].expiry, lease)) {
+			ippool_journal_log(inst, lease, true);
+		}
+	}
+	fflush(inst->journal);
+
+	return 0;
+}
+
+/*
+ *	Carve the range up into per-shard slices, and set up the
+ *	journal if one was configured.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_ippool_t	*inst = instance;
+	char const	*pool_name = NULL;
+	uint32_t	start, end, base, i;
+
+	pool_name = cf_section_name2(conf);
+	if (pool_name != NULL) {
+		inst->pool_name = talloc_typed_strdup(inst, pool_name);
+	} else {
+		inst->pool_name = talloc_typed_strdup(inst, "ippool");
+	}
+
+	if (fr_dict_attr_by_qualified_name(&inst->framed_ip_address,
+					   dict_freeradius, inst->attribute_name, false) != FR_DICT_ATTR_OK) {
+		cf_log_perr(conf, "Failed resolving attribute");
+		return -1;
+	}
+
+	if (inst->framed_ip_address->type != FR_TYPE_IPV4_ADDR) {
+		cf_log_err(conf, "Cannot use non-IPv4 attributes for 'attribute_name = %s'", inst->attribute_name);
+		return -1;
+	}
+
+	if ((inst->range_start.af != AF_INET) || (inst->range_end.af != AF_INET)) {
+		cf_log_err(conf, "'range_start' and 'range_end' must be IPv4 addresses");
+		return -1;
+	}
+
+	start = ntohl(inst->range_start.addr.v4.s_addr);
+	end = ntohl(inst->range_end.addr.v4.s_addr);
+	if (end < start) {
+		cf_log_err(conf, "'range_end' must not be before 'range_start'");
+		return -1;
+	}
+
+	inst->range_base = start;
+	inst->range_size = (end - start) + 1;
+
+	if (inst->num_shards == 0) inst->num_shards = 1;
+	if (inst->num_shards > inst->range_size) inst->num_shards = inst->range_size;
+
+	inst->shards = talloc_zero_array(inst, rlm_ippool_shard_t, inst->num_shards);
+	if (!inst->shards) return -1;
+
+	base = 0;
+	for (i = 0; i < inst->num_shards; i++) {
+		rlm_ippool_shard_t *shard = &inst->shards[i];
+		uint32_t j;
+
+		shard->base = base;
+		shard->size = inst->range_size / inst->num_shards;
+		if (i < (inst->range_size % inst->num_shards)) shard->size++;
+		base += shard->size;
+
+		pthread_mutex_init(&shard->mutex, NULL);
+
+		shard->ctx = talloc_init("rlm_ippool shard");
+		if (!shard->ctx) return -1;
+
+		shard->owners = fr_hash_table_create(shard->ctx, lease_hash, lease_cmp, NULL);
+		if (!shard->owners) return -1;
+
+		fr_dlist_init(&shard->expiry, rlm_ippool_lease_t, entry);
+
+		shard->free_stack = talloc_array(shard->ctx, uint32_t, shard->size);
+		if (!shard->free_stack) return -1;
+
+		/*
+		 *	Descending, so the pool hands out ascending
+		 *	addresses.  Mostly useful for debugging.
+		 */
+		for (j = shard->size; j > 0; j--) shard->free_stack[shard->num_free++] = shard->base + j - 1;
+	}
+
+	if (inst->journal_name && (ippool_journal_open(inst, conf) < 0)) return -1;
+
+	return 0;
+}
+
+/*
+ *	Flush the journal, and tear down the per-shard state.
+ */
+static int mod_detach(void *instance)
+{
+	rlm_ippool_t	*inst = instance;
+	uint32_t	i;
+
+	if (inst->journal) {
+		fclose(inst->journal);
+		inst->journal = NULL;
+	}
+
+	if (inst->shards) for (i = 0; i < inst->num_shards; i++) {
+		pthread_mutex_destroy(&inst->shards[i].mutex);
+		TALLOC_FREE(inst->shards[i].ctx);
+	}
+
+	return 0;
+}
+
+/*
+ *	If we have something to log, then we log it.
+ *	Otherwise we return the retcode as soon as possible
+ */
+static int do_logging(REQUEST *request, char const *str, int rcode)
+{
+	char		*expanded = NULL;
+	VALUE_PAIR	*vp;
+
+	if (!str || !*str) return rcode;
+
+	if (xlat_aeval(request, &expanded, request, str, NULL, NULL) < 0) return rcode;
+
+	MEM(pair_add_request(&vp, attr_module_success_message) == 0);
+	fr_pair_value_strsteal(vp, expanded);
+
+	return rcode;
+}
+
+/** Expand the owner key for this request
+ *
+ * @return
+ *	- The expanded key (talloced off the request).
+ *	- NULL if the expansion failed or was empty.
+ */
+static char *ippool_get_owner(rlm_ippool_t *inst, REQUEST *request)
+{
+	char *owner = NULL;
+
+	if (xlat_aeval(request, &owner, request, inst->key, NULL, NULL) < 0) return NULL;
+
+	if (!*owner) {
+		RDEBUG2("Expansion of 'key' (%s) was empty, owners cannot be distinguished", inst->key);
+		talloc_free(owner);
+		return NULL;
+	}
+
+	return owner;
+}
+
+/*
+ *	Allocate an IP number from the pool.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_ippool_t	*inst = instance;
+	char		buffer[FR_IPADDR_STRLEN];
+	char		*owner;
+	uint32_t	index;
+	VALUE_PAIR	*vp;
+
+	/*
+	 *	If there is a Framed-IP-Address attribute in the reply do nothing
+	 */
+	if (fr_pair_find_by_da(request->reply->vps, inst->framed_ip_address, TAG_ANY) != NULL) {
+		RDEBUG2("%s already exists", inst->attribute_name);
+
+		return do_logging(request, inst->log_exists, RLM_MODULE_NOOP);
+	}
+
+	vp = fr_pair_find_by_da(request->control, attr_pool_name, TAG_ANY);
+	if (!vp) {
+		RDEBUG2("No Pool-Name defined");
+
+		return do_logging(request, inst->log_nopool, RLM_MODULE_NOOP);
+	}
+
+	/*
+	 *	The pool may be handled by another instance of this
+	 *	module (or by sqlippool), so an unknown name is not an
+	 *	error.
+	 */
+	if (strcmp(vp->vp_strvalue, inst->pool_name) != 0) {
+		RDEBUG2("Pool-Name \"%s\" is not mine", vp->vp_strvalue);
+		return RLM_MODULE_NOOP;
+	}
+
+	owner = ippool_get_owner(inst, request);
+	if (!owner) return do_logging(request, inst->log_failed, RLM_MODULE_NOOP);
+
+	if (ippool_allocate(inst, owner, &index) < 0) {
+		RDEBUG2("Pool appears to be full");
+		return do_logging(request, inst->log_failed, RLM_MODULE_NOTFOUND);
+	}
+
+	MEM(vp = fr_pair_afrom_da(request->reply, inst->framed_ip_address));
+	vp->vp_ip = inst->range_start;
+	vp->vp_ipv4addr = htonl(inst->range_base + index);
+
+	RDEBUG2("Allocated IP %s", ippool_index_ntop(inst, index, buffer));
+	fr_pair_add(&request->reply->vps, vp);
+
+	return do_logging(request, inst->log_success, RLM_MODULE_OK);
+}
+
+/*
+ *	Check for an Accounting-Stop.  If we find one and we have
+ *	allocated an IP to this owner, then deallocate it.  Start and
+ *	Alive packets renew the lease.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_ippool_t	*inst = instance;
+	VALUE_PAIR	*vp;
+	char		*owner;
+	rlm_rcode_t	rcode;
+
+	vp = fr_pair_find_by_da(request->packet->vps, attr_acct_status_type, TAG_ANY);
+	if (!vp) {
+		RDEBUG2("Could not find account status type in packet");
+		return RLM_MODULE_NOOP;
+	}
+
+	switch (vp->vp_uint32) {
+	case FR_STATUS_START:
+	case FR_STATUS_ALIVE:
+	case FR_STATUS_STOP:
+		break;		/* continue through to the next section */
+
+	/*
+	 *	We don't track which NAS a lease was issued through,
+	 *	so Accounting-On/Off can't selectively clear leases.
+	 *	They expire naturally after lease_duration instead.
+	 */
+	default:
+		return RLM_MODULE_NOOP;
+	}
+
+	owner = ippool_get_owner(inst, request);
+	if (!owner) return RLM_MODULE_NOOP;
+
+	if (vp->vp_uint32 == FR_STATUS_STOP) {
+		if (ippool_release(inst, owner) < 0) {
+			RDEBUG2("No lease found for this owner");
+			return RLM_MODULE_NOOP;
+		}
+
+		rcode = do_logging(request, inst->log_clear, RLM_MODULE_OK);
+	} else {
+		if (ippool_renew(inst, owner) < 0) {
+			RDEBUG2("No lease found for this owner");
+			return RLM_MODULE_NOOP;
+		}
+
+		rcode = RLM_MODULE_OK;
+	}
+
+	return rcode;
+}
+
+/*
+ *	The module name should be the only globally exported symbol.
+ *	That is, everything else should be 'static'.
+ */
+extern module_t rlm_ippool;
+module_t rlm_ippool = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "ippool",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_ippool_t),
+	.config		= module_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.methods = {
+		[MOD_ACCOUNTING]	= mod_accounting,
+		[MOD_POST_AUTH]		= mod_post_auth
+	},
+};
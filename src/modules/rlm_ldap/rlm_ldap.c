@@ -608,7 +608,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 	if (check_is_dn) {
 		char *norm;
 
-		MEM(norm = talloc_memdup(check, check->vp_strvalue, talloc_array_length(check->vp_strvalue)));
+		MEM(norm = talloc_memdup(check, check->vp_strvalue, check->vp_length + 1));
 		fr_ldap_util_normalise_dn(norm, check->vp_strvalue);
 		fr_pair_value_strsteal(check, norm);
 	}
@@ -83,6 +83,11 @@ typedef struct {
 	char const			*delimiter;		//!< Line termination string (usually \n).
 	size_t				delimiter_len;		//!< Length of line termination string.
 
+	size_t				buffer_depth;		//!< Lines to queue per destination before flushing
+								///< them with a single writev().  0 disables batching.
+	fr_time_delta_t			flush_timeout;		//!< Maximum time a queued line will wait before
+								///< being flushed.
+
 	vp_tmpl_t			*log_src;		//!< Source of log messages.
 
 	vp_tmpl_t			*log_ref;		//!< Path to a #CONF_PAIR (to use as the source of
@@ -122,6 +127,32 @@ typedef struct {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
 
+/** Lines queued for a single destination
+ *
+ * File destinations get one queue per expanded filename, socket
+ * destinations only ever have one queue (with a NULL path).
+ */
+typedef struct {
+	char			*path;			//!< Expanded filename (NULL for socket destinations).
+	struct iovec		*vector;		//!< Queued lines and delimiters.  The copies of the
+							///< line data are parented by this array.
+	size_t			vector_len;		//!< Number of entries used.
+	size_t			lines;			//!< Number of complete lines queued.
+} linelog_queue_t;
+
+/** Per-thread queues used to batch up writes
+ *
+ * Only allocated/used when buffer_depth > 0.
+ */
+typedef struct {
+	linelog_instance_t const *inst;			//!< Instance of linelog.
+	fr_event_list_t		*el;			//!< This thread's event list (for the flush timer).
+	fr_event_timer_t const	*ev;			//!< Pending flush timer.
+	linelog_queue_t		**queues;		//!< One queue per destination.
+} linelog_thread_t;
+
+static void linelog_flush_all(linelog_thread_t *t);
+
 
 static const CONF_PARSER file_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_XLAT, linelog_instance_t, file.name) },
@@ -160,6 +191,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("destination", FR_TYPE_STRING | FR_TYPE_REQUIRED, linelog_instance_t, log_dst_str) },
 
 	{ FR_CONF_OFFSET("delimiter", FR_TYPE_STRING, linelog_instance_t, delimiter), .dflt = "\n" },
+	{ FR_CONF_OFFSET("buffer_depth", FR_TYPE_SIZE, linelog_instance_t, buffer_depth), .dflt = "0" },
+	{ FR_CONF_OFFSET("flush_timeout", FR_TYPE_TIME_DELTA, linelog_instance_t, flush_timeout), .dflt = "0.1" },
 	{ FR_CONF_OFFSET("format", FR_TYPE_TMPL, linelog_instance_t, log_src) },
 	{ FR_CONF_OFFSET("reference", FR_TYPE_TMPL, linelog_instance_t, log_ref) },
 
@@ -312,6 +345,22 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 	snprintf(prefix, sizeof(prefix), "rlm_linelog (%s)", inst->name);
 
+	/*
+	 *	Syslog writes line at a time, so there's nothing
+	 *	to batch.  Keep the vector per flush comfortably
+	 *	under IOV_MAX (each line may also need a delimiter
+	 *	entry).
+	 */
+	if (inst->buffer_depth > 0) {
+		if (inst->log_dst == LINELOG_DST_SYSLOG) {
+			cf_log_warn(conf, "Ignoring 'buffer_depth', syslog destinations cannot be batched");
+			inst->buffer_depth = 0;
+		} else {
+			FR_SIZE_BOUND_CHECK("buffer_depth", inst->buffer_depth, <=, (size_t)500);
+			FR_TIME_DELTA_BOUND_CHECK("flush_timeout", inst->flush_timeout, >=, (fr_time_delta_t)(NSEC / 1000));
+		}
+	}
+
 	/*
 	 *	Setup the logging destination
 	 */
@@ -405,6 +454,43 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Create thread-specific queues
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of linelog.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return 0.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	linelog_instance_t	*inst = instance;
+	linelog_thread_t	*t = talloc_get_type_abort(thread, linelog_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	if (inst->buffer_depth > 0) MEM(t->queues = talloc_array(t, linelog_queue_t *, 0));
+
+	return 0;
+}
+
+/** Flush any queued lines before the thread exits
+ *
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return 0.
+ */
+static int mod_thread_detach(fr_event_list_t *el, void *thread)
+{
+	linelog_thread_t	*t = talloc_get_type_abort(thread, linelog_thread_t);
+
+	if (t->ev) fr_event_timer_delete(el, &t->ev);
+	linelog_flush_all(t);
+
+	return 0;
+}
+
 /** Escape unprintable characters
  *
  * - Newline is escaped as ``\\n``.
@@ -435,6 +521,265 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
 	return fr_snprint(out, outlen, in, -1, 0);
 }
 
+/** Find (or create) the queue for a destination
+ *
+ * @param[in] t		Thread instance holding the queues.
+ * @param[in] path	Expanded filename, or NULL for socket destinations.
+ * @return
+ *	- The queue for this destination.
+ *	- NULL on allocation failure.
+ */
+static linelog_queue_t *linelog_queue_find(linelog_thread_t *t, char const *path)
+{
+	linelog_queue_t	*queue;
+	size_t		i, num;
+
+	num = talloc_array_length(t->queues);
+	for (i = 0; i < num; i++) {
+		queue = t->queues[i];
+
+		if (!path) {
+			if (!queue->path) return queue;
+			continue;
+		}
+		if (queue->path && (strcmp(queue->path, path) == 0)) return queue;
+	}
+
+	MEM(queue = talloc_zero(t, linelog_queue_t));
+	if (path) MEM(queue->path = talloc_strdup(queue, path));
+	MEM(queue->vector = talloc_array(queue, struct iovec, t->inst->buffer_depth * 2));
+
+	MEM(t->queues = talloc_realloc(t, t->queues, linelog_queue_t *, num + 1));
+	t->queues[num] = queue;
+
+	return queue;
+}
+
+/** Flush any lines queued for a destination
+ *
+ * Writes all the queued lines with a single writev(), so files take
+ * the exfile lock once per flush, and sockets see one send per flush.
+ *
+ * @param[in] t		Thread instance holding the queues.
+ * @param[in] request	The current request, may be NULL when flushing
+ *			from a timer or on thread exit.
+ * @param[in] queue	to flush.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we failed writing.
+ */
+static int linelog_queue_flush(linelog_thread_t *t, REQUEST *request, linelog_queue_t *queue)
+{
+	linelog_instance_t const	*inst = t->inst;
+	fr_time_delta_t			timeout = 0;
+	linelog_conn_t			*conn;
+	int				ret = 0;
+
+	if (queue->vector_len == 0) return 0;
+
+	switch (inst->log_dst) {
+	case LINELOG_DST_FILE:
+	{
+		int fd;
+
+		fd = exfile_open(inst->file.ef, request, queue->path, inst->file.permissions);
+		if (fd < 0) {
+			ROPTIONAL(RERROR, ERROR, "Failed to open %s: %s", queue->path, fr_syserror(errno));
+			ret = -1;
+			break;
+		}
+
+		if (inst->file.group_str && (chown(queue->path, -1, inst->file.group) == -1)) {
+			ROPTIONAL(RWARN, WARN, "Unable to change system group of \"%s\": %s",
+				  queue->path, fr_strerror());
+		}
+
+		if (writev(fd, queue->vector, queue->vector_len) < 0) {
+			ROPTIONAL(RERROR, ERROR, "Failed writing to \"%s\": %s", queue->path, fr_syserror(errno));
+			ret = -1;
+
+			/* Assert on the extra fatal errors */
+			rad_assert((errno != EINVAL) && (errno != EFAULT));
+		}
+
+		exfile_close(inst->file.ef, request, fd);
+	}
+		break;
+
+	case LINELOG_DST_UNIX:
+		if (inst->unix_sock.timeout) timeout = inst->unix_sock.timeout;
+		goto do_write;
+
+	case LINELOG_DST_UDP:
+		if (inst->udp.timeout) timeout = inst->udp.timeout;
+		goto do_write;
+
+	case LINELOG_DST_TCP:
+	{
+		int i, num;
+
+		if (inst->tcp.timeout) timeout = inst->tcp.timeout;
+
+	do_write:
+		num = fr_pool_state(inst->pool)->num;
+		conn = fr_pool_connection_get(inst->pool, request);
+		if (!conn) {
+			ret = -1;
+			break;
+		}
+
+		for (i = num; i >= 0; i--) {
+			ssize_t wrote;
+			char discard[64];
+
+			wrote = fr_writev(conn->sockfd, queue->vector, queue->vector_len, timeout);
+			if (wrote < 0) switch (errno) {
+			/* Errors that indicate we should reconnect */
+			case EDESTADDRREQ:
+			case EPIPE:
+			case EBADF:
+			case ECONNRESET:
+			case ENETDOWN:
+			case ENETUNREACH:
+			case EADDRNOTAVAIL: /* Which is OSX for outbound interface is down? */
+				ROPTIONAL(RWARN, WARN, "Failed writing to socket: %s.  "
+					  "Will reconnect and try again...", fr_syserror(errno));
+				conn = fr_pool_connection_reconnect(inst->pool, request, conn);
+				if (!conn) {
+					ret = -1;
+					goto done;
+				}
+				continue;
+
+			/* Assert on the extra fatal errors */
+			case EINVAL:
+			case EFAULT:
+				rad_assert(0);
+				/* FALL-THROUGH */
+
+			/* Normal errors that just cause the module to fail */
+			default:
+				ROPTIONAL(RERROR, ERROR, "Failed writing to socket: %s", fr_syserror(errno));
+				ret = -1;
+				goto done;
+			}
+			ROPTIONAL(RDEBUG2, DEBUG2, "Wrote %zi bytes", wrote);
+
+			/* Drain the receive buffer */
+			while (read(conn->sockfd, discard, sizeof(discard)) > 0);
+			break;
+		}
+	done:
+		fr_pool_connection_release(inst->pool, request, conn);
+	}
+		break;
+
+	case LINELOG_DST_SYSLOG:
+	case LINELOG_DST_INVALID:
+		rad_assert(0);
+		ret = -1;
+		break;
+	}
+
+	/*
+	 *	The queued line copies are parented by the vector,
+	 *	so this frees them too.
+	 */
+	talloc_free(queue->vector);
+	MEM(queue->vector = talloc_array(queue, struct iovec, inst->buffer_depth * 2));
+	queue->vector_len = 0;
+	queue->lines = 0;
+
+	return ret;
+}
+
+/** Flush all the destination queues for a thread
+ *
+ * Called from the flush timer, and on thread exit.
+ */
+static void linelog_flush_all(linelog_thread_t *t)
+{
+	size_t i;
+
+	for (i = 0; i < talloc_array_length(t->queues); i++) (void) linelog_queue_flush(t, NULL, t->queues[i]);
+}
+
+/** Flush timer fired, push out any queued lines
+ *
+ * @param[in] el	the event timer was inserted into.
+ * @param[in] now	The current time.
+ * @param[in] uctx	A #linelog_thread_t.
+ */
+static void _linelog_flush_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	linelog_thread_t *t = talloc_get_type_abort(uctx, linelog_thread_t);
+
+	linelog_flush_all(t);
+}
+
+/** Add line(s) to the queue for a destination
+ *
+ * The line data is copied, as it's owned by the request, which will
+ * likely be freed before the queue is flushed.
+ *
+ * Flushes the queue once it holds buffer_depth lines.  Otherwise the
+ * lines are flushed when the flush_timeout timer fires.
+ *
+ * @param[in] t		Thread instance holding the queues.
+ * @param[in] request	The current request.
+ * @param[in] path	Expanded filename, or NULL for socket destinations.
+ * @param[in] vector	Line(s) to queue, as built for writev().
+ * @param[in] vector_len Number of entries in vector.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we failed queueing or flushing.
+ */
+static int linelog_enqueue(linelog_thread_t *t, REQUEST *request, char const *path,
+			   struct iovec const *vector, size_t vector_len)
+{
+	linelog_instance_t const	*inst = t->inst;
+	linelog_queue_t			*queue;
+	bool				with_delim;
+	size_t				i, used;
+
+	queue = linelog_queue_find(t, path);
+	if (!queue) return -1;
+
+	used = queue->vector_len;
+	if ((used + vector_len) > talloc_array_length(queue->vector)) {
+		MEM(queue->vector = talloc_realloc(queue, queue->vector, struct iovec, used + vector_len));
+	}
+
+	for (i = 0; i < vector_len; i++) {
+		uint8_t *data;
+
+		MEM(data = talloc_memdup(queue->vector, vector[i].iov_base, vector[i].iov_len));
+		queue->vector[used + i].iov_base = data;
+		queue->vector[used + i].iov_len = vector[i].iov_len;
+	}
+	queue->vector_len = used + vector_len;
+
+	with_delim = (inst->log_dst != LINELOG_DST_SYSLOG) && (inst->delimiter_len > 0);
+	queue->lines += with_delim ? (vector_len / 2) : vector_len;
+
+	RDEBUG2("Queued %zu line(s) for batched write", queue->lines);
+
+	if (queue->lines >= inst->buffer_depth) return linelog_queue_flush(t, request, queue);
+
+	/*
+	 *	Bound how long a line can sit in the queue.  The
+	 *	event core clears t->ev before running the callback,
+	 *	so a fresh timer is started for the next batch.
+	 */
+	if (!t->ev && (fr_event_timer_in(t, t->el, &t->ev, inst->flush_timeout,
+					 _linelog_flush_timeout, t) < 0)) {
+		RERROR("Failed inserting flush timer, flushing immediately");
+		return linelog_queue_flush(t, request, queue);
+	}
+
+	return 0;
+}
+
 /** Write a linelog message
  *
  * Write a log message to syslog or a flat file.
@@ -447,8 +792,8 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
  *	- #RLM_MODULE_FAIL if we failed writing the message.
  *	- #RLM_MODULE_OK on success.
  */
-static rlm_rcode_t mod_do_linelog(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_do_linelog(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_do_linelog(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_do_linelog(void *instance, void *thread, REQUEST *request)
 {
 	linelog_conn_t		*conn;
 	fr_time_delta_t		timeout = 0;
@@ -629,6 +974,40 @@ build_vector:
 		goto finish;
 	}
 
+	/*
+	 *	Queue the line(s) for a batched flush, instead of
+	 *	writing them out synchronously.
+	 */
+	if (inst->buffer_depth > 0) {
+		linelog_thread_t	*t = talloc_get_type_abort(thread, linelog_thread_t);
+		char			path[2048];
+		char const		*path_p = NULL;
+
+		if (inst->log_dst == LINELOG_DST_FILE) {
+			if (xlat_eval(path, sizeof(path), request, inst->file.name,
+				      inst->file.escape_func, NULL) < 0) {
+				rcode = RLM_MODULE_FAIL;
+				goto finish;
+			}
+
+			/* check path and eventually create subdirs */
+			p = strrchr(path, '/');
+			if (p) {
+				*p = '\0';
+				if (fr_file_mkdir(NULL, path, -1, 0700) < 0) {
+					RERROR("Failed to create directory %s: %s", path, fr_syserror(errno));
+					rcode = RLM_MODULE_FAIL;
+					goto finish;
+				}
+				*p = '/';
+			}
+			path_p = path;
+		}
+
+		if (linelog_enqueue(t, request, path_p, vector_p, vector_len) < 0) rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
 	/*
 	 *	Reserve a handle, write out the data, close the handle
 	 */
@@ -783,12 +1162,16 @@ finish:
  */
 extern module_t rlm_linelog;
 module_t rlm_linelog = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "linelog",
-	.inst_size	= sizeof(linelog_instance_t),
-	.config		= module_config,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "linelog",
+	.inst_size		= sizeof(linelog_instance_t),
+	.thread_inst_size	= sizeof(linelog_thread_t),
+	.thread_inst_type	= "linelog_thread_t",
+	.config			= module_config,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_do_linelog,
 		[MOD_AUTHORIZE]		= mod_do_linelog,
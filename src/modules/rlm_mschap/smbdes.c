@@ -26,8 +26,10 @@
 
 /* NOTES:
 
-   This code makes no attempt to be fast! In fact, it is a very
-   slow implementation
+   When OpenSSL is available, the DES operations below are performed
+   with its EVP interface, which uses whatever acceleration the CPU
+   provides.  The bitwise implementation is only compiled as a
+   fallback, and makes no attempt to be fast.
 
    This code is NOT a complete DES implementation. It implements only
    the minimum necessary for SMB authentication, as used by all SMB
@@ -55,6 +57,117 @@ RCSID("$Id$")
 
 #define uchar unsigned char
 
+/*
+ *	Expand a 7 byte key into the 8 byte, odd parity, form DES
+ *	expects.
+ */
+static void str_to_key(unsigned char const *str, unsigned char *key)
+{
+	int i;
+
+	key[0] = str[0]>>1;
+	key[1] = ((str[0]&0x01)<<6) | (str[1]>>2);
+	key[2] = ((str[1]&0x03)<<5) | (str[2]>>3);
+	key[3] = ((str[2]&0x07)<<4) | (str[3]>>4);
+	key[4] = ((str[3]&0x0F)<<3) | (str[4]>>5);
+	key[5] = ((str[4]&0x1F)<<2) | (str[5]>>6);
+	key[6] = ((str[5]&0x3F)<<1) | (str[6]>>7);
+	key[7] = str[6]&0x7F;
+	for (i=0;i<8;i++) {
+		key[i] = (key[i]<<1);
+	}
+}
+
+#ifdef HAVE_OPENSSL_EVP_H
+#  include <openssl/evp.h>
+#  include <freeradius-devel/util/thread_local.h>
+
+fr_thread_local_setup(EVP_CIPHER_CTX *, smbdes_evp_ctx)
+
+static void _smbdes_ctx_free_on_exit(void *arg)
+{
+	EVP_CIPHER_CTX_free(arg);
+}
+
+/** Perform one DES block operation using OpenSSL
+ *
+ * The cipher context is thread local, so the three DES operations which
+ * make up an MS-CHAP response reuse the same context, and repeated
+ * authentications in the same thread never pay for context setup.
+ *
+ * @param[out] out 8 byte output block.
+ * @param[in] in 8 byte input block.
+ * @param[in] key7 56 bit (7 byte) key.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int smbdes_hash_evp(unsigned char *out, unsigned char const *in, unsigned char const *key7)
+{
+	EVP_CIPHER_CTX *ctx;
+	unsigned char key[8];
+	int len;
+
+	if (unlikely(!smbdes_evp_ctx)) {
+		ctx = EVP_CIPHER_CTX_new();
+		if (unlikely(!ctx)) return -1;
+		fr_thread_local_set_destructor(smbdes_evp_ctx, _smbdes_ctx_free_on_exit, ctx);
+	} else {
+		ctx = smbdes_evp_ctx;
+	}
+
+	str_to_key(key7, key);
+
+	if (unlikely(EVP_EncryptInit_ex(ctx, EVP_des_ecb(), NULL, key, NULL) != 1)) return -1;
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+	if (unlikely(EVP_EncryptUpdate(ctx, out, &len, in, 8) != 1)) return -1;
+
+	return 0;
+}
+
+void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
+{
+	if (smbdes_hash_evp(out, in, key) < 0) memset(out, 0, 8);
+}
+
+/*
+ *	Converts the password to uppercase, and creates the LM
+ *	password hash.
+ */
+void smbdes_lmpwdhash(char const *password, uint8_t *lmhash)
+{
+	int i;
+	uint8_t p14[14];
+	static uint8_t sp8[8] = {0x4b, 0x47, 0x53, 0x21, 0x40, 0x23, 0x24, 0x25};
+
+	memset(p14, 0, sizeof(p14));
+	for (i = 0; i < 14 && password[i]; i++) {
+		p14[i] = toupper((int) password[i]);
+	}
+
+	smbhash(lmhash, sp8, p14);
+	smbhash(lmhash+8, sp8, p14+7);
+}
+
+/*
+ *	Take the NT or LM password, and return the MSCHAP response
+ *
+ *	The win_password MUST be exactly 16 bytes long.
+ */
+void smbdes_mschap(uint8_t const win_password[16],
+		 uint8_t const *challenge, uint8_t *response)
+{
+	uint8_t p21[21];
+
+	memset(p21, 0, sizeof(p21));
+	memcpy(p21, win_password, 16);
+
+	smbhash(response, challenge, p21);
+	smbhash(response+8, challenge, p21+7);
+	smbhash(response+16, challenge, p21+14);
+}
+
+#else
 static const uchar perm1[56] = {57, 49, 41, 33, 25, 17,  9,
 			 1, 58, 50, 42, 34, 26, 18,
 			10,  2, 59, 51, 43, 35, 27,
@@ -186,19 +299,57 @@ static void xor(char *out, char *in1, char *in2, int n)
 		out[i] = in1[i] ^ in2[i];
 }
 
-static void dohash(char *out, char *in, char *key)
+/*
+ *	Expand an 8 byte block into the one-bit-per-char form the
+ *	permutations operate on.
+ */
+static void des_bits_in(char *inb, unsigned char const *in)
 {
-	int i, j, k;
+	int i;
+
+	for (i=0;i<64;i++) {
+		inb[i] = (in[i/8] & (1<<(7-(i%8)))) ? 1 : 0;
+	}
+}
+
+/*
+ *	Pack the one-bit-per-char form back into an 8 byte block.
+ */
+static void des_bits_out(unsigned char *out, char const *outb)
+{
+	int i;
+
+	for (i=0;i<8;i++) {
+		out[i] = 0;
+	}
+
+	for (i=0;i<64;i++) {
+		if (outb[i])
+			out[i/8] |= (1<<(7-(i%8)));
+	}
+}
+
+/*
+ *	Compute the sixteen round subkeys from a 56 bit (7 byte) key.
+ *
+ *	This is the expensive half of a DES operation, so it's kept
+ *	separate from the rounds below.  Callers hashing the same
+ *	input under several keys only expand the input once.
+ */
+static void des_key_sched(char ki[16][48], unsigned char const *key7)
+{
+	int i;
+	unsigned char key2[8];
+	char keyb[64];
 	char pk1[56];
 	char c[28];
 	char d[28];
 	char cd[56];
-	char ki[16][48];
-	char pd1[64];
-	char l[32], r[32];
-	char rl[64];
 
-	permute(pk1, key, perm1, 56);
+	str_to_key(key7, key2);
+	des_bits_in(keyb, key2);
+
+	permute(pk1, keyb, perm1, 56);
 
 	for (i=0;i<28;i++)
 		c[i] = pk1[i];
@@ -212,6 +363,14 @@ static void dohash(char *out, char *in, char *key)
 		concat(cd, c, d, 28, 28);
 		permute(ki[i], cd, perm2, 48);
 	}
+}
+
+static void dohash(char *out, char const *in, char ki[16][48])
+{
+	int i, j, k;
+	char pd1[64];
+	char l[32], r[32];
+	char rl[64];
 
 	permute(pd1, in, perm3, 64);
 
@@ -265,50 +424,18 @@ static void dohash(char *out, char *in, char *key)
 	permute(out, rl, perm6, 64);
 }
 
-static void str_to_key(unsigned char *str,unsigned char *key)
-{
-	int i;
-
-	key[0] = str[0]>>1;
-	key[1] = ((str[0]&0x01)<<6) | (str[1]>>2);
-	key[2] = ((str[1]&0x03)<<5) | (str[2]>>3);
-	key[3] = ((str[2]&0x07)<<4) | (str[3]>>4);
-	key[4] = ((str[3]&0x0F)<<3) | (str[4]>>5);
-	key[5] = ((str[4]&0x1F)<<2) | (str[5]>>6);
-	key[6] = ((str[5]&0x3F)<<1) | (str[6]>>7);
-	key[7] = str[6]&0x7F;
-	for (i=0;i<8;i++) {
-		key[i] = (key[i]<<1);
-	}
-}
-
-
 void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
 {
-	int i;
 	char outb[64];
 	char inb[64];
-	char keyb[64];
-	unsigned char key2[8];
-
-	str_to_key(key, key2);
+	char ki[16][48];
 
-	for (i=0;i<64;i++) {
-		inb[i] = (in[i/8] & (1<<(7-(i%8)))) ? 1 : 0;
-		keyb[i] = (key2[i/8] & (1<<(7-(i%8)))) ? 1 : 0;
-		outb[i] = 0;
-	}
+	des_key_sched(ki, key);
+	des_bits_in(inb, in);
 
-	dohash(outb, inb, keyb);
+	dohash(outb, inb, ki);
 
-	for (i=0;i<8;i++) {
-		out[i] = 0;
-	}
-
-	for (i=0;i<64;i++) {
-		if (outb[i])
-			out[i/8] |= (1<<(7-(i%8)));
-	}
+	des_bits_out(out, outb);
 }
 
 /*
@@ -319,6 +446,7 @@ void smbdes_lmpwdhash(char const *password, uint8_t *lmhash)
 {
 	int i;
 	uint8_t p14[14];
+	char inb[64];
 	static uint8_t sp8[8] = {0x4b, 0x47, 0x53, 0x21, 0x40, 0x23, 0x24, 0x25};
 
 	memset(p14, 0, sizeof(p14));
@@ -326,8 +454,20 @@ void smbdes_lmpwdhash(char const *password, uint8_t *lmhash)
 		p14[i] = toupper((int) password[i]);
 	}
 
-	smbhash(lmhash, sp8, p14);
-	smbhash(lmhash+8, sp8, p14+7);
+	/*
+	 *	Both halves of the hash encrypt the same constant,
+	 *	so expand it to bits only once.
+	 */
+	des_bits_in(inb, sp8);
+
+	for (i = 0; i < 2; i++) {
+		char outb[64];
+		char ki[16][48];
+
+		des_key_sched(ki, p14 + (i * 7));
+		dohash(outb, inb, ki);
+		des_bits_out(lmhash + (i * 8), outb);
+	}
 }
 
 /*
@@ -338,12 +478,26 @@ void smbdes_lmpwdhash(char const *password, uint8_t *lmhash)
 void smbdes_mschap(uint8_t const win_password[16],
 		 uint8_t const *challenge, uint8_t *response)
 {
+	int i;
 	uint8_t p21[21];
+	char inb[64];
 
 	memset(p21, 0, sizeof(p21));
 	memcpy(p21, win_password, 16);
 
-	smbhash(response, challenge, p21);
-	smbhash(response+8, challenge, p21+7);
-	smbhash(response+16, challenge, p21+14);
+	/*
+	 *	The three DES operations all encrypt the same
+	 *	challenge, so expand it to bits only once.
+	 */
+	des_bits_in(inb, challenge);
+
+	for (i = 0; i < 3; i++) {
+		char outb[64];
+		char ki[16][48];
+
+		des_key_sched(ki, p21 + (i * 7));
+		dohash(outb, inb, ki);
+		des_bits_out(response + (i * 8), outb);
+	}
 }
+#endif	/* HAVE_OPENSSL_EVP_H */
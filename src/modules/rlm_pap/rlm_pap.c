@@ -32,9 +32,11 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/base64.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.password.h>
 
@@ -51,16 +53,27 @@ USES_APPLE_DEPRECATED_API
  *      a lot cleaner to do so, and a pointer to the structure can
  *      be used as the instance handle.
  */
+#ifdef HAVE_CRYPT
+typedef struct pap_crypt_pool_s pap_crypt_pool_t;
+#endif
+
 typedef struct {
 	char const		*name;
 	fr_dict_enum_t		*auth_type;
 	bool			normify;
+#ifdef HAVE_CRYPT
+	uint32_t		crypt_threads;	//!< number of threads to offload crypt() checks to
+	pap_crypt_pool_t	*crypt_pool;	//!< the threads themselves
+#endif
 } rlm_pap_t;
 
 typedef rlm_rcode_t (*pap_auth_func_t)(rlm_pap_t const *, REQUEST *, VALUE_PAIR const *, VALUE_PAIR const *);
 
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_pap_t, normify), .dflt = "yes" },
+#ifdef HAVE_CRYPT
+	{ FR_CONF_OFFSET("crypt_threads", FR_TYPE_UINT32, rlm_pap_t, crypt_threads), .dflt = "0" },
+#endif
 	CONF_PARSER_TERMINATOR
 };
 
@@ -167,7 +180,167 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_crypt(UNUSED rlm_pap_t const *inst,
 	}
 	return RLM_MODULE_OK;
 }
-#endif
+
+/*
+ *	Offloading of crypt() checks to a dedicated thread pool.
+ *
+ *	Modern crypt() schemes (bcrypt, sha512crypt) are deliberately
+ *	expensive, so running them inline means a burst of slow logins
+ *	stalls every other request on the same worker thread.  When a
+ *	pool is configured, the worker queues the check, yields, and is
+ *	resumed via a pipe once a pool thread has done the work.
+ */
+struct pap_crypt_pool_s {
+	fr_dlist_head_t		jobs;		//!< queued password checks
+	pthread_mutex_t		mutex;		//!< protects the job list
+	pthread_cond_t		cond;		//!< signalled when a job is queued
+	pthread_t		*threads;	//!< pool thread ids
+	uint32_t		num_threads;	//!< number of threads we started
+	bool			stop;		//!< pool is being destroyed
+};
+
+/** A crypt() check in flight
+ *
+ *  The job deliberately holds copies of the passwords, and not the
+ *  password pairs.  Pool threads never dereference the request, so
+ *  they can't race against it being stopped or freed.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< entry in the pool's job list
+	REQUEST			*request;	//!< request to resume.  Only dereferenced by
+						///< the originating worker thread.
+	char const		*password;	//!< copy of the cleartext password
+	char const		*known_good;	//!< copy of the reference crypt string
+	int			result;		//!< result of fr_crypt_check()
+	bool			defunct;	//!< request was stopped while the job was in flight
+	int			reply_fd;	//!< write end of the originating worker's pipe
+} pap_crypt_job_t;
+
+typedef struct {
+	int			fd[2];		//!< completion notification socketpair.  [0] is
+						///< registered with the worker's event list,
+						///< [1] is written to by pool threads.
+} rlm_pap_thread_t;
+
+static void *pap_crypt_pool_worker(void *arg)
+{
+	pap_crypt_pool_t *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		pap_crypt_job_t *job;
+
+		job = fr_dlist_head(&pool->jobs);
+		if (!job) {
+			if (pool->stop) break;
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		(void) fr_dlist_remove(&pool->jobs, job);
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->result = fr_crypt_check(job->password, job->known_good);
+
+		/*
+		 *	Tell the originating worker thread the job is
+		 *	done.  Pointer sized writes to a socketpair
+		 *	are atomic, so pool threads don't need any
+		 *	synchronisation here.
+		 */
+		if (write(job->reply_fd, &job, sizeof(job)) < 0) {
+			ERROR("Failed writing to crypt pool reply pipe: %s", fr_syserror(errno));
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Resume a request after a pool thread has finished its crypt() check
+ *
+ */
+static rlm_rcode_t mod_crypt_resume(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
+{
+	pap_crypt_job_t	*job = talloc_get_type_abort(rctx, pap_crypt_job_t);
+	int		result = job->result;
+
+	talloc_free(job);
+
+	if (result != 0) {
+		REDEBUG("Crypt digest does not match \"known good\" digest");
+		REDEBUG("Password incorrect");
+		return RLM_MODULE_REJECT;
+	}
+
+	RDEBUG2("User authenticated successfully");
+
+	return RLM_MODULE_OK;
+}
+
+static void mod_crypt_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+			     void *rctx, fr_state_signal_t action)
+{
+	pap_crypt_job_t *job = talloc_get_type_abort(rctx, pap_crypt_job_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	/*
+	 *	The job may be queued, or in flight on a pool thread,
+	 *	so we can't free it here.  Mark it defunct, and let
+	 *	the completion handler discard it.
+	 */
+	job->defunct = true;
+}
+
+/** Drain completed jobs from the reply pipe, and resume their requests
+ *
+ */
+static void _pap_crypt_pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	ssize_t		len;
+	void		*ptr;
+	pap_crypt_job_t	*job;
+
+	len = read(fd, &ptr, sizeof(ptr));
+	if (len != sizeof(ptr)) {
+		ERROR("Failed reading from crypt pool reply pipe: %s",
+		      (len < 0) ? fr_syserror(errno) : "short read");
+		return;
+	}
+
+	job = talloc_get_type_abort(ptr, pap_crypt_job_t);
+	if (job->defunct) {			/* Request was stopped */
+		talloc_free(job);
+		return;
+	}
+
+	unlang_interpret_resumable(job->request);
+}
+
+static rlm_rcode_t pap_crypt_enqueue(rlm_pap_t const *inst, rlm_pap_thread_t *t, REQUEST *request,
+				     VALUE_PAIR const *known_good, VALUE_PAIR const *password)
+{
+	pap_crypt_pool_t	*pool = inst->crypt_pool;
+	pap_crypt_job_t		*job;
+
+	MEM(job = talloc_zero(NULL, pap_crypt_job_t));
+	MEM(job->password = talloc_strdup(job, password->vp_strvalue));
+	MEM(job->known_good = talloc_strdup(job, known_good->vp_strvalue));
+	job->request = request;
+	job->reply_fd = t->fd[1];
+
+	pthread_mutex_lock(&pool->mutex);
+	fr_dlist_insert_tail(&pool->jobs, job);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	RDEBUG3("Deferring crypt check to the crypt thread pool");
+
+	return unlang_module_yield(request, mod_crypt_resume, mod_crypt_signal, job);
+}
+#endif	/* HAVE_CRYPT */
 
 static rlm_rcode_t CC_HINT(nonnull) pap_auth_md5(UNUSED rlm_pap_t const *inst, REQUEST *request,
 						 VALUE_PAIR const *known_good, VALUE_PAIR const *password)
@@ -281,6 +454,39 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_ssha1(UNUSED rlm_pap_t const *inst,
 }
 
 #ifdef HAVE_OPENSSL_EVP_H
+fr_thread_local_setup(EVP_MD_CTX *, pap_evp_md_ctx)
+
+static void _pap_evp_md_ctx_free_on_exit(void *arg)
+{
+	EVP_MD_CTX_free(arg);
+}
+
+/** Return the thread local EVP_MD_CTX
+ *
+ *  At high authentication rates, creating and destroying an EVP_MD_CTX
+ *  for every password comparison costs more than computing the digest
+ *  itself for the cheaper hashes.  The ctx is reset by the next
+ *  EVP_DigestInit_ex(), so it can be reused for every scheme.
+ *
+ * @return
+ *	- The thread local ctx on success.
+ *	- NULL on allocation failure.
+ */
+static EVP_MD_CTX *pap_evp_md_ctx_acquire(void)
+{
+	EVP_MD_CTX *md_ctx;
+
+	if (unlikely(!pap_evp_md_ctx)) {
+		md_ctx = EVP_MD_CTX_new();
+		if (unlikely(!md_ctx)) return NULL;
+		fr_thread_local_set_destructor(pap_evp_md_ctx, _pap_evp_md_ctx_free_on_exit, md_ctx);
+	} else {
+		md_ctx = pap_evp_md_ctx;
+	}
+
+	return md_ctx;
+}
+
 static rlm_rcode_t CC_HINT(nonnull) pap_auth_evp_md(UNUSED rlm_pap_t const *inst, REQUEST *request,
 						    VALUE_PAIR const *known_good, VALUE_PAIR const *password,
 						    char const *name, EVP_MD const *md)
@@ -289,11 +495,14 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_evp_md(UNUSED rlm_pap_t const *inst
 	uint8_t		digest[EVP_MAX_MD_SIZE];
 	unsigned int	digest_len;
 
-	ctx = EVP_MD_CTX_create();
+	ctx = pap_evp_md_ctx_acquire();
+	if (unlikely(!ctx)) {
+		REDEBUG("Failed allocating EVP_MD_CTX");
+		return RLM_MODULE_FAIL;
+	}
 	EVP_DigestInit_ex(ctx, md, NULL);
 	EVP_DigestUpdate(ctx, password->vp_octets, password->vp_length);
 	EVP_DigestFinal_ex(ctx, digest, &digest_len);
-	EVP_MD_CTX_destroy(ctx);
 
 	rad_assert((size_t) digest_len == known_good->vp_length);	/* This would be an OpenSSL bug... */
 
@@ -317,12 +526,15 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_evp_md_salted(UNUSED rlm_pap_t cons
 	unsigned int	digest_len, min_len;
 
 	min_len = EVP_MD_size(md);
-	ctx = EVP_MD_CTX_create();
+	ctx = pap_evp_md_ctx_acquire();
+	if (unlikely(!ctx)) {
+		REDEBUG("Failed allocating EVP_MD_CTX");
+		return RLM_MODULE_FAIL;
+	}
 	EVP_DigestInit_ex(ctx, md, NULL);
 	EVP_DigestUpdate(ctx, password->vp_octets, password->vp_length);
 	EVP_DigestUpdate(ctx, known_good->vp_octets + min_len, known_good->vp_length - min_len);
 	EVP_DigestFinal_ex(ctx, digest, &digest_len);
-	EVP_MD_CTX_destroy(ctx);
 
 	rad_assert((size_t) digest_len == min_len);	/* This would be an OpenSSL bug... */
 
@@ -889,6 +1101,20 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		RDEBUG2("Comparing with \"known-good\" %s (%zu)", known_good->da->name, known_good->vp_length);
 	}
 
+#ifdef HAVE_CRYPT
+	/*
+	 *	If a crypt thread pool was configured, hand the check
+	 *	off to it and yield, instead of stalling this worker
+	 *	thread for the duration.
+	 */
+	if ((auth_func == pap_auth_crypt) && inst->crypt_pool) {
+		rcode = pap_crypt_enqueue(inst, talloc_get_type_abort(thread, rlm_pap_thread_t),
+					  request, known_good, password);
+		if (ephemeral) talloc_list_free(&known_good);
+		return rcode;
+	}
+#endif
+
 	/*
 	 *	Authenticate, and return.
 	 */
@@ -932,6 +1158,103 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+#ifdef HAVE_CRYPT
+static int mod_detach(void *instance)
+{
+	rlm_pap_t		*inst = instance;
+	pap_crypt_pool_t	*pool = inst->crypt_pool;
+	uint32_t		i;
+
+	if (!pool) return 0;
+
+	/*
+	 *	Pool threads drain any queued jobs before they exit.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+	TALLOC_FREE(inst->crypt_pool);
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_pap_t		*inst = instance;
+	pap_crypt_pool_t	*pool;
+	uint32_t		i;
+
+	if (!inst->crypt_threads) return 0;
+
+	MEM(pool = talloc_zero(instance, pap_crypt_pool_t));
+	fr_dlist_init(&pool->jobs, pap_crypt_job_t, entry);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	MEM(pool->threads = talloc_array(pool, pthread_t, inst->crypt_threads));
+	inst->crypt_pool = pool;
+
+	for (i = 0; i < inst->crypt_threads; i++) {
+		int ret;
+
+		ret = pthread_create(&pool->threads[i], NULL, pap_crypt_pool_worker, pool);
+		if (ret != 0) {
+			ERROR("Failed spawning crypt pool thread: %s", fr_syserror(ret));
+			mod_detach(instance);
+			return -1;
+		}
+		pool->num_threads++;
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_pap_t		*inst = instance;
+	rlm_pap_thread_t	*t = thread;
+
+	talloc_set_type(thread, rlm_pap_thread_t);
+	t->fd[0] = t->fd[1] = -1;
+
+	if (!inst->crypt_pool) return 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, t->fd) < 0) {
+		ERROR("Failed creating crypt pool reply pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_event_fd_insert(NULL, el, t->fd[0], _pap_crypt_pipe_read, NULL, NULL, t) < 0) {
+		ERROR("Failed registering crypt pool reply pipe");
+		close(t->fd[0]);
+		close(t->fd[1]);
+		t->fd[0] = t->fd[1] = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(fr_event_list_t *el, void *thread)
+{
+	rlm_pap_thread_t *t = talloc_get_type_abort(thread, rlm_pap_thread_t);
+
+	if (t->fd[0] >= 0) {
+		(void) fr_event_fd_delete(el, t->fd[0], FR_EVENT_FILTER_IO);
+		close(t->fd[0]);
+		close(t->fd[1]);
+	}
+
+	return 0;
+}
+#endif	/* HAVE_CRYPT */
+
 static int mod_load(void)
 {
 	size_t	i, j = 0;
@@ -1006,6 +1329,13 @@ module_t rlm_pap = {
 	.unload		= mod_unload,
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
+#ifdef HAVE_CRYPT
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.thread_inst_size = sizeof(rlm_pap_thread_t),
+	.thread_instantiate = mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
+#endif
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
@@ -25,6 +25,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/unlang/base.h>
@@ -464,6 +465,17 @@ static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, void *thread, RE
 	rlm_radius_thread_t *t = talloc_get_type_abort(thread, rlm_radius_thread_t);
 	void *request_io_ctx;
 
+	/*
+	 *	This destination is being drained, most likely so it
+	 *	can be removed from service.  Fail immediately, so a
+	 *	redundant block can try another home server.  Requests
+	 *	which are already in flight still get their replies.
+	 */
+	if (inst->suspended) {
+		RDEBUG("Proxying to %s is suspended", inst->name);
+		return RLM_MODULE_FAIL;
+	}
+
 	if (!request->packet->code) {
 		REDEBUG("You MUST specify a packet code");
 		return RLM_MODULE_FAIL;
@@ -727,6 +739,76 @@ setup_io_submodule:
 }
 
 
+/** Suspend proxying to this home server
+ *
+ */
+static int cmd_suspend(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_radius_t *inst = talloc_get_type_abort(ctx, rlm_radius_t);
+
+	inst->suspended = true;
+	fprintf(fp, "Proxying to %s suspended - in-flight requests will still complete\n", inst->name);
+
+	return 0;
+}
+
+/** Resume proxying to this home server
+ *
+ */
+static int cmd_resume(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_radius_t *inst = talloc_get_type_abort(ctx, rlm_radius_t);
+
+	inst->suspended = false;
+	fprintf(fp, "Proxying to %s resumed\n", inst->name);
+
+	return 0;
+}
+
+/** Show the proxy state of this home server
+ *
+ */
+static int cmd_state(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_radius_t *inst = talloc_get_type_abort(ctx, rlm_radius_t);
+
+	fprintf(fp, "state\t\t%s\n", inst->suspended ? "suspended" : "active");
+	fprintf(fp, "connections\t%u\n", load(inst->num_connections));
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_radius_table[] = {
+	{
+		.parent = "set module",
+		.add_name = true,
+		.name = "suspend",
+		.func = cmd_suspend,
+		.help = "Stop sending new requests to this home server, draining in-flight ones.",
+		.read_only = false,
+	},
+
+	{
+		.parent = "set module",
+		.add_name = true,
+		.name = "resume",
+		.func = cmd_resume,
+		.help = "Start sending requests to this home server again.",
+		.read_only = false,
+	},
+
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "state",
+		.func = cmd_state,
+		.help = "Show the proxy state and connection count of this home server.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
 /** Instantiate the module
  *
  * Instantiate I/O and type submodules.
@@ -747,6 +829,11 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (fr_command_register_hook(NULL, inst->name, inst, cmd_radius_table) < 0) {
+		ERROR("Failed registering radmin commands for module %s - %s", inst->name, fr_strerror());
+		return -1;
+	}
+
 	return 0;
 }
 
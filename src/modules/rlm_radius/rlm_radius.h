@@ -86,6 +86,9 @@ struct rlm_radius_t {
 	bool			replicate;	//!< are we ignoring responses?
 	bool			synchronous;	//!< are we doing synchronous proxying?
 	bool			no_connection_fail; //!< are we failing immediately on no connection?
+	bool			suspended;	//!< while set, new requests are refused, so the
+						///< destination drains and can be removed from
+						///< service without a restart.
 
 	dl_module_inst_t		*io_submodule;	//!< As provided by the transport_parse
 	fr_radius_client_io_t const *io;	//!< Easy access to the IO handle
@@ -35,6 +35,20 @@ RCSID("$Id$")
 #include "rlm_radius.h"
 #include "track.h"
 
+/** How many encoded packets we accumulate before flushing them in one sendmmsg()
+ *
+ */
+#define SEND_BATCH_MAX (32)
+
+/*
+ *	This is easier than ifdef's in the function definition.
+ */
+#ifdef HAVE_SENDMMSG
+#define BATCH_UNUSED
+#else
+#define BATCH_UNUSED UNUSED
+#endif
+
 /** Static configuration for the module.
  *
  */
@@ -57,6 +71,9 @@ typedef struct {
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 	bool			replicate;		//!< Copied from parent->replicate
+
+	rlm_radius_rtt_t	*rtt;			//!< RTT estimate for the home server, shared
+							//!< by all worker threads.
 } rlm_radius_udp_t;
 
 
@@ -262,7 +279,7 @@ fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[] = {
 static void conn_error(fr_event_list_t *el, int fd, int flags, int fd_errno, void *uctx);
 static void conn_read(fr_event_list_t *el, int fd, int flags, void *uctx);
 static void conn_writable(fr_event_list_t *el, int fd, int flags, void *uctx);
-static int conn_write(fr_io_connection_t *c, fr_io_request_t *u);
+static int conn_write(fr_io_connection_t *c, fr_io_request_t *u, bool batch);
 static void conn_transition(fr_io_connection_t *c, fr_io_connection_state_t state);
 static void state_transition(fr_io_request_t *u, fr_io_request_state_t state, fr_io_connection_t *c);
 static void conn_zombie_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx);
@@ -1036,7 +1053,7 @@ static void conn_zombie_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now
 	/*
 	 *	And now write it to the connection.
 	 */
-	rcode = conn_write(c, u);
+	rcode = conn_write(c, u, false);
 	if (rcode < 0) {
 		DEBUG2("%s - Failed writing status check, closing connection %s",
 		       c->module_name, c->name);
@@ -1597,6 +1614,13 @@ done:
 	 */
 	c->last_reply = fr_time();
 
+	/*
+	 *	Feed the shared RTT estimate for the home server.
+	 *	Replies to retransmitted packets are ambiguous (Karn's
+	 *	algorithm), so only first transmissions are sampled.
+	 */
+	if (u->timer.count == 1) rr_rtt_update(c->inst->rtt, c->last_reply - u->time_sent);
+
 	/*
 	 *	Track the Most Recently Started with reply.  If we're
 	 *	writable or have IDs available, just re-order the list
@@ -1907,13 +1931,16 @@ get_new_connection:
  *
  * @param c the conneciton
  * @param u the udp_request_t connecting everything
+ * @param batch the caller is draining the queue, and will flush the
+ *	encoded packets itself in one batched system call.
  * @return
  *	- <0 on error
  *	- 0 should retry the write later
  *	- 1 the packet was successfully written to the socket, and we wait for a reply
  *	- 2 the packet was replicated to the socket, and should be resumed immediately.
+ *	- 3 the packet was encoded, and is waiting for the caller to flush the batch.
  */
-static int conn_write(fr_io_connection_t *c, fr_io_request_t *u)
+static int conn_write(fr_io_connection_t *c, fr_io_request_t *u, BATCH_UNUSED bool batch)
 {
 	int			rcode;
 	ssize_t			packet_len;
@@ -2161,6 +2188,25 @@ static int conn_write(fr_io_connection_t *c, fr_io_request_t *u)
 
 	request->module = module_name;
 
+#ifdef HAVE_SENDMMSG
+	/*
+	 *	The caller is draining the queue.  Leave the encoded
+	 *	packet with the request, and let the caller write the
+	 *	whole batch in one system call.  Replication is
+	 *	handled when the batch is flushed.
+	 */
+	if (batch) {
+		rad_assert(u != radius->status_u);
+
+		MEM(u->packet = talloc_memdup(u, c->buffer, packet_len));
+		u->packet_len = packet_len;
+
+		RDEBUG("Proxying request.  Writing it with the other queued packets");
+
+		return 3;
+	}
+#endif
+
 	/*
 	 *	Write the packet to the socket.  If it blocks, stop
 	 *	dequeueing packets.
@@ -2244,6 +2290,73 @@ static int conn_write(fr_io_connection_t *c, fr_io_request_t *u)
 	return 1;
 }
 
+#ifdef HAVE_SENDMMSG
+/** Flush a batch of encoded packets in one system call
+ *
+ *  The packets were encoded (and copied to their requests) by
+ *  conn_write() with batch set, so all that's left is the write.  If
+ *  the socket blocks part way through the batch, the unsent packets
+ *  are returned to the thread queue, exactly as a blocked write()
+ *  would be.
+ *
+ * @param[in] c		the connection.
+ * @param[in] batch	requests whose packets are waiting to be written.
+ * @param[in] num	number of entries in batch.
+ * @param[out] pending	set to true if the socket blocked part way
+ *			through the batch.
+ * @return
+ *	- 0 on success, including a partial write.
+ *	- -1 the connection errored, and must be closed.
+ */
+static int conn_batch_flush(fr_io_connection_t *c, fr_io_request_t **batch, int num, bool *pending)
+{
+	udp_packet_t	packets[SEND_BATCH_MAX];
+	int		i, sent;
+
+	if (!num) return 0;
+
+	for (i = 0; i < num; i++) {
+		packets[i].data = batch[i]->packet;
+		packets[i].data_len = batch[i]->packet_len;
+	}
+
+	sent = udp_send_multi(c->fd, packets, num);
+	if (sent < 0) {
+		PERROR("%s - Failed writing batched packets for connection %s", c->module_name, c->name);
+		return -1;
+	}
+
+	DEBUG3("%s - Wrote %d of %d batched packets for connection %s",
+	       c->module_name, sent, num, c->name);
+
+	/*
+	 *	We're replicating, so we don't care about the
+	 *	responses to the packets which were written.
+	 */
+	if (c->inst->replicate) {
+		for (i = 0; i < sent; i++) {
+			batch[i]->rcode = RLM_MODULE_OK;
+			state_transition(batch[i], REQUEST_IO_STATE_REPLIED, NULL);
+		}
+	}
+
+	if (sent == num) return 0;
+
+	/*
+	 *	The socket blocked part way through the batch.
+	 *	Re-insert the unsent packets onto the main thread
+	 *	queue, and stop writing packets to this connection.
+	 */
+	for (i = sent; i < num; i++) {
+		state_transition(batch[i], REQUEST_IO_STATE_QUEUED, NULL);
+	}
+	conn_transition(c, CONN_BLOCKED);
+	*pending = true;
+
+	return 0;
+}
+#endif
+
 /** There's space available to write data, so do that...
  *
  */
@@ -2256,6 +2369,10 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 	fr_io_connection_state_t	prev_state = c->state;
 	fr_io_connection_t		*next;
 	int				rcode;
+#ifdef HAVE_SENDMMSG
+	fr_io_request_t			*batch[SEND_BATCH_MAX];
+	int				num_batched = 0;
+#endif
 
 	DEBUG3("%s - Writing packets for connection %s", c->module_name, c->name);
 
@@ -2265,7 +2382,7 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 	 */
 	if (radius->status_check_blocked) {
 		radius->status_check_blocked = false;
-		rcode = conn_write(c, radius->status_u);
+		rcode = conn_write(c, radius->status_u, false);
 
 		/*
 		 *	Error, close the connection.
@@ -2318,7 +2435,7 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 		 *	Encode the packet, and do various magical
 		 *	transformations.
 		 */
-		rcode = conn_write(c, u);
+		rcode = conn_write(c, u, true);
 
 		/*
 		 *	The packet was sent, and we should wait for
@@ -2328,6 +2445,23 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 			continue;
 		}
 
+#ifdef HAVE_SENDMMSG
+		/*
+		 *	The packet was encoded, and is waiting for us
+		 *	to write it.  Flush the batch when it's full.
+		 */
+		if (rcode == 3) {
+			batch[num_batched++] = u;
+
+			if (num_batched == SEND_BATCH_MAX) {
+				if (conn_batch_flush(c, batch, num_batched, &pending) < 0) goto fail;
+				num_batched = 0;
+				if (pending) break;
+			}
+			continue;
+		}
+#endif
+
 		/*
 		 *	The write returned EWOULDBLOCK.  We re-insert
 		 *	the packet back onto the main thread queue,
@@ -2343,24 +2477,8 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 		/*
 		 *	Can't write a packet to this connection, so we
 		 *	close it.
-		 *
-		 *	We still wake up the "next" connection, as we
-		 *	hope that it may be writable.  If it isn't, it
-		 *	will shut itself down again.  If it is
-		 *	writable (and it usually is), then we've saved
-		 *	another round trip through the event loop.
 		 */
-		if (rcode < 0) {
-			fr_io_connection_thread_t *t = c->thread;
-
-			talloc_free(c);
-
-			next = fr_heap_peek(t->active);
-			if (!next) return;
-
-			conn_writable(el, next->fd, 0, next);
-			return;
-		}
+		if (rcode < 0) goto fail;
 
 		/*
 		 *	The packet was replicated, we don't care about
@@ -2372,6 +2490,13 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 		}
 	}
 
+#ifdef HAVE_SENDMMSG
+	/*
+	 *	Flush any partial batch.
+	 */
+	if (num_batched && (conn_batch_flush(c, batch, num_batched, &pending) < 0)) goto fail;
+#endif
+
 	/*
 	 *	There are no more packets to write.  Set ourselves to
 	 *	idle.
@@ -2413,6 +2538,29 @@ static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
 	if (!next) return;
 
 	conn_writable(el, next->fd, 0, next);
+	return;
+
+	/*
+	 *	Can't write a packet to this connection, so we close
+	 *	it.
+	 *
+	 *	We still wake up the "next" connection, as we hope
+	 *	that it may be writable.  If it isn't, it will shut
+	 *	itself down again.  If it is writable (and it usually
+	 *	is), then we've saved another round trip through the
+	 *	event loop.
+	 */
+fail:
+	{
+		fr_io_connection_thread_t *t = c->thread;
+
+		talloc_free(c);
+
+		next = fr_heap_peek(t->active);
+		if (!next) return;
+
+		conn_writable(el, next->fd, 0, next);
+	}
 }
 
 /** Free an fr_io_request_t
@@ -2504,6 +2652,7 @@ static fr_connection_state_t _conn_failed(UNUSED int fd, fr_connection_state_t s
 
 			memset(&u->timer, 0, sizeof(u->timer));
 			u->timer.retry = &c->inst->parent->retry[u->code];
+			u->timer.rtt = c->inst->rtt;
 
 			rad_assert(u->c == c);
 
@@ -2674,6 +2823,7 @@ static fr_connection_state_t _conn_open(UNUSED fr_event_list_t *el, int fd, void
 
 		memset(&u->timer, 0, sizeof(u->timer));
 		u->timer.retry = &c->inst->parent->retry[u->code];
+		u->timer.rtt = c->inst->rtt;
 		radius->status_check_blocked = false;
 	}
 } /* RADIUS end */
@@ -2817,6 +2967,7 @@ static rlm_rcode_t mod_push(void *instance, REQUEST *request, void *request_io_c
 	u->thread = t;
 	u->heap_id = -1;
 	u->timer.retry = &inst->parent->retry[u->code];
+	u->timer.rtt = inst->rtt;
 	fr_dlist_entry_init(&u->entry);
 
 	talloc_set_destructor(u, udp_request_free);
@@ -3006,6 +3157,12 @@ static int mod_instantiate(rlm_radius_t *parent, void *instance, CONF_SECTION *c
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	inst->rtt = rr_rtt_create(inst);
+	if (!inst->rtt) {
+		cf_log_err(conf, "Failed allocating RTT tracking");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -469,8 +469,107 @@ int rr_track_start(rlm_radius_retransmit_t *timer)
 	timer->count = 1;
 	timer->rt = timer->retry->irt * USEC; /* rt is in usec */
 
+	/*
+	 *	If we have an RTT estimate for this destination, start
+	 *	from RTO = SRTT + 4 * RTTVAR (RFC 6298) instead of the
+	 *	static IRT.  A fast home server then gets retransmits
+	 *	long before the IRT would fire, and a degraded one
+	 *	pushes the first retransmit out past it.
+	 */
+	if (timer->rtt) {
+		uint64_t rto;
+
+		pthread_mutex_lock(&timer->rtt->mutex);
+		rto = (uint64_t) (timer->rtt->srtt + 4 * timer->rtt->rttvar) / 1000; /* usec */
+		pthread_mutex_unlock(&timer->rtt->mutex);
+
+		if (rto) {
+			uint32_t min_rt;
+
+			/*
+			 *	Never retransmit faster than once a
+			 *	second (RFC 6298 Section 2.4), or
+			 *	faster than a deliberately small IRT.
+			 */
+			min_rt = timer->retry->irt * USEC;
+			if (min_rt > USEC) min_rt = USEC;
+			if (rto < min_rt) rto = min_rt;
+
+			/*
+			 *	Cap at MRT, as rr_track_retry() does.
+			 */
+			if (timer->retry->mrt && (rto > ((uint64_t) timer->retry->mrt * USEC))) {
+				rto = (uint64_t) timer->retry->mrt * USEC;
+			}
+
+			timer->rt = rto;
+		}
+	}
+
 	timer->next = timer->start;
 	timer->next += timer->rt * 1000;
 
 	return 0;
 }
+
+/** Free the mutex protecting an rlm_radius_rtt_t
+ *
+ */
+static int _rr_rtt_free(rlm_radius_rtt_t *rtt)
+{
+	pthread_mutex_destroy(&rtt->mutex);
+
+	return 0;
+}
+
+/** Create an RTT estimate to be shared by everyone sending to one destination
+ *
+ * @param ctx the talloc ctx
+ * @return
+ *	- NULL on error
+ *	- rlm_radius_rtt_t on success
+ */
+rlm_radius_rtt_t *rr_rtt_create(TALLOC_CTX *ctx)
+{
+	rlm_radius_rtt_t *rtt;
+
+	rtt = talloc_zero(ctx, rlm_radius_rtt_t);
+	if (!rtt) return NULL;
+
+	if (pthread_mutex_init(&rtt->mutex, NULL) != 0) {
+		talloc_free(rtt);
+		return NULL;
+	}
+	talloc_set_destructor(rtt, _rr_rtt_free);
+
+	return rtt;
+}
+
+/** Fold a round-trip time sample into the shared estimate
+ *
+ *  Implements the RFC 6298 Section 2 estimator.  The caller must only
+ *  pass samples from packets which were not retransmitted (Karn's
+ *  algorithm), as a reply to a retransmitted packet can't be matched
+ *  to a particular transmission.
+ *
+ * @param rtt		shared estimate for the destination.
+ * @param sample	measured request/reply round-trip time.
+ */
+void rr_rtt_update(rlm_radius_rtt_t *rtt, fr_time_delta_t sample)
+{
+	pthread_mutex_lock(&rtt->mutex);
+	if (!rtt->srtt) {
+		rtt->srtt = sample;
+		rtt->rttvar = sample / 2;
+
+	} else {
+		fr_time_delta_t err;
+
+		err = sample - rtt->srtt;
+		if (err < 0) err = -err;
+
+		rtt->rttvar += (err - rtt->rttvar) / 4;
+		rtt->srtt += (sample - rtt->srtt) / 8;
+	}
+	pthread_mutex_unlock(&rtt->mutex);
+}
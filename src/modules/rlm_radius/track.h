@@ -26,6 +26,19 @@
 
 #include "rlm_radius.h"
 #include <freeradius-devel/util/dlist.h>
+#include <pthread.h>
+
+/** Round-trip time estimate for one destination (RFC 6298)
+ *
+ *  The estimate is shared by all worker threads talking to the
+ *  destination, so when a home server degrades, every connection
+ *  starts backing off together.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the fields below across worker threads.
+	fr_time_delta_t		srtt;		//!< Smoothed round-trip time, 0 until the first sample.
+	fr_time_delta_t		rttvar;		//!< Round-trip time variation.
+} rlm_radius_rtt_t;
 
 typedef struct {
 	fr_time_t      		start;		//!< when we started sending the packet
@@ -34,6 +47,7 @@ typedef struct {
 	fr_time_t		next;		//!< next time when the timer should fire
 	fr_event_timer_t const	*ev;		//!< timer event associated with this packet
 	rlm_radius_retry_t	*retry;		//!< pointer to retry structure
+	rlm_radius_rtt_t	*rtt;		//!< shared RTT estimate for the destination, may be NULL
 } rlm_radius_retransmit_t;
 
 /** Track one request to a response
@@ -78,3 +92,6 @@ void rr_track_use_authenticator(rlm_radius_id_t *id, bool flag) CC_HINT(nonnull)
 
 int rr_track_start(rlm_radius_retransmit_t *timer) CC_HINT(nonnull);
 int rr_track_retry(rlm_radius_retransmit_t *timer, fr_time_t now) CC_HINT(nonnull);
+
+rlm_radius_rtt_t *rr_rtt_create(TALLOC_CTX *ctx);
+void rr_rtt_update(rlm_radius_rtt_t *rtt, fr_time_delta_t sample) CC_HINT(nonnull);
@@ -1862,6 +1862,18 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	 */
 	if (inst->http_negotiation != CURL_HTTP_VERSION_NONE) SET_OPTION(CURLOPT_HTTP_VERSION, inst->http_negotiation);
 
+#ifdef CURLPIPE_MULTIPLEX
+	/*
+	 *	Wait for a connection which is still being established
+	 *	to the same host, instead of immediately opening a new
+	 *	one.  If the server negotiates HTTP >= 2.0, a burst of
+	 *	requests is then multiplexed over a handful of
+	 *	connections, instead of opening one connection per
+	 *	in-flight request.
+	 */
+	if (inst->multiplex) SET_OPTION(CURLOPT_PIPEWAIT, 1L);
+#endif
+
 	/*
 	 *	Setup any header options and generic headers.
 	 */
@@ -2232,7 +2244,7 @@ int rest_response_certinfo(rlm_rest_t const *inst, UNUSED rlm_rest_section_t con
 			strlcpy(attr, cert_attrs->data, (q - cert_attrs->data) + 1);
 			for (p = attr; *p != '\0'; p++) if (*p == ' ') *p = '-';
 
-			da = fr_dict_attr_by_name(dict_freeradius, buffer);
+			da = fr_dict_attr_by_name_cached(dict_freeradius, buffer);
 			if (!da) {
 				RDEBUG3("Skipping %s += '%s'", buffer, q + 1);
 				RDEBUG3("If this value is required, define attribute \"%s\"", buffer);
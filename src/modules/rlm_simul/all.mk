@@ -0,0 +1,2 @@
+TARGET		:= rlm_simul.a
+SOURCES		:= rlm_simul.c
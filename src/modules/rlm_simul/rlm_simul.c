@@ -0,0 +1,484 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_simul.c
+ * @brief Enforce Simultaneous-Use from an in-memory session registry.
+ *
+ * The module builds a table of active sessions from the accounting
+ * stream, and counts a user's sessions from that table at
+ * authorization time.  This replaces the per-login SQL query
+ * traditionally used for Simultaneous-Use enforcement, at the cost of
+ * bounded staleness: a session whose Stop packet was lost is counted
+ * until its entry times out.
+ *
+ * The registry is local to one server.  Sites with multiple servers
+ * should either shard users across servers at the load balancer, or
+ * keep using a shared datastore for this check.
+ *
+ * @copyright 2019 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/rad_assert.h>
+
+#include <pthread.h>
+
+typedef struct {
+	char const		*name;		//!< Instance name.
+
+	vp_tmpl_t		*session_key;	//!< What to expand to uniquely identify a session.
+	vp_tmpl_t		*user_key;	//!< What to expand to identify the session's owner.
+	uint32_t		timeout;	//!< How long before a session without a Stop expires (seconds).
+	uint32_t		max_entries;	//!< Maximum number of sessions we track.
+
+	rbtree_t		*sessions;	//!< Session key -> session entry.
+	rbtree_t		*users;		//!< User key -> number of active sessions.
+	pthread_mutex_t		mutex;		//!< Protect both trees from multiple readers/writers.
+} rlm_simul_t;
+
+/** One active session
+ *
+ */
+typedef struct {
+	uint8_t const		*key;		//!< Expanded session key.
+	size_t			key_len;	//!< Length of the session key.
+	char const		*user;		//!< Owner of the session.
+	time_t			expires;	//!< When this entry may be reclaimed.
+} simul_session_t;
+
+/** Number of active sessions for one user
+ *
+ */
+typedef struct {
+	char const		*user;		//!< User key this entry counts sessions for.
+	uint32_t		count;		//!< Number of sessions we've seen Start but not Stop for.
+} simul_user_t;
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("session_key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_simul_t, session_key) },
+	{ FR_CONF_OFFSET("user_key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_simul_t, user_key) },
+	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, rlm_simul_t, timeout), .dflt = "86400" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_simul_t, max_entries), .dflt = "65536" },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t *dict_freeradius;
+static fr_dict_t *dict_radius;
+
+extern fr_dict_autoload_t rlm_simul_dict[];
+fr_dict_autoload_t rlm_simul_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_simultaneous_use;
+static fr_dict_attr_t const *attr_acct_status_type;
+
+extern fr_dict_attr_autoload_t rlm_simul_dict_attr[];
+fr_dict_attr_autoload_t rlm_simul_dict_attr[] = {
+	{ .out = &attr_simultaneous_use, .name = "Simultaneous-Use", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+
+	{ NULL }
+};
+
+/** Compare two sessions by key
+ *
+ * There may only be one session with the same key.
+ */
+static int simul_session_cmp(void const *one, void const *two)
+{
+	simul_session_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Compare two per-user counters by user key
+ *
+ */
+static int simul_user_cmp(void const *one, void const *two)
+{
+	simul_user_t const *a = one, *b = two;
+
+	return strcmp(a->user, b->user);
+}
+
+/** Decrement a user's session count, reclaiming the counter at zero
+ *
+ * Must be called with the mutex held.
+ */
+static void simul_user_decrement(rlm_simul_t *inst, char const *user)
+{
+	simul_user_t *entry;
+
+	entry = rbtree_finddata(inst->users, &(simul_user_t){ .user = user });
+	if (!entry) return;
+
+	if (entry->count > 1) {
+		entry->count--;
+		return;
+	}
+
+	rbtree_deletebydata(inst->users, entry);
+	talloc_free(entry);
+}
+
+/** Increment a user's session count, creating the counter if needed
+ *
+ * Must be called with the mutex held.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on allocation failure.
+ */
+static int simul_user_increment(rlm_simul_t *inst, char const *user)
+{
+	simul_user_t *entry;
+
+	entry = rbtree_finddata(inst->users, &(simul_user_t){ .user = user });
+	if (entry) {
+		entry->count++;
+		return 0;
+	}
+
+	entry = talloc_zero(NULL, simul_user_t);
+	if (!entry) return -1;
+
+	entry->user = talloc_strdup(entry, user);
+	if (!entry->user) {
+		talloc_free(entry);
+		return -1;
+	}
+	entry->count = 1;
+
+	if (!rbtree_insert(inst->users, entry)) {
+		talloc_free(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Remove a session from the registry
+ *
+ * Must be called with the mutex held.
+ */
+static void simul_session_delete(rlm_simul_t *inst, simul_session_t *session)
+{
+	simul_user_decrement(inst, session->user);
+	rbtree_deletebydata(inst->sessions, session);
+	talloc_free(session);
+}
+
+typedef struct {
+	rlm_simul_t	*inst;
+	time_t		now;
+} simul_expire_ctx_t;
+
+/** Reclaim a session if it has expired
+ *
+ * @param[in] data	session to check.
+ * @param[in] uctx	a #simul_expire_ctx_t.
+ * @return
+ *	- 2 if the session was reclaimed.
+ *	- 0 if the session is still live.
+ */
+static int _simul_session_expire(void *data, void *uctx)
+{
+	simul_session_t *session = data;
+	simul_expire_ctx_t *expire = uctx;
+
+	if (session->expires > expire->now) return 0;
+
+	simul_user_decrement(expire->inst, session->user);
+	talloc_free(session);
+
+	return 2;
+}
+
+/** Walk over a tree, freeing all entries
+ *
+ * Used on detach.
+ *
+ * @param[in] data	entry to free.
+ * @param[in] uctx	unused.
+ * @return 2
+ */
+static int _simul_entry_free(void *data, UNUSED void *uctx)
+{
+	talloc_free(data);
+
+	return 2;
+}
+
+/** Expand the session and user keys for this request
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if a key could not be expanded, or was zero length.
+ */
+static int simul_keys_expand(uint8_t const **key, ssize_t *key_len, char *key_buffer, size_t key_buffer_len,
+			     char const **user, char *user_buffer, size_t user_buffer_len,
+			     rlm_simul_t *inst, REQUEST *request)
+{
+	*key_len = tmpl_expand((char const **)key, key_buffer, key_buffer_len,
+			       request, inst->session_key, NULL, NULL);
+	if (*key_len <= 0) {
+		REDEBUG("Zero length session key is invalid");
+		return -1;
+	}
+
+	if (tmpl_expand(user, user_buffer, user_buffer_len,
+			request, inst->user_key, NULL, NULL) <= 0) {
+		REDEBUG("Zero length user key is invalid");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Track session Starts and Stops from the accounting stream
+ *
+ * @return
+ *	- #RLM_MODULE_OK if the registry was updated.
+ *	- #RLM_MODULE_NOOP if the packet doesn't change session state.
+ *	- #RLM_MODULE_FAIL on allocation failure, or if a key could not
+ *	  be expanded.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_simul_t		*inst = talloc_get_type_abort(instance, rlm_simul_t);
+	simul_session_t		*session;
+	VALUE_PAIR		*vp;
+	time_t			now;
+	bool			stopping;
+
+	char			key_buffer[1024];
+	char			user_buffer[256];
+	uint8_t const		*key;
+	ssize_t			key_len;
+	char const		*user;
+
+	vp = fr_pair_find_by_da(request->packet->vps, attr_acct_status_type, TAG_ANY);
+	if (!vp) return RLM_MODULE_NOOP;
+
+	switch (vp->vp_uint32) {
+	case FR_STATUS_START:
+	case FR_STATUS_ALIVE:
+		stopping = false;
+		break;
+
+	case FR_STATUS_STOP:
+		stopping = true;
+		break;
+
+	/*
+	 *	NAS reboot.  We don't index sessions by NAS, so the
+	 *	stale sessions are reclaimed by the timeout instead.
+	 */
+	default:
+		return RLM_MODULE_NOOP;
+	}
+
+	if (simul_keys_expand(&key, &key_len, key_buffer, sizeof(key_buffer),
+			      &user, user_buffer, sizeof(user_buffer), inst, request) < 0) return RLM_MODULE_FAIL;
+
+	now = fr_time_to_sec(request->packet->timestamp);
+
+	pthread_mutex_lock(&inst->mutex);
+
+	session = rbtree_finddata(inst->sessions, &(simul_session_t){ .key = key, .key_len = key_len });
+
+	if (stopping) {
+		if (session) simul_session_delete(inst, session);
+		pthread_mutex_unlock(&inst->mutex);
+
+		return session ? RLM_MODULE_OK : RLM_MODULE_NOOP;
+	}
+
+	/*
+	 *	Interim-Updates refresh the expiry time, so live
+	 *	sessions never time out of the registry.
+	 */
+	if (session) {
+		session->expires = now + inst->timeout;
+		pthread_mutex_unlock(&inst->mutex);
+
+		return RLM_MODULE_OK;
+	}
+
+	/*
+	 *	Reclaim expired sessions lazily, and only when we'd
+	 *	otherwise refuse to track a new one.
+	 */
+	if (rbtree_num_elements(inst->sessions) >= inst->max_entries) {
+		simul_expire_ctx_t expire = { .inst = inst, .now = now };
+
+		rbtree_walk(inst->sessions, RBTREE_DELETE_ORDER, _simul_session_expire, &expire);
+
+		if (rbtree_num_elements(inst->sessions) >= inst->max_entries) {
+			pthread_mutex_unlock(&inst->mutex);
+
+			RWDEBUG("Not tracking session, already tracking %u sessions", inst->max_entries);
+			return RLM_MODULE_NOOP;
+		}
+	}
+
+	session = talloc_zero(NULL, simul_session_t);
+	if (!session) goto fail;
+
+	session->key = talloc_memdup(session, key, key_len);
+	session->user = talloc_strdup(session, user);
+	if (!session->key || !session->user) {
+		talloc_free(session);
+		goto fail;
+	}
+	session->key_len = key_len;
+	session->expires = now + inst->timeout;
+
+	if (!rbtree_insert(inst->sessions, session)) {
+		talloc_free(session);
+		goto fail;
+	}
+
+	if (simul_user_increment(inst, session->user) < 0) {
+		rbtree_deletebydata(inst->sessions, session);
+		talloc_free(session);
+		goto fail;
+	}
+
+	pthread_mutex_unlock(&inst->mutex);
+
+	return RLM_MODULE_OK;
+
+fail:
+	pthread_mutex_unlock(&inst->mutex);
+
+	return RLM_MODULE_FAIL;
+}
+
+/** Enforce Simultaneous-Use against the session registry
+ *
+ * @return
+ *	- #RLM_MODULE_DISALLOW if the user is at their session limit.
+ *	- #RLM_MODULE_OK if the user is under their session limit.
+ *	- #RLM_MODULE_NOOP if there's no Simultaneous-Use to enforce.
+ *	- #RLM_MODULE_FAIL if the user key could not be expanded.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_simul_t		*inst = talloc_get_type_abort(instance, rlm_simul_t);
+	simul_user_t		*entry;
+	VALUE_PAIR		*vp;
+	uint32_t		count = 0;
+
+	char			user_buffer[256];
+	char const		*user;
+
+	vp = fr_pair_find_by_da(request->control, attr_simultaneous_use, TAG_ANY);
+	if (!vp) return RLM_MODULE_NOOP;
+
+	if (tmpl_expand(&user, user_buffer, sizeof(user_buffer),
+			request, inst->user_key, NULL, NULL) <= 0) {
+		REDEBUG("Zero length user key is invalid");
+		return RLM_MODULE_FAIL;
+	}
+
+	pthread_mutex_lock(&inst->mutex);
+	entry = rbtree_finddata(inst->users, &(simul_user_t){ .user = user });
+	if (entry) count = entry->count;
+	pthread_mutex_unlock(&inst->mutex);
+
+	if (count >= vp->vp_uint32) {
+		REDEBUG("User has %u active sessions, limit is %u", count, vp->vp_uint32);
+		return RLM_MODULE_DISALLOW;
+	}
+
+	RDEBUG2("User has %u active sessions, limit is %u", count, vp->vp_uint32);
+
+	return RLM_MODULE_OK;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_simul_t *inst = talloc_get_type_abort(instance, rlm_simul_t);
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	inst->sessions = rbtree_talloc_create(NULL, simul_session_cmp, simul_session_t, NULL, 0);
+	if (!inst->sessions) {
+		ERROR("Failed to create session tree");
+		return -1;
+	}
+	talloc_link_ctx(inst, inst->sessions);
+
+	inst->users = rbtree_talloc_create(NULL, simul_user_cmp, simul_user_t, NULL, 0);
+	if (!inst->users) {
+		ERROR("Failed to create user tree");
+		return -1;
+	}
+	talloc_link_ctx(inst, inst->users);
+
+	if (pthread_mutex_init(&inst->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_simul_t *inst = talloc_get_type_abort(instance, rlm_simul_t);
+
+	if (inst->sessions) rbtree_walk(inst->sessions, RBTREE_DELETE_ORDER, _simul_entry_free, NULL);
+	if (inst->users) rbtree_walk(inst->users, RBTREE_DELETE_ORDER, _simul_entry_free, NULL);
+
+	pthread_mutex_destroy(&inst->mutex);
+
+	return 0;
+}
+
+/*
+ *	The module name should be the only globally exported symbol.
+ *	That is, everything else should be 'static'.
+ */
+extern module_t rlm_simul;
+module_t rlm_simul = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "simul",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_simul_t),
+	.config		= module_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.methods = {
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_PREACCT]		= mod_accounting,
+		[MOD_ACCOUNTING]	= mod_accounting
+	},
+};
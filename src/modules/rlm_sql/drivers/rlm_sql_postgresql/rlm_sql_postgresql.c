@@ -254,57 +254,19 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
-					      char const *query)
+/** Retrieve the result of a dispatched query and classify it
+ *
+ * Common to the blocking and non-blocking query paths; the caller must
+ * already know that the result is ready (PQisBusy() returned false).
+ */
+static sql_rcode_t sql_process_result(rlm_sql_handle_t *handle, rlm_sql_config_t *config)
 {
 	rlm_sql_postgres_conn_t	*conn = handle->conn;
 	rlm_sql_postgres_t	*inst = config->driver;
-	struct timeval		timeout = {config->query_timeout, 0};
-	int			sockfd, r;
-	fd_set			read_fd;
 	PGresult		*tmp_result;
 	int			numfields = 0;
 	ExecStatusType		status;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	sockfd = PQsocket(conn->db);
-	if (sockfd < 0) {
-		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
-	if (!PQsendQuery(conn->db, query)) {
-		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  We try to avoid blocking by waiting until the driver indicates that
-	 *  the result is ready or our timeout expires
-	 */
-	while (PQisBusy(conn->db)) {
-		FD_ZERO(&read_fd);
-		FD_SET(sockfd, &read_fd);
-		r = select(sockfd + 1, &read_fd, NULL, NULL, config->query_timeout ? &timeout : NULL);
-		if (r == 0) {
-			ERROR("Socket read timeout after %d seconds", config->query_timeout);
-			return RLM_SQL_RECONNECT;
-		}
-		if (r < 0) {
-			if (errno == EINTR) continue;
-			ERROR("Failed in select: %s", fr_syserror(errno));
-			return RLM_SQL_RECONNECT;
-		}
-		if (!PQconsumeInput(conn->db)) {
-			ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
-			return RLM_SQL_RECONNECT;
-		}
-	}
-
 	/*
 	 *  Returns a PGresult pointer or possibly a null pointer.
 	 *  A non-null pointer will generally be returned except in
@@ -376,6 +338,195 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 	return sql_classify_error(inst, status, conn->result);;
 }
 
+/** Wait for the result of an outstanding query
+ *
+ * We try to avoid blocking by waiting until the driver indicates that
+ * the result is ready or our timeout expires.
+ */
+static sql_rcode_t sql_query_wait(rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	struct timeval		timeout = {config->query_timeout, 0};
+	int			sockfd, r;
+	fd_set			read_fd;
+
+	sockfd = PQsocket(conn->db);
+
+	while (PQisBusy(conn->db)) {
+		FD_ZERO(&read_fd);
+		FD_SET(sockfd, &read_fd);
+		r = select(sockfd + 1, &read_fd, NULL, NULL, config->query_timeout ? &timeout : NULL);
+		if (r == 0) {
+			ERROR("Socket read timeout after %d seconds", config->query_timeout);
+			return RLM_SQL_RECONNECT;
+		}
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			ERROR("Failed in select: %s", fr_syserror(errno));
+			return RLM_SQL_RECONNECT;
+		}
+		if (!PQconsumeInput(conn->db)) {
+			ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+			return RLM_SQL_RECONNECT;
+		}
+	}
+
+	return sql_process_result(handle, config);
+}
+
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (PQsocket(conn->db) < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_wait(handle, config);
+}
+
+/** Prepare a query shape as a named statement
+ *
+ * Replaces any statement previously prepared under the same name, as
+ * statement names are reused when rlm_sql's cache evicts an entry.
+ * Preparation happens once per query shape per connection, so the
+ * blocking libpq calls here aren't on the hot path.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_prepare(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						char const *name, char const *query, int nparams)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	PGresult		*result;
+	char			buffer[NAMEDATALEN + 12];
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *	Drop whatever we previously prepared under this name.  The
+	 *	first time round there's nothing to drop, and the error is
+	 *	ignored.
+	 */
+	snprintf(buffer, sizeof(buffer), "DEALLOCATE %s", name);
+	result = PQexec(conn->db, buffer);
+	if (result) PQclear(result);
+
+	/*
+	 *	Passing no parameter types lets the server infer them from
+	 *	how the placeholders are used.
+	 */
+	result = PQprepare(conn->db, name, query, nparams, NULL);
+	if (!result) return RLM_SQL_RECONNECT;
+
+	if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+		ERROR("Failed to prepare statement: %s", PQresultErrorMessage(result));
+		PQclear(result);
+		return RLM_SQL_ERROR;
+	}
+	PQclear(result);
+
+	return RLM_SQL_OK;
+}
+
+/** Execute a previously prepared statement
+ *
+ * All parameters are sent in text format, the server coerces them to
+ * the types it inferred when the statement was prepared.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_prepared(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+						       char const *name, char const * const *params, int nparams)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (PQsocket(conn->db) < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQueryPrepared(conn->db, name, nparams, params, NULL, NULL, 0)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_wait(handle, config);
+}
+
+/** Submit a query without waiting for the result
+ *
+ * libpq runs the whole protocol exchange asynchronously; the blocking
+ * sql_query() above only blocks in its own select() loop, so the
+ * non-blocking interface reuses the same machinery and just leaves the
+ * waiting to the caller's event loop.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_start(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						    char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (PQsocket(conn->db) < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_YIELD;
+}
+
+/** Consume any pending input, and retrieve the result if it's ready
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_resume(rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (PQisBusy(conn->db)) return RLM_SQL_YIELD;
+
+	return sql_process_result(handle, config);
+}
+
+/** Return the fd the caller should wait on for an outstanding query
+ */
+static CC_HINT(nonnull) int sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) return -1;
+
+	return PQsocket(conn->db);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
 {
 	return sql_query(handle, config, query);
@@ -653,6 +804,11 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
 	.sql_select_query		= sql_select_query,
+	.sql_query_start		= sql_query_start,
+	.sql_query_resume		= sql_query_resume,
+	.sql_fd				= sql_fd,
+	.sql_prepare			= sql_prepare,
+	.sql_query_prepared		= sql_query_prepared,
 	.sql_num_fields			= sql_num_fields,
 	.sql_fields			= sql_fields,
 	.sql_fetch_row			= sql_fetch_row,
@@ -37,6 +37,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/table.h>
 
 #include <sys/stat.h>
@@ -70,6 +71,11 @@ static const CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.logfile) },
 
+	{ FR_CONF_OFFSET("batch_header", FR_TYPE_STRING, rlm_sql_config_t, accounting.batch_header) },
+	{ FR_CONF_OFFSET("batch_values", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.batch_values) },
+	{ FR_CONF_OFFSET("batch_max_rows", FR_TYPE_UINT32, rlm_sql_config_t, accounting.batch_max_rows), .dflt = "128" },
+	{ FR_CONF_OFFSET("batch_window", FR_TYPE_TIME_DELTA, rlm_sql_config_t, accounting.batch_window), .dflt = "0.1" },
+
 	{ FR_CONF_POINTER("type", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) type_config },
 	CONF_PARSER_TERMINATOR
 };
@@ -296,25 +302,63 @@ static int _sql_map_proc_get_value(TALLOC_CTX *ctx, VALUE_PAIR **out,
 	return 0;
 }
 
+#define MAX_SQL_FIELD_INDEX (64)
+
+/** Pre-compiled program for a map {} section
+ *
+ * Built once by sql_map_verify() when the section is compiled, so
+ * evaluating the section doesn't redo per-request work for the parts
+ * of the map list which never change.
+ */
+typedef struct {
+	int		num_maps;	//!< Number of entries in the map list.
+	char const	**fields;	//!< Constant RHS (field name) of each map, or
+					//!< NULL if the name is dynamic, and must be
+					//!< expanded at runtime.
+} sql_map_inst_t;
+
 /*
- *	Verify the result of the map.
+ *	Verify the result of the map, and pre-compile what we can.
  */
-static int sql_map_verify(CONF_SECTION *cs, UNUSED void *mod_inst, UNUSED void *proc_inst,
-			  vp_tmpl_t const *src, UNUSED vp_map_t const *maps)
+static int sql_map_verify(CONF_SECTION *cs, UNUSED void *mod_inst, void *proc_inst,
+			  vp_tmpl_t const *src, vp_map_t const *maps)
 {
+	sql_map_inst_t	*inst = proc_inst;
+	vp_map_t const	*map;
+	int		i, num_maps = 0;
+
 	if (!src) {
 		cf_log_err(cs, "Missing SQL query");
 
 		return -1;
 	}
 
+	for (map = maps; map; map = map->next) num_maps++;
+
+	if (num_maps > MAX_SQL_FIELD_INDEX) {
+		cf_log_err(cs, "Too many map entries (%d), maximum is %d", num_maps, MAX_SQL_FIELD_INDEX);
+
+		return -1;
+	}
+
+	inst->num_maps = num_maps;
+	MEM(inst->fields = talloc_zero_array(inst, char const *, num_maps));
+
+	/*
+	 *	Most field names are constants.  Resolve them here,
+	 *	instead of expanding them on every request.
+	 */
+	for (map = maps, i = 0; map; map = map->next, i++) {
+		if (tmpl_is_unparsed(map->rhs)) inst->fields[i] = map->rhs->name;
+	}
+
 	return 0;
 }
 
 /** Executes a SELECT query and maps the result to server attributes
  *
  * @param mod_inst #rlm_sql_t instance.
- * @param proc_inst Instance data for this specific mod_proc call (unused).
+ * @param proc_inst #sql_map_inst_t, pre-compiled by #sql_map_verify.
  * @param request The current request.
  * @param query string to execute.
  * @param maps Head of the map list.
@@ -323,10 +367,11 @@ static int sql_map_verify(CONF_SECTION *cs, UNUSED void *mod_inst, UNUSED void *
  *	- #RLM_MODULE_UPDATED if one or more #VALUE_PAIR were added to the #REQUEST.
  *	- #RLM_MODULE_FAIL if a fault occurred.
  */
-static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST *request,
+static rlm_rcode_t mod_map_proc(void *mod_inst, void *proc_inst, REQUEST *request,
 				fr_value_box_t **query, vp_map_t const *maps)
 {
 	rlm_sql_t		*inst = talloc_get_type_abort(mod_inst, rlm_sql_t);
+	sql_map_inst_t const	*map_inst = proc_inst;
 	rlm_sql_handle_t	*handle = NULL;
 
 	int			i, j;
@@ -345,8 +390,6 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST
 
 	char const		*query_str = NULL;
 
-#define MAX_SQL_FIELD_INDEX (64)
-
 	int			field_index[MAX_SQL_FIELD_INDEX];
 	bool			found_field = false;	/* Did we find any matching fields in the result set ? */
 
@@ -427,13 +470,16 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST
 	 *	map set is evaluated (map->rhs can be dynamic).
 	 */
 	for (map = maps, i = 0;
-	     map && (i < MAX_SQL_FIELD_INDEX);
+	     map && (i < map_inst->num_maps);
 	     map = map->next, i++) {
 		/*
-		 *	Expand the RHS to get the name of the SQL field
+		 *	Constant field names were resolved at compile
+		 *	time, only dynamic ones are expanded here.
 		 */
-		if (tmpl_expand(&map_rhs, map_rhs_buff, sizeof(map_rhs_buff),
-				request, map->rhs, NULL, NULL) < 0) {
+		map_rhs = map_inst->fields[i];
+		if (!map_rhs &&
+		    (tmpl_expand(&map_rhs, map_rhs_buff, sizeof(map_rhs_buff),
+				 request, map->rhs, NULL, NULL) < 0)) {
 			RPERROR("Failed getting field name");
 			goto error;
 		}
@@ -499,6 +545,27 @@ static size_t sql_escape_func(UNUSED REQUEST *request, char *out, size_t outlen,
 	rlm_sql_t const		*inst = talloc_get_type_abort_const(handle->inst, rlm_sql_t);
 	size_t			len = 0;
 
+	/*
+	 *	Almost all values need no escaping at all.  Scan with
+	 *	the precomputed table, and if we hit the end of the
+	 *	string without finding anything special, the escaped
+	 *	form is just a copy of the input.
+	 */
+	{
+		uint8_t const *p = (uint8_t const *) in;
+
+		while (inst->escape_allowed[*p]) p++;
+		if (!*p) {
+			len = (char const *) p - in;
+			if (len >= outlen) len = outlen - 1;
+
+			memcpy(out, in, len);
+			out[len] = '\0';
+
+			return len;
+		}
+	}
+
 	while (in[0]) {
 		size_t utf8_len;
 
@@ -562,8 +629,7 @@ static size_t sql_escape_func(UNUSED REQUEST *request, char *out, size_t outlen,
 		 *	Non-printable characters get replaced with their
 		 *	mime-encoded equivalents.
 		 */
-		if ((in[0] < 32) ||
-		    strchr(inst->config->allowed_chars, *in) == NULL) {
+		if (!inst->escape_allowed[(uint8_t) in[0]]) {
 			/*
 			 *	Only 3 or less bytes available.
 			 */
@@ -666,6 +732,13 @@ int sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username)
  */
 #define sql_unset_user(_i, _r) fr_pair_delete_by_da(&_r->packet->vps, _i->sql_user)
 
+/*
+ *	The full list has to be materialised here, as the caller issues
+ *	per-group check/reply queries on the same handle, which can't
+ *	happen while the membership select is still open.  Callers which
+ *	only need to test membership should stream rlm_sql_fetch_row
+ *	directly instead (see sql_groupcmp).
+ */
 static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, REQUEST *request,
 			     rlm_sql_grouplist_t **phead)
 {
@@ -730,7 +803,9 @@ static int sql_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req
 {
 	rlm_sql_handle_t	*handle;
 	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
-	rlm_sql_grouplist_t	*head, *entry;
+	char			*expanded = NULL;
+	rlm_sql_row_t		row;
+	bool			found = false;
 
 	/*
 	 *	No group queries, don't do group comparisons.
@@ -739,6 +814,7 @@ static int sql_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req
 		RWARN("Cannot do group comparison when group_membership_query is not set");
 		return 1;
 	}
+	if (!*inst->config->groupmemb_query) return 1;
 
 	RDEBUG2("sql_groupcmp");
 
@@ -762,28 +838,47 @@ static int sql_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req
 	}
 
 	/*
-	 *	Get the list of groups this user is a member of
+	 *	Run the membership query, and stream the rows straight
+	 *	off the driver cursor.  We only need to know whether one
+	 *	row matches, so there's no point materialising the full
+	 *	group list, and we stop fetching at the first match.
 	 */
-	if (sql_get_grouplist(inst, &handle, request, &head) < 0) {
+	if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
+		       inst->sql_escape_func, handle) < 0) {
 		REDEBUG("Error getting group membership");
 		fr_pool_connection_release(inst->pool, request, handle);
 		return 1;
 	}
 
-	for (entry = head; entry != NULL; entry = entry->next) {
-		if (strcmp(entry->name, check->vp_strvalue) == 0){
-			RDEBUG2("sql_groupcmp finished: User is a member of group %s",
-			       check->vp_strvalue);
-			talloc_free(head);
-			fr_pool_connection_release(inst->pool, request, handle);
-			return 0;
+	if (rlm_sql_select_query(inst, request, &handle, expanded) != RLM_SQL_OK) {
+		talloc_free(expanded);
+		REDEBUG("Error getting group membership");
+		fr_pool_connection_release(inst->pool, request, handle);
+		return 1;
+	}
+	talloc_free(expanded);
+
+	while (rlm_sql_fetch_row(&row, inst, request, &handle) == RLM_SQL_OK) {
+		if (!row[0]) {
+			RDEBUG2("row[0] returned NULL");
+			break;
+		}
+
+		if (strcmp(row[0], check->vp_strvalue) == 0) {
+			found = true;
+			break;
 		}
 	}
 
-	/* Free the grouplist */
-	talloc_free(head);
+	(inst->driver->sql_finish_select_query)(handle, inst->config);
 	fr_pool_connection_release(inst->pool, request, handle);
 
+	if (found) {
+		RDEBUG2("sql_groupcmp finished: User is a member of group %s",
+		        check->vp_strvalue);
+		return 0;
+	}
+
 	RDEBUG2("sql_groupcmp finished: User is NOT a member of group %pV", &check->data);
 
 	return 1;
@@ -1076,7 +1171,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	/*
 	 *	Register the SQL map processor function
 	 */
-	if (inst->driver->sql_fields) map_proc_register(inst, inst->name, mod_map_proc, sql_map_verify, 0);
+	if (inst->driver->sql_fields) map_proc_register(inst, inst->name, mod_map_proc, sql_map_verify,
+							sizeof(sql_map_inst_t));
 
 	return 0;
 }
@@ -1126,6 +1222,20 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->config->accounting.cs = cf_section_find(conf, "accounting", NULL);
 	inst->config->accounting.reference_cp = (cf_pair_find(inst->config->accounting.cs, "reference") != NULL);
 
+	/*
+	 *	Batched accounting needs both halves of the insert.
+	 */
+	if (inst->config->accounting.batch_values) {
+		if (!inst->config->accounting.batch_header) {
+			cf_log_err(conf, "Accounting \"batch_values\" requires \"batch_header\" to be set");
+			return -1;
+		}
+		if (inst->config->accounting.batch_max_rows < 2) {
+			cf_log_err(conf, "Accounting \"batch_max_rows\" must be >= 2");
+			return -1;
+		}
+	}
+
 	inst->config->postauth.cs = cf_section_find(conf, "post-auth", NULL);
 	inst->config->postauth.reference_cp = (cf_pair_find(inst->config->postauth.cs, "reference") != NULL);
 
@@ -1151,6 +1261,19 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 				inst->driver->sql_escape_func :
 				sql_escape_func;
 
+	/*
+	 *	Precompute which bytes pass through the default escape
+	 *	function unmodified, so escaping is a table lookup
+	 *	instead of a strchr() per character.
+	 */
+	{
+		int i;
+
+		for (i = 32; i < 128; i++) {
+			if (strchr(inst->config->allowed_chars, i)) inst->escape_allowed[i] = true;
+		}
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, true, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -1410,6 +1533,253 @@ release:
 	return rcode;
 }
 
+/** Resume ctx for accounting queries driven from the event loop
+ */
+typedef struct {
+	sql_acct_section_t	*section;	//!< Section of redundant queries being processed.
+	rlm_sql_handle_t	*handle;	//!< Connection the current query is running on.
+	CONF_PAIR		*pair;		//!< Current query template.
+	char const		*attr;		//!< Name of the reference config pair.
+	int			fd;		//!< Driver fd we're waiting on.
+	sql_rcode_t		ret;		//!< Result of the yielded query.
+} sql_acct_rctx_t;
+
+/** Release the query state and return the section's final rcode
+ */
+static rlm_rcode_t acct_redundant_finish(rlm_sql_t const *inst, REQUEST *request,
+					 sql_acct_rctx_t *rctx, rlm_rcode_t rcode)
+{
+	fr_pool_connection_release(inst->pool, request, rctx->handle);
+	sql_unset_user(inst, request);
+	talloc_free(rctx);
+
+	return rcode;
+}
+
+/** Process the result of one query in a redundant set
+ *
+ * @return
+ *	- 1 if the caller should run the next query in the set.
+ *	- 0 if we're done, with the final rcode written to *rcode.
+ */
+static int acct_redundant_result(rlm_sql_t const *inst, REQUEST *request,
+				 sql_acct_rctx_t *rctx, sql_rcode_t sql_ret, rlm_rcode_t *rcode)
+{
+	int numaffected;
+
+	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, sql_ret, "<INVALID>"));
+
+	switch (sql_ret) {
+	/*
+	 *  Query was a success! Now we just need to check if it did anything.
+	 */
+	case RLM_SQL_OK:
+		break;
+
+	/*
+	 *  A general, unrecoverable server fault.
+	 */
+	case RLM_SQL_ERROR:
+		*rcode = RLM_MODULE_FAIL;
+		return 0;
+
+	/*
+	 *  The connection is dead.  The blocking API exhausts the pool
+	 *  before returning this, and NULLs the handle.  The async path
+	 *  still holds the dead connection, so close it instead of
+	 *  returning it to the pool.
+	 */
+	case RLM_SQL_RECONNECT:
+		if (rctx->handle) {
+			fr_pool_connection_close(inst->pool, request, rctx->handle);
+			rctx->handle = NULL;
+		}
+		*rcode = RLM_MODULE_FAIL;
+		return 0;
+
+	/*
+	 *  Query was invalid, this is a terminal error, but we still need
+	 *  to do cleanup, as the connection handle is still valid.
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		*rcode = RLM_MODULE_INVALID;
+		return 0;
+
+	/*
+	 *  Driver found an error (like a unique key constraint violation)
+	 *  that hinted it might be a good idea to try an alternative query.
+	 */
+	case RLM_SQL_ALT_QUERY:
+		goto next;
+
+	default:
+		break;
+	}
+	rad_assert(rctx->handle);
+
+	/*
+	 *  We need to have updated something for the query to have been
+	 *  counted as successful.
+	 */
+	numaffected = (inst->driver->sql_affected_rows)(rctx->handle, inst->config);
+	(inst->driver->sql_finish_query)(rctx->handle, inst->config);
+	RDEBUG2("%i record(s) updated", numaffected);
+
+	if (numaffected > 0) {
+		*rcode = RLM_MODULE_OK;	/* A query succeeded, were done! */
+		return 0;
+	}
+
+next:
+	/*
+	 *  We assume all entries with the same name form a redundant
+	 *  set of queries.
+	 */
+	rctx->pair = cf_pair_find_next(rctx->section->cs, rctx->pair, rctx->attr);
+	if (!rctx->pair) {
+		RDEBUG2("No additional queries configured");
+		*rcode = RLM_MODULE_NOOP;
+		return 0;
+	}
+
+	RDEBUG2("Trying next query...");
+
+	return 1;
+}
+
+/** The driver fd became readable, drive the outstanding query
+ */
+static void acct_redundant_readable(void *instance, UNUSED void *thread, REQUEST *request, void *uctx, int fd)
+{
+	rlm_sql_t const	*inst = instance;
+	sql_acct_rctx_t	*rctx = talloc_get_type_abort(uctx, sql_acct_rctx_t);
+
+	rctx->ret = rlm_sql_query_resume(inst, request, rctx->handle);
+	if (rctx->ret == RLM_SQL_YIELD) return;		/* Not done yet, the fd event stays registered */
+
+	(void) unlang_module_fd_delete(request, rctx, fd);
+	unlang_interpret_resumable(request);
+}
+
+/** The driver fd errored out, fail the outstanding query
+ */
+static void acct_redundant_fd_error(UNUSED void *instance, UNUSED void *thread, REQUEST *request, void *uctx, int fd)
+{
+	sql_acct_rctx_t	*rctx = talloc_get_type_abort(uctx, sql_acct_rctx_t);
+
+	rctx->ret = RLM_SQL_RECONNECT;
+
+	(void) unlang_module_fd_delete(request, rctx, fd);
+	unlang_interpret_resumable(request);
+}
+
+/** The request was signalled whilst a query was outstanding
+ */
+static void acct_redundant_signal(void *instance, UNUSED void *thread, REQUEST *request,
+				  void *uctx, fr_state_signal_t action)
+{
+	rlm_sql_t const	*inst = instance;
+	sql_acct_rctx_t	*rctx = talloc_get_type_abort(uctx, sql_acct_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_fd_delete(request, rctx, rctx->fd);
+
+	/*
+	 *	The server may still send a result for the abandoned
+	 *	query, so don't return the connection to the pool.
+	 */
+	fr_pool_connection_close(inst->pool, request, rctx->handle);
+	rctx->handle = NULL;
+
+	(void) acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+}
+
+static rlm_rcode_t acct_redundant_resume(void *instance, void *thread, REQUEST *request, void *uctx);
+
+/** Run queries from a redundant set until one succeeds
+ *
+ * Expands one query at a time, and for drivers with a non-blocking
+ * interface yields the request while the query is outstanding, so a
+ * slow database server doesn't stall the whole worker thread.
+ */
+static rlm_rcode_t acct_redundant_iterate(rlm_sql_t const *inst, REQUEST *request, sql_acct_rctx_t *rctx)
+{
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	sql_rcode_t	sql_ret;
+	char const	*value;
+	char		*expanded = NULL;
+
+	while (true) {
+		value = cf_pair_value(rctx->pair);
+		if (!value) {
+			RDEBUG2("Ignoring null query");
+
+			return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
+		}
+
+		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, rctx->handle) < 0) {
+			return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+		}
+
+		if (!*expanded) {
+			talloc_free(expanded);
+			RDEBUG2("Ignoring null query");
+
+			return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
+		}
+
+		rlm_sql_query_log(inst, request, rctx->section, expanded);
+
+		if (rlm_sql_query_async_supported(inst)) {
+			sql_ret = rlm_sql_query_start(inst, request, rctx->handle, expanded);
+			if (sql_ret == RLM_SQL_YIELD) {
+				TALLOC_FREE(expanded);
+
+				rctx->fd = rlm_sql_query_fd(inst, rctx->handle);
+				if ((rctx->fd < 0) ||
+				    (unlang_module_fd_add(request, acct_redundant_readable, NULL,
+							  acct_redundant_fd_error, rctx, rctx->fd) < 0)) {
+					return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
+				}
+
+				return unlang_module_yield(request, acct_redundant_resume,
+							   acct_redundant_signal, rctx);
+			}
+
+			/*
+			 *	Couldn't submit the query.  Fall back to
+			 *	the blocking API, which drives the pool's
+			 *	reconnection logic.
+			 */
+			if (sql_ret == RLM_SQL_RECONNECT) sql_ret = rlm_sql_query(inst, request, &rctx->handle,
+										  expanded);
+		} else {
+			sql_ret = rlm_sql_query(inst, request, &rctx->handle, expanded);
+		}
+		TALLOC_FREE(expanded);
+
+		if (!acct_redundant_result(inst, request, rctx, sql_ret, &rcode)) {
+			return acct_redundant_finish(inst, request, rctx, rcode);
+		}
+	}
+}
+
+/** Resume processing of a redundant set after a yielded query completed
+ */
+static rlm_rcode_t acct_redundant_resume(void *instance, UNUSED void *thread, REQUEST *request, void *uctx)
+{
+	rlm_sql_t const	*inst = instance;
+	sql_acct_rctx_t	*rctx = talloc_get_type_abort(uctx, sql_acct_rctx_t);
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+
+	if (!acct_redundant_result(inst, request, rctx, rctx->ret, &rcode)) {
+		return acct_redundant_finish(inst, request, rctx, rcode);
+	}
+
+	return acct_redundant_iterate(inst, request, rctx);
+}
+
 /*
  *	Generic function for failing between a bunch of queries.
  *
@@ -1420,31 +1790,24 @@ release:
  *	doesn't update any rows, the next matching config item is used.
  *
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
+	sql_acct_rctx_t		*rctx;
 
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
 
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	rad_assert(section);
 
+	MEM(rctx = talloc_zero(request, sql_acct_rctx_t));
+	rctx->section = section;
+
 	if (section->reference[0] != '.') *p++ = '.';
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
 	}
 
 	/*
@@ -1454,140 +1817,235 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
 
-		goto finish;
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
 
-		goto finish;
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_NOOP);
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	rctx->pair = cf_item_to_pair(item);
+	rctx->attr = cf_pair_attr(rctx->pair);
 
-	RDEBUG2("Using query template '%s'", attr);
+	RDEBUG2("Using query template '%s'", rctx->attr);
 
-	handle = fr_pool_connection_get(inst->pool, request);
-	if (!handle) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+	rctx->handle = fr_pool_connection_get(inst->pool, request);
+	if (!rctx->handle) {
+		return acct_redundant_finish(inst, request, rctx, RLM_MODULE_FAIL);
 	}
 
 	sql_set_user(inst, request, NULL);
 
-	while (true) {
-		value = cf_pair_value(pair);
-		if (!value) {
-			RDEBUG2("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	return acct_redundant_iterate(inst, request, rctx);
+}
 
-			goto finish;
-		}
+/** Per-thread batch of buffered accounting rows
+ *
+ *  Nothing here is locked, the batch is only ever touched from its
+ *  own worker thread's event loop.
+ */
+typedef struct {
+	rlm_sql_t const		*inst;		//!< Instance the batch belongs to.
+	fr_event_list_t		*el;		//!< Worker's event list, used for the flush timer.
+	fr_event_timer_t const	*ev;		//!< Fires when the batch window expires.
+	fr_dlist_head_t		rows;		//!< Buffered rows, oldest first.
+	uint32_t		num_rows;	//!< How many rows are buffered.
+} rlm_sql_thread_t;
+
+/** One buffered accounting row, and the request waiting on it
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the thread's list of buffered rows.
+	rlm_sql_thread_t	*t;		//!< Thread the row is buffered on.
+	REQUEST			*request;	//!< Yielded until the batch is written.  NULL if
+						//!< the request was cancelled while it waited.
+	char			*values;	//!< Expanded row tuple.
+	sql_rcode_t		ret;		//!< Result of the batched query.
+} sql_batch_row_t;
+
+/** Write out the buffered rows as one multi-row insert
+ *
+ *  The combined query is run through the blocking API.  That stalls
+ *  this worker for one round trip per batch, instead of one per
+ *  packet, which is the point of batching.
+ */
+static void sql_batch_flush(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const		*inst = t->inst;
+	rlm_sql_handle_t	*handle;
+	sql_batch_row_t		*row;
+	char			*query;
+	sql_rcode_t		ret;
+	uint32_t		num;
 
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
+	if (t->ev) fr_event_timer_delete(t->el, &t->ev);
 
-			goto finish;
+	if (!t->num_rows) return;
+
+	MEM(query = talloc_typed_strdup(NULL, inst->config->accounting.batch_header));
+	num = 0;
+	for (row = fr_dlist_head(&t->rows); row; row = fr_dlist_next(&t->rows, row)) {
+		MEM(query = talloc_asprintf_append_buffer(query, "%s%s", num ? ", " : " ", row->values));
+		num++;
+	}
+
+	DEBUG2("Writing batch of %u accounting row(s)", num);
+
+	handle = fr_pool_connection_get(inst->pool, NULL);
+	if (!handle) {
+		ret = RLM_SQL_ERROR;
+	} else {
+		ret = rlm_sql_query(inst, NULL, &handle, query);
+		if (ret == RLM_SQL_OK) {
+			DEBUG2("%i record(s) updated", (inst->driver->sql_affected_rows)(handle, inst->config));
+			(inst->driver->sql_finish_query)(handle, inst->config);
 		}
+		if (handle) fr_pool_connection_release(inst->pool, NULL, handle);
+	}
+	talloc_free(query);
 
-		if (!*expanded) {
-			RDEBUG2("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	/*
+	 *	Wake the requests waiting on the batch.  Each row is
+	 *	freed by its request's resume function, or here if the
+	 *	request went away while the row was buffered.
+	 */
+	t->num_rows = 0;
+	while ((row = fr_dlist_head(&t->rows))) {
+		fr_dlist_remove(&t->rows, row);
 
-			goto finish;
+		if (!row->request) {
+			talloc_free(row);
+			continue;
 		}
 
-		rlm_sql_query_log(inst, request, section, expanded);
+		row->ret = ret;
+		unlang_interpret_resumable(row->request);
+	}
+}
 
-		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
-		TALLOC_FREE(expanded);
-		RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, sql_ret, "<INVALID>"));
+/** The batch window expired, flush whatever has accumulated
+ */
+static void _sql_batch_window_expired(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_sql_thread_t *t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
 
-		switch (sql_ret) {
-		/*
-		 *  Query was a success! Now we just need to check if it did anything.
-		 */
-		case RLM_SQL_OK:
-			break;
+	sql_batch_flush(t);
+}
 
-		/*
-		 *  A general, unrecoverable server fault.
-		 */
-		case RLM_SQL_ERROR:
-		/*
-		 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
-		 *  were exhausted, and we couldn't create a new connection,
-		 *  so we do not need to call fr_pool_connection_release.
-		 */
-		case RLM_SQL_RECONNECT:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+#ifdef WITH_ACCOUNTING
 
-		/*
-		 *  Query was invalid, this is a terminal error, but we still need
-		 *  to do cleanup, as the connection handle is still valid.
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+/** Resume a request after the batch containing its row was written
+ */
+static rlm_rcode_t sql_batch_resume(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request, void *uctx)
+{
+	sql_batch_row_t	*row = talloc_get_type_abort(uctx, sql_batch_row_t);
+	sql_rcode_t	ret = row->ret;
 
-		/*
-		 *  Driver found an error (like a unique key constraint violation)
-		 *  that hinted it might be a good idea to try an alternative query.
-		 */
-		case RLM_SQL_ALT_QUERY:
-			goto next;
-		}
-		rad_assert(handle);
+	talloc_free(row);
 
-		/*
-		 *  We need to have updated something for the query to have been
-		 *  counted as successful.
-		 */
-		numaffected = (inst->driver->sql_affected_rows)(handle, inst->config);
-		(inst->driver->sql_finish_query)(handle, inst->config);
-		RDEBUG2("%i record(s) updated", numaffected);
+	return (ret == RLM_SQL_OK) ? RLM_MODULE_OK : RLM_MODULE_FAIL;
+}
 
-		if (numaffected > 0) break;	/* A query succeeded, were done! */
-	next:
-		/*
-		 *  We assume all entries with the same name form a redundant
-		 *  set of queries.
-		 */
-		pair = cf_pair_find_next(section->cs, pair, attr);
+/** The request was signalled whilst its row sat in the batch
+ */
+static void sql_batch_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+			     void *uctx, fr_state_signal_t action)
+{
+	sql_batch_row_t	*row = talloc_get_type_abort(uctx, sql_batch_row_t);
 
-		if (!pair) {
-			RDEBUG2("No additional queries configured");
-			rcode = RLM_MODULE_NOOP;
+	if (action != FR_SIGNAL_CANCEL) return;
 
-			goto finish;
-		}
+	/*
+	 *	Keep the row, the data should still reach the
+	 *	database.  Just don't try to resume the request when
+	 *	the batch is written.
+	 */
+	row->request = NULL;
+}
+
+/** Buffer one accounting row, and yield until the batch is written
+ */
+static rlm_rcode_t sql_batch_enqueue(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request)
+{
+	rlm_sql_handle_t	*handle;
+	sql_batch_row_t		*row;
+	char			*expanded = NULL;
+
+	if (sql_set_user(inst, request, NULL) < 0) return RLM_MODULE_FAIL;
 
-		RDEBUG2("Trying next query...");
+	/*
+	 *	The escape function needs a connection for driver
+	 *	specific quoting.  It's only borrowed for the
+	 *	expansion, not held while the row sits in the batch.
+	 */
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) {
+	error:
+		sql_unset_user(inst, request);
+		return RLM_MODULE_FAIL;
 	}
 
-finish:
-	talloc_free(expanded);
+	if (xlat_aeval(request, &expanded, request, inst->config->accounting.batch_values,
+		       inst->sql_escape_func, handle) < 0) {
+		fr_pool_connection_release(inst->pool, request, handle);
+		goto error;
+	}
 	fr_pool_connection_release(inst->pool, request, handle);
 	sql_unset_user(inst, request);
 
-	return rcode;
-}
+	if (!*expanded) {
+		talloc_free(expanded);
+		RDEBUG2("Ignoring null row");
 
-#ifdef WITH_ACCOUNTING
+		return RLM_MODULE_NOOP;
+	}
+
+	MEM(row = talloc_zero(t, sql_batch_row_t));
+	row->t = t;
+	row->request = request;
+	row->values = talloc_steal(row, expanded);
+
+	fr_dlist_insert_tail(&t->rows, row);
+	t->num_rows++;
+
+	RDEBUG2("Buffering accounting row %u of %u", t->num_rows, inst->config->accounting.batch_max_rows);
+
+	/*
+	 *	The first row in a batch opens the flush window.  When
+	 *	the batch fills before the window expires, flush on the
+	 *	next event loop iteration, i.e. once this request has
+	 *	yielded.
+	 */
+	if ((t->num_rows == 1) || (t->num_rows >= inst->config->accounting.batch_max_rows)) {
+		fr_time_delta_t delay = (t->num_rows >= inst->config->accounting.batch_max_rows) ?
+					0 : inst->config->accounting.batch_window;
+
+		if (fr_event_timer_in(t, t->el, &t->ev, delay, _sql_batch_window_expired, t) < 0) {
+			RERROR("Failed inserting batch flush timer");
+			fr_dlist_remove(&t->rows, row);
+			t->num_rows--;
+			talloc_free(row);
+			return RLM_MODULE_FAIL;
+		}
+	}
+
+	return unlang_module_yield(request, sql_batch_resume, sql_batch_signal, row);
+}
 
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
+	if (inst->config->accounting.batch_values) {
+		return sql_batch_enqueue(inst, talloc_get_type_abort(thread, rlm_sql_thread_t), request);
+	}
+
 	if (inst->config->accounting.reference_cp) {
 		return acct_redundant(inst, request, &inst->config->accounting);
 	}
@@ -1616,6 +2074,33 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
  *	Execute postauth_query after authentication
  */
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t		*inst = talloc_get_type_abort(instance, rlm_sql_t);
+	rlm_sql_thread_t	*t = thread;
+
+	talloc_set_type(t, rlm_sql_thread_t);
+	t->inst = inst;
+	t->el = el;
+	fr_dlist_init(&t->rows, sql_batch_row_t, entry);
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	/*
+	 *	Don't lose rows buffered at shutdown.  Requests still
+	 *	waiting on the batch were cancelled before the thread
+	 *	is torn down, which detached them from their rows.
+	 */
+	sql_batch_flush(t);
+
+	return 0;
+}
 
 /* globally exported name */
 module_t rlm_sql = {
@@ -1627,6 +2112,11 @@ module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -46,6 +46,7 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_YIELD			//!< Non-blocking query still in progress.
 } sql_rcode_t;
 
 typedef enum {
@@ -83,6 +84,15 @@ typedef struct {
 	char const		*logfile;
 
 	char const		**query;			/* for xlat parsing */
+
+	char const		*batch_header;			//!< Literal SQL which precedes the batched
+								//!< row tuples, e.g. "INSERT INTO ... VALUES".
+	char const		*batch_values;			//!< xlat expansion producing one row tuple.
+								//!< Enables batch mode when set.
+	uint32_t		batch_max_rows;			//!< Flush the batch once it's buffered this
+								//!< many rows.
+	fr_time_delta_t		batch_window;			//!< Flush the batch when the oldest buffered
+								//!< row is this old.
 } sql_acct_section_t;
 
 typedef struct {
@@ -142,12 +152,33 @@ typedef struct {
 
 typedef struct sql_inst rlm_sql_t;
 
+#define SQL_HANDLE_PREPARED_MAX	(16)			//!< Distinct query shapes cached per connection.
+#define SQL_PREPARED_MAX_PARAMS	(32)			//!< Most literals we'll lift out of one query.
+
+/** One prepared statement, cached on a connection handle
+ *
+ * Statements are keyed on the query "shape", i.e. the expanded query
+ * with its literals replaced by placeholders.  The database only
+ * parses each shape once per connection, no matter how many different
+ * literal values we execute it with.
+ */
+typedef struct {
+	char			*query;				//!< Query shape this statement was prepared from.
+	char			name[8];			//!< Statement name, unique within the connection.
+	uint64_t		last_used;			//!< For LRU eviction.
+} rlm_sql_prepared_t;
+
 typedef struct {
 	void			*conn;				//!< Database specific connection handle.
 	rlm_sql_row_t		row;				//!< Row data from the last query.
 	rlm_sql_t const		*inst;				//!< The rlm_sql instance this connection belongs to.
 	TALLOC_CTX		*log_ctx;			//!< Talloc pool used to avoid allocing memory
 								//!< when log strings need to be copied.
+
+	rlm_sql_prepared_t	prepared[SQL_HANDLE_PREPARED_MAX];	//!< Prepared statement cache, used only
+								//!< if the driver provides sql_prepare and
+								//!< sql_query_prepared.
+	uint64_t		prepared_counter;		//!< Monotonic use counter for LRU eviction.
 } rlm_sql_handle_t;
 
 extern fr_table_num_sorted_t const sql_rcode_description_table[];
@@ -197,6 +228,39 @@ typedef struct {
 	sql_rcode_t (*sql_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
 	sql_rcode_t (*sql_store_result)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
+	/*
+	 *	Optional non-blocking interface.  A driver providing all
+	 *	three callbacks can have its queries driven from the event
+	 *	loop via rlm_sql_query_start() and friends, instead of
+	 *	blocking a worker thread until the server answers.
+	 *
+	 *	sql_query_start submits the query without waiting, and
+	 *	returns RLM_SQL_YIELD if the result isn't available yet.
+	 *	sql_query_resume should then be called each time the fd
+	 *	returned by sql_fd becomes readable, until it returns
+	 *	something other than RLM_SQL_YIELD.
+	 */
+	sql_rcode_t (*sql_query_start)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	sql_rcode_t (*sql_query_resume)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	int (*sql_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional prepared statement interface.  A driver providing
+	 *	both callbacks lets rlm_sql_query() prepare each query shape
+	 *	once per connection, and execute it with just the literal
+	 *	values on subsequent calls.
+	 *
+	 *	sql_prepare must replace any statement previously prepared
+	 *	under the same name on this connection.  Placeholders in the
+	 *	query are written as $1..$n; drivers whose native syntax
+	 *	differs should rewrite them here, where the cost is paid
+	 *	once, not per execution.
+	 */
+	sql_rcode_t (*sql_prepare)(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+				   char const *name, char const *query, int nparams);
+	sql_rcode_t (*sql_query_prepared)(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					  char const *name, char const * const *params, int nparams);
+
 	int (*sql_num_fields)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 	int (*sql_num_rows)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 	int (*sql_affected_rows)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
@@ -228,6 +292,8 @@ struct sql_inst {
 
 	int (*sql_set_user)(rlm_sql_t const *inst, REQUEST *request, char const *username);
 	xlat_escape_t sql_escape_func;
+	bool escape_allowed[UINT8_MAX + 1];	//!< Bytes the default escape function passes through
+						//!< unmodified, precomputed from allowed_chars.
 	sql_rcode_t (*sql_query)(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_select_query)(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_fetch_row)(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
@@ -243,13 +309,17 @@ struct rlm_sql_grouplist_s {
 };
 
 void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout);
-int		sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **first_pair, rlm_sql_row_t row);
+int		sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, fr_cursor_t *cursor, rlm_sql_row_t row);
 int		sql_read_realms(rlm_sql_handle_t *handle);
 int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, char const *query);
 int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
 sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
 sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+bool		rlm_sql_query_async_supported(rlm_sql_t const *inst) CC_HINT(nonnull);
+sql_rcode_t	rlm_sql_query_start(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_query_resume(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle) CC_HINT(nonnull (1, 3));
+int		rlm_sql_query_fd(rlm_sql_t const *inst, rlm_sql_handle_t *handle) CC_HINT(nonnull);
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
@@ -44,6 +44,7 @@ RCSID("$Id$")
  *	readable reason strings.
  */
 fr_table_num_sorted_t const sql_rcode_description_table[] = {
+	{ "in progress",	RLM_SQL_YIELD		},
 	{ "need alt query",	RLM_SQL_ALT_QUERY	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
@@ -59,7 +60,8 @@ fr_table_num_sorted_t const sql_rcode_table[] = {
 	{ "error",		RLM_SQL_ERROR		},
 	{ "invalid",		RLM_SQL_QUERY_INVALID	},
 	{ "ok",			RLM_SQL_OK		},
-	{ "reconnect",		RLM_SQL_RECONNECT	}
+	{ "reconnect",		RLM_SQL_RECONNECT	},
+	{ "yield",		RLM_SQL_YIELD		}
 };
 size_t sql_rcode_table_len = NUM_ELEMENTS(sql_rcode_table);
 
@@ -113,7 +115,7 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout)
  *	Purpose: Read entries from the database and fill VALUE_PAIR structures
  *
  *************************************************************************/
-int sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **head, rlm_sql_row_t row)
+int sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, fr_cursor_t *cursor, rlm_sql_row_t row)
 {
 	VALUE_PAIR *vp;
 	char const *ptr, *value;
@@ -219,9 +221,11 @@ int sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **h
 	}
 
 	/*
-	 *	Add the pair into the packet
+	 *	Add the pair into the packet.  The cursor tracks the
+	 *	tail of the list, so appending each row is O(1) rather
+	 *	than a walk of everything added so far.
 	 */
-	fr_pair_add(head, vp);
+	fr_cursor_append(cursor, vp);
 	return 0;
 }
 
@@ -317,6 +321,193 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
+/** Reduce an expanded query to its shape, lifting literals out as parameters
+ *
+ * The queries we execute only vary in their literals; the surrounding SQL
+ * comes from the configuration and is fixed.  Replacing each string and
+ * numeric literal with a $N placeholder recovers a query shape the database
+ * can parse and plan once per connection.
+ *
+ * The tokenizer is deliberately conservative.  Anything it doesn't fully
+ * understand (backslash escapes, comments, unterminated quotes, too many
+ * literals) makes it give up, and the caller falls back to sending the
+ * query as text.
+ *
+ * @param[out] out	where to write the query shape.
+ * @param[in] outlen	size of the out buffer.
+ * @param[out] params	array of at least #SQL_PREPARED_MAX_PARAMS pointers,
+ *			populated with the extracted literal values.
+ * @param[out] values	buffer the extracted values are written to.
+ * @param[in] values_len size of the values buffer.
+ * @param[in] query	expanded query to normalize.
+ * @return
+ *	- >= 0 the number of literals extracted.
+ *	- -1 if the query can't be normalized, and should be sent as text.
+ */
+static int sql_query_normalize(char *out, size_t outlen,
+			       char const *params[], char *values, size_t values_len,
+			       char const *query)
+{
+	char const	*p = query;
+	char		*shape = out, *shape_end = out + (outlen - 1);
+	char		*value = values, *value_end = values + values_len;
+	int		nparams = 0;
+	size_t		len;
+	char		prev = '\0';
+
+	while (*p) {
+		/*
+		 *	String literal.  The only escape we accept is the
+		 *	standard doubled quote.
+		 */
+		if (*p == '\'') {
+			if (nparams == SQL_PREPARED_MAX_PARAMS) return -1;
+			params[nparams] = value;
+
+			p++;
+			while (true) {
+				if (!*p || (*p == '\\')) return -1;
+				if (*p == '\'') {
+					if (p[1] != '\'') break;
+					p++;			/* '' collapses to ' */
+				}
+				if (value == value_end) return -1;
+				*value++ = *p++;
+			}
+			p++;					/* Skip the closing quote */
+
+			if (value == value_end) return -1;
+			*value++ = '\0';
+			nparams++;
+
+			len = snprintf(shape, (shape_end - shape) + 1, "$%d", nparams);
+			if ((ssize_t)len > (shape_end - shape)) return -1;
+			shape += len;
+			prev = '0';				/* Never a literal boundary */
+			continue;
+		}
+
+		/*
+		 *	Numeric literal, if it starts at a boundary and
+		 *	isn't part of an identifier.
+		 */
+		if (isdigit((uint8_t) *p) &&
+		    !isalnum((uint8_t) prev) && (prev != '_') && (prev != '$') && (prev != '.') && (prev != '"')) {
+			char const *q = p;
+
+			while (isdigit((uint8_t) *q)) q++;
+			if (*q == '.') {
+				q++;
+				while (isdigit((uint8_t) *q)) q++;
+			}
+
+			/*
+			 *	"1e5", "30d" etc. - not a plain number,
+			 *	copy it through verbatim.
+			 */
+			if (isalnum((uint8_t) *q) || (*q == '_') || (*q == '$') || (*q == '.')) {
+				if ((shape_end - shape) < (q - p)) return -1;
+				memcpy(shape, p, q - p);
+				shape += q - p;
+				prev = q[-1];
+				p = q;
+				continue;
+			}
+
+			if (nparams == SQL_PREPARED_MAX_PARAMS) return -1;
+			if ((value_end - value) < ((q - p) + 1)) return -1;
+			params[nparams] = value;
+			memcpy(value, p, q - p);
+			value += q - p;
+			*value++ = '\0';
+			nparams++;
+
+			len = snprintf(shape, (shape_end - shape) + 1, "$%d", nparams);
+			if ((ssize_t)len > (shape_end - shape)) return -1;
+			shape += len;
+			prev = '0';
+			p = q;
+			continue;
+		}
+
+		/*
+		 *	Comments could hide quotes from us, refuse to guess.
+		 */
+		if (((p[0] == '-') && (p[1] == '-')) || ((p[0] == '/') && (p[1] == '*'))) return -1;
+
+		if (shape == shape_end) return -1;
+		prev = *p;
+		*shape++ = *p++;
+	}
+	*shape = '\0';
+
+	return nparams;
+}
+
+/** Run a query via the driver's prepared statement interface
+ *
+ * Looks the query shape up in the handle's statement cache, preparing it
+ * (and evicting the least recently used statement) on a miss.
+ *
+ * @param[in] inst	#rlm_sql_t instance data.
+ * @param[in] request	Current request.
+ * @param[in] handle	to query the database with.
+ * @param[in] query	expanded query to execute.
+ * @param[out] ret_p	the driver rcode, written only when we return true.
+ * @return
+ *	- true if the query was executed as a prepared statement.
+ *	- false if the caller should fall back to the plain text path.
+ */
+static bool sql_query_prepared(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+			       char const *query, int *ret_p)
+{
+	char			shape[2048];
+	char			values[2048];
+	char const		*params[SQL_PREPARED_MAX_PARAMS];
+	int			nparams, i;
+	rlm_sql_prepared_t	*slot = NULL, *lru;
+
+	nparams = sql_query_normalize(shape, sizeof(shape), params, values, sizeof(values), query);
+	if (nparams < 0) return false;
+
+	lru = &handle->prepared[0];
+	for (i = 0; i < SQL_HANDLE_PREPARED_MAX; i++) {
+		rlm_sql_prepared_t *ps = &handle->prepared[i];
+
+		if (ps->query && (strcmp(ps->query, shape) == 0)) {
+			slot = ps;
+			break;
+		}
+		if (ps->last_used < lru->last_used) lru = ps;
+	}
+
+	if (!slot) {
+		slot = lru;
+		TALLOC_FREE(slot->query);
+		snprintf(slot->name, sizeof(slot->name), "fr%u", (unsigned int)(slot - handle->prepared));
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Preparing statement %s: %s", slot->name, shape);
+
+		if ((inst->driver->sql_prepare)(handle, inst->config, slot->name, shape, nparams) != RLM_SQL_OK) {
+			/*
+			 *	The shape may use syntax the database won't
+			 *	prepare.  Send the query as text instead,
+			 *	the error (if any) will be reported there.
+			 */
+			return false;
+		}
+		slot->query = talloc_typed_strdup(handle, shape);
+	}
+	slot->last_used = ++handle->prepared_counter;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Executing prepared statement %s", slot->name);
+	if (request && RDEBUG_ENABLED3) for (i = 0; i < nparams; i++) RDEBUG3("$%d = \"%s\"", i + 1, params[i]);
+
+	*ret_p = (inst->driver->sql_query_prepared)(handle, inst->config, slot->name, params, nparams);
+
+	return true;
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -357,9 +548,23 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	 *  a new connection, then give up.
 	 */
 	for (i = 0; i < (count + 1); i++) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+		bool prepared = false;
+
+		/*
+		 *	Preferentially use the prepared statement interface,
+		 *	falling back to sending the query as text if the
+		 *	driver doesn't provide one, or the query can't be
+		 *	normalized into a preparable shape.
+		 */
+		if (inst->driver->sql_prepare && inst->driver->sql_query_prepared) {
+			prepared = sql_query_prepared(inst, request, *handle, query, &ret);
+		}
 
-		ret = (inst->driver->sql_query)(*handle, inst->config, query);
+		if (!prepared) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+
+			ret = (inst->driver->sql_query)(*handle, inst->config, query);
+		}
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -419,6 +624,133 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	return RLM_SQL_ERROR;
 }
 
+/** Log and translate driver errors the same way rlm_sql_query does
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle the query was run on.
+ * @param ret returned by the driver.
+ * @return the translated return code.
+ */
+static sql_rcode_t sql_query_error(rlm_sql_t const *inst, REQUEST *request,
+				   rlm_sql_handle_t *handle, sql_rcode_t ret)
+{
+	switch (ret) {
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, handle, false);
+			(inst->driver->sql_finish_query)(handle, inst->config);
+			break;
+		}
+		ret = RLM_SQL_ALT_QUERY;
+		/* FALL-THROUGH */
+
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, handle, true);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+/** Whether the driver can run queries without blocking
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @return true if the driver provides the full non-blocking interface.
+ */
+bool rlm_sql_query_async_supported(rlm_sql_t const *inst)
+{
+	return (inst->driver->sql_query_start && inst->driver->sql_query_resume && inst->driver->sql_fd);
+}
+
+/** Submit a query without waiting for the result
+ *
+ * On #RLM_SQL_YIELD the caller should wait for the fd returned by
+ * #rlm_sql_query_fd to become readable, then call #rlm_sql_query_resume.
+ *
+ * Unlike #rlm_sql_query, connection errors are not retried here.  On
+ * #RLM_SQL_RECONNECT the caller should fall back to the blocking API,
+ * which drives the pool's reconnection logic.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_YIELD if the query was submitted.
+ *	- #RLM_SQL_OK if the result was available immediately.
+ *	- Any of the #rlm_sql_query error codes.
+ */
+sql_rcode_t rlm_sql_query_start(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, char const *query)
+{
+	sql_rcode_t ret;
+
+	rad_assert(rlm_sql_query_async_supported(inst));
+
+	/* There's no query to run, return an error */
+	if (query[0] == '\0') {
+		if (request) REDEBUG("Zero length query");
+		return RLM_SQL_QUERY_INVALID;
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+
+	ret = (inst->driver->sql_query_start)(handle, inst->config, query);
+	if ((ret == RLM_SQL_OK) || (ret == RLM_SQL_YIELD) || (ret == RLM_SQL_RECONNECT)) return ret;
+
+	return sql_query_error(inst, request, handle, ret);
+}
+
+/** Drive an outstanding non-blocking query towards completion
+ *
+ * Should be called each time the fd returned by #rlm_sql_query_fd
+ * becomes readable, until something other than #RLM_SQL_YIELD is
+ * returned.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle the query was submitted on.
+ * @return
+ *	- #RLM_SQL_YIELD if the result still isn't available.
+ *	- #RLM_SQL_OK on success.
+ *	- Any of the #rlm_sql_query error codes.
+ */
+sql_rcode_t rlm_sql_query_resume(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle)
+{
+	sql_rcode_t ret;
+
+	rad_assert(rlm_sql_query_async_supported(inst));
+
+	ret = (inst->driver->sql_query_resume)(handle, inst->config);
+	if ((ret == RLM_SQL_OK) || (ret == RLM_SQL_YIELD) || (ret == RLM_SQL_RECONNECT)) return ret;
+
+	return sql_query_error(inst, request, handle, ret);
+}
+
+/** Return the fd to wait on for an outstanding non-blocking query
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param handle the query was submitted on.
+ * @return
+ *	- The fd to wait on.
+ *	- -1 if the driver couldn't provide one.
+ */
+int rlm_sql_query_fd(rlm_sql_t const *inst, rlm_sql_handle_t *handle)
+{
+	rad_assert(rlm_sql_query_async_supported(inst));
+
+	return (inst->driver->sql_fd)(handle, inst->config);
+}
+
 /** Call the driver's sql_select_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
@@ -506,14 +838,17 @@ int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_
 	rlm_sql_row_t	row;
 	int		rows = 0;
 	sql_rcode_t	rcode;
+	fr_cursor_t	cursor;
 
 	rad_assert(request);
 
 	rcode = rlm_sql_select_query(inst, request, handle, query);
 	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query */
 
+	fr_cursor_init(&cursor, pair);
+
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == RLM_SQL_OK) {
-		if (sql_fr_pair_list_afrom_str(ctx, request, pair, row) != 0) {
+		if (sql_fr_pair_list_afrom_str(ctx, request, &cursor, row) != 0) {
 			REDEBUG("Error parsing user data from database result");
 
 			(inst->driver->sql_finish_select_query)(*handle, inst->config);
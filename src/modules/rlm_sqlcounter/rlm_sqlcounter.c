@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/rad_assert.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 #define MAX_QUERY_LEN 1024
 
@@ -69,10 +70,42 @@ typedef struct {
 	char const	*query;		//!< SQL query to retrieve current session time.
 	char const	*reset;  	//!< Daily, weekly, monthly, never or user defined.
 
+	bool		incremental;	//!< Advance counters in memory from accounting packets,
+					///< only reconciling with SQL periodically.
+	fr_time_delta_t	sync_period;	//!< How long an in-memory counter is trusted before it's
+					///< reconciled with SQL again.
+	vp_tmpl_t	*increment_attr; //!< Attribute added to the in-memory counter, usually
+					///< Acct-Session-Time or one of the octets counters.
+
+	rbtree_t	*counters;	//!< In-memory counters, keyed on the expanded key.
+	pthread_mutex_t	mutex;		//!< Protects the counter tree.
+
 	fr_time_t	reset_time;
 	fr_time_t	last_reset;
 } rlm_sqlcounter_t;
 
+/** One in-memory counter
+ *
+ * The counter the rest of the server sees is sql_value + delta.
+ * Reconciling with SQL folds the accounting updates we counted into
+ * sql_value (the database saw the same packets), and restarts delta
+ * from zero.
+ */
+typedef struct {
+	char const	*key;		//!< Expanded key the counter is tracked under.
+	uint64_t	sql_value;	//!< Value returned by the last SQL query.
+	uint64_t	delta;		//!< Accounting updates applied since then.
+	fr_time_t	synced;		//!< When we last ran the SQL query.
+	fr_time_t	window_start;	//!< Reset window the values belong to.
+} sqlcounter_entry_t;
+
+static int sqlcounter_entry_cmp(void const *one, void const *two)
+{
+	sqlcounter_entry_t const *a = one, *b = two;
+
+	return strcmp(a->key, b->key);
+}
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_sqlcounter_t, sqlmod_inst) },
 
@@ -82,6 +115,10 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, rlm_sqlcounter_t, key), .dflt = "%{%{Stripped-User-Name}:-%{User-Name}}", .quote = T_DOUBLE_QUOTED_STRING },
 
+	{ FR_CONF_OFFSET("incremental", FR_TYPE_BOOL, rlm_sqlcounter_t, incremental), .dflt = "no" },
+	{ FR_CONF_OFFSET("sync_period", FR_TYPE_TIME_DELTA, rlm_sqlcounter_t, sync_period), .dflt = "60" },
+	{ FR_CONF_OFFSET("increment", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_sqlcounter_t, increment_attr), .dflt = "&Acct-Session-Time", .quote = T_BARE_WORD },
+
 	/* Just used to register a paircmp against */
 	{ FR_CONF_OFFSET("counter_name", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE | FR_TYPE_REQUIRED, rlm_sqlcounter_t, paircmp_attr) },
 	{ FR_CONF_OFFSET("check_name", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE | FR_TYPE_REQUIRED, rlm_sqlcounter_t, limit_attr) },
@@ -101,11 +138,13 @@ fr_dict_autoload_t rlm_sqlcounter_dict[] = {
 	{ NULL }
 };
 
+static fr_dict_attr_t const *attr_acct_status_type;
 static fr_dict_attr_t const *attr_reply_message;
 static fr_dict_attr_t const *attr_session_timeout;
 
 extern fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[];
 fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[] = {
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_reply_message, .name = "Reply-Message", .type = FR_TYPE_STRING, .dict = &dict_radius },
 	{ .out = &attr_session_timeout, .name = "Session-Timeout", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
@@ -338,14 +377,10 @@ static ssize_t sqlcounter_expand(char *out, int outlen, rlm_sqlcounter_t const *
 
 
 /*
- *	See if the counter matches.
+ *	Run the SQL aggregate query, and parse the result as a counter.
  */
-static int counter_cmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req , VALUE_PAIR *check,
-		       UNUSED VALUE_PAIR *check_pairs, UNUSED VALUE_PAIR **reply_pairs)
+static int sqlcounter_query(uint64_t *out, rlm_sqlcounter_t const *inst, REQUEST *request)
 {
-	rlm_sqlcounter_t const *inst = instance;
-	uint64_t counter;
-
 	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
 	char *expanded = NULL;
 	size_t len;
@@ -354,7 +389,7 @@ static int counter_cmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req
 	if (sqlcounter_expand(subst, sizeof(subst), inst, request, inst->query) <= 0) {
 		REDEBUG("Insufficient query buffer space");
 
-		return RLM_MODULE_FAIL;
+		return -1;
 	}
 
 	/* Then combine that with the name of the module were using to do the query */
@@ -362,19 +397,104 @@ static int counter_cmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req
 	if (len >= sizeof(query) - 1) {
 		REDEBUG("Insufficient query buffer space");
 
-		return RLM_MODULE_FAIL;
+		return -1;
 	}
 
 	/* Finally, xlat resulting SQL query */
 	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) {
-		return RLM_MODULE_FAIL;
+		return -1;
 	}
 
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in string \"%s\"", expanded);
+	if (sscanf(expanded, "%" PRIu64, out) != 1) {
+		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
+			expanded);
+		*out = 0;
 	}
 	talloc_free(expanded);
 
+	return 0;
+}
+
+/*
+ *	Get the current counter value.
+ *
+ *	In incremental mode the SQL aggregate only runs when the
+ *	in-memory entry is missing, older than sync_period, or belongs
+ *	to a previous reset window.  In between, checks are a tree
+ *	lookup, and the counter advances from the accounting packets
+ *	we've seen (see mod_accounting).
+ */
+static int sqlcounter_get(uint64_t *out, rlm_sqlcounter_t *inst, REQUEST *request)
+{
+	sqlcounter_entry_t	*entry;
+	fr_time_t		now = request->packet->timestamp;
+	uint64_t		counter;
+	char			*key = NULL;
+
+	if (!inst->incremental) return sqlcounter_query(out, inst, request);
+
+	if (tmpl_aexpand(request, &key, request, inst->key, NULL, NULL) < 0) {
+		REDEBUG("Failed expanding key");
+		return -1;
+	}
+
+	pthread_mutex_lock(&inst->mutex);
+	entry = rbtree_finddata(inst->counters, &(sqlcounter_entry_t){ .key = key });
+	if (entry && (entry->window_start >= inst->last_reset) && ((entry->synced + inst->sync_period) > now)) {
+		*out = entry->sql_value + entry->delta;
+		pthread_mutex_unlock(&inst->mutex);
+		talloc_free(key);
+
+		return 0;
+	}
+	pthread_mutex_unlock(&inst->mutex);
+
+	/*
+	 *	Don't hold the mutex over the SQL round trip.  If two
+	 *	requests for the same key race here they both run the
+	 *	query, and the later result wins, which is harmless.
+	 */
+	if (sqlcounter_query(&counter, inst, request) < 0) {
+		talloc_free(key);
+		return -1;
+	}
+
+	pthread_mutex_lock(&inst->mutex);
+	entry = rbtree_finddata(inst->counters, &(sqlcounter_entry_t){ .key = key });
+	if (!entry) {
+		MEM(entry = talloc_zero(NULL, sqlcounter_entry_t));
+		entry->key = talloc_typed_strdup(entry, key);
+		rbtree_insert(inst->counters, entry);
+	}
+
+	/*
+	 *	The database has already seen the accounting packets
+	 *	we counted, so the delta is folded into the query
+	 *	result and starts again from zero.
+	 */
+	entry->sql_value = counter;
+	entry->delta = 0;
+	entry->synced = now;
+	entry->window_start = inst->last_reset;
+
+	*out = counter;
+	pthread_mutex_unlock(&inst->mutex);
+	talloc_free(key);
+
+	return 0;
+}
+
+/*
+ *	See if the counter matches.
+ */
+static int counter_cmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR *req , VALUE_PAIR *check,
+		       UNUSED VALUE_PAIR *check_pairs, UNUSED VALUE_PAIR **reply_pairs)
+{
+	rlm_sqlcounter_t *inst = instance;
+	uint64_t counter = 0;
+
+	if (sqlcounter_get(&counter, inst, request) < 0) return RLM_MODULE_FAIL;
+
 	if (counter < check->vp_uint64) return -1;
 	if (counter > check->vp_uint64) return 1;
 	return 0;
@@ -395,11 +515,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 	char			msg[128];
 	int			ret;
 
-	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
-	char *expanded = NULL;
-
-	size_t len;
-
 	/*
 	 *	Before doing anything else, see if we have to reset
 	 *	the counters.
@@ -417,32 +532,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 		return RLM_MODULE_NOOP;
 	}
 
-	/* First, expand %k, %b and %e in query */
-	if (sqlcounter_expand(subst, sizeof(subst), inst, request, inst->query) <= 0) {
-		REDEBUG("Insufficient query buffer space");
-
-		return RLM_MODULE_FAIL;
-	}
-
-	/* Then combine that with the name of the module were using to do the query */
-	len = snprintf(query, sizeof(query), "%%{%s:%s}", inst->sqlmod_inst, subst);
-	if (len >= (sizeof(query) - 1)) {
-		REDEBUG("Insufficient query buffer space");
-
-		return RLM_MODULE_FAIL;
-	}
-
-	/* Finally, xlat resulting SQL query */
-	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) {
-		return RLM_MODULE_FAIL;
-	}
-	talloc_free(expanded);
-
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
-			expanded);
-		counter = 0;
-	}
+	if (sqlcounter_get(&counter, inst, request) < 0) return RLM_MODULE_FAIL;
 
 	/*
 	 *	Check if check item > counter
@@ -522,6 +612,71 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 	return RLM_MODULE_OK;
 }
 
+/*
+ *	Advance the in-memory counter from accounting data.
+ *
+ *	Only Stop packets are applied.  Interim-Update packets report
+ *	cumulative values for the session, which we can't add without
+ *	double counting; their totals are picked up at the next
+ *	reconciliation with SQL.
+ */
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_sqlcounter_t	*inst = instance;
+	sqlcounter_entry_t	*entry;
+	VALUE_PAIR		*vp;
+	uint64_t		delta;
+	char			*key = NULL;
+
+	if (!inst->incremental) return RLM_MODULE_NOOP;
+
+	vp = fr_pair_find_by_da(request->packet->vps, attr_acct_status_type, TAG_ANY);
+	if (!vp || (vp->vp_uint32 != FR_STATUS_STOP)) return RLM_MODULE_NOOP;
+
+	if (tmpl_find_vp(&vp, request, inst->increment_attr) < 0) {
+		RDEBUG2("Couldn't find increment attribute, %s, doing nothing...", inst->increment_attr->name);
+		return RLM_MODULE_NOOP;
+	}
+
+	switch (vp->vp_type) {
+	case FR_TYPE_UINT32:
+		delta = vp->vp_uint32;
+		break;
+
+	case FR_TYPE_UINT64:
+		delta = vp->vp_uint64;
+		break;
+
+	default:
+		RWDEBUG2("Increment attribute %s must be an integer", inst->increment_attr->name);
+		return RLM_MODULE_NOOP;
+	}
+
+	if (tmpl_aexpand(request, &key, request, inst->key, NULL, NULL) < 0) {
+		REDEBUG("Failed expanding key");
+		return RLM_MODULE_FAIL;
+	}
+
+	pthread_mutex_lock(&inst->mutex);
+	entry = rbtree_finddata(inst->counters, &(sqlcounter_entry_t){ .key = key });
+	if (!entry) {
+		/*
+		 *	synced is left at zero, so the first authorize
+		 *	check for this key reconciles with SQL.
+		 */
+		MEM(entry = talloc_zero(NULL, sqlcounter_entry_t));
+		entry->key = talloc_typed_strdup(entry, key);
+		entry->window_start = inst->last_reset;
+		rbtree_insert(inst->counters, entry);
+	}
+	entry->delta += delta;
+	RDEBUG2("Incremented counter for \"%s\" by %" PRIu64, key, delta);
+	pthread_mutex_unlock(&inst->mutex);
+	talloc_free(key);
+
+	return RLM_MODULE_OK;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -557,6 +712,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->incremental) {
+		inst->counters = rbtree_talloc_create(inst, sqlcounter_entry_cmp, sqlcounter_entry_t,
+						      rbtree_node_talloc_free, 0);
+		if (!inst->counters) {
+			cf_log_err(conf, "Failed creating counter tree");
+			return -1;
+		}
+		pthread_mutex_init(&inst->mutex, NULL);
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_sqlcounter_t *inst = instance;
+
+	if (inst->incremental) pthread_mutex_destroy(&inst->mutex);
+
 	return 0;
 }
 
@@ -619,8 +793,10 @@ module_t rlm_sqlcounter = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
-		[MOD_AUTHORIZE]		= mod_authorize
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_ACCOUNTING]	= mod_accounting
 	},
 };
 
@@ -24,6 +24,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/util/dlist.h>
@@ -41,13 +42,14 @@ RCSID("$Id$")
 #include <pthread.h>
 
 typedef struct {
-	pthread_mutex_t		mutex;
+	pthread_mutex_t		mutex;				//!< Protects the list of threads, and the counters
+								//!< of exited threads.  Never taken on the packet path.
 	fr_dict_attr_t const	*type_da;			//!< FreeRADIUS-Stats4-Type
 	fr_dict_attr_t const	*ipv4_da;			//!< FreeRADIUS-Stats4-IPv4-Address
 	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
 	fr_dlist_head_t		list;				//!< for threads to know about each other
 
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
+	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];	//!< Counters from threads which have exited.
 } rlm_stats_t;
 
 typedef struct {
@@ -60,7 +62,6 @@ typedef struct {
 typedef struct {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
 	fr_time_t		last_manage;			//!< when we deleted old things
@@ -68,7 +69,11 @@ typedef struct {
 	rbtree_t		*src;				//!< stats by source
 	rbtree_t		*dst;				//!< stats by destination
 
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
+	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE] CC_HINT(aligned(64));
+								//!< Counters for this thread.  Only ever written by
+								//!< the owning thread, and kept away from the list
+								//!< linkage readers walk, so aggregation doesn't
+								//!< bounce the cache line the writer is using.
 } rlm_stats_thread_t;
 
 static const CONF_PARSER module_config[] = {
@@ -140,6 +145,31 @@ static void coalesce(uint64_t final_stats[FR_RADIUS_MAX_PACKET_CODE], rlm_stats_
 	}
 }
 
+/** Sum the global counters over all worker threads
+ *
+ * The mutex only protects the list of threads, and the counters of
+ * threads which have exited.  Live counters are read without
+ * synchronisation, so the totals may lag the workers by a packet or
+ * two, which is fine for statistics.  The workers themselves never
+ * touch the mutex.
+ */
+static void global_coalesce(uint64_t final_stats[FR_RADIUS_MAX_PACKET_CODE], rlm_stats_t *inst)
+{
+	rlm_stats_thread_t *other;
+	int i;
+
+	pthread_mutex_lock(&inst->mutex);
+	memcpy(final_stats, inst->stats, sizeof(inst->stats));
+
+	for (other = fr_dlist_head(&inst->list);
+	     other != NULL;
+	     other = fr_dlist_next(&inst->list, other)) {
+		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
+			final_stats[i] += other->stats[i];
+		}
+	}
+	pthread_mutex_unlock(&inst->mutex);
+}
 
 /*
  *	Do the statistics
@@ -213,19 +243,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		 *	@todo - periodically clean up old entries.
 		 */
 
-		if ((t->last_global_update + NSEC) > request->async->recv_time) {
-			return RLM_MODULE_UPDATED;
-		}
-
-		t->last_global_update = request->async->recv_time;
-
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		pthread_mutex_unlock(&inst->mutex);
-
 		return RLM_MODULE_UPDATED;
 	}
 
@@ -254,19 +271,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 
 	switch (stats_type) {
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_GLOBAL:			/* global */
-		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
-		 */
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->stats, sizeof(inst->stats));
-		pthread_mutex_unlock(&inst->mutex);
+		global_coalesce(local_stats, inst);
 		vp = NULL;
 		break;
 
@@ -309,7 +314,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		if (!local_stats[i]) continue;
 
 		strlcpy(buffer + 18, fr_packet_codes[i], sizeof(buffer) - 18);
-		da = fr_dict_attr_by_name(dict_radius, buffer);
+		da = fr_dict_attr_by_name_cached(dict_radius, buffer);
 		if (!da) continue;
 
 		MEM(vp = fr_pair_afrom_da(request->reply, da));
@@ -373,13 +378,55 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 	return 0;
 }
 
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+/** Roll up the global counters for radmin
+ *
+ */
+static int cmd_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_stats_t	*inst = talloc_get_type_abort(ctx, rlm_stats_t);
+	uint64_t	local_stats[FR_RADIUS_MAX_PACKET_CODE];
+	int		i;
+
+	global_coalesce(local_stats, inst);
+
+	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
+		if (!local_stats[i]) continue;
+
+		fprintf(fp, "%s\t%" PRIu64 "\n", fr_packet_codes[i], local_stats[i]);
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_stats_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "stats",
+		.func = cmd_stats,
+		.help = "Show the packet counters aggregated over all worker threads.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_stats_t	*inst = instance;
+	char const	*name;
 
 	pthread_mutex_init(&inst->mutex, NULL);
 	fr_dlist_init(&inst->list, rlm_stats_thread_t, entry);
 
+	name = cf_section_name2(conf);
+	if (!name) name = cf_section_name1(conf);
+
+	if (fr_command_register_hook(NULL, name, inst, cmd_stats_table) < 0) {
+		ERROR("Failed registering radmin commands for module %s - %s", name, fr_strerror());
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -31,7 +31,6 @@ RCSID("$Id$")
  */
 static rlm_rcode_t CC_HINT(nonnull) mod_utf8_clean(UNUSED void *instance, UNUSED void *thread, REQUEST *request)
 {
-	size_t		i, len;
 	VALUE_PAIR	*vp;
 	fr_cursor_t	cursor;
 
@@ -40,10 +39,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_utf8_clean(UNUSED void *instance, UNUSED
 	     vp = fr_cursor_next(&cursor)) {
 		if (vp->vp_type != FR_TYPE_STRING) continue;
 
-		for (i = 0; i < vp->vp_length; i += len) {
-			len = fr_utf8_char(&vp->vp_octets[i], -1);
-			if (len == 0) return RLM_MODULE_FAIL;
-		}
+		if (fr_utf8_str(vp->vp_octets, vp->vp_length) != (ssize_t) vp->vp_length) return RLM_MODULE_FAIL;
 	}
 
 	return RLM_MODULE_NOOP;
@@ -8,6 +8,7 @@ TARGET		:= libfreeradius-dhcpv4.a
 SOURCES		:= base.c \
 		   decode.c \
 		   encode.c \
+		   lease.c \
 		   packet.c \
 		   pcap.c \
 		   raw.c \
@@ -268,6 +268,29 @@ bool fr_dhcpv4_ok(uint8_t const *data, ssize_t data_len, uint8_t *message_type,
 	return true;
 }
 
+/** Check whether an attribute list is already in DHCP option order
+ *
+ * The list is in option order if DHCP-Message-Type is at the head,
+ * and any Relay-Agent (option 82) sub-options form the tail, which is
+ * exactly what fr_dhcpv4_attr_cmp enforces.  Both violations are
+ * visible in an adjacent pair, so one linear pass is sufficient.
+ *
+ * @param[in] vps	to check.
+ * @return
+ *	- true if sorting the list would be a no-op.
+ *	- false if it needs to be sorted.
+ */
+static bool attr_list_sorted(VALUE_PAIR *vps)
+{
+	VALUE_PAIR *vp;
+
+	for (vp = vps; vp && vp->next; vp = vp->next) {
+		if (fr_dhcpv4_attr_cmp(vp, vp->next) > 0) return false;
+	}
+
+	return true;
+}
+
 ssize_t fr_dhcpv4_encode(uint8_t *buffer, size_t buflen, dhcp_packet_t *original, int code, uint32_t xid, VALUE_PAIR *vps)
 {
 	uint8_t		*p;
@@ -468,8 +491,12 @@ ssize_t fr_dhcpv4_encode(uint8_t *buffer, size_t buflen, dhcp_packet_t *original
 	/*
 	 *  Pre-sort attributes into contiguous blocks so that fr_dhcpv4_encode_option
 	 *  operates correctly. This changes the order of the list, but never mind...
+	 *
+	 *  Reply lists are normally built in the same order for every
+	 *  packet, so they're usually already sorted.  Checking that is
+	 *  a cheap linear pass, sorting is not.
 	 */
-	fr_pair_list_sort(&vps, fr_dhcpv4_attr_cmp);
+	if (!attr_list_sorted(vps)) fr_pair_list_sort(&vps, fr_dhcpv4_attr_cmp);
 	fr_cursor_init(&cursor, &vps);
 
 	/*
@@ -196,6 +196,34 @@ int		fr_dhcpv4_pcap_send(fr_pcap_t *pcap, uint8_t *dst_ether_addr, RADIUS_PACKET
  */
 int		fr_dhcpv4_udp_add_arp_entry(int fd, char const *interface,
 					    fr_ipaddr_t const *ip, uint8_t macaddr[static 6]);
+
+/*
+ *	lease.c
+ */
+
+/** One lease record in the mmap'd lease table
+ */
+typedef struct {
+	uint32_t	ipaddr;				//!< Leased address (network byte order).
+	uint8_t		chaddr[6];			//!< Client hardware address.
+	uint8_t		hlen;				//!< Length of chaddr.
+	uint8_t		active;				//!< Lease is currently assigned.
+	uint64_t	expires;			//!< When the lease ends (unix time, in seconds).
+} fr_dhcpv4_lease_t;
+
+typedef struct fr_dhcpv4_lease_table fr_dhcpv4_lease_table_t;
+
+fr_dhcpv4_lease_table_t	*fr_dhcpv4_lease_table_open(TALLOC_CTX *ctx, char const *filename, uint32_t max_leases);
+
+int		fr_dhcpv4_lease_update(fr_dhcpv4_lease_table_t *lt, uint32_t ipaddr,
+				       uint8_t const *chaddr, uint8_t hlen, uint32_t lease_time);
+
+int		fr_dhcpv4_lease_release(fr_dhcpv4_lease_table_t *lt, uint32_t ipaddr);
+
+int		fr_dhcpv4_lease_find_by_ip(fr_dhcpv4_lease_table_t *lt, fr_dhcpv4_lease_t *out, uint32_t ipaddr);
+
+int		fr_dhcpv4_lease_find_by_chaddr(fr_dhcpv4_lease_table_t *lt, fr_dhcpv4_lease_t *out,
+					       uint8_t const *chaddr, uint8_t hlen);
 #ifdef __cplusplus
 }
 #endif
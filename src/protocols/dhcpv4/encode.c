@@ -79,6 +79,76 @@ static inline VALUE_PAIR *first_encodable(fr_cursor_t *cursor, void *encoder_ctx
 	return next_encodable(cursor, encoder_ctx);
 }
 
+/** Check whether an option can be emitted by the fixed-size fast path
+ *
+ * Simple top-level options with fixed-size values (the bulk of a
+ * typical reply) don't need the TLV stack machinery, they're always
+ * two bytes of header followed by the value.
+ *
+ * @param[in] vp	to check.
+ * @return
+ *	- true if #encode_fixed can emit the option.
+ *	- false if it needs the generic encoder.
+ */
+static inline bool is_fixed_size(VALUE_PAIR const *vp)
+{
+	switch (vp->da->type) {
+	case FR_TYPE_BOOL:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_IPV4_ADDR:
+	case FR_TYPE_ETHERNET:
+		break;
+
+	default:
+		return false;
+	}
+
+	if (!vp->da->parent->flags.is_root) return false;	/* Sub-options need their parent's header */
+	if (vp->da->flags.array) return false;			/* Arrays coalesce into one option */
+
+	return true;
+}
+
+/** Write out a fixed-size option header and value
+ *
+ * The option length comes straight out of the #dict_attr_sizes table,
+ * so the only per-option work is writing the two header bytes and the
+ * value.
+ *
+ * @param[out] out		buffer to write the option to.
+ * @param[in] outlen		length of the output buffer.
+ * @param[in,out] cursor	Current attribute we're encoding.
+ * @param[in] encoder_ctx	Containing DHCPv4 dictionary.
+ * @return
+ *	- >0 length of data encoded.
+ *	- 0 if we ran out of space.
+ *	- < 0 on error.
+ */
+static ssize_t encode_fixed(uint8_t *out, size_t outlen, fr_cursor_t *cursor, void *encoder_ctx)
+{
+	VALUE_PAIR	*vp = fr_cursor_current(cursor);
+	size_t		len = dict_attr_sizes[vp->da->type][0];
+	size_t		need = 0;
+	ssize_t		slen;
+
+	if (outlen < (2 + len)) return 0;	/* No space */
+
+	out[0] = vp->da->attr & 0xff;
+	out[1] = len;
+
+	slen = fr_value_box_to_network(&need, out + 2, outlen - 2, &vp->data);
+	if (slen < 0) return slen;
+	if (need > 0) return 0;
+
+	(void) next_encodable(cursor, encoder_ctx);
+
+	FR_PROTO_HEX_DUMP(out, 2 + len, "Fixed-size option");
+
+	return 2 + len;
+}
+
 /** Write DHCP option value into buffer
  *
  * Does not include DHCP option length or number.
@@ -489,6 +559,12 @@ ssize_t fr_dhcpv4_encode_option(uint8_t *out, size_t outlen, fr_cursor_t *cursor
 		return 0;
 	}
 
+	/*
+	 *	Fast path.  Most reply options are simple fixed-size
+	 *	values, and don't need the TLV stack built at all.
+	 */
+	if (is_fixed_size(vp)) return encode_fixed(out, outlen, cursor, encoder_ctx);
+
 	fr_proto_tlv_stack_build(tlv_stack, vp->da);
 
 	FR_PROTO_STACK_PRINT(tlv_stack, depth);
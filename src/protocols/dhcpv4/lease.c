@@ -0,0 +1,424 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file protocols/dhcpv4/lease.c
+ * @brief mmap'd lease table, for answering lease queries without a database.
+ *
+ * The table is an open addressed hash table in a file backed mapping,
+ * with one index by leased IP address, and one by client hardware
+ * address.  Because the file persists across restarts, the server can
+ * keep answering lease queries immediately after starting up, which is
+ * exactly when relays flood it with them.
+ *
+ * The indexes hold entry numbers (offset by one, zero meaning empty),
+ * and entries are only ever appended, so a stale index slot always
+ * points at a valid entry.  Lookups verify the key against the entry,
+ * making stale MAC slots (left behind when a lease moves to new
+ * hardware) harmless.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/base.h>
+#include <freeradius-devel/dhcpv4/dhcpv4.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LEASE_TABLE_MAGIC	(0x46526c74)		/* "FRlt" */
+#define LEASE_TABLE_VERSION	(2)
+
+/** Hash a key for the on disk indexes
+ *
+ * The index slots in the lease file are positioned by this hash, so it
+ * is part of the file format.  It MUST NOT change, and it MUST NOT be
+ * replaced with fr_hash(), which is free to evolve (and to produce
+ * different output on different CPUs) because nothing persists its
+ * output.
+ *
+ * This is FNV-1a, fixed for all time.
+ */
+static uint32_t lease_hash(void const *data, size_t size)
+{
+	uint8_t const	*p = data;
+	uint8_t const	*q = p + size;
+	uint32_t	hash = 0x811c9dc5;
+
+	while (p != q) {
+		hash ^= (uint32_t) (*p++);
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/** On disk header for the lease table
+ */
+typedef struct {
+	uint32_t		magic;			//!< LEASE_TABLE_MAGIC
+	uint32_t		version;		//!< LEASE_TABLE_VERSION
+	uint32_t		capacity;		//!< Size of the entry and index arrays.
+	uint32_t		used;			//!< Number of entries allocated.
+} fr_dhcpv4_lease_header_t;
+
+struct fr_dhcpv4_lease_table {
+	int			fd;			//!< Of the backing file.
+	void			*base;			//!< Base of the mapping.
+	size_t			size;			//!< Of the mapping.
+
+	uint32_t		capacity;		//!< Cached from the header (always a power of two).
+
+	fr_dhcpv4_lease_header_t *header;		//!< At the start of the mapping.
+	fr_dhcpv4_lease_t	*entries;		//!< Lease records.
+	uint32_t		*ip_index;		//!< Entry number + 1, by hashed IP.  0 is empty.
+	uint32_t		*mac_index;		//!< Entry number + 1, by hashed chaddr.  0 is empty.
+
+	pthread_mutex_t		mutex;			//!< Serialises updates (and lookups).
+};
+
+static int _lease_table_free(fr_dhcpv4_lease_table_t *lt)
+{
+	pthread_mutex_destroy(&lt->mutex);
+	if (lt->base != MAP_FAILED) munmap(lt->base, lt->size);
+	if (lt->fd >= 0) close(lt->fd);
+
+	return 0;
+}
+
+/** Open (or create) a lease table
+ *
+ * If the file exists and matches the requested geometry the previous
+ * contents are kept, otherwise it's (re-)initialised to empty.
+ *
+ * @param[in] ctx		to tie the lifetime of the table to.
+ * @param[in] filename		backing file for the mapping.
+ * @param[in] max_leases	the table must be able to hold.
+ * @return
+ *	- The new table.
+ *	- NULL on failure.
+ */
+fr_dhcpv4_lease_table_t *fr_dhcpv4_lease_table_open(TALLOC_CTX *ctx, char const *filename, uint32_t max_leases)
+{
+	fr_dhcpv4_lease_table_t	*lt;
+	struct stat		statbuf;
+	uint32_t		capacity;
+	size_t			size;
+	bool			init;
+
+	/*
+	 *	Keep the load factor at or below 0.5, so the probe
+	 *	chains stay short.
+	 */
+	capacity = 64;
+	while (capacity < (max_leases * 2)) capacity <<= 1;
+
+	size = sizeof(fr_dhcpv4_lease_header_t) +
+	       (capacity * sizeof(fr_dhcpv4_lease_t)) +
+	       (capacity * sizeof(uint32_t) * 2);
+
+	lt = talloc_zero(ctx, fr_dhcpv4_lease_table_t);
+	if (!lt) return NULL;
+	lt->fd = -1;
+	lt->base = MAP_FAILED;
+	talloc_set_destructor(lt, _lease_table_free);
+
+	lt->fd = open(filename, O_RDWR | O_CREAT, 0600);
+	if (lt->fd < 0) {
+		fr_strerror_printf("Failed opening lease table \"%s\": %s", filename, fr_syserror(errno));
+	error:
+		talloc_free(lt);
+		return NULL;
+	}
+
+	if (fstat(lt->fd, &statbuf) < 0) {
+		fr_strerror_printf("Failed getting size of lease table \"%s\": %s", filename, fr_syserror(errno));
+		goto error;
+	}
+
+	init = ((size_t) statbuf.st_size != size);
+	if (init && (ftruncate(lt->fd, size) < 0)) {
+		fr_strerror_printf("Failed sizing lease table \"%s\": %s", filename, fr_syserror(errno));
+		goto error;
+	}
+
+	lt->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, lt->fd, 0);
+	if (lt->base == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping lease table \"%s\": %s", filename, fr_syserror(errno));
+		goto error;
+	}
+	lt->size = size;
+
+	lt->header = (fr_dhcpv4_lease_header_t *) lt->base;
+	lt->entries = (fr_dhcpv4_lease_t *) (lt->header + 1);
+	lt->ip_index = (uint32_t *) (lt->entries + capacity);
+	lt->mac_index = lt->ip_index + capacity;
+
+	/*
+	 *	New file, or the geometry changed.  Start over.
+	 */
+	if (!init &&
+	    ((lt->header->magic != LEASE_TABLE_MAGIC) ||
+	     (lt->header->version != LEASE_TABLE_VERSION) ||
+	     (lt->header->capacity != capacity))) init = true;
+
+	if (init) {
+		memset(lt->base, 0, size);
+		lt->header->magic = LEASE_TABLE_MAGIC;
+		lt->header->version = LEASE_TABLE_VERSION;
+		lt->header->capacity = capacity;
+	}
+	lt->capacity = capacity;
+
+	pthread_mutex_init(&lt->mutex, NULL);
+
+	return lt;
+}
+
+/** Find the entry for an IP address, and the index slot it should live in
+ *
+ * Caller must hold the mutex.
+ *
+ * @param[in] lt	Lease table.
+ * @param[in] ipaddr	to look for (network byte order).
+ * @param[out] slot_p	index slot the entry was found in, or the empty
+ *			slot a new entry should be added to.
+ * @return
+ *	- The matching entry.
+ *	- NULL if the address isn't in the table.
+ */
+static fr_dhcpv4_lease_t *lease_find_ip(fr_dhcpv4_lease_table_t *lt, uint32_t ipaddr, uint32_t *slot_p)
+{
+	uint32_t	mask = lt->capacity - 1;
+	uint32_t	h = lease_hash(&ipaddr, sizeof(ipaddr));
+	uint32_t	i, slot, idx;
+
+	for (i = 0; i <= mask; i++) {
+		slot = (h + i) & mask;
+		idx = lt->ip_index[slot];
+
+		if (!idx) {
+			*slot_p = slot;
+			return NULL;
+		}
+
+		if (lt->entries[idx - 1].ipaddr == ipaddr) {
+			*slot_p = slot;
+			return &lt->entries[idx - 1];
+		}
+	}
+
+	/*
+	 *	Can't happen, the load factor is at most 0.5.
+	 */
+	*slot_p = h & mask;
+	return NULL;
+}
+
+/** Add or update a lease
+ *
+ * Called when the server sends an ACK for an address.
+ *
+ * @param[in] lt		Lease table.
+ * @param[in] ipaddr		which was leased (network byte order).
+ * @param[in] chaddr		client hardware address it was leased to.
+ * @param[in] hlen		length of chaddr.
+ * @param[in] lease_time	in seconds.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the table is full.
+ */
+int fr_dhcpv4_lease_update(fr_dhcpv4_lease_table_t *lt, uint32_t ipaddr,
+			   uint8_t const *chaddr, uint8_t hlen, uint32_t lease_time)
+{
+	fr_dhcpv4_lease_t	*lease;
+	uint32_t		slot, idx;
+	bool			mac_changed;
+
+	if (hlen > sizeof(lease->chaddr)) hlen = sizeof(lease->chaddr);
+
+	pthread_mutex_lock(&lt->mutex);
+
+	lease = lease_find_ip(lt, ipaddr, &slot);
+	if (!lease) {
+		if (lt->header->used >= (lt->capacity / 2)) {
+			pthread_mutex_unlock(&lt->mutex);
+			return -1;
+		}
+
+		idx = ++lt->header->used;
+		lt->ip_index[slot] = idx;
+
+		lease = &lt->entries[idx - 1];
+		lease->ipaddr = ipaddr;
+	} else {
+		idx = lt->ip_index[slot];
+	}
+
+	mac_changed = ((lease->hlen != hlen) || (memcmp(lease->chaddr, chaddr, hlen) != 0));
+
+	memset(lease->chaddr, 0, sizeof(lease->chaddr));
+	memcpy(lease->chaddr, chaddr, hlen);
+	lease->hlen = hlen;
+	lease->active = 1;
+	lease->expires = (uint64_t) time(NULL) + lease_time;
+
+	/*
+	 *	Point the MAC index at this entry.  The old slot (if
+	 *	the lease moved to new hardware) goes stale, which
+	 *	lookups tolerate.
+	 */
+	if (mac_changed) {
+		uint32_t	mask = lt->capacity - 1;
+		uint32_t	h = lease_hash(lease->chaddr, hlen);
+		uint32_t	i, mac_slot;
+
+		for (i = 0; i <= mask; i++) {
+			mac_slot = (h + i) & mask;
+
+			if (!lt->mac_index[mac_slot] || (lt->mac_index[mac_slot] == idx)) {
+				lt->mac_index[mac_slot] = idx;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&lt->mutex);
+
+	return 0;
+}
+
+/** Mark the lease on an address as released
+ *
+ * @param[in] lt	Lease table.
+ * @param[in] ipaddr	which was released (network byte order).
+ * @return
+ *	- 0 if the lease was marked released.
+ *	- -1 if the address isn't in the table.
+ */
+int fr_dhcpv4_lease_release(fr_dhcpv4_lease_table_t *lt, uint32_t ipaddr)
+{
+	fr_dhcpv4_lease_t	*lease;
+	uint32_t		slot;
+
+	pthread_mutex_lock(&lt->mutex);
+
+	lease = lease_find_ip(lt, ipaddr, &slot);
+	if (lease) lease->active = 0;
+
+	pthread_mutex_unlock(&lt->mutex);
+
+	return lease ? 0 : -1;
+}
+
+static inline bool lease_is_active(fr_dhcpv4_lease_t const *lease, uint64_t now)
+{
+	return (lease->active && (lease->expires > now));
+}
+
+/** Look up a lease by IP address
+ *
+ * @param[in] lt	Lease table.
+ * @param[out] out	a copy of the lease record, if one was found.
+ * @param[in] ipaddr	to look for (network byte order).
+ * @return
+ *	- 1 if the address has an active lease.
+ *	- 0 if the address is known, but has no active lease.
+ *	- -1 if the address isn't in the table.
+ */
+int fr_dhcpv4_lease_find_by_ip(fr_dhcpv4_lease_table_t *lt, fr_dhcpv4_lease_t *out, uint32_t ipaddr)
+{
+	fr_dhcpv4_lease_t	*lease;
+	uint32_t		slot;
+	int			ret = -1;
+
+	pthread_mutex_lock(&lt->mutex);
+
+	lease = lease_find_ip(lt, ipaddr, &slot);
+	if (lease) {
+		*out = *lease;
+		ret = lease_is_active(lease, (uint64_t) time(NULL)) ? 1 : 0;
+	}
+
+	pthread_mutex_unlock(&lt->mutex);
+
+	return ret;
+}
+
+/** Look up a lease by client hardware address
+ *
+ * If the client holds multiple leases, the one expiring last is
+ * returned.
+ *
+ * @param[in] lt	Lease table.
+ * @param[out] out	a copy of the lease record, if one was found.
+ * @param[in] chaddr	to look for.
+ * @param[in] hlen	length of chaddr.
+ * @return
+ *	- 1 if the client has an active lease.
+ *	- 0 if the client is known, but has no active lease.
+ *	- -1 if the client isn't in the table.
+ */
+int fr_dhcpv4_lease_find_by_chaddr(fr_dhcpv4_lease_table_t *lt, fr_dhcpv4_lease_t *out,
+				   uint8_t const *chaddr, uint8_t hlen)
+{
+	fr_dhcpv4_lease_t	*found = NULL;
+	uint32_t		mask = lt->capacity - 1;
+	uint32_t		h, i, slot, idx;
+	uint64_t		now = (uint64_t) time(NULL);
+	int			ret = -1;
+
+	if (hlen > sizeof(found->chaddr)) hlen = sizeof(found->chaddr);
+
+	h = lease_hash(chaddr, hlen);
+
+	pthread_mutex_lock(&lt->mutex);
+
+	for (i = 0; i <= mask; i++) {
+		fr_dhcpv4_lease_t *lease;
+
+		slot = (h + i) & mask;
+		idx = lt->mac_index[slot];
+		if (!idx) break;
+
+		lease = &lt->entries[idx - 1];
+
+		/*
+		 *	Stale slot, the lease moved to new hardware.
+		 */
+		if ((lease->hlen != hlen) || (memcmp(lease->chaddr, chaddr, hlen) != 0)) continue;
+
+		if (!found ||
+		    (lease_is_active(lease, now) &&
+		     (!lease_is_active(found, now) || (lease->expires > found->expires)))) found = lease;
+	}
+
+	if (found) {
+		*out = *found;
+		ret = lease_is_active(found, now) ? 1 : 0;
+	}
+
+	pthread_mutex_unlock(&lt->mutex);
+
+	return ret;
+}
@@ -438,15 +438,15 @@ ssize_t fr_radius_decode_tlv(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t con
 	while (p < end) {
 		ssize_t tlv_len;
 
-		child = fr_dict_attr_child_by_num(parent, p[0]);
+		child = fr_dict_attr_by_child_num(dict, parent, p[0]);
 		if (!child) {
 			FR_PROTO_TRACE("Failed to find child %u of TLV %s", p[0], parent->name);
 
 			/*
 			 *	Build an unknown attr
 			 */
-			child = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent,
-							     fr_dict_vendor_num_by_da(parent), p[0]);
+			child = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent,
+								    fr_dict_vendor_num_by_da(parent), p[0]);
 			if (!child) {
 			error:
 				fr_pair_list_free(&head);
@@ -547,8 +547,8 @@ static ssize_t decode_vsa_internal(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict
 	/*
 	 *	See if the VSA is known.
 	 */
-	da = fr_dict_attr_child_by_num(parent, attribute);
-	if (!da) da = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent, dv->pen, attribute);
+	da = fr_dict_attr_by_child_num(dict, parent, attribute);
+	if (!da) da = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent, dv->pen, attribute);
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s", da->parent->name, da->name);
 
@@ -697,8 +697,8 @@ static ssize_t decode_wimax(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t cons
 	 */
 	if (((size_t) (data[5] + 4)) != attr_len) return -1;
 
-	da = fr_dict_attr_child_by_num(parent, data[4]);
-	if (!da) da = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent, vendor, data[4]);
+	da = fr_dict_attr_by_child_num(dict, parent, data[4]);
+	if (!da) da = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent, vendor, data[4]);
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s", da->parent->name, da->name);
 
@@ -869,6 +869,41 @@ static ssize_t decode_vsa(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t const
 	memcpy(&vendor, data, 4);
 	vendor = ntohl(vendor);
 
+	/*
+	 *	The caller never references this vendor's attributes.
+	 *	Keep the entire VSA as one raw pair instead of
+	 *	expanding it into a pair per sub-TLV.  The wire bytes
+	 *	are preserved, so the attribute still re-encodes
+	 *	correctly when proxied, and can be decoded in full
+	 *	later if it's needed after all.
+	 */
+	if (packet_ctx->vendor_interest &&
+	    !fr_radius_vendor_interest_isset(packet_ctx->vendor_interest, vendor)) {
+		fr_dict_attr_t	*unknown;
+		VALUE_PAIR	*vp;
+
+		unknown = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent->parent, 0, parent->attr);
+		if (!unknown) return -1;
+
+		vp = fr_pair_afrom_da(ctx, unknown);
+		if (!vp) return -1;
+
+		if (packet_ctx->borrowed) {
+			uint8_t *q;
+
+			memcpy(&q, &data, sizeof(q));	/* const issues */
+			fr_value_box_memcpy_shallow(&vp->data, vp->da, q, attr_len, true);
+		} else if (fr_pair_value_memcpy(vp, data, attr_len, true) < 0) {
+			talloc_free(vp);
+			return -1;
+		}
+
+		vp->type = VT_DATA;
+		fr_cursor_append(cursor, vp);
+
+		return attr_len;
+	}
+
 	/*
 	 *	Verify that the parent (which should be a VSA)
 	 *	contains a fake attribute representing the vendor.
@@ -877,7 +912,7 @@ static ssize_t decode_vsa(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t const
 	 *	(unlike DHCP) we know vendor attributes have a
 	 *	standard format, so we can decode the data anyway.
 	 */
-	vendor_da = fr_dict_attr_child_by_num(parent, vendor);
+	vendor_da = fr_dict_attr_by_child_num(dict, parent, vendor);
 	if (!vendor_da) {
 		fr_dict_attr_t *n;
 		/*
@@ -1002,7 +1037,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 	size_t			min = 0, max = 0;
 	int			extra;
 
-	if (!parent || (attr_len > packet_len) || (attr_len > 128 * 1024)) {
+	if (unlikely(!parent || (attr_len > packet_len) || (attr_len > 128 * 1024))) {
 		fr_strerror_printf("%s: Invalid arguments", __FUNCTION__);
 		return -1;
 	}
@@ -1203,7 +1238,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 		 *	a known child, so we use that as the fast
 		 *	path.
 		 */
-		child = fr_dict_attr_child_by_num(parent, p[0]);
+		child = fr_dict_attr_by_child_num(dict, parent, p[0]);
 		if (child) {
 			/*
 			 *	Normal "extended" with 0 or more bytes
@@ -1252,7 +1287,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 		 *	and succeed, instead of failing.  So we don't
 		 *	need to handle that case here.
 		 */
-		child = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent, 0, p[0]);
+		child = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent, 0, p[0]);
 		if (!child) goto raw;
 
 		/*
@@ -1292,33 +1327,33 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 			 *	represented as a subtlv(ish) of an EVS or VSA
 			 *	attribute.
 			 */
-			vendor_child = fr_dict_attr_child_by_num(parent, vendor);
+			vendor_child = fr_dict_attr_by_child_num(dict, parent, vendor);
 			if (!vendor_child) {
 				/*
 				 *	If there's no child, it means the vendor is unknown
 				 *	which means the child attribute is unknown too.
 				 *
-				 *	fr_dict_unknown_afrom_fields will do the right thing
+				 *	fr_dict_unknown_afrom_fields_cached will do the right thing
 				 *	and create both an unknown vendor and an unknown
 				 *	attr.
 				 *
 				 *	This can be used later by the encoder to rebuild
 				 *	the attribute header.
 				 */
-				parent = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent, vendor, p[4]);
+				parent = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent, vendor, p[4]);
 				p += 5;
 				data_len -= 5;
 				break;
 			}
 
-			child = fr_dict_attr_child_by_num(vendor_child, p[4]);
+			child = fr_dict_attr_by_child_num(dict, vendor_child, p[4]);
 			if (!child) {
 				/*
 				 *	Vendor exists but child didn't, again
-				 *	fr_dict_unknown_afrom_fields will do the right thing
+				 *	fr_dict_unknown_afrom_fields_cached will do the right thing
 				 *	and only create the unknown attr.
 				 */
-				parent = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, parent, vendor, p[4]);
+				parent = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, parent, vendor, p[4]);
 				p += 5;
 				data_len -= 5;
 				break;
@@ -1414,8 +1449,27 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 	vp->tag = tag;
 
 	switch (parent->type) {
-	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	Borrowed decode.  The value box points into the
+		 *	packet buffer instead of copying out of it, and
+		 *	is only duplicated if something writes to it.
+		 *
+		 *	Only possible when the value hasn't been
+		 *	decrypted or de-tagged into the local buffer,
+		 *	and never for strings, as vb_strvalue must be
+		 *	'\0' terminated and the wire value isn't.
+		 */
+		if (packet_ctx && packet_ctx->borrowed && (p != buffer)) {
+			uint8_t *q;
+
+			memcpy(&q, &p, sizeof(p));	/* const issues */
+			fr_value_box_memcpy_shallow(&vp->data, vp->da, q, data_len, true);
+			break;
+		}
+		/* FALL-THROUGH */
+
+	case FR_TYPE_STRING:
 	case FR_TYPE_IPV4_ADDR:
 	case FR_TYPE_IPV6_ADDR:
 	case FR_TYPE_BOOL:
@@ -1544,15 +1598,15 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dict_t co
 	fr_dict_attr_t const	*da;
 	fr_radius_ctx_t		*packet_ctx = decoder_ctx;
 
-	if ((data_len < 2) || (data[1] < 2) || (data[1] > data_len)) {
+	if (unlikely((data_len < 2) || (data[1] < 2) || (data[1] > data_len))) {
 		fr_strerror_printf("%s: Insufficient data", __FUNCTION__);
 		return -1;
 	}
 
-	da = fr_dict_attr_child_by_num(fr_dict_root(dict), data[0]);
+	da = fr_dict_attr_by_child_num(dict, fr_dict_root(dict), data[0]);
 	if (!da) {
 		FR_PROTO_TRACE("Unknown attribute %u", data[0]);
-		da = fr_dict_unknown_afrom_fields(packet_ctx->tmp_ctx, fr_dict_root(dict), 0, data[0]);
+		da = fr_dict_unknown_afrom_fields_cached(packet_ctx->tmp_ctx, fr_dict_root(dict), 0, data[0]);
 	}
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s",da->parent->name, da->name);
@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/base.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/struct.h>
+#include <freeradius-devel/util/thread_local.h>
 #include <freeradius-devel/io/test_point.h>
 #include "attrs.h"
 
@@ -661,11 +662,12 @@ static ssize_t encode_value(uint8_t *out, size_t outlen,
 		break;
 
 	/*
-	 *	Simple data types use the common encoder.
+	 *	Fixed-width types have direct encoders, resolved by
+	 *	the attribute's type.  One indexed call, one
+	 *	byte-swapping store.  Accounting packets are mostly
+	 *	numeric attributes, so this is the common case.
 	 */
 	case FR_TYPE_IPV4_ADDR:
-	case FR_TYPE_IFID:
-	case FR_TYPE_ETHERNET:	/* just in case */
 	case FR_TYPE_BOOL:
 	case FR_TYPE_UINT8:
 	case FR_TYPE_UINT16:
@@ -675,6 +677,15 @@ static ssize_t encode_value(uint8_t *out, size_t outlen,
 	case FR_TYPE_INT16:
 	case FR_TYPE_INT32:
 	case FR_TYPE_INT64:
+		len = fr_value_box_to_network_func(da->type)(buffer, &vp->data);
+		data = buffer;
+		break;
+
+	/*
+	 *	Simple data types use the common encoder.
+	 */
+	case FR_TYPE_IFID:
+	case FR_TYPE_ETHERNET:	/* just in case */
 	case FR_TYPE_DATE:
 	case FR_TYPE_TIME_DELTA:
 		len = fr_value_box_to_network(NULL, buffer, sizeof(buffer), &vp->data);
@@ -1385,6 +1396,100 @@ static int encode_rfc_hdr(uint8_t *out, size_t outlen, fr_dict_attr_t const **tl
 	return encode_rfc_hdr_internal(out, outlen, tlv_stack, depth, cursor, encoder_ctx);
 }
 
+/** A cached wire image of a previously encoded attribute
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;			//!< Attribute the image was encoded from.
+	fr_value_box_t		value;			//!< Copy of the value that was encoded.
+	uint8_t			wire[UINT8_MAX];	//!< The complete encoded attribute.
+	size_t			wire_len;		//!< Length of the encoded attribute.
+} encode_cache_entry_t;
+
+/** Number of slots in the wire image cache
+ *
+ * Must be a power of two.
+ */
+#define ENCODE_CACHE_SLOTS	(64)
+
+typedef struct {
+	encode_cache_entry_t	*slot[ENCODE_CACHE_SLOTS];	//!< Most recent image, per attribute hash.
+} encode_cache_t;
+
+fr_thread_local_setup(encode_cache_t *, encode_cache)	/* macro */
+
+static void _encode_cache_free(void *arg)
+{
+	talloc_free(arg);
+	encode_cache = NULL;
+}
+
+/** Whether an attribute's wire image is independent of the packet it's in
+ *
+ * Only context-free encodings can be cached and replayed.  Anything
+ * encrypted depends on the packet vector and secret, and tagged
+ * attributes mix in per-pair data.
+ */
+static bool encode_cacheable(VALUE_PAIR const *vp)
+{
+	if (vp->da->flags.subtype != FLAG_ENCRYPT_NONE) return false;
+
+	if (vp->da->flags.has_tag) return false;
+
+	if (vp->da->attr > UINT8_MAX) return false;
+
+	switch (vp->vp_type) {
+	case FR_TYPE_VALUES:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Return the cache slot for an attribute, initialising the cache if needed
+ *
+ */
+static encode_cache_entry_t **encode_cache_slot(VALUE_PAIR const *vp)
+{
+	encode_cache_t *cache = encode_cache;
+
+	if (!cache) {
+		cache = talloc_zero(NULL, encode_cache_t);
+		if (!cache) return NULL;
+
+		fr_thread_local_set_destructor(encode_cache, _encode_cache_free, cache);
+	}
+
+	return &cache->slot[fr_hash_fast(&vp->da, sizeof(vp->da)) & (ENCODE_CACHE_SLOTS - 1)];
+}
+
+/** Record the wire image of an attribute we just encoded
+ *
+ */
+static void encode_cache_store(encode_cache_entry_t **slot, VALUE_PAIR const *vp,
+			       uint8_t const *wire, size_t wire_len)
+{
+	encode_cache_entry_t *entry;
+
+	if (wire_len > UINT8_MAX) return;
+
+	entry = talloc_zero(encode_cache, encode_cache_entry_t);
+	if (!entry) return;
+
+	entry->da = vp->da;
+	if (fr_value_box_copy(entry, &entry->value, &vp->data) < 0) {
+		talloc_free(entry);
+		return;
+	}
+
+	memcpy(entry->wire, wire, wire_len);
+	entry->wire_len = wire_len;
+
+	talloc_free(*slot);
+	*slot = entry;
+}
+
 /** Encode a data structure into a RADIUS attribute
  *
  * This is the main entry point into the encoder.  It sets up the encoder array
@@ -1447,10 +1552,38 @@ ssize_t fr_radius_encode_pair(uint8_t *out, size_t outlen, fr_cursor_t *cursor,
 	 *	Fast path for the common case.
 	 */
 	if (vp->da->parent->flags.is_root && !vp->da->flags.concat && (vp->vp_type != FR_TYPE_TLV)) {
+		encode_cache_entry_t	**slot = NULL;
+		ssize_t			len;
+
+		/*
+		 *	If we encoded the same attribute and value before,
+		 *	replay the wire image instead of re-running the
+		 *	encoder.  Static reply attributes (Reply-Message,
+		 *	policy VSAs, etc.) hit this on every packet.
+		 */
+		if (encode_cacheable(vp)) {
+			slot = encode_cache_slot(vp);
+			if (slot && *slot &&
+			    ((*slot)->da == vp->da) && ((*slot)->wire_len <= attr_len) &&
+			    (fr_value_box_cmp(&(*slot)->value, &vp->data) == 0)) {
+				memcpy(out, (*slot)->wire, (*slot)->wire_len);
+				(void) next_encodable(cursor);
+				return (*slot)->wire_len;
+			}
+		}
+
 		tlv_stack[0] = vp->da;
 		tlv_stack[1] = NULL;
 		FR_PROTO_STACK_PRINT(tlv_stack, 0);
-		return encode_rfc_hdr(out, attr_len, tlv_stack, 0, cursor, encoder_ctx);
+		len = encode_rfc_hdr(out, attr_len, tlv_stack, 0, cursor, encoder_ctx);
+
+		/*
+		 *	Only complete encodings are cached.  If the buffer
+		 *	was short the value may have been truncated to fit.
+		 */
+		if (slot && (len > 0) && (attr_len == UINT8_MAX)) encode_cache_store(slot, vp, out, (size_t)len);
+
+		return len;
 	}
 
 	/*
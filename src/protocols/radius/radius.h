@@ -79,6 +79,17 @@ size_t		fr_radius_attr_len(VALUE_PAIR const *vp);
 
 int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+
+/** One packet in a fr_radius_sign_multi() batch
+ */
+typedef struct {
+	uint8_t		*packet;	//!< Encoded packet to sign (signed in place).
+	uint8_t	const	*original;	//!< Original request if packet is a response, else NULL.
+	int		ret;		//!< Per-packet result, as returned by fr_radius_sign().
+} fr_radius_sign_entry_t;
+
+int		fr_radius_sign_multi(fr_radius_sign_entry_t entries[], size_t num_entries,
+				     uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
 				 uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
@@ -92,9 +103,65 @@ ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *sr
 ssize_t		fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
 				 char const *secret, UNUSED size_t secret_len, int code, int id, VALUE_PAIR *vps);
 
+/** Set of top-level attribute numbers a caller wants decoded
+ *
+ * Built by callers which know they only read some of a packet's
+ * attributes, e.g. an accounting listener which uses a dozen of the
+ * sixty-odd attributes a NAS sends.  Attributes outside the set
+ * aren't materialised as pairs, though the raw bytes remain in the
+ * packet buffer, so they can still be decoded later if needed.
+ *
+ * The set is keyed by the top-level attribute number only.  To decode
+ * any vendor attributes, add Vendor-Specific (26).  Callers which
+ * respond to or proxy the packet should also add State (24) and
+ * Proxy-State (33), which must be echoed back.
+ */
+typedef struct {
+	uint64_t	bits[4];		//!< One bit per top-level attribute number.
+} fr_radius_interest_t;
+
+static inline void fr_radius_interest_add(fr_radius_interest_t *interest, uint8_t attr)
+{
+	interest->bits[attr >> 6] |= ((uint64_t)1) << (attr & 0x3f);
+}
+
+static inline bool fr_radius_interest_isset(fr_radius_interest_t const *interest, uint8_t attr)
+{
+	return (interest->bits[attr >> 6] & (((uint64_t)1) << (attr & 0x3f))) != 0;
+}
+
+/** Vendors whose VSA contents the caller will reference
+ *
+ * Optional second level of filtering below #fr_radius_interest_t.
+ * When set, the contents of Vendor-Specific attributes for vendors
+ * outside the set are kept as a single raw (octets) Vendor-Specific
+ * pair, instead of being expanded into one pair per sub-TLV.  The wire
+ * bytes are preserved, so the pair still re-encodes correctly when
+ * proxied, and can be decoded in full later if it's needed after all.
+ */
+typedef struct {
+	uint32_t const	*pens;			//!< Vendor PENs the caller references.
+	size_t		num;			//!< Number of entries in pens.
+} fr_radius_vendor_interest_t;
+
+static inline bool fr_radius_vendor_interest_isset(fr_radius_vendor_interest_t const *vendors, uint32_t pen)
+{
+	size_t i;
+
+	for (i = 0; i < vendors->num; i++) if (vendors->pens[i] == pen) return true;
+
+	return false;
+}
+
 ssize_t		fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
 				 char const *secret, UNUSED size_t secret_len, VALUE_PAIR **vps) CC_HINT(nonnull);
 
+ssize_t		fr_radius_decode_filtered(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len,
+					  uint8_t const *original, char const *secret, UNUSED size_t secret_len,
+					  fr_radius_interest_t const *interest,
+					  fr_radius_vendor_interest_t const *vendor_interest,
+					  VALUE_PAIR **vps) CC_HINT(nonnull (1,2,4,5,9));
+
 int		fr_radius_init(void);
 
 void		fr_radius_free(void);
@@ -128,6 +195,12 @@ typedef struct {
 	uint8_t const		*vector;		//!< vector for encryption / decryption of data
 	char const		*secret;		//!< shared secret.  MUST be talloc'd
 	bool 			tunnel_password_zeros;
+	bool			borrowed;		//!< octets values may point into the packet
+							//!< buffer instead of being copied out of it.
+							//!< The caller MUST keep the buffer alive for
+							//!< the lifetime of the decoded pairs.
+	fr_radius_vendor_interest_t const *vendor_interest;	//!< if set, only these vendors' VSAs are
+							//!< expanded into sub-TLV pairs.
 } fr_radius_ctx_t;
 
 /*
@@ -512,9 +512,32 @@ int fr_tacacs_packet_send(RADIUS_PACKET * const packet, RADIUS_PACKET const * co
 	}
 
 	/*
-	 *	@fixme: EINTR and retry
+	 *	The reply must hit the wire as one contiguous frame.
+	 *	Replies to other sessions multiplexed over the same
+	 *	connection may be written between our calls, so a short
+	 *	write can't simply be retried by the caller.
 	 */
-	return write(packet->sockfd, packet->data, packet->data_len);
+	{
+		uint8_t const	*p = packet->data;
+		size_t		left = packet->data_len;
+
+		while (left > 0) {
+			ssize_t slen;
+
+			slen = write(packet->sockfd, p, left);
+			if (slen < 0) {
+				if (errno == EINTR) continue;
+
+				fr_strerror_printf("Failed writing TACACS reply: %s", fr_syserror(errno));
+				return -1;
+			}
+
+			p += slen;
+			left -= slen;
+		}
+	}
+
+	return packet->data_len;
 }
 
 int fr_tacacs_init(void)
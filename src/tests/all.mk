@@ -64,6 +64,51 @@ travis-test: raddb/test.conf test
 	@perl -p -i -e 's/allow_vulnerable_openssl = no/allow_vulnerable_openssl = yes/' ${raddbdir}/radiusd.conf
 	@${sbindir}/radiusd -XC
 
+#
+#  Run the packet path benchmark (decode -> process -> encode) over a
+#  corpus of raw packets, printing per-stage timings and allocation
+#  counts.
+#
+#  Point BENCHMARK_CORPUS at a fuzzer corpus (or any other raw packet
+#  files) to benchmark those instead of the canned packets.
+#
+BENCHMARK_COUNT  ?= 10000
+BENCHMARK_CORPUS ?= $(wildcard src/tests/benchmark/*.pkt)
+
+.PHONY: benchmark
+benchmark: ${BUILD_DIR}/bin/unit_test_benchmark | build.raddb
+	${Q}$(TESTBIN)/unit_test_benchmark -D share/dictionary -d src/tests/benchmark \
+		-c $(BENCHMARK_COUNT) $(BENCHMARK_CORPUS)
+
+#
+#  Replay the corpus through the decoder only, and fail if the median
+#  decode time or the allocations per packet exceed the budgets
+#  recorded in src/tests/benchmark/thresholds.txt.
+#
+#  Decode failures are counted instead of being fatal, so a fuzzer
+#  corpus (which contains intentionally malformed packets) can be
+#  replayed unchanged via BENCHMARK_CORPUS.
+#
+.PHONY: benchmark-gate
+benchmark-gate: ${BUILD_DIR}/bin/unit_test_benchmark | build.raddb
+	${Q}$(TESTBIN)/unit_test_benchmark -D share/dictionary -d src/tests/benchmark \
+		-r -t src/tests/benchmark/thresholds.txt \
+		-c $(BENCHMARK_COUNT) $(BENCHMARK_CORPUS)
+
+#
+#  Run the canned policy workload (raddb/policy.d/benchmark) through
+#  the unit_test_module harness, and report operations per second.
+#
+#  See raddb/sites-available/benchmark for benchmarking the same
+#  policy on a full running server, over the network.
+#
+BENCHMARK_POLICY_COUNT ?= 10000
+
+.PHONY: benchmark-policy
+benchmark-policy: ${BUILD_DIR}/bin/unit_test_module | build.raddb
+	${Q}$(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/benchmark \
+		-i src/tests/benchmark/benchmark.attrs -c $(BENCHMARK_POLICY_COUNT)
+
 #
 #  The tests do a lot of rooting through files, which slows down non-test builds.
 #
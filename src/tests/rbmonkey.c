@@ -231,6 +231,112 @@ again:
 	}
 	fprintf(stderr,"matched OK\n");
 	talloc_free(t);
+
+	/*
+	 * Incremental batch walk.  Build a tree of known even values,
+	 * walk it a few nodes at a time, and between batches delete a
+	 * value ahead of the cursor and insert odd values on both
+	 * sides of it.  The deletes and inserts bump the tree's
+	 * generation (forcing the re-find resume path) and cycle
+	 * nodes through the free list.  The deleted value and the
+	 * values inserted behind the cursor must not be visited,
+	 * everything else must be, exactly once, in tree order.
+	 */
+	{
+		rbtree_t	*t2;
+		rbtree_walk_t	cursor;
+		uint32_t	v, last;
+		int		rc;
+		uint8_t		present[4 * MAXSIZE];
+		uint8_t		expect[4 * MAXSIZE];
+		uint8_t		seen[4 * MAXSIZE];
+
+		memset(present, 0, sizeof(present));
+		memset(expect, 0, sizeof(expect));
+		memset(seen, 0, sizeof(seen));
+
+		t2 = rbtree_create(NULL, comp, freenode, RBTREE_FLAG_LOCK);
+
+		for (i = 1; i <= MAXSIZE / 2; i++) {
+			uint32_t *p;
+
+			p = talloc(t2, uint32_t);
+			*p = i * 2;
+			if (!rbtree_insert(t2, p)) return -1;
+			present[i * 2] = expect[i * 2] = 1;
+		}
+
+		cb_stored = 0;
+		rbtree_walk_init(&cursor, t2);
+
+		while ((rc = rbtree_walk_batch(&cursor, 7, store_cb, NULL)) == 1) {
+			last = rvals[cb_stored - 1];
+
+			/*
+			 * Delete the next value the walk would
+			 * visit.  The comparator is descending, so
+			 * "ahead" is numerically smaller.  Never the
+			 * last visited value, which anchors the walk.
+			 */
+			for (v = last; v > 0; v--) {
+				uint32_t key = v - 1;
+
+				if (!present[key]) continue;
+				if (!rbtree_deletebydata(t2, &key)) return -1;
+				present[key] = expect[key] = 0;
+				break;
+			}
+
+			/*
+			 * Odd values straddling the cursor.  The one
+			 * ahead must be visited, the one behind must
+			 * not.
+			 */
+			if ((last > 1) && !present[last - 1]) {
+				uint32_t *p;
+
+				p = talloc(t2, uint32_t);
+				*p = last - 1;
+				if (!rbtree_insert(t2, p)) return -1;
+				present[last - 1] = expect[last - 1] = 1;
+			}
+
+			if (!present[last + 1]) {
+				uint32_t *p;
+
+				p = talloc(t2, uint32_t);
+				*p = last + 1;
+				if (!rbtree_insert(t2, p)) return -1;
+				present[last + 1] = 1;
+			}
+		}
+		if (rc != 0) return -1;
+
+		for (i = 0; i < cb_stored; i++) {
+			if (i && (rvals[i - 1] <= rvals[i])) {
+				fprintf(stderr, "batch walk out of order at %i: %x %x\n",
+					i, rvals[i - 1], rvals[i]);
+				return -1;
+			}
+			if (seen[rvals[i]]) {
+				fprintf(stderr, "batch walk visited %x twice\n", rvals[i]);
+				return -1;
+			}
+			seen[rvals[i]] = 1;
+		}
+
+		for (v = 0; v < 4 * MAXSIZE; v++) {
+			if (expect[v] != seen[v]) {
+				fprintf(stderr, "batch walk %s %x\n",
+					expect[v] ? "missed" : "wrongly visited", v);
+				return -1;
+			}
+		}
+
+		fprintf(stderr, "batch walk OK\n");
+		talloc_free(t2);
+	}
+
 	goto again;
 
 bad: